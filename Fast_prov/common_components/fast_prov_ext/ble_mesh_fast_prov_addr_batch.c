@@ -0,0 +1,419 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_ble_mesh_networking_api.h"
+#include "ble_mesh_fast_prov_addr_batch.h"
+
+#define TAG "ADDR_BATCH"
+
+/* Room for the seq octet in front of the encoded addresses */
+#define BATCH_MSG_SIZE      (CONFIG_FAST_PROV_ADDR_BATCH_BYTES + 1)
+
+static struct {
+    esp_ble_mesh_model_t *model;
+    example_msg_common_info_t info;
+    uint16_t addr[CONFIG_FAST_PROV_ADDR_BATCH_MAX];
+    uint16_t count;
+    uint16_t in_flight;     /* addr[0, in_flight) are carried by the outstanding batch */
+    uint8_t  seq;
+    bool     sending;
+    SemaphoreHandle_t lock;
+    struct k_delayed_work timer;
+} batch;
+
+static inline uint8_t varint_len(uint32_t val)
+{
+    return val < 0x80 ? 1 : (val < 0x4000 ? 2 : 3);
+}
+
+static uint8_t varint_put(uint8_t *buf, uint32_t val)
+{
+    uint8_t len = 0;
+
+    while (val >= 0x80) {
+        buf[len++] = (val & 0x7F) | 0x80;
+        val >>= 7;
+    }
+    buf[len++] = val;
+    return len;
+}
+
+static int varint_get(const uint8_t *buf, uint16_t len, uint16_t *pos, uint32_t *val)
+{
+    *val = 0;
+
+    for (int shift = 0; shift < 21; shift += 7) {
+        if (*pos >= len) {
+            return -1;
+        }
+        uint8_t byte = buf[(*pos)++];
+        *val |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+uint16_t example_addr_batch_encode(const uint16_t *addr, uint16_t count,
+                                   uint8_t *buf, uint16_t size, uint16_t *used)
+{
+    uint16_t prev = 0, len = 0, i = 0;
+
+    while (i < count) {
+        uint16_t gap = addr[i] - prev, run = 1;
+        uint32_t token;
+
+        while (i + run < count && addr[i + run] - addr[i + run - 1] == gap) {
+            run++;
+        }
+
+        token = (gap << 1) | (run > 1);
+        if (len + varint_len(token) + (run > 1 ? varint_len(run - 1) : 0) > size) {
+            break;
+        }
+
+        len += varint_put(&buf[len], token);
+        if (run > 1) {
+            len += varint_put(&buf[len], run - 1);
+        }
+        prev = addr[i + run - 1];
+        i += run;
+    }
+
+    if (used) {
+        *used = i;
+    }
+    return len;
+}
+
+int example_addr_batch_decode(const uint8_t *buf, uint16_t len, uint16_t *addr, uint16_t max)
+{
+    uint32_t token, run, prev = 0;
+    uint16_t pos = 0;
+    int count = 0;
+
+    while (pos < len) {
+        if (varint_get(buf, len, &pos, &token)) {
+            return -1;
+        }
+        run = 1;
+        if ((token & 1) && varint_get(buf, len, &pos, &run) == 0) {
+            run++;
+        } else if (token & 1) {
+            return -1;
+        }
+        if ((token >> 1) == 0) {
+            return -1;
+        }
+
+        while (run--) {
+            prev += token >> 1;
+            if (!ESP_BLE_MESH_ADDR_IS_UNICAST(prev) || count >= max) {
+                return -1;
+            }
+            addr[count++] = prev;
+        }
+    }
+
+    return count;
+}
+
+static void batch_sort(void)
+{
+    /* Insertion sort, the pending addresses are mostly in provisioning order */
+    for (uint16_t i = 1; i < batch.count; i++) {
+        uint16_t val = batch.addr[i], j = i;
+        while (j > 0 && batch.addr[j - 1] > val) {
+            batch.addr[j] = batch.addr[j - 1];
+            j--;
+        }
+        batch.addr[j] = val;
+    }
+}
+
+/* A batch prepared with the lock held, sent once it is released: the client
+ * posts to the BTC task, whose ack and timeout events take the lock
+ */
+struct batch_msg {
+    esp_ble_mesh_model_t *model;
+    example_msg_common_info_t info;
+    uint8_t  data[BATCH_MSG_SIZE];
+    uint16_t len;
+    uint16_t count;
+    uint8_t  seq;
+};
+
+/* Called with the lock held, returns false if there is nothing to send */
+static bool batch_prepare(struct batch_msg *msg)
+{
+    if (batch.sending || batch.count == 0) {
+        return false;
+    }
+
+    k_delayed_work_cancel(&batch.timer);
+
+    batch_sort();
+    msg->data[0] = batch.seq;
+    msg->len = example_addr_batch_encode(batch.addr, batch.count, &msg->data[1],
+                                         CONFIG_FAST_PROV_ADDR_BATCH_BYTES, &batch.in_flight) + 1;
+    msg->model = batch.model;
+    msg->info = batch.info;
+    msg->count = batch.in_flight;
+    msg->seq = batch.seq;
+    batch.sending = true;
+    return true;
+}
+
+/* Called with the lock released */
+static esp_err_t batch_send(struct batch_msg *msg)
+{
+    esp_ble_mesh_msg_ctx_t ctx = {
+        .net_idx  = msg->info.net_idx,
+        .app_idx  = msg->info.app_idx,
+        .addr     = msg->info.dst,
+        .send_ttl = ESP_BLE_MESH_TTL_DEFAULT,
+    };
+    esp_err_t err;
+
+    err = esp_ble_mesh_client_model_send_msg(msg->model, &ctx, ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_BATCH,
+                                             msg->len, msg->data, msg->info.timeout, true, msg->info.role);
+    if (err != ESP_OK) {
+        /* Usually another message to the primary Provisioner is outstanding */
+        ESP_LOGW(TAG, "%s: Failed to send %d addresses, retry later", __func__, msg->count);
+        xSemaphoreTake(batch.lock, portMAX_DELAY);
+        if (batch.sending && batch.seq == msg->seq) {
+            batch.sending   = false;
+            batch.in_flight = 0;
+            k_delayed_work_submit(&batch.timer, CONFIG_FAST_PROV_ADDR_BATCH_LATENCY_MS);
+        }
+        xSemaphoreGive(batch.lock);
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Batch %d: %d addresses in %d octets", msg->seq, msg->count, msg->len - 1);
+    return ESP_OK;
+}
+
+static void batch_timeout(struct k_work *work)
+{
+    struct batch_msg msg;
+    bool send;
+
+    xSemaphoreTake(batch.lock, portMAX_DELAY);
+    send = batch_prepare(&msg);
+    xSemaphoreGive(batch.lock);
+
+    if (send) {
+        batch_send(&msg);
+    }
+}
+
+esp_err_t example_addr_batch_init(esp_ble_mesh_model_t *model)
+{
+    if (!model) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!batch.lock) {
+        batch.lock = xSemaphoreCreateMutex();
+        if (!batch.lock) {
+            return ESP_ERR_NO_MEM;
+        }
+        k_delayed_work_init(&batch.timer, batch_timeout);
+    }
+
+    xSemaphoreTake(batch.lock, portMAX_DELAY);
+    k_delayed_work_cancel(&batch.timer);
+    batch.model     = model;
+    batch.count     = 0;
+    batch.in_flight = 0;
+    batch.sending   = false;
+    xSemaphoreGive(batch.lock);
+
+    return ESP_OK;
+}
+
+esp_err_t example_addr_batch_add(const example_msg_common_info_t *info, uint16_t addr)
+{
+    uint8_t probe[BATCH_MSG_SIZE];
+    struct batch_msg msg;
+    uint16_t used;
+    bool send = false;
+
+    if (!batch.lock || !info || !ESP_BLE_MESH_ADDR_IS_UNICAST(addr)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(batch.lock, portMAX_DELAY);
+
+    for (uint16_t i = 0; i < batch.count; i++) {
+        if (batch.addr[i] == addr) {
+            /* Re-provisioned device, already queued */
+            xSemaphoreGive(batch.lock);
+            return ESP_OK;
+        }
+    }
+    if (batch.count == CONFIG_FAST_PROV_ADDR_BATCH_MAX) {
+        xSemaphoreGive(batch.lock);
+        ESP_LOGE(TAG, "%s: Batch is full, drop 0x%04x", __func__, addr);
+        return ESP_ERR_NO_MEM;
+    }
+
+    batch.info = *info;
+    batch.addr[batch.count++] = addr;
+
+    if (batch.sending) {
+        /* Sent with the next batch, once the outstanding one is acknowledged */
+        xSemaphoreGive(batch.lock);
+        return ESP_OK;
+    }
+
+    batch_sort();
+    example_addr_batch_encode(batch.addr, batch.count, probe, CONFIG_FAST_PROV_ADDR_BATCH_BYTES, &used);
+    if (used < batch.count || batch.count == CONFIG_FAST_PROV_ADDR_BATCH_MAX) {
+        send = batch_prepare(&msg);
+    } else if (batch.count == 1) {
+        k_delayed_work_submit(&batch.timer, CONFIG_FAST_PROV_ADDR_BATCH_LATENCY_MS);
+    }
+
+    xSemaphoreGive(batch.lock);
+    return send ? batch_send(&msg) : ESP_OK;
+}
+
+esp_err_t example_addr_batch_flush(void)
+{
+    struct batch_msg msg;
+    bool send;
+
+    if (!batch.lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(batch.lock, portMAX_DELAY);
+    send = batch_prepare(&msg);
+    xSemaphoreGive(batch.lock);
+
+    return send ? batch_send(&msg) : ESP_OK;
+}
+
+esp_err_t example_addr_batch_recv_ack(const uint8_t *msg, uint16_t len)
+{
+    uint16_t count, min, max;
+
+    if (!msg || len < 7) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(batch.lock, portMAX_DELAY);
+
+    count = msg[1] | (msg[2] << 8);
+    min   = msg[3] | (msg[4] << 8);
+    max   = msg[5] | (msg[6] << 8);
+    if (!batch.sending || msg[0] != batch.seq || count > batch.in_flight ||
+            min != batch.addr[0] || max != batch.addr[batch.in_flight - 1]) {
+        xSemaphoreGive(batch.lock);
+        ESP_LOGW(TAG, "%s: Unexpected ack of batch %d (%d, 0x%04x-0x%04x)", __func__, msg[0], count, min, max);
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (count < batch.in_flight) {
+        /* Its node table is full, sending them again would not help */
+        ESP_LOGW(TAG, "%s: %d of the %d addresses of batch %d were not stored",
+                 __func__, batch.in_flight - count, batch.in_flight, msg[0]);
+    }
+
+    memmove(batch.addr, &batch.addr[batch.in_flight], (batch.count - batch.in_flight) * sizeof(uint16_t));
+    batch.count    -= batch.in_flight;
+    batch.in_flight = 0;
+    batch.sending   = false;
+    batch.seq++;
+
+    if (batch.count) {
+        k_delayed_work_submit(&batch.timer, CONFIG_FAST_PROV_ADDR_BATCH_LATENCY_MS);
+    }
+
+    xSemaphoreGive(batch.lock);
+    return ESP_OK;
+}
+
+esp_err_t example_addr_batch_recv_timeout(void)
+{
+    xSemaphoreTake(batch.lock, portMAX_DELAY);
+    /* The same addresses are sent again, with the same seq */
+    batch.sending   = false;
+    batch.in_flight = 0;
+    k_delayed_work_submit(&batch.timer, CONFIG_FAST_PROV_ADDR_BATCH_LATENCY_MS);
+    xSemaphoreGive(batch.lock);
+
+    return ESP_OK;
+}
+
+bool example_addr_batch_busy(void)
+{
+    return batch.sending;
+}
+
+bool example_addr_batch_idle(void)
+{
+    return batch.count == 0;
+}
+
+esp_err_t example_addr_batch_recv(esp_ble_mesh_model_t *model, esp_ble_mesh_msg_ctx_t *ctx,
+                                  const uint8_t *msg, uint16_t len)
+{
+    /* Up to 2 KB, too much for the stack of the BTC task, which is the only caller */
+    static uint16_t addr[CONFIG_FAST_PROV_ADDR_BATCH_MAX];
+    uint8_t ack[7] = {0};
+    uint16_t stored = 0;
+    int count;
+
+    if (!model || !ctx || !msg || len < 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ack[0] = msg[0];
+    count = example_addr_batch_decode(&msg[1], len - 1, addr, CONFIG_FAST_PROV_ADDR_BATCH_MAX);
+    if (count < 0) {
+        /* Not acknowledged, the sender retries after its timeout */
+        ESP_LOGE(TAG, "%s: Malformed batch from 0x%04x", __func__, ctx->addr);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (example_store_remote_node_address(addr[i]) != ESP_OK) {
+            ESP_LOGE(TAG, "%s: Failed to store node address 0x%04x", __func__, addr[i]);
+            continue;
+        }
+        stored++;
+    }
+
+    /* The whole range is acknowledged, with the number of addresses stored */
+    if (count) {
+        ack[1] = stored & 0xFF;
+        ack[2] = stored >> 8;
+        ack[3] = addr[0] & 0xFF;
+        ack[4] = addr[0] >> 8;
+        ack[5] = addr[count - 1] & 0xFF;
+        ack[6] = addr[count - 1] >> 8;
+    }
+
+    return esp_ble_mesh_server_model_send_msg(model, ctx, ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_BATCH_ACK,
+                                              sizeof(ack), ack);
+}
@@ -0,0 +1,90 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BLE_MESH_FAST_PROV_ADDR_BATCH_H_
+#define _BLE_MESH_FAST_PROV_ADDR_BATCH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#include "esp_ble_mesh_defs.h"
+#include "ble_mesh_fast_prov_common.h"
+#include "ble_mesh_fast_prov_operation.h"
+
+#ifndef CONFIG_FAST_PROV_ADDR_BATCH_MAX
+#define CONFIG_FAST_PROV_ADDR_BATCH_MAX         64
+#endif
+
+#ifndef CONFIG_FAST_PROV_ADDR_BATCH_BYTES
+#define CONFIG_FAST_PROV_ADDR_BATCH_BYTES       32
+#endif
+
+#ifndef CONFIG_FAST_PROV_ADDR_BATCH_LATENCY_MS
+#define CONFIG_FAST_PROV_ADDR_BATCH_LATENCY_MS  3000
+#endif
+
+/* Node Addr Batch:     seq (1 octet), encoded addresses (variable)
+ * Node Addr Batch Ack: seq (1 octet), count (2 octets), unicast_min (2 octets),
+ *                      unicast_max (2 octets)
+ *
+ * The ack covers the whole batch, count is the number of addresses the primary
+ * Provisioner could store. Those it could not are dropped, not sent again.
+ *
+ * The addresses are sorted and sent as gaps from the previous address, each
+ * gap as a varint token (gap << 1 | run). When run is set, another varint
+ * follows with the number of extra repetitions of the same gap, so a block
+ * of consecutive addresses takes a few octets whatever its length: 100 of
+ * them from 0x0100 take 4 octets, 2 for the gap from 0 to the first address
+ * and 2 for the 99 gaps of 1, instead of 200 in Node Addr messages.
+ */
+#define ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_BATCH     ESP_BLE_MESH_MODEL_OP_3(0x0E, CID_ESP)
+#define ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_BATCH_ACK ESP_BLE_MESH_MODEL_OP_3(0x0F, CID_ESP)
+
+/* Encodes the sorted, duplicate-free addresses which fit in size octets.
+ * Returns the encoded length and sets *used to the number of addresses.
+ */
+uint16_t example_addr_batch_encode(const uint16_t *addr, uint16_t count,
+                                   uint8_t *buf, uint16_t size, uint16_t *used);
+
+/* Returns the number of decoded addresses, or -1 if buf is malformed */
+int example_addr_batch_decode(const uint8_t *buf, uint16_t len, uint16_t *addr, uint16_t max);
+
+/* Provisioners other than the primary one. Addresses are sent to info->dst
+ * once CONFIG_FAST_PROV_ADDR_BATCH_BYTES are pending, or
+ * CONFIG_FAST_PROV_ADDR_BATCH_LATENCY_MS after the first one was queued.
+ */
+esp_err_t example_addr_batch_init(esp_ble_mesh_model_t *model);
+
+esp_err_t example_addr_batch_add(const example_msg_common_info_t *info, uint16_t addr);
+
+esp_err_t example_addr_batch_flush(void);
+
+esp_err_t example_addr_batch_recv_ack(const uint8_t *msg, uint16_t len);
+
+esp_err_t example_addr_batch_recv_timeout(void);
+
+bool example_addr_batch_busy(void);
+
+/* Every queued address has been acknowledged */
+bool example_addr_batch_idle(void);
+
+/* Primary Provisioner, stores the addresses of a Node Addr Batch with
+ * example_store_remote_node_address() and acknowledges their range, even if
+ * some of them could not be stored.
+ */
+esp_err_t example_addr_batch_recv(esp_ble_mesh_model_t *model, esp_ble_mesh_msg_ctx_t *ctx,
+                                  const uint8_t *msg, uint16_t len);
+
+#endif /* _BLE_MESH_FAST_PROV_ADDR_BATCH_H_ */
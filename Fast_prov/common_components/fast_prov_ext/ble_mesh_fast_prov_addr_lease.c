@@ -0,0 +1,526 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_system.h"
+
+#include "esp_ble_mesh_networking_api.h"
+#include "ble_mesh_fast_prov_addr_lease.h"
+
+#define TAG "ADDR_LEASE"
+
+#define LEASE_NIL   0
+
+/* Node 0 is the nil node, so child links fit in 16 bits */
+typedef struct {
+    uint16_t min;
+    uint16_t max;
+    uint16_t left;
+    uint16_t right;
+    uint16_t span;      /* Longest range in the subtree */
+    uint16_t prio;
+} lease_node_t;
+
+static struct {
+    lease_node_t node[CONFIG_FAST_PROV_LEASE_MAX_RANGES + 1];
+    uint16_t root;
+    uint16_t free_list;     /* Unused nodes, linked through right */
+    uint16_t ranges;
+    uint16_t avail;
+} pool;
+
+static struct {
+    esp_ble_mesh_model_t *model;
+    example_msg_common_info_t info;
+    uint32_t pend_op;       /* Opcode of the outstanding message, 0 if none */
+    uint16_t ret_min;       /* Range carried by the last Lease Return */
+    uint16_t ret_max;
+    bool ret_held;          /* ret_min..ret_max is out of the pool and not acknowledged yet */
+} lease_cli;
+
+static inline uint16_t range_len(uint16_t t)
+{
+    return pool.node[t].max - pool.node[t].min + 1;
+}
+
+static void node_update(uint16_t t)
+{
+    lease_node_t *n = &pool.node[t];
+    uint16_t span = range_len(t);
+
+    if (n->left && pool.node[n->left].span > span) {
+        span = pool.node[n->left].span;
+    }
+    if (n->right && pool.node[n->right].span > span) {
+        span = pool.node[n->right].span;
+    }
+    n->span = span;
+}
+
+/* Splits t into the ranges starting below key (l) and the others (r) */
+static void treap_split(uint16_t t, uint16_t key, uint16_t *l, uint16_t *r)
+{
+    if (t == LEASE_NIL) {
+        *l = *r = LEASE_NIL;
+        return;
+    }
+
+    if (pool.node[t].min < key) {
+        treap_split(pool.node[t].right, key, &pool.node[t].right, r);
+        *l = t;
+    } else {
+        treap_split(pool.node[t].left, key, l, &pool.node[t].left);
+        *r = t;
+    }
+    node_update(t);
+}
+
+/* Every range of l must start below every range of r */
+static uint16_t treap_merge(uint16_t l, uint16_t r)
+{
+    if (l == LEASE_NIL) {
+        return r;
+    }
+    if (r == LEASE_NIL) {
+        return l;
+    }
+
+    if (pool.node[l].prio > pool.node[r].prio) {
+        pool.node[l].right = treap_merge(pool.node[l].right, r);
+        node_update(l);
+        return l;
+    }
+    pool.node[r].left = treap_merge(l, pool.node[r].left);
+    node_update(r);
+    return r;
+}
+
+static uint16_t node_alloc(uint16_t min, uint16_t max)
+{
+    uint16_t t = pool.free_list;
+
+    if (t == LEASE_NIL) {
+        return LEASE_NIL;
+    }
+
+    pool.free_list = pool.node[t].right;
+    pool.node[t].min   = min;
+    pool.node[t].max   = max;
+    pool.node[t].left  = LEASE_NIL;
+    pool.node[t].right = LEASE_NIL;
+    pool.node[t].prio  = esp_random() & 0xFFFF;
+    node_update(t);
+    pool.ranges++;
+    return t;
+}
+
+static void node_release(uint16_t t)
+{
+    pool.node[t].left  = LEASE_NIL;
+    pool.node[t].right = pool.free_list;
+    pool.free_list = t;
+    pool.ranges--;
+}
+
+void example_addr_lease_reset(void)
+{
+    memset(&pool, 0, sizeof(pool));
+    for (uint16_t i = CONFIG_FAST_PROV_LEASE_MAX_RANGES; i > 0; i--) {
+        pool.node[i].right = pool.free_list;
+        pool.free_list = i;
+    }
+
+    /* A range being returned belongs to the previous address space */
+    lease_cli.ret_held = false;
+}
+
+esp_err_t example_addr_lease_free(uint16_t min, uint16_t max)
+{
+    uint16_t l, r, pred = LEASE_NIL, succ = LEASE_NIL, t;
+
+    if (min > max || !ESP_BLE_MESH_ADDR_IS_UNICAST(min) || !ESP_BLE_MESH_ADDR_IS_UNICAST(max)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (pool.free_list == LEASE_NIL && pool.ranges == 0) {
+        /* Never reset, the node pool has not been linked yet */
+        example_addr_lease_reset();
+    }
+
+    treap_split(pool.root, min, &l, &r);
+
+    for (t = l; t != LEASE_NIL; t = pool.node[t].right) {
+        pred = t;
+    }
+    for (t = r; t != LEASE_NIL; t = pool.node[t].left) {
+        succ = t;
+    }
+
+    if ((pred && pool.node[pred].max >= min) || (succ && pool.node[succ].min <= max)) {
+        pool.root = treap_merge(l, r);
+        ESP_LOGW(TAG, "%s: 0x%04x-0x%04x overlaps a free range", __func__, min, max);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    pool.avail += max - min + 1;
+
+    /* Coalesce with the neighbours, reusing their nodes */
+    if (pred && pool.node[pred].max + 1 == min) {
+        treap_split(l, pool.node[pred].min, &l, &t);
+        min = pool.node[pred].min;
+        node_release(pred);
+    }
+    if (succ && pool.node[succ].min == max + 1) {
+        treap_split(r, pool.node[succ].min + 1, &t, &r);
+        max = pool.node[succ].max;
+        node_release(succ);
+    }
+
+    t = node_alloc(min, max);
+    if (t == LEASE_NIL) {
+        /* Only possible without coalescing, so nothing has been released */
+        pool.avail -= max - min + 1;
+        pool.root = treap_merge(l, r);
+        ESP_LOGE(TAG, "%s: Too many free ranges", __func__);
+        return ESP_ERR_NO_MEM;
+    }
+
+    pool.root = treap_merge(treap_merge(l, t), r);
+    return ESP_OK;
+}
+
+esp_err_t example_addr_lease_alloc(uint16_t count, uint16_t *min, uint16_t *max)
+{
+    uint16_t t = pool.root, l, m, r;
+
+    if (!min || !max || count == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (t == LEASE_NIL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (pool.node[t].span < count) {
+        count = pool.node[t].span;
+    }
+
+    /* Leftmost range which is long enough, guided by the subtree spans */
+    for (;;) {
+        uint16_t left = pool.node[t].left;
+        if (left && pool.node[left].span >= count) {
+            t = left;
+        } else if (range_len(t) >= count) {
+            break;
+        } else {
+            t = pool.node[t].right;
+        }
+    }
+
+    *min = pool.node[t].min;
+    *max = pool.node[t].min + count - 1;
+    pool.avail -= count;
+
+    treap_split(pool.root, pool.node[t].min, &l, &r);
+    treap_split(r, pool.node[t].min + 1, &m, &r);
+    if (range_len(m) == count) {
+        node_release(m);
+        m = LEASE_NIL;
+    } else {
+        pool.node[m].min += count;
+        node_update(m);
+    }
+    pool.root = treap_merge(treap_merge(l, m), r);
+
+    return ESP_OK;
+}
+
+uint16_t example_addr_lease_avail(void)
+{
+    return pool.avail;
+}
+
+uint16_t example_addr_lease_ranges(void)
+{
+    return pool.ranges;
+}
+
+/* First free range ending at or after addr */
+static uint16_t lease_find_from(uint16_t addr)
+{
+    uint16_t t = pool.root, found = LEASE_NIL;
+
+    while (t != LEASE_NIL) {
+        if (pool.node[t].max >= addr) {
+            found = t;
+            t = pool.node[t].left;
+        } else {
+            t = pool.node[t].right;
+        }
+    }
+    return found;
+}
+
+/* Frees the parts of min..max which are not free yet. Each of them touches
+ * a free range and is merged into it, so no node is needed.
+ */
+static esp_err_t lease_free_uncovered(uint16_t min, uint16_t max)
+{
+    uint16_t addr = min, t, end;
+    esp_err_t err;
+
+    while (addr <= max) {
+        t = lease_find_from(addr);
+        if (t == LEASE_NIL || pool.node[t].min > max) {
+            return example_addr_lease_free(addr, max);
+        }
+        end = pool.node[t].max;
+        if (pool.node[t].min > addr) {
+            err = example_addr_lease_free(addr, pool.node[t].min - 1);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+        if (end >= max) {
+            break;
+        }
+        addr = end + 1;
+    }
+    return ESP_OK;
+}
+
+esp_err_t example_addr_lease_recv_get(esp_ble_mesh_model_t *model, esp_ble_mesh_msg_ctx_t *ctx,
+                                      const uint8_t *msg, uint16_t len)
+{
+    uint8_t status[5] = {FAST_PROV_LEASE_STATUS_NO_ADDR};
+    uint16_t count, min, max;
+
+    if (!model || !ctx || !msg || len < 2) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    count = msg[0] | (msg[1] << 8);
+    if (count > CONFIG_FAST_PROV_LEASE_MAX_GRANT) {
+        /* Otherwise a single request could take the whole pool */
+        count = CONFIG_FAST_PROV_LEASE_MAX_GRANT;
+    }
+    if (count == 0) {
+        status[0] = FAST_PROV_LEASE_STATUS_INVALID;
+    } else if (example_addr_lease_alloc(count, &min, &max) == ESP_OK) {
+        ESP_LOGI(TAG, "Lease 0x%04x-0x%04x to 0x%04x", min, max, ctx->addr);
+        status[0] = FAST_PROV_LEASE_STATUS_SUCCESS;
+        status[1] = min & 0xFF;
+        status[2] = min >> 8;
+        status[3] = max & 0xFF;
+        status[4] = max >> 8;
+    } else {
+        ESP_LOGW(TAG, "No address left to lease to 0x%04x", ctx->addr);
+    }
+
+    return esp_ble_mesh_server_model_send_msg(model, ctx, ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_STATUS,
+                                              sizeof(status), status);
+}
+
+esp_err_t example_addr_lease_recv_return(esp_ble_mesh_model_t *model, esp_ble_mesh_msg_ctx_t *ctx,
+                                         const uint8_t *msg, uint16_t len)
+{
+    uint8_t status = FAST_PROV_LEASE_STATUS_SUCCESS;
+    uint16_t min, max;
+    esp_err_t err;
+
+    if (!model || !ctx || !msg || len < 4) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    min = msg[0] | (msg[1] << 8);
+    max = msg[2] | (msg[3] << 8);
+    err = example_addr_lease_free(min, max);
+    if (err == ESP_ERR_INVALID_STATE) {
+        /* Returned twice, or overlapping a range returned before: only the
+         * addresses which are not free yet go back to the pool.
+         */
+        ESP_LOGW(TAG, "0x%04x-0x%04x from 0x%04x is partly free", min, max, ctx->addr);
+        err = lease_free_uncovered(min, max);
+    }
+    switch (err) {
+    case ESP_OK:
+        ESP_LOGI(TAG, "0x%04x returned 0x%04x-0x%04x", ctx->addr, min, max);
+        break;
+    case ESP_ERR_NO_MEM:
+        /* The sender keeps the range until the free ranges have been merged */
+        ESP_LOGW(TAG, "No room for 0x%04x-0x%04x from 0x%04x", min, max, ctx->addr);
+        status = FAST_PROV_LEASE_STATUS_NO_ROOM;
+        break;
+    default:
+        status = FAST_PROV_LEASE_STATUS_INVALID;
+        break;
+    }
+
+    return esp_ble_mesh_server_model_send_msg(model, ctx, ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN_ACK,
+                                              sizeof(status), &status);
+}
+
+static esp_err_t lease_cli_send(uint32_t opcode, uint8_t *data, uint16_t len)
+{
+    esp_ble_mesh_msg_ctx_t ctx = {
+        .net_idx  = lease_cli.info.net_idx,
+        .app_idx  = lease_cli.info.app_idx,
+        .addr     = lease_cli.info.dst,
+        .send_ttl = ESP_BLE_MESH_TTL_DEFAULT,
+    };
+    esp_err_t err;
+
+    err = esp_ble_mesh_client_model_send_msg(lease_cli.model, &ctx, opcode, len, data,
+                                             lease_cli.info.timeout, true, lease_cli.info.role);
+    if (err == ESP_OK) {
+        lease_cli.pend_op = opcode;
+    }
+    return err;
+}
+
+esp_err_t example_addr_lease_send_get(esp_ble_mesh_model_t *model,
+                                      const example_msg_common_info_t *info, uint16_t count)
+{
+    uint8_t data[2] = {count & 0xFF, count >> 8};
+
+    if (!model || !info || count == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (lease_cli.pend_op) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    lease_cli.model = model;
+    lease_cli.info  = *info;
+    return lease_cli_send(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_GET, data, sizeof(data));
+}
+
+/* Puts the range of a Lease Return which was not accepted back into the pool.
+ * If no node is left for it, it stays held and is the next one returned.
+ */
+static void lease_return_restore(void)
+{
+    if (!lease_cli.ret_held) {
+        return;
+    }
+
+    if (example_addr_lease_free(lease_cli.ret_min, lease_cli.ret_max) == ESP_ERR_NO_MEM) {
+        ESP_LOGW(TAG, "%s: Holding 0x%04x-0x%04x until the next Lease Return",
+                 __func__, lease_cli.ret_min, lease_cli.ret_max);
+        return;
+    }
+    lease_cli.ret_held = false;
+}
+
+static esp_err_t lease_return_next(void)
+{
+    uint8_t data[4];
+    esp_err_t err;
+
+    if (!lease_cli.ret_held) {
+        if (example_addr_lease_alloc(pool.root ? pool.node[pool.root].span : 1,
+                                     &lease_cli.ret_min, &lease_cli.ret_max) != ESP_OK) {
+            /* Everything has been returned */
+            lease_cli.pend_op = 0;
+            return ESP_OK;
+        }
+        lease_cli.ret_held = true;
+    }
+
+    data[0] = lease_cli.ret_min & 0xFF;
+    data[1] = lease_cli.ret_min >> 8;
+    data[2] = lease_cli.ret_max & 0xFF;
+    data[3] = lease_cli.ret_max >> 8;
+    err = lease_cli_send(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN, data, sizeof(data));
+    if (err != ESP_OK) {
+        lease_return_restore();
+        lease_cli.pend_op = 0;
+    }
+    return err;
+}
+
+esp_err_t example_addr_lease_send_return(esp_ble_mesh_model_t *model,
+                                         const example_msg_common_info_t *info)
+{
+    if (!model || !info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (lease_cli.pend_op) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    lease_cli.model = model;
+    lease_cli.info  = *info;
+    return lease_return_next();
+}
+
+esp_err_t example_addr_lease_recv_status(uint32_t opcode, const uint8_t *msg, uint16_t len)
+{
+    uint16_t min, max;
+
+    if (!msg || len < 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if ((opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_STATUS &&
+            lease_cli.pend_op != ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_GET) ||
+        (opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN_ACK &&
+            lease_cli.pend_op != ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    lease_cli.pend_op = 0;
+
+    switch (opcode) {
+    case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_STATUS:
+        if (msg[0] != FAST_PROV_LEASE_STATUS_SUCCESS || len < 5) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        min = msg[1] | (msg[2] << 8);
+        max = msg[3] | (msg[4] << 8);
+        ESP_LOGI(TAG, "Leased 0x%04x-0x%04x", min, max);
+        return example_addr_lease_free(min, max);
+    case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN_ACK:
+        if (msg[0] == FAST_PROV_LEASE_STATUS_NO_ROOM) {
+            /* Try again with the next Lease Return */
+            lease_return_restore();
+            return ESP_ERR_NO_MEM;
+        }
+        if (msg[0] != FAST_PROV_LEASE_STATUS_SUCCESS) {
+            ESP_LOGW(TAG, "%s: 0x%04x-0x%04x rejected", __func__, lease_cli.ret_min, lease_cli.ret_max);
+        }
+        lease_cli.ret_held = false;
+        return lease_return_next();
+    default:
+        return ESP_ERR_INVALID_ARG;
+    }
+}
+
+esp_err_t example_addr_lease_recv_timeout(uint32_t opcode)
+{
+    if (opcode != lease_cli.pend_op) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN) {
+        /* Keep the range, it is returned again next time */
+        lease_return_restore();
+    }
+    lease_cli.pend_op = 0;
+
+    return ESP_OK;
+}
+
+bool example_addr_lease_busy(void)
+{
+    return lease_cli.pend_op != 0;
+}
@@ -0,0 +1,109 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BLE_MESH_FAST_PROV_ADDR_LEASE_H_
+#define _BLE_MESH_FAST_PROV_ADDR_LEASE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#include "esp_ble_mesh_defs.h"
+#include "ble_mesh_fast_prov_common.h"
+#include "ble_mesh_fast_prov_operation.h"
+
+#ifndef CONFIG_FAST_PROV_LEASE_MAX_RANGES
+#define CONFIG_FAST_PROV_LEASE_MAX_RANGES   32
+#endif
+
+#ifndef CONFIG_FAST_PROV_LEASE_BLOCK
+#define CONFIG_FAST_PROV_LEASE_BLOCK        4
+#endif
+
+#ifndef CONFIG_FAST_PROV_LEASE_MAX_GRANT
+#define CONFIG_FAST_PROV_LEASE_MAX_GRANT    256
+#endif
+
+/* Address lease messages, exchanged between a Provisioner which ran out of
+ * unicast addresses to hand out and the primary Provisioner.
+ *
+ * Lease Get:        count (2 octets)
+ * Lease Status:     status (1 octet), unicast_min (2 octets), unicast_max (2 octets)
+ * Lease Return:     unicast_min (2 octets), unicast_max (2 octets)
+ * Lease Return Ack: status (1 octet)
+ */
+#define ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_GET           ESP_BLE_MESH_MODEL_OP_3(0x0A, CID_ESP)
+#define ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_STATUS        ESP_BLE_MESH_MODEL_OP_3(0x0B, CID_ESP)
+#define ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN        ESP_BLE_MESH_MODEL_OP_3(0x0C, CID_ESP)
+#define ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN_ACK    ESP_BLE_MESH_MODEL_OP_3(0x0D, CID_ESP)
+
+#define FAST_PROV_LEASE_STATUS_SUCCESS  0x00
+#define FAST_PROV_LEASE_STATUS_NO_ADDR  0x01
+#define FAST_PROV_LEASE_STATUS_INVALID  0x02
+#define FAST_PROV_LEASE_STATUS_NO_ROOM  0x03    /* Return Ack only, the range was not taken back */
+
+/* Free unicast addresses are kept as disjoint [min, max] ranges in a treap
+ * ordered by min, where every node also records the longest range of its
+ * subtree. Allocation (first fit) and release (with coalescing of adjacent
+ * ranges) are both O(log n) in the number of free ranges.
+ *
+ * example_addr_lease_reset() empties the pool, e.g. when the address space
+ * of the Provisioner changes.
+ */
+void example_addr_lease_reset(void);
+
+/* Adds [min, max] to the free ranges. Fails with ESP_ERR_INVALID_STATE if any
+ * address of it is already free.
+ */
+esp_err_t example_addr_lease_free(uint16_t min, uint16_t max);
+
+/* Takes count addresses from the lowest free range that can hold them. If no
+ * range is large enough, the largest one is handed out instead.
+ */
+esp_err_t example_addr_lease_alloc(uint16_t count, uint16_t *min, uint16_t *max);
+
+uint16_t example_addr_lease_avail(void);
+
+uint16_t example_addr_lease_ranges(void);
+
+/* Primary Provisioner, handles Lease Get and Lease Return. A Lease Get is
+ * granted at most CONFIG_FAST_PROV_LEASE_MAX_GRANT addresses.
+ */
+esp_err_t example_addr_lease_recv_get(esp_ble_mesh_model_t *model, esp_ble_mesh_msg_ctx_t *ctx,
+                                      const uint8_t *msg, uint16_t len);
+
+esp_err_t example_addr_lease_recv_return(esp_ble_mesh_model_t *model, esp_ble_mesh_msg_ctx_t *ctx,
+                                         const uint8_t *msg, uint16_t len);
+
+/* Other Provisioners. Only one lease message is outstanding at a time. */
+esp_err_t example_addr_lease_send_get(esp_ble_mesh_model_t *model,
+                                      const example_msg_common_info_t *info, uint16_t count);
+
+/* Returns every free range to info->dst, one Lease Return at a time. */
+esp_err_t example_addr_lease_send_return(esp_ble_mesh_model_t *model,
+                                         const example_msg_common_info_t *info);
+
+/* Handles Lease Status and Lease Return Ack. For Lease Status, ESP_OK means the
+ * granted range has been added to the free ranges, ESP_ERR_NOT_FOUND that the
+ * primary Provisioner has no address left. For Lease Return Ack,
+ * ESP_ERR_NO_MEM means the primary Provisioner could not take the range back;
+ * it is kept and returning stops until the next example_addr_lease_send_return().
+ */
+esp_err_t example_addr_lease_recv_status(uint32_t opcode, const uint8_t *msg, uint16_t len);
+
+esp_err_t example_addr_lease_recv_timeout(uint32_t opcode);
+
+bool example_addr_lease_busy(void);
+
+#endif /* _BLE_MESH_FAST_PROV_ADDR_LEASE_H_ */
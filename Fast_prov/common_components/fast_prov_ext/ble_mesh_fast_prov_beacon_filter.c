@@ -0,0 +1,167 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include "ble_mesh_fast_prov_common.h"
+#include "ble_mesh_fast_prov_node_index.h"
+#include "ble_mesh_fast_prov_beacon_filter.h"
+
+#define FILTER_BITS     (1U << CONFIG_FAST_PROV_BEACON_FILTER_BITS)
+#define FILTER_WORDS    (FILTER_BITS / 32)
+#define FILTER_PROBES   3
+#define FILTER_TAGS     (FILTER_BITS / 16)
+#define FILTER_WAYS     4
+#define FILTER_SETS     (FILTER_TAGS / FILTER_WAYS)
+
+static struct {
+    uint32_t gen[2][FILTER_WORDS];
+    /* FILTER_WAYS-way set associative, so that devices whose fingerprints fall
+     * in the same place do not keep evicting each other. A fingerprint expires
+     * with its generation, otherwise a device added long ago would be dropped
+     * whenever other devices happen to set its bits.
+     */
+    uint32_t tag[FILTER_TAGS];
+    uint16_t tag_epoch[FILTER_TAGS];    /* Generation each fingerprint was last added in */
+    uint16_t epoch;                     /* Generation of gen[cur] */
+    uint8_t  cur;
+    uint32_t window_ms;
+    uint32_t rotate_ms;     /* Time of the last generation switch */
+    example_beacon_filter_stats_t stats;
+} filter;
+
+static inline uint16_t tag_age(uint32_t t)
+{
+    return filter.epoch - filter.tag_epoch[t];
+}
+
+static inline bool tag_live(uint32_t t)
+{
+    return filter.tag[t] && tag_age(t) <= 1;
+}
+
+/* Slot of the fingerprint of hash in its set of FILTER_WAYS, or -1 */
+static int tag_find(uint32_t hash)
+{
+    uint32_t set = (hash % FILTER_SETS) * FILTER_WAYS;
+
+    for (uint32_t t = set; t < set + FILTER_WAYS; t++) {
+        if (filter.tag[t] == hash && tag_live(t)) {
+            return t;
+        }
+    }
+    return -1;
+}
+
+static inline uint32_t probe_bit(uint32_t hash, int i)
+{
+    /* Double hashing, the second hash is forced odd to cover the whole filter */
+    uint32_t h2 = (hash * 0x9E3779B1U) | 1;
+
+    return (hash + i * h2) & (FILTER_BITS - 1);
+}
+
+static void filter_age(void)
+{
+    uint32_t now = k_uptime_get_32();
+
+    if (now - filter.rotate_ms < filter.window_ms) {
+        return;
+    }
+
+    /* Two windows without a rotation means both generations are stale */
+    if (now - filter.rotate_ms >= 2 * filter.window_ms) {
+        memset(filter.gen[filter.cur], 0, sizeof(filter.gen[0]));
+        filter.epoch++;
+    }
+    filter.cur ^= 1;
+    filter.epoch++;
+    memset(filter.gen[filter.cur], 0, sizeof(filter.gen[0]));
+    filter.rotate_ms = now;
+}
+
+static bool gen_test(const uint32_t *gen, uint32_t hash)
+{
+    for (int i = 0; i < FILTER_PROBES; i++) {
+        uint32_t bit = probe_bit(hash, i);
+        if (!(gen[bit / 32] & (1U << (bit % 32)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void example_beacon_filter_init(uint32_t window_ms)
+{
+    memset(&filter, 0, sizeof(filter));
+    filter.window_ms = window_ms ? window_ms : CONFIG_FAST_PROV_BEACON_WINDOW_MS;
+    filter.rotate_ms = k_uptime_get_32();
+}
+
+bool example_beacon_filter_seen(const uint8_t uuid[16])
+{
+    uint32_t hash = example_node_index_uuid_hash(uuid);
+
+    filter_age();
+
+    if (gen_test(filter.gen[filter.cur], hash) || gen_test(filter.gen[filter.cur ^ 1], hash)) {
+        if (tag_find(hash) >= 0) {
+            filter.stats.dropped++;
+            return true;
+        }
+        /* Bits set by other devices, or the fingerprint has been replaced since */
+        filter.stats.false_positive++;
+    }
+
+    filter.stats.accepted++;
+    return false;
+}
+
+void example_beacon_filter_add(const uint8_t uuid[16])
+{
+    uint32_t hash = example_node_index_uuid_hash(uuid);
+    uint32_t set, t, oldest;
+    int slot;
+
+    filter_age();
+
+    for (int i = 0; i < FILTER_PROBES; i++) {
+        uint32_t bit = probe_bit(hash, i);
+        filter.gen[filter.cur][bit / 32] |= (1U << (bit % 32));
+    }
+
+    /* Otherwise it takes a free slot of the set, or the one of the oldest fingerprint */
+    slot = tag_find(hash);
+    if (slot < 0) {
+        set = (hash % FILTER_SETS) * FILTER_WAYS;
+        oldest = set;
+        for (t = set; t < set + FILTER_WAYS; t++) {
+            if (!tag_live(t)) {
+                oldest = t;
+                break;
+            }
+            if (tag_age(t) > tag_age(oldest)) {
+                oldest = t;
+            }
+        }
+        slot = oldest;
+        filter.tag[slot] = hash;
+    }
+    filter.tag_epoch[slot] = filter.epoch;
+}
+
+void example_beacon_filter_get_stats(example_beacon_filter_stats_t *stats)
+{
+    if (stats) {
+        memcpy(stats, &filter.stats, sizeof(example_beacon_filter_stats_t));
+    }
+}
@@ -0,0 +1,54 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BLE_MESH_FAST_PROV_BEACON_FILTER_H_
+#define _BLE_MESH_FAST_PROV_BEACON_FILTER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#ifndef CONFIG_FAST_PROV_BEACON_FILTER_BITS
+#define CONFIG_FAST_PROV_BEACON_FILTER_BITS     10
+#endif
+
+#ifndef CONFIG_FAST_PROV_BEACON_WINDOW_MS
+#define CONFIG_FAST_PROV_BEACON_WINDOW_MS       2000
+#endif
+
+/* Drops repeated unprovisioned device beacons of a device which has already
+ * been handed to the stack within the last window. Membership is kept in two
+ * Bloom filter generations of 2^CONFIG_FAST_PROV_BEACON_FILTER_BITS bits each:
+ * the older one is cleared every window, so a device is remembered for one to
+ * two windows without storing any timestamp. A Bloom hit is confirmed against
+ * a table of 32-bit fingerprints, which expire with the generation they were
+ * added in; a hit which is not confirmed is counted as a false positive and the
+ * beacon is let through.
+ */
+typedef struct {
+    uint32_t accepted;
+    uint32_t dropped;
+    uint32_t false_positive;
+} example_beacon_filter_stats_t;
+
+void example_beacon_filter_init(uint32_t window_ms);
+
+/* Returns true if the beacon repeats one of a device added within the window */
+bool example_beacon_filter_seen(const uint8_t uuid[16]);
+
+/* Records a device which has been added to the unprovisioned device queue */
+void example_beacon_filter_add(const uint8_t uuid[16]);
+
+void example_beacon_filter_get_stats(example_beacon_filter_stats_t *stats);
+
+#endif /* _BLE_MESH_FAST_PROV_BEACON_FILTER_H_ */
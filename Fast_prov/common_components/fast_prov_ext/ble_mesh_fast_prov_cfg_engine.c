@@ -0,0 +1,555 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_system.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_ble_mesh_defs.h"
+#include "ble_mesh_fast_prov_common.h"
+#include "ble_mesh_fast_prov_cfg_engine.h"
+
+#define TAG "CFG_ENGINE"
+
+#define CFG_WINDOW_MAX      16
+#define CFG_CTX_NUM         CONFIG_BLE_MESH_MAX_PROV_NODES
+#define CFG_HEAP_NONE       0xFFFF
+
+typedef struct {
+    example_node_info_t *node;
+    uint16_t addr;
+    uint16_t heap_pos;      /* Position in the queue of its step, CFG_HEAP_NONE if not queued */
+    uint8_t  step;
+    uint8_t  attempts;
+    bool     in_use;
+    bool     in_flight;
+    uint32_t due_ms;
+    uint32_t start_ms;
+} cfg_ctx_t;
+
+/* Messages and results picked with the lock held, handed to send() and
+ * complete() once it is released: both post to the BTC task, whose callbacks
+ * take the lock in turn.
+ */
+typedef struct {
+    struct {
+        example_node_info_t *node;
+        uint16_t idx;
+        uint16_t addr;
+        uint8_t  step;
+    } send[CFG_WINDOW_MAX];
+    uint8_t send_len;
+    struct {
+        example_node_info_t *node;
+        esp_err_t result;
+    } done[CFG_WINDOW_MAX + 1];
+    uint8_t done_len;
+} cfg_out_t;
+
+/* One binary min-heap on due_ms per step. Picking the highest ready step first
+ * gives the step priority, and the heap keeps retries in deadline order.
+ */
+typedef struct {
+    uint16_t item[CFG_CTX_NUM];
+    uint16_t len;
+} cfg_heap_t;
+
+static struct {
+    example_cfg_engine_config_t config;
+    cfg_ctx_t  ctx[CFG_CTX_NUM];
+    cfg_heap_t queue[FAST_PROV_CFG_STEP_DONE];
+    uint16_t   in_flight[CFG_WINDOW_MAX];
+    uint8_t    in_flight_len;
+    example_cfg_engine_stats_t stats;
+    SemaphoreHandle_t lock;
+    struct k_delayed_work timer;
+    bool       init;
+} engine;
+
+static inline bool time_before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+static void heap_swap(cfg_heap_t *heap, uint16_t i, uint16_t j)
+{
+    uint16_t tmp = heap->item[i];
+
+    heap->item[i] = heap->item[j];
+    heap->item[j] = tmp;
+    engine.ctx[heap->item[i]].heap_pos = i;
+    engine.ctx[heap->item[j]].heap_pos = j;
+}
+
+static inline bool heap_less(const cfg_heap_t *heap, uint16_t i, uint16_t j)
+{
+    return time_before(engine.ctx[heap->item[i]].due_ms, engine.ctx[heap->item[j]].due_ms);
+}
+
+static void heap_sift_up(cfg_heap_t *heap, uint16_t i)
+{
+    while (i > 0) {
+        uint16_t parent = (i - 1) / 2;
+        if (!heap_less(heap, i, parent)) {
+            break;
+        }
+        heap_swap(heap, i, parent);
+        i = parent;
+    }
+}
+
+static void heap_sift_down(cfg_heap_t *heap, uint16_t i)
+{
+    for (;;) {
+        uint16_t left = 2 * i + 1, right = left + 1, min = i;
+        if (left < heap->len && heap_less(heap, left, min)) {
+            min = left;
+        }
+        if (right < heap->len && heap_less(heap, right, min)) {
+            min = right;
+        }
+        if (min == i) {
+            break;
+        }
+        heap_swap(heap, i, min);
+        i = min;
+    }
+}
+
+static void heap_push(uint16_t idx)
+{
+    cfg_ctx_t *ctx = &engine.ctx[idx];
+    cfg_heap_t *heap = &engine.queue[ctx->step];
+
+    ctx->heap_pos = heap->len;
+    heap->item[heap->len++] = idx;
+    heap_sift_up(heap, ctx->heap_pos);
+}
+
+static void heap_remove(uint16_t idx)
+{
+    cfg_ctx_t *ctx = &engine.ctx[idx];
+    cfg_heap_t *heap = &engine.queue[ctx->step];
+    uint16_t pos = ctx->heap_pos;
+
+    if (pos == CFG_HEAP_NONE) {
+        return;
+    }
+
+    ctx->heap_pos = CFG_HEAP_NONE;
+    if (pos != --heap->len) {
+        heap->item[pos] = heap->item[heap->len];
+        engine.ctx[heap->item[pos]].heap_pos = pos;
+        heap_sift_down(heap, pos);
+        heap_sift_up(heap, pos);
+    }
+}
+
+static void in_flight_remove(uint16_t idx)
+{
+    for (uint8_t i = 0; i < engine.in_flight_len; i++) {
+        if (engine.in_flight[i] == idx) {
+            engine.in_flight[i] = engine.in_flight[--engine.in_flight_len];
+            break;
+        }
+    }
+    engine.ctx[idx].in_flight = false;
+}
+
+static int in_flight_find(uint16_t addr, uint8_t step)
+{
+    for (uint8_t i = 0; i < engine.in_flight_len; i++) {
+        cfg_ctx_t *ctx = &engine.ctx[engine.in_flight[i]];
+        if (ctx->addr == addr && ctx->step == step) {
+            return engine.in_flight[i];
+        }
+    }
+    return -1;
+}
+
+static void ctx_free(uint16_t idx)
+{
+    heap_remove(idx);
+    if (engine.ctx[idx].in_flight) {
+        in_flight_remove(idx);
+    }
+    memset(&engine.ctx[idx], 0, sizeof(cfg_ctx_t));
+    engine.ctx[idx].heap_pos = CFG_HEAP_NONE;
+}
+
+static void ctx_schedule(uint16_t idx, uint32_t due_ms)
+{
+    engine.ctx[idx].due_ms = due_ms;
+    heap_push(idx);
+}
+
+static uint8_t latency_bucket(uint32_t latency_ms)
+{
+    uint32_t units = latency_ms / FAST_PROV_CFG_LATENCY_BUCKET0_MS;
+    uint8_t bucket = units ? 32 - __builtin_clz(units) : 0;
+
+    return bucket < FAST_PROV_CFG_LATENCY_BUCKETS ? bucket : FAST_PROV_CFG_LATENCY_BUCKETS - 1;
+}
+
+static void stats_update(void)
+{
+    engine.stats.in_flight = engine.in_flight_len;
+    engine.stats.pending = engine.queue[FAST_PROV_CFG_STEP_APPKEY_ADD].len +
+                           engine.queue[FAST_PROV_CFG_STEP_INFO_SET].len;
+}
+
+static void ctx_finish(uint16_t idx, esp_err_t result, uint32_t now, cfg_out_t *out)
+{
+    cfg_ctx_t *ctx = &engine.ctx[idx];
+    example_node_info_t *node = ctx->node;
+    uint32_t latency = now - ctx->start_ms;
+
+    if (result == ESP_OK) {
+        engine.stats.nodes_done++;
+        engine.stats.latency_sum_ms += latency;
+        engine.stats.latency_hist[latency_bucket(latency)]++;
+        if (latency > engine.stats.latency_max_ms) {
+            engine.stats.latency_max_ms = latency;
+        }
+    } else {
+        engine.stats.nodes_failed++;
+        ESP_LOGW(TAG, "Node 0x%04x failed at step %d after %d retries",
+                 ctx->addr, ctx->step, ctx->attempts);
+    }
+
+    ctx_free(idx);
+    /* So the callback can tell whether this was the last node */
+    stats_update();
+
+    if (engine.config.complete && out->done_len < ARRAY_SIZE(out->done)) {
+        out->done[out->done_len].node = node;
+        out->done[out->done_len++].result = result;
+    }
+}
+
+static void ctx_retry(uint16_t idx, uint32_t now, cfg_out_t *out)
+{
+    cfg_ctx_t *ctx = &engine.ctx[idx];
+    uint32_t delay;
+
+    if (ctx->attempts >= engine.config.max_retries) {
+        ctx_finish(idx, ESP_ERR_TIMEOUT, now, out);
+        return;
+    }
+
+    /* Exponential backoff with up to 25% jitter, so nodes that timed out
+     * together do not retry in the same advertising slot.
+     */
+    delay = (uint32_t)engine.config.backoff_base_ms << ctx->attempts;
+    if (delay > engine.config.backoff_max_ms) {
+        delay = engine.config.backoff_max_ms;
+    }
+    delay += esp_random() % (delay / 4 + 1);
+
+    ctx->attempts++;
+    engine.stats.retries++;
+    ctx_schedule(idx, now + delay);
+}
+
+/* Takes a window slot now, the message goes out after the lock is released */
+static void ctx_send(uint16_t idx, cfg_out_t *out)
+{
+    cfg_ctx_t *ctx = &engine.ctx[idx];
+
+    ctx->in_flight = true;
+    engine.in_flight[engine.in_flight_len++] = idx;
+    if (engine.in_flight_len > engine.stats.in_flight_max) {
+        engine.stats.in_flight_max = engine.in_flight_len;
+    }
+
+    out->send[out->send_len].node = ctx->node;
+    out->send[out->send_len].idx  = idx;
+    out->send[out->send_len].addr = ctx->addr;
+    out->send[out->send_len++].step = ctx->step;
+}
+
+static int queue_pick_ready(uint32_t now)
+{
+    for (int step = FAST_PROV_CFG_STEP_DONE - 1; step >= 0; step--) {
+        cfg_heap_t *heap = &engine.queue[step];
+        if (heap->len && !time_before(now, engine.ctx[heap->item[0]].due_ms)) {
+            return heap->item[0];
+        }
+    }
+    return -1;
+}
+
+static void engine_pump(cfg_out_t *out)
+{
+    uint32_t now = k_uptime_get_32();
+    uint32_t next = 0;
+    bool armed = false;
+    int idx;
+
+    while (engine.in_flight_len < engine.config.window &&
+            (idx = queue_pick_ready(now)) >= 0) {
+        heap_remove(idx);
+        ctx_send(idx, out);
+    }
+
+    /* Steps still queued are either waiting for their backoff to expire, or
+     * for a window slot, which is released by step_done()/step_fail().
+     */
+    if (engine.in_flight_len < engine.config.window) {
+        for (int step = 0; step < FAST_PROV_CFG_STEP_DONE; step++) {
+            cfg_heap_t *heap = &engine.queue[step];
+            if (heap->len && (!armed || time_before(engine.ctx[heap->item[0]].due_ms, next))) {
+                next = engine.ctx[heap->item[0]].due_ms;
+                armed = true;
+            }
+        }
+    }
+
+    k_delayed_work_cancel(&engine.timer);
+    if (armed) {
+        k_delayed_work_submit(&engine.timer, time_before(now, next) ? next - now : 0);
+    }
+
+    stats_update();
+}
+
+/* Called with the lock released. A send that fails takes the lock again to
+ * schedule its retry, which may pick more messages or finish the node.
+ */
+static void engine_flush(cfg_out_t *out)
+{
+    while (out->send_len || out->done_len) {
+        cfg_out_t cur = *out;
+
+        out->send_len = out->done_len = 0;
+
+        for (uint8_t i = 0; i < cur.done_len; i++) {
+            engine.config.complete(cur.done[i].node, cur.done[i].result);
+        }
+
+        for (uint8_t i = 0; i < cur.send_len; i++) {
+            esp_err_t err = engine.config.send(cur.send[i].node, cur.send[i].step);
+            if (err == ESP_OK) {
+                continue;
+            }
+            ESP_LOGE(TAG, "Failed to send step %d to 0x%04x (err %d)",
+                     cur.send[i].step, cur.send[i].addr, err);
+
+            xSemaphoreTakeRecursive(engine.lock, portMAX_DELAY);
+            /* Unless the node was enqueued again meanwhile */
+            if (in_flight_find(cur.send[i].addr, cur.send[i].step) == cur.send[i].idx) {
+                in_flight_remove(cur.send[i].idx);
+                ctx_retry(cur.send[i].idx, k_uptime_get_32(), out);
+                engine_pump(out);
+            }
+            xSemaphoreGiveRecursive(engine.lock);
+        }
+    }
+}
+
+static void engine_timeout(struct k_work *work)
+{
+    cfg_out_t out = {0};
+
+    xSemaphoreTakeRecursive(engine.lock, portMAX_DELAY);
+    engine_pump(&out);
+    xSemaphoreGiveRecursive(engine.lock);
+
+    engine_flush(&out);
+}
+
+static int step_from_opcode(uint32_t opcode)
+{
+    switch (opcode) {
+    case ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD:
+    case ESP_BLE_MESH_MODEL_OP_APP_KEY_STATUS:
+        return FAST_PROV_CFG_STEP_APPKEY_ADD;
+    case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_SET:
+    case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_STATUS:
+        return FAST_PROV_CFG_STEP_INFO_SET;
+    default:
+        return -1;
+    }
+}
+
+esp_err_t example_cfg_engine_init(const example_cfg_engine_config_t *config)
+{
+    if (!config || !config->send || config->window == 0 || config->window > CFG_WINDOW_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!engine.lock) {
+        engine.lock = xSemaphoreCreateRecursiveMutex();
+        if (!engine.lock) {
+            return ESP_ERR_NO_MEM;
+        }
+        k_delayed_work_init(&engine.timer, engine_timeout);
+    }
+
+    xSemaphoreTakeRecursive(engine.lock, portMAX_DELAY);
+    k_delayed_work_cancel(&engine.timer);
+    memcpy(&engine.config, config, sizeof(example_cfg_engine_config_t));
+    memset(engine.ctx, 0, sizeof(engine.ctx));
+    memset(engine.queue, 0, sizeof(engine.queue));
+    memset(&engine.stats, 0, sizeof(engine.stats));
+    for (int i = 0; i < CFG_CTX_NUM; i++) {
+        engine.ctx[i].heap_pos = CFG_HEAP_NONE;
+    }
+    engine.in_flight_len = 0;
+    engine.init = true;
+    xSemaphoreGiveRecursive(engine.lock);
+
+    return ESP_OK;
+}
+
+esp_err_t example_cfg_engine_enqueue(example_node_info_t *node)
+{
+    cfg_out_t out = {0};
+    int idx = -1;
+
+    if (!engine.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!node) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTakeRecursive(engine.lock, portMAX_DELAY);
+
+    for (int i = 0; i < CFG_CTX_NUM; i++) {
+        if (engine.ctx[i].in_use && engine.ctx[i].node == node) {
+            ctx_free(i);
+            idx = i;
+            break;
+        }
+        if (idx < 0 && !engine.ctx[i].in_use) {
+            idx = i;
+        }
+    }
+
+    if (idx < 0) {
+        xSemaphoreGiveRecursive(engine.lock);
+        ESP_LOGE(TAG, "%s: No free configuration context", __func__);
+        return ESP_ERR_NO_MEM;
+    }
+
+    engine.ctx[idx].in_use   = true;
+    engine.ctx[idx].node     = node;
+    engine.ctx[idx].addr     = node->unicast_addr;
+    engine.ctx[idx].step     = FAST_PROV_CFG_STEP_APPKEY_ADD;
+    engine.ctx[idx].start_ms = k_uptime_get_32();
+    ctx_schedule(idx, engine.ctx[idx].start_ms);
+    engine_pump(&out);
+
+    xSemaphoreGiveRecursive(engine.lock);
+
+    engine_flush(&out);
+    return ESP_OK;
+}
+
+esp_err_t example_cfg_engine_step_done(uint16_t addr, uint32_t opcode)
+{
+    int step = step_from_opcode(opcode);
+    cfg_out_t out = {0};
+    int idx;
+
+    if (!engine.init || step < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTakeRecursive(engine.lock, portMAX_DELAY);
+
+    idx = in_flight_find(addr, step);
+    if (idx < 0) {
+        /* Late status of a step that was already retried or completed */
+        xSemaphoreGiveRecursive(engine.lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    in_flight_remove(idx);
+    if (++engine.ctx[idx].step == FAST_PROV_CFG_STEP_DONE) {
+        ctx_finish(idx, ESP_OK, k_uptime_get_32(), &out);
+    } else {
+        engine.ctx[idx].attempts = 0;
+        ctx_schedule(idx, k_uptime_get_32());
+    }
+    engine_pump(&out);
+
+    xSemaphoreGiveRecursive(engine.lock);
+
+    engine_flush(&out);
+    return ESP_OK;
+}
+
+esp_err_t example_cfg_engine_step_fail(uint16_t addr, uint32_t opcode)
+{
+    int step = step_from_opcode(opcode);
+    cfg_out_t out = {0};
+    int idx;
+
+    if (!engine.init || step < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTakeRecursive(engine.lock, portMAX_DELAY);
+
+    idx = in_flight_find(addr, step);
+    if (idx < 0) {
+        xSemaphoreGiveRecursive(engine.lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    in_flight_remove(idx);
+    ctx_retry(idx, k_uptime_get_32(), &out);
+    engine_pump(&out);
+
+    xSemaphoreGiveRecursive(engine.lock);
+
+    engine_flush(&out);
+    return ESP_OK;
+}
+
+void example_cfg_engine_get_stats(example_cfg_engine_stats_t *stats)
+{
+    if (!stats || !engine.init) {
+        return;
+    }
+
+    xSemaphoreTakeRecursive(engine.lock, portMAX_DELAY);
+    memcpy(stats, &engine.stats, sizeof(example_cfg_engine_stats_t));
+    xSemaphoreGiveRecursive(engine.lock);
+}
+
+uint32_t example_cfg_engine_latency_pct(const example_cfg_engine_stats_t *stats, uint8_t pct)
+{
+    uint32_t rank, seen = 0;
+
+    if (!stats || !stats->nodes_done) {
+        return 0;
+    }
+
+    /* Smallest bucket holding at least pct percent of the nodes, rounded up */
+    rank = ((uint64_t)stats->nodes_done * pct + 99) / 100;
+    for (int i = 0; i < FAST_PROV_CFG_LATENCY_BUCKETS - 1; i++) {
+        seen += stats->latency_hist[i];
+        if (seen >= rank) {
+            uint32_t bound = (uint32_t)FAST_PROV_CFG_LATENCY_BUCKET0_MS << i;
+            return bound < stats->latency_max_ms ? bound : stats->latency_max_ms;
+        }
+    }
+
+    return stats->latency_max_ms;
+}
@@ -0,0 +1,116 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BLE_MESH_FAST_PROV_CFG_ENGINE_H_
+#define _BLE_MESH_FAST_PROV_CFG_ENGINE_H_
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#include "ble_mesh_fast_prov_operation.h"
+
+#ifndef CONFIG_FAST_PROV_CFG_WINDOW
+#define CONFIG_FAST_PROV_CFG_WINDOW             3
+#endif
+
+#ifndef CONFIG_FAST_PROV_CFG_MAX_RETRIES
+#define CONFIG_FAST_PROV_CFG_MAX_RETRIES        5
+#endif
+
+#ifndef CONFIG_FAST_PROV_CFG_BACKOFF_BASE_MS
+#define CONFIG_FAST_PROV_CFG_BACKOFF_BASE_MS    500
+#endif
+
+#ifndef CONFIG_FAST_PROV_CFG_BACKOFF_MAX_MS
+#define CONFIG_FAST_PROV_CFG_BACKOFF_MAX_MS     8000
+#endif
+
+/* Post-provisioning configuration steps, in the order they are sent to a node.
+ * When several steps are ready at the same time, the later step wins, so nodes
+ * already in the pipeline finish before new ones are started.
+ */
+typedef enum {
+    FAST_PROV_CFG_STEP_APPKEY_ADD,
+    FAST_PROV_CFG_STEP_INFO_SET,
+    FAST_PROV_CFG_STEP_DONE,
+} example_cfg_step_t;
+
+/* Sends the message for one step. It is only called by the engine, which owns
+ * pacing and retransmission; the caller must not resend on timeout itself.
+ */
+typedef esp_err_t (*example_cfg_send_cb_t)(example_node_info_t *node, example_cfg_step_t step);
+
+/* Reports the end of a node configuration, ESP_OK or ESP_ERR_TIMEOUT once the
+ * retries of a step are exhausted.
+ */
+typedef void (*example_cfg_complete_cb_t)(example_node_info_t *node, esp_err_t result);
+
+typedef struct {
+    uint8_t  window;            /* Maximum number of nodes with a message in flight */
+    uint8_t  max_retries;       /* Retransmissions per step before giving up */
+    uint16_t backoff_base_ms;   /* First retry delay, doubled on each retry */
+    uint16_t backoff_max_ms;    /* Upper bound of the retry delay */
+    example_cfg_send_cb_t     send;
+    example_cfg_complete_cb_t complete;
+} example_cfg_engine_config_t;
+
+#define EXAMPLE_CFG_ENGINE_DEFAULT_CONFIG(_send, _complete) {   \
+    .window          = CONFIG_FAST_PROV_CFG_WINDOW,             \
+    .max_retries     = CONFIG_FAST_PROV_CFG_MAX_RETRIES,        \
+    .backoff_base_ms = CONFIG_FAST_PROV_CFG_BACKOFF_BASE_MS,    \
+    .backoff_max_ms  = CONFIG_FAST_PROV_CFG_BACKOFF_MAX_MS,     \
+    .send            = (_send),                                 \
+    .complete        = (_complete),                             \
+}
+
+/* Latency histogram: bucket 0 counts nodes configured in less than
+ * FAST_PROV_CFG_LATENCY_BUCKET0_MS, and each next bucket spans twice the range
+ * of the previous one. The last bucket also counts everything above it.
+ */
+#define FAST_PROV_CFG_LATENCY_BUCKETS       16
+#define FAST_PROV_CFG_LATENCY_BUCKET0_MS    16
+
+typedef struct {
+    uint32_t nodes_done;        /* Nodes that completed every step */
+    uint32_t nodes_failed;      /* Nodes dropped after exhausting retries */
+    uint32_t retries;           /* Total retransmissions */
+    uint16_t pending;           /* Steps waiting in the queue */
+    uint8_t  in_flight;         /* Nodes with a message outstanding */
+    uint8_t  in_flight_max;     /* High-water mark of in_flight */
+    uint32_t latency_max_ms;    /* Longest enqueue -> done time */
+    uint32_t latency_sum_ms;    /* Sum of enqueue -> done times, over nodes_done */
+    uint32_t latency_hist[FAST_PROV_CFG_LATENCY_BUCKETS];
+} example_cfg_engine_stats_t;
+
+esp_err_t example_cfg_engine_init(const example_cfg_engine_config_t *config);
+
+/* Starts configuring a node from FAST_PROV_CFG_STEP_APPKEY_ADD. A node that is
+ * already in the engine (e.g. re-provisioned) is restarted.
+ */
+esp_err_t example_cfg_engine_enqueue(example_node_info_t *node);
+
+/* The status of the step identified by opcode has been received from addr. */
+esp_err_t example_cfg_engine_step_done(uint16_t addr, uint32_t opcode);
+
+/* The step identified by opcode timed out or could not be sent to addr. */
+esp_err_t example_cfg_engine_step_fail(uint16_t addr, uint32_t opcode);
+
+void example_cfg_engine_get_stats(example_cfg_engine_stats_t *stats);
+
+/* Upper bound of the enqueue -> done time of pct percent of the configured
+ * nodes, at the resolution of the latency histogram.
+ */
+uint32_t example_cfg_engine_latency_pct(const example_cfg_engine_stats_t *stats, uint8_t pct);
+
+#endif /* _BLE_MESH_FAST_PROV_CFG_ENGINE_H_ */
@@ -0,0 +1,227 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "ble_mesh_fast_prov_common.h"
+#include "ble_mesh_fast_prov_link_ctrl.h"
+
+#define TAG "LINK_CTRL"
+
+#define LINK_SLOTS  16
+
+static struct {
+    example_link_ctrl_config_t config;
+    example_link_ctrl_stats_t stats;
+    uint8_t credit;         /* Clean closes since the last increase */
+    uint8_t recover;        /* Links of the round which caused the last decrease */
+    example_link_ctrl_sample_t history[CONFIG_FAST_PROV_LINK_HISTORY];
+    uint8_t hist_head;
+    uint8_t hist_len;
+    /* Start time of each link in flight, oldest first from slot_head. Link Close
+     * does not tell which link it is for, so it always retires the oldest slot.
+     */
+    uint32_t slot_start[LINK_SLOTS];
+    uint8_t slot_head;
+    SemaphoreHandle_t lock;
+    struct k_delayed_work timer;
+} ctrl;
+
+static void window_set(uint8_t window)
+{
+    if (window < ctrl.config.window_min) {
+        window = ctrl.config.window_min;
+    } else if (window > ctrl.config.window_max) {
+        window = ctrl.config.window_max;
+    }
+
+    if (window == ctrl.stats.window && ctrl.hist_len) {
+        return;
+    }
+
+    ctrl.stats.window = window;
+    ctrl.history[ctrl.hist_head].time_ms = k_uptime_get_32();
+    ctrl.history[ctrl.hist_head].window  = window;
+    ctrl.hist_head = (ctrl.hist_head + 1) % CONFIG_FAST_PROV_LINK_HISTORY;
+    if (ctrl.hist_len < CONFIG_FAST_PROV_LINK_HISTORY) {
+        ctrl.hist_len++;
+    }
+}
+
+static void slot_timer_update(void)
+{
+    uint32_t due, now = k_uptime_get_32();
+
+    k_delayed_work_cancel(&ctrl.timer);
+    if (ctrl.stats.in_flight == 0) {
+        return;
+    }
+
+    due = ctrl.slot_start[ctrl.slot_head] + ctrl.config.link_timeout_ms;
+    k_delayed_work_submit(&ctrl.timer, (int32_t)(due - now) > 0 ? due - now : 0);
+}
+
+static void link_done(uint8_t reason)
+{
+    ctrl.slot_head = (ctrl.slot_head + 1) % LINK_SLOTS;
+    ctrl.stats.in_flight--;
+
+    if (reason == FAST_PROV_LINK_CLOSE_SUCCESS) {
+        ctrl.stats.succeeded++;
+        if (ctrl.recover) {
+            ctrl.recover--;
+        } else if (++ctrl.credit >= ctrl.stats.window) {
+            ctrl.credit = 0;
+            window_set(ctrl.stats.window + 1);
+        }
+        return;
+    }
+
+    ctrl.stats.failed++;
+    if (reason == FAST_PROV_LINK_CLOSE_TIMEOUT) {
+        ctrl.stats.timeouts++;
+    }
+
+    if (ctrl.recover) {
+        ctrl.recover--;
+        return;
+    }
+
+    ctrl.credit  = 0;
+    ctrl.recover = ctrl.stats.in_flight;
+    window_set(ctrl.stats.window / 2);
+    ESP_LOGW(TAG, "Link closed with reason 0x%02x, window %d", reason, ctrl.stats.window);
+}
+
+/* A device which was added but never got a Link Close, e.g. because it went
+ * away before the link was opened, would hold its slot forever.
+ */
+static void link_expire(void)
+{
+    ctrl.stats.expired++;
+    ESP_LOGW(TAG, "No Link Close after %d ms", ctrl.config.link_timeout_ms);
+    link_done(FAST_PROV_LINK_CLOSE_TIMEOUT);
+}
+
+static void link_timeout(struct k_work *work)
+{
+    uint32_t now = k_uptime_get_32();
+
+    xSemaphoreTake(ctrl.lock, portMAX_DELAY);
+    while (ctrl.stats.in_flight &&
+            now - ctrl.slot_start[ctrl.slot_head] >= ctrl.config.link_timeout_ms) {
+        link_expire();
+    }
+    slot_timer_update();
+    xSemaphoreGive(ctrl.lock);
+}
+
+esp_err_t example_link_ctrl_init(const example_link_ctrl_config_t *config)
+{
+    if (!config || config->window_min == 0 || config->window_min > config->window_max ||
+            config->link_timeout_ms == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!ctrl.lock) {
+        ctrl.lock = xSemaphoreCreateMutex();
+        if (!ctrl.lock) {
+            return ESP_ERR_NO_MEM;
+        }
+        k_delayed_work_init(&ctrl.timer, link_timeout);
+    }
+
+    xSemaphoreTake(ctrl.lock, portMAX_DELAY);
+    k_delayed_work_cancel(&ctrl.timer);
+    memcpy(&ctrl.config, config, sizeof(example_link_ctrl_config_t));
+    memset(&ctrl.stats, 0, sizeof(ctrl.stats));
+    ctrl.credit = ctrl.recover = 0;
+    ctrl.hist_head = ctrl.hist_len = 0;
+    ctrl.slot_head = 0;
+    window_set(config->window_init);
+    xSemaphoreGive(ctrl.lock);
+
+    return ESP_OK;
+}
+
+bool example_link_ctrl_can_start(void)
+{
+    bool start;
+
+    xSemaphoreTake(ctrl.lock, portMAX_DELAY);
+    start = ctrl.stats.in_flight < ctrl.stats.window;
+    if (!start) {
+        ctrl.stats.deferred++;
+    }
+    xSemaphoreGive(ctrl.lock);
+
+    return start;
+}
+
+void example_link_ctrl_start(void)
+{
+    xSemaphoreTake(ctrl.lock, portMAX_DELAY);
+    if (ctrl.stats.in_flight == LINK_SLOTS) {
+        link_expire();
+    }
+    ctrl.slot_start[(ctrl.slot_head + ctrl.stats.in_flight) % LINK_SLOTS] = k_uptime_get_32();
+    ctrl.stats.started++;
+    ctrl.stats.in_flight++;
+    slot_timer_update();
+    xSemaphoreGive(ctrl.lock);
+}
+
+void example_link_ctrl_close(uint8_t reason)
+{
+    xSemaphoreTake(ctrl.lock, portMAX_DELAY);
+    /* Otherwise the link was opened by someone else, e.g. PB-GATT, or it has
+     * already expired.
+     */
+    if (ctrl.stats.in_flight) {
+        link_done(reason);
+        slot_timer_update();
+    }
+    xSemaphoreGive(ctrl.lock);
+}
+
+void example_link_ctrl_get_stats(example_link_ctrl_stats_t *stats)
+{
+    if (stats) {
+        xSemaphoreTake(ctrl.lock, portMAX_DELAY);
+        memcpy(stats, &ctrl.stats, sizeof(example_link_ctrl_stats_t));
+        xSemaphoreGive(ctrl.lock);
+    }
+}
+
+uint8_t example_link_ctrl_get_history(example_link_ctrl_sample_t *samples, uint8_t max)
+{
+    uint8_t count, start;
+
+    if (!samples) {
+        return 0;
+    }
+
+    xSemaphoreTake(ctrl.lock, portMAX_DELAY);
+    count = ctrl.hist_len < max ? ctrl.hist_len : max;
+    start = (ctrl.hist_head + CONFIG_FAST_PROV_LINK_HISTORY - count) % CONFIG_FAST_PROV_LINK_HISTORY;
+    for (uint8_t i = 0; i < count; i++) {
+        samples[i] = ctrl.history[(start + i) % CONFIG_FAST_PROV_LINK_HISTORY];
+    }
+    xSemaphoreGive(ctrl.lock);
+
+    return count;
+}
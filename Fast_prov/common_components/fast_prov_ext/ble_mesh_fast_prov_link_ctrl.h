@@ -0,0 +1,92 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BLE_MESH_FAST_PROV_LINK_CTRL_H_
+#define _BLE_MESH_FAST_PROV_LINK_CTRL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#ifndef CONFIG_FAST_PROV_LINK_WINDOW_INIT
+#define CONFIG_FAST_PROV_LINK_WINDOW_INIT   2
+#endif
+
+#ifndef CONFIG_FAST_PROV_LINK_HISTORY
+#define CONFIG_FAST_PROV_LINK_HISTORY       16
+#endif
+
+#ifndef CONFIG_FAST_PROV_LINK_TIMEOUT_MS
+#define CONFIG_FAST_PROV_LINK_TIMEOUT_MS    65000
+#endif
+
+/* PB-ADV Link Close reasons */
+#define FAST_PROV_LINK_CLOSE_SUCCESS    0x00
+#define FAST_PROV_LINK_CLOSE_TIMEOUT    0x01
+#define FAST_PROV_LINK_CLOSE_FAIL       0x02
+
+/* AIMD controller for the number of concurrent PB-ADV provisioning links.
+ * Every clean Link Close grows the window by 1/window (so by one link per
+ * round of successful links), and a failed or timed out link halves it. The
+ * links still open when the window is halved belong to the same round, so
+ * their failures do not shrink it again.
+ *
+ * A link without Link Close after link_timeout_ms is counted as timed out,
+ * so that devices which never got a link do not hold the window.
+ */
+typedef struct {
+    uint8_t window_min;
+    uint8_t window_max;     /* Usually CONFIG_BLE_MESH_PBA_SAME_TIME */
+    uint8_t window_init;
+    uint32_t link_timeout_ms;
+} example_link_ctrl_config_t;
+
+#define EXAMPLE_LINK_CTRL_DEFAULT_CONFIG(_max) {            \
+    .window_min      = 1,                                   \
+    .window_max      = (_max),                              \
+    .window_init     = CONFIG_FAST_PROV_LINK_WINDOW_INIT,   \
+    .link_timeout_ms = CONFIG_FAST_PROV_LINK_TIMEOUT_MS,    \
+}
+
+typedef struct {
+    uint32_t started;       /* Devices handed to the stack */
+    uint32_t succeeded;     /* Links closed with FAST_PROV_LINK_CLOSE_SUCCESS */
+    uint32_t failed;        /* Links closed with any other reason */
+    uint32_t timeouts;      /* Part of failed, closed with FAST_PROV_LINK_CLOSE_TIMEOUT */
+    uint32_t deferred;      /* Beacons not acted on because the window was full */
+    uint32_t expired;       /* Part of timeouts, links without Link Close after link_timeout_ms */
+    uint8_t  in_flight;
+    uint8_t  window;
+} example_link_ctrl_stats_t;
+
+typedef struct {
+    uint32_t time_ms;
+    uint8_t  window;
+} example_link_ctrl_sample_t;
+
+esp_err_t example_link_ctrl_init(const example_link_ctrl_config_t *config);
+
+/* Returns true if one more link may be opened, otherwise counts a deferral */
+bool example_link_ctrl_can_start(void);
+
+void example_link_ctrl_start(void);
+
+void example_link_ctrl_close(uint8_t reason);
+
+void example_link_ctrl_get_stats(example_link_ctrl_stats_t *stats);
+
+/* Copies the most recent window changes, oldest first, and returns how many */
+uint8_t example_link_ctrl_get_history(example_link_ctrl_sample_t *samples, uint8_t max);
+
+#endif /* _BLE_MESH_FAST_PROV_LINK_CTRL_H_ */
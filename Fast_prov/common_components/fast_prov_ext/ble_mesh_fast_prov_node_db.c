@@ -0,0 +1,518 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "ble_mesh_fast_prov_node_index.h"
+#include "ble_mesh_fast_prov_node_db.h"
+
+#define TAG "NODE_DB"
+
+#define NODE_DB_MAGIC       0x444E5046  /* "FPND" */
+#define NODE_DB_SECTOR      4096
+
+#define REC_NODE            0x0001
+#define REC_RANGE           0x0002
+#define REC_ERASED          0xFFFF      /* Start of the unwritten part of a half */
+
+#define REC_ALIGN(len)      (((len) + 3) & ~3U)
+
+#define NODE_DB_TASK_STACK  2048
+
+/* State of the half records are not appended to */
+enum {
+    SPARE_DIRTY,        /* Holds an older generation */
+    SPARE_ERASING,      /* Left to the node db task */
+    SPARE_ERASED,
+};
+
+/* Written last when a half is formatted, so a half whose compaction was cut
+ * short is never picked at boot.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t gen;
+    uint32_t gen_inv;
+    uint32_t reserved;
+} node_db_half_t;
+
+typedef struct {
+    uint16_t type;
+    uint16_t len;       /* Payload octets, the next record starts 4-byte aligned */
+    uint32_t crc;       /* Over type, len and payload */
+} node_db_rec_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t  uuid[16];
+    uint16_t unicast_addr;
+    uint16_t net_idx;
+    uint16_t app_idx;
+    uint8_t  elem_num;
+    uint8_t  onoff;
+} node_db_node_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t unicast_addr;
+    uint16_t unicast_min;
+    uint16_t unicast_max;
+    uint8_t  lack_of_addr;
+    uint8_t  reserved;
+} node_db_range_t;
+
+static struct {
+    const esp_partition_t *part;
+    uint32_t half_size;
+    uint8_t  active;    /* Half records are appended to */
+    uint32_t gen;       /* Generation of the active half */
+    uint32_t tail;      /* Offset of the next record in the active half */
+    uint32_t records;
+    volatile uint8_t spare;
+    bool     full;      /* The nodes did not fit in a half, compaction is not tried again */
+    SemaphoreHandle_t erase_lock;   /* Held while the spare half is erased */
+    TaskHandle_t task;
+} db;
+
+static inline uint32_t half_offset(uint8_t half)
+{
+    return half * db.half_size;
+}
+
+static uint32_t rec_crc(const node_db_rec_t *rec, const void *payload)
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)rec, offsetof(node_db_rec_t, crc));
+
+    return esp_rom_crc32_le(crc, payload, rec->len);
+}
+
+static bool half_valid(const node_db_half_t *half)
+{
+    return half->magic == NODE_DB_MAGIC && (half->gen ^ half->gen_inv) == 0xFFFFFFFF;
+}
+
+static esp_err_t rec_write(uint8_t half, uint32_t *tail, uint16_t type, const void *payload, uint16_t len)
+{
+    uint8_t buf[sizeof(node_db_rec_t) + REC_ALIGN(sizeof(node_db_node_t))] = {0};
+    node_db_rec_t *rec = (node_db_rec_t *)buf;
+    uint32_t size = sizeof(node_db_rec_t) + REC_ALIGN(len);
+    esp_err_t err;
+
+    if (size > sizeof(buf)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (*tail + size > db.half_size) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    rec->type = type;
+    rec->len = len;
+    memcpy(buf + sizeof(node_db_rec_t), payload, len);
+    rec->crc = rec_crc(rec, payload);
+
+    err = esp_partition_write(db.part, half_offset(half) + *tail, buf, size);
+    if (err == ESP_OK) {
+        *tail += size;
+    }
+    return err;
+}
+
+static void node_to_rec(const example_node_info_t *node, node_db_node_t *rec)
+{
+    memcpy(rec->uuid, node->uuid, 16);
+    rec->unicast_addr = node->unicast_addr;
+    rec->net_idx = node->net_idx;
+    rec->app_idx = node->app_idx;
+    rec->elem_num = node->element_num;
+    rec->onoff = node->onoff;
+}
+
+static void range_to_rec(const example_node_info_t *node, node_db_range_t *rec)
+{
+    rec->unicast_addr = node->unicast_addr;
+    rec->unicast_min = node->unicast_min;
+    rec->unicast_max = node->unicast_max;
+    rec->lack_of_addr = node->lack_of_addr;
+    rec->reserved = 0;
+}
+
+static void rec_apply(const node_db_rec_t *rec, const void *payload)
+{
+    const node_db_node_t *n = payload;
+    const node_db_range_t *r = payload;
+    example_node_info_t *node;
+
+    switch (rec->type) {
+    case REC_NODE:
+        if (rec->len == sizeof(node_db_node_t)) {
+            example_node_index_store(n->uuid, n->unicast_addr, n->elem_num,
+                                     n->net_idx, n->app_idx, n->onoff);
+        }
+        break;
+    case REC_RANGE:
+        if (rec->len == sizeof(node_db_range_t) &&
+                (node = example_node_index_find_by_addr(r->unicast_addr)) != NULL) {
+            node->unicast_min = r->unicast_min;
+            node->unicast_max = r->unicast_max;
+            node->lack_of_addr = r->lack_of_addr;
+        }
+        break;
+    default:
+        /* Written by a later version, skipped */
+        break;
+    }
+}
+
+/* Replays the records of the active half, returns false if the log ends with
+ * a damaged record, which is left behind by a write cut short.
+ */
+static bool half_replay(const uint8_t *base)
+{
+    uint32_t off = sizeof(node_db_half_t);
+
+    while (off + sizeof(node_db_rec_t) <= db.half_size) {
+        const node_db_rec_t *rec = (const node_db_rec_t *)(base + off);
+        const uint8_t *payload = base + off + sizeof(node_db_rec_t);
+
+        if (rec->type == REC_ERASED) {
+            break;
+        }
+        if (off + sizeof(node_db_rec_t) + REC_ALIGN(rec->len) > db.half_size ||
+                rec_crc(rec, payload) != rec->crc) {
+            db.tail = off;
+            return false;
+        }
+        rec_apply(rec, payload);
+        db.records++;
+        off += sizeof(node_db_rec_t) + REC_ALIGN(rec->len);
+    }
+
+    db.tail = off;
+    return true;
+}
+
+struct compact_ctx {
+    uint32_t tail;
+    uint32_t records;
+    esp_err_t err;
+};
+
+static bool compact_node(example_node_info_t *node, void *arg)
+{
+    struct compact_ctx *ctx = arg;
+    node_db_node_t n;
+    node_db_range_t r;
+    uint8_t half = !db.active;
+
+    node_to_rec(node, &n);
+    ctx->err = rec_write(half, &ctx->tail, REC_NODE, &n, sizeof(n));
+    if (ctx->err != ESP_OK) {
+        return false;
+    }
+    ctx->records++;
+
+    if (node->unicast_min || node->lack_of_addr) {
+        range_to_rec(node, &r);
+        ctx->err = rec_write(half, &ctx->tail, REC_RANGE, &r, sizeof(r));
+        if (ctx->err != ESP_OK) {
+            return false;
+        }
+        ctx->records++;
+    }
+    return true;
+}
+
+static esp_err_t half_format(uint8_t half, uint32_t gen)
+{
+    node_db_half_t hdr = {
+        .magic = NODE_DB_MAGIC,
+        .gen = gen,
+        .gen_inv = ~gen,
+    };
+
+    return esp_partition_write(db.part, half_offset(half), &hdr, sizeof(hdr));
+}
+
+/* Erasing half of the partition takes a sector erase per 4 KB, too long for
+ * the mesh callback context, so it is done ahead of time by this task. The
+ * records are rewritten from the callback context, where the node index is
+ * changed, at the next append after it is done.
+ */
+static void node_db_task(void *arg)
+{
+    esp_err_t err;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        xSemaphoreTake(db.erase_lock, portMAX_DELAY);
+        if (db.spare == SPARE_ERASING) {
+            err = esp_partition_erase_range(db.part, half_offset(!db.active), db.half_size);
+            if (err != ESP_OK) {
+                ESP_LOGW(TAG, "%s: Erase failed (err %d)", __func__, err);
+            }
+            db.spare = err == ESP_OK ? SPARE_ERASED : SPARE_DIRTY;
+        }
+        xSemaphoreGive(db.erase_lock);
+    }
+}
+
+static void spare_request(void)
+{
+    if (db.spare == SPARE_DIRTY) {
+        db.spare = SPARE_ERASING;
+        xTaskNotifyGive(db.task);
+    }
+}
+
+/* Erases the spare half now, unless the task did, waiting for it if it is at it */
+static esp_err_t spare_erase(void)
+{
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(db.erase_lock, portMAX_DELAY);
+    if (db.spare != SPARE_ERASED) {
+        err = esp_partition_erase_range(db.part, half_offset(!db.active), db.half_size);
+        db.spare = err == ESP_OK ? SPARE_ERASED : SPARE_DIRTY;
+    }
+    xSemaphoreGive(db.erase_lock);
+    return err;
+}
+
+/* Writes the nodes to the erased spare half, which becomes the active one */
+static esp_err_t compact_rewrite(void)
+{
+    struct compact_ctx ctx = {
+        .tail = sizeof(node_db_half_t),
+        .records = 0,
+        .err = ESP_OK,
+    };
+    uint8_t half = !db.active;
+    esp_err_t err;
+
+    db.spare = SPARE_DIRTY;
+    example_node_index_foreach(compact_node, &ctx);
+    if (ctx.err == ESP_ERR_NO_MEM) {
+        /* Until the nodes are erased, another try would only wear the flash */
+        ESP_LOGE(TAG, "%s: Nodes do not fit in %" PRIu32 " octets", __func__, db.half_size);
+        db.full = true;
+    }
+    if (ctx.err != ESP_OK) {
+        return ctx.err;
+    }
+
+    /* The old half stays valid until this header is written */
+    err = half_format(half, db.gen + 1);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    db.active = half;
+    db.gen++;
+    db.tail = ctx.tail;
+    db.records = ctx.records;
+    ESP_LOGI(TAG, "Compacted to %" PRIu32 " records, %" PRIu32 " octets", db.records, db.tail);
+    return ESP_OK;
+}
+
+esp_err_t example_node_db_compact(void)
+{
+    esp_err_t err;
+
+    if (!db.part) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    err = spare_erase();
+    if (err != ESP_OK) {
+        return err;
+    }
+    return compact_rewrite();
+}
+
+/* Each node has at most a NODE and a RANGE record alive, the others were
+ * superseded by later ones. Compacting once enough of them pile up bounds the
+ * records replayed at boot.
+ */
+static bool compact_due(void)
+{
+    return db.records >= 2U * example_node_index_count() + CONFIG_FAST_PROV_NODE_DB_COMPACT_DEAD;
+}
+
+static esp_err_t rec_append(uint16_t type, const void *payload, uint16_t len)
+{
+    esp_err_t err;
+
+    if (!db.part) {
+        return ESP_OK;
+    }
+
+    err = rec_write(db.active, &db.tail, type, payload, len);
+    if (err == ESP_OK) {
+        db.records++;
+        if (db.full) {
+            return ESP_OK;
+        }
+        if (compact_due() && db.spare == SPARE_ERASED) {
+            if (compact_rewrite() != ESP_OK) {
+                /* The record is in the log, compaction is tried again on the next one */
+                ESP_LOGW(TAG, "%s: Compaction failed", __func__);
+            }
+        } else if (compact_due() || db.tail >= db.half_size / 4 * 3) {
+            /* So the spare half is ready before the active one is full */
+            spare_request();
+        }
+        return ESP_OK;
+    }
+    if (err != ESP_ERR_NO_MEM) {
+        ESP_LOGW(TAG, "%s: Write at 0x%" PRIx32 " failed (err %d)", __func__, db.tail, err);
+    } else if (db.full) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    /* The node index already holds the change, compaction writes it to a freshly
+     * erased half, past a full log or a partly written record alike.
+     */
+    return example_node_db_compact();
+}
+
+esp_err_t example_node_db_put_node(const example_node_info_t *node)
+{
+    node_db_node_t rec;
+
+    if (!node) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    node_to_rec(node, &rec);
+    return rec_append(REC_NODE, &rec, sizeof(rec));
+}
+
+esp_err_t example_node_db_put_range(const example_node_info_t *node)
+{
+    node_db_range_t rec;
+
+    if (!node) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    range_to_rec(node, &rec);
+    return rec_append(REC_RANGE, &rec, sizeof(rec));
+}
+
+esp_err_t example_node_db_erase(void)
+{
+    esp_err_t err;
+
+    if (!db.part) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(db.erase_lock, portMAX_DELAY);
+    err = esp_partition_erase_range(db.part, 0, db.part->size);
+    db.spare = err == ESP_OK ? SPARE_ERASED : SPARE_DIRTY;
+    xSemaphoreGive(db.erase_lock);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    db.active = 0;
+    db.gen = 1;
+    db.tail = sizeof(node_db_half_t);
+    db.records = 0;
+    db.full = false;
+    return half_format(0, db.gen);
+}
+
+esp_err_t example_node_db_init(uint16_t *restored)
+{
+    const node_db_half_t *half[2];
+    spi_flash_mmap_handle_t handle;
+    const void *base;
+    bool clean;
+    esp_err_t err;
+
+    if (restored) {
+        *restored = 0;
+    }
+
+    db.part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                       CONFIG_FAST_PROV_NODE_DB_PARTITION);
+    if (!db.part) {
+        ESP_LOGW(TAG, "No \"%s\" partition, nodes are kept in RAM only", CONFIG_FAST_PROV_NODE_DB_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (db.part->size < 2 * NODE_DB_SECTOR || db.part->size % (2 * NODE_DB_SECTOR)) {
+        ESP_LOGE(TAG, "Partition size 0x%" PRIx32 " is not an even number of sectors", db.part->size);
+        db.part = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+    db.half_size = db.part->size / 2;
+    db.spare = SPARE_DIRTY;
+    db.full = false;
+
+    if (!db.erase_lock && (db.erase_lock = xSemaphoreCreateMutex()) == NULL) {
+        db.part = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    if (!db.task && xTaskCreate(node_db_task, "node_db", NODE_DB_TASK_STACK, NULL,
+                                tskIDLE_PRIORITY + 1, &db.task) != pdPASS) {
+        db.part = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    err = esp_partition_mmap(db.part, 0, db.part->size, SPI_FLASH_MMAP_DATA, &base, &handle);
+    if (err != ESP_OK) {
+        db.part = NULL;
+        return err;
+    }
+
+    half[0] = base;
+    half[1] = (const node_db_half_t *)((const uint8_t *)base + db.half_size);
+    if (!half_valid(half[0]) && !half_valid(half[1])) {
+        spi_flash_munmap(handle);
+        ESP_LOGI(TAG, "Formatting \"%s\"", CONFIG_FAST_PROV_NODE_DB_PARTITION);
+        return example_node_db_erase();
+    }
+
+    /* The newest half, the generation may have wrapped */
+    db.active = !half_valid(half[0]) ||
+                (half_valid(half[1]) && (int32_t)(half[1]->gen - half[0]->gen) > 0);
+    db.gen = half[db.active]->gen;
+    db.records = 0;
+
+    clean = half_replay((const uint8_t *)half[db.active]);
+    spi_flash_munmap(handle);
+
+    if (restored) {
+        *restored = example_node_index_count();
+    }
+    ESP_LOGI(TAG, "Restored %u nodes from %" PRIu32 " records", example_node_index_count(), db.records);
+
+    if (!clean) {
+        /* Appending after a damaged record would hide the new ones at the next boot */
+        ESP_LOGW(TAG, "Damaged record at 0x%" PRIx32 ", compacting", db.tail);
+        return example_node_db_compact();
+    }
+    if (compact_due()) {
+        return example_node_db_compact();
+    }
+    return ESP_OK;
+}
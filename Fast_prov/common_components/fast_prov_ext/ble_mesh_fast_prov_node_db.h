@@ -0,0 +1,68 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BLE_MESH_FAST_PROV_NODE_DB_H_
+#define _BLE_MESH_FAST_PROV_NODE_DB_H_
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#include "ble_mesh_fast_prov_operation.h"
+
+#ifndef CONFIG_FAST_PROV_NODE_DB_PARTITION
+#define CONFIG_FAST_PROV_NODE_DB_PARTITION  "fp_nodes"
+#endif
+
+#ifndef CONFIG_FAST_PROV_NODE_DB_COMPACT_DEAD
+#define CONFIG_FAST_PROV_NODE_DB_COMPACT_DEAD   128
+#endif
+
+/* The node database keeps the provisioned nodes and the address range given
+ * to each of them across a restart. It is a log of CRC-checked records in its
+ * own data partition, split into two halves: records are appended to the
+ * active half, and once it is full or holds CONFIG_FAST_PROV_NODE_DB_COMPACT_DEAD
+ * superseded records, the nodes still indexed are written to the other half,
+ * which becomes the active one. A record costs one flash write, and the log is
+ * replayed from a single memory-mapped read at boot.
+ *
+ * The other half is erased ahead of time by a low priority task, once
+ * compaction is due or the active half is three quarters full, and the nodes
+ * are written to it at the next append. Only an append finding the active half
+ * full before that erases it in the caller's context. If the nodes do not fit
+ * in a half, compaction is not tried again until the database is erased.
+ *
+ * Not thread safe, to be called from the mesh callback context only.
+ */
+
+/* Finds the partition and replays the log into the node index. Fails with
+ * ESP_ERR_NOT_FOUND if the partition table has no such partition, in which
+ * case the other calls do nothing and nodes are only kept in RAM.
+ */
+esp_err_t example_node_db_init(uint16_t *restored);
+
+/* Records the node as stored by example_node_index_store() */
+esp_err_t example_node_db_put_node(const example_node_info_t *node);
+
+/* Records the unicast address range assigned to the node */
+esp_err_t example_node_db_put_range(const example_node_info_t *node);
+
+/* Rewrites the nodes of the node index into the other half, erasing it first
+ * unless the task already did
+ */
+esp_err_t example_node_db_compact(void);
+
+/* Forgets every node, the node index itself is left as it is */
+esp_err_t example_node_db_erase(void);
+
+#endif /* _BLE_MESH_FAST_PROV_NODE_DB_H_ */
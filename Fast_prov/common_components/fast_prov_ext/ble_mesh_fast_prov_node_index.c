@@ -0,0 +1,308 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "ble_mesh_fast_prov_node_index.h"
+
+#define TAG "NODE_INDEX"
+
+#define NODE_INDEX_MASK     (FAST_PROV_NODE_INDEX_SLOTS - 1)
+
+_Static_assert(FAST_PROV_NODE_INDEX_SLOTS >= 2 * CONFIG_BLE_MESH_MAX_PROV_NODES,
+               "FAST_PROV_NODE_INDEX_BITS is too small for BLE_MESH_MAX_PROV_NODES");
+
+/* A key of 0 marks an empty slot. UUID keys are forced non-zero and unicast
+ * addresses are never 0 (ESP_BLE_MESH_ADDR_UNASSIGNED), so no extra flag is needed.
+ */
+typedef struct {
+    uint32_t key;
+    uint16_t addr;      /* Address the node was indexed under (UUID table only) */
+    example_node_info_t *node;
+} node_slot_t;
+
+typedef struct {
+    node_slot_t slot[FAST_PROV_NODE_INDEX_SLOTS];
+    uint16_t count;
+} node_table_t;
+
+static node_table_t uuid_tbl;
+static node_table_t addr_tbl;
+
+/* The index owns the node entries, so storing a node never walks the node
+ * array of the fast_provisioning component. Entries are taken in order and
+ * the removed ones are reused first.
+ */
+static example_node_info_t node_pool[CONFIG_BLE_MESH_MAX_PROV_NODES];
+static example_node_info_t *node_free[CONFIG_BLE_MESH_MAX_PROV_NODES];
+static uint16_t node_free_cnt;
+static uint16_t node_used;
+
+uint32_t example_node_index_uuid_hash(const uint8_t uuid[16])
+{
+    /* FNV-1a, the leading bytes of ESP device UUIDs are constant so all 16 are mixed */
+    uint32_t hash = 0x811C9DC5;
+
+    for (int i = 0; i < 16; i++) {
+        hash ^= uuid[i];
+        hash *= 0x01000193;
+    }
+
+    return hash ? hash : 1;
+}
+
+static inline uint32_t slot_home(uint32_t key)
+{
+    /* Fibonacci hashing, takes the top bits of the product */
+    return (key * 0x9E3779B1U) >> (32 - CONFIG_FAST_PROV_NODE_INDEX_BITS);
+}
+
+static int slot_find(const node_table_t *tbl, uint32_t key, const uint8_t *uuid)
+{
+    uint32_t i = slot_home(key);
+
+    for (uint32_t n = 0; n < FAST_PROV_NODE_INDEX_SLOTS; n++, i = (i + 1) & NODE_INDEX_MASK) {
+        const node_slot_t *slot = &tbl->slot[i];
+        if (slot->key == 0) {
+            return -1;
+        }
+        if (slot->key == key && (uuid == NULL || !memcmp(slot->node->uuid, uuid, 16))) {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+static node_slot_t *slot_insert(node_table_t *tbl, uint32_t key)
+{
+    uint32_t i = slot_home(key);
+
+    if (tbl->count >= FAST_PROV_NODE_INDEX_SLOTS - 1) {
+        return NULL;
+    }
+
+    while (tbl->slot[i].key != 0) {
+        i = (i + 1) & NODE_INDEX_MASK;
+    }
+
+    tbl->slot[i].key = key;
+    tbl->count++;
+    return &tbl->slot[i];
+}
+
+static void slot_delete(node_table_t *tbl, uint32_t i)
+{
+    uint32_t j = i;
+
+    /* Backward-shift deletion: pull every following entry of the cluster whose
+     * home slot is not in (i, j] back into the hole, so lookups never need
+     * tombstones.
+     */
+    for (;;) {
+        j = (j + 1) & NODE_INDEX_MASK;
+        if (tbl->slot[j].key == 0) {
+            break;
+        }
+        uint32_t home = slot_home(tbl->slot[j].key);
+        if (((j - home) & NODE_INDEX_MASK) >= ((j - i) & NODE_INDEX_MASK)) {
+            tbl->slot[i] = tbl->slot[j];
+            i = j;
+        }
+    }
+
+    memset(&tbl->slot[i], 0, sizeof(node_slot_t));
+    tbl->count--;
+}
+
+static void addr_unlink(uint16_t addr, const example_node_info_t *node)
+{
+    int i = slot_find(&addr_tbl, addr, NULL);
+
+    if (i >= 0 && addr_tbl.slot[i].node == node) {
+        slot_delete(&addr_tbl, i);
+    }
+}
+
+static example_node_info_t *node_alloc(void)
+{
+    if (node_free_cnt) {
+        return node_free[--node_free_cnt];
+    }
+    if (node_used < CONFIG_BLE_MESH_MAX_PROV_NODES) {
+        return &node_pool[node_used++];
+    }
+    return NULL;
+}
+
+static void node_release(example_node_info_t *node)
+{
+    memset(node, 0, sizeof(example_node_info_t));
+    node_free[node_free_cnt++] = node;
+}
+
+static esp_err_t node_link(example_node_info_t *node)
+{
+    node_slot_t *slot = NULL;
+    uint32_t key;
+    int i;
+
+    key = example_node_index_uuid_hash(node->uuid);
+    i = slot_find(&uuid_tbl, key, node->uuid);
+    if (i >= 0) {
+        slot = &uuid_tbl.slot[i];
+        if (slot->addr != node->unicast_addr) {
+            /* Re-provisioned with a new address, drop the stale address key */
+            addr_unlink(slot->addr, node);
+        }
+    } else {
+        slot = slot_insert(&uuid_tbl, key);
+        if (!slot) {
+            ESP_LOGE(TAG, "%s: UUID table is full", __func__);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    slot->node = node;
+    slot->addr = node->unicast_addr;
+
+    i = slot_find(&addr_tbl, node->unicast_addr, NULL);
+    if (i >= 0) {
+        addr_tbl.slot[i].node = node;
+        return ESP_OK;
+    }
+
+    slot = slot_insert(&addr_tbl, node->unicast_addr);
+    if (!slot) {
+        ESP_LOGE(TAG, "%s: Address table is full", __func__);
+        slot_delete(&uuid_tbl, slot_find(&uuid_tbl, key, node->uuid));
+        return ESP_ERR_NO_MEM;
+    }
+    slot->node = node;
+
+    return ESP_OK;
+}
+
+esp_err_t example_node_index_store(const uint8_t uuid[16], uint16_t unicast_addr,
+                                   uint8_t elem_num, uint16_t net_idx,
+                                   uint16_t app_idx, uint8_t onoff)
+{
+    example_node_info_t *node = NULL;
+    esp_err_t err;
+
+    if (!uuid || !ESP_BLE_MESH_ADDR_IS_UNICAST(unicast_addr) || !elem_num) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    node = example_node_index_find_by_uuid(uuid);
+    if (node) {
+        ESP_LOGW(TAG, "%s: Reprovisioned node", __func__);
+        node->reprov = true;
+    } else {
+        node = node_alloc();
+        if (!node) {
+            ESP_LOGE(TAG, "%s: Node pool is full", __func__);
+            return ESP_FAIL;
+        }
+        memcpy(node->uuid, uuid, 16);
+        node->reprov = false;
+    }
+
+    node->unicast_addr = unicast_addr;
+    node->element_num = elem_num;
+    node->net_idx = net_idx;
+    node->app_idx = app_idx;
+    node->onoff = onoff;
+
+    err = node_link(node);
+    if (err != ESP_OK) {
+        /* No longer reachable through either table */
+        node_release(node);
+    }
+    return err;
+}
+
+esp_err_t example_node_index_remove(const uint8_t uuid[16])
+{
+    example_node_info_t *node = NULL;
+    int i;
+
+    if (!uuid) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    i = slot_find(&uuid_tbl, example_node_index_uuid_hash(uuid), uuid);
+    if (i < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    node = uuid_tbl.slot[i].node;
+    addr_unlink(uuid_tbl.slot[i].addr, node);
+    slot_delete(&uuid_tbl, i);
+    node_release(node);
+
+    return ESP_OK;
+}
+
+example_node_info_t *example_node_index_find_by_uuid(const uint8_t uuid[16])
+{
+    int i;
+
+    if (!uuid) {
+        return NULL;
+    }
+
+    i = slot_find(&uuid_tbl, example_node_index_uuid_hash(uuid), uuid);
+    return i < 0 ? NULL : uuid_tbl.slot[i].node;
+}
+
+example_node_info_t *example_node_index_find_by_addr(uint16_t unicast_addr)
+{
+    int i;
+
+    if (!ESP_BLE_MESH_ADDR_IS_UNICAST(unicast_addr)) {
+        return NULL;
+    }
+
+    /* Only primary addresses are indexed, a miss is final */
+    i = slot_find(&addr_tbl, unicast_addr, NULL);
+    return i < 0 ? NULL : addr_tbl.slot[i].node;
+}
+
+bool example_node_index_exist(const uint8_t uuid[16])
+{
+    return example_node_index_find_by_uuid(uuid) != NULL;
+}
+
+uint16_t example_node_index_count(void)
+{
+    return uuid_tbl.count;
+}
+
+void example_node_index_foreach(bool (*cb)(example_node_info_t *node, void *arg), void *arg)
+{
+    for (uint32_t i = 0; i < FAST_PROV_NODE_INDEX_SLOTS; i++) {
+        if (uuid_tbl.slot[i].key != 0 && !cb(uuid_tbl.slot[i].node, arg)) {
+            return;
+        }
+    }
+}
+
+void example_node_index_reset(void)
+{
+    memset(&uuid_tbl, 0, sizeof(uuid_tbl));
+    memset(&addr_tbl, 0, sizeof(addr_tbl));
+    memset(node_pool, 0, sizeof(node_pool));
+    node_free_cnt = 0;
+    node_used = 0;
+}
@@ -0,0 +1,66 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BLE_MESH_FAST_PROV_NODE_INDEX_H_
+#define _BLE_MESH_FAST_PROV_NODE_INDEX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#include "ble_mesh_fast_prov_operation.h"
+
+#ifndef CONFIG_FAST_PROV_NODE_INDEX_BITS
+#define CONFIG_FAST_PROV_NODE_INDEX_BITS    6
+#endif
+
+#define FAST_PROV_NODE_INDEX_SLOTS  (1U << CONFIG_FAST_PROV_NODE_INDEX_BITS)
+
+/* The node index replaces the node array kept by the fast_provisioning
+ * component and resolves a device UUID or a primary unicast address to its
+ * example_node_info_t entry with a single hashed probe sequence, instead of
+ * walking the whole array as example_is_node_exist() and example_get_node_info()
+ * do. It never allocates; the entries come from a pool of
+ * BLE_MESH_MAX_PROV_NODES, and both tables are fixed-size and use linear probing
+ * with backward-shift deletion, so no tombstones build up over a rollout.
+ */
+
+/* Stores the node info in an entry of the index, in place of
+ * example_store_node_info(). A re-provisioned device keeps its entry, with
+ * reprov set; only its address key is updated.
+ */
+esp_err_t example_node_index_store(const uint8_t uuid[16], uint16_t unicast_addr,
+                                   uint8_t elem_num, uint16_t net_idx,
+                                   uint16_t app_idx, uint8_t onoff);
+
+esp_err_t example_node_index_remove(const uint8_t uuid[16]);
+
+example_node_info_t *example_node_index_find_by_uuid(const uint8_t uuid[16]);
+
+/* Only the primary element address of a node is indexed */
+example_node_info_t *example_node_index_find_by_addr(uint16_t unicast_addr);
+
+bool example_node_index_exist(const uint8_t uuid[16]);
+
+uint16_t example_node_index_count(void);
+
+/* Calls cb for every indexed node, in no particular order, until it returns false */
+void example_node_index_foreach(bool (*cb)(example_node_info_t *node, void *arg), void *arg);
+
+void example_node_index_reset(void);
+
+/* Hash of a device UUID, never 0, also used by the beacon filter */
+uint32_t example_node_index_uuid_hash(const uint8_t uuid[16]);
+
+#endif /* _BLE_MESH_FAST_PROV_NODE_INDEX_H_ */
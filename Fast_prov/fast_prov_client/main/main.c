@@ -29,7 +29,13 @@
 #include "ble_mesh_fast_prov_common.h"
 #include "ble_mesh_fast_prov_operation.h"
 #include "ble_mesh_fast_prov_client_model.h"
+#include "ble_mesh_fast_prov_node_index.h"
+#include "ble_mesh_fast_prov_node_db.h"
+#include "ble_mesh_fast_prov_cfg_engine.h"
+#include "ble_mesh_fast_prov_link_ctrl.h"
+#include "ble_mesh_fast_prov_beacon_filter.h"
 #include "ble_mesh_example_init.h"
+#include "trace_events.h"
 
 #define TAG "EXAMPLE"
 
@@ -131,8 +137,11 @@ static void provisioner_prov_link_close(esp_ble_mesh_prov_bearer_t bearer, uint8
     ESP_LOGI(TAG, "%s link close, reason 0x%02x",
              bearer == ESP_BLE_MESH_PROV_ADV ? "PB-ADV" : "PB-GATT", reason);
 
-    if (bearer == ESP_BLE_MESH_PROV_ADV && reason != 0x00) {
-        prov_info.max_node_num++;
+    if (bearer == ESP_BLE_MESH_PROV_ADV) {
+        example_link_ctrl_close(reason);
+        if (reason != 0x00) {
+            prov_info.max_node_num++;
+        }
     }
 }
 
@@ -154,21 +163,36 @@ static void provisioner_prov_complete(int node_index, const uint8_t uuid[16], ui
     }
 
     /* Sets node info */
-    err = example_store_node_info(uuid, unicast_addr, elem_num, prov_info.net_idx,
-                                  prov_info.app_idx, LED_OFF);
+    err = example_node_index_store(uuid, unicast_addr, elem_num, prov_info.net_idx,
+                                   prov_info.app_idx, LED_OFF);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "%s: Failed to set node info", __func__);
         return;
     }
 
     /* Gets node info */
-    node = example_get_node_info(unicast_addr);
+    node = example_node_index_find_by_addr(unicast_addr);
     if (!node) {
         ESP_LOGE(TAG, "%s: Failed to get node info", __func__);
         return;
     }
 
-    /* The Provisioner will send Config AppKey Add to the node. */
+    if (example_node_db_put_node(node) != ESP_OK) {
+        ESP_LOGW(TAG, "%s: Failed to log node 0x%04x", __func__, unicast_addr);
+    }
+
+    /* The configuration engine will send Config AppKey Add and then Fast Prov Info Set
+     * to the node, interleaved with the other nodes being configured.
+     */
+    err = example_cfg_engine_enqueue(node);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: Failed to queue node 0x%04x for configuration", __func__, unicast_addr);
+        return;
+    }
+}
+
+static esp_err_t example_cfg_send_step(example_node_info_t *node, example_cfg_step_t step)
+{
     example_msg_common_info_t info = {
         .net_idx = node->net_idx,
         .app_idx = node->app_idx,
@@ -176,16 +200,47 @@ static void provisioner_prov_complete(int node_index, const uint8_t uuid[16], ui
         .timeout = 0,
         .role = ROLE_PROVISIONER,
     };
-    esp_ble_mesh_cfg_app_key_add_t add_key = {
-        .net_idx = prov_info.net_idx,
-        .app_idx = prov_info.app_idx,
-    };
-    memcpy(add_key.app_key, prov_info.app_key, 16);
-    err = example_send_config_appkey_add(config_client.model, &info, &add_key);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "%s: Failed to send Config AppKey Add message", __func__);
+
+    switch (step) {
+    case FAST_PROV_CFG_STEP_APPKEY_ADD: {
+        esp_ble_mesh_cfg_app_key_add_t add_key = {
+            .net_idx = prov_info.net_idx,
+            .app_idx = prov_info.app_idx,
+        };
+        memcpy(add_key.app_key, prov_info.app_key, 16);
+        return example_send_config_appkey_add(config_client.model, &info, &add_key);
+    }
+    case FAST_PROV_CFG_STEP_INFO_SET: {
+        example_fast_prov_info_set_t set = {0};
+        set.ctx_flags = 0x037F;
+        memcpy(&set.node_addr_cnt, &node->node_addr_cnt,
+               sizeof(example_node_info_t) - offsetof(example_node_info_t, node_addr_cnt));
+        return example_send_fast_prov_info_set(fast_prov_client.model, &info, &set);
+    }
+    default:
+        return ESP_ERR_INVALID_ARG;
+    }
+}
+
+static void example_cfg_complete(example_node_info_t *node, esp_err_t result)
+{
+    example_cfg_engine_stats_t stats;
+
+    if (result != ESP_OK) {
+        ESP_LOGE(TAG, "%s: Failed to configure node 0x%04x", __func__, node->unicast_addr);
+    } else {
+        ESP_LOGD(TAG, "%s: Node 0x%04x configured", __func__, node->unicast_addr);
+    }
+
+    /* Summarize the rollout once the engine has nothing left to do */
+    example_cfg_engine_get_stats(&stats);
+    if (stats.pending || stats.in_flight) {
         return;
     }
+    ESP_LOGI(TAG, "Configuration done %d, failed %d, retries %d, latency p50 %d ms, p99 %d ms, max %d ms",
+             stats.nodes_done, stats.nodes_failed, stats.retries,
+             example_cfg_engine_latency_pct(&stats, 50), example_cfg_engine_latency_pct(&stats, 99),
+             stats.latency_max_ms);
 }
 
 static void example_recv_unprov_adv_pkt(uint8_t dev_uuid[16], uint8_t addr[BLE_MESH_ADDR_LEN],
@@ -198,11 +253,16 @@ static void example_recv_unprov_adv_pkt(uint8_t dev_uuid[16], uint8_t addr[BLE_M
     bool reprov;
 
     if (bearer & ESP_BLE_MESH_PROV_ADV) {
+        /* Drops the repeated beacons of a device which has just been added */
+        if (example_beacon_filter_seen(dev_uuid)) {
+            return;
+        }
+
         /* Checks if the device has been provisioned previously. If the device
          * is a re-provisioned one, we will ignore the 'max_node_num' count and
-         * start to provision it directly.
+         * the link window, and start to provision it directly.
          */
-        reprov = example_is_node_exist(dev_uuid);
+        reprov = example_node_index_exist(dev_uuid);
         if (reprov) {
             goto add;
         }
@@ -211,6 +271,14 @@ static void example_recv_unprov_adv_pkt(uint8_t dev_uuid[16], uint8_t addr[BLE_M
             return;
         }
 
+        /* The number of concurrent PB-ADV links follows the link controller
+         * window. With BLE_MESH_PBA_SAME_TIME=1 the window is always 1, which the
+         * stack enforces anyway, so it only keeps the link statistics.
+         */
+        if (!example_link_ctrl_can_start()) {
+            return;
+        }
+
         ESP_LOGI(TAG, "address:  %s, address type: %d, adv type: %d", bt_hex(addr, 6), addr_type, adv_type);
         ESP_LOGI(TAG, "dev uuid: %s", bt_hex(dev_uuid, 16));
         ESP_LOGI(TAG, "oob info: %d, bearer: %s", oob_info, (bearer & ESP_BLE_MESH_PROV_ADV) ? "PB-ADV" : "PB-GATT");
@@ -227,6 +295,8 @@ add:
             ESP_LOGE(TAG, "%s: Failed to start provisioning a device", __func__);
             return;
         }
+        example_link_ctrl_start();
+        example_beacon_filter_add(dev_uuid);
 
         if (!reprov) {
             if (prov_info.max_node_num) {
@@ -331,7 +401,7 @@ static void example_custom_model_callback(esp_ble_mesh_model_cb_event_t event,
         case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_STATUS:
         case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NET_KEY_STATUS:
         case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_STATUS: {
-            ESP_LOGI(TAG, "%s: Fast Prov Client Model receives status, opcode 0x%04x", __func__, opcode);
+            BIN_TRACEI(TRACE_CLI_RECV, opcode, param->model_operation.ctx->addr, 0);
             err = example_fast_prov_client_recv_status(param->model_operation.model,
                     param->model_operation.ctx,
                     param->model_operation.length,
@@ -340,29 +410,34 @@ static void example_custom_model_callback(esp_ble_mesh_model_cb_event_t event,
                 ESP_LOGE(TAG, "%s: Failed to handle fast prov status message", __func__);
                 return;
             }
+            if (opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_STATUS) {
+                example_cfg_engine_step_done(param->model_operation.ctx->addr, opcode);
+            }
             break;
         }
         default:
-            ESP_LOGI(TAG, "%s: opcode 0x%04x", __func__, param->model_operation.opcode);
+            BIN_TRACEI(TRACE_VND_RECV, opcode, param->model_operation.ctx->addr, 0);
             break;
         }
         break;
     }
     case ESP_BLE_MESH_MODEL_SEND_COMP_EVT:
-        ESP_LOGI(TAG, "ESP_BLE_MESH_MODEL_SEND_COMP_EVT, err_code %d",
-                 param->model_send_comp.err_code);
+        BIN_TRACEI(TRACE_SEND_COMP, param->model_send_comp.opcode, param->model_send_comp.err_code, 0);
         break;
     case ESP_BLE_MESH_MODEL_PUBLISH_COMP_EVT:
-        ESP_LOGI(TAG, "ESP_BLE_MESH_MODEL_PUBLISH_COMP_EVT, err_code %d",
-                 param->model_publish_comp.err_code);
+        BIN_TRACEI(TRACE_PUB_COMP, param->model_publish_comp.err_code, 0, 0);
         break;
     case ESP_BLE_MESH_CLIENT_MODEL_RECV_PUBLISH_MSG_EVT:
-        ESP_LOGI(TAG, "ESP_BLE_MESH_MODEL_CLIENT_RECV_PUBLISH_MSG_EVT, opcode 0x%04x",
-                 param->client_recv_publish_msg.opcode);
+        BIN_TRACEI(TRACE_CLI_RECV_PUB, param->client_recv_publish_msg.opcode, 0, 0);
         break;
     case ESP_BLE_MESH_CLIENT_MODEL_SEND_TIMEOUT_EVT:
-        ESP_LOGI(TAG, "ESP_BLE_MESH_CLIENT_MODEL_SEND_TIMEOUT_EVT, opcode 0x%04x, dst 0x%04x",
-                 param->client_send_timeout.opcode, param->client_send_timeout.ctx->addr);
+        BIN_TRACEW(TRACE_CLI_TIMEOUT, param->client_send_timeout.opcode, param->client_send_timeout.ctx->addr, 0);
+        if (param->client_send_timeout.opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_SET) {
+            /* Fast Prov Info Set is retransmitted by the configuration engine */
+            example_cfg_engine_step_fail(param->client_send_timeout.ctx->addr,
+                                         param->client_send_timeout.opcode);
+            break;
+        }
         err = example_fast_prov_client_recv_timeout(param->client_send_timeout.opcode,
                 param->client_send_timeout.model,
                 param->client_send_timeout.ctx);
@@ -382,15 +457,16 @@ static void example_config_client_callback(esp_ble_mesh_cfg_client_cb_event_t ev
     example_node_info_t *node = NULL;
     uint32_t opcode;
     uint16_t address;
-    esp_err_t err;
-
-    ESP_LOGI(TAG, "%s, error_code = 0x%02x, event = 0x%02x, addr: 0x%04x",
-             __func__, param->error_code, event, param->params->ctx.addr);
 
     opcode  = param->params->opcode;
     address = param->params->ctx.addr;
 
-    node = example_get_node_info(address);
+    BIN_TRACEI(TRACE_CFG_CLI_EVT, event, opcode, address);
+    if (param->error_code) {
+        BIN_TRACEW(TRACE_CFG_CLI_ERR, param->error_code, address, 0);
+    }
+
+    node = example_node_index_find_by_addr(address);
     if (!node) {
         ESP_LOGE(TAG, "%s: Failed to get node info", __func__);
         return;
@@ -398,6 +474,7 @@ static void example_config_client_callback(esp_ble_mesh_cfg_client_cb_event_t ev
 
     if (param->error_code) {
         ESP_LOGE(TAG, "Failed to send config client message, opcode: 0x%04x", opcode);
+        example_cfg_engine_step_fail(address, opcode);
         return;
     }
 
@@ -406,8 +483,7 @@ static void example_config_client_callback(esp_ble_mesh_cfg_client_cb_event_t ev
         break;
     case ESP_BLE_MESH_CFG_CLIENT_SET_STATE_EVT:
         switch (opcode) {
-        case ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD: {
-            example_fast_prov_info_set_t set = {0};
+        case ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD:
             if (!node->reprov || !ESP_BLE_MESH_ADDR_IS_UNICAST(node->unicast_min)) {
                 /* If the node is a new one or the node is re-provisioned but the information of the node
                  * has not been set before, here we will set the Fast Prov Info Set info to the node.
@@ -423,23 +499,8 @@ static void example_config_client_callback(esp_ble_mesh_cfg_client_cb_event_t ev
                 memcpy(node->match_val, prov_info.match_val, prov_info.match_len);
                 node->action        = 0x81;
             }
-            set.ctx_flags = 0x037F;
-            memcpy(&set.node_addr_cnt, &node->node_addr_cnt,
-                   sizeof(example_node_info_t) - offsetof(example_node_info_t, node_addr_cnt));
-            example_msg_common_info_t info = {
-                .net_idx = node->net_idx,
-                .app_idx = node->app_idx,
-                .dst = node->unicast_addr,
-                .timeout = 0,
-                .role = ROLE_PROVISIONER,
-            };
-            err = example_send_fast_prov_info_set(fast_prov_client.model, &info, &set);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "%s: Failed to set Fast Prov Info Set message", __func__);
-                return;
-            }
+            example_cfg_engine_step_done(address, opcode);
             break;
-        }
         default:
             break;
         }
@@ -448,26 +509,9 @@ static void example_config_client_callback(esp_ble_mesh_cfg_client_cb_event_t ev
         break;
     case ESP_BLE_MESH_CFG_CLIENT_TIMEOUT_EVT:
         switch (opcode) {
-        case ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD: {
-            example_msg_common_info_t info = {
-                .net_idx = node->net_idx,
-                .app_idx = node->app_idx,
-                .dst = node->unicast_addr,
-                .timeout = 0,
-                .role = ROLE_PROVISIONER,
-            };
-            esp_ble_mesh_cfg_app_key_add_t add_key = {
-                .net_idx = prov_info.net_idx,
-                .app_idx = prov_info.app_idx,
-            };
-            memcpy(add_key.app_key, prov_info.app_key, 16);
-            err = example_send_config_appkey_add(config_client.model, &info, &add_key);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "%s: Failed to send Config AppKey Add message", __func__);
-                return;
-            }
+        case ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD:
+            example_cfg_engine_step_fail(address, opcode);
             break;
-        }
         default:
             break;
         }
@@ -485,13 +529,15 @@ static void example_generic_client_callback(esp_ble_mesh_generic_client_cb_event
     uint32_t opcode;
     uint16_t address;
 
-    ESP_LOGI(TAG, "%s, error_code = 0x%02x, event = 0x%02x, addr: 0x%04x",
-             __func__, param->error_code, event, param->params->ctx.addr);
-
     opcode  = param->params->opcode;
     address = param->params->ctx.addr;
 
-    node = example_get_node_info(address);
+    BIN_TRACEI(TRACE_GEN_CLI_EVT, event, opcode, address);
+    if (param->error_code) {
+        BIN_TRACEW(TRACE_GEN_CLI_ERR, param->error_code, address, 0);
+    }
+
+    node = example_node_index_find_by_addr(address);
     if (!node) {
         ESP_LOGE(TAG, "%s: Failed to get node info", __func__);
         return;
@@ -509,7 +555,7 @@ static void example_generic_client_callback(esp_ble_mesh_generic_client_cb_event
         switch (opcode) {
         case ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET:
             node->onoff = param->status_cb.onoff_status.present_onoff;
-            ESP_LOGI(TAG, "node->onoff: 0x%02x", node->onoff);
+            BIN_TRACEI(TRACE_ONOFF_STATUS, address, node->onoff, 0);
             break;
         default:
             break;
@@ -557,6 +603,23 @@ static esp_err_t ble_mesh_init(void)
         return ESP_FAIL;
     }
 
+    example_cfg_engine_config_t cfg_engine = EXAMPLE_CFG_ENGINE_DEFAULT_CONFIG(example_cfg_send_step,
+                                                                              example_cfg_complete);
+    err = example_cfg_engine_init(&cfg_engine);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: Failed to initialize configuration engine", __func__);
+        return ESP_FAIL;
+    }
+
+    example_link_ctrl_config_t link_ctrl = EXAMPLE_LINK_CTRL_DEFAULT_CONFIG(CONFIG_BLE_MESH_PBA_SAME_TIME);
+    err = example_link_ctrl_init(&link_ctrl);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: Failed to initialize provisioning link controller", __func__);
+        return ESP_FAIL;
+    }
+
+    example_beacon_filter_init(CONFIG_FAST_PROV_BEACON_WINDOW_MS);
+
     err = esp_ble_mesh_provisioner_prov_enable(ESP_BLE_MESH_PROV_ADV | ESP_BLE_MESH_PROV_GATT);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "%s: Failed to enable provisioning", __func__);
@@ -580,6 +643,12 @@ void app_main(void)
 
     ESP_LOGI(TAG, "Initializing...");
 
+    /* Prints the message traces when idle, and soon after a warning */
+    err = bin_trace_start();
+    if (err) {
+        ESP_LOGE(TAG, "bin_trace_start failed (err %d)", err);
+    }
+
     err = nvs_flash_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES) {
         ESP_ERROR_CHECK(nvs_flash_erase());
@@ -595,6 +664,12 @@ void app_main(void)
 
     ble_mesh_get_dev_uuid(dev_uuid);
 
+    /* Restore the nodes provisioned before a restart, before any mesh callback runs */
+    err = example_node_db_init(NULL);
+    if (err != ESP_OK && err != ESP_ERR_NOT_FOUND) {
+        ESP_LOGE(TAG, "Node database init failed (err %d)", err);
+    }
+
     /* Initialize the Bluetooth Mesh Subsystem */
     err = ble_mesh_init();
     if (err) {
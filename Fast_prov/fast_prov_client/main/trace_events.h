@@ -0,0 +1,28 @@
+/* trace_events.h - Trace events of the Fast Prov client, see bin_trace.h */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef _TRACE_EVENTS_H_
+#define _TRACE_EVENTS_H_
+
+#include "bin_trace.h"
+
+#define EXAMPLE_TRACE_EVENTS(X)                                                         \
+    X(TRACE_CLI_RECV,       "Fast prov client receives status, opcode 0x%06x, src 0x%04x") \
+    X(TRACE_VND_RECV,       "Vendor model receives opcode 0x%06x, src 0x%04x")          \
+    X(TRACE_SEND_COMP,      "Send complete, opcode 0x%06x, err_code %d")                \
+    X(TRACE_PUB_COMP,       "Publish complete, err_code %d")                            \
+    X(TRACE_CLI_RECV_PUB,   "Client receives publish, opcode 0x%06x")                   \
+    X(TRACE_CLI_TIMEOUT,    "Client send timeout, opcode 0x%06x, dst 0x%04x")           \
+    X(TRACE_CFG_CLI_EVT,    "Config client event %u, opcode 0x%04x, addr 0x%04x")       \
+    X(TRACE_CFG_CLI_ERR,    "Config client error_code 0x%02x, addr 0x%04x")             \
+    X(TRACE_GEN_CLI_EVT,    "Generic client event %u, opcode 0x%04x, addr 0x%04x")      \
+    X(TRACE_GEN_CLI_ERR,    "Generic client error_code 0x%02x, addr 0x%04x")            \
+    X(TRACE_ONOFF_STATUS,   "Node 0x%04x, onoff 0x%02x")
+
+enum {
+    EXAMPLE_TRACE_EVENTS(BIN_TRACE_EVENT_ID)
+};
+
+#endif /* _TRACE_EVENTS_H_ */
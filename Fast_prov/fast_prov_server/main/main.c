@@ -30,23 +30,37 @@
 #include "ble_mesh_fast_prov_operation.h"
 #include "ble_mesh_fast_prov_client_model.h"
 #include "ble_mesh_fast_prov_server_model.h"
+#include "ble_mesh_fast_prov_node_index.h"
+#include "ble_mesh_fast_prov_cfg_engine.h"
+#include "ble_mesh_fast_prov_addr_lease.h"
+#include "ble_mesh_fast_prov_link_ctrl.h"
+#include "ble_mesh_fast_prov_beacon_filter.h"
+#include "ble_mesh_fast_prov_addr_batch.h"
+#include "ble_mesh_fast_prov_node_db.h"
 #include "ble_mesh_example_init.h"
+#include "trace_events.h"
 
 #define TAG "EXAMPLE"
 
 extern struct _led_state led_state;
-extern struct k_delayed_work send_self_prov_node_addr_timer;
-extern bt_mesh_atomic_t fast_prov_cli_flags;
 
 static uint8_t dev_uuid[16] = { 0xdd, 0xdd };
-static uint8_t prov_start_num = 0;
 static bool prov_start = false;
 
+/* Nodes whose AppKey Add step is held until the primary Provisioner grants an address lease */
+static example_node_info_t *lease_wait[CONFIG_FAST_PROV_CFG_WINDOW];
+static uint8_t lease_wait_cnt;
+/* Range of the Fast Prov Info Set the address pool was seeded from */
+static uint16_t lease_pool_min, lease_pool_max;
+
 static const esp_ble_mesh_client_op_pair_t fast_prov_cli_op_pair[] = {
     { ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_SET,      ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_STATUS      },
     { ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NET_KEY_ADD,   ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NET_KEY_STATUS   },
     { ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR,     ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_ACK    },
     { ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_GET, ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_STATUS },
+    { ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_GET,     ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_STATUS     },
+    { ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN,  ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN_ACK },
+    { ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_BATCH, ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_BATCH_ACK },
 };
 
 /* Configuration Client Model user_data */
@@ -111,13 +125,19 @@ static esp_ble_mesh_model_op_t fast_prov_srv_op[] = {
     ESP_BLE_MESH_MODEL_OP(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_GET,     0),
     ESP_BLE_MESH_MODEL_OP(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_GROUP_ADD,    2),
     ESP_BLE_MESH_MODEL_OP(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_GROUP_DELETE, 2),
+    ESP_BLE_MESH_MODEL_OP(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_GET,         2),
+    ESP_BLE_MESH_MODEL_OP(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN,      4),
+    ESP_BLE_MESH_MODEL_OP(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_BATCH,   2),
     ESP_BLE_MESH_MODEL_OP_END,
 };
 
 static esp_ble_mesh_model_op_t fast_prov_cli_op[] = {
-    ESP_BLE_MESH_MODEL_OP(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_STATUS,    1),
-    ESP_BLE_MESH_MODEL_OP(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NET_KEY_STATUS, 2),
-    ESP_BLE_MESH_MODEL_OP(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_ACK,  0),
+    ESP_BLE_MESH_MODEL_OP(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_STATUS,      1),
+    ESP_BLE_MESH_MODEL_OP(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NET_KEY_STATUS,   2),
+    ESP_BLE_MESH_MODEL_OP(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_ACK,    0),
+    ESP_BLE_MESH_MODEL_OP(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_STATUS,     1),
+    ESP_BLE_MESH_MODEL_OP(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN_ACK, 1),
+    ESP_BLE_MESH_MODEL_OP(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_BATCH_ACK, 7),
     ESP_BLE_MESH_MODEL_OP_END,
 };
 
@@ -191,8 +211,27 @@ static void provisioner_prov_link_close(esp_ble_mesh_prov_bearer_t bearer, uint8
 {
     ESP_LOGI(TAG, "%s: bearer %s, reason 0x%02x", __func__,
              bearer == ESP_BLE_MESH_PROV_ADV ? "PB-ADV" : "PB-GATT", reason);
-    if (prov_start_num) {
-        prov_start_num--;
+    if (bearer == ESP_BLE_MESH_PROV_ADV) {
+        example_link_ctrl_close(reason);
+    }
+}
+
+/* If the node_addr_cnt configured by the phone is smaller than or equal to the
+ * maximum number of nodes the primary Provisioner can provision, restarts the
+ * timer which is used to send all node addresses to the phone.
+ */
+static void example_gatt_proxy_timer_reset(void)
+{
+    if (fast_prov_server.node_addr_cnt == FAST_PROV_NODE_COUNT_MIN ||
+            fast_prov_server.node_addr_cnt > fast_prov_server.max_node_num) {
+        return;
+    }
+
+    if (bt_mesh_atomic_test_and_clear_bit(fast_prov_server.srv_flags, GATT_PROXY_ENABLE_START)) {
+        k_delayed_work_cancel(&fast_prov_server.gatt_proxy_enable_timer);
+    }
+    if (!bt_mesh_atomic_test_and_set_bit(fast_prov_server.srv_flags, GATT_PROXY_ENABLE_START)) {
+        k_delayed_work_submit(&fast_prov_server.gatt_proxy_enable_timer, GATT_PROXY_ENABLE_TIMEOUT);
     }
 }
 
@@ -202,7 +241,7 @@ static void provisioner_prov_complete(int node_idx, const uint8_t uuid[16], uint
     example_node_info_t *node = NULL;
     esp_err_t err;
 
-    if (example_is_node_exist(uuid) == false) {
+    if (example_node_index_exist(uuid) == false) {
         fast_prov_server.prov_node_cnt++;
     }
 
@@ -210,50 +249,48 @@ static void provisioner_prov_complete(int node_idx, const uint8_t uuid[16], uint
     ESP_LOGI(TAG, "Unicast address 0x%04x", unicast_addr);
 
     /* Sets node info */
-    err = example_store_node_info(uuid, unicast_addr, element_num, net_idx,
-                                  fast_prov_server.app_idx, LED_OFF);
+    err = example_node_index_store(uuid, unicast_addr, element_num, net_idx,
+                                   fast_prov_server.app_idx, LED_OFF);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "%s: Failed to set node info", __func__);
         return;
     }
 
     /* Gets node info */
-    node = example_get_node_info(unicast_addr);
+    node = example_node_index_find_by_addr(unicast_addr);
     if (!node) {
         ESP_LOGE(TAG, "%s: Failed to get node info", __func__);
         return;
     }
 
+    if (example_node_db_put_node(node) != ESP_OK) {
+        ESP_LOGW(TAG, "%s: Failed to log node 0x%04x", __func__, unicast_addr);
+    }
+
     if (fast_prov_server.primary_role == true) {
         /* If the Provisioner is the primary one (i.e. provisioned by the phone), it shall
-         * store self-provisioned node addresses;
-         * If the node_addr_cnt configured by the phone is small than or equal to the
-         * maximum number of nodes it can provision, it shall reset the timer which is used
-         * to send all node addresses to the phone.
+         * store self-provisioned node addresses.
          */
         err = example_store_remote_node_address(unicast_addr);
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "%s: Failed to store node address 0x%04x", __func__, unicast_addr);
             return;
         }
-        if (fast_prov_server.node_addr_cnt != FAST_PROV_NODE_COUNT_MIN &&
-            fast_prov_server.node_addr_cnt <= fast_prov_server.max_node_num) {
-            if (bt_mesh_atomic_test_and_clear_bit(fast_prov_server.srv_flags, GATT_PROXY_ENABLE_START)) {
-                k_delayed_work_cancel(&fast_prov_server.gatt_proxy_enable_timer);
-            }
-            if (!bt_mesh_atomic_test_and_set_bit(fast_prov_server.srv_flags, GATT_PROXY_ENABLE_START)) {
-                k_delayed_work_submit(&fast_prov_server.gatt_proxy_enable_timer, GATT_PROXY_ENABLE_TIMEOUT);
-            }
-        }
-    } else {
-        /* When a device is provisioned, the non-primary Provisioner shall reset the timer
-         * which is used to send node addresses to the primary Provisioner.
+        example_gatt_proxy_timer_reset();
+    } else if (ESP_BLE_MESH_ADDR_IS_UNICAST(fast_prov_server.prim_prov_addr)) {
+        /* The non-primary Provisioner queues the node address, it is sent to the primary
+         * Provisioner with the other ones provisioned around the same time.
          */
-        if (bt_mesh_atomic_test_and_clear_bit(&fast_prov_cli_flags, SEND_SELF_PROV_NODE_ADDR_START)) {
-            k_delayed_work_cancel(&send_self_prov_node_addr_timer);
-        }
-        if (!bt_mesh_atomic_test_and_set_bit(&fast_prov_cli_flags, SEND_SELF_PROV_NODE_ADDR_START)) {
-            k_delayed_work_submit(&send_self_prov_node_addr_timer, SEND_SELF_PROV_NODE_ADDR_TIMEOUT);
+        example_msg_common_info_t info = {
+            .net_idx = fast_prov_server.net_idx,
+            .app_idx = fast_prov_server.app_idx,
+            .dst = fast_prov_server.prim_prov_addr,
+            .timeout = 0,
+            .role = ROLE_FAST_PROV,
+        };
+        err = example_addr_batch_add(&info, unicast_addr);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "%s: Failed to queue node address 0x%04x", __func__, unicast_addr);
         }
     }
 
@@ -266,7 +303,18 @@ static void provisioner_prov_complete(int node_idx, const uint8_t uuid[16], uint
         k_delayed_work_submit(&fast_prov_server.disable_fast_prov_timer, DISABLE_FAST_PROV_TIMEOUT);
     }
 
-    /* The Provisioner will send Config AppKey Add to the node. */
+    /* The configuration engine will send Config AppKey Add and then Fast Prov Info Set
+     * to the node, interleaved with the other nodes being configured.
+     */
+    err = example_cfg_engine_enqueue(node);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: Failed to queue node 0x%04x for configuration", __func__, unicast_addr);
+        return;
+    }
+}
+
+static esp_err_t example_cfg_send_step(example_node_info_t *node, example_cfg_step_t step)
+{
     example_msg_common_info_t info = {
         .net_idx = node->net_idx,
         .app_idx = node->app_idx,
@@ -274,11 +322,177 @@ static void provisioner_prov_complete(int node_idx, const uint8_t uuid[16], uint
         .timeout = 0,
         .role = ROLE_FAST_PROV,
     };
-    err = example_send_config_appkey_add(config_client.model, &info, NULL);
+
+    switch (step) {
+    case FAST_PROV_CFG_STEP_APPKEY_ADD:
+        return example_send_config_appkey_add(config_client.model, &info, NULL);
+    case FAST_PROV_CFG_STEP_INFO_SET: {
+        example_fast_prov_info_set_t set = {0};
+        if (node->lack_of_addr == false) {
+            set.ctx_flags = 0x03FE;
+            memcpy(&set.unicast_min, &node->unicast_min,
+                   sizeof(example_node_info_t) - offsetof(example_node_info_t, unicast_min));
+        } else {
+            set.ctx_flags  = BIT(6);
+            set.group_addr = fast_prov_server.group_addr;
+        }
+        return example_send_fast_prov_info_set(fast_prov_client.model, &info, &set);
+    }
+    default:
+        return ESP_ERR_INVALID_ARG;
+    }
+}
+
+static void example_cfg_complete(example_node_info_t *node, esp_err_t result)
+{
+    if (result != ESP_OK) {
+        ESP_LOGE(TAG, "%s: Failed to configure node 0x%04x", __func__, node->unicast_addr);
+        return;
+    }
+    ESP_LOGI(TAG, "%s: Node 0x%04x configured", __func__, node->unicast_addr);
+}
+
+static void example_lease_pool_seed(void)
+{
+    /* The range left after the static split configured by Fast Prov Info Set is the
+     * initial address pool; leases from the primary Provisioner are added to it later.
+     * A Fast Prov Info Set with another range replaces the pool.
+     */
+    if (!ESP_BLE_MESH_ADDR_IS_UNICAST(fast_prov_server.unicast_cur) ||
+            (fast_prov_server.unicast_min == lease_pool_min &&
+             fast_prov_server.unicast_max == lease_pool_max)) {
+        return;
+    }
+    lease_pool_min = fast_prov_server.unicast_min;
+    lease_pool_max = fast_prov_server.unicast_max;
+    example_addr_lease_reset();
+    if (fast_prov_server.unicast_cur <= fast_prov_server.unicast_max) {
+        example_addr_lease_free(fast_prov_server.unicast_cur, fast_prov_server.unicast_max);
+    }
+}
+
+static bool example_assign_node_range(example_node_info_t *node)
+{
+    uint16_t min, max;
+
+    example_lease_pool_seed();
+    if (example_addr_lease_alloc(fast_prov_server.unicast_step + 1, &min, &max) != ESP_OK) {
+        return false;
+    }
+
+    node->lack_of_addr = false;
+    node->unicast_min  = min;
+    node->unicast_max  = max;
+    node->flags      = fast_prov_server.flags;
+    node->iv_index   = fast_prov_server.iv_index;
+    node->fp_net_idx = fast_prov_server.net_idx;
+    node->group_addr = fast_prov_server.group_addr;
+    node->prov_addr  = fast_prov_server.prim_prov_addr;
+    node->match_len  = fast_prov_server.match_len;
+    memcpy(node->match_val, fast_prov_server.match_val, fast_prov_server.match_len);
+    node->action = FAST_PROV_ACT_ENTER;
+    fast_prov_server.unicast_cur = max + 1;
+    example_node_db_put_range(node);
+    return true;
+}
+
+static void example_lease_resume(bool granted);
+
+static void example_lease_request(void)
+{
+    example_msg_common_info_t info = {
+        .net_idx = fast_prov_server.net_idx,
+        .app_idx = fast_prov_server.app_idx,
+        .dst = fast_prov_server.prim_prov_addr,
+        .timeout = 0,
+        .role = ROLE_FAST_PROV,
+    };
+    esp_err_t err;
+
+    if (example_addr_lease_busy() || example_addr_batch_busy()) {
+        /* Requested once the outstanding lease or address message completes */
+        return;
+    }
+
+    err = example_addr_lease_send_get(fast_prov_client.model, &info,
+                                      (fast_prov_server.unicast_step + 1) * CONFIG_FAST_PROV_LEASE_BLOCK);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "%s: Failed to send Config AppKey Add message", __func__);
+        ESP_LOGE(TAG, "%s: Failed to send Lease Get message", __func__);
+        example_lease_resume(false);
+    }
+}
+
+static bool example_lease_wait(example_node_info_t *node)
+{
+    if (fast_prov_server.primary_role == true ||
+            !ESP_BLE_MESH_ADDR_IS_UNICAST(fast_prov_server.prim_prov_addr)) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < lease_wait_cnt; i++) {
+        if (lease_wait[i] == node) {
+            return true;
+        }
+    }
+    if (lease_wait_cnt == ARRAY_SIZE(lease_wait)) {
+        return false;
+    }
+
+    lease_wait[lease_wait_cnt++] = node;
+    example_lease_request();
+    return true;
+}
+
+static void example_lease_resume(bool granted)
+{
+    example_node_info_t *node = NULL;
+    uint8_t i;
+
+    for (i = 0; i < lease_wait_cnt; i++) {
+        node = lease_wait[i];
+        if (granted && !example_assign_node_range(node)) {
+            break;
+        }
+        if (!granted) {
+            /* Fall back to only adding the group address to the node */
+            ESP_LOGW(TAG, "%s: Not enough address to be assigned", __func__);
+            node->lack_of_addr = true;
+            example_node_db_put_range(node);
+        }
+        example_cfg_engine_step_done(node->unicast_addr, ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD);
+    }
+
+    memmove(lease_wait, &lease_wait[i], (lease_wait_cnt - i) * sizeof(lease_wait[0]));
+    lease_wait_cnt -= i;
+    if (lease_wait_cnt) {
+        /* The lease was smaller than requested, ask for another one */
+        example_lease_request();
+    }
+}
+
+static void example_lease_return(void)
+{
+    example_msg_common_info_t info = {
+        .net_idx = fast_prov_server.net_idx,
+        .app_idx = fast_prov_server.app_idx,
+        .dst = fast_prov_server.prim_prov_addr,
+        .timeout = 0,
+        .role = ROLE_FAST_PROV,
+    };
+    esp_err_t err;
+
+    /* Unused addresses go back to the primary Provisioner once this one is idle, so
+     * they can be leased to Provisioners which still have devices around them.
+     */
+    if (fast_prov_server.primary_role == true || lease_wait_cnt || example_addr_lease_busy() ||
+            !example_addr_batch_idle() || example_addr_lease_avail() == 0) {
         return;
     }
+
+    err = example_addr_lease_send_return(fast_prov_client.model, &info);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: Failed to send Lease Return message", __func__);
+    }
 }
 
 static void example_recv_unprov_adv_pkt(uint8_t dev_uuid[16], uint8_t addr[BLE_MESH_ADDR_LEN],
@@ -291,10 +505,15 @@ static void example_recv_unprov_adv_pkt(uint8_t dev_uuid[16], uint8_t addr[BLE_M
 
     /* In Fast Provisioning, the Provisioner should only use PB-ADV to provision devices. */
     if (prov_start && (bearer & ESP_BLE_MESH_PROV_ADV)) {
+        /* Drops the repeated beacons of a device which has just been added */
+        if (example_beacon_filter_seen(dev_uuid)) {
+            return;
+        }
+
         /* Checks if the device is a reprovisioned one. */
-        if (example_is_node_exist(dev_uuid) == false) {
-            if ((prov_start_num >= fast_prov_server.max_node_num) ||
-                    (fast_prov_server.prov_node_cnt >= fast_prov_server.max_node_num)) {
+        if (example_node_index_exist(dev_uuid) == false) {
+            if ((fast_prov_server.prov_node_cnt >= fast_prov_server.max_node_num) ||
+                    !example_link_ctrl_can_start()) {
                 return;
             }
         }
@@ -311,8 +530,9 @@ static void example_recv_unprov_adv_pkt(uint8_t dev_uuid[16], uint8_t addr[BLE_M
             return;
         }
 
-        /* If adding unprovisioned device successfully, increase prov_start_num */
-        prov_start_num++;
+        /* If adding unprovisioned device successfully, account for the new link */
+        example_link_ctrl_start();
+        example_beacon_filter_add(dev_uuid);
     }
 
     return;
@@ -440,7 +660,7 @@ static void example_ble_mesh_custom_model_cb(esp_ble_mesh_model_cb_event_t event
         case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_GET:
         case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_GROUP_ADD:
         case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_GROUP_DELETE: {
-            ESP_LOGI(TAG, "%s: Fast prov server receives msg, opcode 0x%04x", __func__, opcode);
+            BIN_TRACEI(TRACE_SRV_RECV, opcode, param->model_operation.ctx->addr, 0);
             struct net_buf_simple buf = {
                 .len = param->model_operation.length,
                 .data = param->model_operation.msg,
@@ -453,10 +673,42 @@ static void example_ble_mesh_custom_model_cb(esp_ble_mesh_model_cb_event_t event
             }
             break;
         }
+        case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_GET:
+        case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN:
+            BIN_TRACEI(TRACE_SRV_RECV, opcode, param->model_operation.ctx->addr, 0);
+            if (fast_prov_server.primary_role == false) {
+                break;
+            }
+            example_lease_pool_seed();
+            if (opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_GET) {
+                err = example_addr_lease_recv_get(param->model_operation.model, param->model_operation.ctx,
+                                                  param->model_operation.msg, param->model_operation.length);
+            } else {
+                err = example_addr_lease_recv_return(param->model_operation.model, param->model_operation.ctx,
+                                                     param->model_operation.msg, param->model_operation.length);
+            }
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "%s: Failed to handle address lease message", __func__);
+                return;
+            }
+            break;
+        case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_BATCH:
+            BIN_TRACEI(TRACE_SRV_RECV, opcode, param->model_operation.ctx->addr, 0);
+            if (fast_prov_server.primary_role == false) {
+                break;
+            }
+            err = example_addr_batch_recv(param->model_operation.model, param->model_operation.ctx,
+                                          param->model_operation.msg, param->model_operation.length);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "%s: Failed to handle node address batch", __func__);
+                return;
+            }
+            example_gatt_proxy_timer_reset();
+            break;
         case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_STATUS:
         case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NET_KEY_STATUS:
         case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_ACK: {
-            ESP_LOGI(TAG, "%s: Fast prov client receives msg, opcode 0x%04x", __func__, opcode);
+            BIN_TRACEI(TRACE_CLI_RECV, opcode, param->model_operation.ctx->addr, 0);
             err = example_fast_prov_client_recv_status(param->model_operation.model,
                     param->model_operation.ctx,
                     param->model_operation.length,
@@ -465,16 +717,45 @@ static void example_ble_mesh_custom_model_cb(esp_ble_mesh_model_cb_event_t event
                 ESP_LOGE(TAG, "%s: Failed to handle fast prov server message", __func__);
                 return;
             }
+            if (opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_STATUS) {
+                example_cfg_engine_step_done(param->model_operation.ctx->addr, opcode);
+            }
             break;
         }
+        case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_STATUS:
+        case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN_ACK:
+            BIN_TRACEI(TRACE_CLI_RECV, opcode, param->model_operation.ctx->addr, 0);
+            err = example_addr_lease_recv_status(opcode, param->model_operation.msg,
+                                                 param->model_operation.length);
+            if (opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_STATUS) {
+                example_lease_resume(err == ESP_OK);
+            } else if (lease_wait_cnt && !example_addr_lease_busy()) {
+                /* Nodes started waiting while addresses were being returned */
+                example_lease_request();
+            }
+            break;
+        case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_BATCH_ACK:
+            BIN_TRACEI(TRACE_CLI_RECV, opcode, param->model_operation.ctx->addr, 0);
+            err = example_addr_batch_recv_ack(param->model_operation.msg, param->model_operation.length);
+            if (err != ESP_OK) {
+                break;
+            }
+            if (lease_wait_cnt) {
+                example_lease_request();
+            } else if (example_addr_batch_idle()) {
+                example_lease_return();
+            } else {
+                example_addr_batch_flush();
+            }
+            break;
         default:
-            ESP_LOGI(TAG, "%s: opcode 0x%04x", __func__, param->model_operation.opcode);
+            BIN_TRACEI(TRACE_VND_RECV, opcode, param->model_operation.ctx->addr, 0);
             break;
         }
         break;
     }
     case ESP_BLE_MESH_MODEL_SEND_COMP_EVT:
-        ESP_LOGI(TAG, "ESP_BLE_MESH_MODEL_SEND_COMP_EVT, err_code %d", param->model_send_comp.err_code);
+        BIN_TRACEI(TRACE_SEND_COMP, param->model_send_comp.opcode, param->model_send_comp.err_code, 0);
         switch (param->model_send_comp.opcode) {
         case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_STATUS:
         case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NET_KEY_STATUS:
@@ -494,16 +775,37 @@ static void example_ble_mesh_custom_model_cb(esp_ble_mesh_model_cb_event_t event
         }
         break;
     case ESP_BLE_MESH_MODEL_PUBLISH_COMP_EVT:
-        ESP_LOGI(TAG, "ESP_BLE_MESH_MODEL_PUBLISH_COMP_EVT, err_code %d",
-                 param->model_publish_comp.err_code);
+        BIN_TRACEI(TRACE_PUB_COMP, param->model_publish_comp.err_code, 0, 0);
         break;
     case ESP_BLE_MESH_CLIENT_MODEL_RECV_PUBLISH_MSG_EVT:
-        ESP_LOGI(TAG, "ESP_BLE_MESH_MODEL_CLIENT_RECV_PUBLISH_MSG_EVT, opcode 0x%04x",
-                 param->client_recv_publish_msg.opcode);
+        BIN_TRACEI(TRACE_CLI_RECV_PUB, param->client_recv_publish_msg.opcode, 0, 0);
         break;
     case ESP_BLE_MESH_CLIENT_MODEL_SEND_TIMEOUT_EVT:
-        ESP_LOGI(TAG, "ESP_BLE_MESH_CLIENT_MODEL_SEND_TIMEOUT_EVT, opcode 0x%04x, dst 0x%04x",
-                 param->client_send_timeout.opcode, param->client_send_timeout.ctx->addr);
+        BIN_TRACEW(TRACE_CLI_TIMEOUT, param->client_send_timeout.opcode, param->client_send_timeout.ctx->addr, 0);
+        if (param->client_send_timeout.opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_SET) {
+            /* Fast Prov Info Set is retransmitted by the configuration engine */
+            example_cfg_engine_step_fail(param->client_send_timeout.ctx->addr,
+                                         param->client_send_timeout.opcode);
+            break;
+        }
+        if (param->client_send_timeout.opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_GET ||
+            param->client_send_timeout.opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN) {
+            example_addr_lease_recv_timeout(param->client_send_timeout.opcode);
+            if (lease_wait_cnt) {
+                /* Retry the lease for the waiting nodes, unless the Lease Get itself timed out */
+                example_lease_resume(param->client_send_timeout.opcode !=
+                                     ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_GET);
+            }
+            break;
+        }
+        if (param->client_send_timeout.opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_BATCH) {
+            /* The same batch is sent again after CONFIG_FAST_PROV_ADDR_BATCH_LATENCY_MS */
+            example_addr_batch_recv_timeout();
+            if (lease_wait_cnt) {
+                example_lease_request();
+            }
+            break;
+        }
         err = example_fast_prov_client_recv_timeout(param->client_send_timeout.opcode,
                 param->client_send_timeout.model,
                 param->client_send_timeout.ctx);
@@ -523,15 +825,16 @@ static void example_ble_mesh_config_client_cb(esp_ble_mesh_cfg_client_cb_event_t
     example_node_info_t *node = NULL;
     uint32_t opcode;
     uint16_t address;
-    esp_err_t err;
-
-    ESP_LOGI(TAG, "%s, error_code = 0x%02x, event = 0x%02x, addr: 0x%04x",
-             __func__, param->error_code, event, param->params->ctx.addr);
 
     opcode = param->params->opcode;
     address = param->params->ctx.addr;
 
-    node = example_get_node_info(address);
+    BIN_TRACEI(TRACE_CFG_CLI_EVT, event, opcode, address);
+    if (param->error_code) {
+        BIN_TRACEW(TRACE_CFG_CLI_ERR, param->error_code, address, 0);
+    }
+
+    node = example_node_index_find_by_addr(address);
     if (!node) {
         ESP_LOGE(TAG, "%s: Failed to get node info", __func__);
         return;
@@ -539,6 +842,7 @@ static void example_ble_mesh_config_client_cb(esp_ble_mesh_cfg_client_cb_event_t
 
     if (param->error_code) {
         ESP_LOGE(TAG, "Failed to send config client message, opcode: 0x%04x", opcode);
+        example_cfg_engine_step_fail(address, opcode);
         return;
     }
 
@@ -547,64 +851,24 @@ static void example_ble_mesh_config_client_cb(esp_ble_mesh_cfg_client_cb_event_t
         break;
     case ESP_BLE_MESH_CFG_CLIENT_SET_STATE_EVT:
         switch (opcode) {
-        case ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD: {
-            example_fast_prov_info_set_t set = {0};
-            if (node->reprov == false) {
-                /* After sending Config AppKey Add successfully, start to send Fast Prov Info Set */
-                if (fast_prov_server.unicast_cur >= fast_prov_server.unicast_max) {
-                    /* TODO:
-                     * 1. If unicast_cur is >= unicast_max, we can also send the message to enable
-                     * the Provisioner functionality on the node, and need to add another vendor
-                     * message used by the node to require a new unicast address range from primary
-                     * Provisioner, and before get the correct response, the node should pend
-                     * the fast provisioning functionality.
-                     * 2. Currently if address is not enough, the Provisioner will only add the group
-                     * address to the node.
-                     */
-                    ESP_LOGW(TAG, "%s: Not enough address to be assigned", __func__);
-                    node->lack_of_addr = true;
-                } else {
-                    /* Send fast_prov_info_set message to node */
-                    node->lack_of_addr = false;
-                    node->unicast_min = fast_prov_server.unicast_cur;
-                    if (fast_prov_server.unicast_cur + fast_prov_server.unicast_step >= fast_prov_server.unicast_max) {
-                        node->unicast_max = fast_prov_server.unicast_max;
-                    } else {
-                        node->unicast_max = fast_prov_server.unicast_cur + fast_prov_server.unicast_step;
-                    }
-                    node->flags      = fast_prov_server.flags;
-                    node->iv_index   = fast_prov_server.iv_index;
-                    node->fp_net_idx = fast_prov_server.net_idx;
-                    node->group_addr = fast_prov_server.group_addr;
-                    node->prov_addr  = fast_prov_server.prim_prov_addr;
-                    node->match_len  = fast_prov_server.match_len;
-                    memcpy(node->match_val, fast_prov_server.match_val, fast_prov_server.match_len);
-                    node->action = FAST_PROV_ACT_ENTER;
-                    fast_prov_server.unicast_cur = node->unicast_max + 1;
+        case ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD:
+            /* After sending Config AppKey Add successfully, assign the unicast address
+             * range used by the Fast Prov Info Set sent by the configuration engine.
+             */
+            if (node->reprov == false && !example_assign_node_range(node)) {
+                if (example_lease_wait(node)) {
+                    /* The step completes once the primary Provisioner grants a lease */
+                    break;
                 }
+                /* Currently if address is not enough, the Provisioner will only add the group
+                 * address to the node.
+                 */
+                ESP_LOGW(TAG, "%s: Not enough address to be assigned", __func__);
+                node->lack_of_addr = true;
+                example_node_db_put_range(node);
             }
-            if (node->lack_of_addr == false) {
-                set.ctx_flags = 0x03FE;
-                memcpy(&set.unicast_min, &node->unicast_min,
-                       sizeof(example_node_info_t) - offsetof(example_node_info_t, unicast_min));
-            } else {
-                set.ctx_flags  = BIT(6);
-                set.group_addr = fast_prov_server.group_addr;
-            }
-            example_msg_common_info_t info = {
-                .net_idx = node->net_idx,
-                .app_idx = node->app_idx,
-                .dst = node->unicast_addr,
-                .timeout = 0,
-                .role = ROLE_FAST_PROV,
-            };
-            err = example_send_fast_prov_info_set(fast_prov_client.model, &info, &set);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "%s: Failed to send Fast Prov Info Set message", __func__);
-                return;
-            }
+            example_cfg_engine_step_done(address, opcode);
             break;
-        }
         default:
             break;
         }
@@ -613,21 +877,9 @@ static void example_ble_mesh_config_client_cb(esp_ble_mesh_cfg_client_cb_event_t
         break;
     case ESP_BLE_MESH_CFG_CLIENT_TIMEOUT_EVT:
         switch (opcode) {
-        case ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD: {
-            example_msg_common_info_t info = {
-                .net_idx = node->net_idx,
-                .app_idx = node->app_idx,
-                .dst = node->unicast_addr,
-                .timeout = 0,
-                .role = ROLE_FAST_PROV,
-            };
-            err = example_send_config_appkey_add(config_client.model, &info, NULL);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "%s: Failed to send Config AppKey Add message", __func__);
-                return;
-            }
+        case ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD:
+            example_cfg_engine_step_fail(address, opcode);
             break;
-        }
         default:
             break;
         }
@@ -669,15 +921,13 @@ static void example_ble_mesh_config_server_cb(esp_ble_mesh_cfg_server_cb_event_t
 static void example_ble_mesh_generic_server_cb(esp_ble_mesh_generic_server_cb_event_t event,
                                                esp_ble_mesh_generic_server_cb_param_t *param)
 {
-    ESP_LOGI(TAG, "event 0x%02x, opcode 0x%04x, src 0x%04x, dst 0x%04x",
-        event, param->ctx.recv_op, param->ctx.addr, param->ctx.recv_dst);
+    BIN_TRACED(TRACE_GEN_SRV_EVT, event, param->ctx.recv_op, param->ctx.addr);
 
     switch (event) {
     case ESP_BLE_MESH_GENERIC_SERVER_STATE_CHANGE_EVT:
-        ESP_LOGI(TAG, "ESP_BLE_MESH_GENERIC_SERVER_STATE_CHANGE_EVT");
         if (param->ctx.recv_op == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET ||
             param->ctx.recv_op == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET_UNACK) {
-            ESP_LOGI(TAG, "onoff 0x%02x", param->value.state_change.onoff_set.onoff);
+            BIN_TRACEI(TRACE_ONOFF_CHANGE, param->value.state_change.onoff_set.onoff, 0, 0);
             example_change_led_state(param->value.state_change.onoff_set.onoff);
         }
         break;
@@ -715,7 +965,28 @@ static esp_err_t ble_mesh_init(void)
         return err;
     }
 
-    k_delayed_work_init(&send_self_prov_node_addr_timer, example_send_self_prov_node_addr);
+    err = example_addr_batch_init(&vnd_models[1]);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: Failed to initialize node address batch", __func__);
+        return err;
+    }
+
+    example_cfg_engine_config_t cfg_engine = EXAMPLE_CFG_ENGINE_DEFAULT_CONFIG(example_cfg_send_step,
+                                                                              example_cfg_complete);
+    err = example_cfg_engine_init(&cfg_engine);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: Failed to initialize configuration engine", __func__);
+        return err;
+    }
+
+    example_link_ctrl_config_t link_ctrl = EXAMPLE_LINK_CTRL_DEFAULT_CONFIG(CONFIG_BLE_MESH_PBA_SAME_TIME);
+    err = example_link_ctrl_init(&link_ctrl);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: Failed to initialize provisioning link controller", __func__);
+        return err;
+    }
+
+    example_beacon_filter_init(CONFIG_FAST_PROV_BEACON_WINDOW_MS);
 
     err = esp_ble_mesh_node_prov_enable(ESP_BLE_MESH_PROV_ADV | ESP_BLE_MESH_PROV_GATT);
     if (err != ESP_OK) {
@@ -742,6 +1013,12 @@ void app_main(void)
         return;
     }
 
+    /* Prints the message traces when idle, and soon after a warning */
+    err = bin_trace_start();
+    if (err) {
+        ESP_LOGE(TAG, "bin_trace_start failed (err %d)", err);
+    }
+
     err = nvs_flash_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES) {
         ESP_ERROR_CHECK(nvs_flash_erase());
@@ -757,6 +1034,15 @@ void app_main(void)
 
     ble_mesh_get_dev_uuid(dev_uuid);
 
+    /* Restore the nodes provisioned before a restart, before any mesh callback runs.
+     * They are let through again as re-provisioned devices, prov_node_cnt only
+     * counts the new ones against max_node_num.
+     */
+    err = example_node_db_init(NULL);
+    if (err != ESP_OK && err != ESP_ERR_NOT_FOUND) {
+        ESP_LOGE(TAG, "Node database init failed (err %d)", err);
+    }
+
     /* Initialize the Bluetooth Mesh Subsystem */
     err = ble_mesh_init();
     if (err) {
@@ -14,14 +14,13 @@
 
 #include "iot_button.h"
 #include "board.h"
+#include "onoff_tap.h"
 
 #define TAG "BOARD"
 
 #define BUTTON_IO_NUM           0
 #define BUTTON_ACTIVE_LEVEL     0
 
-extern void example_ble_mesh_send_gen_onoff_set(void);
-
 struct _led_state led_state = {
     LED_OFF, LED_OFF, 2, "led_2"
 };
@@ -50,9 +49,10 @@ static void board_led_init(void)
 
 static void button_tap_cb(void* arg)
 {
-    ESP_LOGI(TAG, "tap cb (%s)", (char *)arg);
+    ESP_LOGD(TAG, "tap cb (%s)", (char *)arg);
 
-    example_ble_mesh_send_gen_onoff_set();
+    /* Never blocks, the mesh message is sent from the tap task */
+    example_onoff_tap();
 }
 
 static void board_button_init(void)
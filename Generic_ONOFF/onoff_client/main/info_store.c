@@ -0,0 +1,101 @@
+/* info_store.c - OnOff client info written behind, with TIDs reserved ahead */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdbool.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "info_store.h"
+
+static example_info_t *store;
+static example_info_write_t store_write;
+static example_info_due_t store_due;
+static SemaphoreHandle_t store_lock;
+static esp_timer_handle_t store_timer;
+static bool store_dirty;
+static uint8_t tid_next;    /* TID of the next message */
+static uint8_t tid_flash;   /* store->tid as last written to flash */
+
+/* Called with store_lock held */
+static void info_commit(void)
+{
+    if (!store_dirty) {
+        return;
+    }
+    if (store_write(store) == ESP_OK) {
+        store_dirty = false;
+        tid_flash = store->tid;
+    }
+}
+
+static void info_timeout(void *arg)
+{
+    store_due();
+}
+
+esp_err_t example_info_init(example_info_t *info, example_info_write_t write, example_info_due_t due)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = info_timeout,
+        .name = "info_store",
+    };
+
+    store = info;
+    store_write = write;
+    store_due = due;
+    store_lock = xSemaphoreCreateMutex();
+    if (!store_lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    return esp_timer_create(&timer_args, &store_timer);
+}
+
+void example_info_restored(void)
+{
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+    tid_next = store->tid;
+    tid_flash = store->tid;
+    store_dirty = false;
+    xSemaphoreGive(store_lock);
+}
+
+void example_info_changed(void)
+{
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+    store_dirty = true;
+    xSemaphoreGive(store_lock);
+
+    /* Every change pushes the write back */
+    esp_timer_stop(store_timer);
+    esp_timer_start_once(store_timer, CONFIG_EXAMPLE_STORE_DELAY_MS * 1000);
+}
+
+void example_info_flush(void)
+{
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+    info_commit();
+    xSemaphoreGive(store_lock);
+}
+
+uint8_t example_info_tid_take(void)
+{
+    uint8_t tid;
+
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+    if ((uint8_t)(store->tid - tid_next) <= CONFIG_EXAMPLE_TID_BLOCK / 2) {
+        store->tid = tid_next + CONFIG_EXAMPLE_TID_BLOCK;
+        store_dirty = true;
+    }
+    if (tid_next == tid_flash) {
+        info_commit();
+    }
+    tid = tid_next++;
+    xSemaphoreGive(store_lock);
+
+    return tid;
+}
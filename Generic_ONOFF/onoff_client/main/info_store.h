@@ -0,0 +1,56 @@
+/* info_store.h - OnOff client info written behind, with TIDs reserved ahead */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef _INFO_STORE_H_
+#define _INFO_STORE_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifndef CONFIG_EXAMPLE_STORE_DELAY_MS
+#define CONFIG_EXAMPLE_STORE_DELAY_MS   2000
+#endif
+
+#ifndef CONFIG_EXAMPLE_TID_BLOCK
+#define CONFIG_EXAMPLE_TID_BLOCK        16
+#endif
+
+typedef struct {
+    uint16_t net_idx;   /* NetKey Index */
+    uint16_t app_idx;   /* AppKey Index */
+    uint8_t  onoff;     /* Remote OnOff */
+    uint8_t  tid;       /* Message TID, the first one not reserved yet */
+} __attribute__((packed)) example_info_t;
+
+/* Writes the info to flash */
+typedef esp_err_t (*example_info_write_t)(const example_info_t *info);
+
+/* The delayed write is due. Called from the esp_timer task, which must not
+ * wait for flash: example_info_flush() is then called from a task of the
+ * example.
+ */
+typedef void (*example_info_due_t)(void);
+
+esp_err_t example_info_init(example_info_t *info, example_info_write_t write, example_info_due_t due);
+
+/* After the info was read back from flash, the TIDs below info->tid may have
+ * been sent before the restart
+ */
+void example_info_restored(void);
+
+/* The info changed, it is written once changes stop for CONFIG_EXAMPLE_STORE_DELAY_MS */
+void example_info_changed(void);
+
+/* Writes the info if it changed since the last write */
+void example_info_flush(void);
+
+/* Returns the TID of a new message. TIDs are reserved CONFIG_EXAMPLE_TID_BLOCK
+ * ahead, the block is written once half of it is used, and at once only if
+ * the TIDs written to flash are used up.
+ */
+uint8_t example_info_tid_take(void);
+
+#endif /* _INFO_STORE_H_ */
@@ -11,6 +11,7 @@
 #include <string.h>
 
 #include "esp_log.h"
+#include "esp_system.h"
 #include "nvs_flash.h"
 
 #include "esp_ble_mesh_common_api.h"
@@ -20,8 +21,12 @@
 #include "esp_ble_mesh_generic_model_api.h"
 
 #include "board.h"
+#include "info_store.h"
+#include "onoff_tap.h"
+#include "onoff_txn.h"
 #include "ble_mesh_example_init.h"
 #include "ble_mesh_example_nvs.h"
+#include "trace_events.h"
 
 #define TAG "EXAMPLE"
 
@@ -29,12 +34,7 @@
 
 static uint8_t dev_uuid[16] = { 0xdd, 0xdd };
 
-static struct example_info_store {
-    uint16_t net_idx;   /* NetKey Index */
-    uint16_t app_idx;   /* AppKey Index */
-    uint8_t  onoff;     /* Remote OnOff */
-    uint8_t  tid;       /* Message TID */
-} __attribute__((packed)) store = {
+static example_info_t store = {
     .net_idx = ESP_BLE_MESH_KEY_UNUSED,
     .app_idx = ESP_BLE_MESH_KEY_UNUSED,
     .onoff = LED_OFF,
@@ -44,6 +44,9 @@ static struct example_info_store {
 static nvs_handle_t NVS_HANDLE;
 static const char * NVS_KEY = "onoff_client";
 
+/* The tap task also writes the store behind, once the store timer found it due */
+static bool store_due;
+
 static esp_ble_mesh_client_t onoff_client;
 
 static esp_ble_mesh_cfg_srv_t config_server = {
@@ -96,9 +99,22 @@ static esp_ble_mesh_prov_t provision = {
 #endif
 };
 
-static void mesh_example_info_store(void)
+static esp_err_t mesh_example_info_write(const example_info_t *info)
+{
+    return ble_mesh_nvs_store(NVS_HANDLE, NVS_KEY, info, sizeof(*info));
+}
+
+static void mesh_example_info_due(void)
+{
+    __atomic_store_n(&store_due, true, __ATOMIC_RELAXED);
+    example_onoff_tap_notify();
+}
+
+static void mesh_example_info_wake(void)
 {
-    ble_mesh_nvs_store(NVS_HANDLE, NVS_KEY, &store, sizeof(store));
+    if (__atomic_exchange_n(&store_due, false, __ATOMIC_RELAXED)) {
+        example_info_flush();
+    }
 }
 
 static void mesh_example_info_restore(void)
@@ -114,6 +130,7 @@ static void mesh_example_info_restore(void)
     if (exist) {
         ESP_LOGI(TAG, "Restore, net_idx 0x%04x, app_idx 0x%04x, onoff %u, tid 0x%02x",
             store.net_idx, store.app_idx, store.onoff, store.tid);
+        example_info_restored();
     }
 }
 
@@ -123,7 +140,7 @@ static void prov_complete(uint16_t net_idx, uint16_t addr, uint8_t flags, uint32
     ESP_LOGI(TAG, "flags: 0x%02x, iv_index: 0x%08x", flags, iv_index);
     board_led_operation(LED_G, LED_OFF);
     store.net_idx = net_idx;
-    /* mesh_example_info_store() shall not be invoked here, because if the device
+    /* example_info_changed() shall not be invoked here, because if the device
      * is restarted and goes into a provisioned state, then the following events
      * will come:
      * 1st: ESP_BLE_MESH_NODE_PROV_COMPLETE_EVT
@@ -168,63 +185,53 @@ static void example_ble_mesh_provisioning_cb(esp_ble_mesh_prov_cb_event_t event,
     }
 }
 
-void example_ble_mesh_send_gen_onoff_set(void)
+static void example_ble_mesh_send_gen_onoff_set(void)
 {
-    esp_ble_mesh_generic_client_set_state_t set = {0};
-    esp_ble_mesh_client_common_param_t common = {0};
     esp_err_t err = ESP_OK;
 
-    common.opcode = ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET_UNACK;
-    common.model = onoff_client.model;
-    common.ctx.net_idx = store.net_idx;
-    common.ctx.app_idx = store.app_idx;
-    common.ctx.addr = 0xFFFF;   /* to all nodes */
-    common.ctx.send_ttl = 3;
-    common.ctx.send_rel = false;
-    common.msg_timeout = 0;     /* 0 indicates that timeout value from menuconfig will be used */
-    common.msg_role = ROLE_NODE;
-
-    set.onoff_set.op_en = false;
-    set.onoff_set.onoff = store.onoff;
-    set.onoff_set.tid = store.tid++;
-
-    err = esp_ble_mesh_generic_client_set_state(&common, &set);
+    err = example_onoff_txn_set(store.net_idx, store.app_idx, CONFIG_EXAMPLE_ONOFF_DST, store.onoff);
     if (err) {
-        ESP_LOGE(TAG, "Send Generic OnOff Set Unack failed");
+        ESP_LOGE(TAG, "Send Generic OnOff Set failed");
         return;
     }
 
     store.onoff = !store.onoff;
-    mesh_example_info_store(); /* Store proper mesh example info */
+    example_info_changed(); /* Store proper mesh example info */
+}
+
+static void example_ble_mesh_onoff_set_done(const example_onoff_txn_result_t *result)
+{
+    if (result->err != ESP_OK) {
+        BIN_TRACEW(TRACE_ONOFF_LOST, result->dst, result->attempts, 0);
+        return;
+    }
+    BIN_TRACEI(TRACE_ONOFF_DONE, result->dst, result->attempts, result->rtt_ms);
 }
 
 static void example_ble_mesh_generic_client_cb(esp_ble_mesh_generic_client_cb_event_t event,
                                                esp_ble_mesh_generic_client_cb_param_t *param)
 {
-    ESP_LOGI(TAG, "Generic client, event %u, error code %d, opcode is 0x%04x",
-        event, param->error_code, param->params->opcode);
+    BIN_TRACEI(TRACE_GEN_CLI_EVT, event, param->params->opcode, param->error_code);
 
     switch (event) {
     case ESP_BLE_MESH_GENERIC_CLIENT_GET_STATE_EVT:
-        ESP_LOGI(TAG, "ESP_BLE_MESH_GENERIC_CLIENT_GET_STATE_EVT");
         if (param->params->opcode == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_GET) {
-            ESP_LOGI(TAG, "ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_GET, onoff %d", param->status_cb.onoff_status.present_onoff);
+            BIN_TRACEI(TRACE_ONOFF_STATUS, param->status_cb.onoff_status.present_onoff, param->params->ctx.addr, 0);
         }
         break;
     case ESP_BLE_MESH_GENERIC_CLIENT_SET_STATE_EVT:
-        ESP_LOGI(TAG, "ESP_BLE_MESH_GENERIC_CLIENT_SET_STATE_EVT");
         if (param->params->opcode == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET) {
-            ESP_LOGI(TAG, "ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET, onoff %d", param->status_cb.onoff_status.present_onoff);
+            BIN_TRACEI(TRACE_ONOFF_STATUS, param->status_cb.onoff_status.present_onoff, param->params->ctx.addr, 0);
+            example_onoff_txn_status(param->params->ctx.addr);
         }
         break;
     case ESP_BLE_MESH_GENERIC_CLIENT_PUBLISH_EVT:
-        ESP_LOGI(TAG, "ESP_BLE_MESH_GENERIC_CLIENT_PUBLISH_EVT");
         break;
     case ESP_BLE_MESH_GENERIC_CLIENT_TIMEOUT_EVT:
-        ESP_LOGI(TAG, "ESP_BLE_MESH_GENERIC_CLIENT_TIMEOUT_EVT");
+        BIN_TRACEW(TRACE_ONOFF_TIMEOUT, param->params->ctx.addr, 0, 0);
         if (param->params->opcode == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET) {
-            /* If failed to get the response of Generic OnOff Set, resend Generic OnOff Set  */
-            example_ble_mesh_send_gen_onoff_set();
+            /* Resent with the same TID, not as a new command */
+            example_onoff_txn_timeout(param->params->ctx.addr);
         }
         break;
     default:
@@ -254,7 +261,7 @@ static void example_ble_mesh_config_server_cb(esp_ble_mesh_cfg_server_cb_event_t
             if (param->value.state_change.mod_app_bind.company_id == 0xFFFF &&
                 param->value.state_change.mod_app_bind.model_id == ESP_BLE_MESH_MODEL_ID_GEN_ONOFF_CLI) {
                 store.app_idx = param->value.state_change.mod_app_bind.app_idx;
-                mesh_example_info_store(); /* Store proper mesh example info */
+                example_info_changed(); /* Store proper mesh example info */
             }
             break;
         default:
@@ -271,6 +278,11 @@ static esp_err_t ble_mesh_init(void)
     esp_ble_mesh_register_generic_client_callback(example_ble_mesh_generic_client_cb);
     esp_ble_mesh_register_config_server_callback(example_ble_mesh_config_server_cb);
 
+    err = example_onoff_txn_init(&root_models[1], example_info_tid_take, example_ble_mesh_onoff_set_done);
+    if (err != ESP_OK) {
+        return err;
+    }
+
     err = esp_ble_mesh_init(&provision, &composition);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to initialize mesh stack (err %d)", err);
@@ -298,6 +310,12 @@ void app_main(void)
 
     board_init();
 
+    /* Prints the message traces when idle, and soon after a warning */
+    err = bin_trace_start();
+    if (err) {
+        ESP_LOGE(TAG, "bin_trace_start failed (err %d)", err);
+    }
+
     err = nvs_flash_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES) {
         ESP_ERROR_CHECK(nvs_flash_erase());
@@ -317,11 +335,18 @@ void app_main(void)
         return;
     }
 
+    ESP_ERROR_CHECK(example_info_init(&store, mesh_example_info_write, mesh_example_info_due));
+    /* Write what is still pending on esp_restart() */
+    esp_register_shutdown_handler(example_info_flush);
+
     ble_mesh_get_dev_uuid(dev_uuid);
 
     /* Initialize the Bluetooth Mesh Subsystem */
     err = ble_mesh_init();
     if (err) {
         ESP_LOGE(TAG, "Bluetooth mesh init failed (err %d)", err);
+        return;
     }
+
+    ESP_ERROR_CHECK(example_onoff_tap_init(example_ble_mesh_send_gen_onoff_set, mesh_example_info_wake));
 }
@@ -0,0 +1,74 @@
+/* onoff_tap.c - Button taps merged into OnOff commands by a task */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "onoff_tap.h"
+
+#define TAG "TAP"
+
+/* Taps not handled yet, added by the button and taken by the tap task */
+static uint32_t tap_count;
+static TaskHandle_t tap_task;
+static example_onoff_tap_toggle_t tap_toggle;
+static example_onoff_tap_wake_t tap_wake;
+
+static void onoff_tap_task(void *arg)
+{
+    uint32_t taps;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (tap_wake) {
+            tap_wake();
+        }
+        if (!__atomic_load_n(&tap_count, __ATOMIC_RELAXED)) {
+            continue;
+        }
+
+        /* Taps within the window after the first one are a single command.
+         * What they notified is left for the next turn, it may be more than
+         * taps.
+         */
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_EXAMPLE_TAP_WINDOW_MS));
+        taps = __atomic_exchange_n(&tap_count, 0, __ATOMIC_RELAXED);
+        if (taps & 1) {
+            tap_toggle();
+        } else {
+            ESP_LOGI(TAG, "%" PRIu32 " taps cancel out", taps);
+        }
+    }
+}
+
+esp_err_t example_onoff_tap_init(example_onoff_tap_toggle_t toggle, example_onoff_tap_wake_t wake)
+{
+    if (toggle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    tap_toggle = toggle;
+    tap_wake = wake;
+    if (xTaskCreate(onoff_tap_task, "onoff_tap", 3072, NULL, 5, &tap_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void example_onoff_tap(void)
+{
+    __atomic_fetch_add(&tap_count, 1, __ATOMIC_RELAXED);
+    example_onoff_tap_notify();
+}
+
+void example_onoff_tap_notify(void)
+{
+    if (tap_task) {
+        xTaskNotifyGive(tap_task);
+    }
+}
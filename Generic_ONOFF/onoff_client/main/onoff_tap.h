@@ -0,0 +1,33 @@
+/* onoff_tap.h - Button taps merged into OnOff commands by a task */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef _ONOFF_TAP_H_
+#define _ONOFF_TAP_H_
+
+#include "esp_err.h"
+
+#ifndef CONFIG_EXAMPLE_TAP_WINDOW_MS
+#define CONFIG_EXAMPLE_TAP_WINDOW_MS    300
+#endif
+
+/* Toggles the remote OnOff, called from the tap task */
+typedef void (*example_onoff_tap_toggle_t)(void);
+
+/* Called from the tap task every time it wakes, before it looks at the taps */
+typedef void (*example_onoff_tap_wake_t)(void);
+
+/* Creates the tap task. Taps within CONFIG_EXAMPLE_TAP_WINDOW_MS of the first
+ * one are a single command: an odd number of them toggles once, an even
+ * number sends nothing.
+ */
+esp_err_t example_onoff_tap_init(example_onoff_tap_toggle_t toggle, example_onoff_tap_wake_t wake);
+
+/* A tap of the button, never waits */
+void example_onoff_tap(void);
+
+/* Wakes the tap task for the work of the wake callback */
+void example_onoff_tap_notify(void);
+
+#endif /* _ONOFF_TAP_H_ */
@@ -0,0 +1,272 @@
+/* onoff_txn.c - Acknowledged Generic OnOff Set with retransmission */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_ble_mesh_generic_model_api.h"
+
+#include "onoff_txn.h"
+
+#define TAG "TXN"
+
+/* One Set in flight per destination, the stack refuses a second one anyway */
+struct onoff_txn {
+    uint16_t dst;           /* ESP_BLE_MESH_ADDR_UNASSIGNED if free */
+    uint16_t net_idx;
+    uint16_t app_idx;
+    uint8_t  onoff;
+    uint8_t  tid;
+    uint8_t  attempts;
+    bool     next_pending;  /* A newer Set waits for this one to end */
+    uint8_t  next_onoff;
+    uint8_t  next_tid;      /* Taken by example_onoff_txn_set(), not by the mesh callback */
+    int64_t  start_us;      /* First transmission */
+    int64_t  sent_us;       /* Last transmission */
+};
+
+/* A transmission prepared with txn_lock held, sent once it is released: the
+ * client posts to the BTC task, whose Status and timeout events take the lock
+ */
+struct txn_msg {
+    uint16_t net_idx;
+    uint16_t app_idx;
+    uint16_t dst;
+    int32_t  timeout_ms;
+    uint8_t  onoff;
+    uint8_t  tid;
+};
+
+static struct onoff_txn txn[CONFIG_EXAMPLE_TXN_MAX];
+static SemaphoreHandle_t txn_lock;
+static esp_ble_mesh_model_t *txn_model;
+static example_onoff_txn_tid_t txn_tid_take;
+static example_onoff_txn_cb_t txn_cb;
+
+static struct onoff_txn *txn_find(uint16_t dst)
+{
+    for (int i = 0; i < CONFIG_EXAMPLE_TXN_MAX; i++) {
+        if (txn[i].dst == dst) {
+            return &txn[i];
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t txn_send(uint16_t net_idx, uint16_t app_idx, uint16_t dst, uint32_t opcode,
+                          int32_t timeout_ms, uint8_t onoff, uint8_t tid)
+{
+    esp_ble_mesh_generic_client_set_state_t set = {0};
+    esp_ble_mesh_client_common_param_t common = {0};
+
+    common.opcode = opcode;
+    common.model = txn_model;
+    common.ctx.net_idx = net_idx;
+    common.ctx.app_idx = app_idx;
+    common.ctx.addr = dst;
+    common.ctx.send_ttl = 3;
+    common.ctx.send_rel = false;
+    common.msg_timeout = timeout_ms;
+    common.msg_role = ROLE_NODE;
+
+    set.onoff_set.op_en = false;
+    set.onoff_set.onoff = onoff;
+    set.onoff_set.tid = tid;
+
+    return esp_ble_mesh_generic_client_set_state(&common, &set);
+}
+
+/* Called with txn_lock held. The timeout doubles with every attempt, plus up
+ * to a quarter of it at random so clients which lost the same Status do not
+ * retransmit together.
+ */
+static void txn_transmit(struct onoff_txn *t, struct txn_msg *msg)
+{
+    int32_t timeout_ms = CONFIG_EXAMPLE_TXN_TIMEOUT_MS << t->attempts;
+
+    timeout_ms += esp_random() % (timeout_ms / 4 + 1);
+    t->attempts++;
+    t->sent_us = esp_timer_get_time();
+
+    msg->net_idx = t->net_idx;
+    msg->app_idx = t->app_idx;
+    msg->dst = t->dst;
+    msg->timeout_ms = timeout_ms;
+    msg->onoff = t->onoff;
+    msg->tid = t->tid;
+}
+
+/* Called with txn_lock held */
+static void txn_start(struct onoff_txn *t, uint8_t onoff, uint8_t tid, struct txn_msg *msg)
+{
+    t->onoff = onoff;
+    t->tid = tid;
+    t->attempts = 0;
+    t->next_pending = false;
+    t->start_us = esp_timer_get_time();
+
+    txn_transmit(t, msg);
+}
+
+/* Called with txn_lock released. The first transmission of a Set failed, the
+ * transaction is freed unless it has moved on meanwhile.
+ */
+static esp_err_t txn_send_first(const struct txn_msg *msg)
+{
+    struct onoff_txn *t;
+    esp_err_t err;
+
+    err = txn_send(msg->net_idx, msg->app_idx, msg->dst, ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET,
+                   msg->timeout_ms, msg->onoff, msg->tid);
+    if (err != ESP_OK) {
+        xSemaphoreTake(txn_lock, portMAX_DELAY);
+        t = txn_find(msg->dst);
+        if (t && t->tid == msg->tid && t->attempts == 1) {
+            t->dst = ESP_BLE_MESH_ADDR_UNASSIGNED;
+        }
+        xSemaphoreGive(txn_lock);
+    }
+    return err;
+}
+
+static void txn_end(uint16_t dst, esp_err_t status)
+{
+    example_onoff_txn_result_t result;
+    struct onoff_txn *t;
+    struct txn_msg msg;
+    bool next = false;
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(txn_lock, portMAX_DELAY);
+    t = txn_find(dst);
+    if (t == NULL) {
+        xSemaphoreGive(txn_lock);
+        return;
+    }
+
+    result.dst = dst;
+    result.onoff = t->onoff;
+    result.attempts = t->attempts;
+    result.err = status;
+    result.rtt_ms = (now - t->sent_us) / 1000;
+    result.latency_ms = (now - t->start_us) / 1000;
+
+    if (t->next_pending) {
+        txn_start(t, t->next_onoff, t->next_tid, &msg);
+        next = true;
+    } else {
+        t->dst = ESP_BLE_MESH_ADDR_UNASSIGNED;
+    }
+    xSemaphoreGive(txn_lock);
+
+    if (next) {
+        txn_send_first(&msg);
+    }
+    if (txn_cb) {
+        txn_cb(&result);
+    }
+}
+
+esp_err_t example_onoff_txn_init(esp_ble_mesh_model_t *model, example_onoff_txn_tid_t tid_take,
+                                 example_onoff_txn_cb_t cb)
+{
+    if (model == NULL || tid_take == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    txn_lock = xSemaphoreCreateMutex();
+    if (txn_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < CONFIG_EXAMPLE_TXN_MAX; i++) {
+        txn[i].dst = ESP_BLE_MESH_ADDR_UNASSIGNED;
+    }
+    txn_model = model;
+    txn_tid_take = tid_take;
+    txn_cb = cb;
+
+    return ESP_OK;
+}
+
+esp_err_t example_onoff_txn_set(uint16_t net_idx, uint16_t app_idx, uint16_t dst, uint8_t onoff)
+{
+    struct onoff_txn *t;
+    struct txn_msg msg;
+    /* Before the lock, taking it may write the TID block to flash */
+    uint8_t tid = txn_tid_take();
+
+    if (!ESP_BLE_MESH_ADDR_IS_UNICAST(dst)) {
+        /* Several servers may answer, nothing to wait for */
+        return txn_send(net_idx, app_idx, dst, ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET_UNACK,
+                        0, onoff, tid);
+    }
+
+    xSemaphoreTake(txn_lock, portMAX_DELAY);
+    t = txn_find(dst);
+    if (t) {
+        /* Sent once the one in flight ends, replacing any other waiting */
+        t->next_pending = true;
+        t->next_onoff = onoff;
+        t->next_tid = tid;
+        xSemaphoreGive(txn_lock);
+        return ESP_OK;
+    }
+
+    t = txn_find(ESP_BLE_MESH_ADDR_UNASSIGNED);
+    if (t == NULL) {
+        xSemaphoreGive(txn_lock);
+        ESP_LOGW(TAG, "No free transaction for 0x%04x", dst);
+        return ESP_ERR_NO_MEM;
+    }
+
+    t->dst = dst;
+    t->net_idx = net_idx;
+    t->app_idx = app_idx;
+    txn_start(t, onoff, tid, &msg);
+    xSemaphoreGive(txn_lock);
+
+    return txn_send_first(&msg);
+}
+
+void example_onoff_txn_status(uint16_t addr)
+{
+    txn_end(addr, ESP_OK);
+}
+
+void example_onoff_txn_timeout(uint16_t addr)
+{
+    struct onoff_txn *t;
+    struct txn_msg msg;
+    bool retransmit;
+
+    xSemaphoreTake(txn_lock, portMAX_DELAY);
+    t = txn_find(addr);
+    if (t == NULL) {
+        xSemaphoreGive(txn_lock);
+        return;
+    }
+
+    /* A newer Set waiting makes this one stale, no need to insist */
+    retransmit = t->attempts < CONFIG_EXAMPLE_TXN_MAX_ATTEMPTS && !t->next_pending;
+    if (retransmit) {
+        ESP_LOGI(TAG, "Retransmit to 0x%04x, tid 0x%02x, attempt %u", addr, t->tid, t->attempts + 1);
+        txn_transmit(t, &msg);
+    }
+    xSemaphoreGive(txn_lock);
+
+    if (retransmit && txn_send(msg.net_idx, msg.app_idx, msg.dst, ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET,
+                               msg.timeout_ms, msg.onoff, msg.tid) == ESP_OK) {
+        return;
+    }
+    txn_end(addr, ESP_ERR_TIMEOUT);
+}
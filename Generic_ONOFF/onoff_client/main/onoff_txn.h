@@ -0,0 +1,57 @@
+/* onoff_txn.h - Acknowledged Generic OnOff Set with retransmission */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef _ONOFF_TXN_H_
+#define _ONOFF_TXN_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_ble_mesh_defs.h"
+
+#ifndef CONFIG_EXAMPLE_TXN_MAX
+#define CONFIG_EXAMPLE_TXN_MAX          4
+#endif
+
+#ifndef CONFIG_EXAMPLE_TXN_TIMEOUT_MS
+#define CONFIG_EXAMPLE_TXN_TIMEOUT_MS   500
+#endif
+
+#ifndef CONFIG_EXAMPLE_TXN_MAX_ATTEMPTS
+#define CONFIG_EXAMPLE_TXN_MAX_ATTEMPTS 4
+#endif
+
+typedef struct {
+    uint16_t  dst;
+    uint8_t   onoff;
+    uint8_t   attempts;
+    esp_err_t err;          /* ESP_OK once a Status came back, ESP_ERR_TIMEOUT if every attempt timed out */
+    uint32_t  rtt_ms;       /* From the last transmission to the Status */
+    uint32_t  latency_ms;   /* From the first transmission to the Status */
+} example_onoff_txn_result_t;
+
+/* Called once per Set to a unicast address, from the mesh callback context */
+typedef void (*example_onoff_txn_cb_t)(const example_onoff_txn_result_t *result);
+
+/* Returns the TID of a new message, called from example_onoff_txn_set() only */
+typedef uint8_t (*example_onoff_txn_tid_t)(void);
+
+esp_err_t example_onoff_txn_init(esp_ble_mesh_model_t *model, example_onoff_txn_tid_t tid_take,
+                                 example_onoff_txn_cb_t cb);
+
+/* A unicast destination gets an acknowledged Set, retransmitted with the same
+ * TID and a jittered exponential timeout until a Status arrives. A Set for a
+ * destination with one in flight waits for it to end, only the latest is kept.
+ * Any other destination gets a single unacknowledged Set.
+ */
+esp_err_t example_onoff_txn_set(uint16_t net_idx, uint16_t app_idx, uint16_t dst, uint8_t onoff);
+
+/* On ESP_BLE_MESH_GENERIC_CLIENT_SET_STATE_EVT, addr is the Status source */
+void example_onoff_txn_status(uint16_t addr);
+
+/* On ESP_BLE_MESH_GENERIC_CLIENT_TIMEOUT_EVT for a Generic OnOff Set */
+void example_onoff_txn_timeout(uint16_t addr);
+
+#endif /* _ONOFF_TXN_H_ */
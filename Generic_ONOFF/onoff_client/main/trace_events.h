@@ -0,0 +1,22 @@
+/* trace_events.h - Trace events of the OnOff client, see bin_trace.h */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef _TRACE_EVENTS_H_
+#define _TRACE_EVENTS_H_
+
+#include "bin_trace.h"
+
+#define EXAMPLE_TRACE_EVENTS(X)                                                         \
+    X(TRACE_GEN_CLI_EVT,    "Generic client event %u, opcode 0x%04x, error code %d")    \
+    X(TRACE_ONOFF_STATUS,   "Status, onoff 0x%02x, src 0x%04x")                         \
+    X(TRACE_ONOFF_DONE,     "Set to 0x%04x acknowledged, attempts %u, rtt %u ms")       \
+    X(TRACE_ONOFF_LOST,     "Set to 0x%04x not acknowledged after %u attempts")         \
+    X(TRACE_ONOFF_TIMEOUT,  "Set to 0x%04x timed out")
+
+enum {
+    EXAMPLE_TRACE_EVENTS(BIN_TRACE_EVENT_ID)
+};
+
+#endif /* _TRACE_EVENTS_H_ */
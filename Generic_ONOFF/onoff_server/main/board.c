@@ -32,6 +32,12 @@ void board_led_operation(uint8_t pin, uint8_t onoff)
     ESP_LOGE(TAG, "LED is not found!");
 }
 
+struct _led_state *board_led_get(uint8_t index)
+{
+    /* The board has a single LED, driven by the primary element */
+    return index == 0 ? &led_state : NULL;
+}
+
 static void board_led_init(void)
 {
         gpio_reset_pin(led_state.pin);
@@ -43,6 +43,9 @@ struct _led_state {
 
 void board_led_operation(uint8_t pin, uint8_t onoff);
 
+/* LED driven by the element at offset index from the primary element, NULL if none */
+struct _led_state *board_led_get(uint8_t index);
+
 void board_init(void);
 
 #endif
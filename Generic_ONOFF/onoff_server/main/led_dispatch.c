@@ -0,0 +1,92 @@
+/* led_dispatch.c - Element of a Generic OnOff message, resolved from a table */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "esp_ble_mesh_local_data_operation_api.h"
+
+#include "led_dispatch.h"
+
+#define TAG "DISPATCH"
+
+#define SLOT_MASK   (LED_DISPATCH_GROUP_SLOTS - 1)
+
+static inline uint32_t group_slot(uint16_t addr)
+{
+    return ((addr * 0x9E37U) >> 6) & SLOT_MASK;
+}
+
+/* Slot of the group, or the free slot it goes to. Returns -1 if the group is
+ * not in the table and there is no room for it.
+ */
+static int group_find(const struct led_dispatch *table, uint16_t addr)
+{
+    uint32_t slot = group_slot(addr);
+
+    for (int i = 0; i < LED_DISPATCH_GROUP_SLOTS; i++, slot = (slot + 1) & SLOT_MASK) {
+        if (table->group[slot].addr == addr ||
+                table->group[slot].addr == ESP_BLE_MESH_ADDR_UNASSIGNED) {
+            return slot;
+        }
+    }
+
+    return -1;
+}
+
+void led_dispatch_build(struct led_dispatch *table, uint16_t primary_addr,
+                        esp_ble_mesh_model_t *const onoff[], uint8_t count)
+{
+    memset(table, 0, sizeof(struct led_dispatch));
+    table->primary_addr = primary_addr;
+    table->elem_count = count < LED_DISPATCH_ELEMS ? count : LED_DISPATCH_ELEMS;
+
+    for (int i = 0; i < table->elem_count; i++) {
+        esp_ble_mesh_model_t *model = onoff[i];
+        if (!model) {
+            continue;
+        }
+        for (size_t j = 0; j < ARRAY_SIZE(model->groups); j++) {
+            if (!ESP_BLE_MESH_ADDR_IS_GROUP(model->groups[j])) {
+                continue;
+            }
+            int slot = group_find(table, model->groups[j]);
+            if (slot < 0) {
+                ESP_LOGW(TAG, "Group table is full, 0x%04x is checked per message", model->groups[j]);
+                continue;
+            }
+            table->group[slot].addr = model->groups[j];
+            table->group[slot].elems[i / 32] |= (1U << (i % 32));
+        }
+    }
+}
+
+int led_dispatch_find(const struct led_dispatch *table, esp_ble_mesh_model_t *model,
+                      uint16_t elem_addr, uint16_t dst)
+{
+    uint16_t offset = elem_addr - table->primary_addr;
+    int slot;
+
+    if (table->primary_addr == ESP_BLE_MESH_ADDR_UNASSIGNED || offset >= table->elem_count) {
+        return -1;
+    }
+
+    if (ESP_BLE_MESH_ADDR_IS_UNICAST(dst)) {
+        return dst == elem_addr ? offset : -1;
+    }
+    if (ESP_BLE_MESH_ADDR_IS_GROUP(dst)) {
+        slot = group_find(table, dst);
+        if (slot >= 0 && table->group[slot].addr == dst) {
+            return (table->group[slot].elems[offset / 32] & (1U << (offset % 32))) ? offset : -1;
+        }
+        /* Did not fit, or subscribed without a state change event (e.g. Model
+         * Subscription Overwrite) since the table was built.
+         */
+        return esp_ble_mesh_is_model_subscribed_to_group(model, dst) ? offset : -1;
+    }
+    return dst == ESP_BLE_MESH_ADDR_ALL_NODES ? offset : -1;
+}
@@ -0,0 +1,44 @@
+/* led_dispatch.h - Element of a Generic OnOff message, resolved from a table */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef _LED_DISPATCH_H_
+#define _LED_DISPATCH_H_
+
+#include <stdint.h>
+
+#include "esp_ble_mesh_defs.h"
+
+/* Multiple of 32, the largest number of elements */
+#define LED_DISPATCH_ELEMS          32
+
+/* Power of two, larger than the number of groups of all elements */
+#define LED_DISPATCH_GROUP_SLOTS    64
+
+/* Group addresses map to a bitmap of the elements whose Generic OnOff Server
+ * subscribes to them, kept in an open addressing table.
+ */
+struct led_dispatch {
+    uint16_t primary_addr;
+    uint8_t  elem_count;
+    struct {
+        uint16_t addr;
+        uint32_t elems[LED_DISPATCH_ELEMS / 32];
+    } group[LED_DISPATCH_GROUP_SLOTS];
+};
+
+/* Fills the table from the Generic OnOff Server of each element, onoff[i] is
+ * NULL for an element without one. A group which does not fit is checked with
+ * the stack per message.
+ */
+void led_dispatch_build(struct led_dispatch *table, uint16_t primary_addr,
+                        esp_ble_mesh_model_t *const onoff[], uint8_t count);
+
+/* Offset from the primary element of the element at elem_addr, the one of
+ * model, if it handles a message sent to dst. Returns -1 otherwise.
+ */
+int led_dispatch_find(const struct led_dispatch *table, esp_ble_mesh_model_t *model,
+                      uint16_t elem_addr, uint16_t dst);
+
+#endif
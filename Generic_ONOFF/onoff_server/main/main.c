@@ -23,14 +23,15 @@
 #include "esp_ble_mesh_local_data_operation_api.h"
 
 #include "board.h"
+#include "led_dispatch.h"
+#include "onoff_trans.h"
+#include "trace_events.h"
 #include "ble_mesh_example_init.h"
 
 #define TAG "EXAMPLE"
 
 #define CID_ESP 0x02E5
 
-extern struct _led_state led_state[3];
-
 static uint8_t dev_uuid[16] = { 0xdd, 0xdd };
 
 static esp_ble_mesh_cfg_srv_t config_server = {
@@ -55,7 +56,7 @@ static esp_ble_mesh_cfg_srv_t config_server = {
 ESP_BLE_MESH_MODEL_PUB_DEFINE(onoff_pub_0, 2 + 3, ROLE_NODE);
 static esp_ble_mesh_gen_onoff_srv_t onoff_server_0 = {
     .rsp_ctrl.get_auto_rsp = ESP_BLE_MESH_SERVER_AUTO_RSP,
-    .rsp_ctrl.set_auto_rsp = ESP_BLE_MESH_SERVER_AUTO_RSP,
+    .rsp_ctrl.set_auto_rsp = ESP_BLE_MESH_SERVER_RSP_BY_APP,
 };
 
 ESP_BLE_MESH_MODEL_PUB_DEFINE(onoff_pub_1, 2 + 3, ROLE_NODE);
@@ -89,6 +90,21 @@ static esp_ble_mesh_elem_t elements[] = {
     ESP_BLE_MESH_ELEMENT(0, extend_model_1, ESP_BLE_MESH_MODEL_NONE),
 };
 
+/* Delay and transition state of each Generic OnOff Server, the Set messages of
+ * all the servers are handled by the application.
+ */
+static example_onoff_trans_t onoff_trans[ARRAY_SIZE(elements)];
+
+/* Element to LED dispatch, resolved once the primary element address is known.
+ * The transition callbacks read it on the esp_timer task with the transition
+ * lock held, so it is rebuilt on the BTC task into the table not in use and
+ * swapped under that lock.
+ */
+static struct led_dispatch led_dispatch_table[2];
+static struct led_dispatch *led_dispatch = &led_dispatch_table[0];
+static struct _led_state *elem_led[ARRAY_SIZE(elements)];
+static esp_ble_mesh_model_t *elem_onoff[ARRAY_SIZE(elements)];
+
 static esp_ble_mesh_comp_t composition = {
     .cid = CID_ESP,
     .elements = elements,
@@ -109,65 +125,102 @@ static esp_ble_mesh_prov_t provision = {
 #endif
 };
 
+static void example_led_dispatch_update(uint16_t primary_addr);
+
 static void prov_complete(uint16_t net_idx, uint16_t addr, uint8_t flags, uint32_t iv_index)
 {
     ESP_LOGI(TAG, "net_idx: 0x%hu, addr: 0x%hu", net_idx, addr);
     ESP_LOGI(TAG, "flags: 0x%hhu, iv_index: 0x%lu", flags, iv_index);
     board_led_operation(LED_G, LED_OFF);
+    example_led_dispatch_update(addr);
 }
 
-static void example_change_led_state(esp_ble_mesh_model_t *model,
-                                     esp_ble_mesh_msg_ctx_t *ctx, uint8_t onoff)
+static void example_led_dispatch_init(void)
 {
-    uint16_t primary_addr = esp_ble_mesh_get_primary_element_address();
-    uint8_t elem_count = esp_ble_mesh_get_element_count();
-    struct _led_state *led = NULL;
-    uint8_t i;
-
-    if (ESP_BLE_MESH_ADDR_IS_UNICAST(ctx->recv_dst)) {
-        for (i = 0; i < elem_count; i++) {
-            if (ctx->recv_dst == (primary_addr + i)) {
-                led = &led_state[i];
-                board_led_operation(led->pin, onoff);
+    for (int i = 0; i < ARRAY_SIZE(elements); i++) {
+        elem_led[i] = board_led_get(i);
+        elem_onoff[i] = NULL;
+        for (int j = 0; j < elements[i].sig_model_count; j++) {
+            if (elements[i].sig_models[j].model_id == ESP_BLE_MESH_MODEL_ID_GEN_ONOFF_SRV) {
+                elem_onoff[i] = &elements[i].sig_models[j];
+                break;
             }
         }
-    } else if (ESP_BLE_MESH_ADDR_IS_GROUP(ctx->recv_dst)) {
-        if (esp_ble_mesh_is_model_subscribed_to_group(model, ctx->recv_dst)) {
-            led = &led_state[model->element->element_addr - primary_addr];
-            board_led_operation(led->pin, onoff);
+    }
+}
+
+/* ESP_BLE_MESH_ADDR_UNASSIGNED once the node is reset */
+static void example_led_dispatch_update(uint16_t primary_addr)
+{
+    struct led_dispatch *next = led_dispatch == &led_dispatch_table[0] ?
+                                &led_dispatch_table[1] : &led_dispatch_table[0];
+
+    led_dispatch_build(next, primary_addr, elem_onoff, ARRAY_SIZE(elements));
+
+    example_onoff_trans_lock();
+    led_dispatch = next;
+    example_onoff_trans_unlock();
+}
+
+static void example_change_led_state(esp_ble_mesh_model_t *model,
+                                     esp_ble_mesh_msg_ctx_t *ctx, uint8_t onoff)
+{
+    int offset = led_dispatch_find(led_dispatch, model, model->element->element_addr, ctx->recv_dst);
+
+    if (offset >= 0 && elem_led[offset]) {
+        board_led_operation(elem_led[offset]->pin, onoff);
+    }
+}
+
+static example_onoff_trans_t *example_find_onoff_trans(esp_ble_mesh_model_t *model)
+{
+    for (int i = 0; i < ARRAY_SIZE(onoff_trans); i++) {
+        if (onoff_trans[i].model == model) {
+            return &onoff_trans[i];
         }
-    } else if (ctx->recv_dst == 0xFFFF) {
-        led = &led_state[model->element->element_addr - primary_addr];
-        board_led_operation(led->pin, onoff);
     }
+    return NULL;
+}
+
+static void example_onoff_trans_changed(example_onoff_trans_t *trans)
+{
+    esp_ble_mesh_msg_ctx_t ctx = {
+        .recv_dst = trans->recv_dst,
+    };
+
+    example_change_led_state(trans->model, &ctx, trans->present);
 }
 
 static void example_handle_gen_onoff_msg(esp_ble_mesh_model_t *model,
                                          esp_ble_mesh_msg_ctx_t *ctx,
                                          esp_ble_mesh_server_recv_gen_onoff_set_t *set)
 {
-    esp_ble_mesh_gen_onoff_srv_t *srv = model->user_data;
+    example_onoff_trans_t *trans = example_find_onoff_trans(model);
+    esp_err_t err;
+
+    if (!trans) {
+        ESP_LOGE(TAG, "No transition state for model 0x%04x", model->model_id);
+        return;
+    }
 
     switch (ctx->recv_op) {
     case ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_GET:
-        esp_ble_mesh_server_model_send_msg(model, ctx,
-            ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_STATUS, sizeof(srv->state.onoff), &srv->state.onoff);
+        example_onoff_trans_reply(trans, ctx);
         break;
     case ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET:
     case ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET_UNACK:
-        if (set->op_en == false) {
-            srv->state.onoff = set->onoff;
-        } else {
-            /* TODO: Delay and state transition */
-            srv->state.onoff = set->onoff;
+        /* The status is published once the target state is reached, coalesced
+         * with the other changes of the same publication window. A repeated
+         * message is only acknowledged.
+         */
+        err = example_onoff_trans_set(trans, ctx, set);
+        if (err == ESP_ERR_INVALID_ARG) {
+            ESP_LOGW(TAG, "Invalid Generic OnOff Set, onoff 0x%02x", set->onoff);
+            break;
         }
         if (ctx->recv_op == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET) {
-            esp_ble_mesh_server_model_send_msg(model, ctx,
-                ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_STATUS, sizeof(srv->state.onoff), &srv->state.onoff);
+            example_onoff_trans_reply(trans, ctx);
         }
-        esp_ble_mesh_model_publish(model, ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_STATUS,
-            sizeof(srv->state.onoff), &srv->state.onoff, ROLE_NODE);
-        example_change_led_state(model, ctx, srv->state.onoff);
         break;
     default:
         break;
@@ -180,6 +233,10 @@ static void example_ble_mesh_provisioning_cb(esp_ble_mesh_prov_cb_event_t event,
     switch (event) {
     case ESP_BLE_MESH_PROV_REGISTER_COMP_EVT:
         ESP_LOGI(TAG, "ESP_BLE_MESH_PROV_REGISTER_COMP_EVT, err_code %d", param->prov_register_comp.err_code);
+        if (esp_ble_mesh_node_is_provisioned()) {
+            /* Provisioning data restored from flash */
+            example_led_dispatch_update(esp_ble_mesh_get_primary_element_address());
+        }
         break;
     case ESP_BLE_MESH_NODE_PROV_ENABLE_COMP_EVT:
         ESP_LOGI(TAG, "ESP_BLE_MESH_NODE_PROV_ENABLE_COMP_EVT, err_code %d", param->node_prov_enable_comp.err_code);
@@ -199,6 +256,7 @@ static void example_ble_mesh_provisioning_cb(esp_ble_mesh_prov_cb_event_t event,
         break;
     case ESP_BLE_MESH_NODE_PROV_RESET_EVT:
         ESP_LOGI(TAG, "ESP_BLE_MESH_NODE_PROV_RESET_EVT");
+        example_led_dispatch_update(ESP_BLE_MESH_ADDR_UNASSIGNED);
         break;
     case ESP_BLE_MESH_NODE_SET_UNPROV_DEV_NAME_COMP_EVT:
         ESP_LOGI(TAG, "ESP_BLE_MESH_NODE_SET_UNPROV_DEV_NAME_COMP_EVT, err_code %d", param->node_set_unprov_dev_name_comp.err_code);
@@ -212,34 +270,32 @@ static void example_ble_mesh_generic_server_cb(esp_ble_mesh_generic_server_cb_ev
                                                esp_ble_mesh_generic_server_cb_param_t *param)
 {
     esp_ble_mesh_gen_onoff_srv_t *srv;
-    ESP_LOGI(TAG, "event 0x%d, opcode 0x%lu, src 0x%hu, dst 0x%hu",
-        event, param->ctx.recv_op, param->ctx.addr, param->ctx.recv_dst);
+
+    /* Per message, traced instead of logged */
+    BIN_TRACED(TRACE_GEN_SRV_EVT, event, param->ctx.recv_op, param->ctx.addr);
+    BIN_TRACEV(TRACE_GEN_SRV_DST, param->ctx.recv_dst, 0, 0);
 
     switch (event) {
     case ESP_BLE_MESH_GENERIC_SERVER_STATE_CHANGE_EVT:
-        ESP_LOGI(TAG, "ESP_BLE_MESH_GENERIC_SERVER_STATE_CHANGE_EVT");
         if (param->ctx.recv_op == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET ||
             param->ctx.recv_op == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET_UNACK) {
-            ESP_LOGI(TAG, "onoff 0x%02x", param->value.state_change.onoff_set.onoff);
+            BIN_TRACEI(TRACE_ONOFF_CHANGE, param->value.state_change.onoff_set.onoff, 0, 0);
             example_change_led_state(param->model, &param->ctx, param->value.state_change.onoff_set.onoff);
         }
         break;
     case ESP_BLE_MESH_GENERIC_SERVER_RECV_GET_MSG_EVT:
-        ESP_LOGI(TAG, "ESP_BLE_MESH_GENERIC_SERVER_RECV_GET_MSG_EVT");
         if (param->ctx.recv_op == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_GET) {
             srv = param->model->user_data;
-            ESP_LOGI(TAG, "onoff 0x%02x", srv->state.onoff);
+            BIN_TRACEI(TRACE_ONOFF_GET, srv->state.onoff, 0, 0);
             example_handle_gen_onoff_msg(param->model, &param->ctx, NULL);
         }
         break;
     case ESP_BLE_MESH_GENERIC_SERVER_RECV_SET_MSG_EVT:
-        ESP_LOGI(TAG, "ESP_BLE_MESH_GENERIC_SERVER_RECV_SET_MSG_EVT");
         if (param->ctx.recv_op == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET ||
             param->ctx.recv_op == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET_UNACK) {
-            ESP_LOGI(TAG, "onoff 0x%02x, tid 0x%02x", param->value.set.onoff.onoff, param->value.set.onoff.tid);
+            BIN_TRACEI(TRACE_ONOFF_SET, param->value.set.onoff.onoff, param->value.set.onoff.tid, param->ctx.addr);
             if (param->value.set.onoff.op_en) {
-                ESP_LOGI(TAG, "trans_time 0x%02x, delay 0x%02x",
-                    param->value.set.onoff.trans_time, param->value.set.onoff.delay);
+                BIN_TRACEI(TRACE_ONOFF_SET_TRANS, param->value.set.onoff.trans_time, param->value.set.onoff.delay, 0);
             }
             example_handle_gen_onoff_msg(param->model, &param->ctx, &param->value.set.onoff);
         }
@@ -250,6 +306,33 @@ static void example_ble_mesh_generic_server_cb(esp_ble_mesh_generic_server_cb_ev
     }
 }
 
+static void example_ble_mesh_custom_model_cb(esp_ble_mesh_model_cb_event_t event,
+                                             esp_ble_mesh_model_cb_param_t *param)
+{
+    example_onoff_pub_stats_t stats;
+
+    switch (event) {
+    case ESP_BLE_MESH_MODEL_SEND_COMP_EVT:
+        if (param->model_send_comp.opcode == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_STATUS) {
+            example_onoff_trans_msg_comp(example_find_onoff_trans(param->model_send_comp.model), false,
+                                         param->model_send_comp.err_code);
+        }
+        break;
+    case ESP_BLE_MESH_MODEL_PUBLISH_COMP_EVT:
+        example_onoff_trans_msg_comp(example_find_onoff_trans(param->model_publish_comp.model), true,
+                                     param->model_publish_comp.err_code);
+        if (param->model_publish_comp.err_code) {
+            example_onoff_pub_get_stats(&stats);
+            ESP_LOGW(TAG, "Publish failed (err %d), %lu published, %lu coalesced, %lu no buffer, %u/%u pending",
+                param->model_publish_comp.err_code, stats.published, stats.coalesced, stats.no_buf,
+                stats.status_pending, stats.status_pending_max);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
 static void example_ble_mesh_config_server_cb(esp_ble_mesh_cfg_server_cb_event_t event,
                                               esp_ble_mesh_cfg_server_cb_param_t *param)
 {
@@ -277,6 +360,16 @@ static void example_ble_mesh_config_server_cb(esp_ble_mesh_cfg_server_cb_event_t
                 param->value.state_change.mod_sub_add.sub_addr,
                 param->value.state_change.mod_sub_add.company_id,
                 param->value.state_change.mod_sub_add.model_id);
+            example_led_dispatch_update(led_dispatch->primary_addr);
+            break;
+        case ESP_BLE_MESH_MODEL_OP_MODEL_SUB_DELETE:
+            ESP_LOGI(TAG, "ESP_BLE_MESH_MODEL_OP_MODEL_SUB_DELETE");
+            ESP_LOGI(TAG, "elem_addr 0x%04x, sub_addr 0x%04x, cid 0x%04x, mod_id 0x%04x",
+                param->value.state_change.mod_sub_delete.element_addr,
+                param->value.state_change.mod_sub_delete.sub_addr,
+                param->value.state_change.mod_sub_delete.company_id,
+                param->value.state_change.mod_sub_delete.model_id);
+            example_led_dispatch_update(led_dispatch->primary_addr);
             break;
         default:
             break;
@@ -288,9 +381,22 @@ static esp_err_t ble_mesh_init(void)
 {
     esp_err_t err = ESP_OK;
 
+    example_led_dispatch_init();
+
     esp_ble_mesh_register_prov_callback(example_ble_mesh_provisioning_cb);
     esp_ble_mesh_register_config_server_callback(example_ble_mesh_config_server_cb);
     esp_ble_mesh_register_generic_server_callback(example_ble_mesh_generic_server_cb);
+    esp_ble_mesh_register_custom_model_callback(example_ble_mesh_custom_model_cb);
+
+    /* Before the mesh stack, whose callbacks may already take the transition lock */
+    err = example_onoff_trans_init(example_onoff_trans_changed);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize transition engine (err %d)", err);
+        return err;
+    }
+    example_onoff_trans_bind(&onoff_trans[0], &root_models[1]);
+    example_onoff_trans_bind(&onoff_trans[1], &extend_model_0[0]);
+    example_onoff_trans_bind(&onoff_trans[2], &extend_model_1[0]);
 
     err = esp_ble_mesh_init(&provision, &composition);
     if (err != ESP_OK) {
@@ -319,6 +425,12 @@ void app_main(void)
 
     board_init();
 
+    /* Prints the message traces when idle */
+    err = bin_trace_start();
+    if (err) {
+        ESP_LOGE(TAG, "bin_trace_start failed (err %d)", err);
+    }
+
     err = nvs_flash_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES) {
         ESP_ERROR_CHECK(nvs_flash_erase());
@@ -0,0 +1,421 @@
+/* onoff_trans.c - Generic OnOff delay and transition engine */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include <errno.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_ble_mesh_networking_api.h"
+
+#include "onoff_trans.h"
+
+#define TAG "TRANS"
+
+#define TICK_US             (CONFIG_EXAMPLE_ONOFF_TRANS_TICK_MS * 1000LL)
+#define TID_TIMEOUT_MS      6000
+#define DELAY_STEP_MS       5
+#define TRANS_TIME_UNKNOWN  0x3F
+
+static struct timer_wheel wheel;
+static int64_t wheel_base_us;       /* Time of wheel.now */
+static esp_timer_handle_t wheel_timer;
+static SemaphoreHandle_t trans_lock;
+static example_onoff_trans_cb_t trans_cb;
+static example_onoff_pub_stats_t pub_stats;
+static example_onoff_trans_t *pub_head;     /* Due publications */
+
+static const uint32_t trans_step_ms[] = { 100, 1000, 10000, 600000 };
+
+static uint32_t trans_time_decode(uint8_t trans_time)
+{
+    return (trans_time & 0x3F) * trans_step_ms[trans_time >> 6];
+}
+
+static uint8_t trans_time_encode(uint32_t ms)
+{
+    for (uint8_t i = 0; i < ARRAY_SIZE(trans_step_ms); i++) {
+        uint32_t steps = (ms + trans_step_ms[i] - 1) / trans_step_ms[i];
+        if (steps < TRANS_TIME_UNKNOWN) {
+            return (i << 6) | steps;
+        }
+    }
+    return (3 << 6) | (TRANS_TIME_UNKNOWN - 1);
+}
+
+static inline uint32_t ms_to_ticks(uint32_t ms)
+{
+    return (ms + CONFIG_EXAMPLE_ONOFF_TRANS_TICK_MS - 1) / CONFIG_EXAMPLE_ONOFF_TRANS_TICK_MS;
+}
+
+static void wheel_sync(void)
+{
+    uint32_t ticks = (esp_timer_get_time() - wheel_base_us) / TICK_US;
+
+    wheel_base_us += ticks * TICK_US;
+    timer_wheel_advance(&wheel, ticks);
+}
+
+static void wheel_arm(void)
+{
+    uint32_t next = timer_wheel_next(&wheel);
+    int64_t delay_us;
+
+    esp_timer_stop(wheel_timer);
+    if (next == 0) {
+        return;
+    }
+
+    delay_us = wheel_base_us + next * TICK_US - esp_timer_get_time();
+    esp_timer_start_once(wheel_timer, delay_us > 0 ? delay_us : 0);
+}
+
+static void pub_flush(void);
+
+static void wheel_timeout(void *arg)
+{
+    xSemaphoreTake(trans_lock, portMAX_DELAY);
+    wheel_sync();
+    wheel_arm();
+    xSemaphoreGive(trans_lock);
+
+    pub_flush();
+}
+
+static uint8_t trans_status(example_onoff_trans_t *trans, uint8_t status[3])
+{
+    int64_t remain_ms;
+
+    status[0] = trans->present;
+    if (trans->phase == ONOFF_TRANS_IDLE) {
+        return 1;
+    }
+
+    remain_ms = trans->end_ms - esp_timer_get_time() / 1000;
+    status[1] = trans->target;
+    status[2] = trans_time_encode(remain_ms > 0 ? remain_ms : 0);
+    return 3;
+}
+
+static void msg_queued(uint8_t *pending)
+{
+    (*pending)++;
+    if (++pub_stats.status_pending > pub_stats.status_pending_max) {
+        pub_stats.status_pending_max = pub_stats.status_pending;
+    }
+}
+
+static void msg_done(uint8_t *pending)
+{
+    if (*pending) {
+        (*pending)--;
+        pub_stats.status_pending--;
+    }
+}
+
+static void pub_timeout(struct timer_wheel_timer *timer)
+{
+    example_onoff_trans_t *trans = (example_onoff_trans_t *)
+                                   ((uint8_t *)timer - offsetof(example_onoff_trans_t, pub_timer));
+
+    if (!trans->pub_due) {
+        trans->pub_due = true;
+        trans->pub_next = pub_head;
+        pub_head = trans;
+    }
+}
+
+/* Publishes the due statuses with the lock released: the BTC task, which
+ * esp_ble_mesh_model_publish() may wait for, takes it to handle messages.
+ */
+static void pub_flush(void)
+{
+    example_onoff_trans_t *trans;
+    uint8_t status[3];
+    uint8_t len, onoff;
+
+    while (1) {
+        xSemaphoreTake(trans_lock, portMAX_DELAY);
+        trans = pub_head;
+        if (!trans) {
+            xSemaphoreGive(trans_lock);
+            return;
+        }
+        pub_head = trans->pub_next;
+        trans->pub_due = false;
+
+        if (trans->phase == ONOFF_TRANS_IDLE && trans->present == trans->pub_onoff) {
+            /* Changed back to the published state within the window */
+            pub_stats.suppressed++;
+            xSemaphoreGive(trans_lock);
+            continue;
+        }
+        len = trans_status(trans, status);
+        onoff = trans->present;
+        /* Counted first, the completion event may come before the publish returns */
+        msg_queued(&trans->pub_pending);
+        xSemaphoreGive(trans_lock);
+
+        if (esp_ble_mesh_model_publish(trans->model, ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_STATUS,
+                                       len, status, ROLE_NODE) == ESP_OK) {
+            xSemaphoreTake(trans_lock, portMAX_DELAY);
+            trans->pub_onoff = onoff;
+            pub_stats.published++;
+            xSemaphoreGive(trans_lock);
+        } else {
+            xSemaphoreTake(trans_lock, portMAX_DELAY);
+            msg_done(&trans->pub_pending);
+            xSemaphoreGive(trans_lock);
+        }
+    }
+}
+
+static void pub_schedule(example_onoff_trans_t *trans)
+{
+    uint32_t delay_ms = CONFIG_EXAMPLE_ONOFF_PUB_WINDOW_MS;
+
+    if (timer_wheel_is_pending(&trans->pub_timer)) {
+        pub_stats.coalesced++;
+        return;
+    }
+
+#if CONFIG_EXAMPLE_ONOFF_PUB_JITTER_MS
+    /* Nodes answering the same group message do not publish at once */
+    delay_ms += esp_random() % (CONFIG_EXAMPLE_ONOFF_PUB_JITTER_MS + 1);
+#endif
+    timer_wheel_add(&wheel, &trans->pub_timer, ms_to_ticks(delay_ms));
+}
+
+static void trans_apply(example_onoff_trans_t *trans, uint8_t onoff, bool complete)
+{
+    esp_ble_mesh_gen_onoff_srv_t *srv = trans->model->user_data;
+
+    trans->present = onoff;
+    srv->state.onoff = onoff;
+    srv->state.target_onoff = trans->target;
+    trans_cb(trans);
+
+    if (complete) {
+        pub_schedule(trans);
+    }
+}
+
+static void trans_start(example_onoff_trans_t *trans)
+{
+    if (trans->trans_ms == 0) {
+        trans->phase = ONOFF_TRANS_IDLE;
+        trans_apply(trans, trans->target, true);
+        return;
+    }
+
+    trans->phase = ONOFF_TRANS_RUN;
+    trans->end_ms = esp_timer_get_time() / 1000 + trans->trans_ms;
+    timer_wheel_add(&wheel, &trans->timer, ms_to_ticks(trans->trans_ms));
+
+    /* Off to On is visible as soon as the transition starts, On to Off at its end */
+    if (trans->target && !trans->present) {
+        trans_apply(trans, trans->target, false);
+    }
+}
+
+static void trans_timeout(struct timer_wheel_timer *timer)
+{
+    example_onoff_trans_t *trans = (example_onoff_trans_t *)
+                                   ((uint8_t *)timer - offsetof(example_onoff_trans_t, timer));
+
+    if (trans->phase == ONOFF_TRANS_DELAY) {
+        trans_start(trans);
+    } else if (trans->phase == ONOFF_TRANS_RUN) {
+        trans->phase = ONOFF_TRANS_IDLE;
+        trans_apply(trans, trans->target, true);
+    }
+}
+
+esp_err_t example_onoff_trans_init(example_onoff_trans_cb_t cb)
+{
+    const esp_timer_create_args_t args = {
+        .callback = wheel_timeout,
+        .name = "onoff_trans",
+    };
+    esp_err_t err;
+
+    if (!cb) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    trans_lock = xSemaphoreCreateMutex();
+    if (!trans_lock) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    err = esp_timer_create(&args, &wheel_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create transition timer (err %d)", err);
+        return err;
+    }
+
+    timer_wheel_init(&wheel);
+    wheel_base_us = esp_timer_get_time();
+    trans_cb = cb;
+
+    return ESP_OK;
+}
+
+esp_err_t example_onoff_trans_bind(example_onoff_trans_t *trans, esp_ble_mesh_model_t *model)
+{
+    esp_ble_mesh_gen_onoff_srv_t *srv;
+
+    if (!trans || !model || !model->user_data) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    srv = model->user_data;
+    memset(trans, 0, sizeof(example_onoff_trans_t));
+    timer_wheel_timer_init(&trans->timer, trans_timeout);
+    timer_wheel_timer_init(&trans->pub_timer, pub_timeout);
+    trans->model = model;
+    trans->present = trans->target = trans->pub_onoff = srv->state.onoff;
+    trans->last_ms = -TID_TIMEOUT_MS;
+
+    return ESP_OK;
+}
+
+esp_err_t example_onoff_trans_set(example_onoff_trans_t *trans, esp_ble_mesh_msg_ctx_t *ctx,
+                                  esp_ble_mesh_server_recv_gen_onoff_set_t *set)
+{
+    int64_t now_ms = esp_timer_get_time() / 1000;
+    uint32_t delay_ms = 0;
+
+    if (!trans || !ctx || !set) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (set->onoff > 1 || (set->op_en && (set->trans_time & 0x3F) == TRANS_TIME_UNKNOWN)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(trans_lock, portMAX_DELAY);
+
+    if (set->tid == trans->last_tid && ctx->addr == trans->last_src &&
+            ctx->recv_dst == trans->last_dst && now_ms - trans->last_ms < TID_TIMEOUT_MS) {
+        xSemaphoreGive(trans_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    trans->last_tid = set->tid;
+    trans->last_src = ctx->addr;
+    trans->last_dst = ctx->recv_dst;
+    trans->last_ms  = now_ms;
+
+    /* A new message replaces the transition in progress, from the present state */
+    wheel_sync();
+    timer_wheel_cancel(&wheel, &trans->timer);
+
+    trans->recv_dst = ctx->recv_dst;
+    trans->target = set->onoff;
+    trans->trans_ms = 0;
+    if (set->op_en) {
+        trans->trans_ms = trans_time_decode(set->trans_time);
+        delay_ms = set->delay * DELAY_STEP_MS;
+    }
+
+    if (delay_ms) {
+        trans->phase = ONOFF_TRANS_DELAY;
+        trans->end_ms = now_ms + delay_ms + trans->trans_ms;
+        timer_wheel_add(&wheel, &trans->timer, ms_to_ticks(delay_ms));
+    } else {
+        trans_start(trans);
+    }
+
+    wheel_arm();
+    if (pub_head) {
+        /* Published from the esp_timer task, like the others */
+        esp_timer_stop(wheel_timer);
+        esp_timer_start_once(wheel_timer, 0);
+    }
+    xSemaphoreGive(trans_lock);
+
+    return ESP_OK;
+}
+
+uint8_t example_onoff_trans_status(example_onoff_trans_t *trans, uint8_t status[3])
+{
+    uint8_t len;
+
+    xSemaphoreTake(trans_lock, portMAX_DELAY);
+    len = trans_status(trans, status);
+    xSemaphoreGive(trans_lock);
+
+    return len;
+}
+
+esp_err_t example_onoff_trans_reply(example_onoff_trans_t *trans, esp_ble_mesh_msg_ctx_t *ctx)
+{
+    uint8_t status[3];
+    uint8_t len;
+    esp_err_t err;
+
+    xSemaphoreTake(trans_lock, portMAX_DELAY);
+    len = trans_status(trans, status);
+    msg_queued(&trans->reply_pending);
+    xSemaphoreGive(trans_lock);
+
+    err = esp_ble_mesh_server_model_send_msg(trans->model, ctx, ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_STATUS,
+                                             len, status);
+
+    xSemaphoreTake(trans_lock, portMAX_DELAY);
+    if (err == ESP_OK) {
+        pub_stats.replied++;
+    } else {
+        msg_done(&trans->reply_pending);
+    }
+    xSemaphoreGive(trans_lock);
+
+    return err;
+}
+
+void example_onoff_trans_msg_comp(example_onoff_trans_t *trans, bool publish, int err_code)
+{
+    uint8_t *pending;
+
+    if (!trans) {
+        return;
+    }
+
+    xSemaphoreTake(trans_lock, portMAX_DELAY);
+    pending = publish ? &trans->pub_pending : &trans->reply_pending;
+    if (*pending) {
+        msg_done(pending);
+        if (err_code == -ENOBUFS) {
+            pub_stats.no_buf++;
+        }
+    }
+    xSemaphoreGive(trans_lock);
+}
+
+void example_onoff_pub_get_stats(example_onoff_pub_stats_t *stats)
+{
+    if (stats) {
+        xSemaphoreTake(trans_lock, portMAX_DELAY);
+        memcpy(stats, &pub_stats, sizeof(example_onoff_pub_stats_t));
+        xSemaphoreGive(trans_lock);
+    }
+}
+
+void example_onoff_trans_lock(void)
+{
+    xSemaphoreTake(trans_lock, portMAX_DELAY);
+}
+
+void example_onoff_trans_unlock(void)
+{
+    xSemaphoreGive(trans_lock);
+}
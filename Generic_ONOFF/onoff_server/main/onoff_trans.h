@@ -0,0 +1,110 @@
+/* onoff_trans.h - Generic OnOff delay and transition engine */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef _ONOFF_TRANS_H_
+#define _ONOFF_TRANS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_ble_mesh_defs.h"
+#include "esp_ble_mesh_generic_model_api.h"
+
+#include "timer_wheel.h"
+
+#ifndef CONFIG_EXAMPLE_ONOFF_TRANS_TICK_MS
+#define CONFIG_EXAMPLE_ONOFF_TRANS_TICK_MS  10
+#endif
+
+#ifndef CONFIG_EXAMPLE_ONOFF_PUB_WINDOW_MS
+#define CONFIG_EXAMPLE_ONOFF_PUB_WINDOW_MS  200
+#endif
+
+#ifndef CONFIG_EXAMPLE_ONOFF_PUB_JITTER_MS
+#define CONFIG_EXAMPLE_ONOFF_PUB_JITTER_MS  50
+#endif
+
+enum {
+    ONOFF_TRANS_IDLE,
+    ONOFF_TRANS_DELAY,
+    ONOFF_TRANS_RUN,
+};
+
+typedef struct example_onoff_trans example_onoff_trans_t;
+
+/* Called when the present OnOff state changes */
+typedef void (*example_onoff_trans_cb_t)(example_onoff_trans_t *trans);
+
+/* Generic OnOff Status messages sent by the engine, each of them holds an
+ * advertising buffer until its completion event.
+ */
+typedef struct {
+    uint32_t published;
+    uint32_t coalesced;     /* Completed transitions merged into a pending publication */
+    uint32_t suppressed;    /* Publications skipped, the state was already published */
+    uint32_t replied;
+    uint32_t no_buf;        /* Completed with -ENOBUFS */
+    uint16_t status_pending;        /* Not completed yet */
+    uint16_t status_pending_max;
+} example_onoff_pub_stats_t;
+
+struct example_onoff_trans {
+    struct timer_wheel_timer timer;
+    esp_ble_mesh_model_t *model;
+    uint16_t recv_dst;      /* Destination of the Set which started the transition */
+    uint8_t  present;
+    uint8_t  target;
+    uint8_t  phase;
+    uint32_t trans_ms;
+    int64_t  end_ms;
+    /* The last Set is not processed again when repeated within 6 seconds */
+    uint8_t  last_tid;
+    uint16_t last_src;
+    uint16_t last_dst;
+    int64_t  last_ms;
+    /* Completed transitions are published once per window, with the final state */
+    struct timer_wheel_timer pub_timer;
+    uint8_t  pub_onoff;
+    bool     pub_due;       /* Published once the transition lock is released */
+    example_onoff_trans_t *pub_next;
+    /* Status messages waiting for their completion event */
+    uint8_t  reply_pending;
+    uint8_t  pub_pending;
+};
+
+/* All the transitions share one wheel and one esp_timer, which is only armed
+ * for the next non-empty slot of CONFIG_EXAMPLE_ONOFF_TRANS_TICK_MS.
+ */
+esp_err_t example_onoff_trans_init(example_onoff_trans_cb_t cb);
+
+esp_err_t example_onoff_trans_bind(example_onoff_trans_t *trans, esp_ble_mesh_model_t *model);
+
+/* Returns ESP_ERR_INVALID_STATE for a repeated message and ESP_ERR_INVALID_ARG
+ * for a prohibited Transition Time, the state is left unchanged in both cases.
+ */
+esp_err_t example_onoff_trans_set(example_onoff_trans_t *trans, esp_ble_mesh_msg_ctx_t *ctx,
+                                  esp_ble_mesh_server_recv_gen_onoff_set_t *set);
+
+/* Fills a Generic OnOff Status and returns its length */
+uint8_t example_onoff_trans_status(example_onoff_trans_t *trans, uint8_t status[3]);
+
+/* Replies to a Get or an acknowledged Set */
+esp_err_t example_onoff_trans_reply(example_onoff_trans_t *trans, esp_ble_mesh_msg_ctx_t *ctx);
+
+/* To be called on ESP_BLE_MESH_MODEL_SEND_COMP_EVT of a Generic OnOff Status
+ * (publish false) and on ESP_BLE_MESH_MODEL_PUBLISH_COMP_EVT (publish true) of
+ * the model of trans. Only the messages sent by the engine are counted.
+ */
+void example_onoff_trans_msg_comp(example_onoff_trans_t *trans, bool publish, int err_code);
+
+void example_onoff_pub_get_stats(example_onoff_pub_stats_t *stats);
+
+/* The callback runs with this lock held, state it reads is swapped under it */
+void example_onoff_trans_lock(void);
+
+void example_onoff_trans_unlock(void);
+
+#endif
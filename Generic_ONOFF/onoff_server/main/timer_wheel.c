@@ -0,0 +1,131 @@
+/* timer_wheel.c - Hashed timer wheel driven by a single clock */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "timer_wheel.h"
+
+#define SLOT_MASK   (TIMER_WHEEL_SLOTS - 1)
+
+static void slot_unlink(struct timer_wheel *wheel, struct timer_wheel_timer *timer)
+{
+    uint32_t slot = timer->expire & SLOT_MASK;
+
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        wheel->slot[slot] = timer->next;
+        if (!timer->next) {
+            wheel->busy[slot / 32] &= ~(1U << (slot % 32));
+        }
+    }
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    timer->next = timer->prev = timer;  /* Not pending */
+    wheel->pending--;
+}
+
+void timer_wheel_init(struct timer_wheel *wheel)
+{
+    memset(wheel, 0, sizeof(struct timer_wheel));
+}
+
+void timer_wheel_timer_init(struct timer_wheel_timer *timer, timer_wheel_handler_t handler)
+{
+    timer->next = timer->prev = timer;
+    timer->expire = 0;
+    timer->handler = handler;
+}
+
+bool timer_wheel_is_pending(const struct timer_wheel_timer *timer)
+{
+    return timer->next != timer;
+}
+
+void timer_wheel_add(struct timer_wheel *wheel, struct timer_wheel_timer *timer, uint32_t ticks)
+{
+    uint32_t slot;
+
+    if (timer_wheel_is_pending(timer)) {
+        slot_unlink(wheel, timer);
+    }
+
+    timer->expire = wheel->now + (ticks ? ticks : 1);
+    slot = timer->expire & SLOT_MASK;
+
+    timer->prev = NULL;
+    timer->next = wheel->slot[slot];
+    if (timer->next) {
+        timer->next->prev = timer;
+    }
+    wheel->slot[slot] = timer;
+    wheel->busy[slot / 32] |= (1U << (slot % 32));
+    wheel->pending++;
+}
+
+void timer_wheel_cancel(struct timer_wheel *wheel, struct timer_wheel_timer *timer)
+{
+    if (timer_wheel_is_pending(timer)) {
+        slot_unlink(wheel, timer);
+    }
+}
+
+static void slot_expire(struct timer_wheel *wheel, uint32_t slot)
+{
+    struct timer_wheel_timer *timer = wheel->slot[slot];
+
+    while (timer) {
+        if ((int32_t)(timer->expire - wheel->now) > 0) {
+            /* Due in a later revolution */
+            timer = timer->next;
+            continue;
+        }
+        slot_unlink(wheel, timer);
+        timer->handler(timer);
+        /* The handler may have added or cancelled timers of this slot */
+        timer = wheel->slot[slot];
+    }
+}
+
+void timer_wheel_advance(struct timer_wheel *wheel, uint32_t ticks)
+{
+    uint32_t target = wheel->now + ticks;
+
+    if (ticks > TIMER_WHEEL_SLOTS) {
+        /* Every slot is visited once in the last revolution, which also
+         * expires the timers due before it.
+         */
+        wheel->now = target - TIMER_WHEEL_SLOTS;
+    }
+
+    while (wheel->now != target) {
+        uint32_t slot = ++wheel->now & SLOT_MASK;
+        if (wheel->busy[slot / 32] & (1U << (slot % 32))) {
+            slot_expire(wheel, slot);
+        }
+    }
+}
+
+uint32_t timer_wheel_next(const struct timer_wheel *wheel)
+{
+    if (wheel->pending == 0) {
+        return 0;
+    }
+
+    for (uint32_t ticks = 1; ticks <= TIMER_WHEEL_SLOTS;) {
+        uint32_t slot = (wheel->now + ticks) & SLOT_MASK;
+        uint32_t word = wheel->busy[slot / 32] >> (slot % 32);
+
+        if (word) {
+            return ticks + __builtin_ctz(word);
+        }
+        /* Skip to the start of the next bitmap word */
+        ticks += 32 - (slot % 32);
+    }
+
+    return TIMER_WHEEL_SLOTS;
+}
@@ -0,0 +1,54 @@
+/* timer_wheel.h - Hashed timer wheel driven by a single clock */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Must be a power of two, one revolution is TIMER_WHEEL_SLOTS ticks */
+#define TIMER_WHEEL_SLOTS   256
+
+struct timer_wheel_timer;
+
+typedef void (*timer_wheel_handler_t)(struct timer_wheel_timer *timer);
+
+struct timer_wheel_timer {
+    struct timer_wheel_timer *next;
+    struct timer_wheel_timer *prev;
+    uint32_t expire;                /* Absolute tick */
+    timer_wheel_handler_t handler;
+};
+
+struct timer_wheel {
+    struct timer_wheel_timer *slot[TIMER_WHEEL_SLOTS];
+    uint32_t busy[TIMER_WHEEL_SLOTS / 32];  /* Non-empty slots */
+    uint32_t now;
+    uint32_t pending;
+};
+
+void timer_wheel_init(struct timer_wheel *wheel);
+
+void timer_wheel_timer_init(struct timer_wheel_timer *timer, timer_wheel_handler_t handler);
+
+/* (Re)starts the timer, it expires after ticks (at least one) */
+void timer_wheel_add(struct timer_wheel *wheel, struct timer_wheel_timer *timer, uint32_t ticks);
+
+void timer_wheel_cancel(struct timer_wheel *wheel, struct timer_wheel_timer *timer);
+
+bool timer_wheel_is_pending(const struct timer_wheel_timer *timer);
+
+/* Moves the wheel forward and runs the handlers of the expired timers, which
+ * may add or cancel timers themselves.
+ */
+void timer_wheel_advance(struct timer_wheel *wheel, uint32_t ticks);
+
+/* Ticks until the next non-empty slot, 0 if no timer is pending. This is a
+ * lower bound: a timer due in a later revolution only needs another wakeup.
+ */
+uint32_t timer_wheel_next(const struct timer_wheel *wheel);
+
+#endif
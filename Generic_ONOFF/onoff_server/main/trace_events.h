@@ -0,0 +1,23 @@
+/* trace_events.h - Trace events of the OnOff server, see bin_trace.h */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef _TRACE_EVENTS_H_
+#define _TRACE_EVENTS_H_
+
+#include "bin_trace.h"
+
+#define EXAMPLE_TRACE_EVENTS(X)                                                 \
+    X(TRACE_GEN_SRV_EVT,    "Generic Server event %u, opcode 0x%04x, src 0x%04x") \
+    X(TRACE_GEN_SRV_DST,    "dst 0x%04x")                                       \
+    X(TRACE_ONOFF_CHANGE,   "State change, onoff 0x%02x")                       \
+    X(TRACE_ONOFF_GET,      "Get, onoff 0x%02x")                                \
+    X(TRACE_ONOFF_SET,      "Set, onoff 0x%02x, tid 0x%02x, src 0x%04x")        \
+    X(TRACE_ONOFF_SET_TRANS, "Set, trans_time 0x%02x, delay 0x%02x")
+
+enum {
+    EXAMPLE_TRACE_EVENTS(BIN_TRACE_EVENT_ID)
+};
+
+#endif /* _TRACE_EVENTS_H_ */
@@ -15,6 +15,7 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "esp_bt.h"
 
@@ -30,6 +31,8 @@
 
 #include "esp32_button.h"
 #include "keypad.h"
+#include "hid_kbd.h"
+#include "trace_events.h"
 
 
 #define A_BTN 5
@@ -63,8 +66,6 @@
 /*Create my button queue*/
 QueueHandle_t ButtonQueue;
 
-QueueHandle_t keypad_queue;
-
 typedef enum {
     W,
     A,
@@ -84,7 +85,8 @@ int8_t keypad[] = {
 
 /*end */
 
-uint16_t hid_conn_id = 0;
+/* Hosts connected, every one of them gets the same reports */
+static uint8_t hid_conn_count = 0;
 static bool sec_conn = false;
 static bool send_volum_up = false;
 #define CHAR_DECLARATION_SIZE   (sizeof(uint8_t))
@@ -153,12 +155,21 @@ static void hidd_event_callback(esp_hidd_cb_event_t event, esp_hidd_cb_param_t *
 	     break;
 		case ESP_HIDD_EVENT_BLE_CONNECT: {
             ESP_LOGI(HID_DEMO_TAG, "ESP_HIDD_EVENT_BLE_CONNECT");
-            hid_conn_id = param->connect.conn_id;
+            hid_conn_count++;
+            hid_kbd_set_conn(ESP_HIDD_CONN_ID_ALL, true);
+            /* Keep advertising while another host may connect */
+            if (hid_conn_count < HID_MAX_APPS) {
+                esp_ble_gap_start_advertising(&hidd_adv_params);
+            }
             break;
         }
         case ESP_HIDD_EVENT_BLE_DISCONNECT: {
             sec_conn = false;
-            ESP_LOGI(HID_DEMO_TAG, "ESP_HIDD_EVENT_BLE_DISCONNECT");
+            if (hid_conn_count) {
+                hid_conn_count--;
+            }
+            hid_kbd_set_conn(ESP_HIDD_CONN_ID_ALL, hid_conn_count > 0);
+            ESP_LOGI(HID_DEMO_TAG, "ESP_HIDD_EVENT_BLE_DISCONNECT, conn_id = %d", param->disconnect.conn_id);
             esp_ble_gap_start_advertising(&hidd_adv_params);
             break;
         }
@@ -237,37 +248,19 @@ void button_task(void *pvPara) {
 
 void hid_demo_task(void *pvParameters)
 {
+    keypad_event_t ev;
+
     vTaskDelay(1000 / portTICK_PERIOD_MS);
-    // BTN btn;
-    uint8_t key_val = 0 ;
+    hid_kbd_init();
     keypad_initalize(pins,keypad);
     while(1) {
-        // vTaskDelay(50 / portTICK_PERIOD_MS);445687c999
-        if (xQueueReceive(keypad_queue,&key_val,(TickType_t)5)) {
-            ESP_LOGI("KEYPAD","Key: %d",key_val);
-            // switch (btn)
-            // {
-            // case W:
-            //     key_val = HID_KEY_W;
-            //     break;
-            // case A:
-            //     key_val = HID_KEY_A;
-            //     break;
-            // case S:
-            //     key_val = HID_KEY_S;
-            //     break;
-            // case D:
-            //     key_val = HID_KEY_D;
-            //     break;
-            // }
-                // 123456789*03abcd3693258112312222223333444455678903*abcd
-
-            esp_hidd_send_keyboard_value(hid_conn_id, 0, &key_val, 1);
-            vTaskDelay(50/portTICK_PERIOD_MS);
-            key_val = HID_KEY_RESERVED;
-            esp_hidd_send_keyboard_value(hid_conn_id, 0, &key_val, 1);
-            vTaskDelay(50/portTICK_PERIOD_MS);
+        if (!keypad_get_event(&ev, portMAX_DELAY)) {
+            continue;
         }
+        BIN_TRACEI(TRACE_KEY, ev.code, ev.pressed, esp_timer_get_time() - ev.time_us);
+
+        /* Reports follow the state of the keys, not a fixed press and release */
+        hid_kbd_key(ev.code, ev.pressed);
     }
 }
 
@@ -307,6 +300,11 @@ void app_main(void)
     }
     ESP_ERROR_CHECK( ret );
 
+    // Print the key traces when idle
+    if ((ret = bin_trace_start()) != ESP_OK) {
+        ESP_LOGE(HID_DEMO_TAG, "%s start trace dump failed\n", __func__);
+    }
+
     ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
 
     esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -6,7 +7,9 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "driver/gpio.h"
+#include "soc/soc_caps.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 
@@ -14,17 +17,32 @@
 
 #define TAG "BUTTON"
 
+#define POLL_MS 10
+
 typedef struct {
-  uint8_t pin;
-  bool inverted;
-  uint16_t history;
-  uint32_t down_time;
-  uint32_t next_long_time;
+    uint32_t down_time;
+    uint32_t next_long_time;
+    uint16_t history;
+    uint8_t pin;
 } debounce_t;
 
-int pin_count = -1;
-debounce_t * debounce;
-QueueHandle_t queue;
+struct button_group {
+    struct button_group *next;
+    QueueHandle_t queue;
+    unsigned long long pin_select;
+    uint32_t long_press_ms;
+    uint32_t long_press_repeat_ms;
+    uint32_t dropped;           // Events the queue had no room for
+    bool inverted;
+    volatile bool polling;      // Set by the isr, cleared by the task once every button settled
+    uint8_t count;
+    debounce_t debounce[];      // One allocation with the group, in pin order
+};
+
+// Every group is served by the same task
+static struct button_group *groups;
+static SemaphoreHandle_t groups_lock;
+static TaskHandle_t button_task_handle;
 
 static void update_button(debounce_t *d) {
     d->history = (d->history << 1) | gpio_get_level(d->pin);
@@ -45,12 +63,12 @@ static bool button_fell(debounce_t *d) {
     }
     return 0;
 }
-static bool button_down(debounce_t *d) {
-    if (d->inverted) return button_fell(d);
+static bool button_down(button_group_handle_t group, debounce_t *d) {
+    if (group->inverted) return button_fell(d);
     return button_rose(d);
 }
-static bool button_up(debounce_t *d) {
-    if (d->inverted) return button_rose(d);
+static bool button_up(button_group_handle_t group, debounce_t *d) {
+    if (group->inverted) return button_rose(d);
     return button_fell(d);
 }
 
@@ -58,86 +76,244 @@ static uint32_t millis() {
     return esp_timer_get_time() / 1000;
 }
 
-static void send_event(debounce_t db, int ev) {
+// Runs under groups_lock, so a reader which is behind loses events instead of
+// stalling every group
+static void send_event(button_group_handle_t group, debounce_t *d, int ev) {
     button_event_t event = {
-        .pin = db.pin,
+        .pin = d->pin,
         .event = ev,
     };
-    xQueueSend(queue, &event, portMAX_DELAY);
+    if (xQueueSend(group->queue, &event, 0) != pdTRUE) {
+        group->dropped++;
+    }
+}
+
+// Settled and released: nothing to poll until the next edge
+static bool button_idle(button_group_handle_t group, debounce_t *d) {
+    return d->down_time == 0 && d->history == (group->inverted ? 0xffff : 0x0000);
+}
+
+static void group_intr_enable(button_group_handle_t group, bool enable) {
+    for (int idx=0; idx<group->count; idx++) {
+        if (enable) {
+            gpio_intr_enable(group->debounce[idx].pin);
+        } else {
+            gpio_intr_disable(group->debounce[idx].pin);
+        }
+    }
+}
+
+static void button_isr(void *arg) {
+    button_group_handle_t group = arg;
+    BaseType_t woken = pdFALSE;
+
+    // Polling takes over until every button of the group is idle again
+    group_intr_enable(group, false);
+    group->polling = true;
+    vTaskNotifyGiveFromISR(button_task_handle, &woken);
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+// Keeps polling if a pin moved before its interrupt was enabled
+static void button_arm(button_group_handle_t group) {
+    group->polling = false;
+    group_intr_enable(group, true);
+    for (int idx=0; idx<group->count; idx++) {
+        if (gpio_get_level(group->debounce[idx].pin) != (group->debounce[idx].history & 1)) {
+            group_intr_enable(group, false);
+            group->polling = true;
+            return;
+        }
+    }
+}
+
+static void poll_group(button_group_handle_t group) {
+    bool idle = true;
+
+    for (int idx=0; idx<group->count; idx++) {
+        debounce_t *d = &group->debounce[idx];
+
+        update_button(d);
+        if (button_up(group, d)) {
+            d->down_time = 0;
+            ESP_LOGI(TAG, "%d UP", d->pin);
+            send_event(group, d, BUTTON_UP);
+        } else if (d->down_time && millis() >= d->next_long_time) {
+            ESP_LOGI(TAG, "%d LONG", d->pin);
+            d->next_long_time = d->next_long_time + group->long_press_repeat_ms;
+            send_event(group, d, BUTTON_HELD);
+        } else if (button_down(group, d) && d->down_time == 0) {
+            d->down_time = millis();
+            ESP_LOGI(TAG, "%d DOWN", d->pin);
+            d->next_long_time = d->down_time + group->long_press_ms;
+            send_event(group, d, BUTTON_DOWN);
+        }
+        if (!button_idle(group, d)) {
+            idle = false;
+        }
+    }
+    if (idle) {
+        button_arm(group);
+    }
 }
 
 static void button_task(void *pvParameter)
 {
+    bool polling = false;
+
     for (;;) {
-        for (int idx=0; idx<pin_count; idx++) {
-            update_button(&debounce[idx]);
-            if (button_up(&debounce[idx])) {
-                debounce[idx].down_time = 0;
-                ESP_LOGI(TAG, "%d UP", debounce[idx].pin);
-                send_event(debounce[idx], BUTTON_UP);
-            } else if (debounce[idx].down_time && millis() >= debounce[idx].next_long_time) {
-                ESP_LOGI(TAG, "%d LONG", debounce[idx].pin);
-                debounce[idx].next_long_time = debounce[idx].next_long_time + CONFIG_ESP32_BUTTON_LONG_PRESS_REPEAT_MS;
-                send_event(debounce[idx], BUTTON_HELD);
-            } else if (button_down(&debounce[idx]) && debounce[idx].down_time == 0) {
-                debounce[idx].down_time = millis();
-                ESP_LOGI(TAG, "%d DOWN", debounce[idx].pin);
-                debounce[idx].next_long_time = debounce[idx].down_time + CONFIG_ESP32_BUTTON_LONG_PRESS_DURATION_MS;
-                send_event(debounce[idx], BUTTON_DOWN);
-            } 
+        ulTaskNotifyTake(pdTRUE, polling ? POLL_MS/portTICK_PERIOD_MS : portMAX_DELAY);
+
+        polling = false;
+        xSemaphoreTake(groups_lock, portMAX_DELAY);
+        for (button_group_handle_t group = groups; group; group = group->next) {
+            if (group->polling) {
+                poll_group(group);
+                polling |= group->polling;
+            }
         }
-        vTaskDelay(10/portTICK_PERIOD_MS);
+        xSemaphoreGive(groups_lock);
     }
 }
 
-QueueHandle_t button_init(unsigned long long pin_select) {
-    return pulled_button_init(pin_select, GPIO_FLOATING);
-}
+// Shared by every group, created with the first one
+static esp_err_t button_service_init(void) {
+    if (button_task_handle) {
+        return ESP_OK;
+    }
+
+    // The service may already be installed by another driver
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        return err;
+    }
 
+    groups_lock = xSemaphoreCreateMutex();
+    if (groups_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
 
-QueueHandle_t pulled_button_init(unsigned long long pin_select, gpio_pull_mode_t pull_mode)
+    // Spawn a task to monitor the pins, it polls until they all settle then waits for an edge
+    if (xTaskCreate(&button_task, "button_task", CONFIG_ESP32_BUTTON_TASK_STACK_SIZE, NULL, 10, &button_task_handle) != pdPASS) {
+        vSemaphoreDelete(groups_lock);
+        groups_lock = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+button_group_handle_t button_create(const button_config_t *config)
 {
-    if (pin_count != -1) {
-        ESP_LOGI(TAG, "Already initialized");
+    button_group_handle_t group;
+    unsigned long long mask;
+    int count = __builtin_popcountll(config->pin_select);
+
+    if (count == 0 || (config->pin_select & ~SOC_GPIO_VALID_GPIO_MASK)) {
+        ESP_LOGE(TAG, "Invalid pin mask 0x%llx", config->pin_select);
+        return NULL;
+    }
+
+    esp_err_t err = button_service_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Start button task failed: %s", esp_err_to_name(err));
+        return NULL;
+    }
+
+    group = calloc(1, sizeof(struct button_group) + count * sizeof(debounce_t));
+    if (group == NULL) {
+        return NULL;
+    }
+    group->queue = xQueueCreate(config->queue_size ? config->queue_size : CONFIG_ESP32_BUTTON_QUEUE_SIZE, sizeof(button_event_t));
+    if (group->queue == NULL) {
+        free(group);
         return NULL;
     }
+    group->pin_select = config->pin_select;
+    group->long_press_ms = config->long_press_ms;
+    group->long_press_repeat_ms = config->long_press_repeat_ms;
+    group->inverted = config->inverted;
+    group->count = count;
+    group->polling = true;
 
     // Configure the pins
     gpio_config_t io_conf;
-    io_conf.intr_type = GPIO_INTR_POSEDGE;
+    io_conf.intr_type = GPIO_INTR_ANYEDGE;
     io_conf.mode = GPIO_MODE_INPUT;
-    io_conf.pull_up_en = 1;
-    io_conf.pull_down_en = 0;
-    io_conf.pin_bit_mask = pin_select;
+    io_conf.pull_up_en = (config->pull_mode == GPIO_PULLUP_ONLY || config->pull_mode == GPIO_PULLUP_PULLDOWN);
+    io_conf.pull_down_en = (config->pull_mode == GPIO_PULLDOWN_ONLY || config->pull_mode == GPIO_PULLUP_PULLDOWN);
+    io_conf.pin_bit_mask = config->pin_select;
     gpio_config(&io_conf);
 
-    // Scan the pin map to determine number of pins
-    pin_count = 0;
-    for (int pin=0; pin<=39; pin++) {
-        if ((1ULL<<pin) & pin_select) {
-            pin_count++;
-        }
+    // One step per selected pin, lowest first
+    int idx = 0;
+    for (mask = config->pin_select; mask; mask &= mask - 1) {
+        int pin = __builtin_ctzll(mask);
+
+        ESP_LOGI(TAG, "Registering button input: %d", pin);
+        group->debounce[idx].pin = pin;
+        group->debounce[idx].history = group->inverted ? 0xffff : 0x0000;
+        gpio_intr_disable(pin);
+        gpio_isr_handler_add(pin, button_isr, group);
+        idx++;
     }
 
-    // Initialize global state and queue
-    debounce = calloc(pin_count, sizeof(debounce_t));
-    queue = xQueueCreate(CONFIG_ESP32_BUTTON_QUEUE_SIZE, sizeof(button_event_t));
-
-    // Scan the pin map to determine each pin number, populate the state
-    uint32_t idx = 0;
-    for (int pin=0; pin<=39; pin++) {
-        if ((1ULL<<pin) & pin_select) {
-            ESP_LOGI(TAG, "Registering button input: %d", pin);
-            debounce[idx].pin = pin;
-            debounce[idx].down_time = 0;
-            debounce[idx].inverted = true;
-            if (debounce[idx].inverted) debounce[idx].history = 0xffff;
-            idx++;
+    xSemaphoreTake(groups_lock, portMAX_DELAY);
+    group->next = groups;
+    groups = group;
+    xSemaphoreGive(groups_lock);
+    xTaskNotifyGive(button_task_handle);
+
+    return group;
+}
+
+QueueHandle_t button_get_queue(button_group_handle_t group)
+{
+    return group->queue;
+}
+
+uint32_t button_get_dropped(button_group_handle_t group)
+{
+    return group->dropped;
+}
+
+void button_delete(button_group_handle_t group)
+{
+    xSemaphoreTake(groups_lock, portMAX_DELAY);
+    for (button_group_handle_t *prev = &groups; *prev; prev = &(*prev)->next) {
+        if (*prev == group) {
+            *prev = group->next;
+            break;
         }
     }
+    xSemaphoreGive(groups_lock);
 
-    // Spawn a task to monitor the pins
-    xTaskCreate(&button_task, "button_task", CONFIG_ESP32_BUTTON_TASK_STACK_SIZE, NULL, 10, NULL);
+    for (int idx=0; idx<group->count; idx++) {
+        gpio_isr_handler_remove(group->debounce[idx].pin);
+        gpio_reset_pin(group->debounce[idx].pin);
+    }
+    vQueueDelete(group->queue);
+    free(group);
+}
 
-    return queue;
-}
\ No newline at end of file
+QueueHandle_t button_init(unsigned long long pin_select) {
+    return pulled_button_init(pin_select, GPIO_PULLUP_ONLY);
+}
+
+
+QueueHandle_t pulled_button_init(unsigned long long pin_select, gpio_pull_mode_t pull_mode)
+{
+    button_config_t config = {
+        .pin_select = pin_select,
+        .pull_mode = pull_mode,
+        .inverted = (pull_mode != GPIO_PULLDOWN_ONLY),
+        .long_press_ms = CONFIG_ESP32_BUTTON_LONG_PRESS_DURATION_MS,
+        .long_press_repeat_ms = CONFIG_ESP32_BUTTON_LONG_PRESS_REPEAT_MS,
+        .queue_size = CONFIG_ESP32_BUTTON_QUEUE_SIZE,
+    };
+    button_group_handle_t group = button_create(&config);
+
+    return group ? group->queue : NULL;
+}
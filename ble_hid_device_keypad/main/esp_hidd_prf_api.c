@@ -54,6 +54,9 @@ esp_err_t esp_hidd_profile_init(void)
     }
     // Reset the hid device target environment
     memset(&hidd_le_env, 0, sizeof(hidd_le_env_t));
+    if (hid_dev_queue_init() != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
     hidd_le_env.enabled = true;
     return ESP_OK;
 }
@@ -85,12 +88,15 @@ uint16_t esp_hidd_get_version(void)
 }
 
 void esp_hidd_send_consumer_value(uint16_t conn_id, uint8_t key_cmd, bool key_pressed)
+{
+    esp_hidd_send_consumer_values(conn_id, &key_cmd, key_pressed ? 1 : 0);
+}
+
+void esp_hidd_send_consumer_values(uint16_t conn_id, uint8_t *key_cmd, uint8_t num_key)
 {
     uint8_t buffer[HID_CC_IN_RPT_LEN] = {0, 0};
-    if (key_pressed) {
-        ESP_LOGD(HID_LE_PRF_TAG, "hid_consumer_build_report");
-        hid_consumer_build_report(buffer, key_cmd);
-    }
+
+    hid_consumer_build_report_n(buffer, key_cmd, num_key);
     ESP_LOGD(HID_LE_PRF_TAG, "buffer[0] = %x, buffer[1] = %x", buffer[0], buffer[1]);
     hid_dev_send_report(hidd_le_env.gatt_if, conn_id,
                         HID_RPT_ID_CC_IN, HID_REPORT_TYPE_INPUT, HID_CC_IN_RPT_LEN, buffer);
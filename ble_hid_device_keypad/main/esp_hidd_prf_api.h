@@ -52,6 +52,9 @@ typedef enum {
 #define RIGHT_GUI_KEY_MASK           (1 << 7)
 
 typedef uint8_t key_mask_t;
+
+/// conn_id sending a report to every connected host
+#define ESP_HIDD_CONN_ID_ALL         0xFFFF
 /**
  * @brief HIDD callback parameters union
  */
@@ -83,6 +86,7 @@ typedef union {
      * @brief ESP_HIDD_EVENT_DISCONNECT
 	 */
     struct hidd_disconnect_evt_param {
+        uint16_t conn_id;                           /*!< HID connection index */
         esp_bd_addr_t remote_bda;                   /*!< HID Remote bluetooth device address */
     } disconnect;									/*!< HID callback param of ESP_HIDD_EVENT_DISCONNECT */
 
@@ -148,6 +152,9 @@ uint16_t esp_hidd_get_version(void);
 
 void esp_hidd_send_consumer_value(uint16_t conn_id, uint8_t key_cmd, bool key_pressed);
 
+// Several consumer usages in one report, num_key 0 releases them all
+void esp_hidd_send_consumer_values(uint16_t conn_id, uint8_t *key_cmd, uint8_t num_key);
+
 void esp_hidd_send_keyboard_value(uint16_t conn_id, key_mask_t special_key_mask, uint8_t *keyboard_cmd, uint8_t num_key);
 
 void esp_hidd_send_mouse_value(uint16_t conn_id, uint8_t mouse_button, int8_t mickeys_x, int8_t mickeys_y);
@@ -10,120 +10,533 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+
+// Highest report ID of the service
+#define HID_DEV_RPT_ID_MAX      HID_RPT_ID_VENDOR_OUT
+#define HID_DEV_RPT_NONE        0xFF
+
+// CCCD state of a report, the host may never write it again once bonded
+#define HID_DEV_CCCD_UNKNOWN    0xFFFF
+#define HID_DEV_CCCD_NOTIFY     0x0001
+
+// Reports waiting while the link is congested, per connection
+#define HID_DEV_RPT_QUEUE_LEN   16
+// Largest queued report, the keyboard input report
+#define HID_DEV_RPT_DATA_MAX    8
+// Notifications handed to the stack and not yet completed
+#define HID_DEV_TX_WINDOW       4
+// Retry of a queue the stack refused with no notification in flight to drain it
+#define HID_DEV_RETRY_MS        10
+
+typedef struct {
+    uint16_t    handle;
+    uint8_t     id;
+    uint8_t     len;
+    uint8_t     data[HID_DEV_RPT_DATA_MAX];
+} hid_dev_rpt_entry_t;
+
+typedef struct {
+    hid_dev_rpt_entry_t entry[HID_DEV_RPT_QUEUE_LEN];
+    esp_gatt_if_t   gatts_if;
+    uint8_t         head;
+    uint8_t         count;
+    uint8_t         in_flight;
+    uint16_t        in_flight_handle[HID_DEV_TX_WINDOW];    // Oldest first
+    bool            sending;    // Reports picked by a task, not yet handed to the stack
+    bool            redrain;    // Drain skipped meanwhile, done by that task after sending
+    hid_dev_queue_stats_t stats;
+} hid_dev_rpt_queue_t;
+
+// A report picked with the lock held, sent once it is released: the stack posts
+// to the BTC task, whose completions and congestion events take the lock
+typedef struct {
+    uint16_t        conn_id;
+    esp_gatt_if_t   gatts_if;
+    uint16_t        handle;
+    uint8_t         id;
+    uint8_t         len;
+    bool            refused;    // By the stack
+    bool            held;       // Not sent, after a refused one of the same connection
+    uint8_t         *ext;       // Unqueued report of the caller, or NULL for data
+    uint8_t         data[HID_DEV_RPT_DATA_MAX];
+} hid_dev_tx_t;
+
+typedef struct {
+    hid_dev_tx_t    tx[HID_MAX_APPS * HID_DEV_TX_WINDOW];
+    uint8_t         len;
+} hid_dev_tx_batch_t;
 
 static hid_report_map_t *hid_dev_rpt_tbl;
 static uint8_t hid_dev_rpt_tbl_Len;
 
-static hid_report_map_t *hid_dev_rpt_by_id(uint8_t id, uint8_t type)
-{
-    hid_report_map_t *rpt = hid_dev_rpt_tbl;
+// One queue per connection link, same index as hidd_le_env.hidd_clcb
+static hid_dev_rpt_queue_t hid_dev_rpt_queue[HID_MAX_APPS];
+static SemaphoreHandle_t hid_dev_queue_lock;
+static esp_timer_handle_t hid_dev_retry_timer;
 
-    for (uint8_t i = hid_dev_rpt_tbl_Len; i > 0; i--, rpt++) {
-        if (rpt->id == id && rpt->type == type && rpt->mode == hidProtocolMode) {
-            return rpt;
-        }
+// Position in hid_dev_rpt_tbl by protocol mode, report type and report ID
+static uint8_t hid_dev_rpt_idx[HID_PROTOCOL_MODE_REPORT + 1][HID_REPORT_TYPE_FEATURE][HID_DEV_RPT_ID_MAX + 1];
+
+// Returns the position of the report in hid_dev_rpt_tbl, HID_DEV_RPT_NONE if there is none
+static uint8_t hid_dev_rpt_by_id(uint8_t mode, uint8_t id, uint8_t type)
+{
+    if (mode > HID_PROTOCOL_MODE_REPORT || type < HID_REPORT_TYPE_INPUT ||
+        type > HID_REPORT_TYPE_FEATURE || id > HID_DEV_RPT_ID_MAX) {
+        return HID_DEV_RPT_NONE;
     }
 
-    return NULL;
+    return hid_dev_rpt_idx[mode][type - 1][id];
 }
 
 void hid_dev_register_reports(uint8_t num_reports, hid_report_map_t *p_report)
 {
+    hid_report_map_t *rpt = p_report;
+
+    if (num_reports > HID_NUM_REPORTS) {
+        ESP_LOGE(HID_LE_PRF_TAG, "%s(), too many reports %d", __func__, num_reports);
+        num_reports = HID_NUM_REPORTS;
+    }
+
     hid_dev_rpt_tbl = p_report;
     hid_dev_rpt_tbl_Len = num_reports;
+
+    memset(hid_dev_rpt_idx, HID_DEV_RPT_NONE, sizeof(hid_dev_rpt_idx));
+    for (uint8_t i = 0; i < num_reports; i++, rpt++) {
+        if (rpt->handle == 0 || rpt->mode > HID_PROTOCOL_MODE_REPORT || rpt->type < HID_REPORT_TYPE_INPUT ||
+            rpt->type > HID_REPORT_TYPE_FEATURE || rpt->id > HID_DEV_RPT_ID_MAX) {
+            continue;
+        }
+        // The first report of a key wins, as with the former linear search
+        if (hid_dev_rpt_idx[rpt->mode][rpt->type - 1][rpt->id] == HID_DEV_RPT_NONE) {
+            hid_dev_rpt_idx[rpt->mode][rpt->type - 1][rpt->id] = i;
+        }
+    }
     return;
 }
 
+bool hid_dev_write_cccd(uint16_t conn_id, uint16_t handle, uint16_t len, const uint8_t *value)
+{
+    hid_report_map_t *rpt = hid_dev_rpt_tbl;
+    hidd_clcb_t *clcb;
+
+    if (handle == 0 || len != sizeof(uint16_t)) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < hid_dev_rpt_tbl_Len; i++, rpt++) {
+        if (rpt->cccdHandle == handle) {
+            if ((clcb = hidd_clcb_find(conn_id)) != NULL) {
+                clcb->cccd[i] = value[0] | (value[1] << 8);
+                ESP_LOGD(HID_LE_PRF_TAG, "%s(), conn %d report %d cccd = 0x%04x", __func__, conn_id, rpt->id, clcb->cccd[i]);
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static hid_dev_rpt_queue_t *hid_dev_queue_get(uint16_t conn_id, hidd_clcb_t **clcb)
+{
+    if ((*clcb = hidd_clcb_find(conn_id)) == NULL) {
+        return NULL;
+    }
+    return &hid_dev_rpt_queue[*clcb - hidd_le_env.hidd_clcb];
+}
+
+static hid_dev_rpt_queue_t *hid_dev_queue_of(hidd_clcb_t *clcb)
+{
+    return &hid_dev_rpt_queue[clcb - hidd_le_env.hidd_clcb];
+}
+
+// Takes a window slot for a report the caller sends after releasing the lock
+static hid_dev_tx_t *hid_dev_tx_push(hid_dev_rpt_queue_t *q, hidd_clcb_t *clcb, hid_dev_tx_batch_t *batch,
+                                     uint16_t handle, uint8_t id, uint8_t len)
+{
+    hid_dev_tx_t *tx = &batch->tx[batch->len++];
+
+    q->in_flight_handle[q->in_flight++] = handle;
+    q->stats.sent++;
+    q->sending = true;
+
+    tx->conn_id = clcb->conn_id;
+    tx->gatts_if = q->gatts_if;
+    tx->handle = handle;
+    tx->id = id;
+    tx->len = len;
+    tx->refused = false;
+    tx->held = false;
+    tx->ext = NULL;
+    return tx;
+}
+
+// Picks the queued reports the link accepts, called with the lock held
+static void hid_dev_queue_drain(hid_dev_rpt_queue_t *q, hidd_clcb_t *clcb, hid_dev_tx_batch_t *batch)
+{
+    if (q->sending) {
+        // another task has not sent its reports yet, these would overtake them
+        q->redrain = true;
+        return;
+    }
+    while (q->count && !clcb->congest && q->in_flight < HID_DEV_TX_WINDOW) {
+        hid_dev_rpt_entry_t *e = &q->entry[q->head];
+        hid_dev_tx_t *tx = hid_dev_tx_push(q, clcb, batch, e->handle, e->id, e->len);
+
+        memcpy(tx->data, e->data, e->len);
+        q->head = (q->head + 1) % HID_DEV_RPT_QUEUE_LEN;
+        q->count--;
+    }
+}
+
+// Gives back the window slot of a refused report, and its queue slot if it was queued
+static void hid_dev_tx_refused(hid_dev_rpt_queue_t *q, hid_dev_tx_t *tx)
+{
+    hid_dev_rpt_entry_t *e;
+    int i;
+
+    // the latest one with this handle, those after it were picked later
+    for (i = q->in_flight - 1; i >= 0 && q->in_flight_handle[i] != tx->handle; i--) {
+    }
+    if (i < 0) {
+        return;
+    }
+    q->in_flight--;
+    memmove(&q->in_flight_handle[i], &q->in_flight_handle[i + 1], (q->in_flight - i) * sizeof(uint16_t));
+    q->stats.sent--;
+
+    if (tx->ext || q->count == HID_DEV_RPT_QUEUE_LEN) {
+        q->stats.dropped++;
+        ESP_LOGW(HID_LE_PRF_TAG, "%s(), conn %d report %d dropped, %d queued", __func__, tx->conn_id, tx->id, q->count);
+        return;
+    }
+    q->head = (q->head + HID_DEV_RPT_QUEUE_LEN - 1) % HID_DEV_RPT_QUEUE_LEN;
+    q->count++;
+    e = &q->entry[q->head];
+    e->handle = tx->handle;
+    e->id = tx->id;
+    e->len = tx->len;
+    memcpy(e->data, tx->data, tx->len);
+}
+
+// Whether the stack refused a report of the connection in the batch
+static bool hid_dev_tx_any_refused(const hid_dev_tx_batch_t *batch, uint16_t conn_id)
+{
+    for (uint8_t i = 0; i < batch->len; i++) {
+        if (batch->tx[i].conn_id == conn_id && batch->tx[i].refused) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Sends the reports picked under the lock, called with the lock released. A report
+// the stack refuses goes back to the head of its queue with the ones picked after it.
+static void hid_dev_tx_flush(hid_dev_tx_batch_t *batch)
+{
+    hidd_clcb_t *redrain[HID_MAX_APPS];
+    hid_dev_rpt_queue_t *q;
+    hidd_clcb_t *clcb;
+    uint8_t i, j, n;
+
+    while (batch->len) {
+        for (i = 0; i < batch->len; i++) {
+            hid_dev_tx_t *tx = &batch->tx[i];
+
+            if (hid_dev_tx_any_refused(batch, tx->conn_id)) {
+                tx->held = true;
+            } else if (esp_ble_gatts_send_indicate(tx->gatts_if, tx->conn_id, tx->handle, tx->len,
+                                                   tx->ext ? tx->ext : tx->data, false) != ESP_OK) {
+                tx->refused = true;
+            }
+        }
+
+        xSemaphoreTake(hid_dev_queue_lock, portMAX_DELAY);
+        // newest first, so the refused ones are queued again in their order
+        for (int k = batch->len - 1; k >= 0; k--) {
+            hid_dev_tx_t *tx = &batch->tx[k];
+
+            // unless the connection was reset meanwhile
+            if ((tx->refused || tx->held) &&
+                (q = hid_dev_queue_get(tx->conn_id, &clcb)) != NULL && q->sending) {
+                q->stats.refused += tx->refused;
+                hid_dev_tx_refused(q, tx);
+            }
+        }
+        // then once per connection, the queues are left to other tasks again
+        for (i = 0, n = 0; i < batch->len; i++) {
+            for (j = 0; j < i && batch->tx[j].conn_id != batch->tx[i].conn_id; j++) {
+            }
+            if (j < i || (q = hid_dev_queue_get(batch->tx[i].conn_id, &clcb)) == NULL || !q->sending) {
+                continue;
+            }
+            q->sending = false;
+            if (hid_dev_tx_any_refused(batch, clcb->conn_id)) {
+                // no completion or end of congestion will come to drain the queue again
+                if (q->in_flight == 0 && hid_dev_retry_timer) {
+                    esp_timer_start_once(hid_dev_retry_timer, HID_DEV_RETRY_MS * 1000);
+                }
+                q->redrain = false;
+            } else if (q->redrain) {
+                q->redrain = false;
+                redrain[n++] = clcb;
+            }
+        }
+        batch->len = 0;
+        for (i = 0; i < n; i++) {
+            hid_dev_queue_drain(hid_dev_queue_of(redrain[i]), redrain[i], batch);
+        }
+        xSemaphoreGive(hid_dev_queue_lock);
+    }
+}
+
+// Sums the motion of a mouse report into the last queued one if the buttons are the same
+static bool hid_dev_queue_merge(hid_dev_rpt_queue_t *q, uint16_t handle, uint8_t id, uint8_t length, uint8_t *data)
+{
+    hid_dev_rpt_entry_t *tail;
+
+    if (id != HID_RPT_ID_MOUSE_IN || q->count == 0) {
+        return false;
+    }
+
+    tail = &q->entry[(q->head + q->count - 1) % HID_DEV_RPT_QUEUE_LEN];
+    if (tail->handle != handle || tail->len != length || tail->data[0] != data[0]) {
+        return false;
+    }
+
+    // Button state in byte 0, then signed deltas
+    for (uint8_t i = 1; i < length; i++) {
+        int sum = (int8_t)tail->data[i] + (int8_t)data[i];
+        if (sum < INT8_MIN || sum > INT8_MAX) {
+            return false;
+        }
+    }
+    for (uint8_t i = 1; i < length; i++) {
+        tail->data[i] = (int8_t)tail->data[i] + (int8_t)data[i];
+    }
+    q->stats.merged++;
+    return true;
+}
+
+// Queues a report for one host, called with the lock held
+static void hid_dev_send_to(hidd_clcb_t *clcb, esp_gatt_if_t gatts_if, hid_dev_tx_batch_t *batch,
+                            uint8_t id, uint8_t type, uint8_t length, uint8_t *data)
+{
+    hid_dev_rpt_queue_t *q = hid_dev_queue_of(clcb);
+    hid_report_map_t *p_rpt;
+    uint8_t i;
+
+    // get att handle for report in the protocol mode of the host
+    if ((i = hid_dev_rpt_by_id(clcb->proto_mode, id, type)) == HID_DEV_RPT_NONE) {
+        return;
+    }
+    p_rpt = &hid_dev_rpt_tbl[i];
+    // drop the report if the host disabled notifications
+    if (p_rpt->cccdHandle && clcb->cccd[i] != HID_DEV_CCCD_UNKNOWN && !(clcb->cccd[i] & HID_DEV_CCCD_NOTIFY)) {
+        return;
+    }
+
+    q->gatts_if = gatts_if;
+    if (hid_dev_queue_merge(q, p_rpt->handle, id, length, data)) {
+        // motion summed into a report still waiting
+    } else if (length > HID_DEV_RPT_DATA_MAX || q->count == HID_DEV_RPT_QUEUE_LEN) {
+        if (q->count == 0 && !clcb->congest && !q->sending && q->in_flight < HID_DEV_TX_WINDOW) {
+            // the caller's buffer, sent before hid_dev_send_report() returns
+            hid_dev_tx_push(q, clcb, batch, p_rpt->handle, id, length)->ext = data;
+            return;
+        } else {
+            q->stats.dropped++;
+            ESP_LOGW(HID_LE_PRF_TAG, "%s(), conn %d report %d dropped, %d queued", __func__, clcb->conn_id, id, q->count);
+        }
+    } else {
+        hid_dev_rpt_entry_t *e = &q->entry[(q->head + q->count) % HID_DEV_RPT_QUEUE_LEN];
+
+        ESP_LOGD(HID_LE_PRF_TAG, "%s(), queue the report, handle = %d", __func__, p_rpt->handle);
+        e->handle = p_rpt->handle;
+        e->id = id;
+        e->len = length;
+        memcpy(e->data, data, length);
+        q->count++;
+        q->stats.queued++;
+        if (q->count > q->stats.high_water) {
+            q->stats.high_water = q->count;
+        }
+    }
+    hid_dev_queue_drain(q, clcb, batch);
+}
+
 void hid_dev_send_report(esp_gatt_if_t gatts_if, uint16_t conn_id,
                                     uint8_t id, uint8_t type, uint8_t length, uint8_t *data)
 {
-    hid_report_map_t *p_rpt;
+    hid_dev_tx_batch_t batch;
+    hidd_clcb_t *clcb;
 
-    // get att handle for report
-    if ((p_rpt = hid_dev_rpt_by_id(id, type)) != NULL) {
-        // if notifications are enabled
-        ESP_LOGD(HID_LE_PRF_TAG, "%s(), send the report, handle = %d", __func__, p_rpt->handle);
-        esp_ble_gatts_send_indicate(gatts_if, conn_id, p_rpt->handle, length, data, false);
+    batch.len = 0;
+    xSemaphoreTake(hid_dev_queue_lock, portMAX_DELAY);
+    if (conn_id == ESP_HIDD_CONN_ID_ALL) {
+        // the same report to every host, each in its own protocol mode
+        for (clcb = hidd_le_env.hidd_clcb; clcb < &hidd_le_env.hidd_clcb[HID_MAX_APPS]; clcb++) {
+            if (clcb->in_use) {
+                hid_dev_send_to(clcb, gatts_if, &batch, id, type, length, data);
+            }
+        }
+    } else if ((clcb = hidd_clcb_find(conn_id)) != NULL) {
+        hid_dev_send_to(clcb, gatts_if, &batch, id, type, length, data);
+    } else {
+        ESP_LOGD(HID_LE_PRF_TAG, "%s(), no connection %d", __func__, conn_id);
     }
+    xSemaphoreGive(hid_dev_queue_lock);
+    hid_dev_tx_flush(&batch);
 
     return;
 }
 
-void hid_consumer_build_report(uint8_t *buffer, consumer_cmd_t cmd)
+static void hid_dev_retry(void *arg)
 {
-    if (!buffer) {
-        ESP_LOGE(HID_LE_PRF_TAG, "%s(), the buffer is NULL, hid build report failed.", __func__);
-        return;
+    hid_dev_tx_batch_t batch;
+    hidd_clcb_t *clcb;
+
+    batch.len = 0;
+    xSemaphoreTake(hid_dev_queue_lock, portMAX_DELAY);
+    for (clcb = hidd_le_env.hidd_clcb; clcb < &hidd_le_env.hidd_clcb[HID_MAX_APPS]; clcb++) {
+        if (clcb->in_use) {
+            hid_dev_queue_drain(hid_dev_queue_of(clcb), clcb, &batch);
+        }
     }
+    xSemaphoreGive(hid_dev_queue_lock);
+    hid_dev_tx_flush(&batch);
+}
 
-    switch (cmd) {
-        case HID_CONSUMER_CHANNEL_UP:
-            HID_CC_RPT_SET_CHANNEL(buffer, HID_CC_RPT_CHANNEL_UP);
-            break;
+esp_err_t hid_dev_queue_init(void)
+{
+    const esp_timer_create_args_t retry_args = {
+        .callback = hid_dev_retry,
+        .name = "hid_dev_retry",
+    };
 
-        case HID_CONSUMER_CHANNEL_DOWN:
-            HID_CC_RPT_SET_CHANNEL(buffer, HID_CC_RPT_CHANNEL_DOWN);
-            break;
+    if (hid_dev_queue_lock == NULL) {
+        hid_dev_queue_lock = xSemaphoreCreateMutex();
+        if (hid_dev_queue_lock == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (hid_dev_retry_timer == NULL && esp_timer_create(&retry_args, &hid_dev_retry_timer) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    memset(hid_dev_rpt_queue, 0, sizeof(hid_dev_rpt_queue));
+    return ESP_OK;
+}
 
-        case HID_CONSUMER_VOLUME_UP:
-            HID_CC_RPT_SET_VOLUME_UP(buffer);
-            break;
+void hid_dev_conn_reset(uint16_t conn_id)
+{
+    hid_dev_rpt_queue_t *q;
+    hidd_clcb_t *clcb;
 
-        case HID_CONSUMER_VOLUME_DOWN:
-            HID_CC_RPT_SET_VOLUME_DOWN(buffer);
-            break;
+    xSemaphoreTake(hid_dev_queue_lock, portMAX_DELAY);
+    if ((q = hid_dev_queue_get(conn_id, &clcb)) != NULL) {
+        memset(q, 0, sizeof(hid_dev_rpt_queue_t));
+        for (uint8_t i = 0; i < HID_NUM_REPORTS; i++) {
+            clcb->cccd[i] = HID_DEV_CCCD_UNKNOWN;
+        }
+    }
+    xSemaphoreGive(hid_dev_queue_lock);
+}
 
-        case HID_CONSUMER_MUTE:
-            HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_MUTE);
-            break;
+void hid_dev_send_done(uint16_t conn_id, uint16_t handle, esp_gatt_status_t status)
+{
+    hid_dev_tx_batch_t batch;
+    hid_dev_rpt_queue_t *q;
+    hidd_clcb_t *clcb;
+    uint8_t i;
 
-        case HID_CONSUMER_POWER:
-            HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_POWER);
-            break;
+    batch.len = 0;
+    xSemaphoreTake(hid_dev_queue_lock, portMAX_DELAY);
+    if ((q = hid_dev_queue_get(conn_id, &clcb)) != NULL) {
+        // not a report of ours, e.g. the battery level
+        for (i = 0; i < q->in_flight && q->in_flight_handle[i] != handle; i++) {
+        }
+        if (i == q->in_flight) {
+            xSemaphoreGive(hid_dev_queue_lock);
+            return;
+        }
+        q->in_flight--;
+        memmove(&q->in_flight_handle[i], &q->in_flight_handle[i + 1], (q->in_flight - i) * sizeof(uint16_t));
+        if (status != ESP_GATT_OK) {
+            ESP_LOGD(HID_LE_PRF_TAG, "%s(), status 0x%x", __func__, status);
+        }
+        hid_dev_queue_drain(q, clcb, &batch);
+    }
+    xSemaphoreGive(hid_dev_queue_lock);
+    hid_dev_tx_flush(&batch);
+}
 
-        case HID_CONSUMER_RECALL_LAST:
-            HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_LAST);
-            break;
+void hid_dev_set_congest(uint16_t conn_id, bool congested)
+{
+    hid_dev_tx_batch_t batch;
+    hid_dev_rpt_queue_t *q;
+    hidd_clcb_t *clcb;
 
-        case HID_CONSUMER_ASSIGN_SEL:
-            HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_ASSIGN_SEL);
-            break;
+    batch.len = 0;
+    xSemaphoreTake(hid_dev_queue_lock, portMAX_DELAY);
+    if ((q = hid_dev_queue_get(conn_id, &clcb)) != NULL) {
+        clcb->congest = congested;
+        if (congested) {
+            q->stats.congested++;
+        } else {
+            hid_dev_queue_drain(q, clcb, &batch);
+        }
+    }
+    xSemaphoreGive(hid_dev_queue_lock);
+    hid_dev_tx_flush(&batch);
+}
 
-        case HID_CONSUMER_PLAY:
-            HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_PLAY);
-            break;
+bool hid_dev_get_queue_stats(uint16_t conn_id, hid_dev_queue_stats_t *stats)
+{
+    hid_dev_rpt_queue_t *q;
+    hidd_clcb_t *clcb;
 
-        case HID_CONSUMER_PAUSE:
-            HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_PAUSE);
-            break;
+    xSemaphoreTake(hid_dev_queue_lock, portMAX_DELAY);
+    if ((q = hid_dev_queue_get(conn_id, &clcb)) != NULL) {
+        *stats = q->stats;
+    }
+    xSemaphoreGive(hid_dev_queue_lock);
 
-        case HID_CONSUMER_RECORD:
-            HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_RECORD);
-            break;
+    return q != NULL;
+}
 
-        case HID_CONSUMER_FAST_FORWARD:
-            HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_FAST_FWD);
-            break;
+// One entry per consumer usage, set is 0 for a usage the report does not carry
+typedef struct {
+    uint8_t     byte;
+    uint8_t     keep;
+    uint8_t     set;
+} hid_cc_usage_t;
 
-        case HID_CONSUMER_REWIND:
-            HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_REWIND);
-            break;
+#define HID_CC_USAGE_ENTRY(usage, rpt_byte, rpt_keep, rpt_set) \
+    [usage] = { .byte = (rpt_byte), .keep = (rpt_keep), .set = (rpt_set) },
 
-        case HID_CONSUMER_SCAN_NEXT_TRK:
-            HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_SCAN_NEXT_TRK);
-            break;
+static const hid_cc_usage_t hid_cc_usage[1 << (8 * sizeof(consumer_cmd_t))] = {
+    HID_CC_RPT_USAGES(HID_CC_USAGE_ENTRY)
+};
 
-        case HID_CONSUMER_SCAN_PREV_TRK:
-            HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_SCAN_PREV_TRK);
-            break;
+void hid_consumer_build_report_n(uint8_t *buffer, const consumer_cmd_t *cmds, uint8_t num_cmd)
+{
+    if (!buffer) {
+        ESP_LOGE(HID_LE_PRF_TAG, "%s(), the buffer is NULL, hid build report failed.", __func__);
+        return;
+    }
 
-        case HID_CONSUMER_STOP:
-            HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_STOP);
-            break;
+    for (int i = 0; i < num_cmd; i++) {
+        const hid_cc_usage_t *usage = &hid_cc_usage[cmds[i]];
 
-        default:
-            break;
+        if (usage->set) {
+            buffer[usage->byte] = (buffer[usage->byte] & usage->keep) | usage->set;
+        }
     }
+}
 
-    return;
+void hid_consumer_build_report(uint8_t *buffer, consumer_cmd_t cmd)
+{
+    hid_consumer_build_report_n(buffer, &cmd, 1);
 }
@@ -215,6 +215,26 @@ typedef uint8_t consumer_cmd_t;
 #define HID_CC_RPT_SET_SELECTION(s, x)  (s)[1] &= HID_CC_RPT_SELECTION_BITS; \
                                         (s)[1] |= ((x) & 0x03) << 4
 
+// Consumer usages carried by the report: X(usage, report byte, bits kept, bits set).
+// A new media key is one more line here, usages in different fields share a report.
+#define HID_CC_RPT_USAGES(X)                                                                        \
+    X(HID_CONSUMER_CHANNEL_UP,     0, HID_CC_RPT_CHANNEL_BITS, (HID_CC_RPT_CHANNEL_UP & 0x03) << 4)   \
+    X(HID_CONSUMER_CHANNEL_DOWN,   0, HID_CC_RPT_CHANNEL_BITS, (HID_CC_RPT_CHANNEL_DOWN & 0x03) << 4) \
+    X(HID_CONSUMER_VOLUME_UP,      0, HID_CC_RPT_VOLUME_BITS,  HID_CC_RPT_VOLUME_UP)                  \
+    X(HID_CONSUMER_VOLUME_DOWN,    0, HID_CC_RPT_VOLUME_BITS,  HID_CC_RPT_VOLUME_DOWN)                \
+    X(HID_CONSUMER_MUTE,           1, HID_CC_RPT_BUTTON_BITS,  HID_CC_RPT_MUTE)                       \
+    X(HID_CONSUMER_POWER,          1, HID_CC_RPT_BUTTON_BITS,  HID_CC_RPT_POWER)                      \
+    X(HID_CONSUMER_RECALL_LAST,    1, HID_CC_RPT_BUTTON_BITS,  HID_CC_RPT_LAST)                       \
+    X(HID_CONSUMER_ASSIGN_SEL,     1, HID_CC_RPT_BUTTON_BITS,  HID_CC_RPT_ASSIGN_SEL)                 \
+    X(HID_CONSUMER_PLAY,           1, HID_CC_RPT_BUTTON_BITS,  HID_CC_RPT_PLAY)                       \
+    X(HID_CONSUMER_PAUSE,          1, HID_CC_RPT_BUTTON_BITS,  HID_CC_RPT_PAUSE)                      \
+    X(HID_CONSUMER_RECORD,         1, HID_CC_RPT_BUTTON_BITS,  HID_CC_RPT_RECORD)                     \
+    X(HID_CONSUMER_FAST_FORWARD,   1, HID_CC_RPT_BUTTON_BITS,  HID_CC_RPT_FAST_FWD)                   \
+    X(HID_CONSUMER_REWIND,         1, HID_CC_RPT_BUTTON_BITS,  HID_CC_RPT_REWIND)                     \
+    X(HID_CONSUMER_SCAN_NEXT_TRK,  1, HID_CC_RPT_BUTTON_BITS,  HID_CC_RPT_SCAN_NEXT_TRK)              \
+    X(HID_CONSUMER_SCAN_PREV_TRK,  1, HID_CC_RPT_BUTTON_BITS,  HID_CC_RPT_SCAN_PREV_TRK)              \
+    X(HID_CONSUMER_STOP,           1, HID_CC_RPT_BUTTON_BITS,  HID_CC_RPT_STOP)
+
 
 // HID report mapping table
 typedef struct
@@ -236,11 +256,44 @@ typedef struct
 
 void hid_dev_register_reports(uint8_t num_reports, hid_report_map_t *p_report);
 
+// Records a write to a report CCCD by a host, returns false if the handle is not one
+bool hid_dev_write_cccd(uint16_t conn_id, uint16_t handle, uint16_t len, const uint8_t *value);
+
+// HID report queue counters of a connection
+typedef struct
+{
+  uint32_t    sent;             // Handed to the stack
+  uint32_t    queued;           // Waited for the link
+  uint32_t    merged;           // Mouse motion summed into a queued report
+  uint32_t    dropped;          // Queue full
+  uint32_t    refused;          // Not taken by the stack, sent again later
+  uint32_t    congested;        // Times the link became congested
+  uint8_t     high_water;       // Most reports queued at once
+} hid_dev_queue_stats_t;
+
+// Reports are queued per connection while the link is congested, mouse motion is merged.
+// ESP_HIDD_CONN_ID_ALL sends the report to every connected host.
 void hid_dev_send_report(esp_gatt_if_t gatts_if, uint16_t conn_id,
                                     uint8_t id, uint8_t type, uint8_t length, uint8_t *data);
 
+esp_err_t hid_dev_queue_init(void);
+
+// Drops the reports queued for a connection and forgets its CCCD state, on connect and disconnect
+void hid_dev_conn_reset(uint16_t conn_id);
+
+// On ESP_GATTS_CONF_EVT, a notification left the stack
+void hid_dev_send_done(uint16_t conn_id, uint16_t handle, esp_gatt_status_t status);
+
+// On ESP_GATTS_CONGEST_EVT
+void hid_dev_set_congest(uint16_t conn_id, bool congested);
+
+bool hid_dev_get_queue_stats(uint16_t conn_id, hid_dev_queue_stats_t *stats);
+
 void hid_consumer_build_report(uint8_t *buffer, consumer_cmd_t cmd);
 
+// Sets every usage in the report, a later usage of the same field replaces an earlier one
+void hid_consumer_build_report_n(uint8_t *buffer, const consumer_cmd_t *cmds, uint8_t num_cmd);
+
 void hid_keyboard_build_report(uint8_t *buffer, keyboard_cmd_t cmd);
 
 void hid_mouse_build_report(uint8_t *buffer, mouse_cmd_t cmd);
@@ -540,7 +540,7 @@ void esp_hidd_prf_cb_hdl(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
         case ESP_GATTS_REG_EVT: {
             esp_ble_gap_config_local_icon (ESP_BLE_APPEARANCE_GENERIC_HID);
             esp_hidd_cb_param_t hidd_param;
-            hidd_param.init_finish.state = param->reg.status;
+            hidd_param.init_finish.state = (esp_hidd_init_state_t)param->reg.status;
             if(param->reg.app_id == HIDD_APP_ID) {
                 hidd_le_env.gatt_if = gatts_if;
                 if(hidd_le_env.hidd_cb != NULL) {
@@ -559,6 +559,11 @@ void esp_hidd_prf_cb_hdl(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
             break;
         }
         case ESP_GATTS_CONF_EVT: {
+            hid_dev_send_done(param->conf.conn_id, param->conf.handle, param->conf.status);
+            break;
+        }
+        case ESP_GATTS_CONGEST_EVT: {
+            hid_dev_set_congest(param->congest.conn_id, param->congest.congested);
             break;
         }
         case ESP_GATTS_CREATE_EVT:
@@ -569,6 +574,7 @@ void esp_hidd_prf_cb_hdl(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
 			memcpy(cb_param.connect.remote_bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
             cb_param.connect.conn_id = param->connect.conn_id;
             hidd_clcb_alloc(param->connect.conn_id, param->connect.remote_bda);
+            hid_dev_conn_reset(param->connect.conn_id);
             esp_ble_set_encryption(param->connect.remote_bda, ESP_BLE_SEC_ENCRYPT_NO_MITM);
             if(hidd_le_env.hidd_cb != NULL) {
                 (hidd_le_env.hidd_cb)(ESP_HIDD_EVENT_BLE_CONNECT, &cb_param);
@@ -576,15 +582,30 @@ void esp_hidd_prf_cb_hdl(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
             break;
         }
         case ESP_GATTS_DISCONNECT_EVT: {
+            esp_hidd_cb_param_t cb_param = {0};
+            memcpy(cb_param.disconnect.remote_bda, param->disconnect.remote_bda, sizeof(esp_bd_addr_t));
+            cb_param.disconnect.conn_id = param->disconnect.conn_id;
 			 if(hidd_le_env.hidd_cb != NULL) {
-                    (hidd_le_env.hidd_cb)(ESP_HIDD_EVENT_BLE_DISCONNECT, NULL);
+                    (hidd_le_env.hidd_cb)(ESP_HIDD_EVENT_BLE_DISCONNECT, &cb_param);
              }
+            hid_dev_conn_reset(param->disconnect.conn_id);
             hidd_clcb_dealloc(param->disconnect.conn_id);
             break;
         }
         case ESP_GATTS_CLOSE_EVT:
             break;
         case ESP_GATTS_WRITE_EVT: {
+            if (hid_dev_write_cccd(param->write.conn_id, param->write.handle, param->write.len, param->write.value)) {
+                break;
+            }
+            if (param->write.handle == hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_PROTO_MODE_VAL] &&
+                param->write.len == HID_PROTOCOL_MODE_LEN) {
+                hidd_clcb_t *p_clcb = hidd_clcb_find(param->write.conn_id);
+                if (p_clcb != NULL && param->write.value[0] <= HID_PROTOCOL_MODE_REPORT) {
+                    p_clcb->proto_mode = param->write.value[0];
+                }
+                break;
+            }
 #if (SUPPORT_REPORT_VENDOR == true)
             esp_hidd_cb_param_t cb_param = {0};
             if (param->write.handle == hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_VENDOR_OUT_VAL] &&
@@ -649,26 +670,53 @@ void hidd_clcb_alloc (uint16_t conn_id, esp_bd_addr_t bda)
     for (i_clcb = 0, p_clcb= hidd_le_env.hidd_clcb; i_clcb < HID_MAX_APPS; i_clcb++, p_clcb++) {
         if (!p_clcb->in_use) {
             p_clcb->in_use      = true;
+            p_clcb->congest     = false;
             p_clcb->conn_id     = conn_id;
             p_clcb->connected   = true;
+            p_clcb->proto_mode  = HID_PROTOCOL_MODE_REPORT;
             memcpy (p_clcb->remote_bda, bda, ESP_BD_ADDR_LEN);
-            break;
+            if (conn_id < HIDD_LE_CONN_ID_MAX) {
+                hidd_le_env.hidd_clcb_idx[conn_id] = i_clcb + 1;
+            }
+            return;
         }
     }
+    ESP_LOGE(HID_LE_PRF_TAG, "%s(), no free link for conn_id %d", __func__, conn_id);
     return;
 }
 
 bool hidd_clcb_dealloc (uint16_t conn_id)
+{
+    hidd_clcb_t      *p_clcb = hidd_clcb_find(conn_id);
+
+    if (p_clcb == NULL) {
+        return false;
+    }
+
+    if (conn_id < HIDD_LE_CONN_ID_MAX) {
+        hidd_le_env.hidd_clcb_idx[conn_id] = 0;
+    }
+    memset(p_clcb, 0, sizeof(hidd_clcb_t));
+    return true;
+}
+
+hidd_clcb_t *hidd_clcb_find (uint16_t conn_id)
 {
     uint8_t              i_clcb = 0;
     hidd_clcb_t      *p_clcb = NULL;
 
+    if (conn_id < HIDD_LE_CONN_ID_MAX) {
+        i_clcb = hidd_le_env.hidd_clcb_idx[conn_id];
+        return i_clcb ? &hidd_le_env.hidd_clcb[i_clcb - 1] : NULL;
+    }
+
     for (i_clcb = 0, p_clcb= hidd_le_env.hidd_clcb; i_clcb < HID_MAX_APPS; i_clcb++, p_clcb++) {
-            memset(p_clcb, 0, sizeof(hidd_clcb_t));
-            return true;
+        if (p_clcb->in_use && p_clcb->conn_id == conn_id) {
+            return p_clcb;
+        }
     }
 
-    return false;
+    return NULL;
 }
 
 static struct gatts_profile_inst heart_rate_profile_tab[PROFILE_NUM] = {
@@ -746,7 +794,7 @@ static void hid_add_id_tbl(void)
       hid_rpt_map[0].id = hidReportRefMouseIn[0];
       hid_rpt_map[0].type = hidReportRefMouseIn[1];
       hid_rpt_map[0].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_MOUSE_IN_VAL];
-      hid_rpt_map[0].cccdHandle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_MOUSE_IN_VAL];
+      hid_rpt_map[0].cccdHandle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_MOUSE_IN_CCC];
       hid_rpt_map[0].mode = HID_PROTOCOL_MODE_REPORT;
 
       // Key input report
@@ -775,7 +823,7 @@ static void hid_add_id_tbl(void)
       hid_rpt_map[4].id = hidReportRefKeyIn[0];
       hid_rpt_map[4].type = hidReportRefKeyIn[1];
       hid_rpt_map[4].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_BOOT_KB_IN_REPORT_VAL];
-      hid_rpt_map[4].cccdHandle = 0;
+      hid_rpt_map[4].cccdHandle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_BOOT_KB_IN_REPORT_NTF_CFG];
       hid_rpt_map[4].mode = HID_PROTOCOL_MODE_BOOT;
 
       // Boot keyboard output report
@@ -791,7 +839,7 @@ static void hid_add_id_tbl(void)
       hid_rpt_map[6].id = hidReportRefMouseIn[0];
       hid_rpt_map[6].type = hidReportRefMouseIn[1];
       hid_rpt_map[6].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_BOOT_MOUSE_IN_REPORT_VAL];
-      hid_rpt_map[6].cccdHandle = 0;
+      hid_rpt_map[6].cccdHandle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_BOOT_MOUSE_IN_REPORT_NTF_CFG];
       hid_rpt_map[6].mode = HID_PROTOCOL_MODE_BOOT;
 
       // Feature report
@@ -0,0 +1,222 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+
+#include "hid_kbd.h"
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_hidd_prf_api.h"
+#include "hid_dev.h"
+
+#define HID_KBD_TAG "HID_KBD"
+
+typedef struct {
+    uint8_t key;
+    bool    sent;       // Reported as down at least once
+    bool    released;   // Released before being reported, removed after the next report
+    bool    deferred;   // Pressed again before its release was reported, left out of the next report
+} hid_kbd_held_t;
+
+static struct {
+    hid_kbd_held_t held[HID_KBD_HELD_MAX];
+    uint8_t     count;
+    key_mask_t  mods;
+    key_mask_t  mods_unsent;    // Pressed since the last report
+    key_mask_t  mods_released;  // Released before being reported
+    bool        dirty;
+    uint32_t    dropped;
+    // Last report sent
+    key_mask_t  rpt_mods;
+    uint8_t     rpt_keys[HID_KBD_RPT_KEYS];
+    uint8_t     rpt_count;
+} hid_kbd;
+
+static portMUX_TYPE hid_kbd_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t hid_kbd_task_handle;
+static uint16_t hid_kbd_conn_id;
+static bool hid_kbd_connected;
+
+static bool hid_kbd_is_mod(uint8_t key)
+{
+    return key >= HID_KEY_LEFT_CTRL && key <= HID_KEY_RIGHT_GUI;
+}
+
+static int hid_kbd_find(uint8_t key)
+{
+    for (int i = 0; i < hid_kbd.count; i++) {
+        if (hid_kbd.held[i].key == key) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool hid_kbd_in_report(uint8_t key)
+{
+    return memchr(hid_kbd.rpt_keys, key, hid_kbd.rpt_count) != NULL;
+}
+
+static void hid_kbd_remove(int i)
+{
+    hid_kbd.count--;
+    memmove(&hid_kbd.held[i], &hid_kbd.held[i + 1], (hid_kbd.count - i) * sizeof(hid_kbd_held_t));
+}
+
+void hid_kbd_key(uint8_t key, bool pressed)
+{
+    int i;
+
+    if (key == HID_KEY_RESERVED) {
+        return;
+    }
+
+    portENTER_CRITICAL(&hid_kbd_lock);
+    if (hid_kbd_is_mod(key)) {
+        key_mask_t bit = 1 << (key - HID_KEY_LEFT_CTRL);
+
+        if (pressed) {
+            hid_kbd.mods |= bit;
+            hid_kbd.mods_unsent |= bit;
+            hid_kbd.mods_released &= ~bit;
+        } else if (hid_kbd.mods_unsent & bit) {
+            hid_kbd.mods_released |= bit;
+        } else {
+            hid_kbd.mods &= ~bit;
+        }
+    } else if ((i = hid_kbd_find(key)) >= 0) {
+        if (pressed) {
+            hid_kbd.held[i].released = false;
+        } else if (!hid_kbd.held[i].sent) {
+            hid_kbd.held[i].released = true;
+        } else {
+            hid_kbd_remove(i);
+        }
+    } else if (pressed) {
+        if (hid_kbd.count < HID_KBD_HELD_MAX) {
+            hid_kbd.held[hid_kbd.count].key = key;
+            hid_kbd.held[hid_kbd.count].sent = false;
+            hid_kbd.held[hid_kbd.count].released = false;
+            hid_kbd.held[hid_kbd.count].deferred = hid_kbd_in_report(key);
+            hid_kbd.count++;
+        } else {
+            hid_kbd.dropped++;
+        }
+    }
+    hid_kbd.dirty = true;
+    portEXIT_CRITICAL(&hid_kbd_lock);
+
+    if (hid_kbd_task_handle) {
+        xTaskNotifyGive(hid_kbd_task_handle);
+    }
+}
+
+// Builds the next report, returns false if it is the same as the last one sent
+static bool hid_kbd_take_report(key_mask_t *mods, uint8_t *keys, uint8_t *count)
+{
+    bool changed;
+    uint8_t n = 0;
+
+    portENTER_CRITICAL(&hid_kbd_lock);
+    if (!hid_kbd.dirty) {
+        portEXIT_CRITICAL(&hid_kbd_lock);
+        return false;
+    }
+    hid_kbd.dirty = false;
+
+    *mods = hid_kbd.mods;
+    for (int i = 0; i < hid_kbd.count; i++) {
+        if (!hid_kbd.held[i].deferred) {
+            if (n < HID_KBD_RPT_KEYS) {
+                keys[n] = hid_kbd.held[i].key;
+            }
+            n++;
+        }
+    }
+    if (n > HID_KBD_RPT_KEYS) {
+        memset(keys, HID_KBD_ROLLOVER, HID_KBD_RPT_KEYS);
+        n = HID_KBD_RPT_KEYS;
+    }
+    *count = n;
+
+    // Releases held back until their press was reported go in the next report,
+    // and presses held back until their release was reported
+    for (int i = hid_kbd.count - 1; i >= 0; i--) {
+        if (hid_kbd.held[i].deferred) {
+            hid_kbd.held[i].deferred = false;
+            hid_kbd.dirty = true;
+            continue;
+        }
+        hid_kbd.held[i].sent = true;
+        if (hid_kbd.held[i].released) {
+            hid_kbd_remove(i);
+            hid_kbd.dirty = true;
+        }
+    }
+    if (hid_kbd.mods_released) {
+        hid_kbd.mods &= ~hid_kbd.mods_released;
+        hid_kbd.dirty = true;
+    }
+    hid_kbd.mods_unsent = 0;
+    hid_kbd.mods_released = 0;
+
+    changed = *mods != hid_kbd.rpt_mods || *count != hid_kbd.rpt_count ||
+              memcmp(keys, hid_kbd.rpt_keys, *count) != 0;
+    hid_kbd.rpt_mods = *mods;
+    hid_kbd.rpt_count = *count;
+    memcpy(hid_kbd.rpt_keys, keys, *count);
+    portEXIT_CRITICAL(&hid_kbd_lock);
+
+    return changed;
+}
+
+static void hid_kbd_task(void *arg)
+{
+    key_mask_t mods;
+    uint8_t keys[HID_KBD_RPT_KEYS];
+    uint8_t count;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (hid_kbd.dirty) {
+            if (hid_kbd_take_report(&mods, keys, &count) && hid_kbd_connected) {
+                esp_hidd_send_keyboard_value(hid_kbd_conn_id, mods, keys, count);
+            }
+            vTaskDelay(pdMS_TO_TICKS(HID_KBD_REPORT_INTERVAL_MS));
+        }
+    }
+}
+
+esp_err_t hid_kbd_init(void)
+{
+    if (hid_kbd_task_handle) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xTaskCreate(hid_kbd_task, "hid_kbd", 2048, NULL, 5, &hid_kbd_task_handle) != pdPASS) {
+        ESP_LOGE(HID_KBD_TAG, "%s(), create task failed", __func__);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void hid_kbd_set_conn(uint16_t conn_id, bool connected)
+{
+    hid_kbd_conn_id = conn_id;
+    hid_kbd_connected = connected;
+
+    // A new host starts from no key pressed
+    portENTER_CRITICAL(&hid_kbd_lock);
+    hid_kbd.rpt_mods = 0;
+    hid_kbd.rpt_count = 0;
+    hid_kbd.dirty = true;
+    portEXIT_CRITICAL(&hid_kbd_lock);
+    if (connected && hid_kbd_task_handle) {
+        xTaskNotifyGive(hid_kbd_task_handle);
+    }
+}
+
+uint32_t hid_kbd_dropped(void)
+{
+    return hid_kbd.dropped;
+}
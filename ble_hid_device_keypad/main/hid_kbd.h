@@ -0,0 +1,43 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+
+#ifndef HID_KBD_H__
+#define HID_KBD_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Keys held at once, a report carries up to HID_KBD_RPT_KEYS of them
+#define HID_KBD_HELD_MAX            16
+#define HID_KBD_RPT_KEYS            6
+
+// Keyboard ErrorRollOver, reported in every slot while more keys are held
+#define HID_KBD_ROLLOVER            0x01
+
+// Changes within this time are merged into one report, about one connection event
+#ifndef HID_KBD_REPORT_INTERVAL_MS
+#define HID_KBD_REPORT_INTERVAL_MS  10
+#endif
+
+// Starts the task which sends the keyboard input report
+esp_err_t hid_kbd_init(void);
+
+void hid_kbd_set_conn(uint16_t conn_id, bool connected);
+
+// Never blocks, a key pressed then released before the next report is still reported once
+void hid_kbd_key(uint8_t key, bool pressed);
+
+// Keys ignored because HID_KBD_HELD_MAX were already held
+uint32_t hid_kbd_dropped(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* HID_KBD_H__ */
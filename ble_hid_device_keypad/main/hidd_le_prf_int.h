@@ -30,7 +30,14 @@
 #define HIDD_SUB_VER     0x00  //Version + Subversion
 #define HIDD_VERSION     ((HIDD_GREAT_VER<<8)|HIDD_SUB_VER)  //Version + Subversion
 
-#define HID_MAX_APPS                 1
+// Hosts connected at once, no more than CONFIG_BTDM_CTRL_BLE_MAX_CONN
+#ifndef HIDD_LE_MAX_CONN
+#define HIDD_LE_MAX_CONN             3
+#endif
+#define HID_MAX_APPS                 HIDD_LE_MAX_CONN
+
+// conn_id below this value find their link in one lookup
+#define HIDD_LE_CONN_ID_MAX          16
 
 // Number of HID reports defined in the service
 #define HID_NUM_REPORTS          9
@@ -252,6 +259,8 @@ typedef struct {
     esp_bd_addr_t         remote_bda;
     uint32_t                  trans_id;
     uint8_t                    cur_srvc_id;
+    uint8_t                    proto_mode;                     /* Protocol mode written by this host */
+    uint16_t                  cccd[HID_NUM_REPORTS];          /* CCCD of each report written by this host */
 
 } hidd_clcb_t;
 
@@ -306,6 +315,7 @@ typedef struct
 /* service engine control block */
 typedef struct {
     hidd_clcb_t                  hidd_clcb[HID_MAX_APPS];          /* connection link*/
+    uint8_t                      hidd_clcb_idx[HIDD_LE_CONN_ID_MAX]; /* conn_id to connection link + 1 */
     esp_gatt_if_t                gatt_if;
     bool                         enabled;
     bool                         is_take;
@@ -323,6 +333,13 @@ void hidd_clcb_alloc (uint16_t conn_id, esp_bd_addr_t bda);
 
 bool hidd_clcb_dealloc (uint16_t conn_id);
 
+hidd_clcb_t *hidd_clcb_find (uint16_t conn_id);
+
+void esp_hidd_prf_cb_hdl(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
+                         esp_ble_gatts_cb_param_t *param);
+
+void hidd_le_init(void);
+
 void hidd_le_create_service(esp_gatt_if_t gatts_if);
 
 void hidd_set_attr_value(uint16_t handle, uint16_t val_len, const uint8_t *value);
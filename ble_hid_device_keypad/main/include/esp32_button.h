@@ -1,6 +1,8 @@
 #ifndef ESP32_BUTTON_H
 #define ESP32_BUTTON_H
 
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "driver/gpio.h"
 
@@ -35,6 +37,25 @@ typedef struct {
     uint8_t event;
 } button_event_t;
 
+typedef struct button_group *button_group_handle_t;
+
+typedef struct {
+    unsigned long long pin_select;  // PIN_BIT() of every button of the group
+    gpio_pull_mode_t pull_mode;
+    bool inverted;                  // Pressed reads low
+    uint32_t long_press_ms;         // First BUTTON_HELD after this long
+    uint32_t long_press_repeat_ms;  // Then one BUTTON_HELD every period
+    uint8_t queue_size;             // 0 for CONFIG_ESP32_BUTTON_QUEUE_SIZE
+} button_config_t;
+
+// Groups are independent, each with its own queue, but a single task polls all of them
+button_group_handle_t button_create(const button_config_t *config);
+QueueHandle_t button_get_queue(button_group_handle_t group);
+// Events lost because the queue of the group was full
+uint32_t button_get_dropped(button_group_handle_t group);
+void button_delete(button_group_handle_t group);
+
+// Single group with the Kconfig timings, inverted unless pulled down
 QueueHandle_t button_init(unsigned long long pin_select);
 QueueHandle_t pulled_button_init(unsigned long long pin_select, gpio_pull_mode_t pull_mode);
 
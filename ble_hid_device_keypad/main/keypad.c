@@ -3,76 +3,197 @@
 #include <memory.h>
 #include <esp_log.h>
 #include "esp_timer.h"
+#include "esp_rom_sys.h"
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include <freertos/queue.h>
 #include <freertos/semphr.h>
 
+#define TAG "KEYPAD"
+
+#define KEYPAD_SETTLE_US 3 ///< Time for a row to follow a column change
+
 /** \brief Keypad mapping array*/
 static int8_t _keypad[16] = {0};
 /** \brief Keypad configuration pions*/
 static gpio_num_t _keypad_pins[8] = {0};
 
-/** \brief Last isr time*/
-int64_t time_old_isr = 0;
-
-/** \brief Pressed keys queue*/
+static keypad_matrix_t matrix;
+static esp_timer_handle_t scan_timer;
+static TaskHandle_t scan_task;
 
-extern QueueHandle_t keypad_queue;
-
-QueueHandle_t button_queue = NULL;
+/**
+ * \brief Key events, written by the scan timer only and read by the application task only,
+ * so head and tail need no lock.
+ */
+static keypad_event_t ring[KEYPAD_EVENT_RING];
+static uint32_t ring_head;
+static uint32_t ring_tail;
+static uint32_t ring_dropped;
+static SemaphoreHandle_t ring_sem;
 
 /**
  * @brief Handle keypad click
  * @param [in]args row number
  */
-void intr_click_handler(void *args);
+static void intr_click_handler(void *args);
 
-void keypad_execute(void *arg);
+static void keypad_execute(void *arg);
+
+static bool ring_push(const keypad_event_t *event)
+{
+    uint32_t head = ring_head;
+
+    if (head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) == KEYPAD_EVENT_RING)
+    {
+        ring_dropped++;
+        return false;
+    }
+    ring[head & (KEYPAD_EVENT_RING - 1)] = *event;
+    __atomic_store_n(&ring_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool ring_pop(keypad_event_t *event)
+{
+    uint32_t tail = ring_tail;
+
+    if (tail == __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+    *event = ring[tail & (KEYPAD_EVENT_RING - 1)];
+    __atomic_store_n(&ring_tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
 
 /**
- * @brief Enable rows'pin pullup resistor, and isr. Prepares
- * keypad to read pressed row number.
+ * @brief Drive every column low, so a press on any key pulls its row down, and enable the
+ * rows' isr.
+ *
+ * @return true if a row is already low, a key was pressed before the isr was enabled
  */
-void turnon_rows()
+static bool turnon_rows()
 {
+    bool low = false;
+
     for (int i = 4; i < 8; i++) /// Columns
     {
-        gpio_set_pull_mode(_keypad_pins[i], GPIO_PULLDOWN_ONLY);
+        gpio_set_level(_keypad_pins[i], 0);
     }
+    esp_rom_delay_us(KEYPAD_SETTLE_US);
     for (int i = 0; i < 4; i++) /// Rows
     {
-        gpio_set_pull_mode(_keypad_pins[i], GPIO_PULLUP_ONLY);
         gpio_intr_enable(_keypad_pins[i]);
+        if (!gpio_get_level(_keypad_pins[i]))
+        {
+            low = true;
+        }
     }
+    return low;
 }
 
 /**
- * @brief Enable columns'pin pullup resistor, and disable rows isr and pullup resistor.
- * Prepares keypad to read pressed column number.
+ * @brief Disable rows'isr while the matrix is scanned
  */
-void turnon_cols()
+static void turnoff_rows()
 {
     for (int i = 0; i < 4; i++) /// Rows
     {
         gpio_intr_disable(_keypad_pins[i]);
-        gpio_set_pull_mode(_keypad_pins[i], GPIO_PULLDOWN_ONLY);
     }
-    for (int i = 4; i < 8; i++) /// Columns
+}
+
+/**
+ * @brief Drive one column low at a time and read the rows
+ *
+ * @return Closed keys, bit row * KEYPAD_COLS + col
+ */
+static uint16_t scan_matrix()
+{
+    uint16_t raw = 0;
+
+    for (int i = 4; i < 8; i++)
+    {
+        gpio_set_level(_keypad_pins[i], 1);
+    }
+    for (int col = 0; col < KEYPAD_COLS; col++)
+    {
+        gpio_set_level(_keypad_pins[4 + col], 0);
+        esp_rom_delay_us(KEYPAD_SETTLE_US);
+        for (int row = 0; row < KEYPAD_ROWS; row++)
+        {
+            if (!gpio_get_level(_keypad_pins[row]))
+            {
+                raw |= 1U << (row * KEYPAD_COLS + col);
+            }
+        }
+        gpio_set_level(_keypad_pins[4 + col], 1);
+    }
+    return raw;
+}
+
+static void emit_event(uint8_t key, bool pressed, void *arg)
+{
+    keypad_event_t event = {
+        .time_us = *(int64_t *)arg - (KEYPAD_DEBOUNCE_SAMPLES - 1) * KEYPAD_SCAN_PERIOD_US,
+        .key = key,
+        .code = _keypad[key],
+        .pressed = pressed,
+    };
+
+    if (ring_push(&event))
+    {
+        xSemaphoreGive(ring_sem);
+    }
+}
+
+static void scan_timeout(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (keypad_matrix_feed(&matrix, scan_matrix(), emit_event, &now))
+    {
+        return;
+    }
+
+    /** Every key released, wait for the next press on the rows' isr */
+    esp_timer_stop(scan_timer);
+    if (turnon_rows())
     {
-        gpio_set_pull_mode(_keypad_pins[i], GPIO_PULLUP_ONLY);
+        /** Pressed again before the isr was enabled */
+        turnoff_rows();
+        xTaskNotifyGive(scan_task);
     }
 }
 
 esp_err_t keypad_initalize(gpio_num_t keypad_pins[8], int8_t keypad[16])
 {
+    const esp_timer_create_args_t timer_args = {
+        .callback = scan_timeout,
+        .name = "keypad_scan",
+    };
+
     memcpy(_keypad_pins, keypad_pins, 8 * sizeof(gpio_num_t));
     memcpy(_keypad, keypad, 16 * sizeof(int8_t));
+    keypad_matrix_init(&matrix);
+
+    ring_sem = xSemaphoreCreateBinary();
+    if (ring_sem == NULL)
+        return ESP_ERR_NO_MEM;
+
+    if (esp_timer_create(&timer_args, &scan_timer) != ESP_OK)
+        return ESP_ERR_NO_MEM;
+
+    if (xTaskCreate(keypad_execute, "keypad_execute", 2048, NULL, 3, &scan_task) != pdPASS)
+        return ESP_ERR_NO_MEM;
+
+    for (int i = 4; i < 8; i++) /// Columns
+    {
+        gpio_set_direction(keypad_pins[i], GPIO_MODE_INPUT_OUTPUT_OD);
+        gpio_set_pull_mode(keypad_pins[i], GPIO_FLOATING);
+    }
 
-    // for (int i = 0;i < 16;i++) {
-    //     _keypad[i] = keypad[i];
-    // }
     /** Maybe cause issues if try to desinstall this flag because it's global allocated
      * to all pins try to use gpio_isr_register instrad of gpio_install_isr_service **/
     ESP_ERROR_CHECK_WITHOUT_ABORT(gpio_install_isr_service(0));
@@ -80,79 +201,83 @@ esp_err_t keypad_initalize(gpio_num_t keypad_pins[8], int8_t keypad[16])
     {
         gpio_intr_disable(keypad_pins[i]);
         gpio_set_direction(keypad_pins[i], GPIO_MODE_INPUT);
+        gpio_set_pull_mode(keypad_pins[i], GPIO_PULLUP_ONLY);
         gpio_set_intr_type(keypad_pins[i], GPIO_INTR_NEGEDGE);
-        ESP_ERROR_CHECK_WITHOUT_ABORT(gpio_isr_handler_add(_keypad_pins[i], (void *)intr_click_handler, (void *)i));
+        ESP_ERROR_CHECK_WITHOUT_ABORT(gpio_isr_handler_add(_keypad_pins[i], intr_click_handler, (void *)i));
     }
-    for (int i = 4; i < 8; i++)
+
+    if (turnon_rows())
     {
-        gpio_set_direction(keypad_pins[i], GPIO_MODE_INPUT);
+        /** Key held since boot */
+        turnoff_rows();
+        xTaskNotifyGive(scan_task);
     }
 
-    keypad_queue = xQueueCreate(5, sizeof(int8_t));
-    if (keypad_queue == NULL)
-        return ESP_ERR_NO_MEM;
-
-    turnon_rows();
-
-    button_queue = xQueueCreate(15, sizeof(int));
-    xTaskCreate(keypad_execute, "keypad_execute", 2048, NULL, 3, NULL);
-
     return ESP_OK;
 }
 
-void intr_click_handler(void *args)
+static void intr_click_handler(void *args)
 {
-    int index = (int)(args);
+    BaseType_t woken = pdFALSE;
 
-    int64_t time_now_isr = esp_timer_get_time() / 1000;
-    int64_t time_isr = (time_now_isr - time_old_isr);
-
-    if (time_isr >= KEYPAD_DEBOUNCING)
+    /** Rows stay quiet until the scan has seen every key released */
+    turnoff_rows();
+    vTaskNotifyGiveFromISR(scan_task, &woken);
+    if (woken)
     {
-        xQueueSend(button_queue, (void *)&index, (TickType_t)0);
+        portYIELD_FROM_ISR();
     }
-
-    time_old_isr = time_now_isr;
 }
 
-void keypad_execute(void *arg)
+static void keypad_execute(void *arg)
 {
-    int pin;
     while (1)
     {
-        if (xQueueReceive(button_queue, &pin, (TickType_t)5) == pdTRUE)
-        {
-            ESP_LOGI("ROW", "%d", _keypad_pins[pin]);
-            turnon_cols();
-            for (int j = 4; j < 8; j++)
-            {
-                if (!gpio_get_level(_keypad_pins[j]))
-                {
-                    xQueueSendFromISR(keypad_queue, &_keypad[pin * 4 + j - 4], NULL);
-                    ESP_LOGI("COL", "%d", _keypad_pins[j]);
-                    break;
-                }
-            }
-            turnon_rows();
-        }
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        /** Fails harmlessly if the scan is already running */
+        esp_timer_start_periodic(scan_timer, KEYPAD_SCAN_PERIOD_US);
+    }
+}
+
+bool keypad_get_event(keypad_event_t *event, TickType_t wait)
+{
+    while (!ring_pop(event))
+    {
+        if (xSemaphoreTake(ring_sem, wait) != pdTRUE)
+            return false;
     }
+    return true;
 }
 
 char keypad_getkey()
 {
-    char key;
-    if (!uxQueueMessagesWaiting(keypad_queue)) /// if is empty, return teminator character
-        return '\0';
-    xQueueReceive(keypad_queue, &key, portMAX_DELAY);
-    return key;
+    keypad_event_t event;
+
+    while (keypad_get_event(&event, 0))
+    {
+        if (event.pressed)
+            return event.code;
+    }
+    return '\0'; /// if is empty, return teminator character
+}
+
+uint32_t keypad_dropped(void)
+{
+    return ring_dropped;
 }
 
 void keypad_delete()
 {
-    for (int i = 0; i < 8; i++)
+    for (int i = 0; i < 4; i++)
     {
         gpio_isr_handler_remove(_keypad_pins[i]);
+    }
+    esp_timer_stop(scan_timer);
+    esp_timer_delete(scan_timer);
+    vTaskDelete(scan_task);
+    for (int i = 0; i < 8; i++)
+    {
         gpio_set_direction(_keypad_pins[i], GPIO_MODE_DISABLE);
     }
-    vQueueDelete(keypad_queue);
-}
\ No newline at end of file
+    vSemaphoreDelete(ring_sem);
+}
@@ -1,38 +1,67 @@
 #ifndef KEYPAD_H
 #define KEYPAD_H
 
+#include <stdbool.h>
 #include <driver/gpio.h>
-// #include <freertos/queue.h>
-
-#define KEYPAD_DEBOUNCING 100   ///< time in ms
-#define KEYPAD_STACKSIZE  10
-
+#include <freertos/FreeRTOS.h>
 
+#include "keypad_matrix.h"
 
+#define KEYPAD_SCAN_PERIOD_US 1000 ///< Matrix scan period while a key is held, in us
+#define KEYPAD_EVENT_RING     32   ///< Pending key events, power of two
+#define KEYPAD_STACKSIZE      10
 
+/**
+ * @brief Debounced key change
+ */
+typedef struct {
+    int64_t time_us; ///< Time of the first sample of the new state
+    uint8_t key;     ///< Key index, row * KEYPAD_COLS + col
+    uint8_t code;    ///< Value of the key in the keypad mapping array
+    bool pressed;
+} keypad_event_t;
 
 /**
  * @brief Initialize Keypad settings and start it, setup up directions and isr and initialize
- * key pressed queue.
- * 
- * @param keypad_pins Keypad Connections Array following this template: 
+ * key event ring.
+ *
+ * Rows are inputs with pullup and a falling edge interrupt, columns are open drain outputs
+ * held low while idle. A press on any row starts a periodic scan of the whole matrix, which
+ * stops again once every key has been released.
+ *
+ * @param keypad_pins Keypad Connections Array following this template:
  *  {R1, R2, R3, R4, C1, C2, C3, C4}
- * 
+ *
  * @return esp_err_t returns ESP_OK if succeful initialize
  */
 esp_err_t keypad_initalize(gpio_num_t keypad_pins[8],int8_t keypad[16]);
 
+/**
+ * @brief Waits for the next key press or release
+ *
+ * @param event Filled with the key change
+ * @param wait Ticks to wait for an event
+ *
+ * @return true if an event was received
+ */
+bool keypad_get_event(keypad_event_t *event, TickType_t wait);
+
 /**
  * @brief Returns pressed key on keypad
- * 
- * @return Returns an pressed key on keypad, if key wasn't pressed returns an terminator character. 
+ *
+ * @return Returns an pressed key on keypad, if key wasn't pressed returns an terminator character.
  */
 char keypad_getkey();
 
+/**
+ * @brief Returns the number of events dropped because the ring was full
+ */
+uint32_t keypad_dropped(void);
+
 /**
  * @brief Delete Keyboard and free resources
- * 
+ *
  */
 void keypad_delete(void);
 
-#endif
\ No newline at end of file
+#endif
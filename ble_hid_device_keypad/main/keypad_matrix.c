@@ -0,0 +1,68 @@
+#include "keypad_matrix.h"
+
+#include <string.h>
+
+#define HISTORY_MASK ((uint16_t)((1UL << KEYPAD_DEBOUNCE_SAMPLES) - 1))
+#define ROW_MASK     ((1U << KEYPAD_COLS) - 1)
+
+void keypad_matrix_init(keypad_matrix_t *matrix)
+{
+    memset(matrix, 0, sizeof(keypad_matrix_t));
+}
+
+uint16_t keypad_matrix_ghosts(uint16_t raw)
+{
+    uint16_t ghosts = 0;
+
+    for (int r1 = 0; r1 < KEYPAD_ROWS - 1; r1++)
+    {
+        uint16_t row1 = (raw >> (r1 * KEYPAD_COLS)) & ROW_MASK;
+        if (row1 & (row1 - 1)) /// Needs two columns or more
+        {
+            for (int r2 = r1 + 1; r2 < KEYPAD_ROWS; r2++)
+            {
+                uint16_t common = row1 & (raw >> (r2 * KEYPAD_COLS));
+                if (common & (common - 1))
+                {
+                    ghosts |= (common << (r1 * KEYPAD_COLS)) | (common << (r2 * KEYPAD_COLS));
+                }
+            }
+        }
+    }
+
+    return ghosts;
+}
+
+bool keypad_matrix_feed(keypad_matrix_t *matrix, uint16_t raw, keypad_matrix_emit_t emit, void *arg)
+{
+    uint16_t busy = 0;
+
+    /** Keys already down are real, the others of the rectangle keep their state */
+    matrix->ghost = keypad_matrix_ghosts(raw) & ~matrix->state;
+    raw = (raw & ~matrix->ghost) | (matrix->state & matrix->ghost);
+
+    for (int key = 0; key < KEYPAD_KEYS; key++)
+    {
+        uint16_t bit = 1U << key;
+        uint16_t history = ((matrix->history[key] << 1) | ((raw & bit) ? 1 : 0)) & HISTORY_MASK;
+
+        matrix->history[key] = history;
+        if (history == HISTORY_MASK && !(matrix->state & bit))
+        {
+            matrix->state |= bit;
+            emit(key, true, arg);
+        }
+        else if (history == 0 && (matrix->state & bit))
+        {
+            matrix->state &= ~bit;
+            emit(key, false, arg);
+        }
+
+        if (history != 0)
+        {
+            busy |= bit;
+        }
+    }
+
+    return busy || matrix->state;
+}
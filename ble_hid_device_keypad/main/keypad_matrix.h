@@ -0,0 +1,55 @@
+#ifndef KEYPAD_MATRIX_H
+#define KEYPAD_MATRIX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define KEYPAD_ROWS 4
+#define KEYPAD_COLS 4
+#define KEYPAD_KEYS (KEYPAD_ROWS * KEYPAD_COLS)
+
+/** Consecutive identical samples needed to accept a key change, at most 16 */
+#ifndef KEYPAD_DEBOUNCE_SAMPLES
+#define KEYPAD_DEBOUNCE_SAMPLES 5
+#endif
+
+/**
+ * @brief Debounce state of the whole matrix. Key index is row * KEYPAD_COLS + col,
+ * and the same index is used for the bits of the raw and debounced bitmaps.
+ */
+typedef struct {
+    uint16_t history[KEYPAD_KEYS]; ///< Last samples of each key, newest in bit 0
+    uint16_t state;                ///< Debounced pressed keys
+    uint16_t ghost;                ///< Keys held back because of a ghosting pattern
+} keypad_matrix_t;
+
+/**
+ * @brief Called for every debounced key change
+ *
+ * @param key Key index
+ * @param pressed true when the key went down
+ * @param arg User argument of keypad_matrix_feed
+ */
+typedef void (*keypad_matrix_emit_t)(uint8_t key, bool pressed, void *arg);
+
+void keypad_matrix_init(keypad_matrix_t *matrix);
+
+/**
+ * @brief Returns the keys which may be phantom: in a matrix without diodes, three keys
+ * on the corners of a rectangle also close the fourth one.
+ *
+ * @param raw Sampled keys
+ */
+uint16_t keypad_matrix_ghosts(uint16_t raw);
+
+/**
+ * @brief Feeds one scan of the matrix. Any number of keys may be held at once; a key which
+ * could be a ghost is not reported until the pattern is resolved.
+ *
+ * @param raw Sampled keys, bit set when the key is closed
+ *
+ * @return true while a key is held or still bouncing, so scanning must go on
+ */
+bool keypad_matrix_feed(keypad_matrix_t *matrix, uint16_t raw, keypad_matrix_emit_t emit, void *arg);
+
+#endif
@@ -0,0 +1,18 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+
+#ifndef TRACE_EVENTS_H__
+#define TRACE_EVENTS_H__
+
+#include "bin_trace.h"
+
+// Trace events of the keypad demo, formats read by bin_trace_decode.py
+#define EXAMPLE_TRACE_EVENTS(X)                                             \
+    X(TRACE_KEY,        "Key %d %u (1 down), %u us after the scan saw it")
+
+enum {
+    EXAMPLE_TRACE_EVENTS(BIN_TRACE_EVENT_ID)
+};
+
+#endif /* TRACE_EVENTS_H__ */
@@ -13,26 +13,32 @@
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "esp_gap_bt_api.h"
+#include "esp_timer.h"
 #include <string.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/semphr.h"
 #include "driver/gpio.h"
-#include "freertos/queue.h"
+
+#include "mouse_input.h"
+#include "mouse_motion.h"
+#include "trace_events.h"
 
 #define REPORT_PROTOCOL_MOUSE_REPORT_SIZE      (4)
 #define REPORT_BUFFER_SIZE                     REPORT_PROTOCOL_MOUSE_REPORT_SIZE
+_Static_assert(REPORT_BUFFER_SIZE == MOUSE_REPORT_MAX_SIZE, "last report kept for GET_REPORT");
+
+#define MOUSE_REPORT_PERIOD_US                 (1000000 / CONFIG_EXAMPLE_MOUSE_REPORT_HZ)
 
 #define PIN_SEL (1ULL<<GPIO_NUM_5) | (1ULL<<GPIO_NUM_18) | (1ULL<<GPIO_NUM_19) |(1ULL<<GPIO_NUM_21) | (1ULL<<GPIO_NUM_23)
 
 typedef struct {
     esp_hidd_app_param_t app_param;
     esp_hidd_qos_param_t both_qos;
-    uint8_t protocol_mode;
-    SemaphoreHandle_t mouse_mutex;
+    volatile uint8_t protocol_mode;
     TaskHandle_t mouse_task_hdl;
-    uint8_t buffer[REPORT_BUFFER_SIZE];
+    // last report sent, written by the report timer only
+    mouse_report_buf_t last_report;
     int8_t x_dir;
 } local_param_t;
 
@@ -41,10 +47,22 @@ typedef enum {
     DOWN,
     LEFT,
     RIGHT,
-    PUSHED
+    PUSHED,
+    BTN_NUM
 } BTN;
 
-QueueHandle_t ButtonQueue = NULL;
+static const gpio_num_t s_btn_pin[BTN_NUM] = {
+    [UP] = GPIO_NUM_18,
+    [DOWN] = GPIO_NUM_21,
+    [LEFT] = GPIO_NUM_5,
+    [RIGHT] = GPIO_NUM_19,
+    [PUSHED] = GPIO_NUM_23,
+};
+
+_Static_assert(BTN_NUM <= BUTTON_RING_PINS, "more buttons than the ring debounces");
+
+// Button presses, pushed by the gpio isr only and popped by mouse_move_task only
+static button_ring_t s_button_ring;
 
 
 static local_param_t s_local_param = {0};
@@ -95,7 +113,6 @@ const int hid_mouse_descriptor_len = sizeof(hid_mouse_descriptor);
 bool check_report_id_type(uint8_t report_id, uint8_t report_type)
 {
     bool ret = false;
-    xSemaphoreTake(s_local_param.mouse_mutex, portMAX_DELAY);
     do {
         if (report_type != ESP_HIDD_REPORT_TYPE_INPUT) {
             break;
@@ -120,112 +137,89 @@ bool check_report_id_type(uint8_t report_id, uint8_t report_type)
             esp_bt_hid_device_report_error(ESP_HID_PAR_HANDSHAKE_RSP_ERR_INVALID_REP_ID);
         }
     }
-    xSemaphoreGive(s_local_param.mouse_mutex);
     return ret;
 }
 
-// send the buttons, change in x, and change in y
+// send the buttons, change in x, and change in y, only from the report timer
 void send_mouse_report(uint8_t buttons, char dx, char dy, char wheel)
 {
     uint8_t report_id;
     uint16_t report_size;
-    xSemaphoreTake(s_local_param.mouse_mutex, portMAX_DELAY);
+    uint8_t report[REPORT_BUFFER_SIZE] = {0};
+
     if (s_local_param.protocol_mode == ESP_HIDD_REPORT_MODE) {
         report_id = 0;
         report_size = REPORT_PROTOCOL_MOUSE_REPORT_SIZE;
-        s_local_param.buffer[0] = buttons;
-        s_local_param.buffer[1] = dx;
-        s_local_param.buffer[2] = dy;
-        s_local_param.buffer[3] = wheel;
+        report[0] = buttons;
+        report[1] = dx;
+        report[2] = dy;
+        report[3] = wheel;
     } else {
         // Boot Mode
         report_id = ESP_HIDD_BOOT_REPORT_ID_MOUSE;
         report_size = ESP_HIDD_BOOT_REPORT_SIZE_MOUSE - 1;
-        s_local_param.buffer[0] = buttons;
-        s_local_param.buffer[1] = dx;
-        s_local_param.buffer[2] = dy;
+        report[0] = buttons;
+        report[1] = dx;
+        report[2] = dy;
     }
-    esp_bt_hid_device_send_report(ESP_HIDD_REPORT_TYPE_INTRDATA, report_id, report_size, s_local_param.buffer);
-    xSemaphoreGive(s_local_param.mouse_mutex);
+    mouse_report_store(&s_local_param.last_report, report);
+    esp_bt_hid_device_send_report(ESP_HIDD_REPORT_TYPE_INTRDATA, report_id, report_size, report);
 }
 
 void IRAM_ATTR isr_handler(void *arg) {
-    // ESP_LOGI("ISR","Interrupt");x
-    int pin = (int)arg;
-    BTN btn;
-    switch (pin)
-    {
-    case 5:
-        btn = LEFT;
-        break;
-    case 18:
-        btn = UP;
-        break;
-    case 19:
-        btn = RIGHT;
-        break;
-    case 21:
-        btn = DOWN;
-        break;
-    case 23:
-        btn = PUSHED;
-        break;
+    BTN btn = (BTN)(int)arg;
+    BaseType_t woken = pdFALSE;
+
+    if (!button_ring_edge(&s_button_ring, btn, !gpio_get_level(s_btn_pin[btn]), esp_timer_get_time())) {
+        return;
     }
-    xQueueSend(ButtonQueue,(void *)&btn,(TickType_t)0);
+    if (s_local_param.mouse_task_hdl) {
+        vTaskNotifyGiveFromISR(s_local_param.mouse_task_hdl, &woken);
+        if (woken) {
+            portYIELD_FROM_ISR();
+        }
+    }
+}
+
+static void mouse_report_send(const mouse_motion_report_t *report)
+{
+    send_mouse_report(report->buttons, report->dx, report->dy, report->wheel);
 }
 
-// move the mouse left and right
+// move the mouse with the direction buttons, click with the push button
 void mouse_move_task(void *pvParameters)
 {
     const char *TAG = "mouse_move_task";
 
     ESP_LOGI(TAG, "starting");
-    BTN btn;
+    button_event_t ev;
     for (;;) {
-        if (xQueueReceive(ButtonQueue,&btn,(TickType_t)5)) {
-            switch (btn)
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (button_ring_pop(&s_button_ring, &ev)) {
+            BIN_TRACED(TRACE_BUTTON, ev.btn, esp_timer_get_time() - ev.time_us, 0);
+            switch (ev.btn)
             {
             case LEFT:
-                send_mouse_report(1,-10,0,0);
-                vTaskDelay(200 / portTICK_PERIOD_MS);
-                send_mouse_report(0,0,0,0);
+                mouse_move(-CONFIG_EXAMPLE_MOUSE_STEP, 0, 0);
                 break;
             case RIGHT:
-                send_mouse_report(1,10,0,0);
-                vTaskDelay(200 / portTICK_PERIOD_MS);
-                send_mouse_report(0,0,0,0);
+                mouse_move(CONFIG_EXAMPLE_MOUSE_STEP, 0, 0);
                 break;
             case UP:
-                send_mouse_report(1,0,10,0);
-                vTaskDelay(200 / portTICK_PERIOD_MS);
-                send_mouse_report(0,0,0,0);
+                mouse_move(0, CONFIG_EXAMPLE_MOUSE_STEP, 0);
                 break;
             case DOWN:
-                send_mouse_report(1,0,-10,0);
-                vTaskDelay(200 / portTICK_PERIOD_MS);
-                send_mouse_report(0,0,0,0);
+                mouse_move(0, -CONFIG_EXAMPLE_MOUSE_STEP, 0);
                 break;
             case PUSHED:
-                send_mouse_report(1,0,0,0);
-                vTaskDelay(200 / portTICK_PERIOD_MS);
-                send_mouse_report(0,0,0,0);
+                // only presses reach the task, the click is reported down then up
+                mouse_buttons(1);
+                mouse_buttons(0);
                 break;
             default:
                 break;
             }
         }
-        // s_local_param.x_dir = 1;
-        // int8_t step = 10;
-        // for (int i = 0; i < 2; i++) {
-        //     xSemaphoreTake(s_local_param.mouse_mutex, portMAX_DELAY);
-            // s_local_param.x_dir *= -1;
-        //     xSemaphoreGive(s_local_param.mouse_mutex);
-        //     for (int j = 0; j < 100; j++) {
-                // send_mouse_report(0, s_local_param.x_dir * step, 0, 0);
-        //         vTaskDelay(50 / portTICK_PERIOD_MS);
-        //     }
-        // }
-        vTaskDelay(200 / portTICK_PERIOD_MS);
     }
 }
 
@@ -294,26 +288,23 @@ void esp_bt_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param)
 
 void bt_app_task_start_up(void)
 {
-    s_local_param.mouse_mutex = xSemaphoreCreateMutex();
-    memset(s_local_param.buffer, 0, REPORT_BUFFER_SIZE);
+    uint8_t empty[REPORT_BUFFER_SIZE] = {0};
+
+    mouse_report_store(&s_local_param.last_report, empty);
+    ESP_ERROR_CHECK(mouse_motion_sched_init(MOUSE_REPORT_PERIOD_US, mouse_report_send));
     gpio_config_t io = {};
     io.pin_bit_mask = PIN_SEL;
     io.mode = GPIO_MODE_INPUT;
     io.pull_up_en = GPIO_PULLUP_ENABLE;
     io.pull_down_en = GPIO_PULLDOWN_DISABLE;
-    io.intr_type = GPIO_INTR_NEGEDGE;
+    // both edges, the isr debounces and keeps the presses only
+    io.intr_type = GPIO_INTR_ANYEDGE;
     gpio_config(&io);
-    gpio_set_intr_type(GPIO_NUM_5,GPIO_INTR_NEGEDGE);
-    gpio_set_intr_type(GPIO_NUM_18,GPIO_INTR_NEGEDGE);
-    gpio_set_intr_type(GPIO_NUM_19,GPIO_INTR_NEGEDGE);
-    gpio_set_intr_type(GPIO_NUM_21,GPIO_INTR_NEGEDGE);
-    gpio_set_intr_type(GPIO_NUM_23,GPIO_INTR_NEGEDGE);
     gpio_install_isr_service(0);
-    gpio_isr_handler_add(GPIO_NUM_5,isr_handler,(void *)5);
-    gpio_isr_handler_add(GPIO_NUM_18,isr_handler,(void *)18);
-    gpio_isr_handler_add(GPIO_NUM_19,isr_handler,(void *)19);
-    gpio_isr_handler_add(GPIO_NUM_21,isr_handler,(void *)21);
-    gpio_isr_handler_add(GPIO_NUM_23,isr_handler,(void *)23);
+    for (int btn = 0; btn < BTN_NUM; btn++) {
+        s_button_ring.down[btn] = !gpio_get_level(s_btn_pin[btn]);
+        gpio_isr_handler_add(s_btn_pin[btn], isr_handler, (void *)btn);
+    }
     xTaskCreate(mouse_move_task, "mouse_move_task", 2 * 1024, NULL, configMAX_PRIORITIES - 3, &s_local_param.mouse_task_hdl);
     return;
 }
@@ -325,10 +316,7 @@ void bt_app_task_shut_down(void)
         s_local_param.mouse_task_hdl = NULL;
     }
 
-    if (s_local_param.mouse_mutex) {
-        vSemaphoreDelete(s_local_param.mouse_mutex);
-        s_local_param.mouse_mutex = NULL;
-    }
+    mouse_motion_sched_deinit();
     return;
 }
 
@@ -403,8 +391,7 @@ void esp_bt_hidd_cb(esp_hidd_cb_event_t event, esp_hidd_cb_param_t *param)
         break;
     case ESP_HIDD_SEND_REPORT_EVT:
         if (param->send_report.status == ESP_HIDD_SUCCESS) {
-            ESP_LOGI(TAG, "ESP_HIDD_SEND_REPORT_EVT id:0x%02x, type:%d", param->send_report.report_id,
-                     param->send_report.report_type);
+            BIN_TRACED(TRACE_SEND_REPORT, param->send_report.report_id, param->send_report.report_type, 0);
         } else {
             ESP_LOGE(TAG, "ESP_HIDD_SEND_REPORT_EVT id:0x%02x, type:%d, status:%d, reason:%d",
                      param->send_report.report_id, param->send_report.report_type, param->send_report.status,
@@ -428,9 +415,9 @@ void esp_bt_hidd_cb(esp_hidd_cb_event_t event, esp_hidd_cb_param_t *param)
                 report_id = ESP_HIDD_BOOT_REPORT_ID_MOUSE;
                 report_len = ESP_HIDD_BOOT_REPORT_SIZE_MOUSE - 1;
             }
-            xSemaphoreTake(s_local_param.mouse_mutex, portMAX_DELAY);
-            esp_bt_hid_device_send_report(param->get_report.report_type, report_id, report_len, s_local_param.buffer);
-            xSemaphoreGive(s_local_param.mouse_mutex);
+            uint8_t report[REPORT_BUFFER_SIZE];
+            mouse_report_load(&s_local_param.last_report, report);
+            esp_bt_hid_device_send_report(param->get_report.report_type, report_id, report_len, report);
         } else {
             ESP_LOGE(TAG, "check_report_id failed!");
         }
@@ -442,15 +429,12 @@ void esp_bt_hidd_cb(esp_hidd_cb_event_t event, esp_hidd_cb_param_t *param)
         ESP_LOGI(TAG, "ESP_HIDD_SET_PROTOCOL_EVT");
         if (param->set_protocol.protocol_mode == ESP_HIDD_BOOT_MODE) {
             ESP_LOGI(TAG, "  - boot protocol");
-            xSemaphoreTake(s_local_param.mouse_mutex, portMAX_DELAY);
             s_local_param.x_dir = -1;
-            xSemaphoreGive(s_local_param.mouse_mutex);
         } else if (param->set_protocol.protocol_mode == ESP_HIDD_REPORT_MODE) {
             ESP_LOGI(TAG, "  - report protocol");
         }
-        xSemaphoreTake(s_local_param.mouse_mutex, portMAX_DELAY);
+        // a single byte, read by the report timer without a lock
         s_local_param.protocol_mode = param->set_protocol.protocol_mode;
-        xSemaphoreGive(s_local_param.mouse_mutex);
         break;
     case ESP_HIDD_INTR_DATA_EVT:
         ESP_LOGI(TAG, "ESP_HIDD_INTR_DATA_EVT");
@@ -487,9 +471,12 @@ void app_main(void)
     }
     ESP_ERROR_CHECK( ret );
 
-    ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_BLE));
+    // Print the button and report traces when idle
+    if ((ret = bin_trace_start()) != ESP_OK) {
+        ESP_LOGE(TAG, "start trace dump failed: %s\n", esp_err_to_name(ret));
+    }
 
-    ButtonQueue = xQueueCreate(10,sizeof(BTN));
+    ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_BLE));
 
     esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
     if ((ret = esp_bt_controller_init(&bt_cfg)) != ESP_OK) {
@@ -0,0 +1,59 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+
+#include <string.h>
+#include "esp_attr.h"
+#include "mouse_input.h"
+
+bool IRAM_ATTR button_ring_edge(button_ring_t *ring, uint8_t btn, bool down, int64_t now_us)
+{
+    bool was_down = ring->down[btn];
+    int64_t quiet_us = now_us - ring->last_edge_us[btn];
+
+    ring->down[btn] = down;
+    ring->last_edge_us[btn] = now_us;
+    if (!down || was_down || quiet_us < BUTTON_DEBOUNCE_US) {
+        return false;
+    }
+
+    if (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == BUTTON_RING_SIZE) {
+        ring->dropped++;
+        return false;
+    }
+    ring->event[ring->head & (BUTTON_RING_SIZE - 1)].time_us = now_us;
+    ring->event[ring->head & (BUTTON_RING_SIZE - 1)].btn = btn;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool button_ring_pop(button_ring_t *ring, button_event_t *event)
+{
+    if (ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    *event = ring->event[ring->tail & (BUTTON_RING_SIZE - 1)];
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void mouse_report_store(mouse_report_buf_t *buf, const uint8_t *report)
+{
+    uint32_t seq = buf->seq;
+
+    __atomic_store_n(&buf->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(buf->buffer, report, MOUSE_REPORT_MAX_SIZE);
+    __atomic_store_n(&buf->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void mouse_report_load(mouse_report_buf_t *buf, uint8_t *report)
+{
+    uint32_t seq;
+
+    do {
+        seq = __atomic_load_n(&buf->seq, __ATOMIC_ACQUIRE);
+        memcpy(report, buf->buffer, MOUSE_REPORT_MAX_SIZE);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&buf->seq, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,66 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+
+#ifndef MOUSE_INPUT_H
+#define MOUSE_INPUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BUTTON_DEBOUNCE_US      (20 * 1000)
+#define BUTTON_RING_SIZE        (16)    /* Power of two */
+#define BUTTON_RING_PINS        (8)
+
+#define MOUSE_REPORT_MAX_SIZE   (4)
+
+typedef struct {
+    int64_t time_us;
+    uint8_t btn;
+} button_event_t;
+
+/**
+ * @brief Button presses, pushed by the gpio isr only and popped by one task only
+ */
+typedef struct {
+    button_event_t event[BUTTON_RING_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    uint32_t dropped;
+    int64_t last_edge_us[BUTTON_RING_PINS];
+    bool down[BUTTON_RING_PINS];
+} button_ring_t;
+
+/**
+ * @brief Records an edge of a button pin, called from the gpio isr. A press
+ *        counts only after the pin was quiet for BUTTON_DEBOUNCE_US, the
+ *        bounces around it and the releases are ignored.
+ *
+ * @return true if a press was pushed, false if ignored or the ring was full
+ */
+bool button_ring_edge(button_ring_t *ring, uint8_t btn, bool down, int64_t now_us);
+
+bool button_ring_pop(button_ring_t *ring, button_event_t *event);
+
+/**
+ * @brief The last report sent, written by one sender and read by anyone under
+ *        the sequence count, a reader retries if the copy changed meanwhile
+ */
+typedef struct {
+    uint8_t buffer[MOUSE_REPORT_MAX_SIZE];
+    uint32_t seq;
+} mouse_report_buf_t;
+
+void mouse_report_store(mouse_report_buf_t *buf, const uint8_t *report);
+
+void mouse_report_load(mouse_report_buf_t *buf, uint8_t *report);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MOUSE_INPUT_H */
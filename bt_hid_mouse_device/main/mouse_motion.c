@@ -0,0 +1,147 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "mouse_motion.h"
+
+#define MOUSE_MOTION_MAX    127
+
+static int8_t mouse_motion_clamp(int32_t *acc)
+{
+    int32_t v = *acc;
+
+    if (v > MOUSE_MOTION_MAX) {
+        v = MOUSE_MOTION_MAX;
+    } else if (v < -MOUSE_MOTION_MAX) {
+        v = -MOUSE_MOTION_MAX;
+    }
+    *acc -= v;
+    return (int8_t)v;
+}
+
+void mouse_motion_init(mouse_motion_t *motion)
+{
+    memset(motion, 0, sizeof(mouse_motion_t));
+}
+
+void mouse_motion_move(mouse_motion_t *motion, int32_t dx, int32_t dy, int32_t wheel)
+{
+    motion->dx += dx;
+    motion->dy += dy;
+    motion->wheel += wheel;
+}
+
+void mouse_motion_set_buttons(mouse_motion_t *motion, uint8_t buttons)
+{
+    motion->buttons_pressed |= buttons & ~motion->buttons;
+    motion->buttons = buttons;
+}
+
+bool mouse_motion_pending(const mouse_motion_t *motion)
+{
+    return motion->dx || motion->dy || motion->wheel ||
+           motion->buttons_pressed || motion->buttons != motion->buttons_sent;
+}
+
+bool mouse_motion_take(mouse_motion_t *motion, mouse_motion_report_t *report)
+{
+    if (!mouse_motion_pending(motion)) {
+        return false;
+    }
+
+    /* A click shorter than a report period is held down for one report */
+    report->buttons = motion->buttons | motion->buttons_pressed;
+    report->dx = mouse_motion_clamp(&motion->dx);
+    report->dy = mouse_motion_clamp(&motion->dy);
+    report->wheel = mouse_motion_clamp(&motion->wheel);
+    motion->buttons_sent = report->buttons;
+    motion->buttons_pressed = 0;
+    return true;
+}
+
+static struct {
+    mouse_motion_t motion;
+    portMUX_TYPE lock;
+    esp_timer_handle_t timer;
+    uint32_t period_us;
+    mouse_motion_send_t send;
+} s_sched = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+/* Sends at most one report per period, and none while the mouse is still */
+static void mouse_motion_sched_timeout(void *arg)
+{
+    mouse_motion_report_t report;
+    bool pending;
+
+    portENTER_CRITICAL(&s_sched.lock);
+    pending = mouse_motion_take(&s_sched.motion, &report);
+    portEXIT_CRITICAL(&s_sched.lock);
+
+    if (pending) {
+        s_sched.send(&report);
+        return;
+    }
+
+    esp_timer_stop(s_sched.timer);
+    /* Motion added before the timer was stopped would wait for the next one */
+    portENTER_CRITICAL(&s_sched.lock);
+    pending = mouse_motion_pending(&s_sched.motion);
+    portEXIT_CRITICAL(&s_sched.lock);
+    if (pending) {
+        esp_timer_start_periodic(s_sched.timer, s_sched.period_us);
+    }
+}
+
+static void mouse_motion_sched_kick(void)
+{
+    /* Fails harmlessly if the reports are already running */
+    if (s_sched.timer) {
+        esp_timer_start_periodic(s_sched.timer, s_sched.period_us);
+    }
+}
+
+esp_err_t mouse_motion_sched_init(uint32_t period_us, mouse_motion_send_t send)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = mouse_motion_sched_timeout,
+        .name = "mouse_report",
+    };
+
+    if (s_sched.timer) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    mouse_motion_init(&s_sched.motion);
+    s_sched.period_us = period_us;
+    s_sched.send = send;
+    return esp_timer_create(&timer_args, &s_sched.timer);
+}
+
+void mouse_motion_sched_deinit(void)
+{
+    if (s_sched.timer) {
+        esp_timer_stop(s_sched.timer);
+        esp_timer_delete(s_sched.timer);
+        s_sched.timer = NULL;
+    }
+}
+
+void mouse_move(int32_t dx, int32_t dy, int32_t wheel)
+{
+    portENTER_CRITICAL(&s_sched.lock);
+    mouse_motion_move(&s_sched.motion, dx, dy, wheel);
+    portEXIT_CRITICAL(&s_sched.lock);
+    mouse_motion_sched_kick();
+}
+
+void mouse_buttons(uint8_t buttons)
+{
+    portENTER_CRITICAL(&s_sched.lock);
+    mouse_motion_set_buttons(&s_sched.motion, buttons);
+    portEXIT_CRITICAL(&s_sched.lock);
+    mouse_motion_sched_kick();
+}
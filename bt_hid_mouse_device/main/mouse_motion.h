@@ -0,0 +1,78 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+
+#ifndef MOUSE_MOTION_H
+#define MOUSE_MOTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Motion and buttons waiting for the next mouse report. Deltas beyond
+ *        the int8 range of a report are carried over to the following reports.
+ */
+typedef struct {
+    int32_t dx;
+    int32_t dy;
+    int32_t wheel;
+    uint8_t buttons;            /* Current state */
+    uint8_t buttons_pressed;    /* Pressed since the last report, reported even if already released */
+    uint8_t buttons_sent;
+} mouse_motion_t;
+
+typedef struct {
+    uint8_t buttons;
+    int8_t dx;
+    int8_t dy;
+    int8_t wheel;
+} mouse_motion_report_t;
+
+void mouse_motion_init(mouse_motion_t *motion);
+
+void mouse_motion_move(mouse_motion_t *motion, int32_t dx, int32_t dy, int32_t wheel);
+
+void mouse_motion_set_buttons(mouse_motion_t *motion, uint8_t buttons);
+
+/**
+ * @brief Takes the next report out of the accumulator
+ *
+ * @return false if there is no motion and no button change to report
+ */
+bool mouse_motion_take(mouse_motion_t *motion, mouse_motion_report_t *report);
+
+/**
+ * @brief Whether mouse_motion_take() has something to report
+ */
+bool mouse_motion_pending(const mouse_motion_t *motion);
+
+/**
+ * @brief Sends one report, called from the report timer
+ */
+typedef void (*mouse_motion_send_t)(const mouse_motion_report_t *report);
+
+/**
+ * @brief Creates the report timer of the mouse. Motion and button changes are
+ *        then sent at most once every period_us, and nothing while it is still.
+ */
+esp_err_t mouse_motion_sched_init(uint32_t period_us, mouse_motion_send_t send);
+
+void mouse_motion_sched_deinit(void);
+
+/**
+ * @brief Adds motion, sent with the next report
+ */
+void mouse_move(int32_t dx, int32_t dy, int32_t wheel);
+
+void mouse_buttons(uint8_t buttons);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MOUSE_MOTION_H */
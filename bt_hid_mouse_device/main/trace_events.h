@@ -0,0 +1,19 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+
+#ifndef TRACE_EVENTS_H__
+#define TRACE_EVENTS_H__
+
+#include "bin_trace.h"
+
+// Trace events of the mouse demo, formats read by bin_trace_decode.py
+#define EXAMPLE_TRACE_EVENTS(X)                                             \
+    X(TRACE_BUTTON,         "Button %u, %u us after its edge")              \
+    X(TRACE_SEND_REPORT,    "Report sent, id 0x%02x, type %u")
+
+enum {
+    EXAMPLE_TRACE_EVENTS(BIN_TRACE_EVENT_ID)
+};
+
+#endif /* TRACE_EVENTS_H__ */
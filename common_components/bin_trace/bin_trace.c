@@ -0,0 +1,147 @@
+/* bin_trace.c - Fixed-size trace records kept in RAM, formatted on the host */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "bin_trace.h"
+
+#define RING_SIZE   (1U << CONFIG_BIN_TRACE_RING_BITS)
+
+#define DUMP_TASK_STACK     3072
+#define DUMP_TASK_PRIO      (tskIDLE_PRIORITY + 1)
+
+/* A writer takes a slot with one atomic add, so tasks and isrs preempting
+ * each other on the core (or a task moved to the other one) never wait.
+ */
+typedef struct {
+    uint32_t head;
+    uint32_t dumped;        /* Records before it were printed or lost */
+    bin_trace_rec_t rec[RING_SIZE];
+} bin_trace_ring_t;
+
+static bin_trace_ring_t trace_ring[portNUM_PROCESSORS];
+static volatile uint8_t trace_level = CONFIG_BIN_TRACE_LEVEL;
+static TaskHandle_t dump_task;
+
+void bin_trace_write(esp_log_level_t level, uint16_t id, uint32_t arg0, uint32_t arg1, uint32_t arg2)
+{
+    bin_trace_ring_t *ring;
+    bin_trace_rec_t *rec;
+    uint32_t seq;
+    uint8_t core;
+
+    if (level > trace_level) {
+        return;
+    }
+
+    core = xPortGetCoreID();
+    ring = &trace_ring[core];
+    seq = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    rec = &ring->rec[seq & (RING_SIZE - 1)];
+
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rec->time_us = (uint32_t)esp_timer_get_time();
+    rec->id = id;
+    rec->level = level;
+    rec->core = core;
+    rec->arg[0] = arg0;
+    rec->arg[1] = arg1;
+    rec->arg[2] = arg2;
+    __atomic_store_n(&rec->seq, seq + 1, __ATOMIC_RELEASE);
+
+    if (level <= ESP_LOG_WARN && dump_task) {
+        if (xPortInIsrContext()) {
+            vTaskNotifyGiveFromISR(dump_task, NULL);
+        } else {
+            xTaskNotifyGive(dump_task);
+        }
+    }
+}
+
+void bin_trace_set_level(esp_log_level_t level)
+{
+    trace_level = level;
+}
+
+/* Copies a record, fails if it is being written or was overwritten meanwhile */
+static bool bin_trace_read(const bin_trace_rec_t *rec, uint32_t seq, bin_trace_rec_t *copy)
+{
+    if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != seq + 1) {
+        return false;
+    }
+    *copy = *rec;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&rec->seq, __ATOMIC_RELAXED) == seq + 1;
+}
+
+void bin_trace_dump(void)
+{
+    bin_trace_ring_t *ring;
+    bin_trace_rec_t copy;
+    uint32_t head, seq, lost;
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        ring = &trace_ring[core];
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        seq = ring->dumped;
+        lost = 0;
+        if (head - seq > RING_SIZE) {
+            lost = head - RING_SIZE - seq;
+            seq = head - RING_SIZE;
+        }
+
+        for (; seq != head; seq++) {
+            const bin_trace_rec_t *rec = &ring->rec[seq & (RING_SIZE - 1)];
+
+            if (!bin_trace_read(rec, seq, &copy)) {
+                /* Overwritten meanwhile, or still being written: left for
+                 * the next dump
+                 */
+                if ((int32_t)(__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) - (seq + 1)) > 0) {
+                    lost++;
+                    continue;
+                }
+                break;
+            }
+            printf("BT %u %08" PRIx32 " %08" PRIx32 " %u %04x %08" PRIx32 " %08" PRIx32 " %08" PRIx32 "\n",
+                   copy.core, copy.seq, copy.time_us, copy.level, copy.id,
+                   copy.arg[0], copy.arg[1], copy.arg[2]);
+        }
+        ring->dumped = seq;
+        if (lost) {
+            printf("BT %d lost %" PRIu32 "\n", core, lost);
+        }
+    }
+}
+
+/* Formats and prints only when nothing else is ready to run */
+static void bin_trace_dump_task(void *arg)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_BIN_TRACE_DUMP_PERIOD_MS));
+        bin_trace_dump();
+    }
+}
+
+esp_err_t bin_trace_start(void)
+{
+    if (dump_task) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xTaskCreate(bin_trace_dump_task, "bin_trace", DUMP_TASK_STACK, NULL,
+                    DUMP_TASK_PRIO, &dump_task) != pdPASS) {
+        dump_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
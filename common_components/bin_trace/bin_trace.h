@@ -0,0 +1,85 @@
+/* bin_trace.h - Fixed-size trace records kept in RAM, formatted on the host */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef _BIN_TRACE_H_
+#define _BIN_TRACE_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+#ifndef CONFIG_BIN_TRACE_LEVEL
+#define CONFIG_BIN_TRACE_LEVEL      3
+#endif
+
+#ifndef CONFIG_BIN_TRACE_RING_BITS
+#define CONFIG_BIN_TRACE_RING_BITS  7
+#endif
+
+#ifndef CONFIG_BIN_TRACE_DUMP_PERIOD_MS
+#define CONFIG_BIN_TRACE_DUMP_PERIOD_MS 2000
+#endif
+
+/* An application lists its trace events once, with the format the host
+ * decoder applies to their arguments:
+ *
+ *     #define EXAMPLE_TRACE_EVENTS(X) \
+ *         X(TRACE_SET, "Set onoff %u, tid 0x%02x, src 0x%04x")
+ *
+ *     enum { EXAMPLE_TRACE_EVENTS(BIN_TRACE_EVENT_ID) };
+ *
+ * and traces with BIN_TRACEI(TRACE_SET, onoff, tid, src). bin_trace_start()
+ * prints the records from a task of the lowest priority, now and then and
+ * soon after a warning or an error. tools/bin_trace_decode.py turns them back
+ * into text:
+ *
+ *     bin_trace_decode.py main/trace_events.h monitor.log
+ */
+#define BIN_TRACE_EVENT_ID(id, format)  id,
+
+typedef struct {
+    uint32_t seq;           /* Index of the record plus 1, 0 while it is written */
+    uint32_t time_us;       /* Low bits of esp_timer_get_time() */
+    uint16_t id;
+    uint8_t  level;
+    uint8_t  core;
+    uint32_t arg[3];
+} bin_trace_rec_t;
+
+/* Never blocks and may be called from an isr. Records go to the ring of the
+ * calling core, the oldest one is overwritten. A warning or an error wakes the
+ * dump task.
+ */
+void bin_trace_write(esp_log_level_t level, uint16_t id, uint32_t arg0, uint32_t arg1, uint32_t arg2);
+
+/* Records above this level are dropped, it starts at CONFIG_BIN_TRACE_LEVEL */
+void bin_trace_set_level(esp_log_level_t level);
+
+/* Prints the records not printed yet, one "BT" line each, oldest first per
+ * core, and a "BT <core> lost <count>" line for those overwritten before.
+ * Called by the dump task, or instead of it; not from two tasks at once.
+ */
+void bin_trace_dump(void);
+
+/* Starts the dump task, which calls bin_trace_dump() every
+ * CONFIG_BIN_TRACE_DUMP_PERIOD_MS and when a warning or an error is traced.
+ */
+esp_err_t bin_trace_start(void);
+
+#define BIN_TRACE(level, id, arg0, arg1, arg2) do {                                 \
+        if ((level) <= CONFIG_BIN_TRACE_LEVEL) {                                    \
+            bin_trace_write((level), (id), (uint32_t)(arg0), (uint32_t)(arg1),      \
+                            (uint32_t)(arg2));                                      \
+        }                                                                           \
+    } while (0)
+
+#define BIN_TRACEE(id, arg0, arg1, arg2)    BIN_TRACE(ESP_LOG_ERROR, id, arg0, arg1, arg2)
+#define BIN_TRACEW(id, arg0, arg1, arg2)    BIN_TRACE(ESP_LOG_WARN, id, arg0, arg1, arg2)
+#define BIN_TRACEI(id, arg0, arg1, arg2)    BIN_TRACE(ESP_LOG_INFO, id, arg0, arg1, arg2)
+#define BIN_TRACED(id, arg0, arg1, arg2)    BIN_TRACE(ESP_LOG_DEBUG, id, arg0, arg1, arg2)
+#define BIN_TRACEV(id, arg0, arg1, arg2)    BIN_TRACE(ESP_LOG_VERBOSE, id, arg0, arg1, arg2)
+
+#endif /* _BIN_TRACE_H_ */
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Turns the "BT" lines printed by bin_trace_dump() back into log lines, using
+# the X(id, "format") list of the application's trace events header.
+#
+#     bin_trace_decode.py main/trace_events.h monitor.log
+
+import argparse
+import re
+import sys
+
+EVENT_RE = re.compile(r'X\(\s*(\w+)\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)')
+CONV_RE = re.compile(r'%[-+ #0]*\d*(?:\.\d+)?(?:hh|h|ll|l)?([diouxXc%])')
+LEVELS = {1: 'E', 2: 'W', 3: 'I', 4: 'D', 5: 'V'}
+
+
+def load_events(path):
+    with open(path) as f:
+        return [(name, fmt.encode().decode('unicode_escape')) for name, fmt in EVENT_RE.findall(f.read())]
+
+
+def format_args(fmt, args):
+    values = []
+    py_fmt = ''
+    pos = 0
+    for m in CONV_RE.finditer(fmt):
+        py_fmt += fmt[pos:m.start()]
+        pos = m.end()
+        conv = m.group(1)
+        if conv == '%':
+            py_fmt += '%%'
+            continue
+        value = args[len(values)] if len(values) < len(args) else 0
+        if conv in 'di' and value & 0x80000000:
+            value -= 1 << 32
+        values.append(value)
+        # Length modifiers and %u mean nothing to Python
+        spec = re.sub(r'(hh|h|ll|l)$', '', m.group(0)[:-1])
+        py_fmt += spec + ('d' if conv == 'u' else conv)
+    py_fmt += fmt[pos:]
+    return py_fmt % tuple(values)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode bin_trace_dump() output')
+    parser.add_argument('events', help='header with the X(id, "format") event list')
+    parser.add_argument('log', nargs='?', help='captured console output, stdin if omitted')
+    args = parser.parse_args()
+
+    events = load_events(args.events)
+    records = []
+    lost = {}
+    with (open(args.log, errors='replace') if args.log else sys.stdin) as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) == 4 and fields[0] == 'BT' and fields[2] == 'lost':
+                lost[int(fields[1])] = lost.get(int(fields[1]), 0) + int(fields[3])
+                continue
+            if len(fields) != 9 or fields[0] != 'BT':
+                continue
+            core, level = int(fields[1]), int(fields[4])
+            seq, time_us, event_id = int(fields[2], 16), int(fields[3], 16), int(fields[5], 16)
+            records.append((time_us, core, seq, level, event_id, [int(v, 16) for v in fields[6:9]]))
+
+    # Both cores share the same clock, its low 32 bits wrap every 71 minutes
+    records.sort()
+    for time_us, core, seq, level, event_id, values in records:
+        if event_id < len(events):
+            name, fmt = events[event_id]
+            text = '%s: %s' % (name, format_args(fmt, values))
+        else:
+            text = 'event 0x%04x: %08x %08x %08x' % (event_id, *values)
+        print('%s (%u.%06u) [%u] %s' % (LEVELS.get(level, '?'), time_us // 1000000, time_us % 1000000, core, text))
+    for core, count in sorted(lost.items()):
+        print('core %u: %u records overwritten before they were dumped' % (core, count), file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
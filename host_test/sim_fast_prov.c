@@ -0,0 +1,214 @@
+/* sim_fast_prov.c - The fast_prov_client example provisioning a field of
+ * fast_prov_server examples over the simulated advertising bearer. The client
+ * provisions the first server it hears, which then provisions the others
+ * together with every server it has handed a range of addresses to.
+ *
+ *   sim_fast_prov [--nodes N] [--spacing M] [--range M] [--loss PCT]
+ *                 [--timeout S] [--seed N]
+ *
+ * Runs until every server got provisioned and took its Fast Prov Info, or
+ * until the timeout. Prints when the servers got there, the airtime of the
+ * nodes and the traffic it took.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "ble_mesh_fast_prov_common.h"
+#include "sim_mesh.h"
+#include "sim_node.h"
+
+#define PBA_LINKS   1       /* CONFIG_BLE_MESH_PBA_SAME_TIME of the client */
+#define MAX_NODES   1024    /* CONFIG_BLE_MESH_MAX_PROV_NODES of the modules */
+
+static sim_radio_config_t radio = {
+    .nodes = 200,
+    .spacing_m = 5,
+    .range_m = 25,
+    .loss_pct = 10,
+    /* The Relay Retransmit of the examples */
+    .relay_count = 3,
+    .relay_interval_ms = 20,
+    .queue_max = 60,
+    .seed = 10,
+};
+static uint32_t timeout_s = 600;
+
+static uint32_t client;
+static uint64_t *prov_us, *info_us;     /* Per node, 0 until it happened */
+static uint32_t provisioned, configured;
+static uint64_t last_prov_us;
+
+typedef struct {
+    uint32_t *us;
+    uint32_t cnt, cap;
+} samples_t;
+
+static samples_t prov_times, info_times;
+
+static void sample(samples_t *s, uint64_t us)
+{
+    if (s->cnt == s->cap) {
+        s->cap = s->cap ? 2 * s->cap : 1024;
+        s->us = realloc(s->us, s->cap * sizeof(uint32_t));
+        TEST_ASSERT(s->us);
+    }
+    s->us[s->cnt++] = (uint32_t)us;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(samples_t *s, uint32_t pct)
+{
+    if (!s->cnt) {
+        return 0;
+    }
+    qsort(s->us, s->cnt, sizeof(uint32_t), cmp_u32);
+    return s->us[(uint64_t)(s->cnt - 1) * pct / 100] / 1000.0;
+}
+
+static void prov_done(uint32_t node, uint16_t addr)
+{
+    if (node == client || prov_us[node]) {
+        return;
+    }
+    prov_us[node] = last_prov_us = sim_now_us();
+    provisioned++;
+    sample(&prov_times, prov_us[node]);
+}
+
+/* A server answers the Fast Prov Info Set once it took its part */
+static void msg_seen(uint32_t node, bool rx, uint32_t opcode, uint16_t src, uint16_t dst,
+                     const uint8_t *data, uint16_t len)
+{
+    if (rx || node == client || opcode != ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_STATUS ||
+            info_us[node]) {
+        return;
+    }
+    info_us[node] = sim_now_us();
+    configured++;
+    sample(&info_times, info_us[node]);
+}
+
+static bool all_done(void)
+{
+    return provisioned == radio.nodes - 1 && configured == radio.nodes - 1;
+}
+
+static void parse_args(int argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        uint32_t *value;
+    } opts[] = {
+        { "--nodes", &radio.nodes },
+        { "--spacing", &radio.spacing_m },
+        { "--range", &radio.range_m },
+        { "--loss", &radio.loss_pct },
+        { "--timeout", &timeout_s },
+        { "--seed", &radio.seed },
+    };
+
+    for (int i = 1; i < argc; i++) {
+        size_t j;
+
+        for (j = 0; j < sizeof(opts) / sizeof(opts[0]); j++) {
+            if (!strcmp(argv[i], opts[j].name) && i + 1 < argc) {
+                *opts[j].value = strtoul(argv[++i], NULL, 0);
+                break;
+            }
+        }
+        if (j == sizeof(opts) / sizeof(opts[0])) {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            exit(2);
+        }
+    }
+    TEST_ASSERT(radio.nodes >= 2 && radio.nodes <= MAX_NODES);
+}
+
+int main(int argc, char **argv)
+{
+    sim_radio_stats_t stats;
+    sim_mesh_stats_t mesh;
+    uint64_t airtime = 0, airtime_max = 0, end_us;
+    uint32_t nbr = 0;
+    bool done;
+
+    parse_args(argc, argv);
+    TEST_ASSERT(sim_mesh_init(&radio) == 0);
+
+    /* The client in the middle of the grid, so provisioning spreads both ways */
+    client = radio.nodes / 2;
+    for (uint32_t i = 0; i < radio.nodes; i++) {
+        TEST_ASSERT(sim_node_add(i == client ? SIM_CLIENT_MODULE : SIM_SERVER_MODULE) == (int)i);
+    }
+    sim_mesh_set_pba_links(client, PBA_LINKS);
+    prov_us = calloc(radio.nodes, sizeof(*prov_us));
+    info_us = calloc(radio.nodes, sizeof(*info_us));
+    TEST_ASSERT(prov_us && info_us);
+    sim_mesh_set_prov_hook(prov_done);
+    sim_mesh_set_msg_hook(msg_seen);
+
+    for (uint32_t i = 0; i < radio.nodes; i++) {
+        sim_node_start(i);
+    }
+    done = sim_run((uint64_t)timeout_s * 1000000, all_done);
+    end_us = sim_now_us();
+
+    for (uint32_t i = 0; i < radio.nodes; i++) {
+        uint64_t air = sim_radio_airtime_us(i);
+
+        airtime += air;
+        airtime_max = air > airtime_max ? air : airtime_max;
+        nbr += sim_radio_neighbours(i);
+    }
+    sim_radio_get_stats(&stats);
+    sim_mesh_get_stats(&mesh);
+
+    printf("%u nodes, %.1f neighbours, %u%% loss\n",
+           radio.nodes, (double)nbr / radio.nodes, radio.loss_pct);
+    printf("  Prov:   %u of %u servers in %.1f s, p50 %.1f ms p90 %.1f ms p99 %.1f ms, "
+           "%llu links, %llu failed\n",
+           provisioned, radio.nodes - 1, last_prov_us / 1e6, percentile_ms(&prov_times, 50),
+           percentile_ms(&prov_times, 90), percentile_ms(&prov_times, 99),
+           (unsigned long long)mesh.prov_links, (unsigned long long)mesh.prov_link_fail);
+    printf("  Info:   %u of %u servers, p50 %.1f ms p90 %.1f ms p99 %.1f ms\n",
+           configured, radio.nodes - 1, percentile_ms(&info_times, 50),
+           percentile_ms(&info_times, 90), percentile_ms(&info_times, 99));
+    printf("  Access: %llu sent, %llu received, %llu segmented failed, %llu client timeouts\n",
+           (unsigned long long)mesh.access_tx, (unsigned long long)mesh.access_rx,
+           (unsigned long long)mesh.seg_tx_fail, (unsigned long long)mesh.client_timeouts);
+    printf("  Air:    %llu advertising events, airtime mean %.1f ms max %.1f ms per node, "
+           "%llu collisions, %llu lost, %llu deaf, %llu relayed, %llu dropped\n",
+           (unsigned long long)stats.tx_events, airtime / 1000.0 / radio.nodes, airtime_max / 1000.0,
+           (unsigned long long)stats.rx_collided, (unsigned long long)stats.rx_lost,
+           (unsigned long long)stats.rx_deaf, (unsigned long long)stats.relayed,
+           (unsigned long long)stats.dropped);
+
+    printf("  Run:    %s at %.1f s\n", done ? "done" : "timed out", end_us / 1e6);
+
+    /* The Provisioners split the address space without overlap, only nodes
+     * which got provisioned take the Fast Prov Info, and no example calls into
+     * the stack with one of its locks held.
+     */
+    for (uint32_t i = 0; i < radio.nodes; i++) {
+        TEST_ASSERT(!info_us[i] || prov_us[i]);
+        for (uint32_t j = 0; prov_us[i] && j < i; j++) {
+            TEST_ASSERT(!prov_us[j] || sim_mesh_addr(i) != sim_mesh_addr(j));
+        }
+    }
+    TEST_ASSERT(provisioned > 0 && configured > 0);
+    TEST_ASSERT(mesh.locked_calls == 0);
+
+    sim_node_free();
+    sim_mesh_free();
+    return 0;
+}
@@ -0,0 +1,2653 @@
+/* sim_mesh.c - BLE Mesh stack for the simulated nodes of sim_node.c */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_test.h"
+#include "sim_mesh.h"
+#include "sim_node.h"
+#include "sim_radio.h"
+
+#include "esp_ble_mesh_defs.h"
+#include "esp_ble_mesh_common_api.h"
+#include "esp_ble_mesh_networking_api.h"
+#include "esp_ble_mesh_provisioning_api.h"
+#include "esp_ble_mesh_proxy_api.h"
+#include "esp_ble_mesh_config_model_api.h"
+#include "esp_ble_mesh_generic_model_api.h"
+#include "esp_ble_mesh_local_data_operation_api.h"
+
+#define DEV_KEY_IDX         0xFFFE      /* Device key, BLE_MESH_KEY_DEV of the stack */
+#define PHONE_ADDR          0x7FFF
+#define RSSI                (-50)
+
+#define APP_KEYS            4
+#define ACCESS_MAX          380
+#define UNSEG_MAX           11          /* Access payload of an unsegmented message */
+#define SEG_LEN             12
+#define MIC_LEN             4
+#define SEG_SLOTS           10
+#define SEG_ATTEMPTS        4           /* Retransmissions of the unacknowledged segments */
+#define SEG_RX_TIMEOUT_MS   10000
+#define CLI_SLOTS           10
+#define CLI_TIMEOUT_MS      4000        /* CONFIG_BLE_MESH_CLIENT_MSG_TIMEOUT */
+#define TID_TIMEOUT_MS      6000
+#define TID_SLOTS           8
+#define CLIENT_MODELS       4
+
+#define BEACON_INTERVAL_MS  5000
+#define PB_LINKS_MAX        8
+#define PB_LINKS_DEFAULT    3
+#define PB_RETX_MS          500
+#define PB_TIMEOUT_MS       30000
+#define PB_ECDH_MS          300
+#define PB_BUF              96
+
+/* Generic Provisioning Control Format */
+#define GPCF_START          0x00
+#define GPCF_ACK            0x01
+#define GPCF_CONT           0x02
+#define GPCF_CTL            0x03
+
+#define LINK_OPEN           0x00
+#define LINK_ACK            0x01
+#define LINK_CLOSE          0x02
+
+#define CLOSE_SUCCESS       0x00
+#define CLOSE_TIMEOUT       0x01
+#define CLOSE_FAIL          0x02
+
+/* Provisioning PDUs, with the lengths the stack sends */
+#define PROV_INVITE         0x00
+#define PROV_CAPS           0x01
+#define PROV_START          0x02
+#define PROV_PUB_KEY        0x03
+#define PROV_CONFIRM        0x05
+#define PROV_RANDOM         0x06
+#define PROV_DATA           0x07
+#define PROV_COMPLETE       0x08
+#define PROV_NONE           0xFF
+
+static const uint8_t prov_pdu_len[] = {
+    [PROV_INVITE] = 2, [PROV_CAPS] = 12, [PROV_START] = 6, [PROV_PUB_KEY] = 65,
+    [PROV_CONFIRM] = 17, [PROV_RANDOM] = 17, [PROV_DATA] = 34, [PROV_COMPLETE] = 1,
+};
+
+typedef struct {
+    uint16_t net_idx;
+    uint16_t app_idx;
+    uint8_t key[16];
+} app_key_t;
+
+/* Event reported once a message has left, or failed to */
+enum {
+    COMP_NONE,
+    COMP_SEND,
+    COMP_PUBLISH,
+};
+
+typedef struct {
+    uint8_t kind;
+    uint32_t opcode;
+    esp_ble_mesh_model_t *model;
+    esp_ble_mesh_msg_ctx_t ctx;
+} comp_t;
+
+typedef struct {
+    bool used;
+    uint16_t src;
+    uint16_t dst;
+    uint8_t ttl;
+    uint8_t hdr;
+    uint16_t seq_zero;
+    uint8_t seg_n;
+    uint32_t acked;
+    uint8_t attempts;
+    uint16_t len;
+    uint8_t data[ACCESS_MAX + MIC_LEN];
+    comp_t comp;
+    sim_timer_t retx;
+} seg_tx_t;
+
+typedef struct {
+    bool used;
+    bool done;              /* Kept to acknowledge repeated segments, until the slot is reused */
+    uint16_t src;
+    uint16_t dst;
+    uint8_t ttl;
+    uint8_t hdr;
+    uint16_t seq_zero;
+    uint8_t seg_n;
+    uint32_t got;
+    uint16_t len;
+    uint8_t data[ACCESS_MAX + MIC_LEN];
+    sim_timer_t ack;
+    sim_timer_t timeout;
+} seg_rx_t;
+
+enum {
+    REQ_VND,
+    REQ_CFG,
+    REQ_GEN,
+};
+
+/* Request of a client model waiting for its status message */
+typedef struct {
+    bool used;
+    uint8_t kind;
+    uint32_t status_op;
+    esp_ble_mesh_client_common_param_t params;
+    sim_timer_t timeout;
+} cli_req_t;
+
+typedef struct {
+    esp_ble_mesh_model_t *model;
+    uint16_t src;
+    uint16_t dst;
+    uint8_t tid;
+    uint64_t us;
+} tid_t;
+
+typedef struct {
+    bool active;
+    bool provisioner;
+    bool opened;
+    uint32_t link_id;
+    uint8_t uuid[16];
+    uint8_t elements;
+    uint16_t addr;
+    uint8_t expect;
+    /* Transaction being sent, and the one to send once it is acknowledged */
+    uint8_t txn_next;
+    uint8_t tx_txn;
+    bool tx_busy;
+    uint8_t tx_len;
+    uint8_t tx[PB_BUF];
+    uint8_t next_len;
+    uint8_t next[PB_BUF];
+    /* Transaction being received */
+    bool rx_busy;
+    bool rx_done;
+    uint8_t rx_txn;
+    uint8_t rx_seg_n;
+    uint32_t rx_got;
+    uint8_t rx_len;
+    uint8_t rx[PB_BUF];
+    sim_timer_t retx;
+    sim_timer_t timeout;
+    sim_timer_t ecdh;
+} pb_link_t;
+
+typedef struct {
+    uint32_t index;
+
+    /* Registered by the example */
+    esp_ble_mesh_prov_t *prov;
+    esp_ble_mesh_comp_t *comp;
+    esp_ble_mesh_cfg_srv_t *cfg_srv;
+    esp_ble_mesh_model_t *cfg_srv_model;
+    esp_ble_mesh_model_t *clients[CLIENT_MODELS];
+    uint8_t client_cnt;
+    esp_ble_mesh_prov_cb_t prov_cb;
+    esp_ble_mesh_model_cb_t model_cb;
+    esp_ble_mesh_cfg_client_cb_t cfg_cli_cb;
+    esp_ble_mesh_cfg_server_cb_t cfg_srv_cb;
+    esp_ble_mesh_generic_client_cb_t gen_cli_cb;
+    esp_ble_mesh_generic_server_cb_t gen_srv_cb;
+
+    /* Network */
+    bool provisioned;
+    uint16_t addr;
+    uint16_t net_idx;
+    uint8_t flags;
+    uint32_t iv_index;
+    uint32_t seq;
+    app_key_t app_keys[APP_KEYS];
+    uint8_t app_key_cnt;
+
+    seg_tx_t seg_tx[SEG_SLOTS];
+    seg_rx_t seg_rx[SEG_SLOTS];
+    cli_req_t req[CLI_SLOTS];
+    tid_t tid[TID_SLOTS];
+
+    /* Unprovisioned device */
+    bool beaconing;
+    sim_timer_t beacon;
+    pb_link_t dev_link;
+
+    /* Provisioner */
+    bool prov_enabled;
+    bool prov_suspended;
+    uint8_t match_val[16];
+    uint8_t match_len;
+    uint8_t match_offset;
+    uint16_t alloc_next;
+    uint16_t alloc_max;
+    uint16_t prov_net_idx;
+    uint16_t node_idx;
+    uint8_t pba_links;
+    pb_link_t links[PB_LINKS_MAX];
+} mesh_node_t;
+
+static mesh_node_t *mesh;
+static uint32_t mesh_cnt;
+static uint32_t rng;
+static sim_mesh_msg_hook_t msg_hook;
+static sim_mesh_prov_hook_t prov_hook;
+static sim_mesh_stats_t stats;
+
+static void put_be16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static uint16_t get_be16(const uint8_t *p)
+{
+    return p[0] << 8 | p[1];
+}
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    put_be16(p, v >> 16);
+    put_be16(p + 2, v);
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+    return (uint32_t)get_be16(p) << 16 | get_be16(p + 2);
+}
+
+static mesh_node_t *self(void)
+{
+    uint32_t node = sim_node_self();
+
+    TEST_ASSERT(node < mesh_cnt);
+    return &mesh[node];
+}
+
+/* Node of a send call, counting the calls made with a lock held */
+static mesh_node_t *self_send(void)
+{
+    mesh_node_t *n = self();
+
+    if (sim_node_locks_held(n->index)) {
+        stats.locked_calls++;
+    }
+    return n;
+}
+
+static uint16_t default_ttl(mesh_node_t *n, uint8_t ttl)
+{
+    return ttl == ESP_BLE_MESH_TTL_DEFAULT ? n->cfg_srv->default_ttl : ttl;
+}
+
+/* Element index of addr on the node, -1 if it is not one of its addresses */
+static int elem_of(mesh_node_t *n, uint16_t addr)
+{
+    if (!n->provisioned || !ESP_BLE_MESH_ADDR_IS_UNICAST(addr) || addr < n->addr ||
+            addr >= n->addr + n->comp->element_count) {
+        return -1;
+    }
+    return addr - n->addr;
+}
+
+static bool model_is_sig(const esp_ble_mesh_model_t *model)
+{
+    const esp_ble_mesh_elem_t *elem = model->element;
+
+    return model >= elem->sig_models && model < elem->sig_models + elem->sig_model_count;
+}
+
+static esp_ble_mesh_model_t *model_find(mesh_node_t *n, uint16_t elem_addr, uint16_t company_id,
+                                        uint16_t model_id)
+{
+    esp_ble_mesh_elem_t *elem;
+    int i = n->provisioned ? elem_of(n, elem_addr) : -1;
+
+    if (i < 0) {
+        return NULL;
+    }
+    elem = &n->comp->elements[i];
+    if (company_id == ESP_BLE_MESH_CID_NVAL) {
+        for (int j = 0; j < elem->sig_model_count; j++) {
+            if (elem->sig_models[j].model_id == model_id) {
+                return &elem->sig_models[j];
+            }
+        }
+        return NULL;
+    }
+    for (int j = 0; j < elem->vnd_model_count; j++) {
+        if (elem->vnd_models[j].vnd.company_id == company_id &&
+                elem->vnd_models[j].vnd.model_id == model_id) {
+            return &elem->vnd_models[j];
+        }
+    }
+    return NULL;
+}
+
+static app_key_t *app_key_find(mesh_node_t *n, uint16_t app_idx)
+{
+    for (int i = 0; i < n->app_key_cnt; i++) {
+        if (n->app_keys[i].app_idx == app_idx) {
+            return &n->app_keys[i];
+        }
+    }
+    return NULL;
+}
+
+static int app_key_add(mesh_node_t *n, uint16_t net_idx, uint16_t app_idx, const uint8_t key[16])
+{
+    app_key_t *app_key = app_key_find(n, app_idx);
+
+    if (!app_key) {
+        if (n->app_key_cnt == APP_KEYS) {
+            return -ENOMEM;
+        }
+        app_key = &n->app_keys[n->app_key_cnt++];
+    }
+    app_key->net_idx = net_idx;
+    app_key->app_idx = app_idx;
+    memcpy(app_key->key, key, 16);
+    return 0;
+}
+
+static bool is_client(mesh_node_t *n, const esp_ble_mesh_model_t *model)
+{
+    for (int i = 0; i < n->client_cnt; i++) {
+        if (n->clients[i] == model) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Events, run from the main loop as the BTC task runs them */
+
+enum {
+    EVT_PROV,
+    EVT_MODEL,
+    EVT_CFG_CLI,
+    EVT_CFG_SRV,
+    EVT_GEN_CLI,
+    EVT_GEN_SRV,
+};
+
+typedef struct {
+    uint8_t kind;
+    int event;
+    union {
+        esp_ble_mesh_prov_cb_param_t prov;
+        esp_ble_mesh_model_cb_param_t model;
+        esp_ble_mesh_cfg_client_cb_param_t cfg_cli;
+        esp_ble_mesh_cfg_server_cb_param_t cfg_srv;
+        esp_ble_mesh_generic_client_cb_param_t gen_cli;
+        esp_ble_mesh_generic_server_cb_param_t gen_srv;
+    } param;
+    /* Pointed to by the parameters */
+    esp_ble_mesh_msg_ctx_t ctx;
+    esp_ble_mesh_client_common_param_t params;
+    uint16_t len;
+    uint8_t msg[];
+} evt_t;
+
+static void evt_run(void *arg)
+{
+    mesh_node_t *n = self();
+    evt_t *e = arg;
+
+    switch (e->kind) {
+    case EVT_PROV:
+        if (n->prov_cb) {
+            n->prov_cb(e->event, &e->param.prov);
+        }
+        break;
+    case EVT_MODEL:
+        switch (e->event) {
+        case ESP_BLE_MESH_MODEL_OPERATION_EVT:
+            e->param.model.model_operation.ctx = &e->ctx;
+            e->param.model.model_operation.msg = e->msg;
+            break;
+        case ESP_BLE_MESH_MODEL_SEND_COMP_EVT:
+            e->param.model.model_send_comp.ctx = &e->ctx;
+            break;
+        case ESP_BLE_MESH_CLIENT_MODEL_RECV_PUBLISH_MSG_EVT:
+            e->param.model.client_recv_publish_msg.ctx = &e->ctx;
+            e->param.model.client_recv_publish_msg.msg = e->msg;
+            break;
+        case ESP_BLE_MESH_CLIENT_MODEL_SEND_TIMEOUT_EVT:
+            e->param.model.client_send_timeout.ctx = &e->ctx;
+            break;
+        default:
+            break;
+        }
+        if (n->model_cb) {
+            n->model_cb(e->event, &e->param.model);
+        }
+        break;
+    case EVT_CFG_CLI:
+        e->param.cfg_cli.params = &e->params;
+        if (n->cfg_cli_cb) {
+            n->cfg_cli_cb(e->event, &e->param.cfg_cli);
+        }
+        break;
+    case EVT_CFG_SRV:
+        if (n->cfg_srv_cb) {
+            n->cfg_srv_cb(e->event, &e->param.cfg_srv);
+        }
+        break;
+    case EVT_GEN_CLI:
+        e->param.gen_cli.params = &e->params;
+        if (n->gen_cli_cb) {
+            n->gen_cli_cb(e->event, &e->param.gen_cli);
+        }
+        break;
+    case EVT_GEN_SRV:
+        if (n->gen_srv_cb) {
+            n->gen_srv_cb(e->event, &e->param.gen_srv);
+        }
+        break;
+    }
+}
+
+static evt_t *evt_post(mesh_node_t *n, uint8_t kind, int event, const uint8_t *msg, uint16_t len)
+{
+    evt_t *e = sim_node_post(n->index, evt_run, sizeof(evt_t) + len);
+
+    e->kind = kind;
+    e->event = event;
+    e->len = len;
+    if (len) {
+        memcpy(e->msg, msg, len);
+    }
+    return e;
+}
+
+static void prov_evt(mesh_node_t *n, int event, const esp_ble_mesh_prov_cb_param_t *param)
+{
+    evt_post(n, EVT_PROV, event, NULL, 0)->param.prov = *param;
+}
+
+static void comp_post(mesh_node_t *n, const comp_t *comp, int err)
+{
+    evt_t *e;
+
+    switch (comp->kind) {
+    case COMP_SEND:
+        e = evt_post(n, EVT_MODEL, ESP_BLE_MESH_MODEL_SEND_COMP_EVT, NULL, 0);
+        e->ctx = comp->ctx;
+        e->param.model.model_send_comp.err_code = err;
+        e->param.model.model_send_comp.opcode = comp->opcode;
+        e->param.model.model_send_comp.model = comp->model;
+        break;
+    case COMP_PUBLISH:
+        e = evt_post(n, EVT_MODEL, ESP_BLE_MESH_MODEL_PUBLISH_COMP_EVT, NULL, 0);
+        e->param.model.model_publish_comp.err_code = err;
+        e->param.model.model_publish_comp.model = comp->model;
+        break;
+    default:
+        break;
+    }
+}
+
+/* Network layer */
+
+static bool net_send(mesh_node_t *n, uint8_t ctl, uint8_t ttl, uint16_t src, uint16_t dst,
+                     const uint8_t *data, uint8_t len)
+{
+    uint8_t transmit = n->cfg_srv->net_transmit;
+    sim_pdu_t pdu = {
+        .type = SIM_AD_MESH,
+        .ctl = ctl,
+        .ttl = ttl,
+        .src = src,
+        .dst = dst,
+        .seq = n->seq++ & 0xFFFFFF,
+        .len = len,
+        .sent_us = sim_now_us(),
+    };
+
+    TEST_ASSERT(len <= sizeof(pdu.data));
+    memcpy(pdu.data, data, len);
+    return sim_radio_send(n->index, &pdu, ESP_BLE_MESH_GET_TRANSMIT_COUNT(transmit) + 1,
+                          ESP_BLE_MESH_GET_TRANSMIT_INTERVAL(transmit), sim_now_us());
+}
+
+/* Transport layer */
+
+static uint32_t seg_mask(uint8_t seg_n)
+{
+    return seg_n == 31 ? UINT32_MAX : (1u << (seg_n + 1)) - 1;
+}
+
+static uint32_t seg_interval_us(uint8_t ttl)
+{
+    return (200 + 50 * ttl) * 1000;
+}
+
+static void seg_tx_send(mesh_node_t *n, seg_tx_t *tx)
+{
+    uint8_t pdu[4 + SEG_LEN];
+
+    for (uint8_t seg_o = 0; seg_o <= tx->seg_n; seg_o++) {
+        uint16_t off = seg_o * SEG_LEN;
+        uint8_t len = tx->len - off < SEG_LEN ? tx->len - off : SEG_LEN;
+
+        if (tx->acked & BIT(seg_o)) {
+            continue;
+        }
+        pdu[0] = 0x80 | tx->hdr;
+        pdu[1] = tx->seq_zero >> 6;
+        pdu[2] = (tx->seq_zero & 0x3F) << 2 | seg_o >> 3;
+        pdu[3] = (seg_o & 0x07) << 5 | tx->seg_n;
+        memcpy(pdu + 4, tx->data + off, len);
+        /* A full advertising queue costs this round, the retransmissions cover it */
+        net_send(n, 0, tx->ttl, tx->src, tx->dst, pdu, 4 + len);
+    }
+}
+
+static void seg_tx_end(mesh_node_t *n, seg_tx_t *tx, int err)
+{
+    sim_timer_stop(&tx->retx);
+    tx->used = false;
+    if (err) {
+        stats.seg_tx_fail++;
+    }
+    comp_post(n, &tx->comp, err);
+}
+
+static void seg_tx_retx(sim_timer_t *timer)
+{
+    seg_tx_t *tx = (seg_tx_t *)((char *)timer - offsetof(seg_tx_t, retx));
+    mesh_node_t *n = self();
+
+    if (!tx->attempts) {
+        /* Segments sent to a group are never acknowledged */
+        seg_tx_end(n, tx, ESP_BLE_MESH_ADDR_IS_UNICAST(tx->dst) ? -ETIMEDOUT : 0);
+        return;
+    }
+    tx->attempts--;
+    seg_tx_send(n, tx);
+    sim_timer_start(&tx->retx, seg_interval_us(tx->ttl));
+}
+
+static void seg_ack_recv(mesh_node_t *n, const sim_pdu_t *pdu)
+{
+    uint16_t seq_zero;
+    uint32_t block;
+
+    if (pdu->len < 7) {
+        return;
+    }
+    seq_zero = (get_be16(pdu->data + 1) >> 2) & 0x1FFF;
+    block = get_be32(pdu->data + 3);
+    for (int i = 0; i < SEG_SLOTS; i++) {
+        seg_tx_t *tx = &n->seg_tx[i];
+
+        if (!tx->used || tx->dst != pdu->src || tx->seq_zero != seq_zero) {
+            continue;
+        }
+        if (!block) {
+            /* The receiver has no room for the message */
+            seg_tx_end(n, tx, -EBUSY);
+            return;
+        }
+        tx->acked |= block & seg_mask(tx->seg_n);
+        if (tx->acked == seg_mask(tx->seg_n)) {
+            seg_tx_end(n, tx, 0);
+        }
+        return;
+    }
+}
+
+/* Upper transport PDU of an access message, with its TransMIC */
+static int trans_send(mesh_node_t *n, uint16_t src, uint16_t dst, uint16_t app_idx, uint8_t ttl,
+                      const uint8_t *access, uint16_t len, const comp_t *comp)
+{
+    uint8_t hdr = app_idx == DEV_KEY_IDX ? 0 : (0x40 | (app_idx & 0x3F));
+    uint8_t pdu[1 + UNSEG_MAX + MIC_LEN] = { hdr };
+    seg_tx_t *tx = NULL;
+
+    if (len <= UNSEG_MAX) {
+        memcpy(pdu + 1, access, len);
+        if (!net_send(n, 0, ttl, src, dst, pdu, 1 + len + MIC_LEN)) {
+            return -ENOBUFS;
+        }
+        comp_post(n, comp, 0);
+        return 0;
+    }
+
+    for (int i = 0; i < SEG_SLOTS; i++) {
+        if (!n->seg_tx[i].used) {
+            tx = &n->seg_tx[i];
+            break;
+        }
+    }
+    if (!tx) {
+        return -EBUSY;
+    }
+    tx->used = true;
+    tx->src = src;
+    tx->dst = dst;
+    tx->ttl = ttl;
+    tx->hdr = hdr;
+    tx->seq_zero = n->seq & 0x1FFF;
+    tx->len = len + MIC_LEN;
+    tx->seg_n = (tx->len - 1) / SEG_LEN;
+    tx->acked = 0;
+    tx->attempts = SEG_ATTEMPTS;
+    memcpy(tx->data, access, len);
+    memset(tx->data + len, 0, MIC_LEN);
+    tx->comp = *comp;
+    seg_tx_send(n, tx);
+    sim_timer_start(&tx->retx, seg_interval_us(ttl));
+    return 0;
+}
+
+static void seg_ack_send(mesh_node_t *n, seg_rx_t *rx, uint32_t block)
+{
+    uint8_t pdu[7] = { 0x00 };
+
+    put_be16(pdu + 1, rx->seq_zero << 2);
+    put_be32(pdu + 3, block);
+    net_send(n, 1, rx->ttl ? n->cfg_srv->default_ttl : 0, rx->dst, rx->src, pdu, sizeof(pdu));
+}
+
+static void seg_rx_ack(sim_timer_t *timer)
+{
+    seg_rx_t *rx = (seg_rx_t *)((char *)timer - offsetof(seg_rx_t, ack));
+
+    if (rx->used) {
+        seg_ack_send(self(), rx, rx->got);
+    }
+}
+
+static void seg_rx_timeout(sim_timer_t *timer)
+{
+    seg_rx_t *rx = (seg_rx_t *)((char *)timer - offsetof(seg_rx_t, timeout));
+
+    sim_timer_stop(&rx->ack);
+    rx->used = false;
+}
+
+static void access_recv(mesh_node_t *n, uint16_t src, uint16_t dst, uint8_t ttl, uint8_t hdr,
+                        const uint8_t *access, uint16_t len);
+
+static void seg_recv(mesh_node_t *n, const sim_pdu_t *pdu)
+{
+    uint16_t seq_zero = ((pdu->data[1] & 0x7F) << 6) | pdu->data[2] >> 2;
+    uint8_t seg_o = (pdu->data[2] & 0x03) << 3 | pdu->data[3] >> 5;
+    uint8_t seg_n = pdu->data[3] & 0x1F;
+    uint8_t len = pdu->len - 4;
+    bool unicast = ESP_BLE_MESH_ADDR_IS_UNICAST(pdu->dst);
+    seg_rx_t *rx = NULL;
+
+    if (pdu->len < 5 || seg_o > seg_n || (seg_o < seg_n && len != SEG_LEN)) {
+        return;
+    }
+    for (int i = 0; i < SEG_SLOTS; i++) {
+        seg_rx_t *slot = &n->seg_rx[i];
+
+        if ((slot->used || slot->done) && slot->src == pdu->src && slot->seq_zero == seq_zero) {
+            rx = slot;
+            break;
+        }
+    }
+    if (rx && rx->done) {
+        if (unicast) {
+            seg_ack_send(n, rx, rx->got);
+        }
+        return;
+    }
+    if (!rx) {
+        /* A free slot, then the one of the oldest completed message */
+        for (int i = 0; i < SEG_SLOTS && !rx; i++) {
+            if (!n->seg_rx[i].used && !n->seg_rx[i].done) {
+                rx = &n->seg_rx[i];
+            }
+        }
+        for (int i = 0; i < SEG_SLOTS && !rx; i++) {
+            if (!n->seg_rx[i].used) {
+                rx = &n->seg_rx[i];
+            }
+        }
+        if (!rx) {
+            return;
+        }
+        rx->used = true;
+        rx->done = false;
+        rx->src = pdu->src;
+        rx->dst = pdu->dst;
+        rx->ttl = pdu->ttl;
+        rx->hdr = pdu->data[0] & 0x7F;
+        rx->seq_zero = seq_zero;
+        rx->seg_n = seg_n;
+        rx->got = 0;
+        rx->len = 0;
+    }
+    if (rx->seg_n != seg_n) {
+        return;
+    }
+    memcpy(rx->data + seg_o * SEG_LEN, pdu->data + 4, len);
+    rx->got |= BIT(seg_o);
+    if (seg_o == seg_n) {
+        rx->len = seg_n * SEG_LEN + len;
+    }
+    sim_timer_start(&rx->timeout, SEG_RX_TIMEOUT_MS * 1000);
+
+    if (rx->got != seg_mask(seg_n)) {
+        if (unicast && !sim_timer_armed(&rx->ack)) {
+            sim_timer_start(&rx->ack, (150 + 50 * rx->ttl) * 1000);
+        }
+        return;
+    }
+    sim_timer_stop(&rx->ack);
+    sim_timer_stop(&rx->timeout);
+    rx->used = false;
+    rx->done = true;
+    if (unicast) {
+        seg_ack_send(n, rx, rx->got);
+    }
+    if (rx->len > MIC_LEN) {
+        access_recv(n, rx->src, rx->dst, rx->ttl, rx->hdr, rx->data, rx->len - MIC_LEN);
+    }
+}
+
+static void trans_recv(mesh_node_t *n, const sim_pdu_t *pdu)
+{
+    if (!pdu->len) {
+        return;
+    }
+    if (pdu->ctl) {
+        if ((pdu->data[0] & 0x7F) == 0x00) {
+            seg_ack_recv(n, pdu);
+        }
+        return;
+    }
+    if (pdu->data[0] & 0x80) {
+        seg_recv(n, pdu);
+    } else if (pdu->len > 1 + MIC_LEN) {
+        access_recv(n, pdu->src, pdu->dst, pdu->ttl, pdu->data[0], pdu->data + 1, pdu->len - 1 - MIC_LEN);
+    }
+}
+
+/* Access layer */
+
+static uint8_t op_put(uint8_t *buf, uint32_t opcode)
+{
+    if (opcode < 0x100) {
+        buf[0] = opcode;
+        return 1;
+    }
+    if (opcode < 0x10000) {
+        put_be16(buf, opcode);
+        return 2;
+    }
+    buf[0] = opcode >> 16;
+    put_le16(buf + 1, opcode);
+    return 3;
+}
+
+static int op_get(const uint8_t *buf, uint16_t len, uint32_t *opcode)
+{
+    if (!len) {
+        return -1;
+    }
+    switch (buf[0] >> 6) {
+    case 0:
+    case 1:
+        if (buf[0] == 0x7F) {
+            return -1;
+        }
+        *opcode = buf[0];
+        return 1;
+    case 2:
+        if (len < 2) {
+            return -1;
+        }
+        *opcode = get_be16(buf);
+        return 2;
+    default:
+        if (len < 3) {
+            return -1;
+        }
+        *opcode = (uint32_t)buf[0] << 16 | get_le16(buf + 1);
+        return 3;
+    }
+}
+
+typedef struct {
+    uint16_t src;
+    uint16_t dst;
+    uint8_t ttl;
+    uint16_t app_idx;
+    uint32_t opcode;
+    uint16_t len;
+    uint8_t data[];
+} rx_msg_t;
+
+static void access_dispatch(void *arg);
+
+static void access_post(mesh_node_t *n, uint16_t src, uint16_t dst, uint8_t ttl, uint16_t app_idx,
+                        uint32_t opcode, const uint8_t *data, uint16_t len)
+{
+    rx_msg_t *rx = sim_node_post(n->index, access_dispatch, sizeof(rx_msg_t) + len);
+
+    rx->src = src;
+    rx->dst = dst;
+    rx->ttl = ttl;
+    rx->app_idx = app_idx;
+    rx->opcode = opcode;
+    rx->len = len;
+    memcpy(rx->data, data, len);
+}
+
+static bool subscribed(mesh_node_t *n, uint16_t group)
+{
+    for (size_t i = 0; i < n->comp->element_count; i++) {
+        esp_ble_mesh_elem_t *elem = &n->comp->elements[i];
+
+        for (int j = 0; j < elem->sig_model_count; j++) {
+            if (esp_ble_mesh_is_model_subscribed_to_group(&elem->sig_models[j], group)) {
+                return true;
+            }
+        }
+        for (int j = 0; j < elem->vnd_model_count; j++) {
+            if (esp_ble_mesh_is_model_subscribed_to_group(&elem->vnd_models[j], group)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void access_recv(mesh_node_t *n, uint16_t src, uint16_t dst, uint8_t ttl, uint8_t hdr,
+                        const uint8_t *access, uint16_t len)
+{
+    uint16_t app_idx = DEV_KEY_IDX;
+    uint32_t opcode;
+    int op_len;
+
+    if (hdr & 0x40) {
+        app_idx = ESP_BLE_MESH_KEY_UNUSED;
+        for (int i = 0; i < n->app_key_cnt; i++) {
+            if ((n->app_keys[i].app_idx & 0x3F) == (hdr & 0x3F)) {
+                app_idx = n->app_keys[i].app_idx;
+                break;
+            }
+        }
+        if (app_idx == ESP_BLE_MESH_KEY_UNUSED) {
+            return;
+        }
+    } else if (elem_of(n, dst) < 0) {
+        return;
+    }
+    op_len = op_get(access, len, &opcode);
+    if (op_len < 0) {
+        return;
+    }
+    access_post(n, src, dst, ttl, app_idx, opcode, access + op_len, len - op_len);
+}
+
+static int access_send(mesh_node_t *n, esp_ble_mesh_model_t *model, uint16_t dst, uint16_t app_idx,
+                       uint8_t ttl, uint32_t opcode, const uint8_t *data, uint16_t len, const comp_t *comp)
+{
+    uint8_t access[ACCESS_MAX];
+    uint8_t op_len = op_put(access, opcode);
+    uint16_t src = model->element->element_addr;
+
+    if (!n->provisioned) {
+        return -EAGAIN;
+    }
+    if (op_len + len > ACCESS_MAX) {
+        return -EMSGSIZE;
+    }
+    if (!ESP_BLE_MESH_ADDR_IS_UNICAST(dst) && app_idx == DEV_KEY_IDX) {
+        return -EINVAL;
+    }
+    if (app_idx != DEV_KEY_IDX && !app_key_find(n, app_idx)) {
+        return -EINVAL;
+    }
+    memcpy(access + op_len, data, len);
+    ttl = default_ttl(n, ttl);
+
+    stats.access_tx++;
+    if (msg_hook) {
+        msg_hook(n->index, false, opcode, src, dst, data, len);
+    }
+
+    /* Messages to the node itself do not go on air */
+    if (elem_of(n, dst) >= 0) {
+        access_post(n, src, dst, ttl, app_idx, opcode, data, len);
+        comp_post(n, comp, 0);
+        return 0;
+    }
+    if (!ESP_BLE_MESH_ADDR_IS_UNICAST(dst) && subscribed(n, dst)) {
+        access_post(n, src, dst, ttl, app_idx, opcode, data, len);
+    }
+    return trans_send(n, src, dst, app_idx, ttl, access, op_len + len, comp);
+}
+
+static esp_ble_mesh_msg_ctx_t rx_ctx(mesh_node_t *n, const rx_msg_t *rx, esp_ble_mesh_model_t *model)
+{
+    esp_ble_mesh_msg_ctx_t ctx = {
+        .net_idx = n->net_idx,
+        .app_idx = rx->app_idx,
+        .addr = rx->src,
+        .recv_dst = rx->dst,
+        .recv_rssi = RSSI,
+        .recv_op = rx->opcode,
+        .recv_ttl = rx->ttl,
+        .send_ttl = rx->ttl ? ESP_BLE_MESH_TTL_DEFAULT : 0,
+        .model = model,
+    };
+
+    return ctx;
+}
+
+/* Clients */
+
+static cli_req_t *req_find(mesh_node_t *n, esp_ble_mesh_model_t *model, uint16_t addr)
+{
+    for (int i = 0; i < CLI_SLOTS; i++) {
+        if (n->req[i].used && n->req[i].params.model == model && n->req[i].params.ctx.addr == addr) {
+            return &n->req[i];
+        }
+    }
+    return NULL;
+}
+
+static void req_timeout(sim_timer_t *timer)
+{
+    cli_req_t *req = (cli_req_t *)((char *)timer - offsetof(cli_req_t, timeout));
+    mesh_node_t *n = self();
+    evt_t *e;
+
+    req->used = false;
+    stats.client_timeouts++;
+    switch (req->kind) {
+    case REQ_VND:
+        e = evt_post(n, EVT_MODEL, ESP_BLE_MESH_CLIENT_MODEL_SEND_TIMEOUT_EVT, NULL, 0);
+        e->ctx = req->params.ctx;
+        e->param.model.client_send_timeout.opcode = req->params.opcode;
+        e->param.model.client_send_timeout.model = req->params.model;
+        break;
+    case REQ_CFG:
+        e = evt_post(n, EVT_CFG_CLI, ESP_BLE_MESH_CFG_CLIENT_TIMEOUT_EVT, NULL, 0);
+        e->params = req->params;
+        break;
+    case REQ_GEN:
+        e = evt_post(n, EVT_GEN_CLI, ESP_BLE_MESH_GENERIC_CLIENT_TIMEOUT_EVT, NULL, 0);
+        e->params = req->params;
+        break;
+    }
+}
+
+/* Sends a client message, waiting for status_op if it is not 0 */
+static int req_send(mesh_node_t *n, uint8_t kind, const esp_ble_mesh_client_common_param_t *params,
+                    uint16_t app_idx, uint32_t status_op, int32_t timeout_ms, const uint8_t *data,
+                    uint16_t len, const comp_t *comp)
+{
+    cli_req_t *req = NULL;
+    int err;
+
+    if (status_op) {
+        if (req_find(n, params->model, params->ctx.addr)) {
+            return -EBUSY;
+        }
+        for (int i = 0; i < CLI_SLOTS && !req; i++) {
+            if (!n->req[i].used) {
+                req = &n->req[i];
+            }
+        }
+        if (!req) {
+            return -ENOMEM;
+        }
+    }
+    err = access_send(n, params->model, params->ctx.addr, app_idx, params->ctx.send_ttl,
+                      params->opcode, data, len, comp);
+    if (err || !req) {
+        return err;
+    }
+    req->used = true;
+    req->kind = kind;
+    req->status_op = status_op;
+    req->params = *params;
+    sim_timer_start(&req->timeout, (uint64_t)(timeout_ms > 0 ? timeout_ms : CLI_TIMEOUT_MS) * 1000);
+    return 0;
+}
+
+/* Takes the request the status message answers, if any */
+static bool req_take(mesh_node_t *n, uint8_t kind, esp_ble_mesh_model_t *model, const rx_msg_t *rx,
+                     esp_ble_mesh_client_common_param_t *params)
+{
+    cli_req_t *req = req_find(n, model, rx->src);
+
+    if (!req || req->kind != kind || req->status_op != rx->opcode) {
+        return false;
+    }
+    sim_timer_stop(&req->timeout);
+    req->used = false;
+    *params = req->params;
+    return true;
+}
+
+static void vnd_recv(mesh_node_t *n, esp_ble_mesh_model_t *model, const rx_msg_t *rx)
+{
+    esp_ble_mesh_client_common_param_t params;
+    int event = ESP_BLE_MESH_MODEL_OPERATION_EVT;
+    evt_t *e;
+
+    if (is_client(n, model) && !req_take(n, REQ_VND, model, rx, &params)) {
+        event = ESP_BLE_MESH_CLIENT_MODEL_RECV_PUBLISH_MSG_EVT;
+    }
+    e = evt_post(n, EVT_MODEL, event, rx->data, rx->len);
+    e->ctx = rx_ctx(n, rx, model);
+    if (event == ESP_BLE_MESH_MODEL_OPERATION_EVT) {
+        e->param.model.model_operation.opcode = rx->opcode;
+        e->param.model.model_operation.model = model;
+        e->param.model.model_operation.length = rx->len;
+    } else {
+        e->param.model.client_recv_publish_msg.opcode = rx->opcode;
+        e->param.model.client_recv_publish_msg.model = model;
+        e->param.model.client_recv_publish_msg.length = rx->len;
+    }
+}
+
+/* Configuration Server, also run for the changes a phone makes over GATT */
+
+static uint8_t cfg_model_put(uint8_t *buf, uint16_t company_id, uint16_t model_id)
+{
+    if (company_id == ESP_BLE_MESH_CID_NVAL) {
+        put_le16(buf, model_id);
+        return 2;
+    }
+    put_le16(buf, company_id);
+    put_le16(buf + 2, model_id);
+    return 4;
+}
+
+static void cfg_model_get(const uint8_t *buf, uint16_t len, uint16_t *company_id, uint16_t *model_id)
+{
+    if (len >= 4) {
+        *company_id = get_le16(buf);
+        *model_id = get_le16(buf + 2);
+    } else {
+        *company_id = ESP_BLE_MESH_CID_NVAL;
+        *model_id = get_le16(buf);
+    }
+}
+
+static uint16_t cfg_msg_put(uint8_t *buf, uint32_t opcode, const esp_ble_mesh_cfg_client_set_state_t *set)
+{
+    switch (opcode) {
+    case ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD: {
+        uint32_t idx = (set->app_key_add.net_idx & 0xFFF) | (set->app_key_add.app_idx & 0xFFF) << 12;
+
+        buf[0] = idx;
+        put_le16(buf + 1, idx >> 8);
+        memcpy(buf + 3, set->app_key_add.app_key, 16);
+        return 19;
+    }
+    case ESP_BLE_MESH_MODEL_OP_MODEL_APP_BIND:
+        put_le16(buf, set->model_app_bind.element_addr);
+        put_le16(buf + 2, set->model_app_bind.model_app_idx);
+        return 4 + cfg_model_put(buf + 4, set->model_app_bind.company_id, set->model_app_bind.model_id);
+    case ESP_BLE_MESH_MODEL_OP_MODEL_SUB_ADD:
+        put_le16(buf, set->model_sub_add.element_addr);
+        put_le16(buf + 2, set->model_sub_add.sub_addr);
+        return 4 + cfg_model_put(buf + 4, set->model_sub_add.company_id, set->model_sub_add.model_id);
+    default:
+        return 0;
+    }
+}
+
+static int model_sub_add(esp_ble_mesh_model_t *model, uint16_t group)
+{
+    uint16_t *free_entry = NULL;
+
+    for (int i = 0; i < CONFIG_BLE_MESH_MODEL_GROUP_COUNT; i++) {
+        if (model->groups[i] == group) {
+            return 0;
+        }
+        if (!free_entry && model->groups[i] == ESP_BLE_MESH_ADDR_UNASSIGNED) {
+            free_entry = &model->groups[i];
+        }
+    }
+    if (!free_entry) {
+        return -ENOMEM;
+    }
+    *free_entry = group;
+    return 0;
+}
+
+static void cfg_srv_recv(mesh_node_t *n, esp_ble_mesh_model_t *model, const rx_msg_t *rx, bool reply)
+{
+    esp_ble_mesh_cfg_server_cb_param_t param = {
+        .model = model,
+        .ctx = rx_ctx(n, rx, model),
+    };
+    esp_ble_mesh_model_t *target;
+    uint8_t status[1 + 8] = { 0x00 };
+    uint16_t status_len = 0, company_id, model_id;
+    uint32_t status_op = 0;
+    bool changed = false;
+    evt_t *e;
+
+    switch (rx->opcode) {
+    case ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD: {
+        uint32_t idx;
+
+        if (rx->len < 19) {
+            return;
+        }
+        idx = rx->data[0] | rx->data[1] << 8 | rx->data[2] << 16;
+        param.value.state_change.appkey_add.net_idx = idx & 0xFFF;
+        param.value.state_change.appkey_add.app_idx = idx >> 12;
+        memcpy(param.value.state_change.appkey_add.app_key, rx->data + 3, 16);
+        status[0] = app_key_add(n, idx & 0xFFF, idx >> 12, rx->data + 3) ? 0x05 : 0x00;
+        changed = !status[0];
+        memcpy(status + 1, rx->data, 3);
+        status_len = 4;
+        status_op = ESP_BLE_MESH_MODEL_OP_APP_KEY_STATUS;
+        break;
+    }
+    case ESP_BLE_MESH_MODEL_OP_MODEL_APP_BIND:
+        if (rx->len < 6) {
+            return;
+        }
+        cfg_model_get(rx->data + 4, rx->len - 4, &company_id, &model_id);
+        target = model_find(n, get_le16(rx->data), company_id, model_id);
+        if (!target) {
+            status[0] = 0x02;       /* Invalid Model */
+        } else if (!app_key_find(n, get_le16(rx->data + 2))) {
+            status[0] = 0x03;       /* Invalid AppKey Index */
+        } else {
+            target->keys[0] = get_le16(rx->data + 2);
+            changed = true;
+        }
+        param.value.state_change.mod_app_bind.element_addr = get_le16(rx->data);
+        param.value.state_change.mod_app_bind.app_idx = get_le16(rx->data + 2);
+        param.value.state_change.mod_app_bind.company_id = company_id;
+        param.value.state_change.mod_app_bind.model_id = model_id;
+        memcpy(status + 1, rx->data, rx->len < 8 ? rx->len : 8);
+        status_len = 1 + (rx->len < 8 ? rx->len : 8);
+        status_op = ESP_BLE_MESH_MODEL_OP_MODEL_APP_STATUS;
+        break;
+    case ESP_BLE_MESH_MODEL_OP_MODEL_SUB_ADD:
+    case ESP_BLE_MESH_MODEL_OP_MODEL_SUB_DELETE: {
+        esp_ble_mesh_state_change_model_sub_t *sub = rx->opcode == ESP_BLE_MESH_MODEL_OP_MODEL_SUB_ADD ?
+                &param.value.state_change.mod_sub_add : &param.value.state_change.mod_sub_delete;
+        uint16_t group;
+
+        if (rx->len < 6) {
+            return;
+        }
+        group = get_le16(rx->data + 2);
+        cfg_model_get(rx->data + 4, rx->len - 4, &company_id, &model_id);
+        target = model_find(n, get_le16(rx->data), company_id, model_id);
+        if (!target) {
+            status[0] = 0x02;
+        } else if (!ESP_BLE_MESH_ADDR_IS_GROUP(group)) {
+            status[0] = 0x01;       /* Invalid Address */
+        } else if (rx->opcode == ESP_BLE_MESH_MODEL_OP_MODEL_SUB_ADD) {
+            status[0] = model_sub_add(target, group) ? 0x05 : 0x00;
+            changed = !status[0];
+        } else {
+            uint16_t *entry = esp_ble_mesh_is_model_subscribed_to_group(target, group);
+
+            if (entry) {
+                *entry = ESP_BLE_MESH_ADDR_UNASSIGNED;
+            }
+            changed = true;
+        }
+        sub->element_addr = get_le16(rx->data);
+        sub->sub_addr = group;
+        sub->company_id = company_id;
+        sub->model_id = model_id;
+        memcpy(status + 1, rx->data, rx->len < 8 ? rx->len : 8);
+        status_len = 1 + (rx->len < 8 ? rx->len : 8);
+        status_op = ESP_BLE_MESH_MODEL_OP_MODEL_SUB_STATUS;
+        break;
+    }
+    default:
+        return;
+    }
+
+    if (reply) {
+        comp_t comp = { .kind = COMP_NONE };
+
+        access_send(n, model, rx->src, DEV_KEY_IDX, param.ctx.send_ttl, status_op, status, status_len, &comp);
+    }
+    if (changed) {
+        e = evt_post(n, EVT_CFG_SRV, ESP_BLE_MESH_CFG_SERVER_STATE_CHANGE_EVT, NULL, 0);
+        e->param.cfg_srv = param;
+    }
+}
+
+static void cfg_cli_recv(mesh_node_t *n, esp_ble_mesh_model_t *model, const rx_msg_t *rx)
+{
+    esp_ble_mesh_client_common_param_t params;
+    evt_t *e;
+
+    if (!req_take(n, REQ_CFG, model, rx, &params)) {
+        e = evt_post(n, EVT_CFG_CLI, ESP_BLE_MESH_CFG_CLIENT_PUBLISH_EVT, NULL, 0);
+        e->params.opcode = rx->opcode;
+        e->params.model = model;
+        e->params.ctx = rx_ctx(n, rx, model);
+        return;
+    }
+    e = evt_post(n, EVT_CFG_CLI, ESP_BLE_MESH_CFG_CLIENT_SET_STATE_EVT, NULL, 0);
+    e->params = params;
+    if (rx->opcode == ESP_BLE_MESH_MODEL_OP_APP_KEY_STATUS && rx->len >= 4) {
+        uint32_t idx = rx->data[1] | rx->data[2] << 8 | rx->data[3] << 16;
+
+        e->param.cfg_cli.status_cb.appkey_status.status = rx->data[0];
+        e->param.cfg_cli.status_cb.appkey_status.net_idx = idx & 0xFFF;
+        e->param.cfg_cli.status_cb.appkey_status.app_idx = idx >> 12;
+    }
+}
+
+/* Generic OnOff */
+
+static bool tid_seen(mesh_node_t *n, esp_ble_mesh_model_t *model, const rx_msg_t *rx, uint8_t tid)
+{
+    uint64_t now = sim_now_us();
+    tid_t *slot = &n->tid[0];
+
+    for (int i = 0; i < TID_SLOTS; i++) {
+        if (n->tid[i].model == model) {
+            slot = &n->tid[i];
+            break;
+        }
+        if (n->tid[i].us < slot->us) {
+            slot = &n->tid[i];
+        }
+    }
+    if (slot->model == model && slot->src == rx->src && slot->dst == rx->dst && slot->tid == tid &&
+            now - slot->us < TID_TIMEOUT_MS * 1000ULL) {
+        return true;
+    }
+    slot->model = model;
+    slot->src = rx->src;
+    slot->dst = rx->dst;
+    slot->tid = tid;
+    slot->us = now;
+    return false;
+}
+
+static void gen_srv_recv(mesh_node_t *n, esp_ble_mesh_model_t *model, const rx_msg_t *rx)
+{
+    esp_ble_mesh_gen_onoff_srv_t *srv = model->user_data;
+    esp_ble_mesh_server_recv_gen_onoff_set_t set = { 0 };
+    comp_t comp = { .kind = COMP_NONE };
+    esp_ble_mesh_msg_ctx_t ctx = rx_ctx(n, rx, model);
+    evt_t *e;
+
+    switch (rx->opcode) {
+    case ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_GET:
+        if (srv->rsp_ctrl.get_auto_rsp == ESP_BLE_MESH_SERVER_RSP_BY_APP) {
+            e = evt_post(n, EVT_GEN_SRV, ESP_BLE_MESH_GENERIC_SERVER_RECV_GET_MSG_EVT, NULL, 0);
+            e->param.gen_srv.model = model;
+            e->param.gen_srv.ctx = ctx;
+            return;
+        }
+        access_send(n, model, rx->src, rx->app_idx, ctx.send_ttl, ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_STATUS,
+                    &srv->state.onoff, 1, &comp);
+        return;
+    case ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET:
+    case ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET_UNACK:
+        if (rx->len < 2 || rx->data[0] > 1) {
+            return;
+        }
+        set.onoff = rx->data[0];
+        set.tid = rx->data[1];
+        if (rx->len >= 4) {
+            set.op_en = true;
+            set.trans_time = rx->data[2];
+            set.delay = rx->data[3];
+        }
+        if (srv->rsp_ctrl.set_auto_rsp == ESP_BLE_MESH_SERVER_RSP_BY_APP) {
+            e = evt_post(n, EVT_GEN_SRV, ESP_BLE_MESH_GENERIC_SERVER_RECV_SET_MSG_EVT, NULL, 0);
+            e->param.gen_srv.model = model;
+            e->param.gen_srv.ctx = ctx;
+            e->param.gen_srv.value.set.onoff = set;
+            return;
+        }
+        if (tid_seen(n, model, rx, set.tid)) {
+            return;
+        }
+        srv->state.onoff = srv->state.target_onoff = set.onoff;
+        if (rx->opcode == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET) {
+            access_send(n, model, rx->src, rx->app_idx, ctx.send_ttl, ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_STATUS,
+                        &srv->state.onoff, 1, &comp);
+        }
+        if (model->pub && model->pub->publish_addr != ESP_BLE_MESH_ADDR_UNASSIGNED) {
+            access_send(n, model, model->pub->publish_addr, model->pub->app_idx, model->pub->ttl,
+                        ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_STATUS, &srv->state.onoff, 1, &comp);
+        }
+        e = evt_post(n, EVT_GEN_SRV, ESP_BLE_MESH_GENERIC_SERVER_STATE_CHANGE_EVT, NULL, 0);
+        e->param.gen_srv.model = model;
+        e->param.gen_srv.ctx = ctx;
+        e->param.gen_srv.value.state_change.onoff_set.onoff = set.onoff;
+        return;
+    default:
+        return;
+    }
+}
+
+static void gen_cli_recv(mesh_node_t *n, esp_ble_mesh_model_t *model, const rx_msg_t *rx)
+{
+    esp_ble_mesh_client_common_param_t params;
+    int event;
+    evt_t *e;
+
+    if (rx->opcode != ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_STATUS || rx->len < 1) {
+        return;
+    }
+    if (req_take(n, REQ_GEN, model, rx, &params)) {
+        event = params.opcode == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_GET ? ESP_BLE_MESH_GENERIC_CLIENT_GET_STATE_EVT :
+                ESP_BLE_MESH_GENERIC_CLIENT_SET_STATE_EVT;
+    } else {
+        event = ESP_BLE_MESH_GENERIC_CLIENT_PUBLISH_EVT;
+        params.opcode = rx->opcode;
+        params.model = model;
+        params.ctx = rx_ctx(n, rx, model);
+    }
+    e = evt_post(n, EVT_GEN_CLI, event, NULL, 0);
+    e->params = params;
+    e->param.gen_cli.status_cb.onoff_status.present_onoff = rx->data[0];
+    if (rx->len >= 3) {
+        e->param.gen_cli.status_cb.onoff_status.op_en = true;
+        e->param.gen_cli.status_cb.onoff_status.target_onoff = rx->data[1];
+        e->param.gen_cli.status_cb.onoff_status.remain_time = rx->data[2];
+    }
+}
+
+static void model_recv(mesh_node_t *n, esp_ble_mesh_model_t *model, const rx_msg_t *rx)
+{
+    bool sig = model_is_sig(model);
+    bool config = sig && (model->model_id == ESP_BLE_MESH_MODEL_ID_CONFIG_SRV ||
+                          model->model_id == ESP_BLE_MESH_MODEL_ID_CONFIG_CLI);
+
+    /* Configuration models only take the device key, the others their bound AppKey */
+    if (config != (rx->app_idx == DEV_KEY_IDX) || (!config && model->keys[0] != rx->app_idx)) {
+        return;
+    }
+    if (sig) {
+        switch (model->model_id) {
+        case ESP_BLE_MESH_MODEL_ID_CONFIG_SRV:
+            cfg_srv_recv(n, model, rx, true);
+            return;
+        case ESP_BLE_MESH_MODEL_ID_CONFIG_CLI:
+            cfg_cli_recv(n, model, rx);
+            return;
+        case ESP_BLE_MESH_MODEL_ID_GEN_ONOFF_SRV:
+            gen_srv_recv(n, model, rx);
+            return;
+        case ESP_BLE_MESH_MODEL_ID_GEN_ONOFF_CLI:
+            gen_cli_recv(n, model, rx);
+            return;
+        default:
+            break;
+        }
+    }
+    for (const esp_ble_mesh_model_op_t *op = model->op; op && op->opcode; op++) {
+        if (op->opcode == rx->opcode) {
+            if (rx->len >= op->min_len) {
+                vnd_recv(n, model, rx);
+            }
+            return;
+        }
+    }
+}
+
+static void access_dispatch(void *arg)
+{
+    mesh_node_t *n = self();
+    rx_msg_t *rx = arg;
+    bool unicast = ESP_BLE_MESH_ADDR_IS_UNICAST(rx->dst);
+
+    if (!n->provisioned) {
+        return;
+    }
+    stats.access_rx++;
+    if (msg_hook) {
+        msg_hook(n->index, true, rx->opcode, rx->src, rx->dst, rx->data, rx->len);
+    }
+    for (size_t i = 0; i < n->comp->element_count; i++) {
+        esp_ble_mesh_elem_t *elem = &n->comp->elements[i];
+
+        /* The all-nodes address reaches the primary element */
+        if (unicast ? elem->element_addr != rx->dst : (rx->dst == ESP_BLE_MESH_ADDR_ALL_NODES && i)) {
+            continue;
+        }
+        for (int j = 0; j < elem->sig_model_count + elem->vnd_model_count; j++) {
+            esp_ble_mesh_model_t *model = j < elem->sig_model_count ? &elem->sig_models[j] :
+                                          &elem->vnd_models[j - elem->sig_model_count];
+
+            if (!unicast && rx->dst != ESP_BLE_MESH_ADDR_ALL_NODES &&
+                    !esp_ble_mesh_is_model_subscribed_to_group(model, rx->dst)) {
+                continue;
+            }
+            model_recv(n, model, rx);
+        }
+    }
+}
+
+static bool net_recv(mesh_node_t *n, const sim_pdu_t *pdu)
+{
+    bool own = elem_of(n, pdu->dst) >= 0;
+
+    if (!n->provisioned || elem_of(n, pdu->src) >= 0) {
+        return false;
+    }
+    if (own || pdu->dst == ESP_BLE_MESH_ADDR_ALL_NODES ||
+            (ESP_BLE_MESH_ADDR_IS_GROUP(pdu->dst) && subscribed(n, pdu->dst))) {
+        trans_recv(n, pdu);
+    }
+    return !own && n->cfg_srv->relay == ESP_BLE_MESH_RELAY_ENABLED;
+}
+
+/* PB-ADV */
+
+static void beacon_send(sim_timer_t *timer)
+{
+    mesh_node_t *n = self();
+    sim_pdu_t pdu = { .type = SIM_AD_BEACON, .len = 19 };
+
+    if (!n->beaconing || n->provisioned || n->dev_link.active) {
+        return;
+    }
+    pdu.data[0] = 0x00;     /* Unprovisioned Device beacon */
+    memcpy(pdu.data + 1, n->prov->uuid, 16);
+    sim_radio_send(n->index, &pdu, 1, 20, sim_now_us());
+    sim_timer_start(&n->beacon, BEACON_INTERVAL_MS * 1000);
+}
+
+static void beacon_start(mesh_node_t *n, bool random_phase)
+{
+    if (!n->beaconing || n->provisioned || sim_timer_armed(&n->beacon)) {
+        return;
+    }
+    sim_timer_start(&n->beacon, random_phase ? host_rand(&rng) % (BEACON_INTERVAL_MS * 1000) : 0);
+}
+
+static void pb_send(mesh_node_t *n, pb_link_t *link, uint8_t txn, const uint8_t *gp, uint8_t gp_len,
+                    uint8_t count)
+{
+    sim_pdu_t pdu = { .type = SIM_AD_PROV, .len = 5 + gp_len };
+
+    TEST_ASSERT(pdu.len <= sizeof(pdu.data));
+    put_be32(pdu.data, link->link_id);
+    pdu.data[4] = txn;
+    memcpy(pdu.data + 5, gp, gp_len);
+    sim_radio_send(n->index, &pdu, count, 20, sim_now_us());
+}
+
+static void pb_ctl(mesh_node_t *n, pb_link_t *link, uint8_t op, const uint8_t *data, uint8_t len, uint8_t count)
+{
+    uint8_t gp[1 + 16] = { op << 2 | GPCF_CTL };
+
+    memcpy(gp + 1, data, len);
+    pb_send(n, link, 0, gp, 1 + len, count);
+}
+
+static void pb_tx(mesh_node_t *n, pb_link_t *link)
+{
+    uint8_t gp[24];
+    uint8_t first = link->tx_len < 20 ? link->tx_len : 20;
+    uint8_t seg_n = link->tx_len <= 20 ? 0 : (link->tx_len - 20 + 22) / 23;
+
+    gp[0] = seg_n << 2 | GPCF_START;
+    put_be16(gp + 1, link->tx_len);
+    gp[3] = 0x00;           /* FCS */
+    memcpy(gp + 4, link->tx, first);
+    pb_send(n, link, link->tx_txn, gp, 4 + first, 1);
+    for (uint8_t i = 1, off = first; off < link->tx_len; i++, off += 23) {
+        uint8_t len = link->tx_len - off < 23 ? link->tx_len - off : 23;
+
+        gp[0] = i << 2 | GPCF_CONT;
+        memcpy(gp + 1, link->tx + off, len);
+        pb_send(n, link, link->tx_txn, gp, 1 + len, 1);
+    }
+    sim_timer_start(&link->retx, PB_RETX_MS * 1000);
+}
+
+static void pb_pdu_send(mesh_node_t *n, pb_link_t *link, uint8_t type)
+{
+    link->tx_txn = link->txn_next++;
+    if (link->provisioner && link->txn_next == 0x80) {
+        link->txn_next = 0x00;
+    } else if (!link->provisioner && link->txn_next == 0x00) {
+        link->txn_next = 0x80;
+    }
+    /* Only the type and the length matter, there is no key exchange */
+    memset(link->tx, 0, sizeof(link->tx));
+    link->tx[0] = type;
+    link->tx_len = prov_pdu_len[type];
+    link->tx_busy = true;
+    if (type == PROV_CAPS) {
+        link->tx[1] = n->comp->element_count;
+    } else if (type == PROV_DATA) {
+        put_be16(link->tx + 1 + 16, n->prov_net_idx);
+        link->tx[19] = n->flags;
+        put_be32(link->tx + 20, n->iv_index);
+        put_be16(link->tx + 24, link->addr);
+    }
+    pb_tx(n, link);
+    sim_timer_start(&link->timeout, PB_TIMEOUT_MS * 1000);
+}
+
+static void pb_end(mesh_node_t *n, pb_link_t *link, uint8_t reason)
+{
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+
+    sim_timer_stop(&link->retx);
+    sim_timer_stop(&link->timeout);
+    sim_timer_stop(&link->ecdh);
+    link->active = false;
+    if (link->provisioner) {
+        if (reason != CLOSE_SUCCESS) {
+            stats.prov_link_fail++;
+        }
+        param.provisioner_prov_link_close.bearer = ESP_BLE_MESH_PROV_ADV;
+        param.provisioner_prov_link_close.reason = reason;
+        prov_evt(n, ESP_BLE_MESH_PROVISIONER_PROV_LINK_CLOSE_EVT, &param);
+        return;
+    }
+    if (link->opened) {
+        param.node_prov_link_close.bearer = ESP_BLE_MESH_PROV_ADV;
+        prov_evt(n, ESP_BLE_MESH_NODE_PROV_LINK_CLOSE_EVT, &param);
+    }
+    beacon_start(n, true);
+}
+
+static void pb_close(mesh_node_t *n, pb_link_t *link, uint8_t reason)
+{
+    pb_ctl(n, link, LINK_CLOSE, &reason, 1, 3);
+    pb_end(n, link, reason);
+}
+
+static void pb_retx(sim_timer_t *timer)
+{
+    pb_link_t *link = (pb_link_t *)((char *)timer - offsetof(pb_link_t, retx));
+    mesh_node_t *n = self();
+
+    if (!link->active) {
+        return;
+    }
+    if (link->provisioner && !link->opened) {
+        pb_ctl(n, link, LINK_OPEN, link->uuid, 16, 1);
+        sim_timer_start(&link->retx, PB_RETX_MS * 1000);
+    } else if (link->tx_busy) {
+        pb_tx(n, link);
+    }
+}
+
+static void pb_timeout(sim_timer_t *timer)
+{
+    pb_link_t *link = (pb_link_t *)((char *)timer - offsetof(pb_link_t, timeout));
+
+    if (link->active) {
+        pb_close(self(), link, CLOSE_TIMEOUT);
+    }
+}
+
+static void pb_ecdh(sim_timer_t *timer)
+{
+    pb_link_t *link = (pb_link_t *)((char *)timer - offsetof(pb_link_t, ecdh));
+
+    if (link->active) {
+        pb_pdu_send(self(), link, link->provisioner ? PROV_CONFIRM : PROV_PUB_KEY);
+    }
+}
+
+static void dev_provisioned(mesh_node_t *n, uint16_t net_idx, uint16_t addr, uint8_t flags, uint32_t iv_index)
+{
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+
+    n->provisioned = true;
+    n->addr = addr;
+    n->net_idx = net_idx;
+    n->flags = flags;
+    n->iv_index = iv_index;
+    for (size_t i = 0; i < n->comp->element_count; i++) {
+        n->comp->elements[i].element_addr = addr + i;
+    }
+    sim_timer_stop(&n->beacon);
+
+    param.node_prov_complete.net_idx = net_idx;
+    param.node_prov_complete.addr = addr;
+    param.node_prov_complete.flags = flags;
+    param.node_prov_complete.iv_index = iv_index;
+    prov_evt(n, ESP_BLE_MESH_NODE_PROV_COMPLETE_EVT, &param);
+    if (prov_hook) {
+        prov_hook(n->index, addr);
+    }
+}
+
+static void pb_dev_pdu(mesh_node_t *n, pb_link_t *link, const uint8_t *pdu)
+{
+    switch (pdu[0]) {
+    case PROV_INVITE:
+        pb_pdu_send(n, link, PROV_CAPS);
+        link->expect = PROV_START;
+        break;
+    case PROV_START:
+        link->expect = PROV_PUB_KEY;
+        break;
+    case PROV_PUB_KEY:
+        sim_timer_start(&link->ecdh, PB_ECDH_MS * 1000);
+        link->expect = PROV_CONFIRM;
+        break;
+    case PROV_CONFIRM:
+        pb_pdu_send(n, link, PROV_CONFIRM);
+        link->expect = PROV_RANDOM;
+        break;
+    case PROV_RANDOM:
+        pb_pdu_send(n, link, PROV_RANDOM);
+        link->expect = PROV_DATA;
+        break;
+    case PROV_DATA:
+        link->expect = PROV_NONE;
+        pb_pdu_send(n, link, PROV_COMPLETE);
+        dev_provisioned(n, get_be16(pdu + 17), get_be16(pdu + 24), pdu[19], get_be32(pdu + 20));
+        break;
+    }
+}
+
+static void pb_prov_pdu(mesh_node_t *n, pb_link_t *link, const uint8_t *pdu)
+{
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+
+    switch (pdu[0]) {
+    case PROV_CAPS:
+        link->elements = pdu[1] ? pdu[1] : 1;
+        pb_pdu_send(n, link, PROV_START);
+        link->next_len = 1;
+        link->next[0] = PROV_PUB_KEY;
+        link->expect = PROV_PUB_KEY;
+        break;
+    case PROV_PUB_KEY:
+        sim_timer_start(&link->ecdh, PB_ECDH_MS * 1000);
+        link->expect = PROV_CONFIRM;
+        break;
+    case PROV_CONFIRM:
+        pb_pdu_send(n, link, PROV_RANDOM);
+        link->expect = PROV_RANDOM;
+        break;
+    case PROV_RANDOM:
+        if (n->alloc_next + link->elements - 1 > n->alloc_max || !n->alloc_next) {
+            pb_close(n, link, CLOSE_FAIL);
+            return;
+        }
+        link->addr = n->alloc_next;
+        n->alloc_next += link->elements;
+        pb_pdu_send(n, link, PROV_DATA);
+        link->expect = PROV_COMPLETE;
+        break;
+    case PROV_COMPLETE:
+        link->expect = PROV_NONE;
+        param.provisioner_prov_complete.node_idx = n->node_idx++;
+        param.provisioner_prov_complete.prov_bearer = ESP_BLE_MESH_PROV_ADV;
+        memcpy(param.provisioner_prov_complete.device_uuid, link->uuid, 16);
+        param.provisioner_prov_complete.unicast_addr = link->addr;
+        param.provisioner_prov_complete.element_num = link->elements;
+        param.provisioner_prov_complete.netkey_idx = n->prov_net_idx;
+        prov_evt(n, ESP_BLE_MESH_PROVISIONER_PROV_COMPLETE_EVT, &param);
+        pb_close(n, link, CLOSE_SUCCESS);
+        break;
+    }
+}
+
+static void pb_seg(mesh_node_t *n, pb_link_t *link, uint8_t txn, const uint8_t *gp, uint8_t gp_len)
+{
+    uint8_t ack = GPCF_ACK;
+
+    if (link->rx_done && txn == link->rx_txn) {
+        pb_send(n, link, txn, &ack, 1, 1);
+        return;
+    }
+    if (!link->rx_busy || txn != link->rx_txn) {
+        link->rx_busy = true;
+        link->rx_done = false;
+        link->rx_txn = txn;
+        link->rx_got = 0;
+        link->rx_seg_n = 0xFF;
+    }
+    if ((gp[0] & 0x03) == GPCF_START) {
+        if (gp_len < 4 || get_be16(gp + 1) > PB_BUF || gp_len - 4 > 20) {
+            return;
+        }
+        link->rx_seg_n = gp[0] >> 2;
+        link->rx_len = get_be16(gp + 1);
+        memcpy(link->rx, gp + 4, gp_len - 4);
+        link->rx_got |= BIT(0);
+    } else {
+        uint8_t idx = gp[0] >> 2;
+        uint16_t off = 20 + (idx - 1) * 23;
+
+        if (!idx || gp_len < 2 || off + gp_len - 1 > PB_BUF) {
+            return;
+        }
+        memcpy(link->rx + off, gp + 1, gp_len - 1);
+        link->rx_got |= BIT(idx);
+    }
+    if (link->rx_seg_n == 0xFF || link->rx_got != seg_mask(link->rx_seg_n)) {
+        return;
+    }
+    link->rx_busy = false;
+    link->rx_done = true;
+    pb_send(n, link, txn, &ack, 1, 1);
+    if (!link->rx_len || link->rx[0] != link->expect) {
+        return;
+    }
+    sim_timer_start(&link->timeout, PB_TIMEOUT_MS * 1000);
+    if (link->provisioner) {
+        pb_prov_pdu(n, link, link->rx);
+    } else {
+        pb_dev_pdu(n, link, link->rx);
+    }
+}
+
+static pb_link_t *pb_find(mesh_node_t *n, uint32_t link_id)
+{
+    if (n->dev_link.active && n->dev_link.link_id == link_id) {
+        return &n->dev_link;
+    }
+    for (int i = 0; i < PB_LINKS_MAX; i++) {
+        if (n->links[i].active && n->links[i].link_id == link_id) {
+            return &n->links[i];
+        }
+    }
+    return NULL;
+}
+
+static void pb_open_recv(mesh_node_t *n, uint32_t link_id, const uint8_t *uuid)
+{
+    pb_link_t *link = &n->dev_link;
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+
+    if (!n->beaconing || n->provisioned || !n->prov || !n->prov->uuid || memcmp(uuid, n->prov->uuid, 16)) {
+        return;
+    }
+    if (link->active) {
+        /* The Link Ack got lost */
+        if (link->link_id == link_id) {
+            pb_ctl(n, link, LINK_ACK, NULL, 0, 1);
+        }
+        return;
+    }
+    memset(link, 0, offsetof(pb_link_t, retx));
+    link->active = true;
+    link->opened = true;
+    link->link_id = link_id;
+    link->txn_next = 0x80;
+    link->expect = PROV_INVITE;
+    sim_timer_stop(&n->beacon);
+    sim_timer_start(&link->timeout, PB_TIMEOUT_MS * 1000);
+    pb_ctl(n, link, LINK_ACK, NULL, 0, 1);
+
+    param.node_prov_link_open.bearer = ESP_BLE_MESH_PROV_ADV;
+    prov_evt(n, ESP_BLE_MESH_NODE_PROV_LINK_OPEN_EVT, &param);
+}
+
+static void pb_recv(mesh_node_t *n, const sim_pdu_t *pdu)
+{
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+    uint32_t link_id;
+    const uint8_t *gp;
+    uint8_t gp_len, txn;
+    pb_link_t *link;
+
+    if (pdu->len < 6) {
+        return;
+    }
+    link_id = get_be32(pdu->data);
+    txn = pdu->data[4];
+    gp = pdu->data + 5;
+    gp_len = pdu->len - 5;
+
+    if ((gp[0] & 0x03) == GPCF_CTL && gp[0] >> 2 == LINK_OPEN) {
+        if (gp_len >= 17) {
+            pb_open_recv(n, link_id, gp + 1);
+        }
+        return;
+    }
+    link = pb_find(n, link_id);
+    if (!link) {
+        return;
+    }
+    switch (gp[0] & 0x03) {
+    case GPCF_CTL:
+        if (gp[0] >> 2 == LINK_ACK && link->provisioner && !link->opened) {
+            link->opened = true;
+            stats.prov_links++;
+            sim_timer_stop(&link->retx);
+            param.provisioner_prov_link_open.bearer = ESP_BLE_MESH_PROV_ADV;
+            prov_evt(n, ESP_BLE_MESH_PROVISIONER_PROV_LINK_OPEN_EVT, &param);
+            pb_pdu_send(n, link, PROV_INVITE);
+            link->expect = PROV_CAPS;
+        } else if (gp[0] >> 2 == LINK_CLOSE) {
+            pb_end(n, link, gp_len > 1 ? gp[1] : CLOSE_FAIL);
+        }
+        break;
+    case GPCF_ACK:
+        if (link->tx_busy && txn == link->tx_txn) {
+            link->tx_busy = false;
+            sim_timer_stop(&link->retx);
+            if (link->next_len) {
+                link->next_len = 0;
+                pb_pdu_send(n, link, link->next[0]);
+            }
+        }
+        break;
+    default:
+        if (link->opened) {
+            pb_seg(n, link, txn, gp, gp_len);
+        }
+        break;
+    }
+}
+
+static void beacon_recv(mesh_node_t *n, const sim_pdu_t *pdu)
+{
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+    const uint8_t *uuid = pdu->data + 1;
+
+    if (!n->prov_enabled || n->prov_suspended || pdu->len < 19 || pdu->data[0] != 0x00) {
+        return;
+    }
+    if (n->match_len && (n->match_offset + n->match_len > 16 ||
+                         memcmp(uuid + n->match_offset, n->match_val, n->match_len))) {
+        return;
+    }
+    for (int i = 0; i < PB_LINKS_MAX; i++) {
+        if (n->links[i].active && !memcmp(n->links[i].uuid, uuid, 16)) {
+            return;
+        }
+    }
+    memcpy(param.provisioner_recv_unprov_adv_pkt.dev_uuid, uuid, 16);
+    memcpy(param.provisioner_recv_unprov_adv_pkt.addr, uuid + 2, BLE_MESH_ADDR_LEN);
+    param.provisioner_recv_unprov_adv_pkt.oob_info = get_be16(pdu->data + 17);
+    param.provisioner_recv_unprov_adv_pkt.bearer = ESP_BLE_MESH_PROV_ADV;
+    param.provisioner_recv_unprov_adv_pkt.rssi = RSSI;
+    prov_evt(n, ESP_BLE_MESH_PROVISIONER_RECV_UNPROV_ADV_PKT_EVT, &param);
+}
+
+static bool radio_recv(uint32_t node, const sim_pdu_t *pdu, uint64_t now_us)
+{
+    mesh_node_t *n = &mesh[node];
+    void *prev;
+    bool relay = false;
+
+    if (!n->comp) {
+        return false;
+    }
+    prev = sim_node_enter(node);
+    switch (pdu->type) {
+    case SIM_AD_MESH:
+        relay = net_recv(n, pdu);
+        break;
+    case SIM_AD_PROV:
+        pb_recv(n, pdu);
+        break;
+    case SIM_AD_BEACON:
+        beacon_recv(n, pdu);
+        break;
+    }
+    sim_node_leave(prev);
+    return relay;
+}
+
+/* Simulation side */
+
+int sim_mesh_init(const sim_radio_config_t *config)
+{
+    int err = sim_radio_init(config, radio_recv);
+
+    if (err) {
+        return err;
+    }
+    mesh = calloc(config->nodes, sizeof(mesh_node_t));
+    TEST_ASSERT(mesh);
+    mesh_cnt = config->nodes;
+    rng = config->seed ^ 0x6D657368;
+    if (!rng) {
+        rng = 1;
+    }
+    memset(&stats, 0, sizeof(stats));
+    for (uint32_t i = 0; i < mesh_cnt; i++) {
+        mesh_node_t *n = &mesh[i];
+
+        n->index = i;
+        n->pba_links = PB_LINKS_DEFAULT;
+        sim_timer_init(&n->beacon, i, beacon_send);
+        sim_timer_init(&n->dev_link.retx, i, pb_retx);
+        sim_timer_init(&n->dev_link.timeout, i, pb_timeout);
+        sim_timer_init(&n->dev_link.ecdh, i, pb_ecdh);
+        for (int j = 0; j < PB_LINKS_MAX; j++) {
+            sim_timer_init(&n->links[j].retx, i, pb_retx);
+            sim_timer_init(&n->links[j].timeout, i, pb_timeout);
+            sim_timer_init(&n->links[j].ecdh, i, pb_ecdh);
+        }
+        for (int j = 0; j < SEG_SLOTS; j++) {
+            sim_timer_init(&n->seg_tx[j].retx, i, seg_tx_retx);
+            sim_timer_init(&n->seg_rx[j].ack, i, seg_rx_ack);
+            sim_timer_init(&n->seg_rx[j].timeout, i, seg_rx_timeout);
+        }
+        for (int j = 0; j < CLI_SLOTS; j++) {
+            sim_timer_init(&n->req[j].timeout, i, req_timeout);
+        }
+    }
+    return 0;
+}
+
+void sim_mesh_free(void)
+{
+    free(mesh);
+    mesh = NULL;
+    mesh_cnt = 0;
+    msg_hook = NULL;
+    prov_hook = NULL;
+    sim_radio_free();
+}
+
+void sim_mesh_set_msg_hook(sim_mesh_msg_hook_t hook)
+{
+    msg_hook = hook;
+}
+
+void sim_mesh_set_prov_hook(sim_mesh_prov_hook_t hook)
+{
+    prov_hook = hook;
+}
+
+void sim_mesh_set_pba_links(uint32_t node, uint8_t links)
+{
+    TEST_ASSERT(node < mesh_cnt && links && links <= PB_LINKS_MAX);
+    mesh[node].pba_links = links;
+}
+
+uint16_t sim_mesh_addr(uint32_t node)
+{
+    TEST_ASSERT(node < mesh_cnt);
+    return mesh[node].provisioned ? mesh[node].addr : ESP_BLE_MESH_ADDR_UNASSIGNED;
+}
+
+void sim_mesh_get_stats(sim_mesh_stats_t *out)
+{
+    *out = stats;
+}
+
+enum {
+    PHONE_PROVISION,
+    PHONE_APP_KEY_ADD,
+    PHONE_BIND,
+    PHONE_SUB_ADD,
+    PHONE_PUB_SET,
+    PHONE_RELAY,
+};
+
+typedef struct {
+    uint8_t op;
+    uint16_t addr;
+    uint16_t company_id;
+    uint16_t model_id;
+    uint16_t value;
+    uint16_t app_idx;
+    uint8_t ttl;
+} phone_t;
+
+/* The phone message as the Configuration Server would receive it */
+static void phone_cfg(mesh_node_t *n, uint32_t opcode, const esp_ble_mesh_cfg_client_set_state_t *set)
+{
+    rx_msg_t *rx = calloc(1, sizeof(rx_msg_t) + ACCESS_MAX);
+
+    TEST_ASSERT(rx);
+    rx->src = PHONE_ADDR;
+    rx->dst = n->addr;
+    rx->ttl = n->cfg_srv->default_ttl;
+    rx->app_idx = DEV_KEY_IDX;
+    rx->opcode = opcode;
+    rx->len = cfg_msg_put(rx->data, opcode, set);
+    cfg_srv_recv(n, n->cfg_srv_model, rx, false);
+    free(rx);
+}
+
+static void phone_run(void *arg)
+{
+    mesh_node_t *n = self();
+    phone_t *p = arg;
+    esp_ble_mesh_cfg_client_set_state_t set = { 0 };
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+    esp_ble_mesh_model_t *model;
+
+    TEST_ASSERT(n->comp);
+    switch (p->op) {
+    case PHONE_PROVISION:
+        TEST_ASSERT(!n->provisioned && !n->dev_link.active);
+        param.node_prov_link_open.bearer = ESP_BLE_MESH_PROV_GATT;
+        prov_evt(n, ESP_BLE_MESH_NODE_PROV_LINK_OPEN_EVT, &param);
+        dev_provisioned(n, ESP_BLE_MESH_KEY_PRIMARY, p->addr, 0, 0);
+        param.node_prov_link_close.bearer = ESP_BLE_MESH_PROV_GATT;
+        prov_evt(n, ESP_BLE_MESH_NODE_PROV_LINK_CLOSE_EVT, &param);
+        break;
+    case PHONE_APP_KEY_ADD:
+        set.app_key_add.net_idx = n->net_idx;
+        set.app_key_add.app_idx = p->app_idx;
+        memset(set.app_key_add.app_key, 0x12, 16);
+        phone_cfg(n, ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD, &set);
+        break;
+    case PHONE_BIND:
+        set.model_app_bind.element_addr = p->addr;
+        set.model_app_bind.model_app_idx = p->app_idx;
+        set.model_app_bind.company_id = p->company_id;
+        set.model_app_bind.model_id = p->model_id;
+        phone_cfg(n, ESP_BLE_MESH_MODEL_OP_MODEL_APP_BIND, &set);
+        break;
+    case PHONE_SUB_ADD:
+        set.model_sub_add.element_addr = p->addr;
+        set.model_sub_add.sub_addr = p->value;
+        set.model_sub_add.company_id = p->company_id;
+        set.model_sub_add.model_id = p->model_id;
+        phone_cfg(n, ESP_BLE_MESH_MODEL_OP_MODEL_SUB_ADD, &set);
+        break;
+    case PHONE_PUB_SET:
+        model = model_find(n, p->addr, p->company_id, p->model_id);
+        TEST_ASSERT(model && model->pub);
+        model->pub->publish_addr = p->value;
+        model->pub->app_idx = p->app_idx;
+        model->pub->ttl = p->ttl;
+        break;
+    case PHONE_RELAY:
+        n->cfg_srv->relay = p->value ? ESP_BLE_MESH_RELAY_ENABLED : ESP_BLE_MESH_RELAY_DISABLED;
+        break;
+    }
+}
+
+static phone_t *phone_post(uint32_t node, uint8_t op)
+{
+    phone_t *p;
+
+    TEST_ASSERT(node < mesh_cnt);
+    p = sim_node_post(node, phone_run, sizeof(phone_t));
+    p->op = op;
+    return p;
+}
+
+void sim_mesh_phone_provision(uint32_t node, uint16_t addr)
+{
+    phone_post(node, PHONE_PROVISION)->addr = addr;
+}
+
+void sim_mesh_phone_app_key_add(uint32_t node, uint16_t app_idx)
+{
+    phone_post(node, PHONE_APP_KEY_ADD)->app_idx = app_idx;
+}
+
+void sim_mesh_phone_bind(uint32_t node, uint16_t elem_addr, uint16_t company_id, uint16_t model_id,
+                         uint16_t app_idx)
+{
+    phone_t *p = phone_post(node, PHONE_BIND);
+
+    p->addr = elem_addr;
+    p->company_id = company_id;
+    p->model_id = model_id;
+    p->app_idx = app_idx;
+}
+
+void sim_mesh_phone_sub_add(uint32_t node, uint16_t elem_addr, uint16_t company_id, uint16_t model_id,
+                            uint16_t group)
+{
+    phone_t *p = phone_post(node, PHONE_SUB_ADD);
+
+    p->addr = elem_addr;
+    p->company_id = company_id;
+    p->model_id = model_id;
+    p->value = group;
+}
+
+void sim_mesh_phone_pub_set(uint32_t node, uint16_t elem_addr, uint16_t company_id, uint16_t model_id,
+                            uint16_t pub_addr, uint16_t app_idx, uint8_t ttl)
+{
+    phone_t *p = phone_post(node, PHONE_PUB_SET);
+
+    p->addr = elem_addr;
+    p->company_id = company_id;
+    p->model_id = model_id;
+    p->value = pub_addr;
+    p->app_idx = app_idx;
+    p->ttl = ttl;
+}
+
+void sim_mesh_phone_relay(uint32_t node, bool enable)
+{
+    phone_post(node, PHONE_RELAY)->value = enable;
+}
+
+/* esp_ble_mesh_common_api.h */
+
+esp_err_t esp_ble_mesh_init(esp_ble_mesh_prov_t *prov, esp_ble_mesh_comp_t *comp)
+{
+    mesh_node_t *n = self();
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+
+    if (n->comp || !prov || !comp || !comp->element_count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < comp->element_count; i++) {
+        esp_ble_mesh_elem_t *elem = &comp->elements[i];
+
+        elem->element_addr = ESP_BLE_MESH_ADDR_UNASSIGNED;
+        for (int j = 0; j < elem->sig_model_count + elem->vnd_model_count; j++) {
+            bool sig = j < elem->sig_model_count;
+            esp_ble_mesh_model_t *model = sig ? &elem->sig_models[j] : &elem->vnd_models[j - elem->sig_model_count];
+
+            model->element = elem;
+            model->element_idx = i;
+            model->model_idx = sig ? j : j - elem->sig_model_count;
+            model->keys[0] = ESP_BLE_MESH_KEY_UNUSED;
+            memset(model->groups, 0, sizeof(model->groups));
+            if (model->pub) {
+                model->pub->model = model;
+            }
+            if (!sig || !model->user_data) {
+                continue;
+            }
+            switch (model->model_id) {
+            case ESP_BLE_MESH_MODEL_ID_CONFIG_SRV:
+                n->cfg_srv = model->user_data;
+                n->cfg_srv_model = model;
+                break;
+            case ESP_BLE_MESH_MODEL_ID_CONFIG_CLI:
+            case ESP_BLE_MESH_MODEL_ID_GEN_ONOFF_CLI:
+                ((esp_ble_mesh_client_t *)model->user_data)->model = model;
+                break;
+            case ESP_BLE_MESH_MODEL_ID_GEN_ONOFF_SRV:
+                ((esp_ble_mesh_gen_onoff_srv_t *)model->user_data)->model = model;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    if (!n->cfg_srv || n->cfg_srv_model->element_idx) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    n->prov = prov;
+    n->comp = comp;
+    prov_evt(n, ESP_BLE_MESH_PROV_REGISTER_COMP_EVT, &param);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_register_prov_callback(esp_ble_mesh_prov_cb_t callback)
+{
+    self()->prov_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_register_custom_model_callback(esp_ble_mesh_model_cb_t callback)
+{
+    self()->model_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_register_config_client_callback(esp_ble_mesh_cfg_client_cb_t callback)
+{
+    self()->cfg_cli_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_register_config_server_callback(esp_ble_mesh_cfg_server_cb_t callback)
+{
+    self()->cfg_srv_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_register_generic_client_callback(esp_ble_mesh_generic_client_cb_t callback)
+{
+    self()->gen_cli_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_register_generic_server_callback(esp_ble_mesh_generic_server_cb_t callback)
+{
+    self()->gen_srv_cb = callback;
+    return ESP_OK;
+}
+
+/* esp_ble_mesh_local_data_operation_api.h */
+
+uint16_t *esp_ble_mesh_is_model_subscribed_to_group(esp_ble_mesh_model_t *model, uint16_t group_addr)
+{
+    for (int i = 0; i < CONFIG_BLE_MESH_MODEL_GROUP_COUNT; i++) {
+        if (model->groups[i] == group_addr) {
+            return &model->groups[i];
+        }
+    }
+    return NULL;
+}
+
+uint16_t esp_ble_mesh_get_primary_element_address(void)
+{
+    mesh_node_t *n = self();
+
+    return n->provisioned ? n->addr : ESP_BLE_MESH_ADDR_UNASSIGNED;
+}
+
+const esp_ble_mesh_comp_t *esp_ble_mesh_get_composition_data(void)
+{
+    return self()->comp;
+}
+
+esp_err_t esp_ble_mesh_model_subscribe_group_addr(uint16_t element_addr, uint16_t company_id,
+                                                  uint16_t model_id, uint16_t group_addr)
+{
+    esp_ble_mesh_model_t *model = model_find(self(), element_addr, company_id, model_id);
+
+    if (!model || !ESP_BLE_MESH_ADDR_IS_GROUP(group_addr)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return model_sub_add(model, group_addr) ? ESP_ERR_NO_MEM : ESP_OK;
+}
+
+/* esp_ble_mesh_networking_api.h */
+
+esp_err_t esp_ble_mesh_client_model_init(esp_ble_mesh_model_t *model)
+{
+    mesh_node_t *n = self();
+    esp_ble_mesh_client_t *client = model ? model->user_data : NULL;
+
+    if (!client || !client->op_pair || !client->op_pair_size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!is_client(n, model)) {
+        TEST_ASSERT(n->client_cnt < CLIENT_MODELS);
+        n->clients[n->client_cnt++] = model;
+    }
+    client->model = model;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_server_model_send_msg(esp_ble_mesh_model_t *model, esp_ble_mesh_msg_ctx_t *ctx,
+                                             uint32_t opcode, uint16_t length, uint8_t *data)
+{
+    mesh_node_t *n = self_send();
+    comp_t comp = { .kind = COMP_SEND, .opcode = opcode, .model = model };
+    int err;
+
+    if (!model || !ctx) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    comp.ctx = *ctx;
+    err = model->keys[0] != ctx->app_idx ? -EINVAL :
+          access_send(n, model, ctx->addr, ctx->app_idx, ctx->send_ttl, opcode, data, length, &comp);
+    if (err) {
+        comp_post(n, &comp, err);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_client_model_send_msg(esp_ble_mesh_model_t *model, esp_ble_mesh_msg_ctx_t *ctx,
+                                             uint32_t opcode, uint16_t length, uint8_t *data,
+                                             int32_t msg_timeout, bool need_rsp,
+                                             esp_ble_mesh_dev_role_t device_role)
+{
+    mesh_node_t *n = self_send();
+    comp_t comp = { .kind = COMP_SEND, .opcode = opcode, .model = model };
+    esp_ble_mesh_client_common_param_t params = { .opcode = opcode, .model = model, .msg_role = device_role };
+    esp_ble_mesh_client_t *client;
+    uint32_t status_op = 0;
+    int err;
+
+    if (!model || !ctx || !is_client(n, model)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    client = model->user_data;
+    if (need_rsp) {
+        for (uint32_t i = 0; i < client->op_pair_size; i++) {
+            if (client->op_pair[i].cli_op == opcode) {
+                status_op = client->op_pair[i].status_op;
+            }
+        }
+        if (!status_op) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    comp.ctx = params.ctx = *ctx;
+    err = model->keys[0] != ctx->app_idx ? -EINVAL :
+          req_send(n, REQ_VND, &params, ctx->app_idx, status_op, msg_timeout, data, length, &comp);
+    if (err) {
+        comp_post(n, &comp, err);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_model_publish(esp_ble_mesh_model_t *model, uint32_t opcode,
+                                     uint16_t length, uint8_t *data,
+                                     esp_ble_mesh_dev_role_t device_role)
+{
+    mesh_node_t *n = self_send();
+    comp_t comp = { .kind = COMP_PUBLISH, .opcode = opcode, .model = model };
+    esp_ble_mesh_model_pub_t *pub = model ? model->pub : NULL;
+    int err;
+
+    if (!pub) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (pub->publish_addr == ESP_BLE_MESH_ADDR_UNASSIGNED) {
+        err = -EADDRNOTAVAIL;
+    } else if (model->keys[0] != pub->app_idx) {
+        err = -EINVAL;
+    } else {
+        err = access_send(n, model, pub->publish_addr, pub->app_idx, pub->ttl, opcode, data, length, &comp);
+    }
+    if (err) {
+        comp_post(n, &comp, err);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_provisioner_set_node_name(uint16_t index, const char *name)
+{
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+
+    param.provisioner_set_node_name_comp.node_index = index;
+    prov_evt(self(), ESP_BLE_MESH_PROVISIONER_SET_NODE_NAME_COMP_EVT, &param);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_provisioner_add_local_app_key(const uint8_t app_key[16], uint16_t net_idx,
+                                                     uint16_t app_idx)
+{
+    mesh_node_t *n = self();
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+
+    param.provisioner_add_app_key_comp.err_code = app_key_add(n, net_idx, app_idx, app_key);
+    param.provisioner_add_app_key_comp.app_idx = app_idx;
+    prov_evt(n, ESP_BLE_MESH_PROVISIONER_ADD_LOCAL_APP_KEY_COMP_EVT, &param);
+    return ESP_OK;
+}
+
+const uint8_t *esp_ble_mesh_provisioner_get_local_app_key(uint16_t net_idx, uint16_t app_idx)
+{
+    app_key_t *app_key = app_key_find(self(), app_idx);
+
+    return app_key && app_key->net_idx == net_idx ? app_key->key : NULL;
+}
+
+esp_err_t esp_ble_mesh_provisioner_bind_app_key_to_local_model(uint16_t element_addr, uint16_t app_idx,
+                                                               uint16_t model_id, uint16_t company_id)
+{
+    mesh_node_t *n = self();
+    esp_ble_mesh_model_t *model = model_find(n, element_addr, company_id, model_id);
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+
+    if (!model || !app_key_find(n, app_idx)) {
+        param.provisioner_bind_app_key_to_model_comp.err_code = -EINVAL;
+    } else {
+        model->keys[0] = app_idx;
+    }
+    prov_evt(n, ESP_BLE_MESH_PROVISIONER_BIND_APP_KEY_TO_MODEL_COMP_EVT, &param);
+    return ESP_OK;
+}
+
+/* esp_ble_mesh_config_model_api.h and esp_ble_mesh_generic_model_api.h */
+
+esp_err_t esp_ble_mesh_config_client_set_state(esp_ble_mesh_client_common_param_t *params,
+                                               esp_ble_mesh_cfg_client_set_state_t *set_state)
+{
+    mesh_node_t *n = self_send();
+    comp_t comp = { .kind = COMP_NONE };
+    uint8_t data[ACCESS_MAX];
+    uint32_t status_op;
+    uint16_t len;
+    evt_t *e;
+    int err;
+
+    if (!params || !params->model || !set_state) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    switch (params->opcode) {
+    case ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD:
+        status_op = ESP_BLE_MESH_MODEL_OP_APP_KEY_STATUS;
+        break;
+    case ESP_BLE_MESH_MODEL_OP_MODEL_APP_BIND:
+        status_op = ESP_BLE_MESH_MODEL_OP_MODEL_APP_STATUS;
+        break;
+    case ESP_BLE_MESH_MODEL_OP_MODEL_SUB_ADD:
+        status_op = ESP_BLE_MESH_MODEL_OP_MODEL_SUB_STATUS;
+        break;
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    len = cfg_msg_put(data, params->opcode, set_state);
+    err = req_send(n, REQ_CFG, params, DEV_KEY_IDX, status_op, params->msg_timeout, data, len, &comp);
+    if (err) {
+        e = evt_post(n, EVT_CFG_CLI, ESP_BLE_MESH_CFG_CLIENT_SET_STATE_EVT, NULL, 0);
+        e->params = *params;
+        e->param.cfg_cli.error_code = err;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_generic_client_set_state(esp_ble_mesh_client_common_param_t *params,
+                                                esp_ble_mesh_generic_client_set_state_t *set_state)
+{
+    mesh_node_t *n = self_send();
+    comp_t comp = { .kind = COMP_NONE };
+    uint8_t data[4];
+    uint16_t len = 2;
+    evt_t *e;
+    int err;
+
+    if (!params || !params->model || !set_state) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (params->opcode != ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET &&
+            params->opcode != ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET_UNACK) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    data[0] = set_state->onoff_set.onoff;
+    data[1] = set_state->onoff_set.tid;
+    if (set_state->onoff_set.op_en) {
+        data[2] = set_state->onoff_set.trans_time;
+        data[3] = set_state->onoff_set.delay;
+        len = 4;
+    }
+    err = params->model->keys[0] != params->ctx.app_idx ? -EINVAL :
+          req_send(n, REQ_GEN, params, params->ctx.app_idx,
+                   params->opcode == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET ? ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_STATUS : 0,
+                   params->msg_timeout, data, len, &comp);
+    if (err) {
+        e = evt_post(n, EVT_GEN_CLI, ESP_BLE_MESH_GENERIC_CLIENT_SET_STATE_EVT, NULL, 0);
+        e->params = *params;
+        e->param.gen_cli.error_code = err;
+    }
+    return ESP_OK;
+}
+
+/* esp_ble_mesh_provisioning_api.h and esp_ble_mesh_proxy_api.h */
+
+bool esp_ble_mesh_node_is_provisioned(void)
+{
+    return self()->provisioned;
+}
+
+esp_err_t esp_ble_mesh_node_prov_enable(esp_ble_mesh_prov_bearer_t bearers)
+{
+    mesh_node_t *n = self();
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+
+    if (!n->comp) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    n->beaconing = true;
+    beacon_start(n, true);
+    prov_evt(n, ESP_BLE_MESH_NODE_PROV_ENABLE_COMP_EVT, &param);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_provisioner_prov_enable(esp_ble_mesh_prov_bearer_t bearers)
+{
+    mesh_node_t *n = self();
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+
+    if (!n->comp || !ESP_BLE_MESH_ADDR_IS_UNICAST(n->prov->prov_unicast_addr)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* The Provisioner is a node of its own network */
+    n->provisioned = true;
+    n->addr = n->prov->prov_unicast_addr;
+    n->net_idx = n->prov_net_idx = ESP_BLE_MESH_KEY_PRIMARY;
+    n->flags = n->prov->flags;
+    n->iv_index = n->prov->iv_index;
+    for (size_t i = 0; i < n->comp->element_count; i++) {
+        n->comp->elements[i].element_addr = n->addr + i;
+    }
+    n->alloc_next = n->prov->prov_start_address;
+    n->alloc_max = 0x7FFF;
+    n->prov_enabled = true;
+    prov_evt(n, ESP_BLE_MESH_PROVISIONER_PROV_ENABLE_COMP_EVT, &param);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_provisioner_add_unprov_dev(esp_ble_mesh_unprov_dev_add_t *add_dev,
+                                                  esp_ble_mesh_dev_add_flag_t flags)
+{
+    mesh_node_t *n = self();
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+    pb_link_t *link = NULL;
+    int active = 0;
+
+    if (!add_dev || !n->prov_enabled) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < PB_LINKS_MAX; i++) {
+        if (!n->links[i].active) {
+            link = link ? link : &n->links[i];
+            continue;
+        }
+        active++;
+        if (!memcmp(n->links[i].uuid, add_dev->uuid, 16)) {
+            param.provisioner_add_unprov_dev_comp.err_code = -EALREADY;
+        }
+    }
+    if (!param.provisioner_add_unprov_dev_comp.err_code && (active >= n->pba_links || !link)) {
+        param.provisioner_add_unprov_dev_comp.err_code = -EIO;
+    }
+    if (!param.provisioner_add_unprov_dev_comp.err_code && (flags & ADD_DEV_START_PROV_NOW_FLAG)) {
+        memset(link, 0, offsetof(pb_link_t, retx));
+        link->active = true;
+        link->provisioner = true;
+        link->link_id = host_rand(&rng);
+        memcpy(link->uuid, add_dev->uuid, 16);
+        link->txn_next = 0x00;
+        pb_ctl(n, link, LINK_OPEN, link->uuid, 16, 1);
+        sim_timer_start(&link->retx, PB_RETX_MS * 1000);
+        sim_timer_start(&link->timeout, PB_TIMEOUT_MS * 1000);
+    }
+    prov_evt(n, ESP_BLE_MESH_PROVISIONER_ADD_UNPROV_DEV_COMP_EVT, &param);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_provisioner_set_dev_uuid_match(const uint8_t *match_val, uint8_t match_len,
+                                                      uint8_t offset, bool prov_after_match)
+{
+    mesh_node_t *n = self();
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+
+    if (match_len > sizeof(n->match_val) || offset + match_len > 16) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(n->match_val, match_val, match_len);
+    n->match_len = match_len;
+    n->match_offset = offset;
+    prov_evt(n, ESP_BLE_MESH_PROVISIONER_SET_DEV_UUID_MATCH_COMP_EVT, &param);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_set_fast_prov_info(esp_ble_mesh_fast_prov_info_t *fast_prov_info)
+{
+    mesh_node_t *n = self();
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+
+    if (!fast_prov_info || fast_prov_info->match_len > sizeof(n->match_val)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!ESP_BLE_MESH_ADDR_IS_UNICAST(fast_prov_info->unicast_min) ||
+            fast_prov_info->unicast_max < fast_prov_info->unicast_min) {
+        param.set_fast_prov_info_comp.status_unicast = 0x01;
+    } else {
+        n->alloc_next = fast_prov_info->unicast_min;
+        n->alloc_max = fast_prov_info->unicast_max;
+    }
+    n->prov_net_idx = fast_prov_info->net_idx;
+    n->flags = fast_prov_info->flags;
+    n->iv_index = fast_prov_info->iv_index;
+    memcpy(n->match_val, fast_prov_info->match_val, fast_prov_info->match_len);
+    n->match_len = fast_prov_info->match_len;
+    n->match_offset = fast_prov_info->offset;
+    prov_evt(n, ESP_BLE_MESH_SET_FAST_PROV_INFO_COMP_EVT, &param);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_set_fast_prov_action(esp_ble_mesh_fast_prov_action_t action)
+{
+    mesh_node_t *n = self();
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+
+    switch (action) {
+    case FAST_PROV_ACT_ENTER:
+        n->prov_enabled = n->provisioned;
+        n->prov_suspended = false;
+        param.set_fast_prov_action_comp.status_action = n->provisioned ? 0x00 : 0x01;
+        break;
+    case FAST_PROV_ACT_SUSPEND:
+        n->prov_suspended = true;
+        break;
+    case FAST_PROV_ACT_EXIT:
+        n->prov_enabled = false;
+        break;
+    default:
+        param.set_fast_prov_action_comp.status_action = 0x01;
+        break;
+    }
+    prov_evt(n, ESP_BLE_MESH_SET_FAST_PROV_ACTION_COMP_EVT, &param);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_node_proxy_gatt_enable(void)
+{
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+
+    prov_evt(self(), ESP_BLE_MESH_NODE_PROXY_GATT_ENABLE_COMP_EVT, &param);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_node_proxy_gatt_disable(void)
+{
+    esp_ble_mesh_prov_cb_param_t param = { 0 };
+
+    prov_evt(self(), ESP_BLE_MESH_NODE_PROXY_GATT_DISABLE_COMP_EVT, &param);
+    return ESP_OK;
+}
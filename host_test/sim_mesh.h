@@ -0,0 +1,71 @@
+/* sim_mesh.h - BLE Mesh stack for the simulated nodes of sim_node.c.
+ *
+ * Implements the esp_ble_mesh_* calls the examples make on top of sim_radio.c:
+ * network transmit, relay and message cache, unsegmented and segmented access
+ * messages with their acknowledgements, the Configuration and Generic OnOff
+ * models, client requests with timeouts and PB-ADV provisioning with the Fast
+ * Prov extensions. Events reach the application callbacks from the main loop,
+ * as ESP-IDF posts them to the BTC task. There is no encryption, keys are only
+ * compared by index.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _SIM_MESH_H_
+#define _SIM_MESH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sim_radio.h"
+
+/* An access message sent (rx false) or received by a node */
+typedef void (*sim_mesh_msg_hook_t)(uint32_t node, bool rx, uint32_t opcode, uint16_t src, uint16_t dst,
+                                    const uint8_t *data, uint16_t len);
+
+/* A node got provisioned with its primary address */
+typedef void (*sim_mesh_prov_hook_t)(uint32_t node, uint16_t addr);
+
+typedef struct {
+    uint64_t access_tx;
+    uint64_t access_rx;         /* Per receiving node */
+    uint64_t seg_tx_fail;       /* Segmented messages not acknowledged in time */
+    uint64_t client_timeouts;
+    uint64_t prov_links;        /* PB-ADV links opened */
+    uint64_t prov_link_fail;    /* Closed before Provisioning Complete */
+    uint64_t locked_calls;      /* Send calls made with a lock of the example held */
+} sim_mesh_stats_t;
+
+/* Sets up the radio for config->nodes nodes, added with sim_node_add() */
+int sim_mesh_init(const sim_radio_config_t *config);
+
+void sim_mesh_free(void);
+
+void sim_mesh_set_msg_hook(sim_mesh_msg_hook_t hook);
+
+void sim_mesh_set_prov_hook(sim_mesh_prov_hook_t hook);
+
+/* PB-ADV links a Provisioner node keeps open at once, CONFIG_BLE_MESH_PBA_SAME_TIME */
+void sim_mesh_set_pba_links(uint32_t node, uint8_t links);
+
+/* Primary element address, ESP_BLE_MESH_ADDR_UNASSIGNED before provisioning */
+uint16_t sim_mesh_addr(uint32_t node);
+
+void sim_mesh_get_stats(sim_mesh_stats_t *stats);
+
+/* A phone connected over GATT, which does not use the advertising bearer. Each
+ * call runs on the node from the main loop, in the order of the calls.
+ */
+void sim_mesh_phone_provision(uint32_t node, uint16_t addr);
+void sim_mesh_phone_app_key_add(uint32_t node, uint16_t app_idx);
+void sim_mesh_phone_bind(uint32_t node, uint16_t elem_addr, uint16_t company_id, uint16_t model_id,
+                         uint16_t app_idx);
+void sim_mesh_phone_sub_add(uint32_t node, uint16_t elem_addr, uint16_t company_id, uint16_t model_id,
+                            uint16_t group);
+void sim_mesh_phone_pub_set(uint32_t node, uint16_t elem_addr, uint16_t company_id, uint16_t model_id,
+                            uint16_t pub_addr, uint16_t app_idx, uint8_t ttl);
+void sim_mesh_phone_relay(uint32_t node, bool enable);
+
+#endif /* _SIM_MESH_H_ */
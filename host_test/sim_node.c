@@ -0,0 +1,771 @@
+/* sim_node.c - Simulated devices, each running the app_main() of an example */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "host_test.h"
+#include "host_kernel.h"
+#include "sim_node.h"
+#include "sim_radio.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "nvs_flash.h"
+#include "iot_button.h"
+#include "ble_mesh_example_init.h"
+#include "ble_mesh_example_nvs.h"
+#include "ble_mesh_fast_prov_common.h"
+
+#define GPIO_PINS       64
+#define TASK_STACK      (64 * 1024)
+#define BUTTON_CBS      (BUTTON_CB_SERIAL + 1)
+
+typedef struct nvs_entry {
+    char key[16];
+    size_t len;
+    struct nvs_entry *next;
+    uint8_t data[];
+} nvs_entry_t;
+
+typedef struct {
+    uint32_t index;
+    void *module;
+    void (*app_main)(void);
+    int *locks_held;
+    uint8_t gpio[GPIO_PINS];
+    nvs_entry_t *nvs;
+    button_cb button[BUTTON_CBS];
+    void *button_arg[BUTTON_CBS];
+    shutdown_handler_t shutdown;
+} node_t;
+
+/* A FreeRTOS task, run as a coroutine from the main loop */
+typedef struct sim_task {
+    uint32_t node;
+    TaskFunction_t fn;
+    void *arg;
+    ucontext_t ctx;
+    void *stack;
+    uint32_t notify;
+    bool take;          /* Blocked in ulTaskNotifyTake(), a notification wakes it */
+    bool wake_posted;
+    sim_timer_t timeout;
+    struct sim_task *next;
+} sim_task_t;
+
+typedef struct post {
+    struct post *next;
+    void (*fn)(void *arg);
+    uint32_t node;
+    alignas(max_align_t) uint8_t arg[];
+} post_t;
+
+static node_t **nodes;
+static uint32_t node_cnt, node_cap;
+
+static uint64_t now_us;
+
+static sim_timer_t **timers;
+static uint32_t timer_cnt, timer_cap;
+static uint64_t timer_seq;
+
+static post_t *post_head, **post_tail = &post_head;
+
+static sim_task_t *tasks, *running;
+static ucontext_t sched_ctx;
+
+static sim_node_gpio_hook_t gpio_hook;
+
+static node_t *self(void)
+{
+    node_t *n = host_kernel_owner;
+
+    if (!n) {
+        fprintf(stderr, "sim_node: called outside of a node\n");
+        abort();
+    }
+    return n;
+}
+
+uint32_t sim_node_self(void)
+{
+    return self()->index;
+}
+
+uint32_t sim_node_count(void)
+{
+    return node_cnt;
+}
+
+void *sim_node_enter(uint32_t node)
+{
+    void *prev = host_kernel_owner;
+
+    TEST_ASSERT(node < node_cnt);
+    host_kernel_owner = nodes[node];
+    return prev;
+}
+
+void sim_node_leave(void *prev)
+{
+    host_kernel_owner = prev;
+}
+
+int sim_node_locks_held(uint32_t node)
+{
+    return nodes[node]->locks_held ? *nodes[node]->locks_held : 0;
+}
+
+uint64_t sim_now_us(void)
+{
+    return now_us;
+}
+
+/* A private copy of the module, the dynamic loader shares a file it has
+ * already loaded.
+ */
+static void *module_open(const char *path)
+{
+    const char *dir = getenv("TMPDIR");
+    char copy[PATH_MAX], buf[65536];
+    void *handle = NULL;
+    int in, out;
+    ssize_t len;
+
+    snprintf(copy, sizeof(copy), "%s/sim_node_XXXXXX", dir ? dir : "/tmp");
+    in = open(path, O_RDONLY);
+    out = mkstemp(copy);
+    if (in < 0 || out < 0) {
+        fprintf(stderr, "sim_node: cannot copy %s\n", path);
+        goto out;
+    }
+    while ((len = read(in, buf, sizeof(buf))) > 0) {
+        if (write(out, buf, len) != len) {
+            len = -1;
+            break;
+        }
+    }
+    if (len == 0) {
+        handle = dlopen(copy, RTLD_NOW | RTLD_LOCAL);
+        if (!handle) {
+            fprintf(stderr, "sim_node: %s\n", dlerror());
+        }
+    }
+    unlink(copy);
+out:
+    if (in >= 0) {
+        close(in);
+    }
+    if (out >= 0) {
+        close(out);
+    }
+    return handle;
+}
+
+int sim_node_add(const char *module)
+{
+    node_t *n;
+
+    if (node_cnt == node_cap) {
+        node_cap = node_cap ? 2 * node_cap : 64;
+        nodes = realloc(nodes, node_cap * sizeof(node_t *));
+        TEST_ASSERT(nodes);
+    }
+    n = calloc(1, sizeof(node_t));
+    TEST_ASSERT(n);
+    n->index = node_cnt;
+    n->module = module_open(module);
+    if (!n->module) {
+        free(n);
+        return -1;
+    }
+    n->app_main = (void (*)(void))dlsym(n->module, "app_main");
+    n->locks_held = dlsym(n->module, "host_locks_held");
+    if (!n->app_main) {
+        dlclose(n->module);
+        free(n);
+        return -1;
+    }
+    nodes[node_cnt] = n;
+    return node_cnt++;
+}
+
+static void node_start(void *arg)
+{
+    self()->app_main();
+}
+
+void sim_node_start(uint32_t node)
+{
+    sim_node_post(node, node_start, 0);
+}
+
+void *sim_node_post(uint32_t node, void (*fn)(void *arg), size_t size)
+{
+    post_t *p = calloc(1, sizeof(post_t) + size);
+
+    TEST_ASSERT(p);
+    p->fn = fn;
+    p->node = node;
+    *post_tail = p;
+    post_tail = &p->next;
+    return p->arg;
+}
+
+static void run_posts(void)
+{
+    while (post_head) {
+        post_t *p = post_head;
+        void *prev;
+
+        post_head = p->next;
+        if (!post_head) {
+            post_tail = &post_head;
+        }
+        prev = sim_node_enter(p->node);
+        p->fn(p->arg);
+        sim_node_leave(prev);
+        free(p);
+    }
+}
+
+/* Timers */
+
+static bool timer_before(const sim_timer_t *a, const sim_timer_t *b)
+{
+    return a->due_us < b->due_us || (a->due_us == b->due_us && a->seq < b->seq);
+}
+
+static void timer_place(sim_timer_t *timer, uint32_t slot)
+{
+    timers[slot] = timer;
+    timer->slot = slot;
+}
+
+static void timer_sift(uint32_t slot)
+{
+    sim_timer_t *timer = timers[slot];
+
+    while (slot && timer_before(timer, timers[(slot - 1) / 2])) {
+        timer_place(timers[(slot - 1) / 2], slot);
+        slot = (slot - 1) / 2;
+    }
+    while (1) {
+        uint32_t child = 2 * slot + 1;
+
+        if (child >= timer_cnt) {
+            break;
+        }
+        if (child + 1 < timer_cnt && timer_before(timers[child + 1], timers[child])) {
+            child++;
+        }
+        if (!timer_before(timers[child], timer)) {
+            break;
+        }
+        timer_place(timers[child], slot);
+        slot = child;
+    }
+    timer_place(timer, slot);
+}
+
+void sim_timer_init(sim_timer_t *timer, uint32_t node, sim_timer_cb_t cb)
+{
+    timer->cb = cb;
+    timer->node = node;
+    timer->slot = UINT32_MAX;
+}
+
+void sim_timer_stop(sim_timer_t *timer)
+{
+    uint32_t slot = timer->slot;
+
+    if (slot == UINT32_MAX) {
+        return;
+    }
+    timer->slot = UINT32_MAX;
+    if (slot != --timer_cnt) {
+        timer_place(timers[timer_cnt], slot);
+        timer_sift(slot);
+    }
+}
+
+void sim_timer_start(sim_timer_t *timer, uint64_t delay_us)
+{
+    sim_timer_stop(timer);
+    if (timer_cnt == timer_cap) {
+        timer_cap = timer_cap ? 2 * timer_cap : 256;
+        timers = realloc(timers, timer_cap * sizeof(sim_timer_t *));
+        TEST_ASSERT(timers);
+    }
+    timer->due_us = now_us + delay_us;
+    timer->seq = timer_seq++;
+    timer_place(timer, timer_cnt++);
+    timer_sift(timer->slot);
+}
+
+static void run_timers(void)
+{
+    while (timer_cnt && timers[0]->due_us <= now_us) {
+        sim_timer_t *timer = timers[0];
+        void *prev;
+
+        sim_timer_stop(timer);
+        prev = sim_node_enter(timer->node);
+        timer->cb(timer);
+        sim_node_leave(prev);
+    }
+}
+
+/* Tasks */
+
+static void task_entry(void)
+{
+    sim_task_t *task = running;
+
+    task->fn(task->arg);
+    /* Returning ends the task, which FreeRTOS does not allow */
+    fprintf(stderr, "sim_node: task of node %u returned\n", task->node);
+    abort();
+}
+
+static void task_resume(sim_task_t *task)
+{
+    void *prev;
+
+    TEST_ASSERT(!running);
+    prev = sim_node_enter(task->node);
+    running = task;
+    TEST_ASSERT(swapcontext(&sched_ctx, &task->ctx) == 0);
+    running = NULL;
+    sim_node_leave(prev);
+}
+
+static void task_block(sim_task_t *task)
+{
+    TEST_ASSERT(swapcontext(&task->ctx, &sched_ctx) == 0);
+}
+
+static void task_start(void *arg)
+{
+    task_resume(*(sim_task_t **)arg);
+}
+
+static void task_wake(void *arg)
+{
+    sim_task_t *task = *(sim_task_t **)arg;
+
+    task->wake_posted = false;
+    /* The timeout may have run it meanwhile, and it may be taking again */
+    if (task->take && task->notify) {
+        task_resume(task);
+    }
+}
+
+static void task_timeout(sim_timer_t *timer)
+{
+    task_resume((sim_task_t *)((char *)timer - offsetof(sim_task_t, timeout)));
+}
+
+static sim_task_t *task_self(const char *call)
+{
+    if (!running) {
+        fprintf(stderr, "sim_node: %s outside of a task\n", call);
+        abort();
+    }
+    return running;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    sim_task_t *task = calloc(1, sizeof(sim_task_t));
+
+    if (!task || !(task->stack = malloc(TASK_STACK))) {
+        free(task);
+        return pdFALSE;
+    }
+    task->node = sim_node_self();
+    task->fn = fn;
+    task->arg = arg;
+    sim_timer_init(&task->timeout, task->node, task_timeout);
+    TEST_ASSERT(getcontext(&task->ctx) == 0);
+    task->ctx.uc_stack.ss_sp = task->stack;
+    task->ctx.uc_stack.ss_size = TASK_STACK;
+    task->ctx.uc_link = NULL;
+    makecontext(&task->ctx, task_entry, 0);
+    task->next = tasks;
+    tasks = task;
+
+    /* Starts once the creator is done, as if it had a higher priority */
+    *(sim_task_t **)sim_node_post(task->node, task_start, sizeof(sim_task_t *)) = task;
+    if (handle) {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    sim_task_t *task = task_self(__func__);
+    uint32_t value;
+
+    if (!task->notify && ticks) {
+        task->take = true;
+        if (ticks != portMAX_DELAY) {
+            sim_timer_start(&task->timeout, (uint64_t)ticks * portTICK_PERIOD_MS * 1000);
+        }
+        task_block(task);
+        task->take = false;
+        sim_timer_stop(&task->timeout);
+    }
+    value = task->notify;
+    if (clear_on_exit) {
+        task->notify = 0;
+    } else if (value) {
+        task->notify--;
+    }
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t handle)
+{
+    sim_task_t *task = handle;
+
+    task->notify++;
+    if (task->take && !task->wake_posted) {
+        task->wake_posted = true;
+        *(sim_task_t **)sim_node_post(task->node, task_wake, sizeof(sim_task_t *)) = task;
+    }
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t handle, BaseType_t *woken)
+{
+    xTaskNotifyGive(handle);
+    if (woken) {
+        *woken = pdTRUE;
+    }
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    sim_task_t *task = task_self(__func__);
+
+    sim_timer_start(&task->timeout, (uint64_t)ticks * portTICK_PERIOD_MS * 1000);
+    task_block(task);
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    return 0;
+}
+
+BaseType_t xPortInIsrContext(void)
+{
+    return pdFALSE;
+}
+
+/* Main loop */
+
+bool sim_run(uint64_t until_us, bool (*done)(void))
+{
+    while (1) {
+        uint64_t next = UINT64_MAX, radio_us;
+        uint32_t kernel_ms;
+
+        run_posts();
+        if (done && done()) {
+            return true;
+        }
+
+        if (sim_radio_next(&radio_us)) {
+            next = radio_us;
+        }
+        if (host_kernel_next(&kernel_ms) && (uint64_t)kernel_ms * 1000 < next) {
+            next = (uint64_t)kernel_ms * 1000;
+        }
+        if (timer_cnt && timers[0]->due_us < next) {
+            next = timers[0]->due_us;
+        }
+        /* Work submitted with no delay is due at the current millisecond */
+        if (next < now_us) {
+            next = now_us;
+        }
+        if (next > until_us) {
+            now_us = until_us;
+            host_kernel_advance(now_us / 1000);
+            return false;
+        }
+
+        now_us = next;
+        host_kernel_advance(now_us / 1000);
+        run_timers();
+        sim_radio_run(now_us);
+    }
+}
+
+/* GPIO */
+
+esp_err_t gpio_reset_pin(gpio_num_t pin)
+{
+    return gpio_set_level(pin, 0);
+}
+
+esp_err_t gpio_set_direction(gpio_num_t pin, gpio_mode_t mode)
+{
+    return pin >= 0 && pin < GPIO_PINS ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level)
+{
+    node_t *n = self();
+
+    if (pin < 0 || pin >= GPIO_PINS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    n->gpio[pin] = !!level;
+    if (gpio_hook) {
+        gpio_hook(n->index, pin, !!level);
+    }
+    return ESP_OK;
+}
+
+void sim_node_set_gpio_hook(sim_node_gpio_hook_t hook)
+{
+    gpio_hook = hook;
+}
+
+uint32_t sim_node_gpio(uint32_t node, uint32_t pin)
+{
+    return pin < GPIO_PINS ? nodes[node]->gpio[pin] : 0;
+}
+
+/* NVS, in RAM for the run */
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    node_t *n = self();
+
+    while (n->nvs) {
+        nvs_entry_t *e = n->nvs;
+        n->nvs = e->next;
+        free(e);
+    }
+    return ESP_OK;
+}
+
+static nvs_entry_t **nvs_find(const char *key)
+{
+    nvs_entry_t **e;
+
+    for (e = &self()->nvs; *e; e = &(*e)->next) {
+        if (!strncmp((*e)->key, key, sizeof((*e)->key))) {
+            break;
+        }
+    }
+    return e;
+}
+
+esp_err_t ble_mesh_nvs_open(nvs_handle_t *handle)
+{
+    *handle = sim_node_self() + 1;
+    return ESP_OK;
+}
+
+esp_err_t ble_mesh_nvs_store(nvs_handle_t handle, const char *key, const void *data, size_t length)
+{
+    nvs_entry_t **e = nvs_find(key), *entry;
+
+    entry = calloc(1, sizeof(nvs_entry_t) + length);
+    if (!entry) {
+        return ESP_ERR_NO_MEM;
+    }
+    strncpy(entry->key, key, sizeof(entry->key) - 1);
+    entry->len = length;
+    memcpy(entry->data, data, length);
+    if (*e) {
+        entry->next = (*e)->next;
+        free(*e);
+    }
+    *e = entry;
+    return ESP_OK;
+}
+
+esp_err_t ble_mesh_nvs_restore(nvs_handle_t handle, const char *key, void *data, size_t length, bool *exist)
+{
+    nvs_entry_t *e = *nvs_find(key);
+
+    if (exist) {
+        *exist = e != NULL;
+    }
+    if (e) {
+        memcpy(data, e->data, e->len < length ? e->len : length);
+    }
+    return ESP_OK;
+}
+
+esp_err_t ble_mesh_nvs_erase(nvs_handle_t handle, const char *key)
+{
+    nvs_entry_t **e = nvs_find(key), *entry = *e;
+
+    if (entry) {
+        *e = entry->next;
+        free(entry);
+    }
+    return ESP_OK;
+}
+
+/* No partition, the node database of the Fast Prov examples stays in RAM */
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    return NULL;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+                             spi_flash_mmap_memory_t memory, const void **out_ptr,
+                             spi_flash_mmap_handle_t *out_handle)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle)
+{
+}
+
+/* Button component */
+
+button_handle_t iot_button_create(gpio_num_t gpio_num, button_active_t active_level)
+{
+    return self();
+}
+
+esp_err_t iot_button_set_evt_cb(button_handle_t btn_handle, button_cb_type_t type, button_cb cb, void *arg)
+{
+    node_t *n = btn_handle;
+
+    if (type >= BUTTON_CBS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    n->button[type] = cb;
+    n->button_arg[type] = arg;
+    return ESP_OK;
+}
+
+static void button_press(void *arg)
+{
+    static const button_cb_type_t order[] = { BUTTON_CB_PUSH, BUTTON_CB_RELEASE, BUTTON_CB_TAP };
+    node_t *n = self();
+
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        if (n->button[order[i]]) {
+            n->button[order[i]](n->button_arg[order[i]]);
+        }
+    }
+}
+
+void sim_node_press(uint32_t node)
+{
+    sim_node_post(node, button_press, 0);
+}
+
+/* ESP-IDF and the example_init component */
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler)
+{
+    self()->shutdown = handler;
+    return ESP_OK;
+}
+
+esp_err_t bluetooth_init(void)
+{
+    return ESP_OK;
+}
+
+/* The Bluetooth address of the node after the first two octets */
+void ble_mesh_get_dev_uuid(uint8_t *dev_uuid)
+{
+    uint32_t index = sim_node_self();
+    const uint8_t addr[BLE_MESH_ADDR_LEN] = { 0x24, 0x0a, 0xc4, index >> 16, index >> 8, index };
+
+    memcpy(dev_uuid + 2, addr, sizeof(addr));
+}
+
+const char *bt_hex(const void *buf, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    static char str[4][2 * 32 + 1];
+    static uint8_t cur;
+    const uint8_t *b = buf;
+    char *s = str[cur++ % 4];
+
+    if (len > 32) {
+        len = 32;
+    }
+    for (size_t i = 0; i < len; i++) {
+        s[2 * i] = hex[b[i] >> 4];
+        s[2 * i + 1] = hex[b[i] & 0xF];
+    }
+    s[2 * len] = '\0';
+    return s;
+}
+
+void sim_node_free(void)
+{
+    while (post_head) {
+        post_t *p = post_head;
+        post_head = p->next;
+        free(p);
+    }
+    post_tail = &post_head;
+    while (tasks) {
+        sim_task_t *task = tasks;
+        tasks = task->next;
+        free(task->stack);
+        free(task);
+    }
+    timer_cnt = 0;
+    for (uint32_t i = 0; i < node_cnt; i++) {
+        host_kernel_owner = nodes[i];
+        nvs_flash_erase();
+        /* The examples never stop, their module stays mapped for the
+         * delayed work they left registered with host_kernel.c
+         */
+        free(nodes[i]);
+    }
+    host_kernel_owner = NULL;
+    free(nodes);
+    free(timers);
+    nodes = NULL;
+    timers = NULL;
+    node_cnt = node_cap = timer_cap = 0;
+}
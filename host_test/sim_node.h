@@ -0,0 +1,87 @@
+/* sim_node.h - Simulated devices, each running the app_main() of an example.
+ *
+ * An example is built as a module which gets loaded once per node, so every
+ * node has its own copy of the example's globals. The module calls back into
+ * the simulation for what ESP-IDF would provide: FreeRTOS tasks, GPIO, NVS,
+ * the button component, the timers of host_kernel.c and, from sim_mesh.c,
+ * the BLE Mesh stack. Everything runs on one thread and one virtual clock,
+ * host_kernel_owner tells which node the code running belongs to.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _SIM_NODE_H_
+#define _SIM_NODE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Timer with a microsecond deadline, its callback runs in the node context */
+typedef struct sim_timer sim_timer_t;
+
+typedef void (*sim_timer_cb_t)(sim_timer_t *timer);
+
+struct sim_timer {
+    sim_timer_cb_t cb;
+    uint32_t node;
+    uint64_t due_us;
+    uint64_t seq;           /* Start order, for equal deadlines */
+    uint32_t slot;          /* In the timer heap, UINT32_MAX when stopped */
+};
+
+typedef void (*sim_node_gpio_hook_t)(uint32_t node, uint32_t pin, uint32_t level);
+
+/* Loads another copy of the module, returns the index of the node or -1 */
+int sim_node_add(const char *module);
+
+/* Runs app_main() of the node from the main loop */
+void sim_node_start(uint32_t node);
+
+uint32_t sim_node_count(void);
+
+/* Node whose code is running, the simulation aborts if none is */
+uint32_t sim_node_self(void);
+
+/* Runs the following calls as node, until sim_node_leave(prev) */
+void *sim_node_enter(uint32_t node);
+void sim_node_leave(void *prev);
+
+/* Calls fn(arg) as node from the main loop, after what is already posted,
+ * the way the BTC task runs the callbacks posted to it. arg is a zeroed
+ * buffer of size bytes for the caller to fill, freed after the call.
+ */
+void *sim_node_post(uint32_t node, void (*fn)(void *arg), size_t size);
+
+/* Locks the code of the node holds, see host_locks_held */
+int sim_node_locks_held(uint32_t node);
+
+uint64_t sim_now_us(void);
+
+void sim_timer_init(sim_timer_t *timer, uint32_t node, sim_timer_cb_t cb);
+void sim_timer_start(sim_timer_t *timer, uint64_t delay_us);
+void sim_timer_stop(sim_timer_t *timer);
+
+static inline bool sim_timer_armed(const sim_timer_t *timer)
+{
+    return timer->slot != UINT32_MAX;
+}
+
+/* Runs the simulation until until_us, or until done() returns true after a
+ * step. Returns the result of done(), false without one.
+ */
+bool sim_run(uint64_t until_us, bool (*done)(void));
+
+/* Called for every level set on a pin */
+void sim_node_set_gpio_hook(sim_node_gpio_hook_t hook);
+
+uint32_t sim_node_gpio(uint32_t node, uint32_t pin);
+
+/* Pushes and releases the button of the node */
+void sim_node_press(uint32_t node);
+
+void sim_node_free(void);
+
+#endif /* _SIM_NODE_H_ */
@@ -0,0 +1,260 @@
+/* sim_onoff.c - The onoff_client example switching a group of onoff_server
+ * examples over the simulated advertising bearer. A phone provisions and
+ * configures every node over GATT, then the button of the client gets pushed
+ * at a fixed interval. The Status publications of the servers go back to the
+ * client.
+ *
+ *   sim_onoff [--nodes N] [--spacing M] [--range M] [--loss PCT] [--relay PCT]
+ *             [--cmds N] [--interval MS] [--seed N]
+ *
+ * Prints how many servers each Set reached and when, how many publications got
+ * back to the client and the airtime of the nodes.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "esp_ble_mesh_generic_model_api.h"
+#include "sim_mesh.h"
+#include "sim_node.h"
+
+#define CLIENT_ADDR     0x0001
+#define GROUP_ADDR      0xC000
+#define ELEMENTS        3       /* Of the onoff_server example */
+#define LED_PIN         2       /* LED_G, of the primary element */
+#define APP_IDX         0
+#define TTL             7
+#define SETUP_MS        1000
+#define SETTLE_MS       5000
+
+static sim_radio_config_t radio = {
+    .nodes = 100,
+    .spacing_m = 5,
+    .range_m = 25,
+    .loss_pct = 10,
+    /* The Relay Retransmit of the examples */
+    .relay_count = 3,
+    .relay_interval_ms = 20,
+    .queue_max = 60,
+    .seed = 10,
+};
+static uint32_t relay_pct = 15, cmds = 10, interval_ms = 10000;
+
+static uint32_t client, relays;
+static uint32_t *cmd_seen;      /* Per node, the last command its LED followed */
+
+static struct {
+    uint32_t seq;
+    uint64_t sent_us;
+    uint8_t onoff;
+} cmd;
+
+typedef struct {
+    uint32_t *us;
+    uint32_t cnt, cap;
+} samples_t;
+
+static samples_t set_latency, status_latency;
+static uint64_t *status_sent_us;    /* Per server, its last publication */
+static uint64_t status_sent, status_recv, set_reached, set_expected;
+
+static void sample(samples_t *s, uint64_t us)
+{
+    if (s->cnt == s->cap) {
+        s->cap = s->cap ? 2 * s->cap : 1024;
+        s->us = realloc(s->us, s->cap * sizeof(uint32_t));
+        TEST_ASSERT(s->us);
+    }
+    s->us[s->cnt++] = (uint32_t)us;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(samples_t *s, uint32_t pct)
+{
+    if (!s->cnt) {
+        return 0;
+    }
+    qsort(s->us, s->cnt, sizeof(uint32_t), cmp_u32);
+    return s->us[(uint64_t)(s->cnt - 1) * pct / 100] / 1000.0;
+}
+
+static uint16_t server_addr(uint32_t node)
+{
+    return CLIENT_ADDR + 1 + (node - (node > client)) * ELEMENTS;
+}
+
+/* The LED of the primary element follows the Sets to the group */
+static void gpio_changed(uint32_t node, uint32_t pin, uint32_t level)
+{
+    if (node == client || pin != LED_PIN || !cmd.seq || cmd_seen[node] == cmd.seq ||
+            level != cmd.onoff) {
+        return;
+    }
+    cmd_seen[node] = cmd.seq;
+    set_reached++;
+    sample(&set_latency, sim_now_us() - cmd.sent_us);
+}
+
+static void msg_seen(uint32_t node, bool rx, uint32_t opcode, uint16_t src, uint16_t dst,
+                     const uint8_t *data, uint16_t len)
+{
+    uint32_t server = (src - CLIENT_ADDR - 1) / ELEMENTS;
+
+    if (opcode != ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_STATUS || dst != CLIENT_ADDR) {
+        return;
+    }
+    if (!rx) {
+        status_sent++;
+        status_sent_us[server] = sim_now_us();
+    } else if (node == client) {
+        status_recv++;
+        sample(&status_latency, sim_now_us() - status_sent_us[server]);
+    }
+}
+
+static void setup(void)
+{
+    uint32_t rand_state = radio.seed ? radio.seed : 1;
+
+    for (uint32_t i = 0; i < radio.nodes; i++) {
+        uint16_t addr = i == client ? CLIENT_ADDR : server_addr(i);
+
+        sim_node_start(i);
+        sim_mesh_phone_provision(i, addr);
+        sim_mesh_phone_app_key_add(i, APP_IDX);
+        if (i == client) {
+            sim_mesh_phone_bind(i, addr, ESP_BLE_MESH_CID_NVAL, ESP_BLE_MESH_MODEL_ID_GEN_ONOFF_CLI, APP_IDX);
+            continue;
+        }
+        sim_mesh_phone_bind(i, addr, ESP_BLE_MESH_CID_NVAL, ESP_BLE_MESH_MODEL_ID_GEN_ONOFF_SRV, APP_IDX);
+        sim_mesh_phone_sub_add(i, addr, ESP_BLE_MESH_CID_NVAL, ESP_BLE_MESH_MODEL_ID_GEN_ONOFF_SRV, GROUP_ADDR);
+        sim_mesh_phone_pub_set(i, addr, ESP_BLE_MESH_CID_NVAL, ESP_BLE_MESH_MODEL_ID_GEN_ONOFF_SRV,
+                               CLIENT_ADDR, APP_IDX, TTL);
+        if (host_rand(&rand_state) % 100 < relay_pct) {
+            sim_mesh_phone_relay(i, true);
+            relays++;
+        }
+    }
+}
+
+static void parse_args(int argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        uint32_t *value;
+    } opts[] = {
+        { "--nodes", &radio.nodes },
+        { "--spacing", &radio.spacing_m },
+        { "--range", &radio.range_m },
+        { "--loss", &radio.loss_pct },
+        { "--relay", &relay_pct },
+        { "--cmds", &cmds },
+        { "--interval", &interval_ms },
+        { "--seed", &radio.seed },
+    };
+
+    for (int i = 1; i < argc; i++) {
+        size_t j;
+
+        for (j = 0; j < sizeof(opts) / sizeof(opts[0]); j++) {
+            if (!strcmp(argv[i], opts[j].name) && i + 1 < argc) {
+                *opts[j].value = strtoul(argv[++i], NULL, 0);
+                break;
+            }
+        }
+        if (j == sizeof(opts) / sizeof(opts[0])) {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            exit(2);
+        }
+    }
+    TEST_ASSERT(radio.nodes >= 2 && server_addr(radio.nodes - 1) + ELEMENTS - 1 < 0x7FFF);
+}
+
+int main(int argc, char **argv)
+{
+    sim_radio_stats_t stats;
+    sim_mesh_stats_t mesh;
+    uint64_t airtime = 0, airtime_max = 0, end_us;
+    uint32_t nbr = 0;
+
+    parse_args(argc, argv);
+    TEST_ASSERT(sim_mesh_init(&radio) == 0);
+
+    /* The client in the middle of the grid, so the Sets spread both ways */
+    client = radio.nodes / 2;
+    for (uint32_t i = 0; i < radio.nodes; i++) {
+        TEST_ASSERT(sim_node_add(i == client ? SIM_CLIENT_MODULE : SIM_SERVER_MODULE) == (int)i);
+    }
+    cmd_seen = calloc(radio.nodes, sizeof(*cmd_seen));
+    status_sent_us = calloc(radio.nodes, sizeof(*status_sent_us));
+    TEST_ASSERT(cmd_seen && status_sent_us);
+    sim_node_set_gpio_hook(gpio_changed);
+    sim_mesh_set_msg_hook(msg_seen);
+
+    setup();
+    sim_run((uint64_t)SETUP_MS * 1000, NULL);
+    for (uint32_t i = 0; i < radio.nodes; i++) {
+        TEST_ASSERT(sim_mesh_addr(i) != ESP_BLE_MESH_ADDR_UNASSIGNED);
+    }
+    /* The client sends the state it stores before toggling it, Off first,
+     * which the servers already are.
+     */
+    sim_node_press(client);
+    sim_run(sim_now_us() + (uint64_t)SETUP_MS * 1000, NULL);
+
+    for (cmd.seq = 1; cmd.seq <= cmds; cmd.seq++) {
+        cmd.onoff = cmd.seq & 1;
+        cmd.sent_us = sim_now_us();
+        set_expected += radio.nodes - 1;
+        sim_node_press(client);
+        sim_run(cmd.sent_us + (uint64_t)interval_ms * 1000, NULL);
+    }
+    cmd.seq = 0;
+    sim_run(sim_now_us() + (uint64_t)SETTLE_MS * 1000, NULL);
+    end_us = sim_now_us();
+
+    for (uint32_t i = 0; i < radio.nodes; i++) {
+        uint64_t air = sim_radio_airtime_us(i);
+
+        airtime += air;
+        airtime_max = air > airtime_max ? air : airtime_max;
+        nbr += sim_radio_neighbours(i);
+    }
+    sim_radio_get_stats(&stats);
+    sim_mesh_get_stats(&mesh);
+
+    printf("%u nodes, %u relays, %.1f neighbours, %u%% loss\n",
+           radio.nodes, relays, (double)nbr / radio.nodes, radio.loss_pct);
+    printf("  Set:    %.1f%% of the servers, latency p50 %.1f ms p90 %.1f ms p99 %.1f ms\n",
+           100.0 * set_reached / set_expected, percentile_ms(&set_latency, 50),
+           percentile_ms(&set_latency, 90), percentile_ms(&set_latency, 99));
+    printf("  Status: %llu published, %.1f%% at the client, latency p50 %.1f ms p99 %.1f ms\n",
+           (unsigned long long)status_sent, status_sent ? 100.0 * status_recv / status_sent : 0,
+           percentile_ms(&status_latency, 50), percentile_ms(&status_latency, 99));
+    printf("  Air:    %llu advertising events, duty cycle mean %.3f%% max %.3f%%, "
+           "%llu collisions, %llu lost, %llu deaf, %llu relayed, %llu dropped\n",
+           (unsigned long long)stats.tx_events, 100.0 * airtime / radio.nodes / end_us,
+           100.0 * airtime_max / end_us, (unsigned long long)stats.rx_collided,
+           (unsigned long long)stats.rx_lost, (unsigned long long)stats.rx_deaf,
+           (unsigned long long)stats.relayed, (unsigned long long)stats.dropped);
+
+    /* A server follows each Set once, the client gets each publication once,
+     * and no example calls into the stack with one of its locks held.
+     */
+    TEST_ASSERT(set_reached > 0 && set_reached <= set_expected);
+    TEST_ASSERT(status_recv > 0 && status_recv <= status_sent);
+    TEST_ASSERT(mesh.locked_calls == 0);
+
+    sim_node_free();
+    sim_mesh_free();
+    return 0;
+}
@@ -0,0 +1,388 @@
+/* sim_radio.c - Discrete-event advertising bearer for the host simulations */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_test.h"
+#include "sim_radio.h"
+
+#define CACHE_SIZE      256     /* Network message cache of each node */
+#define ADV_DELAY_US    10000   /* Random delay before each advertising event */
+
+/* One advertising event on the three channels, a receiver hears one of them.
+ * Preamble, access address, header, AdvA, AD structure and CRC at 1 Mbit/s.
+ */
+#define AIR_US(ad_len)  (8 * (1 + 4 + 2 + 6 + 2 + (ad_len) + 3))
+#define CHANNELS        3
+
+enum {
+    EVT_TX_START,
+    EVT_TX_END,
+};
+
+typedef struct {
+    uint64_t due_us;
+    uint32_t seq;       /* Insertion order, for equal times */
+    uint8_t  type;
+    uint32_t node;
+} event_t;
+
+typedef struct tx {
+    sim_pdu_t pdu;
+    uint8_t left;       /* Advertising events still to send */
+    uint32_t interval_us;
+    struct tx *next;
+} tx_t;
+
+typedef struct {
+    uint32_t *nbr;
+    uint32_t nbr_cnt;
+    /* Transmitter */
+    tx_t *queue, *tail;
+    uint32_t queued;
+    bool sending;
+    uint64_t tx_until_us;
+    uint64_t airtime_us;
+    /* Receiver, locked on the first transmission it hears */
+    uint32_t rx_from;
+    uint64_t rx_until_us;
+    bool rx_ok;
+    /* Message cache */
+    uint64_t cache[CACHE_SIZE];
+    uint32_t cache_next;
+} node_t;
+
+static sim_radio_config_t cfg;
+static sim_radio_recv_t recv_cb;
+static node_t *nodes;
+static event_t *heap;
+static uint32_t heap_len, heap_cap, evt_seq;
+static sim_radio_stats_t stats;
+static uint32_t rng;
+
+static bool evt_before(const event_t *a, const event_t *b)
+{
+    return a->due_us < b->due_us || (a->due_us == b->due_us && a->seq < b->seq);
+}
+
+static void evt_push(uint64_t due_us, uint8_t type, uint32_t node)
+{
+    uint32_t i;
+
+    if (heap_len == heap_cap) {
+        heap_cap = heap_cap ? 2 * heap_cap : 1024;
+        heap = realloc(heap, heap_cap * sizeof(event_t));
+        TEST_ASSERT(heap);
+    }
+    i = heap_len++;
+    heap[i] = (event_t) { .due_us = due_us, .seq = evt_seq++, .type = type, .node = node };
+    while (i && evt_before(&heap[i], &heap[(i - 1) / 2])) {
+        event_t tmp = heap[i];
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+static event_t evt_pop(void)
+{
+    event_t top = heap[0];
+    uint32_t i = 0;
+
+    heap[0] = heap[--heap_len];
+    while (1) {
+        uint32_t l = 2 * i + 1, r = l + 1, min = i;
+        if (l < heap_len && evt_before(&heap[l], &heap[min])) {
+            min = l;
+        }
+        if (r < heap_len && evt_before(&heap[r], &heap[min])) {
+            min = r;
+        }
+        if (min == i) {
+            break;
+        }
+        event_t tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+    return top;
+}
+
+static uint64_t pdu_key(const sim_pdu_t *pdu)
+{
+    return (uint64_t)pdu->src << 32 | pdu->seq;
+}
+
+/* Returns true if the PDU was already in the cache */
+static bool cache_check(node_t *n, const sim_pdu_t *pdu)
+{
+    uint64_t key = pdu_key(pdu);
+
+    for (uint32_t i = 0; i < CACHE_SIZE; i++) {
+        if (n->cache[i] == key) {
+            return true;
+        }
+    }
+    n->cache[n->cache_next++ % CACHE_SIZE] = key;
+    return false;
+}
+
+static uint64_t adv_delay_us(void)
+{
+    return host_rand(&rng) % ADV_DELAY_US;
+}
+
+/* Starts the next advertising event of the node, if it has something queued */
+static void tx_kick(uint32_t node, uint64_t now_us)
+{
+    node_t *n = &nodes[node];
+
+    if (n->sending || !n->queue) {
+        return;
+    }
+    n->sending = true;
+    evt_push(now_us + adv_delay_us(), EVT_TX_START, node);
+}
+
+static bool tx_queue(uint32_t node, const sim_pdu_t *pdu, uint8_t count, uint32_t interval_ms,
+                     uint64_t now_us)
+{
+    node_t *n = &nodes[node];
+    tx_t *tx;
+
+    if (n->queued >= cfg.queue_max) {
+        stats.dropped++;
+        return false;
+    }
+    tx = calloc(1, sizeof(tx_t));
+    TEST_ASSERT(tx);
+    tx->pdu = *pdu;
+    tx->left = count;
+    tx->interval_us = interval_ms * 1000;
+    if (n->tail) {
+        n->tail->next = tx;
+    } else {
+        n->queue = tx;
+    }
+    n->tail = tx;
+    n->queued++;
+
+    tx_kick(node, now_us);
+    return true;
+}
+
+/* IVI and NID, CTL and TTL, SEQ, SRC and DST, lower transport PDU and NetMIC */
+static uint32_t ad_len(const sim_pdu_t *pdu)
+{
+    if (pdu->type != SIM_AD_MESH) {
+        return pdu->len;
+    }
+    return 1 + 1 + 3 + 2 + 2 + pdu->len + (pdu->ctl ? 8 : 4);
+}
+
+static void tx_start(uint32_t node, uint64_t now_us)
+{
+    node_t *n = &nodes[node];
+    uint64_t air_us = AIR_US(ad_len(&n->queue->pdu));
+
+    n->tx_until_us = now_us + air_us;
+    n->airtime_us += CHANNELS * air_us;
+    stats.tx_events++;
+
+    /* Half duplex: a reception in progress is lost */
+    if (now_us < n->rx_until_us) {
+        n->rx_ok = false;
+    }
+
+    for (uint32_t i = 0; i < n->nbr_cnt; i++) {
+        node_t *r = &nodes[n->nbr[i]];
+
+        if (now_us < r->tx_until_us) {
+            stats.rx_deaf++;
+            continue;
+        }
+        if (now_us < r->rx_until_us) {
+            /* Both are lost, without capture effect */
+            if (r->rx_ok) {
+                r->rx_ok = false;
+            }
+            stats.rx_collided++;
+            if (now_us + air_us > r->rx_until_us) {
+                r->rx_until_us = now_us + air_us;
+            }
+            continue;
+        }
+        r->rx_from = node;
+        r->rx_until_us = now_us + air_us;
+        r->rx_ok = true;
+    }
+
+    evt_push(now_us + air_us, EVT_TX_END, node);
+}
+
+static void rx_deliver(uint32_t node, const sim_pdu_t *pdu, uint64_t now_us)
+{
+    node_t *n = &nodes[node];
+    sim_pdu_t relay;
+
+    if (pdu->type != SIM_AD_MESH) {
+        recv_cb(node, pdu, now_us);
+        return;
+    }
+    if (cache_check(n, pdu)) {
+        return;
+    }
+    if (recv_cb(node, pdu, now_us) && pdu->ttl >= 2) {
+        relay = *pdu;
+        relay.ttl--;
+        if (tx_queue(node, &relay, cfg.relay_count, cfg.relay_interval_ms, now_us)) {
+            stats.relayed++;
+        }
+    }
+}
+
+static void tx_end(uint32_t node, uint64_t now_us)
+{
+    node_t *n = &nodes[node];
+    tx_t *tx = n->queue;
+
+    for (uint32_t i = 0; i < n->nbr_cnt; i++) {
+        node_t *r = &nodes[n->nbr[i]];
+
+        if (r->rx_from != node || r->rx_until_us != now_us) {
+            continue;
+        }
+        r->rx_from = UINT32_MAX;
+        if (!r->rx_ok) {
+            stats.rx_collided++;
+            continue;
+        }
+        if (host_rand(&rng) % 100 < cfg.loss_pct) {
+            stats.rx_lost++;
+            continue;
+        }
+        stats.rx_ok++;
+        rx_deliver(n->nbr[i], &tx->pdu, now_us);
+    }
+
+    if (--tx->left) {
+        evt_push(now_us + tx->interval_us + adv_delay_us(), EVT_TX_START, node);
+        return;
+    }
+
+    n->queue = tx->next;
+    if (!n->queue) {
+        n->tail = NULL;
+    }
+    n->queued--;
+    free(tx);
+    n->sending = false;
+    tx_kick(node, now_us);
+}
+
+int sim_radio_init(const sim_radio_config_t *config, sim_radio_recv_t recv)
+{
+    uint32_t cols, *nbr;
+
+    cfg = *config;
+    recv_cb = recv;
+    rng = cfg.seed ? cfg.seed : 1;
+    heap_len = evt_seq = 0;
+    memset(&stats, 0, sizeof(stats));
+
+    nodes = calloc(cfg.nodes, sizeof(node_t));
+    nbr = calloc((size_t)cfg.nodes * cfg.nodes, sizeof(uint32_t));
+    if (!nodes || !nbr) {
+        return -1;
+    }
+
+    cols = (uint32_t)ceil(sqrt(cfg.nodes));
+    for (uint32_t i = 0; i < cfg.nodes; i++) {
+        node_t *n = &nodes[i];
+
+        n->nbr = &nbr[(size_t)i * cfg.nodes];
+        n->rx_from = UINT32_MAX;
+        for (uint32_t j = 0; j < cfg.nodes; j++) {
+            double dx = ((double)(i % cols) - (double)(j % cols)) * cfg.spacing_m;
+            double dy = ((double)(i / cols) - (double)(j / cols)) * cfg.spacing_m;
+
+            if (j != i && dx * dx + dy * dy <= (double)cfg.range_m * cfg.range_m) {
+                n->nbr[n->nbr_cnt++] = j;
+            }
+        }
+        memset(n->cache, 0xFF, sizeof(n->cache));
+    }
+    return 0;
+}
+
+void sim_radio_free(void)
+{
+    for (uint32_t i = 0; i < cfg.nodes; i++) {
+        while (nodes[i].queue) {
+            tx_t *tx = nodes[i].queue;
+            nodes[i].queue = tx->next;
+            free(tx);
+        }
+    }
+    if (cfg.nodes) {
+        free(nodes[0].nbr);
+    }
+    free(nodes);
+    free(heap);
+    nodes = NULL;
+    heap = NULL;
+    heap_cap = 0;
+}
+
+bool sim_radio_send(uint32_t node, const sim_pdu_t *pdu, uint8_t count, uint32_t interval_ms,
+                    uint64_t now_us)
+{
+    /* The origin does not process its own PDUs relayed back to it */
+    if (pdu->type == SIM_AD_MESH) {
+        cache_check(&nodes[node], pdu);
+    }
+    return tx_queue(node, pdu, count, interval_ms, now_us);
+}
+
+bool sim_radio_next(uint64_t *due_us)
+{
+    if (!heap_len) {
+        return false;
+    }
+    *due_us = heap[0].due_us;
+    return true;
+}
+
+void sim_radio_run(uint64_t now_us)
+{
+    while (heap_len && heap[0].due_us <= now_us) {
+        event_t evt = evt_pop();
+
+        if (evt.type == EVT_TX_START) {
+            tx_start(evt.node, evt.due_us);
+        } else {
+            tx_end(evt.node, evt.due_us);
+        }
+    }
+}
+
+uint64_t sim_radio_airtime_us(uint32_t node)
+{
+    return nodes[node].airtime_us;
+}
+
+uint32_t sim_radio_neighbours(uint32_t node)
+{
+    return nodes[node].nbr_cnt;
+}
+
+void sim_radio_get_stats(sim_radio_stats_t *out)
+{
+    *out = stats;
+}
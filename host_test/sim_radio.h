@@ -0,0 +1,88 @@
+/* sim_radio.h - Discrete-event advertising bearer for the host simulations.
+ *
+ * Nodes sit on a square grid and hear the nodes within range. Each node sends
+ * its queued advertising PDUs one after the other, every PDU as a number of
+ * advertising events. A reception is lost at random, when two transmissions
+ * overlap at the receiver, or when the receiver transmits itself. Network PDUs
+ * a node has already seen are dropped by its message cache, the others are
+ * relayed with a lower TTL if the receiver asks for it.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _SIM_RADIO_H_
+#define _SIM_RADIO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* AD types of the mesh bearers */
+#define SIM_AD_PROV         0x29    /* PB-ADV */
+#define SIM_AD_MESH         0x2A    /* Network PDU */
+#define SIM_AD_BEACON       0x2B
+
+typedef struct {
+    uint8_t  type;
+    /* Network header, SIM_AD_MESH only */
+    uint8_t  ctl;
+    uint8_t  ttl;
+    uint16_t src;
+    uint16_t dst;
+    uint32_t seq;
+    /* Lower transport PDU, or the whole AD payload of the other types */
+    uint8_t  len;
+    uint8_t  data[29];
+    uint64_t sent_us;       /* Handed to the bearer by the origin, for latency */
+} sim_pdu_t;
+
+typedef struct {
+    uint32_t nodes;
+    uint32_t spacing_m;     /* Between grid neighbours */
+    uint32_t range_m;
+    uint32_t loss_pct;      /* Per reception, on top of collisions */
+    uint8_t  relay_count;   /* Advertising events per relayed PDU, Relay Retransmit */
+    uint32_t relay_interval_ms;
+    uint32_t queue_max;     /* Advertising buffers per node */
+    uint32_t seed;
+} sim_radio_config_t;
+
+/* A PDU heard by node, network PDUs only if the node has not seen them before,
+ * whatever their destination. Returns true to relay a network PDU.
+ */
+typedef bool (*sim_radio_recv_t)(uint32_t node, const sim_pdu_t *pdu, uint64_t now_us);
+
+typedef struct {
+    uint64_t tx_events;
+    uint64_t rx_ok;
+    uint64_t rx_lost;       /* Random loss */
+    uint64_t rx_collided;
+    uint64_t rx_deaf;       /* The receiver was transmitting */
+    uint64_t relayed;
+    uint64_t dropped;       /* Advertising queue full */
+} sim_radio_stats_t;
+
+int sim_radio_init(const sim_radio_config_t *config, sim_radio_recv_t recv);
+
+void sim_radio_free(void);
+
+/* Queues a PDU from node, sent count times interval_ms apart. Returns false if
+ * the advertising queue of the node is full.
+ */
+bool sim_radio_send(uint32_t node, const sim_pdu_t *pdu, uint8_t count, uint32_t interval_ms,
+                    uint64_t now_us);
+
+/* Time of the next radio event, false if the air is quiet */
+bool sim_radio_next(uint64_t *due_us);
+
+/* Runs the radio events up to and including now_us */
+void sim_radio_run(uint64_t now_us);
+
+uint64_t sim_radio_airtime_us(uint32_t node);
+
+uint32_t sim_radio_neighbours(uint32_t node);
+
+void sim_radio_get_stats(sim_radio_stats_t *stats);
+
+#endif /* _SIM_RADIO_H_ */
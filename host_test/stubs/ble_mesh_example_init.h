@@ -0,0 +1,11 @@
+/* ble_mesh_example_init.h - Host stand-in, see sim_node.c */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+esp_err_t bluetooth_init(void);
+
+void ble_mesh_get_dev_uuid(uint8_t *dev_uuid);
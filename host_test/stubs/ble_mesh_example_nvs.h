@@ -0,0 +1,19 @@
+/* ble_mesh_example_nvs.h - Host stand-in, one RAM store per simulated node,
+ * see sim_node.c
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "nvs.h"
+
+esp_err_t ble_mesh_nvs_open(nvs_handle_t *handle);
+
+esp_err_t ble_mesh_nvs_store(nvs_handle_t handle, const char *key, const void *data, size_t length);
+
+esp_err_t ble_mesh_nvs_restore(nvs_handle_t handle, const char *key, void *data, size_t length, bool *exist);
+
+esp_err_t ble_mesh_nvs_erase(nvs_handle_t handle, const char *key);
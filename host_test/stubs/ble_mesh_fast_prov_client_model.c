@@ -0,0 +1,38 @@
+/* ble_mesh_fast_prov_client_model.c - Host stand-in for the Fast Prov Client
+ * model of the fast_provisioning component of ESP-IDF. The statuses only get
+ * logged, the examples act on them themselves.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "esp_log.h"
+
+#include "ble_mesh_fast_prov_common.h"
+#include "ble_mesh_fast_prov_client_model.h"
+
+#define TAG "FAST_PROV_CLIENT"
+
+esp_err_t example_fast_prov_client_recv_status(esp_ble_mesh_model_t *model,
+                                               esp_ble_mesh_msg_ctx_t *ctx,
+                                               uint16_t len, const uint8_t *data)
+{
+    if (!model || !ctx || (len && !data)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ESP_LOGD(TAG, "%s: opcode 0x%06x from 0x%04x, %s", __func__, ctx->recv_op, ctx->addr, bt_hex(data, len));
+    return ESP_OK;
+}
+
+esp_err_t example_fast_prov_client_recv_timeout(uint32_t opcode, esp_ble_mesh_model_t *model,
+                                                esp_ble_mesh_msg_ctx_t *ctx)
+{
+    if (!model || !ctx) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ESP_LOGW(TAG, "%s: opcode 0x%06x to 0x%04x timed out", __func__, opcode, ctx->addr);
+    return ESP_OK;
+}
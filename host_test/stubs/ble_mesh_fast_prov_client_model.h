@@ -0,0 +1,32 @@
+/* ble_mesh_fast_prov_client_model.h - Host stand-in for the fast_provisioning
+ * component of ESP-IDF, see ble_mesh_fast_prov_client_model.c
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_ble_mesh_defs.h"
+
+typedef struct {
+    uint16_t net_idx;
+    uint16_t app_idx;
+    uint8_t  app_key[16];
+
+    uint16_t node_addr_cnt;     /* Number of nodes the phone expects */
+    uint16_t unicast_min;
+    uint16_t unicast_max;
+    uint16_t group_addr;
+    uint8_t  match_val[16];
+    uint8_t  match_len;
+
+    uint8_t  max_node_num;      /* Devices the Provisioner itself provisions */
+} example_prov_info_t;
+
+esp_err_t example_fast_prov_client_recv_status(esp_ble_mesh_model_t *model,
+                                               esp_ble_mesh_msg_ctx_t *ctx,
+                                               uint16_t len, const uint8_t *data);
+
+esp_err_t example_fast_prov_client_recv_timeout(uint32_t opcode, esp_ble_mesh_model_t *model,
+                                                esp_ble_mesh_msg_ctx_t *ctx);
@@ -0,0 +1,66 @@
+/* ble_mesh_fast_prov_common.h - Host stand-in for the fast_provisioning
+ * component of ESP-IDF: vendor models and opcodes, and the mesh kernel helpers.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_log.h"
+#include "esp_ble_mesh_defs.h"
+#include "host_kernel.h"
+
+#define LED_OFF     0x0
+#define LED_ON      0x1
+
+#define CID_ESP     0x02E5
+
+#define ESP_BLE_MESH_VND_MODEL_ID_FAST_PROV_SRV     0x0000
+#define ESP_BLE_MESH_VND_MODEL_ID_FAST_PROV_CLI     0x0001
+
+#define ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_SET        ESP_BLE_MESH_MODEL_OP_3(0x00, CID_ESP)
+#define ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_STATUS     ESP_BLE_MESH_MODEL_OP_3(0x01, CID_ESP)
+#define ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NET_KEY_ADD     ESP_BLE_MESH_MODEL_OP_3(0x02, CID_ESP)
+#define ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NET_KEY_STATUS  ESP_BLE_MESH_MODEL_OP_3(0x03, CID_ESP)
+#define ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR       ESP_BLE_MESH_MODEL_OP_3(0x04, CID_ESP)
+#define ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_ACK   ESP_BLE_MESH_MODEL_OP_3(0x05, CID_ESP)
+#define ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_GET   ESP_BLE_MESH_MODEL_OP_3(0x06, CID_ESP)
+#define ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_STATUS ESP_BLE_MESH_MODEL_OP_3(0x07, CID_ESP)
+#define ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_GROUP_ADD      ESP_BLE_MESH_MODEL_OP_3(0x08, CID_ESP)
+#define ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_GROUP_DELETE   ESP_BLE_MESH_MODEL_OP_3(0x09, CID_ESP)
+
+#define CONTAINER_OF(ptr, type, field) \
+    ((type *)(((char *)(ptr)) - offsetof(type, field)))
+
+/* Atomic bit flags of the mesh stack, every simulated node runs on one thread */
+typedef int bt_mesh_atomic_t;
+
+#define BLE_MESH_ATOMIC_BITS    (sizeof(bt_mesh_atomic_t) * 8)
+#define BLE_MESH_ATOMIC_DEFINE(name, num_bits) \
+    bt_mesh_atomic_t name[1 + ((num_bits) - 1) / BLE_MESH_ATOMIC_BITS]
+
+static inline bool bt_mesh_atomic_test_bit(const bt_mesh_atomic_t *target, int bit)
+{
+    return (target[bit / BLE_MESH_ATOMIC_BITS] >> (bit % BLE_MESH_ATOMIC_BITS)) & 1;
+}
+
+static inline bool bt_mesh_atomic_test_and_set_bit(bt_mesh_atomic_t *target, int bit)
+{
+    bool old = bt_mesh_atomic_test_bit(target, bit);
+
+    target[bit / BLE_MESH_ATOMIC_BITS] |= 1 << (bit % BLE_MESH_ATOMIC_BITS);
+    return old;
+}
+
+static inline bool bt_mesh_atomic_test_and_clear_bit(bt_mesh_atomic_t *target, int bit)
+{
+    bool old = bt_mesh_atomic_test_bit(target, bit);
+
+    target[bit / BLE_MESH_ATOMIC_BITS] &= ~(1 << (bit % BLE_MESH_ATOMIC_BITS));
+    return old;
+}
+
+/* Hex string in one of a few rotating buffers, see sim_node.c */
+const char *bt_hex(const void *buf, size_t len);
@@ -0,0 +1,194 @@
+/* ble_mesh_fast_prov_operation.c - Host stand-in for the message helpers of
+ * the fast_provisioning component of ESP-IDF.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "sdkconfig.h"
+#include "esp_ble_mesh_networking_api.h"
+#include "esp_ble_mesh_local_data_operation_api.h"
+
+#include "ble_mesh_fast_prov_common.h"
+#include "ble_mesh_fast_prov_operation.h"
+
+#define TAG "FAST_PROV_OP"
+
+/* Addresses of the nodes the other Provisioners provisioned, on the primary one */
+static uint16_t node_address[CONFIG_BLE_MESH_MAX_PROV_NODES];
+
+esp_err_t example_store_remote_node_address(uint16_t node_addr)
+{
+    if (!ESP_BLE_MESH_ADDR_IS_UNICAST(node_addr)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(node_address); i++) {
+        if (node_address[i] == node_addr) {
+            return ESP_OK;
+        }
+    }
+    for (int i = 0; i < ARRAY_SIZE(node_address); i++) {
+        if (node_address[i] == ESP_BLE_MESH_ADDR_UNASSIGNED) {
+            node_address[i] = node_addr;
+            return ESP_OK;
+        }
+    }
+
+    ESP_LOGE(TAG, "%s: Node address storage is full", __func__);
+    return ESP_FAIL;
+}
+
+static esp_err_t bind_app_key(esp_ble_mesh_model_t *model, uint16_t app_idx)
+{
+    for (int i = 0; i < ARRAY_SIZE(model->keys); i++) {
+        if (model->keys[i] == app_idx) {
+            return ESP_OK;
+        }
+    }
+    for (int i = 0; i < ARRAY_SIZE(model->keys); i++) {
+        if (model->keys[i] == ESP_BLE_MESH_KEY_UNUSED) {
+            model->keys[i] = app_idx;
+            return ESP_OK;
+        }
+    }
+    return ESP_FAIL;
+}
+
+esp_err_t example_handle_config_app_key_add_evt(uint16_t app_idx)
+{
+    const esp_ble_mesh_comp_t *comp = esp_ble_mesh_get_composition_data();
+
+    if (!comp) {
+        return ESP_FAIL;
+    }
+
+    for (int i = 0; i < comp->element_count; i++) {
+        esp_ble_mesh_elem_t *element = &comp->elements[i];
+
+        /* The Configuration models use the device key */
+        for (int j = 0; j < element->sig_model_count; j++) {
+            esp_ble_mesh_model_t *model = &element->sig_models[j];
+
+            if (model->model_id == ESP_BLE_MESH_MODEL_ID_CONFIG_SRV ||
+                    model->model_id == ESP_BLE_MESH_MODEL_ID_CONFIG_CLI) {
+                continue;
+            }
+            if (bind_app_key(model, app_idx) != ESP_OK) {
+                ESP_LOGE(TAG, "%s: No free key for model 0x%04x", __func__, model->model_id);
+                return ESP_FAIL;
+            }
+        }
+        for (int j = 0; j < element->vnd_model_count; j++) {
+            esp_ble_mesh_model_t *model = &element->vnd_models[j];
+
+            if (bind_app_key(model, app_idx) != ESP_OK) {
+                ESP_LOGE(TAG, "%s: No free key for model 0x%04x", __func__, model->vnd.model_id);
+                return ESP_FAIL;
+            }
+        }
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t example_send_config_appkey_add(esp_ble_mesh_model_t *model,
+                                         example_msg_common_info_t *info,
+                                         esp_ble_mesh_cfg_app_key_add_t *add_key)
+{
+    esp_ble_mesh_client_common_param_t common = {0};
+    esp_ble_mesh_cfg_client_set_state_t set = {0};
+    const uint8_t *key = NULL;
+
+    if (!model || !info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (add_key) {
+        set.app_key_add.net_idx = add_key->net_idx;
+        set.app_key_add.app_idx = add_key->app_idx;
+        key = add_key->app_key;
+    } else {
+        key = esp_ble_mesh_provisioner_get_local_app_key(info->net_idx, info->app_idx);
+        if (!key) {
+            ESP_LOGE(TAG, "%s: Failed to get AppKey 0x%04x", __func__, info->app_idx);
+            return ESP_FAIL;
+        }
+        set.app_key_add.net_idx = info->net_idx;
+        set.app_key_add.app_idx = info->app_idx;
+    }
+    memcpy(set.app_key_add.app_key, key, 16);
+
+    common.opcode = ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD;
+    common.model = model;
+    common.ctx.net_idx = info->net_idx;
+    common.ctx.app_idx = ESP_BLE_MESH_KEY_UNUSED;
+    common.ctx.addr = info->dst;
+    common.ctx.send_rel = false;
+    common.ctx.send_ttl = ESP_BLE_MESH_TTL_DEFAULT;
+    common.msg_timeout = info->timeout;
+    common.msg_role = info->role;
+
+    return esp_ble_mesh_config_client_set_state(&common, &set);
+}
+
+esp_err_t example_send_fast_prov_info_set(esp_ble_mesh_model_t *model,
+                                          example_msg_common_info_t *info,
+                                          example_fast_prov_info_set_t *set)
+{
+    esp_ble_mesh_msg_ctx_t ctx = {0};
+    uint8_t msg[2 + 17 + sizeof(set->match_val) + 1];
+    uint16_t len = 0;
+
+    if (!model || !info || !set || !set->ctx_flags || set->match_len > sizeof(set->match_val)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+#define ADD_LE16(val)   do { msg[len++] = (val) & 0xFF; msg[len++] = (val) >> 8; } while (0)
+    ADD_LE16(set->ctx_flags);
+    if (set->ctx_flags & BIT(0)) {
+        ADD_LE16(set->node_addr_cnt);
+    }
+    if (set->ctx_flags & BIT(1)) {
+        ADD_LE16(set->unicast_min);
+    }
+    if (set->ctx_flags & BIT(2)) {
+        ADD_LE16(set->unicast_max);
+    }
+    if (set->ctx_flags & BIT(3)) {
+        msg[len++] = set->flags;
+    }
+    if (set->ctx_flags & BIT(4)) {
+        ADD_LE16(set->iv_index & 0xFFFF);
+        ADD_LE16(set->iv_index >> 16);
+    }
+    if (set->ctx_flags & BIT(5)) {
+        ADD_LE16(set->net_idx);
+    }
+    if (set->ctx_flags & BIT(6)) {
+        ADD_LE16(set->group_addr);
+    }
+    if (set->ctx_flags & BIT(7)) {
+        ADD_LE16(set->pri_prov_addr);
+    }
+#undef ADD_LE16
+    if (set->ctx_flags & BIT(8)) {
+        memcpy(&msg[len], set->match_val, set->match_len);
+        len += set->match_len;
+    }
+    if (set->ctx_flags & BIT(9)) {
+        msg[len++] = set->action;
+    }
+
+    ctx.net_idx = info->net_idx;
+    ctx.app_idx = info->app_idx;
+    ctx.addr = info->dst;
+    ctx.send_rel = false;
+    ctx.send_ttl = ESP_BLE_MESH_TTL_DEFAULT;
+
+    return esp_ble_mesh_client_model_send_msg(model, &ctx, ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_SET,
+                                              len, msg, info->timeout, true, info->role);
+}
@@ -0,0 +1,76 @@
+/* ble_mesh_fast_prov_operation.h - Host stand-in for the fast_provisioning
+ * component of ESP-IDF, with its node info layout.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_ble_mesh_defs.h"
+#include "esp_ble_mesh_config_model_api.h"
+
+typedef struct {
+    uint8_t  uuid[16];
+    uint16_t unicast_addr;
+    uint8_t  element_num;
+    uint16_t net_idx;
+    uint16_t app_idx;
+    uint8_t  onoff;
+
+    /* The following parameters are used to send Fast Prov Info Set, in the
+     * order of its fields.
+     */
+    bool     reprov;
+    bool     lack_of_addr;
+    uint16_t node_addr_cnt;
+    uint16_t unicast_min;
+    uint16_t unicast_max;
+    uint8_t  flags;
+    uint32_t iv_index;
+    uint16_t fp_net_idx;
+    uint16_t group_addr;
+    uint16_t prov_addr;
+    uint8_t  match_len;
+    uint8_t  match_val[16];
+    uint8_t  action;
+} __attribute__((packed)) example_node_info_t;
+
+/* Fast Prov Info Set, ctx_flags selects the fields which are sent */
+typedef struct {
+    uint16_t ctx_flags;
+    uint16_t node_addr_cnt;
+    uint16_t unicast_min;
+    uint16_t unicast_max;
+    uint8_t  flags;
+    uint32_t iv_index;
+    uint16_t net_idx;
+    uint16_t group_addr;
+    uint16_t pri_prov_addr;
+    uint8_t  match_len;
+    uint8_t  match_val[16];
+    uint8_t  action;
+} __attribute__((packed)) example_fast_prov_info_set_t;
+
+typedef struct {
+    uint16_t net_idx;
+    uint16_t app_idx;
+    uint16_t dst;
+    int32_t  timeout;
+    esp_ble_mesh_dev_role_t role;
+} example_msg_common_info_t;
+
+esp_err_t example_store_remote_node_address(uint16_t node_addr);
+
+/* Binds app_idx to the models of the node other than the configuration ones */
+esp_err_t example_handle_config_app_key_add_evt(uint16_t app_idx);
+
+/* Config AppKey Add, with the local AppKey of info->app_idx if add_key is NULL */
+esp_err_t example_send_config_appkey_add(esp_ble_mesh_model_t *model,
+                                         example_msg_common_info_t *info,
+                                         esp_ble_mesh_cfg_app_key_add_t *add_key);
+
+esp_err_t example_send_fast_prov_info_set(esp_ble_mesh_model_t *model,
+                                          example_msg_common_info_t *info,
+                                          example_fast_prov_info_set_t *set);
@@ -0,0 +1,288 @@
+/* ble_mesh_fast_prov_server_model.c - Host stand-in for the Fast Prov Server
+ * model of the fast_provisioning component of ESP-IDF. It handles Fast Prov
+ * Info Set the way the component does: the range of the message is split
+ * between the devices the node provisions itself and the ranges it hands out,
+ * the node becomes the primary Provisioner without a primary address, and
+ * the status is sent once the fast provisioning info and action are set.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "esp_ble_mesh_networking_api.h"
+#include "esp_ble_mesh_provisioning_api.h"
+#include "esp_ble_mesh_proxy_api.h"
+#include "esp_ble_mesh_local_data_operation_api.h"
+
+#include "ble_mesh_fast_prov_server_model.h"
+#include "ble_mesh_fast_prov_operation.h"
+
+#define TAG "FAST_PROV_SERVER"
+
+static uint16_t pull_le16(struct net_buf_simple *buf)
+{
+    uint16_t val = buf->data[0] | buf->data[1] << 8;
+
+    buf->data += 2;
+    buf->len -= 2;
+    return val;
+}
+
+static uint8_t pull_u8(struct net_buf_simple *buf)
+{
+    buf->len--;
+    return *buf->data++;
+}
+
+/* Fast Prov Info Status: bit mask, ctx flags, unicast, net_idx, group,
+ * primary Provisioner address, match and action status
+ */
+static esp_err_t send_info_status(example_fast_prov_server_t *srv, esp_ble_mesh_msg_ctx_t *ctx,
+                                  uint8_t status_unicast, uint8_t status_action)
+{
+    uint8_t status[8] = { 0 };
+
+    status[2] = status_unicast;
+    status[7] = status_action;
+    return esp_ble_mesh_server_model_send_msg(srv->model, ctx, ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_STATUS,
+                                              sizeof(status), status);
+}
+
+static esp_err_t recv_info_set(example_fast_prov_server_t *srv, esp_ble_mesh_msg_ctx_t *ctx,
+                               struct net_buf_simple *buf)
+{
+    esp_ble_mesh_fast_prov_info_t info = { 0 };
+    uint16_t ctx_flags, unicast_min, unicast_max, group_addr, prim_prov_addr;
+    uint16_t own = esp_ble_mesh_get_primary_element_address();
+    uint8_t action, need = 2;
+
+    /* The fields of the flags set, with the action last */
+    static const uint8_t field_len[] = { 2, 2, 2, 1, 4, 2, 2, 2 };
+
+    if (srv->state == STATE_PEND) {
+        return send_info_status(srv, ctx, 0x01, 0x01);
+    }
+    if (buf->len < 2) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ctx_flags = pull_le16(buf);
+    need = 0;
+    for (int i = 0; i < sizeof(field_len); i++) {
+        need += (ctx_flags & BIT(i)) ? field_len[i] : 0;
+    }
+    need += (ctx_flags & BIT(9)) ? 1 : 0;
+    if (!ctx_flags || buf->len < need) {
+        return send_info_status(srv, ctx, 0x01, 0x01);
+    }
+
+    srv->node_addr_cnt = (ctx_flags & BIT(0)) ? pull_le16(buf) : srv->node_addr_cnt;
+    unicast_min = (ctx_flags & BIT(1)) ? pull_le16(buf) : own + 1;
+    unicast_max = (ctx_flags & BIT(2)) ? pull_le16(buf) : 0x7FFF;
+    srv->flags = (ctx_flags & BIT(3)) ? pull_u8(buf) : srv->flags;
+    if (ctx_flags & BIT(4)) {
+        srv->iv_index = pull_le16(buf);
+        srv->iv_index |= (uint32_t)pull_le16(buf) << 16;
+    }
+    srv->net_idx = (ctx_flags & BIT(5)) ? pull_le16(buf) : srv->net_idx;
+    group_addr = (ctx_flags & BIT(6)) ? pull_le16(buf) : ESP_BLE_MESH_ADDR_UNASSIGNED;
+    prim_prov_addr = (ctx_flags & BIT(7)) ? pull_le16(buf) : ESP_BLE_MESH_ADDR_UNASSIGNED;
+    if (ctx_flags & BIT(8)) {
+        srv->match_len = buf->len - ((ctx_flags & BIT(9)) ? 1 : 0);
+        if (srv->match_len > sizeof(srv->match_val)) {
+            return send_info_status(srv, ctx, 0x00, 0x01);
+        }
+        memcpy(srv->match_val, buf->data, srv->match_len);
+        buf->data += srv->match_len;
+        buf->len -= srv->match_len;
+    }
+    action = (ctx_flags & BIT(9)) ? pull_u8(buf) : FAST_PROV_ACT_NONE;
+
+    if (srv->state == STATE_ACTIVE && !(action & BIT(7))) {
+        return send_info_status(srv, ctx, 0x00, 0x01);
+    }
+    if ((ctx_flags & (BIT(1) | BIT(2))) &&
+            (unicast_min >= unicast_max || unicast_max - unicast_min + 1 < srv->max_node_num)) {
+        return send_info_status(srv, ctx, 0x01, 0x00);
+    }
+
+    srv->app_idx = ctx->app_idx;
+    srv->primary_role = !(ctx_flags & BIT(7));
+    srv->prim_prov_addr = srv->primary_role ? own : prim_prov_addr;
+
+    /* The node provisions the first max_node_num addresses, and splits the
+     * rest between the devices it provisions
+     */
+    info.unicast_min = unicast_min;
+    info.unicast_max = unicast_min + srv->max_node_num - 1;
+    srv->unicast_min = srv->unicast_cur = unicast_min + srv->max_node_num;
+    srv->unicast_max = unicast_max;
+    srv->unicast_step = srv->unicast_min <= unicast_max ?
+                        (unicast_max - srv->unicast_min) / srv->max_node_num : 0;
+    info.net_idx = srv->net_idx;
+    info.flags = srv->flags;
+    info.iv_index = srv->iv_index;
+    info.offset = 0;
+    info.match_len = srv->match_len;
+    memcpy(info.match_val, srv->match_val, srv->match_len);
+
+    if (ESP_BLE_MESH_ADDR_IS_GROUP(group_addr)) {
+        srv->group_addr = group_addr;
+        esp_ble_mesh_model_subscribe_group_addr(own, ESP_BLE_MESH_CID_NVAL,
+                                                ESP_BLE_MESH_MODEL_ID_GEN_ONOFF_SRV, group_addr);
+    }
+    srv->pend_act = action & 0x7F;
+    memcpy(&srv->ctx, ctx, sizeof(srv->ctx));
+    srv->state = STATE_PEND;
+
+    return esp_ble_mesh_set_fast_prov_info(&info);
+}
+
+esp_err_t example_fast_prov_server_recv_msg(esp_ble_mesh_model_t *model,
+                                            esp_ble_mesh_msg_ctx_t *ctx,
+                                            struct net_buf_simple *buf)
+{
+    example_fast_prov_server_t *srv = NULL;
+    uint8_t status = 0x00;
+
+    if (!model || !model->user_data || !ctx || !buf) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    srv = model->user_data;
+
+    switch (ctx->recv_op) {
+    case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_SET:
+        return recv_info_set(srv, ctx, buf);
+    case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NET_KEY_ADD: {
+        uint8_t net_key_status[2] = { 0x01, 0x00 };
+
+        /* Only the primary subnet is simulated */
+        return esp_ble_mesh_server_model_send_msg(model, ctx, ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NET_KEY_STATUS,
+                                                  sizeof(net_key_status), net_key_status);
+    }
+    case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR:
+        while (buf->len >= 2) {
+            example_store_remote_node_address(pull_le16(buf));
+        }
+        return esp_ble_mesh_server_model_send_msg(model, ctx, ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_ACK,
+                                                  0, NULL);
+    case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_GET:
+        return esp_ble_mesh_server_model_send_msg(model, ctx, ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_STATUS,
+                                                  sizeof(status), &status);
+    case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_GROUP_ADD:
+        if (buf->len < 2) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        return esp_ble_mesh_model_subscribe_group_addr(esp_ble_mesh_get_primary_element_address(),
+                                                       ESP_BLE_MESH_CID_NVAL,
+                                                       ESP_BLE_MESH_MODEL_ID_GEN_ONOFF_SRV, pull_le16(buf));
+    case ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_GROUP_DELETE:
+        return ESP_OK;
+    default:
+        ESP_LOGW(TAG, "%s: Unknown opcode 0x%06x", __func__, ctx->recv_op);
+        return ESP_ERR_INVALID_ARG;
+    }
+}
+
+esp_err_t example_handle_fast_prov_info_set_comp_evt(esp_ble_mesh_model_t *model, uint8_t status_unicast,
+                                                     uint8_t status_net_idx, uint8_t status_match)
+{
+    example_fast_prov_server_t *srv = NULL;
+
+    if (!model || !model->user_data) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    srv = model->user_data;
+
+    if (status_unicast || status_net_idx || status_match) {
+        srv->state = STATE_IDLE;
+        return send_info_status(srv, &srv->ctx, status_unicast, 0x01);
+    }
+    return esp_ble_mesh_set_fast_prov_action(srv->pend_act);
+}
+
+esp_err_t example_handle_fast_prov_action_set_comp_evt(esp_ble_mesh_model_t *model, uint8_t status_action)
+{
+    example_fast_prov_server_t *srv = NULL;
+
+    if (!model || !model->user_data) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    srv = model->user_data;
+
+    if (srv->state != STATE_PEND) {
+        /* Suspended by the disable timer, or exited */
+        srv->state = STATE_IDLE;
+        return ESP_OK;
+    }
+    if (status_action) {
+        srv->state = STATE_IDLE;
+    }
+    return send_info_status(srv, &srv->ctx, 0x00, status_action);
+}
+
+esp_err_t example_handle_fast_prov_status_send_comp_evt(int err_code, uint32_t opcode,
+                                                        esp_ble_mesh_model_t *model,
+                                                        esp_ble_mesh_msg_ctx_t *ctx)
+{
+    example_fast_prov_server_t *srv = NULL;
+
+    if (!model || !model->user_data) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    srv = model->user_data;
+
+    if (opcode != ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_STATUS || srv->state != STATE_PEND) {
+        return ESP_OK;
+    }
+    if (err_code) {
+        ESP_LOGE(TAG, "%s: Failed to send Fast Prov Info Status (err %d)", __func__, err_code);
+    }
+    switch (srv->pend_act) {
+    case FAST_PROV_ACT_ENTER:
+        /* The Provisioner advertises on PB-ADV only while it provisions */
+        srv->state = STATE_ACTIVE;
+        return esp_ble_mesh_node_proxy_gatt_disable();
+    case FAST_PROV_ACT_EXIT:
+        srv->state = STATE_IDLE;
+        return esp_ble_mesh_node_proxy_gatt_enable();
+    default:
+        srv->state = STATE_IDLE;
+        return ESP_OK;
+    }
+}
+
+static void disable_fast_prov_timeout(struct k_work *work)
+{
+    example_fast_prov_server_t *srv = CONTAINER_OF(work, example_fast_prov_server_t,
+                                                   disable_fast_prov_timer.work);
+
+    bt_mesh_atomic_test_and_clear_bit(srv->srv_flags, DISABLE_FAST_PROV_START);
+    esp_ble_mesh_set_fast_prov_action(FAST_PROV_ACT_SUSPEND);
+}
+
+static void gatt_proxy_enable_timeout(struct k_work *work)
+{
+    example_fast_prov_server_t *srv = CONTAINER_OF(work, example_fast_prov_server_t,
+                                                   gatt_proxy_enable_timer.work);
+
+    bt_mesh_atomic_test_and_clear_bit(srv->srv_flags, GATT_PROXY_ENABLE_START);
+    esp_ble_mesh_node_proxy_gatt_enable();
+}
+
+esp_err_t example_fast_prov_server_init(esp_ble_mesh_model_t *model)
+{
+    example_fast_prov_server_t *srv = NULL;
+
+    if (!model || !model->user_data) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    srv = model->user_data;
+    srv->model = model;
+
+    k_delayed_work_init(&srv->disable_fast_prov_timer, disable_fast_prov_timeout);
+    k_delayed_work_init(&srv->gatt_proxy_enable_timer, gatt_proxy_enable_timeout);
+    return ESP_OK;
+}
@@ -0,0 +1,5 @@
+/* esp_attr.h - Host stand-in, everything runs from the same memory */
+
+#pragma once
+
+#define IRAM_ATTR
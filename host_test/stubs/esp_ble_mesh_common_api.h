@@ -0,0 +1,7 @@
+/* esp_ble_mesh_common_api.h - Host stand-in, see sim_mesh.c */
+
+#pragma once
+
+#include "esp_ble_mesh_defs.h"
+
+esp_err_t esp_ble_mesh_init(esp_ble_mesh_prov_t *prov, esp_ble_mesh_comp_t *comp);
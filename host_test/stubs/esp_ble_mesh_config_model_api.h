@@ -0,0 +1,100 @@
+/* esp_ble_mesh_config_model_api.h - Host stand-in, the messages the examples
+ * and the simulations send.
+ */
+
+#pragma once
+
+#include "esp_ble_mesh_defs.h"
+
+typedef struct {
+    uint16_t net_idx;
+    uint16_t app_idx;
+    uint8_t  app_key[16];
+} esp_ble_mesh_cfg_app_key_add_t;
+
+typedef struct {
+    uint16_t element_addr;
+    uint16_t model_app_idx;
+    uint16_t model_id;
+    uint16_t company_id;
+} esp_ble_mesh_cfg_model_app_bind_t;
+
+typedef struct {
+    uint16_t element_addr;
+    uint16_t sub_addr;
+    uint16_t model_id;
+    uint16_t company_id;
+} esp_ble_mesh_cfg_model_sub_add_t;
+
+typedef union {
+    esp_ble_mesh_cfg_app_key_add_t    app_key_add;
+    esp_ble_mesh_cfg_model_app_bind_t model_app_bind;
+    esp_ble_mesh_cfg_model_sub_add_t  model_sub_add;
+} esp_ble_mesh_cfg_client_set_state_t;
+
+typedef struct {
+    uint8_t  status;
+    uint16_t net_idx;
+    uint16_t app_idx;
+} esp_ble_mesh_cfg_appkey_status_cb_t;
+
+typedef enum {
+    ESP_BLE_MESH_CFG_CLIENT_GET_STATE_EVT,
+    ESP_BLE_MESH_CFG_CLIENT_SET_STATE_EVT,
+    ESP_BLE_MESH_CFG_CLIENT_PUBLISH_EVT,
+    ESP_BLE_MESH_CFG_CLIENT_TIMEOUT_EVT,
+    ESP_BLE_MESH_CFG_CLIENT_EVT_MAX,
+} esp_ble_mesh_cfg_client_cb_event_t;
+
+typedef struct {
+    int error_code;
+    esp_ble_mesh_client_common_param_t *params;
+    union {
+        esp_ble_mesh_cfg_appkey_status_cb_t appkey_status;
+    } status_cb;
+} esp_ble_mesh_cfg_client_cb_param_t;
+
+typedef enum {
+    ESP_BLE_MESH_CFG_SERVER_STATE_CHANGE_EVT,
+    ESP_BLE_MESH_CFG_SERVER_EVT_MAX,
+} esp_ble_mesh_cfg_server_cb_event_t;
+
+typedef struct {
+    uint16_t element_addr;
+    uint16_t sub_addr;
+    uint16_t company_id;
+    uint16_t model_id;
+} esp_ble_mesh_state_change_model_sub_t;
+
+typedef struct {
+    esp_ble_mesh_model_t *model;
+    esp_ble_mesh_msg_ctx_t ctx;
+    union {
+        union {
+            struct {
+                uint16_t net_idx;
+                uint16_t app_idx;
+                uint8_t  app_key[16];
+            } appkey_add;
+            struct {
+                uint16_t element_addr;
+                uint16_t app_idx;
+                uint16_t company_id;
+                uint16_t model_id;
+            } mod_app_bind;
+            esp_ble_mesh_state_change_model_sub_t mod_sub_add;
+            esp_ble_mesh_state_change_model_sub_t mod_sub_delete;
+        } state_change;
+    } value;
+} esp_ble_mesh_cfg_server_cb_param_t;
+
+typedef void (*esp_ble_mesh_cfg_client_cb_t)(esp_ble_mesh_cfg_client_cb_event_t event,
+                                             esp_ble_mesh_cfg_client_cb_param_t *param);
+typedef void (*esp_ble_mesh_cfg_server_cb_t)(esp_ble_mesh_cfg_server_cb_event_t event,
+                                             esp_ble_mesh_cfg_server_cb_param_t *param);
+
+esp_err_t esp_ble_mesh_register_config_client_callback(esp_ble_mesh_cfg_client_cb_t callback);
+esp_err_t esp_ble_mesh_register_config_server_callback(esp_ble_mesh_cfg_server_cb_t callback);
+
+esp_err_t esp_ble_mesh_config_client_set_state(esp_ble_mesh_client_common_param_t *params,
+                                               esp_ble_mesh_cfg_client_set_state_t *set_state);
@@ -0,0 +1,441 @@
+/* esp_ble_mesh_defs.h - Host stand-in, only what the tested sources and the
+ * examples run by the simulations use.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(array)   (sizeof(array) / sizeof((array)[0]))
+#endif
+
+#ifndef BIT
+#define BIT(nr)             (1UL << (nr))
+#endif
+
+#define BLE_MESH_ADDR_LEN               6
+
+#define ESP_BLE_MESH_ADDR_UNASSIGNED    0x0000
+#define ESP_BLE_MESH_ADDR_ALL_NODES     0xFFFF
+
+#define ESP_BLE_MESH_ADDR_IS_UNICAST(addr)  ((addr) && (addr) < 0x8000)
+#define ESP_BLE_MESH_ADDR_IS_GROUP(addr)    ((addr) >= 0xC000 && (addr) <= 0xFF00)
+
+#define ESP_BLE_MESH_KEY_UNUSED         0xFFFF
+#define ESP_BLE_MESH_KEY_PRIMARY        0x0000
+#define ESP_BLE_MESH_CID_NVAL           0xFFFF
+
+#define ESP_BLE_MESH_TTL_DEFAULT        0xFF
+
+#define ESP_BLE_MESH_RELAY_DISABLED         0x00
+#define ESP_BLE_MESH_RELAY_ENABLED          0x01
+#define ESP_BLE_MESH_RELAY_NOT_SUPPORTED    0x02
+
+#define ESP_BLE_MESH_BEACON_DISABLED        0x00
+#define ESP_BLE_MESH_BEACON_ENABLED         0x01
+
+#define ESP_BLE_MESH_GATT_PROXY_DISABLED        0x00
+#define ESP_BLE_MESH_GATT_PROXY_ENABLED         0x01
+#define ESP_BLE_MESH_GATT_PROXY_NOT_SUPPORTED   0x02
+
+#define ESP_BLE_MESH_FRIEND_DISABLED        0x00
+#define ESP_BLE_MESH_FRIEND_ENABLED         0x01
+#define ESP_BLE_MESH_FRIEND_NOT_SUPPORTED   0x02
+
+/* Network Transmit and Relay Retransmit: count + 1 transmissions int_ms apart */
+#define ESP_BLE_MESH_TRANSMIT(count, int_ms)        ((count) | ((((int_ms) / 10) - 1) << 3))
+#define ESP_BLE_MESH_GET_TRANSMIT_COUNT(transmit)   ((transmit) & 0x07)
+#define ESP_BLE_MESH_GET_TRANSMIT_INTERVAL(transmit) ((((transmit) >> 3) + 1) * 10)
+
+typedef uint8_t esp_ble_mesh_dev_role_t;
+
+#define ROLE_NODE           0
+#define ROLE_PROVISIONER    1
+#define ROLE_FAST_PROV      2
+
+typedef uint8_t esp_ble_mesh_prov_bearer_t;
+
+#define ESP_BLE_MESH_PROV_ADV   BIT(0)
+#define ESP_BLE_MESH_PROV_GATT  BIT(1)
+
+typedef uint8_t esp_ble_mesh_output_action_t;
+
+#define ESP_BLE_MESH_NO_OUTPUT          0
+#define ESP_BLE_MESH_BLINK              BIT(0)
+#define ESP_BLE_MESH_BEEP               BIT(1)
+#define ESP_BLE_MESH_VIBRATE            BIT(2)
+#define ESP_BLE_MESH_DISPLAY_NUMBER     BIT(3)
+#define ESP_BLE_MESH_DISPLAY_STRING     BIT(4)
+
+typedef uint8_t esp_ble_mesh_addr_type_t;
+
+typedef uint8_t esp_ble_mesh_dev_add_flag_t;
+
+#define ADD_DEV_RM_AFTER_PROV_FLAG      BIT(0)
+#define ADD_DEV_START_PROV_NOW_FLAG     BIT(1)
+#define ADD_DEV_FLUSHABLE_DEV_FLAG      BIT(2)
+
+typedef enum {
+    FAST_PROV_ACT_NONE,
+    FAST_PROV_ACT_ENTER,
+    FAST_PROV_ACT_SUSPEND,
+    FAST_PROV_ACT_EXIT,
+    FAST_PROV_ACT_MAX,
+} esp_ble_mesh_fast_prov_action_t;
+
+#define ESP_BLE_MESH_MODEL_ID_CONFIG_SRV    0x0000
+#define ESP_BLE_MESH_MODEL_ID_CONFIG_CLI    0x0001
+#define ESP_BLE_MESH_MODEL_ID_GEN_ONOFF_SRV 0x1000
+#define ESP_BLE_MESH_MODEL_ID_GEN_ONOFF_CLI 0x1001
+
+struct net_buf_simple {
+    uint8_t *data;
+    uint16_t len;
+    uint16_t size;
+    uint8_t *__buf;
+};
+
+typedef void (*esp_ble_mesh_cb_t)(void);
+
+typedef struct {
+    uint32_t opcode;
+    size_t min_len;
+    esp_ble_mesh_cb_t param_cb;
+} esp_ble_mesh_model_op_t;
+
+#define ESP_BLE_MESH_MODEL_OP(_opcode, _min_len)    { .opcode = _opcode, .min_len = _min_len }
+#define ESP_BLE_MESH_MODEL_OP_END                   { 0, 0, 0 }
+
+struct esp_ble_mesh_model_pub;
+struct esp_ble_mesh_elem;
+
+typedef struct esp_ble_mesh_model {
+    union {
+        uint16_t model_id;
+        struct {
+            uint16_t company_id;
+            uint16_t model_id;
+        } vnd;
+    };
+    uint8_t element_idx;
+    uint8_t model_idx;
+    struct esp_ble_mesh_elem *element;
+    struct esp_ble_mesh_model_pub *pub;
+    uint16_t keys[1];
+    uint16_t groups[CONFIG_BLE_MESH_MODEL_GROUP_COUNT];
+    esp_ble_mesh_model_op_t *op;
+    void *user_data;
+} esp_ble_mesh_model_t;
+
+typedef struct esp_ble_mesh_model_pub {
+    esp_ble_mesh_model_t *model;
+    uint16_t publish_addr;
+    uint16_t app_idx;
+    uint8_t ttl;
+    uint8_t retransmit;
+    uint8_t period;
+    esp_ble_mesh_dev_role_t dev_role;
+    uint8_t msg_len;        /* Opcode and payload the publication buffer holds */
+} esp_ble_mesh_model_pub_t;
+
+#define ESP_BLE_MESH_MODEL_PUB_DEFINE(_name, _msg_len, _role)   \
+    static esp_ble_mesh_model_pub_t _name = {                   \
+        .dev_role = _role,                                      \
+        .msg_len = _msg_len,                                    \
+    }
+
+#define ESP_BLE_MESH_SIG_MODEL(_id, _op, _pub, _user_data)      \
+    { .model_id = _id, .pub = _pub, .op = _op, .user_data = _user_data }
+
+#define ESP_BLE_MESH_VENDOR_MODEL(_company, _id, _op, _pub, _user_data) \
+    { .vnd = { .company_id = _company, .model_id = _id },               \
+      .pub = _pub, .op = _op, .user_data = _user_data }
+
+#define ESP_BLE_MESH_MODEL_CFG_SRV(srv_data)    \
+    ESP_BLE_MESH_SIG_MODEL(ESP_BLE_MESH_MODEL_ID_CONFIG_SRV, NULL, NULL, srv_data)
+#define ESP_BLE_MESH_MODEL_CFG_CLI(cli_data)    \
+    ESP_BLE_MESH_SIG_MODEL(ESP_BLE_MESH_MODEL_ID_CONFIG_CLI, NULL, NULL, cli_data)
+
+typedef struct esp_ble_mesh_elem {
+    uint16_t element_addr;
+    uint16_t location;
+    uint8_t sig_model_count;
+    uint8_t vnd_model_count;
+    esp_ble_mesh_model_t *sig_models;
+    esp_ble_mesh_model_t *vnd_models;
+} esp_ble_mesh_elem_t;
+
+#define ESP_BLE_MESH_MODEL_NONE     ((esp_ble_mesh_model_t []){})
+
+#define ESP_BLE_MESH_ELEMENT(_loc, _mods, _vnd_mods)    \
+{                                                       \
+    .location = _loc,                                   \
+    .sig_model_count = ARRAY_SIZE(_mods),               \
+    .vnd_model_count = ARRAY_SIZE(_vnd_mods),           \
+    .sig_models = (_mods),                              \
+    .vnd_models = (_vnd_mods),                          \
+}
+
+typedef struct {
+    uint16_t cid;
+    uint16_t pid;
+    uint16_t vid;
+    size_t element_count;
+    esp_ble_mesh_elem_t *elements;
+} esp_ble_mesh_comp_t;
+
+typedef struct {
+    /* Node */
+    const uint8_t *uuid;
+    uint8_t output_size;
+    esp_ble_mesh_output_action_t output_actions;
+    /* Provisioner */
+    const uint8_t *prov_uuid;
+    uint16_t prov_unicast_addr;
+    uint16_t prov_start_address;
+    uint8_t prov_attention;
+    uint8_t prov_algorithm;
+    uint8_t prov_pub_key_oob;
+    const uint8_t *prov_static_oob_val;
+    uint8_t prov_static_oob_len;
+    uint8_t flags;
+    uint32_t iv_index;
+} esp_ble_mesh_prov_t;
+
+typedef struct {
+    uint8_t net_transmit;
+    uint8_t relay;
+    uint8_t relay_retransmit;
+    uint8_t beacon;
+    uint8_t gatt_proxy;
+    uint8_t friend_state;
+    uint8_t default_ttl;
+} esp_ble_mesh_cfg_srv_t;
+
+typedef struct {
+    uint32_t cli_op;
+    uint32_t status_op;
+} esp_ble_mesh_client_op_pair_t;
+
+typedef struct {
+    esp_ble_mesh_model_t *model;
+    uint32_t op_pair_size;
+    const esp_ble_mesh_client_op_pair_t *op_pair;
+    uint32_t publish_status;
+    void *internal_data;
+    uint8_t msg_role;
+} esp_ble_mesh_client_t;
+
+typedef struct {
+    uint16_t net_idx;
+    uint16_t app_idx;
+    uint16_t addr;
+    uint16_t recv_dst;
+    int8_t   recv_rssi;
+    uint32_t recv_op;
+    uint8_t  recv_ttl;
+    uint8_t  send_rel;
+    uint8_t  send_ttl;
+    void    *model;
+    bool     srv_send;
+} esp_ble_mesh_msg_ctx_t;
+
+#define ESP_BLE_MESH_MODEL_OP_1(b0)         (b0)
+#define ESP_BLE_MESH_MODEL_OP_2(b0, b1)     (((b0) << 8) | (b1))
+#define ESP_BLE_MESH_MODEL_OP_3(b0, cid)    ((((b0) << 16) | 0xC00000) | (cid))
+
+#define ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD           ESP_BLE_MESH_MODEL_OP_1(0x00)
+#define ESP_BLE_MESH_MODEL_OP_APP_KEY_STATUS        ESP_BLE_MESH_MODEL_OP_2(0x80, 0x03)
+#define ESP_BLE_MESH_MODEL_OP_MODEL_SUB_ADD         ESP_BLE_MESH_MODEL_OP_2(0x80, 0x1B)
+#define ESP_BLE_MESH_MODEL_OP_MODEL_SUB_DELETE      ESP_BLE_MESH_MODEL_OP_2(0x80, 0x1C)
+#define ESP_BLE_MESH_MODEL_OP_MODEL_SUB_STATUS      ESP_BLE_MESH_MODEL_OP_2(0x80, 0x1F)
+#define ESP_BLE_MESH_MODEL_OP_MODEL_APP_BIND        ESP_BLE_MESH_MODEL_OP_2(0x80, 0x3D)
+#define ESP_BLE_MESH_MODEL_OP_MODEL_APP_STATUS      ESP_BLE_MESH_MODEL_OP_2(0x80, 0x3E)
+
+typedef struct {
+    uint32_t opcode;
+    esp_ble_mesh_model_t *model;
+    esp_ble_mesh_msg_ctx_t ctx;
+    int32_t msg_timeout;
+    esp_ble_mesh_dev_role_t msg_role;
+} esp_ble_mesh_client_common_param_t;
+
+typedef struct {
+    uint8_t addr[BLE_MESH_ADDR_LEN];
+    esp_ble_mesh_addr_type_t addr_type;
+    uint8_t uuid[16];
+    uint16_t oob_info;
+    esp_ble_mesh_prov_bearer_t bearer;
+} esp_ble_mesh_unprov_dev_add_t;
+
+typedef struct {
+    uint16_t unicast_min;
+    uint16_t unicast_max;
+    uint16_t net_idx;
+    uint8_t flags;
+    uint32_t iv_index;
+    uint8_t offset;
+    uint8_t match_len;
+    uint8_t match_val[16];
+} esp_ble_mesh_fast_prov_info_t;
+
+/* Provisioning events */
+typedef enum {
+    ESP_BLE_MESH_PROV_REGISTER_COMP_EVT,
+    ESP_BLE_MESH_NODE_SET_UNPROV_DEV_NAME_COMP_EVT,
+    ESP_BLE_MESH_NODE_PROV_ENABLE_COMP_EVT,
+    ESP_BLE_MESH_NODE_PROV_LINK_OPEN_EVT,
+    ESP_BLE_MESH_NODE_PROV_LINK_CLOSE_EVT,
+    ESP_BLE_MESH_NODE_PROV_COMPLETE_EVT,
+    ESP_BLE_MESH_NODE_PROV_RESET_EVT,
+    ESP_BLE_MESH_NODE_PROXY_GATT_ENABLE_COMP_EVT,
+    ESP_BLE_MESH_NODE_PROXY_GATT_DISABLE_COMP_EVT,
+    ESP_BLE_MESH_PROVISIONER_PROV_ENABLE_COMP_EVT,
+    ESP_BLE_MESH_PROVISIONER_RECV_UNPROV_ADV_PKT_EVT,
+    ESP_BLE_MESH_PROVISIONER_PROV_LINK_OPEN_EVT,
+    ESP_BLE_MESH_PROVISIONER_PROV_LINK_CLOSE_EVT,
+    ESP_BLE_MESH_PROVISIONER_PROV_COMPLETE_EVT,
+    ESP_BLE_MESH_PROVISIONER_ADD_UNPROV_DEV_COMP_EVT,
+    ESP_BLE_MESH_PROVISIONER_SET_DEV_UUID_MATCH_COMP_EVT,
+    ESP_BLE_MESH_PROVISIONER_SET_NODE_NAME_COMP_EVT,
+    ESP_BLE_MESH_PROVISIONER_ADD_LOCAL_APP_KEY_COMP_EVT,
+    ESP_BLE_MESH_PROVISIONER_BIND_APP_KEY_TO_MODEL_COMP_EVT,
+    ESP_BLE_MESH_SET_FAST_PROV_INFO_COMP_EVT,
+    ESP_BLE_MESH_SET_FAST_PROV_ACTION_COMP_EVT,
+    ESP_BLE_MESH_PROV_EVT_MAX,
+} esp_ble_mesh_prov_cb_event_t;
+
+typedef union {
+    struct {
+        int err_code;
+    } prov_register_comp;
+    struct {
+        int err_code;
+    } node_set_unprov_dev_name_comp;
+    struct {
+        int err_code;
+    } node_prov_enable_comp;
+    struct {
+        esp_ble_mesh_prov_bearer_t bearer;
+    } node_prov_link_open;
+    struct {
+        esp_ble_mesh_prov_bearer_t bearer;
+    } node_prov_link_close;
+    struct {
+        uint16_t net_idx;
+        uint16_t addr;
+        uint8_t flags;
+        uint32_t iv_index;
+    } node_prov_complete;
+    struct {
+        int err_code;
+    } node_proxy_gatt_enable_comp;
+    struct {
+        int err_code;
+    } node_proxy_gatt_disable_comp;
+    struct {
+        int err_code;
+    } provisioner_prov_enable_comp;
+    struct {
+        uint8_t dev_uuid[16];
+        uint8_t addr[BLE_MESH_ADDR_LEN];
+        esp_ble_mesh_addr_type_t addr_type;
+        uint16_t oob_info;
+        uint8_t adv_type;
+        esp_ble_mesh_prov_bearer_t bearer;
+        int8_t rssi;
+    } provisioner_recv_unprov_adv_pkt;
+    struct {
+        esp_ble_mesh_prov_bearer_t bearer;
+    } provisioner_prov_link_open;
+    struct {
+        esp_ble_mesh_prov_bearer_t bearer;
+        uint8_t reason;
+    } provisioner_prov_link_close;
+    struct {
+        uint16_t node_idx;
+        esp_ble_mesh_prov_bearer_t prov_bearer;
+        uint8_t device_uuid[16];
+        uint16_t unicast_addr;
+        uint8_t element_num;
+        uint16_t netkey_idx;
+    } provisioner_prov_complete;
+    struct {
+        int err_code;
+    } provisioner_add_unprov_dev_comp;
+    struct {
+        int err_code;
+    } provisioner_set_dev_uuid_match_comp;
+    struct {
+        int err_code;
+        uint16_t node_index;
+    } provisioner_set_node_name_comp;
+    struct {
+        int err_code;
+        uint16_t app_idx;
+    } provisioner_add_app_key_comp;
+    struct {
+        int err_code;
+    } provisioner_bind_app_key_to_model_comp;
+    struct {
+        uint8_t status_unicast;
+        uint8_t status_net_idx;
+        uint8_t status_match;
+    } set_fast_prov_info_comp;
+    struct {
+        uint8_t status_action;
+    } set_fast_prov_action_comp;
+} esp_ble_mesh_prov_cb_param_t;
+
+/* Model operation events */
+typedef enum {
+    ESP_BLE_MESH_MODEL_OPERATION_EVT,
+    ESP_BLE_MESH_MODEL_SEND_COMP_EVT,
+    ESP_BLE_MESH_MODEL_PUBLISH_COMP_EVT,
+    ESP_BLE_MESH_CLIENT_MODEL_RECV_PUBLISH_MSG_EVT,
+    ESP_BLE_MESH_CLIENT_MODEL_SEND_TIMEOUT_EVT,
+    ESP_BLE_MESH_MODEL_EVT_MAX,
+} esp_ble_mesh_model_cb_event_t;
+
+typedef union {
+    struct {
+        uint32_t opcode;
+        esp_ble_mesh_model_t *model;
+        esp_ble_mesh_msg_ctx_t *ctx;
+        uint16_t length;
+        uint8_t *msg;
+    } model_operation;
+    struct {
+        int err_code;
+        uint32_t opcode;
+        esp_ble_mesh_model_t *model;
+        esp_ble_mesh_msg_ctx_t *ctx;
+    } model_send_comp;
+    struct {
+        int err_code;
+        esp_ble_mesh_model_t *model;
+    } model_publish_comp;
+    struct {
+        uint32_t opcode;
+        esp_ble_mesh_model_t *model;
+        esp_ble_mesh_msg_ctx_t *ctx;
+        uint16_t length;
+        uint8_t *msg;
+    } client_recv_publish_msg;
+    struct {
+        uint32_t opcode;
+        esp_ble_mesh_model_t *model;
+        esp_ble_mesh_msg_ctx_t *ctx;
+    } client_send_timeout;
+} esp_ble_mesh_model_cb_param_t;
+
+typedef void (*esp_ble_mesh_prov_cb_t)(esp_ble_mesh_prov_cb_event_t event,
+                                       esp_ble_mesh_prov_cb_param_t *param);
+typedef void (*esp_ble_mesh_model_cb_t)(esp_ble_mesh_model_cb_event_t event,
+                                        esp_ble_mesh_model_cb_param_t *param);
@@ -0,0 +1,16 @@
+/* esp_ble_mesh_local_data_operation_api.h - Host stand-in, implemented by the
+ * tests which use it and by sim_mesh.c.
+ */
+
+#pragma once
+
+#include "esp_ble_mesh_defs.h"
+
+uint16_t *esp_ble_mesh_is_model_subscribed_to_group(esp_ble_mesh_model_t *model, uint16_t group_addr);
+
+uint16_t esp_ble_mesh_get_primary_element_address(void);
+
+const esp_ble_mesh_comp_t *esp_ble_mesh_get_composition_data(void);
+
+esp_err_t esp_ble_mesh_model_subscribe_group_addr(uint16_t element_addr, uint16_t company_id,
+                                                  uint16_t model_id, uint16_t group_addr);
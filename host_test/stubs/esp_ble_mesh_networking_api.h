@@ -0,0 +1,34 @@
+/* esp_ble_mesh_networking_api.h - Host stand-in. The tests implement the send
+ * and publish functions they use, the simulations get all of them from
+ * sim_mesh.c.
+ */
+
+#pragma once
+
+#include "esp_ble_mesh_defs.h"
+
+esp_err_t esp_ble_mesh_register_custom_model_callback(esp_ble_mesh_model_cb_t callback);
+
+esp_err_t esp_ble_mesh_client_model_init(esp_ble_mesh_model_t *model);
+
+esp_err_t esp_ble_mesh_server_model_send_msg(esp_ble_mesh_model_t *model, esp_ble_mesh_msg_ctx_t *ctx,
+                                             uint32_t opcode, uint16_t length, uint8_t *data);
+
+esp_err_t esp_ble_mesh_client_model_send_msg(esp_ble_mesh_model_t *model, esp_ble_mesh_msg_ctx_t *ctx,
+                                             uint32_t opcode, uint16_t length, uint8_t *data,
+                                             int32_t msg_timeout, bool need_rsp,
+                                             esp_ble_mesh_dev_role_t device_role);
+
+esp_err_t esp_ble_mesh_model_publish(esp_ble_mesh_model_t *model, uint32_t opcode,
+                                     uint16_t length, uint8_t *data,
+                                     esp_ble_mesh_dev_role_t device_role);
+
+esp_err_t esp_ble_mesh_provisioner_set_node_name(uint16_t index, const char *name);
+
+esp_err_t esp_ble_mesh_provisioner_add_local_app_key(const uint8_t app_key[16], uint16_t net_idx,
+                                                     uint16_t app_idx);
+
+const uint8_t *esp_ble_mesh_provisioner_get_local_app_key(uint16_t net_idx, uint16_t app_idx);
+
+esp_err_t esp_ble_mesh_provisioner_bind_app_key_to_local_model(uint16_t element_addr, uint16_t app_idx,
+                                                               uint16_t model_id, uint16_t company_id);
@@ -0,0 +1,9 @@
+/* esp_ble_mesh_proxy_api.h - Host stand-in, see sim_mesh.c */
+
+#pragma once
+
+#include "esp_ble_mesh_defs.h"
+
+esp_err_t esp_ble_mesh_node_proxy_gatt_enable(void);
+
+esp_err_t esp_ble_mesh_node_proxy_gatt_disable(void);
@@ -0,0 +1,5 @@
+/* esp_ble_mesh_sensor_model_api.h - Host stand-in, no sensor model is used */
+
+#pragma once
+
+#include "esp_ble_mesh_defs.h"
@@ -0,0 +1,17 @@
+/* esp_gap_ble_api.h - Host stand-in */
+
+#pragma once
+
+#include "esp_err.h"
+#include "esp_bt_defs.h"
+
+#define ESP_BLE_APPEARANCE_GENERIC_HID  0x03C0
+
+typedef enum {
+    ESP_BLE_SEC_ENCRYPT = 1,
+    ESP_BLE_SEC_ENCRYPT_NO_MITM,
+    ESP_BLE_SEC_ENCRYPT_MITM,
+} esp_ble_sec_act_t;
+
+esp_err_t esp_ble_gap_config_local_icon(uint16_t icon);
+esp_err_t esp_ble_set_encryption(esp_bd_addr_t bd_addr, esp_ble_sec_act_t sec_act);
@@ -0,0 +1,73 @@
+/* esp_gatt_defs.h - Host stand-in */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_bt_defs.h"
+
+typedef uint8_t esp_gatt_if_t;
+
+#define ESP_GATT_IF_NONE    0xFF
+
+typedef enum {
+    ESP_GATT_OK         = 0x00,
+    ESP_GATT_ERROR      = 0x85,
+    ESP_GATT_CONGESTED  = 0x8f,
+} esp_gatt_status_t;
+
+#define ESP_GATT_UUID_BATTERY_SERVICE_SVC   0x180F
+#define ESP_GATT_UUID_PRI_SERVICE           0x2800
+#define ESP_GATT_UUID_INCLUDE_SERVICE       0x2802
+#define ESP_GATT_UUID_CHAR_DECLARE          0x2803
+#define ESP_GATT_UUID_CHAR_PRESENT_FORMAT   0x2904
+#define ESP_GATT_UUID_CHAR_CLIENT_CONFIG    0x2902
+#define ESP_GATT_UUID_EXT_RPT_REF_DESCR     0x2907
+#define ESP_GATT_UUID_RPT_REF_DESCR         0x2908
+#define ESP_GATT_UUID_BATTERY_LEVEL         0x2A19
+#define ESP_GATT_UUID_HID_INFORMATION       0x2A4A
+#define ESP_GATT_UUID_HID_REPORT_MAP        0x2A4B
+#define ESP_GATT_UUID_HID_CONTROL_POINT     0x2A4C
+#define ESP_GATT_UUID_HID_REPORT            0x2A4D
+#define ESP_GATT_UUID_HID_PROTO_MODE        0x2A4E
+#define ESP_GATT_UUID_HID_BT_KB_INPUT       0x2A22
+#define ESP_GATT_UUID_HID_BT_KB_OUTPUT      0x2A32
+#define ESP_GATT_UUID_HID_BT_MOUSE_INPUT    0x2A33
+
+#define ESP_GATT_PERM_READ                  (1 << 0)
+#define ESP_GATT_PERM_READ_ENCRYPTED        (1 << 1)
+#define ESP_GATT_PERM_WRITE                 (1 << 4)
+#define ESP_GATT_PERM_WRITE_ENCRYPTED       (1 << 5)
+
+#define ESP_GATT_CHAR_PROP_BIT_READ         (1 << 1)
+#define ESP_GATT_CHAR_PROP_BIT_WRITE_NR     (1 << 2)
+#define ESP_GATT_CHAR_PROP_BIT_WRITE        (1 << 3)
+#define ESP_GATT_CHAR_PROP_BIT_NOTIFY       (1 << 4)
+
+#define ESP_GATT_AUTO_RSP                   2
+
+typedef uint16_t esp_gatt_perm_t;
+
+typedef struct {
+    uint8_t auto_rsp;
+} esp_attr_control_t;
+
+typedef struct {
+    uint16_t uuid_length;
+    uint8_t *uuid_p;
+    uint16_t perm;
+    uint16_t max_length;
+    uint16_t length;
+    uint8_t *value;
+} esp_attr_desc_t;
+
+typedef struct {
+    esp_attr_control_t attr_control;
+    esp_attr_desc_t att_desc;
+} esp_gatts_attr_db_t;
+
+typedef struct {
+    uint16_t start_hdl;
+    uint16_t end_hdl;
+    uint16_t uuid;
+} esp_gatts_incl_svc_desc_t;
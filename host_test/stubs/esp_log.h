@@ -0,0 +1,57 @@
+/* esp_log.h - Host stand-in, prints only if HOST_TEST_LOG is set */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+__attribute__((format(printf, 3, 4)))
+static inline void host_log(char level, const char *tag, const char *fmt, ...)
+{
+    static int enabled = -1;
+    va_list ap;
+
+    if (enabled < 0) {
+        enabled = getenv("HOST_TEST_LOG") != NULL;
+    }
+    if (!enabled) {
+        return;
+    }
+
+    printf("%c (%s) ", level, tag);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+}
+
+#define ESP_LOGE(tag, fmt, ...) host_log('E', tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) host_log('W', tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) host_log('I', tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) host_log('D', tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) host_log('V', tag, fmt, ##__VA_ARGS__)
+
+static inline void host_log_buffer_hex(const char *tag, const void *buf, int len)
+{
+    char line[3 * 16 + 1];
+
+    for (int i = 0; i < len; i += 16) {
+        int n = len - i < 16 ? len - i : 16;
+        for (int j = 0; j < n; j++) {
+            snprintf(&line[3 * j], 4, "%02x ", ((const unsigned char *)buf)[i + j]);
+        }
+        host_log('I', tag, "%s", line);
+    }
+}
+
+#define ESP_LOG_BUFFER_HEX(tag, buf, len)   host_log_buffer_hex(tag, buf, len)
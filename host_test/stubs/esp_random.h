@@ -0,0 +1,5 @@
+/* esp_random.h - Host stand-in */
+
+#pragma once
+
+#include "esp_system.h"
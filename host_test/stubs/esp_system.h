@@ -0,0 +1,14 @@
+/* esp_system.h - Host stand-in */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* Deterministic, see host_kernel.c */
+uint32_t esp_random(void);
+
+typedef void (*shutdown_handler_t)(void);
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler);
@@ -0,0 +1,31 @@
+/* FreeRTOS.h - Host stand-in, the tests run single threaded */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE          1
+#define pdFALSE         0
+#define pdPASS          pdTRUE
+#define portMAX_DELAY   0xFFFFFFFFU
+#define portTICK_PERIOD_MS  1
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+#define portNUM_PROCESSORS  2
+
+/* Defined by the tests which run code on both cores or in isrs */
+BaseType_t xPortGetCoreID(void);
+BaseType_t xPortInIsrContext(void);
+
+/* Locks held by the test thread, checked before calls which may block */
+__attribute__((weak)) int host_locks_held;
+
+typedef int portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    0
+#define portENTER_CRITICAL(mux)         ((void)(mux), host_locks_held++)
+#define portEXIT_CRITICAL(mux)          ((void)(mux), host_locks_held--)
@@ -0,0 +1,64 @@
+/* queue.h - Host stand-in, a copying ring which cannot block: sending to a full
+ * queue with a timeout aborts the test, nobody would ever receive.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#define errQUEUE_FULL   0
+
+typedef struct host_queue {
+    uint32_t len, size, head, count;
+    uint8_t items[];
+} *QueueHandle_t;
+
+static inline QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t size)
+{
+    QueueHandle_t queue = calloc(1, sizeof(struct host_queue) + len * size);
+
+    if (queue) {
+        queue->len = len;
+        queue->size = size;
+    }
+    return queue;
+}
+
+static inline BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    if (queue->count == queue->len) {
+        if (ticks) {
+            fprintf(stderr, "xQueueSend() would block on a full queue\n");
+            abort();
+        }
+        return errQUEUE_FULL;
+    }
+    memcpy(&queue->items[(queue->head + queue->count++) % queue->len * queue->size], item, queue->size);
+    return pdTRUE;
+}
+
+static inline BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    (void)ticks;
+    if (!queue->count) {
+        return pdFALSE;
+    }
+    memcpy(item, &queue->items[queue->head * queue->size], queue->size);
+    queue->head = (queue->head + 1) % queue->len;
+    queue->count--;
+    return pdTRUE;
+}
+
+static inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return queue->count;
+}
+
+static inline void vQueueDelete(QueueHandle_t queue)
+{
+    free(queue);
+}
@@ -0,0 +1,36 @@
+/* semphr.h - Host stand-in, locks always succeed and are counted */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t host_semaphore(void)
+{
+    static int handle;
+    return &handle;
+}
+
+static inline BaseType_t host_semaphore_take(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    (void)sem;
+    (void)ticks;
+    host_locks_held++;
+    return pdTRUE;
+}
+
+static inline BaseType_t host_semaphore_give(SemaphoreHandle_t sem)
+{
+    (void)sem;
+    host_locks_held--;
+    return pdTRUE;
+}
+
+#define xSemaphoreCreateMutex()                 host_semaphore()
+#define xSemaphoreCreateRecursiveMutex()        host_semaphore()
+#define xSemaphoreTake(sem, ticks)              host_semaphore_take(sem, ticks)
+#define xSemaphoreGive(sem)                     host_semaphore_give(sem)
+#define xSemaphoreTakeRecursive(sem, ticks)     host_semaphore_take(sem, ticks)
+#define xSemaphoreGiveRecursive(sem)            host_semaphore_give(sem)
+#define vSemaphoreDelete(sem)                   ((void)(sem))
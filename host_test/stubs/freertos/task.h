@@ -0,0 +1,21 @@
+/* task.h - Host stand-in. The test which creates a task also schedules it, on
+ * the virtual clock of host_kernel.c.
+ */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#define tskIDLE_PRIORITY    0
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken);
+void vTaskDelay(TickType_t ticks);
+
+#define portYIELD_FROM_ISR()
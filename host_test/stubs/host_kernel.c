@@ -0,0 +1,226 @@
+/* host_kernel.c - Virtual clock and delayed work for the host tests */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "host_kernel.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+static uint32_t now;
+static uint32_t rand_state = 1;
+static struct k_delayed_work *works;
+
+/* Earliest armed work, found again only once it ran or was cancelled */
+static struct k_delayed_work *next_work;
+static bool next_valid;
+
+void *host_kernel_owner;
+
+static inline bool before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+int k_delayed_work_init(struct k_delayed_work *work, k_work_handler_t handler)
+{
+    struct k_delayed_work *w;
+
+    if (work == next_work) {
+        next_valid = false;
+    }
+    work->work.handler = handler;
+    work->armed = false;
+    work->owner = host_kernel_owner;
+    for (w = works; w; w = w->next) {
+        if (w == work) {
+            return 0;
+        }
+    }
+    work->next = works;
+    works = work;
+    return 0;
+}
+
+int k_delayed_work_submit(struct k_delayed_work *work, int32_t delay_ms)
+{
+    if (work == next_work) {
+        next_valid = false;
+    }
+    work->due_ms = now + (delay_ms > 0 ? delay_ms : 0);
+    work->armed = true;
+    /* A tie is left to the list order */
+    if (next_valid && (!next_work || before(work->due_ms, next_work->due_ms))) {
+        next_work = work;
+    } else if (next_valid && work->due_ms == next_work->due_ms) {
+        next_valid = false;
+    }
+    return 0;
+}
+
+int k_delayed_work_cancel(struct k_delayed_work *work)
+{
+    if (work == next_work) {
+        next_valid = false;
+    }
+    work->armed = false;
+    return 0;
+}
+
+int32_t k_delayed_work_remaining_get(struct k_delayed_work *work)
+{
+    return work->armed && before(now, work->due_ms) ? (int32_t)(work->due_ms - now) : 0;
+}
+
+uint32_t k_uptime_get_32(void)
+{
+    return now;
+}
+
+int64_t k_uptime_get(void)
+{
+    return now;
+}
+
+static struct k_delayed_work *host_kernel_first(void)
+{
+    if (!next_valid) {
+        next_work = NULL;
+        for (struct k_delayed_work *w = works; w; w = w->next) {
+            if (w->armed && (!next_work || before(w->due_ms, next_work->due_ms))) {
+                next_work = w;
+            }
+        }
+        next_valid = true;
+    }
+    return next_work;
+}
+
+bool host_kernel_next(uint32_t *due_ms)
+{
+    struct k_delayed_work *w = host_kernel_first();
+
+    if (w) {
+        *due_ms = w->due_ms;
+    }
+    return w != NULL;
+}
+
+void host_kernel_advance(uint32_t now_ms)
+{
+    struct k_delayed_work *w;
+    void *owner = host_kernel_owner;
+
+    while ((w = host_kernel_first()) && !before(now_ms, w->due_ms)) {
+        now = w->due_ms;
+        w->armed = false;
+        next_valid = false;
+        host_kernel_owner = w->owner;
+        w->work.handler(&w->work);
+        host_kernel_owner = owner;
+    }
+    now = now_ms;
+}
+
+void host_kernel_seed(uint32_t seed)
+{
+    rand_state = seed ? seed : 1;
+}
+
+uint32_t esp_random(void)
+{
+    uint32_t x = rand_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return rand_state = x;
+}
+
+/* esp_timer, as delayed work rounded up to the millisecond */
+struct esp_timer {
+    struct k_delayed_work work;
+    esp_timer_cb_t callback;
+    void *arg;
+    uint32_t period_ms;     /* 0 for a one-shot timer */
+};
+
+static void esp_timer_handler(struct k_work *work)
+{
+    struct esp_timer *timer = (struct esp_timer *)((char *)work - offsetof(struct esp_timer, work));
+
+    /* The next period counts from this one, the callback may stop it */
+    if (timer->period_ms) {
+        k_delayed_work_submit(&timer->work, timer->period_ms);
+    }
+    timer->callback(timer->arg);
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    struct esp_timer *timer = calloc(1, sizeof(struct esp_timer));
+
+    if (!timer) {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+    k_delayed_work_init(&timer->work, esp_timer_handler);
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    if (timer->work.armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->period_ms = 0;
+    k_delayed_work_submit(&timer->work, (timeout_us + 999) / 1000);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us)
+{
+    if (timer->work.armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->period_ms = (period_us + 999) / 1000;
+    k_delayed_work_submit(&timer->work, timer->period_ms);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (!timer->work.armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    k_delayed_work_cancel(&timer->work);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    struct k_delayed_work **w;
+
+    if (timer->work.armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (w = &works; *w; w = &(*w)->next) {
+        if (*w == &timer->work) {
+            *w = timer->work.next;
+            break;
+        }
+    }
+    free(timer);
+    return ESP_OK;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return (int64_t)now * 1000;
+}
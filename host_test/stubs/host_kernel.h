@@ -0,0 +1,50 @@
+/* host_kernel.h - Virtual clock and delayed work of the BLE Mesh stack, run by
+ * the test instead of a timer task.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define K_MSEC(ms)      (ms)
+#define K_SECONDS(s)    ((s) * 1000)
+
+struct k_work;
+
+typedef void (*k_work_handler_t)(struct k_work *work);
+
+struct k_work {
+    k_work_handler_t handler;
+};
+
+struct k_delayed_work {
+    struct k_work work;
+    uint32_t due_ms;
+    bool armed;
+    void *owner;            /* host_kernel_owner when the work was initialized */
+    struct k_delayed_work *next;
+};
+
+/* Simulations running several nodes set this to the node whose code is
+ * running, and it is set to the owner of a work around its handler.
+ */
+extern void *host_kernel_owner;
+
+int k_delayed_work_init(struct k_delayed_work *work, k_work_handler_t handler);
+int k_delayed_work_submit(struct k_delayed_work *work, int32_t delay_ms);
+int k_delayed_work_cancel(struct k_delayed_work *work);
+int32_t k_delayed_work_remaining_get(struct k_delayed_work *work);
+
+uint32_t k_uptime_get_32(void);
+int64_t k_uptime_get(void);
+
+/* Test side: moves the clock to now_ms, running every work due on the way in
+ * deadline order.
+ */
+void host_kernel_advance(uint32_t now_ms);
+
+/* Deadline of the earliest armed work, false if there is none */
+bool host_kernel_next(uint32_t *due_ms);
+
+void host_kernel_seed(uint32_t seed);
@@ -0,0 +1,28 @@
+/* iot_button.h - Host stand-in, the simulation presses the buttons, see
+ * sim_node.c
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include "driver/gpio.h"
+
+typedef void (*button_cb)(void *arg);
+
+typedef void *button_handle_t;
+
+typedef enum {
+    BUTTON_ACTIVE_HIGH = 1,
+    BUTTON_ACTIVE_LOW = 0,
+} button_active_t;
+
+typedef enum {
+    BUTTON_CB_PUSH = 0,
+    BUTTON_CB_RELEASE,
+    BUTTON_CB_TAP,
+    BUTTON_CB_SERIAL,
+} button_cb_type_t;
+
+button_handle_t iot_button_create(gpio_num_t gpio_num, button_active_t active_level);
+
+esp_err_t iot_button_set_evt_cb(button_handle_t btn_handle, button_cb_type_t type, button_cb cb, void *arg);
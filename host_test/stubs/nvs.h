@@ -0,0 +1,7 @@
+/* nvs.h - Host stand-in */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef uint32_t nvs_handle_t;
@@ -0,0 +1,10 @@
+/* nvs_flash.h - Host stand-in, see sim_node.c */
+
+#pragma once
+
+#include "esp_err.h"
+#include "nvs.h"
+
+esp_err_t nvs_flash_init(void);
+
+esp_err_t nvs_flash_erase(void);
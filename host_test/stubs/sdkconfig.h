@@ -0,0 +1,11 @@
+/* sdkconfig.h - Host stand-in, tests set the options they depend on */
+
+#pragma once
+
+#ifndef CONFIG_BLE_MESH_MAX_PROV_NODES
+#define CONFIG_BLE_MESH_MAX_PROV_NODES  6
+#endif
+
+#ifndef CONFIG_BLE_MESH_MODEL_GROUP_COUNT
+#define CONFIG_BLE_MESH_MODEL_GROUP_COUNT   3
+#endif
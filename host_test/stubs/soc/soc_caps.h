@@ -0,0 +1,6 @@
+/* soc_caps.h - Host stand-in, the GPIO of an ESP32 */
+
+#pragma once
+
+#define SOC_GPIO_PIN_COUNT          40
+#define SOC_GPIO_VALID_GPIO_MASK    ((1ULL << SOC_GPIO_PIN_COUNT) - 1)
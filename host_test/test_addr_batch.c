@@ -0,0 +1,295 @@
+/* test_addr_batch.c - Node address batch codec round-trip fuzzing, encoded size
+ * against Node Addr messages, and the batch/ack exchange.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_ble_mesh_networking_api.h"
+#include "ble_mesh_fast_prov_addr_batch.h"
+
+#define MAX         CONFIG_FAST_PROV_ADDR_BATCH_MAX
+#define FUZZ_RUNS   100000
+
+static uint32_t seed = 17;
+
+/* Primary Provisioner side of example_store_remote_node_address() */
+static uint16_t stored[MAX];
+static uint16_t stored_cnt, stored_max = MAX;
+
+esp_err_t example_store_remote_node_address(uint16_t node_addr)
+{
+    for (uint16_t i = 0; i < stored_cnt; i++) {
+        if (stored[i] == node_addr) {
+            return ESP_OK;
+        }
+    }
+    if (stored_cnt == stored_max) {
+        return ESP_FAIL;
+    }
+    stored[stored_cnt++] = node_addr;
+    return ESP_OK;
+}
+
+/* Both sides send through here, the last message is kept */
+static struct {
+    uint32_t opcode;
+    uint8_t data[CONFIG_FAST_PROV_ADDR_BATCH_BYTES + 1];
+    uint16_t len;
+    uint32_t count;
+} sent;
+
+static esp_err_t record(uint32_t opcode, uint16_t length, uint8_t *data)
+{
+    TEST_ASSERT(length <= sizeof(sent.data));
+    sent.opcode = opcode;
+    sent.len = length;
+    memcpy(sent.data, data, length);
+    sent.count++;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_server_model_send_msg(esp_ble_mesh_model_t *model, esp_ble_mesh_msg_ctx_t *ctx,
+                                             uint32_t opcode, uint16_t length, uint8_t *data)
+{
+    (void)model;
+    (void)ctx;
+    return record(opcode, length, data);
+}
+
+esp_err_t esp_ble_mesh_client_model_send_msg(esp_ble_mesh_model_t *model, esp_ble_mesh_msg_ctx_t *ctx,
+                                             uint32_t opcode, uint16_t length, uint8_t *data,
+                                             int32_t msg_timeout, bool need_rsp,
+                                             esp_ble_mesh_dev_role_t device_role)
+{
+    (void)model;
+    (void)msg_timeout;
+    (void)device_role;
+    /* The ack and timeout events take the batch lock */
+    TEST_ASSERT(host_locks_held == 0);
+    TEST_ASSERT(need_rsp && ctx->addr == 0x0001);
+    return record(opcode, length, data);
+}
+
+/* Sorted, duplicate-free unicast addresses in one of the shapes seen in a rollout */
+static uint16_t make_addrs(uint16_t *addr, uint16_t count)
+{
+    uint16_t prev = 1 + host_rand(&seed) % 0x7000, n = 0;
+    uint32_t shape = host_rand(&seed) % 4;
+
+    while (n < count) {
+        uint32_t gap;
+
+        switch (shape) {
+        case 0:     /* One element per node */
+            gap = 1;
+            break;
+        case 1:     /* Same element count, with a few holes from failed nodes */
+            gap = host_rand(&seed) % 8 ? 3 : 6;
+            break;
+        case 2:     /* Ranges of several Provisioners */
+            gap = host_rand(&seed) % 16 ? 2 : 1 + host_rand(&seed) % 0x400;
+            break;
+        default:    /* Anywhere */
+            gap = 1 + host_rand(&seed) % 0x200;
+            break;
+        }
+        if (n && prev + gap > 0x7FFF) {
+            break;
+        }
+        if (n) {
+            prev += gap;
+        }
+        addr[n++] = prev;
+    }
+    return n;
+}
+
+static void test_round_trip(void)
+{
+    static uint16_t addr[MAX], out[MAX];
+    static uint8_t buf[MAX * 3];
+    uint16_t count, used, len;
+
+    for (int run = 0; run < FUZZ_RUNS; run++) {
+        count = make_addrs(addr, 1 + host_rand(&seed) % MAX);
+
+        /* Everything fits */
+        len = example_addr_batch_encode(addr, count, buf, sizeof(buf), &used);
+        TEST_ASSERT(used == count);
+        TEST_ASSERT(example_addr_batch_decode(buf, len, out, MAX) == count);
+        TEST_ASSERT(!memcmp(addr, out, count * sizeof(uint16_t)));
+
+        /* A message worth of them: the addresses which fit come back */
+        len = example_addr_batch_encode(addr, count, buf, CONFIG_FAST_PROV_ADDR_BATCH_BYTES, &used);
+        TEST_ASSERT(len <= CONFIG_FAST_PROV_ADDR_BATCH_BYTES && used >= 1);
+        TEST_ASSERT(example_addr_batch_decode(buf, len, out, MAX) == used);
+        TEST_ASSERT(!memcmp(addr, out, used * sizeof(uint16_t)));
+    }
+}
+
+static void test_malformed(void)
+{
+    static uint16_t out[MAX];
+    uint8_t buf[CONFIG_FAST_PROV_ADDR_BATCH_BYTES];
+    int count, ok = 0;
+
+    /* Truncated varint, zero gap, beyond unicast */
+    TEST_ASSERT(example_addr_batch_decode((const uint8_t[]){0x80}, 1, out, MAX) == -1);
+    TEST_ASSERT(example_addr_batch_decode((const uint8_t[]){0x02, 0x00}, 2, out, MAX) == -1);
+    TEST_ASSERT(example_addr_batch_decode((const uint8_t[]){0x03}, 1, out, MAX) == -1);
+    TEST_ASSERT(example_addr_batch_decode((const uint8_t[]){0x80, 0x80, 0x04}, 3, out, MAX) == -1);
+
+    for (int run = 0; run < FUZZ_RUNS; run++) {
+        uint16_t len = 1 + host_rand(&seed) % sizeof(buf);
+
+        for (uint16_t i = 0; i < len; i++) {
+            buf[i] = host_rand(&seed);
+        }
+        count = example_addr_batch_decode(buf, len, out, MAX);
+        TEST_ASSERT(count >= -1 && count <= MAX);
+        for (int i = 0; i < count; i++) {
+            TEST_ASSERT(ESP_BLE_MESH_ADDR_IS_UNICAST(out[i]) && (i == 0 || out[i] > out[i - 1]));
+        }
+        ok += count >= 0;
+    }
+    printf("random input: %d of %d decoded\n", ok, FUZZ_RUNS);
+}
+
+/* Messages and octets, seq included, to report count addresses, against Node
+ * Addr messages of the same payload size with 2 octets per address.
+ */
+static void size_compare(const char *name, const uint16_t *addr, uint16_t count)
+{
+    uint8_t buf[CONFIG_FAST_PROV_ADDR_BATCH_BYTES];
+    uint16_t done = 0, used, msgs = 0, octets = 0;
+
+    while (done < count) {
+        /* Gaps restart from 0 in each batch */
+        octets += 1 + example_addr_batch_encode(&addr[done], count - done, buf, sizeof(buf), &used);
+        done += used;
+        msgs++;
+    }
+    printf("%-24s %3u addresses: %2u batches, %4u octets; Node Addr: %2u messages, %4u octets\n",
+           name, count, msgs, octets, (unsigned)((count * 2 + sizeof(buf) - 1) / sizeof(buf)), count * 2);
+    TEST_ASSERT(octets <= count * 2 + msgs);
+}
+
+static void test_size(void)
+{
+    static uint16_t addr[MAX];
+    uint8_t buf[8];
+    uint16_t used, n;
+
+    /* 2 octets for the gap from 0 to 0x0100, 2 for the 99 gaps of 1 */
+    for (n = 0; n < 100 && n < MAX; n++) {
+        addr[n] = 0x0100 + n;
+    }
+    TEST_ASSERT(n > 2 && example_addr_batch_encode(addr, n, buf, sizeof(buf), &used) == 4);
+    TEST_ASSERT(used == n);
+    size_compare("consecutive", addr, n);
+
+    for (n = 0; n < MAX; n++) {
+        addr[n] = 0x0100 + 3 * n + (n > MAX / 2 ? 3 : 0);
+    }
+    size_compare("3 elements, one hole", addr, n);
+
+    n = 0;
+    for (uint16_t p = 0; p < 4 && n < MAX; p++) {
+        for (uint16_t i = 0; i < MAX / 4; i++) {
+            addr[n++] = 0x0100 + p * 0x1000 + 2 * i;
+        }
+    }
+    size_compare("4 Provisioner ranges", addr, n);
+
+    addr[0] = 0x0100;
+    for (n = 1; n < MAX; n++) {
+        addr[n] = addr[n - 1] + 1 + host_rand(&seed) % 200;
+    }
+    size_compare("scattered", addr, n);
+}
+
+static void test_exchange(void)
+{
+    static esp_ble_mesh_model_t model;
+    esp_ble_mesh_msg_ctx_t ctx = { .addr = 0x0100 };
+    const example_msg_common_info_t info = { .dst = 0x0001, .role = ROLE_FAST_PROV };
+    uint32_t start = k_uptime_get_32();
+    uint8_t batch[sizeof(sent.data)], batch_len;
+
+    TEST_ASSERT(example_addr_batch_init(&model) == ESP_OK);
+    TEST_ASSERT(example_addr_batch_idle() && !example_addr_batch_busy());
+
+    /* Sent CONFIG_FAST_PROV_ADDR_BATCH_LATENCY_MS after the first address */
+    sent.count = 0;
+    TEST_ASSERT(example_addr_batch_add(&info, 0x0203) == ESP_OK);
+    TEST_ASSERT(example_addr_batch_add(&info, 0x0200) == ESP_OK);
+    TEST_ASSERT(example_addr_batch_add(&info, 0x0200) == ESP_OK);
+    host_kernel_advance(start + CONFIG_FAST_PROV_ADDR_BATCH_LATENCY_MS - 1);
+    TEST_ASSERT(sent.count == 0);
+    host_kernel_advance(start + CONFIG_FAST_PROV_ADDR_BATCH_LATENCY_MS);
+    TEST_ASSERT(sent.count == 1 && sent.opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_BATCH);
+    TEST_ASSERT(example_addr_batch_busy());
+    batch_len = sent.len;
+    memcpy(batch, sent.data, batch_len);
+
+    /* Lost, then sent again with the same seq */
+    TEST_ASSERT(example_addr_batch_recv_timeout() == ESP_OK);
+    TEST_ASSERT(example_addr_batch_add(&info, 0x0206) == ESP_OK);
+    host_kernel_advance(k_uptime_get_32() + CONFIG_FAST_PROV_ADDR_BATCH_LATENCY_MS);
+    TEST_ASSERT(sent.count == 2 && sent.data[0] == batch[0] && sent.len > batch_len);
+    batch_len = sent.len;
+    memcpy(batch, sent.data, batch_len);
+
+    /* Primary Provisioner: stores the addresses and acknowledges their range */
+    stored_cnt = 0;
+    TEST_ASSERT(example_addr_batch_recv(&model, &ctx, batch, batch_len) == ESP_OK);
+    TEST_ASSERT(stored_cnt == 3 && stored[0] == 0x0200 && stored[2] == 0x0206);
+    TEST_ASSERT(sent.opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_BATCH_ACK);
+    /* A duplicate batch is stored once */
+    TEST_ASSERT(example_addr_batch_recv(&model, &ctx, batch, batch_len) == ESP_OK);
+    TEST_ASSERT(stored_cnt == 3);
+
+    TEST_ASSERT(example_addr_batch_recv_ack(sent.data, sent.len) == ESP_OK);
+    TEST_ASSERT(example_addr_batch_idle() && !example_addr_batch_busy());
+    /* The same ack again */
+    TEST_ASSERT(example_addr_batch_recv_ack(sent.data, sent.len) == ESP_ERR_INVALID_STATE);
+
+    /* Malformed batches are not acknowledged */
+    sent.count = 0;
+    batch[1] = 0x80;
+    TEST_ASSERT(example_addr_batch_recv(&model, &ctx, batch, 2) == ESP_ERR_INVALID_ARG);
+    TEST_ASSERT(sent.count == 0);
+
+    /* The node table of the primary Provisioner is full: the batch is still
+     * acknowledged, with the number of addresses stored, and not sent again
+     */
+    TEST_ASSERT(example_addr_batch_add(&info, 0x0300) == ESP_OK);
+    TEST_ASSERT(example_addr_batch_add(&info, 0x0301) == ESP_OK);
+    TEST_ASSERT(example_addr_batch_flush() == ESP_OK);
+    TEST_ASSERT(sent.count == 1 && example_addr_batch_busy());
+    batch_len = sent.len;
+    memcpy(batch, sent.data, batch_len);
+
+    stored_max = stored_cnt + 1;
+    TEST_ASSERT(example_addr_batch_recv(&model, &ctx, batch, batch_len) == ESP_OK);
+    TEST_ASSERT(sent.count == 2 && sent.opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_NODE_ADDR_BATCH_ACK);
+    TEST_ASSERT((sent.data[1] | sent.data[2] << 8) == 1 && stored[stored_cnt - 1] == 0x0300);
+    TEST_ASSERT(example_addr_batch_recv_ack(sent.data, sent.len) == ESP_OK);
+    TEST_ASSERT(example_addr_batch_idle() && !example_addr_batch_busy());
+    stored_max = MAX;
+}
+
+int main(void)
+{
+    test_round_trip();
+    test_malformed();
+    test_size();
+    test_exchange();
+    return 0;
+}
@@ -0,0 +1,284 @@
+/* test_addr_lease.c - Address lease allocator and messages, and fragmentation
+ * over 10k lease/return cycles.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "esp_ble_mesh_networking_api.h"
+#include "ble_mesh_fast_prov_addr_lease.h"
+
+#define RANGES      CONFIG_FAST_PROV_LEASE_MAX_RANGES
+#define CYCLES      10000
+
+/* Last message sent, and whether the next send fails */
+static struct {
+    uint32_t opcode;
+    uint8_t data[8];
+    uint16_t len;
+    esp_err_t fail;
+} sent;
+
+static esp_err_t record(uint32_t opcode, uint16_t length, uint8_t *data)
+{
+    if (sent.fail != ESP_OK) {
+        return sent.fail;
+    }
+    TEST_ASSERT(length <= sizeof(sent.data));
+    sent.opcode = opcode;
+    sent.len = length;
+    memcpy(sent.data, data, length);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_mesh_server_model_send_msg(esp_ble_mesh_model_t *model, esp_ble_mesh_msg_ctx_t *ctx,
+                                             uint32_t opcode, uint16_t length, uint8_t *data)
+{
+    (void)model;
+    (void)ctx;
+    return record(opcode, length, data);
+}
+
+esp_err_t esp_ble_mesh_client_model_send_msg(esp_ble_mesh_model_t *model, esp_ble_mesh_msg_ctx_t *ctx,
+                                             uint32_t opcode, uint16_t length, uint8_t *data,
+                                             int32_t msg_timeout, bool need_rsp,
+                                             esp_ble_mesh_dev_role_t device_role)
+{
+    (void)model;
+    (void)ctx;
+    (void)msg_timeout;
+    (void)device_role;
+    TEST_ASSERT(need_rsp);
+    return record(opcode, length, data);
+}
+
+static esp_ble_mesh_model_t model;
+static esp_ble_mesh_msg_ctx_t ctx = { .addr = 0x0005 };
+static const example_msg_common_info_t info = { .dst = 0x0001, .role = ROLE_FAST_PROV };
+
+static uint16_t get16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+/* Fills the pool with RANGES disjoint ranges of two addresses each */
+static void fill_ranges(void)
+{
+    example_addr_lease_reset();
+    for (uint16_t i = 0; i < RANGES; i++) {
+        TEST_ASSERT(example_addr_lease_free(0x0100 + i * 4, 0x0101 + i * 4) == ESP_OK);
+    }
+    TEST_ASSERT(example_addr_lease_ranges() == RANGES);
+}
+
+static void test_alloc_free(void)
+{
+    uint16_t min, max;
+
+    example_addr_lease_reset();
+    TEST_ASSERT(example_addr_lease_alloc(1, &min, &max) == ESP_ERR_NOT_FOUND);
+    TEST_ASSERT(example_addr_lease_free(0x0010, 0x001F) == ESP_OK);
+    TEST_ASSERT(example_addr_lease_free(0x0030, 0x003F) == ESP_OK);
+    TEST_ASSERT(example_addr_lease_free(0x0018, 0x0018) == ESP_ERR_INVALID_STATE);
+    TEST_ASSERT(example_addr_lease_free(0x8000, 0x8001) == ESP_ERR_INVALID_ARG);
+
+    /* Adjacent ranges are merged */
+    TEST_ASSERT(example_addr_lease_free(0x0020, 0x002F) == ESP_OK);
+    TEST_ASSERT(example_addr_lease_ranges() == 1 && example_addr_lease_avail() == 0x30);
+
+    TEST_ASSERT(example_addr_lease_alloc(4, &min, &max) == ESP_OK);
+    TEST_ASSERT(min == 0x0010 && max == 0x0013);
+    /* Larger than any range: the largest one is handed out */
+    TEST_ASSERT(example_addr_lease_alloc(0x100, &min, &max) == ESP_OK);
+    TEST_ASSERT(min == 0x0014 && max == 0x003F && example_addr_lease_avail() == 0);
+
+    /* No node left for a range which does not touch another one */
+    fill_ranges();
+    TEST_ASSERT(example_addr_lease_free(0x7000, 0x7000) == ESP_ERR_NO_MEM);
+    TEST_ASSERT(example_addr_lease_free(0x0102, 0x0102) == ESP_OK);
+}
+
+static void test_recv_get(void)
+{
+    uint8_t get[2] = {0xFF, 0xFF};
+
+    example_addr_lease_reset();
+    TEST_ASSERT(example_addr_lease_free(0x0100, 0x7FFF) == ESP_OK);
+    TEST_ASSERT(example_addr_lease_recv_get(&model, &ctx, get, sizeof(get)) == ESP_OK);
+    TEST_ASSERT(sent.opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_STATUS);
+    TEST_ASSERT(sent.data[0] == FAST_PROV_LEASE_STATUS_SUCCESS);
+    TEST_ASSERT(get16(&sent.data[3]) - get16(&sent.data[1]) + 1 == CONFIG_FAST_PROV_LEASE_MAX_GRANT);
+
+    get[0] = get[1] = 0;
+    TEST_ASSERT(example_addr_lease_recv_get(&model, &ctx, get, sizeof(get)) == ESP_OK);
+    TEST_ASSERT(sent.data[0] == FAST_PROV_LEASE_STATUS_INVALID);
+}
+
+static void test_recv_return(void)
+{
+    uint8_t ret[4] = {0x00, 0x70, 0x00, 0x70};
+
+    /* The primary Provisioner has no node left: the range is not acknowledged */
+    fill_ranges();
+    TEST_ASSERT(example_addr_lease_recv_return(&model, &ctx, ret, sizeof(ret)) == ESP_OK);
+    TEST_ASSERT(sent.opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN_ACK);
+    TEST_ASSERT(sent.data[0] == FAST_PROV_LEASE_STATUS_NO_ROOM);
+    TEST_ASSERT(example_addr_lease_avail() == RANGES * 2);
+
+    /* Returned twice */
+    ret[0] = 0x00, ret[1] = 0x01, ret[2] = 0x01, ret[3] = 0x01;
+    TEST_ASSERT(example_addr_lease_recv_return(&model, &ctx, ret, sizeof(ret)) == ESP_OK);
+    TEST_ASSERT(sent.data[0] == FAST_PROV_LEASE_STATUS_SUCCESS);
+    TEST_ASSERT(example_addr_lease_avail() == RANGES * 2);
+
+    /* Overlapping free ranges: the addresses in between are not lost, even
+     * with no node left
+     */
+    ret[0] = 0x00, ret[1] = 0x01, ret[2] = 0x09, ret[3] = 0x01;
+    TEST_ASSERT(example_addr_lease_recv_return(&model, &ctx, ret, sizeof(ret)) == ESP_OK);
+    TEST_ASSERT(sent.data[0] == FAST_PROV_LEASE_STATUS_SUCCESS);
+    TEST_ASSERT(example_addr_lease_avail() == RANGES * 2 - 6 + 10);
+    TEST_ASSERT(example_addr_lease_ranges() == RANGES - 2);
+
+    /* Starting and ending outside of the free ranges */
+    example_addr_lease_reset();
+    TEST_ASSERT(example_addr_lease_free(0x0110, 0x011F) == ESP_OK);
+    TEST_ASSERT(example_addr_lease_free(0x0130, 0x013F) == ESP_OK);
+    ret[0] = 0x08, ret[1] = 0x01, ret[2] = 0x47, ret[3] = 0x01;
+    TEST_ASSERT(example_addr_lease_recv_return(&model, &ctx, ret, sizeof(ret)) == ESP_OK);
+    TEST_ASSERT(sent.data[0] == FAST_PROV_LEASE_STATUS_SUCCESS);
+    TEST_ASSERT(example_addr_lease_avail() == 0x40 && example_addr_lease_ranges() == 1);
+}
+
+/* Sends the first Lease Return, returns the addresses available before */
+static uint16_t return_first(void)
+{
+    uint16_t avail = example_addr_lease_avail();
+
+    TEST_ASSERT(example_addr_lease_send_return(&model, &info) == ESP_OK);
+    TEST_ASSERT(sent.opcode == ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN);
+    TEST_ASSERT(example_addr_lease_busy());
+    TEST_ASSERT(example_addr_lease_avail() < avail);
+    return avail;
+}
+
+static void test_send_return(void)
+{
+    uint8_t ack = FAST_PROV_LEASE_STATUS_SUCCESS;
+    uint16_t avail;
+
+    /* Every range is returned, largest first, one message each */
+    example_addr_lease_reset();
+    TEST_ASSERT(example_addr_lease_free(0x0100, 0x0107) == ESP_OK);
+    TEST_ASSERT(example_addr_lease_free(0x0200, 0x0201) == ESP_OK);
+    return_first();
+    TEST_ASSERT(get16(sent.data) == 0x0100 && get16(&sent.data[2]) == 0x0107);
+    TEST_ASSERT(example_addr_lease_recv_status(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN_ACK,
+                                               &ack, 1) == ESP_OK);
+    TEST_ASSERT(get16(sent.data) == 0x0200 && example_addr_lease_busy());
+    TEST_ASSERT(example_addr_lease_recv_status(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN_ACK,
+                                               &ack, 1) == ESP_OK);
+    TEST_ASSERT(!example_addr_lease_busy() && example_addr_lease_avail() == 0);
+
+    /* Not taken back by the primary Provisioner: the range stays here */
+    TEST_ASSERT(example_addr_lease_free(0x0100, 0x0107) == ESP_OK);
+    avail = return_first();
+    ack = FAST_PROV_LEASE_STATUS_NO_ROOM;
+    TEST_ASSERT(example_addr_lease_recv_status(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN_ACK,
+                                               &ack, 1) == ESP_ERR_NO_MEM);
+    TEST_ASSERT(!example_addr_lease_busy() && example_addr_lease_avail() == avail);
+
+    /* Timed out */
+    avail = return_first();
+    TEST_ASSERT(example_addr_lease_recv_timeout(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN) == ESP_OK);
+    TEST_ASSERT(!example_addr_lease_busy() && example_addr_lease_avail() == avail);
+
+    /* Not sent */
+    sent.fail = ESP_FAIL;
+    TEST_ASSERT(example_addr_lease_send_return(&model, &info) == ESP_FAIL);
+    sent.fail = ESP_OK;
+    TEST_ASSERT(!example_addr_lease_busy() && example_addr_lease_avail() == avail);
+
+    /* Timed out while the pool filled up: the range is held and returned first */
+    fill_ranges();
+    TEST_ASSERT(example_addr_lease_send_return(&model, &info) == ESP_OK);
+    TEST_ASSERT(get16(sent.data) == 0x0100);
+    TEST_ASSERT(example_addr_lease_free(0x7000, 0x7000) == ESP_OK);
+    TEST_ASSERT(example_addr_lease_recv_timeout(ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_LEASE_RETURN) == ESP_OK);
+    TEST_ASSERT(example_addr_lease_ranges() == RANGES);
+    sent.opcode = 0;
+    TEST_ASSERT(example_addr_lease_send_return(&model, &info) == ESP_OK);
+    TEST_ASSERT(get16(sent.data) == 0x0100 && get16(&sent.data[2]) == 0x0101);
+    TEST_ASSERT(example_addr_lease_ranges() == RANGES);
+}
+
+/* Provisioners lease ranges of random size and return them in random order */
+static void bench(void)
+{
+    static struct {
+        uint16_t min;
+        uint16_t max;
+    } held[48];
+    uint32_t seed = 3, held_cnt = 0, held_addr = 0, no_room = 0, no_addr = 0;
+    uint32_t ranges_sum = 0, ranges_max = 0;
+    uint64_t start, ns;
+    uint16_t min, max;
+
+    example_addr_lease_reset();
+    TEST_ASSERT(example_addr_lease_free(0x0001, 0x7FFF) == ESP_OK);
+
+    start = host_time_ns();
+    for (uint32_t i = 0; i < CYCLES; i++) {
+        uint32_t r = host_rand(&seed);
+
+        /* Around 24 leases are held at any time */
+        if (r % 48 >= held_cnt) {
+            if (example_addr_lease_alloc(1 + (r >> 8) % 64, &min, &max) != ESP_OK) {
+                no_addr++;
+                continue;
+            }
+            held[held_cnt].min = min;
+            held[held_cnt].max = max;
+            held_addr += max - min + 1;
+            held_cnt++;
+        } else {
+            uint32_t n = (r >> 8) % held_cnt;
+            esp_err_t err = example_addr_lease_free(held[n].min, held[n].max);
+
+            if (err == ESP_ERR_NO_MEM) {
+                /* Nacked, the Provisioner keeps it */
+                no_room++;
+                continue;
+            }
+            TEST_ASSERT(err == ESP_OK);
+            held_addr -= held[n].max - held[n].min + 1;
+            held[n] = held[--held_cnt];
+        }
+        /* No address is ever lost */
+        TEST_ASSERT(example_addr_lease_avail() + held_addr == 0x7FFF);
+        ranges_sum += example_addr_lease_ranges();
+        if (example_addr_lease_ranges() > ranges_max) {
+            ranges_max = example_addr_lease_ranges();
+        }
+    }
+    ns = host_time_ns() - start;
+
+    printf("%d cycles, %d nodes: %.2f M ops/s, free ranges avg %.1f max %u, "
+           "%u leases held, nacked %u, no address %u\n",
+           CYCLES, RANGES, CYCLES * 1e3 / ns, (double)ranges_sum / CYCLES, ranges_max,
+           held_cnt, no_room, no_addr);
+}
+
+int main(void)
+{
+    test_alloc_free();
+    test_recv_get();
+    test_recv_return();
+    test_send_return();
+    bench();
+    return 0;
+}
@@ -0,0 +1,124 @@
+/* test_beacon_filter.c - Beacon filter, and a storm of 10k beacons/s from half
+ * as many devices as the fingerprint table holds.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "ble_mesh_fast_prov_common.h"
+#include "ble_mesh_fast_prov_node_index.h"
+#include "ble_mesh_fast_prov_beacon_filter.h"
+
+#define WINDOW_MS       CONFIG_FAST_PROV_BEACON_WINDOW_MS
+#define FILTER_TAGS     ((1U << CONFIG_FAST_PROV_BEACON_FILTER_BITS) / 16)
+#define STORM_DEVICES   (FILTER_TAGS / 2)
+#define STORM_RATE      10000   /* Beacons per second */
+#define STORM_MS        10000
+
+static void make_uuid(uint8_t uuid[16], uint32_t n)
+{
+    memset(uuid, 0xdd, 16);
+    memcpy(uuid + 12, &n, sizeof(n));
+}
+
+static void test_window(void)
+{
+    example_beacon_filter_stats_t stats;
+    uint32_t now = k_uptime_get_32();
+    uint8_t uuid[16];
+
+    example_beacon_filter_init(WINDOW_MS);
+    make_uuid(uuid, 1);
+    TEST_ASSERT(!example_beacon_filter_seen(uuid));
+    example_beacon_filter_add(uuid);
+    TEST_ASSERT(example_beacon_filter_seen(uuid));
+
+    /* Remembered for one to two windows */
+    host_kernel_advance(now + WINDOW_MS);
+    TEST_ASSERT(example_beacon_filter_seen(uuid));
+    host_kernel_advance(now + 2 * WINDOW_MS);
+    TEST_ASSERT(!example_beacon_filter_seen(uuid));
+
+    example_beacon_filter_get_stats(&stats);
+    TEST_ASSERT(stats.accepted == 2 && stats.dropped == 2);
+}
+
+/* A fingerprint from an old generation does not confirm a Bloom hit caused by
+ * the bits of other devices.
+ */
+static void test_stale_tag(void)
+{
+    example_beacon_filter_stats_t stats;
+    uint8_t old[16], uuid[16];
+    uint32_t old_tag;
+
+    example_beacon_filter_init(WINDOW_MS);
+    make_uuid(old, 0);
+    old_tag = example_node_index_uuid_hash(old) % FILTER_TAGS;
+    example_beacon_filter_add(old);
+    host_kernel_advance(k_uptime_get_32() + 3 * WINDOW_MS);
+
+    for (uint32_t n = 1; n < 100000; n++) {
+        make_uuid(uuid, n);
+        if (example_node_index_uuid_hash(uuid) % FILTER_TAGS == old_tag) {
+            /* Would replace the fingerprint */
+            continue;
+        }
+        example_beacon_filter_add(uuid);
+
+        TEST_ASSERT(!example_beacon_filter_seen(old));
+        example_beacon_filter_get_stats(&stats);
+        if (stats.false_positive) {
+            TEST_ASSERT(stats.dropped == 0);
+            return;
+        }
+    }
+    TEST_ASSERT(0);
+}
+
+static void storm(void)
+{
+    static uint8_t uuids[STORM_DEVICES][16];
+    example_beacon_filter_stats_t stats;
+    uint32_t seed = 9, start = k_uptime_get_32(), beacons = STORM_RATE / 1000 * STORM_MS;
+    uint64_t begin, ns;
+
+    for (uint32_t n = 0; n < STORM_DEVICES; n++) {
+        make_uuid(uuids[n], n);
+    }
+    example_beacon_filter_init(WINDOW_MS);
+
+    begin = host_time_ns();
+    for (uint32_t i = 0; i < beacons; i++) {
+        uint8_t *uuid = uuids[host_rand(&seed) % STORM_DEVICES];
+
+        host_kernel_advance(start + i * 1000 / STORM_RATE);
+        if (!example_beacon_filter_seen(uuid)) {
+            /* Handed to the stack */
+            example_beacon_filter_add(uuid);
+        }
+    }
+    ns = host_time_ns() - begin;
+
+    example_beacon_filter_get_stats(&stats);
+    TEST_ASSERT(stats.accepted + stats.dropped == beacons);
+    /* Each device is handed to the stack about once every one to two windows */
+    TEST_ASSERT(stats.accepted <= STORM_DEVICES * (STORM_MS / WINDOW_MS + 1));
+    TEST_ASSERT(stats.accepted >= STORM_DEVICES * (STORM_MS / (2 * WINDOW_MS)));
+    printf("%u bits, %u devices, %d beacons/s for %d s: accepted %u, dropped %u, false positive %u, "
+           "%.0f ns/beacon\n", 1U << CONFIG_FAST_PROV_BEACON_FILTER_BITS, STORM_DEVICES, STORM_RATE, STORM_MS / 1000, stats.accepted,
+           stats.dropped, stats.false_positive, (double)ns / beacons);
+}
+
+int main(void)
+{
+    host_kernel_advance(1000);
+    test_window();
+    test_stale_tag();
+    storm();
+    return 0;
+}
@@ -0,0 +1,295 @@
+/* test_bin_trace.c - Binary trace rings: run-time level, records per core,
+ * dumps which print each record once and count the lost ones, the dump task
+ * woken by warnings, and the cost on the message path against formatting an
+ * ESP_LOGI line.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <setjmp.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "host_test.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "bin_trace.h"
+
+#define RING_SIZE       (1U << CONFIG_BIN_TRACE_RING_BITS)
+#define UART_BAUD       115200  /* The default console */
+#define MSG_FORMAT      "Fast prov server receives msg, opcode 0x%06x, src 0x%04x"
+
+static BaseType_t core;
+static bool in_isr;
+
+static TaskFunction_t task_fn;
+static uint32_t task_notified, task_notified_isr;
+static uint32_t task_wait_ticks;
+static jmp_buf task_wait;
+
+BaseType_t xPortGetCoreID(void)
+{
+    return core;
+}
+
+BaseType_t xPortInIsrContext(void)
+{
+    return in_isr;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    static int task;
+
+    (void)name, (void)stack_depth, (void)arg;
+    TEST_ASSERT(priority == tskIDLE_PRIORITY + 1);
+    task_fn = fn;
+    *handle = &task;
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    TEST_ASSERT(!in_isr);
+    (void)task;
+    task_notified++;
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    TEST_ASSERT(in_isr);
+    (void)task, (void)woken;
+    task_notified_isr++;
+}
+
+/* The dump task gives the test back control the second time it waits */
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    static bool waited;
+
+    TEST_ASSERT(clear_on_exit);
+    task_wait_ticks = ticks;
+    waited = !waited;
+    if (!waited) {
+        longjmp(task_wait, 1);
+    }
+    return 1;
+}
+
+typedef struct {
+    uint32_t core, seq, level, id, arg[3];
+} dumped_t;
+
+static dumped_t dumped[2 * 4096];
+static uint32_t dumped_cnt, lost[portNUM_PROCESSORS];
+
+static void parse(FILE *f)
+{
+    char line[128];
+    dumped_t *d;
+    uint32_t c, n, time_us;
+
+    dumped_cnt = 0;
+    memset(lost, 0, sizeof(lost));
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "BT %u lost %u", &c, &n) == 2) {
+            TEST_ASSERT(c < portNUM_PROCESSORS);
+            lost[c] += n;
+            continue;
+        }
+        TEST_ASSERT(dumped_cnt < sizeof(dumped) / sizeof(dumped[0]));
+        d = &dumped[dumped_cnt++];
+        TEST_ASSERT(sscanf(line, "BT %u %x %x %u %x %x %x %x", &d->core, &d->seq, &time_us,
+                           &d->level, &d->id, &d->arg[0], &d->arg[1], &d->arg[2]) == 8);
+    }
+}
+
+/* Runs the dump with stdout going to a file, then reads it back */
+static void dump(void (*fn)(void))
+{
+    FILE *f = tmpfile();
+    int out;
+
+    TEST_ASSERT(f);
+    fflush(stdout);
+    out = dup(STDOUT_FILENO);
+    dup2(fileno(f), STDOUT_FILENO);
+    fn();
+    fflush(stdout);
+    dup2(out, STDOUT_FILENO);
+    close(out);
+    rewind(f);
+    parse(f);
+    fclose(f);
+}
+
+static void test_level(void)
+{
+    BIN_TRACEI(1, 10, 0, 0);
+    BIN_TRACED(2, 0, 0, 0);         /* Compiled out at level 3 */
+    bin_trace_set_level(ESP_LOG_WARN);
+    BIN_TRACEI(3, 0, 0, 0);
+    BIN_TRACEW(4, 40, 41, 42);
+    bin_trace_set_level(ESP_LOG_NONE);
+    BIN_TRACEE(5, 0, 0, 0);
+    bin_trace_set_level(CONFIG_BIN_TRACE_LEVEL);
+
+    dump(bin_trace_dump);
+    TEST_ASSERT(dumped_cnt == 2);
+    TEST_ASSERT(dumped[0].id == 1 && dumped[0].level == ESP_LOG_INFO && dumped[0].arg[0] == 10);
+    TEST_ASSERT(dumped[1].id == 4 && dumped[1].level == ESP_LOG_WARN);
+    TEST_ASSERT(dumped[1].arg[0] == 40 && dumped[1].arg[1] == 41 && dumped[1].arg[2] == 42);
+    TEST_ASSERT(dumped[1].seq == dumped[0].seq + 1);
+}
+
+/* Each record is printed once, the ones overwritten before a dump are counted */
+static void test_dump(void)
+{
+    uint32_t total = 2 * RING_SIZE + 10, on_core1 = (total + 2) / 3;
+
+    dump(bin_trace_dump);
+    TEST_ASSERT(dumped_cnt == 0 && !lost[0] && !lost[1]);
+
+    for (uint32_t i = 0; i < total; i++) {
+        core = i % 3 == 0;
+        BIN_TRACEI(7, i, core, 0);
+    }
+    core = 0;
+    dump(bin_trace_dump);
+
+    /* Core 1 took a third of them, and kept all */
+    TEST_ASSERT(lost[0] == total - on_core1 - RING_SIZE && lost[1] == 0);
+    TEST_ASSERT(dumped_cnt == RING_SIZE + on_core1);
+    for (uint32_t i = 1; i < dumped_cnt; i++) {
+        if (dumped[i].core == dumped[i - 1].core) {
+            TEST_ASSERT(dumped[i].seq == dumped[i - 1].seq + 1);
+            TEST_ASSERT(dumped[i].arg[0] > dumped[i - 1].arg[0]);
+        }
+        TEST_ASSERT(dumped[i].arg[1] == dumped[i].core);
+    }
+    /* The newest of core 0 is the last traced */
+    TEST_ASSERT(dumped[RING_SIZE - 1].core == 0 && dumped[RING_SIZE - 1].arg[0] == total - 1);
+
+    dump(bin_trace_dump);
+    TEST_ASSERT(dumped_cnt == 0 && !lost[0]);
+}
+
+static void run_task(void)
+{
+    if (!setjmp(task_wait)) {
+        task_fn(NULL);
+    }
+}
+
+/* Warnings wake the dump task, from a task or an isr; info records wait */
+static void test_task(void)
+{
+    TEST_ASSERT(bin_trace_start() == ESP_OK && task_fn);
+    TEST_ASSERT(bin_trace_start() == ESP_ERR_INVALID_STATE);
+
+    BIN_TRACEI(1, 0, 0, 0);
+    TEST_ASSERT(task_notified == 0);
+    BIN_TRACEW(2, 0, 0, 0);
+    TEST_ASSERT(task_notified == 1);
+    in_isr = true;
+    BIN_TRACEE(3, 0, 0, 0);
+    in_isr = false;
+    TEST_ASSERT(task_notified == 1 && task_notified_isr == 1);
+
+    dump(run_task);
+    TEST_ASSERT(task_wait_ticks == pdMS_TO_TICKS(CONFIG_BIN_TRACE_DUMP_PERIOD_MS));
+    TEST_ASSERT(dumped_cnt == 3 && dumped[2].id == 3 && dumped[2].level == ESP_LOG_ERROR);
+}
+
+/* What esp_log_write() formats for an ESP_LOGI: the level, the time, the tag
+ * and the message
+ */
+__attribute__((format(printf, 3, 4)))
+static int log_format(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, size, fmt, ap);
+    va_end(ap);
+    return len;
+}
+
+static void dump_quiet(void)
+{
+    FILE *null = fopen("/dev/null", "w");
+    int out;
+
+    TEST_ASSERT(null);
+    fflush(stdout);
+    out = dup(STDOUT_FILENO);
+    dup2(fileno(null), STDOUT_FILENO);
+    bin_trace_dump();
+    fflush(stdout);
+    dup2(out, STDOUT_FILENO);
+    close(out);
+    fclose(null);
+}
+
+static void bench(void)
+{
+    enum { N = 1000000 };
+    char line[160];
+    volatile int len = 0;
+    uint64_t begin, log_ns, trace_ns, off_ns, dump_ns = 0;
+    uint32_t dumps = 0;
+
+    begin = host_time_ns();
+    for (uint32_t i = 0; i < N; i++) {
+        len = log_format(line, sizeof(line), "I (%u) %s: " MSG_FORMAT "\n", i, "EXAMPLE", i & 0xffffff, i & 0xffff);
+    }
+    log_ns = host_time_ns() - begin;
+
+    begin = host_time_ns();
+    for (uint32_t i = 0; i < N; i++) {
+        BIN_TRACEI(1, i & 0xffffff, i & 0xffff, 0);
+    }
+    trace_ns = host_time_ns() - begin;
+
+    bin_trace_set_level(ESP_LOG_WARN);
+    begin = host_time_ns();
+    for (uint32_t i = 0; i < N; i++) {
+        BIN_TRACEI(1, i & 0xffffff, i & 0xffff, 0);
+    }
+    off_ns = host_time_ns() - begin;
+    bin_trace_set_level(CONFIG_BIN_TRACE_LEVEL);
+
+    /* The dump task, a ring at a time */
+    dump_quiet();
+    for (uint32_t i = 0; i < N / RING_SIZE; i++) {
+        for (uint32_t j = 0; j < RING_SIZE; j++) {
+            BIN_TRACEI(1, j, i, 0);
+        }
+        begin = host_time_ns();
+        dump_quiet();
+        dump_ns += host_time_ns() - begin;
+        dumps += RING_SIZE;
+    }
+
+    printf("ESP_LOGI formatting %.1f ns and %d bytes a message, %.2f ms at %u baud; "
+           "bin_trace_write %.1f ns and %u bytes of RAM (%.1f ns filtered out at run time), "
+           "formatted later by the dump task in %.1f ns a record\n",
+           (double)log_ns / N, len, len * 10 * 1000.0 / UART_BAUD, UART_BAUD,
+           (double)trace_ns / N, (unsigned)sizeof(bin_trace_rec_t), (double)off_ns / N,
+           (double)dump_ns / dumps);
+    TEST_ASSERT(trace_ns < log_ns);
+}
+
+int main(void)
+{
+    test_level();
+    test_dump();
+    test_task();
+    bench();
+    return 0;
+}
@@ -0,0 +1,192 @@
+/* test_cfg_engine.c - Configuration engine against a fake config client, with
+ * configuration throughput and p99 latency for several window sizes.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "ble_mesh_fast_prov_common.h"
+#include "ble_mesh_fast_prov_cfg_engine.h"
+
+#define NODES           200
+#define ARRIVAL_MS      400     /* One node provisioned every ARRIVAL_MS */
+#define MSG_TIMEOUT_MS  4000    /* Client message timeout of the mesh stack */
+
+/* Replies of the fake config client, in flight on the virtual radio */
+typedef struct {
+    uint32_t due_ms;
+    uint16_t addr;
+    uint32_t opcode;
+    bool     ok;
+    bool     used;
+} reply_t;
+
+static reply_t replies[NODES * 2];
+static example_node_info_t nodes[NODES];
+static uint32_t start_ms[NODES], latency_ms[NODES];
+static uint32_t done_cnt, fail_cnt, in_air;
+static uint32_t loss_pct_base;
+static uint32_t send_cnt, send_err_every;  /* Every Nth send fails, none if 0 */
+static uint32_t rng = 7;
+
+static uint32_t step_opcode(example_cfg_step_t step)
+{
+    return step == FAST_PROV_CFG_STEP_APPKEY_ADD ? ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD :
+           ESP_BLE_MESH_VND_MODEL_OP_FAST_PROV_INFO_SET;
+}
+
+/* Every message on the air slows the others down and makes losses more
+ * likely, which is what bounds the useful window.
+ */
+static esp_err_t fake_send(example_node_info_t *node, example_cfg_step_t step)
+{
+    /* The config client posts to the BTC task, whose callbacks take the lock */
+    TEST_ASSERT(host_locks_held == 0);
+    if (send_err_every && ++send_cnt % send_err_every == 0) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < NODES * 2; i++) {
+        reply_t *r = &replies[i];
+        if (r->used) {
+            continue;
+        }
+        in_air++;
+        r->used = true;
+        r->addr = node->unicast_addr;
+        r->opcode = step_opcode(step);
+        r->ok = host_rand(&rng) % 100 >= loss_pct_base + 4 * in_air;
+        r->due_ms = k_uptime_get_32() + (r->ok ? 250 + 120 * in_air + host_rand(&rng) % 200 :
+                                         MSG_TIMEOUT_MS);
+        return ESP_OK;
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+static void fake_complete(example_node_info_t *node, esp_err_t result)
+{
+    uint32_t n = node - nodes;
+
+    TEST_ASSERT(host_locks_held == 0);
+    if (result == ESP_OK) {
+        latency_ms[done_cnt++] = k_uptime_get_32() - start_ms[n];
+    } else {
+        fail_cnt++;
+    }
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run(uint8_t window, uint32_t loss_pct, example_cfg_engine_stats_t *stats)
+{
+    example_cfg_engine_config_t config = EXAMPLE_CFG_ENGINE_DEFAULT_CONFIG(fake_send, fake_complete);
+    uint32_t begin = k_uptime_get_32(), next_node = 0, now;
+
+    config.window = window;
+    TEST_ASSERT(example_cfg_engine_init(&config) == ESP_OK);
+    memset(replies, 0, sizeof(replies));
+    done_cnt = fail_cnt = in_air = 0;
+    loss_pct_base = loss_pct;
+
+    while (done_cnt + fail_cnt < NODES) {
+        uint32_t next = begin + next_node * ARRIVAL_MS, due;
+        bool timer = host_kernel_next(&due);
+        reply_t *first = NULL;
+
+        if (timer && (next_node == NODES || (int32_t)(due - next) < 0)) {
+            next = due;
+        }
+        for (int i = 0; i < NODES * 2; i++) {
+            if (replies[i].used && (!first || (int32_t)(replies[i].due_ms - first->due_ms) < 0)) {
+                first = &replies[i];
+            }
+        }
+        if (first && ((next_node == NODES && !timer) || (int32_t)(first->due_ms - next) <= 0)) {
+            host_kernel_advance(first->due_ms);
+            first->used = false;
+            in_air--;
+            if (first->ok) {
+                TEST_ASSERT(example_cfg_engine_step_done(first->addr, first->opcode) == ESP_OK);
+            } else {
+                TEST_ASSERT(example_cfg_engine_step_fail(first->addr, first->opcode) == ESP_OK);
+            }
+            continue;
+        }
+        /* Something must be left to happen */
+        TEST_ASSERT(next_node < NODES || timer);
+
+        host_kernel_advance(next);
+        if (next_node < NODES && k_uptime_get_32() == begin + next_node * (uint32_t)ARRIVAL_MS) {
+            now = k_uptime_get_32();
+            memset(&nodes[next_node], 0, sizeof(example_node_info_t));
+            nodes[next_node].unicast_addr = 0x0100 + next_node;
+            start_ms[next_node] = now;
+            TEST_ASSERT(example_cfg_engine_enqueue(&nodes[next_node]) == ESP_OK);
+            next_node++;
+        }
+    }
+
+    example_cfg_engine_get_stats(stats);
+    TEST_ASSERT(stats->nodes_done == done_cnt && stats->nodes_failed == fail_cnt);
+    TEST_ASSERT(stats->in_flight == 0 && stats->pending == 0);
+    TEST_ASSERT(stats->in_flight_max <= window);
+    /* A status for a finished node is ignored */
+    TEST_ASSERT(example_cfg_engine_step_done(nodes[0].unicast_addr,
+                                             ESP_BLE_MESH_MODEL_OP_APP_KEY_ADD) == ESP_ERR_NOT_FOUND);
+
+    qsort(latency_ms, done_cnt, sizeof(uint32_t), cmp_u32);
+    printf("window %2u: %5.1f nodes/min, failed %3u, retries %4u, p99 %6u ms (histogram %6u ms)\n",
+           window, done_cnt * 60000.0 / (k_uptime_get_32() - begin), fail_cnt, stats->retries,
+           done_cnt ? latency_ms[(done_cnt * 99 + 99) / 100 - 1] : 0,
+           example_cfg_engine_latency_pct(stats, 99));
+}
+
+static void test_histogram(void)
+{
+    example_cfg_engine_stats_t stats = {0};
+
+    stats.nodes_done = 100;
+    stats.latency_max_ms = 5000;
+    stats.latency_hist[0] = 50;     /* < 16 ms */
+    stats.latency_hist[6] = 49;     /* 512..1023 ms */
+    stats.latency_hist[9] = 1;      /* 4096..8191 ms */
+    TEST_ASSERT(example_cfg_engine_latency_pct(&stats, 50) == 16);
+    TEST_ASSERT(example_cfg_engine_latency_pct(&stats, 99) == 1024);
+    TEST_ASSERT(example_cfg_engine_latency_pct(&stats, 100) == 5000);
+}
+
+int main(void)
+{
+    example_cfg_engine_stats_t stats;
+
+    test_histogram();
+
+    /* Every message lost: each node gives up after max_retries */
+    printf("all lost\n");
+    run(3, 100, &stats);
+    TEST_ASSERT(stats.nodes_failed == NODES && stats.nodes_done == 0);
+    TEST_ASSERT(stats.retries == NODES * CONFIG_FAST_PROV_CFG_MAX_RETRIES);
+
+    printf("%d nodes, one provisioned every %d ms\n", NODES, ARRIVAL_MS);
+    for (uint8_t window = 1; window <= 8; window++) {
+        run(window, 2, &stats);
+        TEST_ASSERT(stats.nodes_done + stats.nodes_failed == NODES);
+    }
+
+    /* Sends refused by the client are retried like lost messages */
+    printf("every 5th send refused\n");
+    send_err_every = 5;
+    run(4, 2, &stats);
+    TEST_ASSERT(stats.nodes_done + stats.nodes_failed == NODES);
+    TEST_ASSERT(stats.retries >= send_cnt / send_err_every);
+    return 0;
+}
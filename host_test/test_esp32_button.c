@@ -0,0 +1,387 @@
+/* test_esp32_button.c - Button events of scripted GPIO traces, and wakeups of
+ * the button task per second idle and under load, against the 100 of the
+ * fixed 10 ms polling loop it replaced.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <setjmp.h>
+#include <string.h>
+
+#include "host_test.h"
+#include "host_kernel.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "soc/soc_caps.h"
+#include "esp32_button.h"
+
+#define PIN_A       4
+#define PIN_B       13
+#define LONG_MS     500
+#define REPEAT_MS   100
+#define POLL_MS     10
+
+/* Simulated pins, an edge calls the handler while its interrupt is enabled */
+static struct {
+    int level;
+    bool intr;
+    gpio_isr_t isr;
+    void *arg;
+} pins[SOC_GPIO_PIN_COUNT];
+
+/* Flipped just before the interrupt of the pin is enabled again */
+static int glitch_pin = -1;
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    (void)config;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t pin)
+{
+    return pins[pin].level;
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t pin)
+{
+    if (pin == glitch_pin) {
+        glitch_pin = -1;
+        pins[pin].level = !pins[pin].level;
+    }
+    pins[pin].intr = true;
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_disable(gpio_num_t pin)
+{
+    pins[pin].intr = false;
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int flags)
+{
+    (void)flags;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t pin, gpio_isr_t isr, void *arg)
+{
+    pins[pin].isr = isr;
+    pins[pin].arg = arg;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t pin)
+{
+    pins[pin].isr = NULL;
+    return ESP_OK;
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t pin)
+{
+    pins[pin].intr = false;
+    return ESP_OK;
+}
+
+static void set_level(int pin, int level)
+{
+    if (pins[pin].level == level) {
+        return;
+    }
+    pins[pin].level = level;
+    if (pins[pin].intr && pins[pin].isr) {
+        pins[pin].isr(pins[pin].arg);
+    }
+}
+
+/* Level changes of a trace, in time order */
+typedef struct {
+    uint32_t at_ms;
+    uint8_t pin;
+    uint8_t level;
+} edge_t;
+
+static edge_t trace[20000];
+static uint32_t trace_len, trace_pos;
+
+static void edge(uint32_t at_ms, int pin, int level)
+{
+    TEST_ASSERT(trace_len < sizeof(trace) / sizeof(trace[0]));
+    TEST_ASSERT(!trace_len || trace[trace_len - 1].at_ms <= at_ms);
+    trace[trace_len++] = (edge_t) { .at_ms = at_ms, .pin = pin, .level = level };
+}
+
+/* Pressed reads low, a contact bounces for bounce_ms */
+static void stroke(uint32_t at_ms, int pin, uint32_t hold_ms, uint32_t bounce_ms)
+{
+    for (uint32_t t = 0; t < bounce_ms; t++) {
+        edge(at_ms + t, pin, t & 1);
+    }
+    edge(at_ms + bounce_ms, pin, 0);
+    for (uint32_t t = 0; t < bounce_ms; t++) {
+        edge(at_ms + hold_ms + t, pin, !(t & 1));
+    }
+    edge(at_ms + hold_ms + bounce_ms, pin, 1);
+}
+
+/* The button task runs in ulTaskNotifyTake(): the trace is played until it
+ * should wake up, and the test gets back control once the task waits without
+ * timeout and the trace is over.
+ */
+static TaskFunction_t task_fn;
+static void *task_arg;
+static jmp_buf quiet;
+static uint32_t notified, wakeups;
+
+static button_group_handle_t group;
+static struct {
+    uint8_t pin, event;
+    uint32_t at_ms;
+} events[4096];
+static uint32_t event_cnt;
+static bool stalled;    /* The application does not read the queue */
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    static int task;
+
+    (void)name, (void)stack_depth, (void)priority;
+    task_fn = fn;
+    task_arg = arg;
+    *handle = &task;
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    (void)task;
+    notified++;
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    (void)task;
+    notified++;
+    *woken = pdTRUE;
+}
+
+static void receive(void)
+{
+    button_event_t event;
+
+    while (!stalled && xQueueReceive(button_get_queue(group), &event, 0) == pdTRUE) {
+        TEST_ASSERT(event_cnt < sizeof(events) / sizeof(events[0]));
+        events[event_cnt].pin = event.pin;
+        events[event_cnt].event = event.event;
+        events[event_cnt].at_ms = k_uptime_get_32();
+        event_cnt++;
+    }
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    uint32_t wake_ms = ticks == portMAX_DELAY ? UINT32_MAX : k_uptime_get_32() + ticks;
+    uint32_t count;
+
+    TEST_ASSERT(host_locks_held == 0);
+    receive();
+    /* Polling goes on only while a button is held */
+    TEST_ASSERT(trace_pos < trace_len || !trace_len || k_uptime_get_32() < trace[trace_len - 1].at_ms + 5000);
+    while (!notified) {
+        if (trace_pos < trace_len && trace[trace_pos].at_ms <= wake_ms) {
+            host_kernel_advance(trace[trace_pos].at_ms);
+            set_level(trace[trace_pos].pin, trace[trace_pos].level);
+            trace_pos++;
+        } else if (wake_ms != UINT32_MAX) {
+            host_kernel_advance(wake_ms);
+            break;
+        } else {
+            longjmp(quiet, 1);
+        }
+    }
+
+    wakeups++;
+    count = notified;
+    notified = clear_on_exit ? 0 : count ? count - 1 : 0;
+    return count;
+}
+
+/* Plays the trace from start_ms, returns the wakeups of the task */
+static uint32_t play(uint32_t start_ms)
+{
+    uint32_t before = wakeups;
+
+    host_kernel_advance(start_ms);
+    if (!setjmp(quiet)) {
+        task_fn(task_arg);
+    }
+    receive();
+    TEST_ASSERT(trace_pos == trace_len);
+    trace_len = trace_pos = 0;
+    return wakeups - before;
+}
+
+static void setup(void)
+{
+    button_config_t config = {
+        .pin_select = PIN_BIT(PIN_A) | PIN_BIT(PIN_B),
+        .pull_mode = GPIO_PULLUP_ONLY,
+        .inverted = true,
+        .long_press_ms = LONG_MS,
+        .long_press_repeat_ms = REPEAT_MS,
+    };
+
+    pins[PIN_A].level = pins[PIN_B].level = 1;
+    group = button_create(&config);
+    TEST_ASSERT(group);
+    /* One poll finds nothing to do */
+    TEST_ASSERT(play(1000) == 1);
+    TEST_ASSERT(pins[PIN_A].intr && pins[PIN_B].intr);
+}
+
+static void test_idle(void)
+{
+    uint32_t start = k_uptime_get_32();
+
+    edge(start + 10000, PIN_A, 1);
+    TEST_ASSERT(play(start) == 0);
+    TEST_ASSERT(k_uptime_get_32() == start + 10000 && event_cnt == 0);
+}
+
+/* DOWN once six polls read pressed, UP once six read released */
+static void test_press(uint32_t bounce_ms)
+{
+    uint32_t start = k_uptime_get_32() + 100;
+
+    event_cnt = 0;
+    stroke(start, PIN_A, 200, bounce_ms);
+    play(start);
+    TEST_ASSERT(event_cnt == 2);
+    TEST_ASSERT(events[0].pin == PIN_A && events[0].event == BUTTON_DOWN);
+    TEST_ASSERT(events[1].pin == PIN_A && events[1].event == BUTTON_UP);
+    TEST_ASSERT(events[0].at_ms - start >= 5 * POLL_MS && events[0].at_ms - start <= 7 * POLL_MS + bounce_ms);
+    TEST_ASSERT(events[1].at_ms - (start + 200) >= 5 * POLL_MS);
+    TEST_ASSERT(events[1].at_ms - (start + 200) <= 7 * POLL_MS + bounce_ms);
+    TEST_ASSERT(pins[PIN_A].intr && pins[PIN_B].intr);
+}
+
+/* HELD after LONG_MS, then every REPEAT_MS, while the other button is used */
+static void test_held(void)
+{
+    uint32_t start = k_uptime_get_32() + 100, held = 0, down_ms = 0, last_ms = 0;
+
+    event_cnt = 0;
+    edge(start, PIN_B, 0);
+    stroke(start + 300, PIN_A, 100, 3);
+    edge(start + 1200, PIN_B, 1);
+    play(start);
+
+    for (uint32_t i = 0; i < event_cnt; i++) {
+        if (events[i].pin != PIN_B) {
+            continue;
+        }
+        if (events[i].event == BUTTON_DOWN) {
+            down_ms = events[i].at_ms;
+            last_ms = down_ms + LONG_MS - REPEAT_MS;
+        } else if (events[i].event == BUTTON_HELD) {
+            TEST_ASSERT(events[i].at_ms - last_ms >= REPEAT_MS && events[i].at_ms - last_ms <= REPEAT_MS + POLL_MS);
+            last_ms = events[i].at_ms;
+            held++;
+        }
+    }
+    TEST_ASSERT(down_ms && held >= (1200 - 60 - LONG_MS) / REPEAT_MS - 1);
+    TEST_ASSERT(held <= (1200 + 70 - LONG_MS) / REPEAT_MS + 1);
+    TEST_ASSERT(event_cnt == 2 + 2 + held);
+}
+
+/* A press while the interrupts are being enabled again is still seen */
+static void test_arm_gap(void)
+{
+    uint32_t start = k_uptime_get_32() + 100;
+
+    event_cnt = 0;
+    edge(start, PIN_B, 0);
+    edge(start + 100, PIN_B, 1);
+    /* Released after the interrupts were enabled again */
+    edge(start + 400, PIN_A, 1);
+    glitch_pin = PIN_A;
+    play(start);
+    TEST_ASSERT(glitch_pin == -1);
+    TEST_ASSERT(event_cnt == 4 && events[2].pin == PIN_A && events[2].event == BUTTON_DOWN);
+    TEST_ASSERT(events[2].at_ms < start + 400 && events[3].pin == PIN_A && events[3].event == BUTTON_UP);
+}
+
+/* A reader which is behind loses the events the queue has no room for, the
+ * task does not wait for it with the groups locked.
+ */
+static void test_stalled(void)
+{
+    uint32_t start = k_uptime_get_32() + 100, dropped = button_get_dropped(group);
+
+    event_cnt = 0;
+    stalled = true;
+    edge(start, PIN_B, 0);
+    edge(start + 1500, PIN_B, 1);
+    play(start);
+    stalled = false;
+    receive();
+    TEST_ASSERT(event_cnt == CONFIG_ESP32_BUTTON_QUEUE_SIZE);
+    TEST_ASSERT(events[0].event == BUTTON_DOWN && events[1].event == BUTTON_HELD);
+    /* DOWN, HELD from 500 ms on every 100 ms and UP */
+    TEST_ASSERT(button_get_dropped(group) - dropped >= 1 + 9 + 1 - CONFIG_ESP32_BUTTON_QUEUE_SIZE);
+
+    /* Nothing left behind once the reader catches up */
+    start = k_uptime_get_32() + 100;
+    event_cnt = 0;
+    stroke(start, PIN_A, 100, 2);
+    play(start);
+    TEST_ASSERT(event_cnt == 2 && events[0].event == BUTTON_DOWN && events[1].event == BUTTON_UP);
+}
+
+/* Wakeups per second of a user pressing a button every min_ms..max_ms, for
+ * 80..300 ms. Strokes do not overlap, min_ms is above 305.
+ */
+static void bench(const char *name, uint32_t min_ms, uint32_t max_ms, uint32_t seconds)
+{
+    uint32_t seed = 12, start = k_uptime_get_32() + 100, t = start, strokes = 0, downs = 0, ups = 0;
+    uint32_t count;
+
+    event_cnt = 0;
+    while (t < start + seconds * 1000 - max_ms - 400) {
+        t += min_ms + host_rand(&seed) % (max_ms - min_ms + 1);
+        stroke(t, host_rand(&seed) & 1 ? PIN_A : PIN_B, 80 + host_rand(&seed) % 220, host_rand(&seed) % 6);
+        strokes++;
+    }
+    edge(start + seconds * 1000, PIN_A, 1);
+    count = play(start);
+
+    for (uint32_t i = 0; i < event_cnt; i++) {
+        downs += events[i].event == BUTTON_DOWN;
+        ups += events[i].event == BUTTON_UP;
+    }
+    TEST_ASSERT(downs == strokes && ups == strokes);
+    printf("%-26s %6.2f wakeups/s, polling loop %u/s\n", name, (double)count / seconds,
+           1000 / POLL_MS);
+}
+
+int main(void)
+{
+    host_kernel_advance(1);
+    setup();
+    test_idle();
+    test_press(0);
+    test_press(5);
+    test_held();
+    test_arm_gap();
+    test_stalled();
+
+    bench("idle", 3600000, 3600000, 3600);
+    bench("a press every 2-10 s", 2000, 10000, 600);
+    bench("a press every 0.4-0.8 s", 400, 800, 600);
+    return 0;
+}
@@ -0,0 +1,446 @@
+/* test_hid_dev.c - HID report lookup against the linear search it replaced,
+ * CCCD filtering, the transmit window and reports/s of both, and consumer
+ * reports from the usage table against the switch it replaced.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "host_kernel.h"
+#include "freertos/FreeRTOS.h"
+#include "hid_dev.h"
+
+#define GATTS_IF    3
+#define CONN        0
+#define REPORTS     4000000
+#define BATTERY     0x50    /* A notification of another service */
+
+hidd_le_env_t hidd_le_env;
+
+/* The report map of hid_device_le_prf.c, the last entry is left unused */
+static hid_report_map_t map[HID_NUM_REPORTS] = {
+    { 0x20, 0x21, HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_PROTOCOL_MODE_REPORT },
+    { 0x24, 0x25, HID_RPT_ID_KEY_IN, HID_REPORT_TYPE_INPUT, HID_PROTOCOL_MODE_REPORT },
+    { 0x28, 0x29, HID_RPT_ID_CC_IN, HID_REPORT_TYPE_INPUT, HID_PROTOCOL_MODE_REPORT },
+    { 0x2C, 0, HID_RPT_ID_LED_OUT, HID_REPORT_TYPE_OUTPUT, HID_PROTOCOL_MODE_REPORT },
+    { 0x30, 0x31, HID_RPT_ID_KEY_IN, HID_REPORT_TYPE_INPUT, HID_PROTOCOL_MODE_BOOT },
+    { 0x34, 0, HID_RPT_ID_LED_OUT, HID_REPORT_TYPE_OUTPUT, HID_PROTOCOL_MODE_BOOT },
+    { 0x38, 0x39, HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_PROTOCOL_MODE_BOOT },
+    { 0x3C, 0, HID_RPT_ID_FEATURE, HID_REPORT_TYPE_FEATURE, HID_PROTOCOL_MODE_REPORT },
+};
+
+static struct {
+    uint16_t conn_id;
+    uint16_t handle;
+    uint16_t len;
+    uint8_t data[8];
+    uint32_t count;
+    uint8_t order[16];  /* data[1] of the last ones, by count */
+} sent;
+static bool refuse;     /* The stack has no buffer */
+static bool complete;   /* The BTC task completes each notification before it returns */
+
+esp_err_t esp_ble_gatts_send_indicate(esp_gatt_if_t gatts_if, uint16_t conn_id, uint16_t attr_handle,
+                                      uint16_t value_len, uint8_t *value, bool need_confirm)
+{
+    TEST_ASSERT(gatts_if == GATTS_IF && !need_confirm);
+    /* Posts to the BTC task, whose callbacks take the queue lock */
+    TEST_ASSERT(host_locks_held == 0);
+    if (refuse) {
+        return ESP_FAIL;
+    }
+    sent.conn_id = conn_id;
+    sent.handle = attr_handle;
+    sent.len = value_len;
+    memcpy(sent.data, value, value_len < sizeof(sent.data) ? value_len : sizeof(sent.data));
+    sent.order[sent.count++ % sizeof(sent.order)] = sent.data[1];
+    if (complete) {
+        hid_dev_send_done(conn_id, attr_handle, ESP_GATT_OK);
+    }
+    return ESP_OK;
+}
+
+/* hidd_clcb_alloc() and hidd_clcb_find() of hid_device_le_prf.c */
+static hidd_clcb_t *connect(uint16_t conn_id, uint8_t proto_mode)
+{
+    for (int i = 0; i < HID_MAX_APPS; i++) {
+        hidd_clcb_t *clcb = &hidd_le_env.hidd_clcb[i];
+
+        if (!clcb->in_use) {
+            memset(clcb, 0, sizeof(*clcb));
+            clcb->in_use = clcb->connected = true;
+            clcb->conn_id = conn_id;
+            clcb->proto_mode = proto_mode;
+            hidd_le_env.hidd_clcb_idx[conn_id] = i + 1;
+            hid_dev_conn_reset(conn_id);
+            return clcb;
+        }
+    }
+    return NULL;
+}
+
+hidd_clcb_t *hidd_clcb_find(uint16_t conn_id)
+{
+    uint8_t i = conn_id < HIDD_LE_CONN_ID_MAX ? hidd_le_env.hidd_clcb_idx[conn_id] : 0;
+
+    return i ? &hidd_le_env.hidd_clcb[i - 1] : NULL;
+}
+
+/* hid_dev_rpt_by_id() before the index, with the mode of the host */
+static hid_report_map_t *lookup_before(uint8_t mode, uint8_t id, uint8_t type)
+{
+    hid_report_map_t *rpt = map;
+
+    for (uint8_t i = HID_NUM_REPORTS; i > 0; i--, rpt++) {
+        if (rpt->id == id && rpt->type == type && rpt->mode == mode) {
+            return rpt;
+        }
+    }
+    return NULL;
+}
+
+static void test_lookup(void)
+{
+    uint8_t data[2] = { 0 };
+
+    for (uint8_t mode = HID_PROTOCOL_MODE_BOOT; mode <= HID_PROTOCOL_MODE_REPORT; mode++) {
+        hidd_le_env.hidd_clcb[0].proto_mode = mode;
+        for (uint8_t type = 0; type <= HID_REPORT_TYPE_FEATURE + 1; type++) {
+            for (int id = 0; id < 256; id++) {
+                hid_report_map_t *rpt = lookup_before(mode, id, type);
+                uint32_t count = sent.count;
+
+                hid_dev_send_report(GATTS_IF, CONN, id, type, sizeof(data), data);
+                /* An empty map entry has no handle, nothing to send to */
+                if (rpt && rpt->handle) {
+                    TEST_ASSERT(sent.count == count + 1 && sent.handle == rpt->handle);
+                    hid_dev_send_done(CONN, sent.handle, ESP_GATT_OK);
+                } else {
+                    TEST_ASSERT(sent.count == count);
+                }
+            }
+        }
+    }
+    hidd_le_env.hidd_clcb[0].proto_mode = HID_PROTOCOL_MODE_REPORT;
+}
+
+/* hid_consumer_build_report() before the usage table */
+static void consumer_before(uint8_t *buffer, consumer_cmd_t cmd)
+{
+    switch (cmd) {
+    case HID_CONSUMER_CHANNEL_UP:
+        HID_CC_RPT_SET_CHANNEL(buffer, HID_CC_RPT_CHANNEL_UP);
+        break;
+    case HID_CONSUMER_CHANNEL_DOWN:
+        HID_CC_RPT_SET_CHANNEL(buffer, HID_CC_RPT_CHANNEL_DOWN);
+        break;
+    case HID_CONSUMER_VOLUME_UP:
+        HID_CC_RPT_SET_VOLUME_UP(buffer);
+        break;
+    case HID_CONSUMER_VOLUME_DOWN:
+        HID_CC_RPT_SET_VOLUME_DOWN(buffer);
+        break;
+    case HID_CONSUMER_MUTE:
+        HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_MUTE);
+        break;
+    case HID_CONSUMER_POWER:
+        HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_POWER);
+        break;
+    case HID_CONSUMER_RECALL_LAST:
+        HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_LAST);
+        break;
+    case HID_CONSUMER_ASSIGN_SEL:
+        HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_ASSIGN_SEL);
+        break;
+    case HID_CONSUMER_PLAY:
+        HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_PLAY);
+        break;
+    case HID_CONSUMER_PAUSE:
+        HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_PAUSE);
+        break;
+    case HID_CONSUMER_RECORD:
+        HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_RECORD);
+        break;
+    case HID_CONSUMER_FAST_FORWARD:
+        HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_FAST_FWD);
+        break;
+    case HID_CONSUMER_REWIND:
+        HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_REWIND);
+        break;
+    case HID_CONSUMER_SCAN_NEXT_TRK:
+        HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_SCAN_NEXT_TRK);
+        break;
+    case HID_CONSUMER_SCAN_PREV_TRK:
+        HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_SCAN_PREV_TRK);
+        break;
+    case HID_CONSUMER_STOP:
+        HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_STOP);
+        break;
+    default:
+        break;
+    }
+}
+
+/* Bit for bit the same report, for every command on every report it can be
+ * applied to, alone and two at a time
+ */
+static void test_consumer(void)
+{
+    uint8_t before[2], after[2];
+    consumer_cmd_t cmds[2];
+    uint32_t seed = 7;
+
+    for (int cmd = 0; cmd < 256; cmd++) {
+        for (int rpt = 0; rpt < 0x10000; rpt++) {
+            before[0] = after[0] = rpt & 0xFF;
+            before[1] = after[1] = rpt >> 8;
+            consumer_before(before, cmd);
+            hid_consumer_build_report(after, cmd);
+            TEST_ASSERT(memcmp(before, after, sizeof(before)) == 0);
+        }
+    }
+
+    for (int first = 0; first < 256; first++) {
+        for (int second = 0; second < 256; second++) {
+            uint32_t rpt = host_rand(&seed);
+
+            before[0] = after[0] = rpt & 0xFF;
+            before[1] = after[1] = rpt >> 8;
+            cmds[0] = first;
+            cmds[1] = second;
+            consumer_before(before, first);
+            consumer_before(before, second);
+            hid_consumer_build_report_n(after, cmds, 2);
+            TEST_ASSERT(memcmp(before, after, sizeof(before)) == 0);
+        }
+    }
+}
+
+/* Sent until the host turns its notifications off */
+static void test_cccd(void)
+{
+    uint8_t on[2] = { 0x01, 0x00 }, off[2] = { 0 }, data[8] = { 0 };
+    uint32_t count = sent.count;
+
+    hid_dev_send_report(GATTS_IF, CONN, HID_RPT_ID_KEY_IN, HID_REPORT_TYPE_INPUT, 8, data);
+    TEST_ASSERT(sent.count == ++count);
+    hid_dev_send_done(CONN, sent.handle, ESP_GATT_OK);
+
+    TEST_ASSERT(hid_dev_write_cccd(CONN, 0x25, sizeof(off), off));
+    hid_dev_send_report(GATTS_IF, CONN, HID_RPT_ID_KEY_IN, HID_REPORT_TYPE_INPUT, 8, data);
+    TEST_ASSERT(sent.count == count);
+    /* Only for the report of that CCCD */
+    hid_dev_send_report(GATTS_IF, CONN, HID_RPT_ID_CC_IN, HID_REPORT_TYPE_INPUT, 2, data);
+    TEST_ASSERT(sent.count == ++count && sent.handle == 0x28);
+    hid_dev_send_done(CONN, sent.handle, ESP_GATT_OK);
+
+    TEST_ASSERT(hid_dev_write_cccd(CONN, 0x25, sizeof(on), on));
+    hid_dev_send_report(GATTS_IF, CONN, HID_RPT_ID_KEY_IN, HID_REPORT_TYPE_INPUT, 8, data);
+    TEST_ASSERT(sent.count == ++count && sent.handle == 0x24);
+    hid_dev_send_done(CONN, sent.handle, ESP_GATT_OK);
+
+    /* Not a CCCD, or not two octets */
+    TEST_ASSERT(!hid_dev_write_cccd(CONN, 0x24, sizeof(on), on));
+    TEST_ASSERT(!hid_dev_write_cccd(CONN, 0x25, 1, on));
+    TEST_ASSERT(!hid_dev_write_cccd(CONN, 0, sizeof(on), on));
+}
+
+/* Only completions of our own notifications open the window again */
+static void test_window(void)
+{
+    uint8_t data[8] = { 0 };
+    hid_dev_queue_stats_t before, after;
+    uint32_t count = sent.count;
+
+    TEST_ASSERT(hid_dev_get_queue_stats(CONN, &before));
+    for (uint8_t n = 0; n < 6; n++) {
+        data[1] = n;
+        hid_dev_send_report(GATTS_IF, CONN, n & 1 ? HID_RPT_ID_CC_IN : HID_RPT_ID_KEY_IN,
+                            HID_REPORT_TYPE_INPUT, n & 1 ? 2 : 8, data);
+    }
+    TEST_ASSERT(sent.count == count + 4);
+
+    hid_dev_send_done(CONN, BATTERY, ESP_GATT_OK);
+    hid_dev_send_done(CONN, 0x20, ESP_GATT_OK);
+    TEST_ASSERT(sent.count == count + 4);
+
+    /* Completed out of order, the next queued report goes out on each */
+    hid_dev_send_done(CONN, 0x28, ESP_GATT_OK);
+    TEST_ASSERT(sent.count == count + 5 && sent.handle == 0x24 && sent.data[1] == 4);
+    hid_dev_send_done(CONN, 0x24, ESP_GATT_OK);
+    TEST_ASSERT(sent.count == count + 6 && sent.handle == 0x28 && sent.data[1] == 5);
+    for (uint8_t n = 0; n < 4; n++) {
+        hid_dev_send_done(CONN, n & 1 ? 0x28 : 0x24, ESP_GATT_OK);
+    }
+    /* Nothing left in flight */
+    hid_dev_send_done(CONN, 0x24, ESP_GATT_OK);
+    TEST_ASSERT(sent.count == count + 6);
+
+    TEST_ASSERT(hid_dev_get_queue_stats(CONN, &after));
+    TEST_ASSERT(after.sent == before.sent + 6 && after.high_water >= 2);
+}
+
+/* A report the stack refuses with nothing in flight is sent again from a timer */
+static void test_refused(void)
+{
+    uint8_t data[8] = { 0 };
+    hid_dev_queue_stats_t stats;
+    uint32_t count = sent.count, now = k_uptime_get_32();
+
+    refuse = true;
+    data[2] = HID_KEY_A;
+    hid_dev_send_report(GATTS_IF, CONN, HID_RPT_ID_KEY_IN, HID_REPORT_TYPE_INPUT, 8, data);
+    data[2] = 0;
+    hid_dev_send_report(GATTS_IF, CONN, HID_RPT_ID_KEY_IN, HID_REPORT_TYPE_INPUT, 8, data);
+    TEST_ASSERT(sent.count == count);
+
+    /* Refused again, the timer keeps going */
+    host_kernel_advance(now + 50);
+    TEST_ASSERT(sent.count == count);
+    TEST_ASSERT(hid_dev_get_queue_stats(CONN, &stats) && stats.refused >= 5);
+
+    refuse = false;
+    host_kernel_advance(now + 60);
+    TEST_ASSERT(sent.count == count + 2 && sent.data[2] == 0);
+    hid_dev_send_done(CONN, 0x24, ESP_GATT_OK);
+    hid_dev_send_done(CONN, 0x24, ESP_GATT_OK);
+
+    /* Nothing queued, the timer stops */
+    TEST_ASSERT(!host_kernel_next(&now));
+}
+
+/* Completions racing with the task sending: the reports they would pick wait
+ * for the reports already picked, and go out in order
+ */
+static void test_race(void)
+{
+    uint8_t data[8] = { 0 };
+    hid_dev_queue_stats_t before, after;
+    uint32_t count = sent.count;
+
+    TEST_ASSERT(hid_dev_get_queue_stats(CONN, &before));
+    /* Window full, then the rest queued */
+    for (uint8_t n = 0; n < 10; n++) {
+        data[1] = n;
+        hid_dev_send_report(GATTS_IF, CONN, HID_RPT_ID_KEY_IN, HID_REPORT_TYPE_INPUT, 8, data);
+    }
+    TEST_ASSERT(sent.count == count + 4 && sent.data[1] == 3);
+
+    /* The completion drains one report, which completes while it is sent: the
+     * task sending picks the next one once it is done, until the queue is empty
+     */
+    complete = true;
+    hid_dev_send_done(CONN, 0x24, ESP_GATT_OK);
+    complete = false;
+    TEST_ASSERT(sent.count == count + 10);
+    for (uint8_t n = 0; n < 10; n++) {
+        TEST_ASSERT(sent.order[(count + n) % sizeof(sent.order)] == n);
+    }
+    hid_dev_send_done(CONN, 0x24, ESP_GATT_OK);
+    hid_dev_send_done(CONN, 0x24, ESP_GATT_OK);
+    hid_dev_send_done(CONN, 0x24, ESP_GATT_OK);
+
+    TEST_ASSERT(hid_dev_get_queue_stats(CONN, &after));
+    TEST_ASSERT(after.sent == before.sent + 10);
+}
+
+/* Keyboard, mouse and consumer reports in turn */
+static const struct {
+    uint8_t id, len;
+} mix[] = {
+    { HID_RPT_ID_KEY_IN, 8 },
+    { HID_RPT_ID_MOUSE_IN, 4 },
+    { HID_RPT_ID_CC_IN, 2 },
+    { HID_RPT_ID_KEY_IN, 8 },
+};
+
+static void bench(void)
+{
+    uint8_t data[8] = { 0 };
+    uint64_t begin, before_ns, after_ns, send_ns;
+    uintptr_t sum = 0;
+
+    /* The lookup alone */
+    begin = host_time_ns();
+    for (int n = 0; n < REPORTS; n++) {
+        sum += (uintptr_t)lookup_before(hidd_le_env.hidd_clcb[0].proto_mode, mix[n & 3].id, HID_REPORT_TYPE_INPUT);
+    }
+    before_ns = host_time_ns() - begin;
+
+    /* The report path before the index: lookup, then straight to the stack */
+    begin = host_time_ns();
+    for (int n = 0; n < REPORTS; n++) {
+        hid_report_map_t *rpt = lookup_before(hidd_le_env.hidd_clcb[0].proto_mode, mix[n & 3].id,
+                                              HID_REPORT_TYPE_INPUT);
+        data[1] = n;
+        esp_ble_gatts_send_indicate(GATTS_IF, CONN, rpt->handle, mix[n & 3].len, data, false);
+    }
+    after_ns = host_time_ns() - begin;
+
+    /* hid_dev_send_report(), and the completion of each notification */
+    begin = host_time_ns();
+    for (int n = 0; n < REPORTS; n++) {
+        data[1] = n;
+        hid_dev_send_report(GATTS_IF, CONN, mix[n & 3].id, HID_REPORT_TYPE_INPUT, mix[n & 3].len, data);
+        hid_dev_send_done(CONN, sent.handle, ESP_GATT_OK);
+    }
+    send_ns = host_time_ns() - begin;
+
+    TEST_ASSERT(sum && sent.handle == 0x24 && sent.data[1] == (uint8_t)(REPORTS - 1));
+    printf("linear lookup %.1f M/s, report path before %.1f M reports/s, "
+           "hid_dev_send_report() %.1f M reports/s\n", REPORTS * 1000.0 / before_ns,
+           REPORTS * 1000.0 / after_ns, REPORTS * 1000.0 / send_ns);
+}
+
+/* Media keys pressed one after the other, on a report cleared each time */
+static void bench_consumer(void)
+{
+    static const consumer_cmd_t keys[] = {
+        HID_CONSUMER_VOLUME_UP, HID_CONSUMER_PLAY, HID_CONSUMER_MUTE, HID_CONSUMER_CHANNEL_DOWN,
+        HID_CONSUMER_SCAN_NEXT_TRK, HID_CONSUMER_VOLUME_DOWN, HID_CONSUMER_STOP, HID_CONSUMER_POWER,
+    };
+    uint8_t before[2], after[2];
+    uint64_t begin, before_ns, after_ns;
+    uint32_t sum = 0;
+
+    begin = host_time_ns();
+    for (int n = 0; n < REPORTS; n++) {
+        before[0] = before[1] = 0;
+        consumer_before(before, keys[n & 7]);
+        sum += before[0] ^ before[1];
+    }
+    before_ns = host_time_ns() - begin;
+
+    begin = host_time_ns();
+    for (int n = 0; n < REPORTS; n++) {
+        after[0] = after[1] = 0;
+        hid_consumer_build_report(after, keys[n & 7]);
+        sum -= after[0] ^ after[1];
+    }
+    after_ns = host_time_ns() - begin;
+
+    TEST_ASSERT(sum == 0);
+    printf("consumer report switch %.1f M/s, usage table %.1f M/s\n",
+           REPORTS * 1000.0 / before_ns, REPORTS * 1000.0 / after_ns);
+}
+
+int main(void)
+{
+    TEST_ASSERT(hid_dev_queue_init() == ESP_OK);
+    hid_dev_register_reports(HID_NUM_REPORTS, map);
+    TEST_ASSERT(connect(CONN, HID_PROTOCOL_MODE_REPORT));
+
+    test_lookup();
+    test_cccd();
+    test_window();
+    test_refused();
+    test_race();
+    test_consumer();
+    bench();
+    bench_consumer();
+    return 0;
+}
@@ -0,0 +1,393 @@
+/* test_hid_kbd.c - Keyboard reports of scripted key traces, and keys/s and
+ * press to report latency of typing traces, against the press, 50 ms, release,
+ * 50 ms demo task the engine replaced.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <setjmp.h>
+#include <string.h>
+
+#include "host_test.h"
+#include "host_kernel.h"
+#include "freertos/task.h"
+#include "esp_hidd_prf_api.h"
+#include "hid_dev.h"
+#include "hid_kbd.h"
+
+#define CONN        0
+#define WINDOW_MS   HID_KBD_REPORT_INTERVAL_MS
+#define SHIFT       LEFT_SHIFT_KEY_MASK
+#define OLD_KEY_MS  100     /* Press, 50 ms, release, 50 ms */
+
+/* Key events of a trace, in time order */
+typedef struct {
+    uint32_t at_ms;
+    uint8_t key;
+    bool pressed;
+} key_event_t;
+
+static key_event_t trace[40000];
+static uint32_t trace_len, trace_pos;
+
+/* Reports sent to the host */
+typedef struct {
+    uint32_t at_ms;
+    key_mask_t mods;
+    uint8_t count;
+    uint8_t keys[HID_KBD_RPT_KEYS];
+} report_t;
+
+static report_t reports[40000];
+static uint32_t report_cnt;
+
+static TaskFunction_t task_fn;
+static void *task_arg;
+static jmp_buf quiet;
+static uint32_t notified;
+
+static void key(uint32_t at_ms, uint8_t code, bool pressed)
+{
+    TEST_ASSERT(trace_len < sizeof(trace) / sizeof(trace[0]));
+    TEST_ASSERT(!trace_len || trace[trace_len - 1].at_ms <= at_ms);
+    trace[trace_len++] = (key_event_t) { .at_ms = at_ms, .key = code, .pressed = pressed };
+}
+
+void esp_hidd_send_keyboard_value(uint16_t conn_id, key_mask_t special_key_mask, uint8_t *keyboard_cmd, uint8_t num_key)
+{
+    report_t *rpt = &reports[report_cnt++];
+
+    TEST_ASSERT(report_cnt <= sizeof(reports) / sizeof(reports[0]));
+    TEST_ASSERT(conn_id == CONN && num_key <= HID_KBD_RPT_KEYS);
+    rpt->at_ms = k_uptime_get_32();
+    rpt->mods = special_key_mask;
+    rpt->count = num_key;
+    memcpy(rpt->keys, keyboard_cmd, num_key);
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    static int task;
+
+    (void)name, (void)stack_depth, (void)priority;
+    task_fn = fn;
+    task_arg = arg;
+    *handle = &task;
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    (void)task;
+    notified++;
+    return pdPASS;
+}
+
+/* The producer, hid_kbd_key() never waits so it runs within the sender task */
+static void play_until(uint32_t until_ms)
+{
+    while (trace_pos < trace_len && trace[trace_pos].at_ms <= until_ms) {
+        host_kernel_advance(trace[trace_pos].at_ms);
+        hid_kbd_key(trace[trace_pos].key, trace[trace_pos].pressed);
+        TEST_ASSERT(host_locks_held == 0);
+        trace_pos++;
+    }
+}
+
+/* The sender task runs in ulTaskNotifyTake() and vTaskDelay(), the test gets
+ * back control once the task waits without timeout and the trace is over.
+ */
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    uint32_t count;
+
+    TEST_ASSERT(host_locks_held == 0 && ticks == portMAX_DELAY);
+    while (!notified) {
+        if (trace_pos == trace_len) {
+            longjmp(quiet, 1);
+        }
+        play_until(trace[trace_pos].at_ms);
+    }
+    count = notified;
+    notified = clear_on_exit ? 0 : count - 1;
+    return count;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    uint32_t wake_ms = k_uptime_get_32() + ticks;
+
+    TEST_ASSERT(host_locks_held == 0);
+    play_until(wake_ms);
+    host_kernel_advance(wake_ms);
+}
+
+/* Plays the trace from start_ms, returns the first report it sent */
+static uint32_t play(uint32_t start_ms)
+{
+    uint32_t first = report_cnt;
+
+    host_kernel_advance(start_ms);
+    notified++;
+    if (!setjmp(quiet)) {
+        task_fn(task_arg);
+    }
+    TEST_ASSERT(trace_pos == trace_len);
+    trace_len = trace_pos = 0;
+    return first;
+}
+
+static void expect(uint32_t i, uint32_t at_ms, key_mask_t mods, const char *keys)
+{
+    size_t n = strlen(keys);
+
+    TEST_ASSERT(i < report_cnt);
+    TEST_ASSERT(reports[i].at_ms == at_ms && reports[i].mods == mods);
+    TEST_ASSERT(reports[i].count == n && !memcmp(reports[i].keys, keys, n));
+}
+
+static void test_tap(void)
+{
+    uint32_t start = k_uptime_get_32() + 1000, i;
+
+    key(start, HID_KEY_A, true);
+    key(start + 50, HID_KEY_A, false);
+    i = play(start);
+    expect(i, start, 0, "\x04");
+    expect(i + 1, start + 50, 0, "");
+    TEST_ASSERT(report_cnt == i + 2);
+}
+
+/* A press and release within one window, and a key pressed again before its
+ * release was reported
+ */
+static void test_window(void)
+{
+    uint32_t start = k_uptime_get_32() + 1000, i;
+
+    key(start, HID_KEY_A, true);
+    key(start, HID_KEY_A, false);
+    i = play(start);
+    expect(i, start, 0, "\x04");
+    expect(i + 1, start + WINDOW_MS, 0, "");
+    TEST_ASSERT(report_cnt == i + 2);
+
+    start += 1000;
+    key(start, HID_KEY_B, true);
+    key(start + 3, HID_KEY_B, false);
+    key(start + 6, HID_KEY_B, true);
+    key(start + 100, HID_KEY_B, false);
+    i = play(start);
+    expect(i, start, 0, "\x05");
+    expect(i + 1, start + WINDOW_MS, 0, "");
+    expect(i + 2, start + 2 * WINDOW_MS, 0, "\x05");
+    expect(i + 3, start + 100, 0, "");
+    TEST_ASSERT(report_cnt == i + 4);
+}
+
+/* Shift+A, the modifier and the key in the order they were pressed */
+static void test_chord(void)
+{
+    uint32_t start = k_uptime_get_32() + 1000, i;
+
+    key(start, HID_KEY_LEFT_SHIFT, true);
+    key(start + 5, HID_KEY_A, true);
+    key(start + 40, HID_KEY_A, false);
+    key(start + 45, HID_KEY_LEFT_SHIFT, false);
+    i = play(start);
+    expect(i, start, SHIFT, "");
+    expect(i + 1, start + WINDOW_MS, SHIFT, "\x04");
+    expect(i + 2, start + 40, SHIFT, "");
+    expect(i + 3, start + 40 + WINDOW_MS, 0, "");
+    TEST_ASSERT(report_cnt == i + 4);
+
+    /* A tap of the modifier alone within one window is reported once */
+    start += 1000;
+    key(start, HID_KEY_LEFT_SHIFT, true);
+    key(start + 1, HID_KEY_LEFT_SHIFT, false);
+    i = play(start);
+    expect(i, start, SHIFT, "");
+    expect(i + 1, start + WINDOW_MS, 0, "");
+    TEST_ASSERT(report_cnt == i + 2);
+}
+
+/* Seven keys report ErrorRollOver, six their codes, HID_KBD_HELD_MAX are kept */
+static void test_rollover(void)
+{
+    uint32_t start = k_uptime_get_32() + 1000, i, dropped = hid_kbd_dropped();
+
+    for (uint8_t k = 0; k < 7; k++) {
+        key(start + 100 * k, HID_KEY_A + k, true);
+    }
+    key(start + 1000, HID_KEY_A + 6, false);
+    i = play(start);
+    expect(i + 5, start + 500, 0, "\x04\x05\x06\x07\x08\x09");
+    expect(i + 6, start + 600, 0, "\x01\x01\x01\x01\x01\x01");
+    expect(i + 7, start + 1000, 0, "\x04\x05\x06\x07\x08\x09");
+
+    start += 2000;
+    for (uint8_t k = 6; k < HID_KBD_HELD_MAX + 1; k++) {
+        key(start + k, HID_KEY_A + k, true);
+    }
+    for (uint8_t k = 0; k < HID_KBD_HELD_MAX + 1; k++) {
+        key(start + 100, HID_KEY_A + k, false);
+    }
+    i = play(start);
+    TEST_ASSERT(hid_kbd_dropped() == dropped + 1);
+    expect(report_cnt - 1, start + 100, 0, "");
+}
+
+/* Nothing is sent without a host, a new host gets the keys held */
+static void test_conn(void)
+{
+    uint32_t start = k_uptime_get_32() + 1000, i;
+
+    hid_kbd_set_conn(CONN, false);
+    key(start, HID_KEY_A, true);
+    key(start + 50, HID_KEY_B, true);
+    key(start + 60, HID_KEY_B, false);
+    i = play(start);
+    TEST_ASSERT(report_cnt == i);
+
+    hid_kbd_set_conn(CONN, true);
+    key(start + 200, HID_KEY_A, false);
+    i = play(start + 100);
+    expect(i, start + 100, 0, "\x04");
+    expect(i + 1, start + 200, 0, "");
+    TEST_ASSERT(report_cnt == i + 2);
+}
+
+typedef struct {
+    uint32_t *ms;
+    uint32_t cnt;
+} samples_t;
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(samples_t *s, uint32_t pct)
+{
+    qsort(s->ms, s->cnt, sizeof(uint32_t), cmp_u32);
+    return s->ms[(s->cnt - 1) * pct / 100];
+}
+
+/* A typist at keys_per_s, holding each key 40 to 120 ms so that fast typing
+ * overlaps, with a shifted letter now and then.
+ */
+static uint32_t typing(uint32_t start, uint32_t keys, uint32_t keys_per_s, uint32_t *seed)
+{
+    static key_event_t ev[20000];
+    uint32_t n = 0, t = start, gap = 1000 / keys_per_s, up_ms[256] = { 0 };
+
+    TEST_ASSERT(2 * keys + 2 <= sizeof(ev) / sizeof(ev[0]));
+    for (uint32_t k = 0; k < keys; k++) {
+        uint8_t code;
+
+        /* A key is not pressed again while it is held */
+        do {
+            code = HID_KEY_A + host_rand(seed) % 26;
+        } while (up_ms[code] >= t);
+        up_ms[code] = t + 40 + host_rand(seed) % 81;
+        ev[n++] = (key_event_t) { t, code, true };
+        ev[n++] = (key_event_t) { up_ms[code], code, false };
+        t += gap / 2 + host_rand(seed) % (gap + 1);
+    }
+    /* Sorted by time, a release before a press at the same time */
+    for (uint32_t a = 1; a < n; a++) {
+        for (uint32_t b = a; b > 0 && (ev[b].at_ms < ev[b - 1].at_ms ||
+                                       (ev[b].at_ms == ev[b - 1].at_ms && !ev[b].pressed && ev[b - 1].pressed)); b--) {
+            key_event_t tmp = ev[b];
+            ev[b] = ev[b - 1];
+            ev[b - 1] = tmp;
+        }
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        key(ev[i].at_ms, ev[i].key, ev[i].pressed);
+    }
+    return n;
+}
+
+static void bench(uint32_t keys_per_s)
+{
+    static uint32_t latency[10000], old_latency[10000];
+    samples_t lat = { latency, 0 }, old = { old_latency, 0 };
+    uint32_t seed = 14 + keys_per_s, start = k_uptime_get_32() + 1000, keys = 2000;
+    uint32_t first, last_ms, old_end_ms = 0, old_last_ms = 0;
+    key_event_t *ev;
+    uint32_t n;
+
+    n = typing(start, keys, keys_per_s, &seed);
+    ev = malloc(n * sizeof(*ev));
+    TEST_ASSERT(ev);
+    memcpy(ev, trace, n * sizeof(*ev));
+    first = play(start);
+
+    /* Each press shows up in the first report after it where the key was not
+     * in the report before
+     */
+    for (uint32_t i = 0; i < n; i++) {
+        bool before = false;
+        uint32_t r;
+
+        if (!ev[i].pressed) {
+            continue;
+        }
+        for (r = first; r < report_cnt; r++) {
+            bool in = memchr(reports[r].keys, ev[i].key, reports[r].count) != NULL;
+
+            if (reports[r].at_ms >= ev[i].at_ms && in && !before) {
+                break;
+            }
+            before = in;
+        }
+        TEST_ASSERT(r < report_cnt);
+        lat.ms[lat.cnt++] = reports[r].at_ms - ev[i].at_ms;
+        /* A report never carries the previous press of this key */
+        for (uint32_t j = i + 1; j < n && ev[j].at_ms <= reports[r].at_ms; j++) {
+            TEST_ASSERT(ev[j].key != ev[i].key || !ev[j].pressed);
+        }
+
+        /* The demo task sent one key every OLD_KEY_MS, in order */
+        old_end_ms = (ev[i].at_ms > old_end_ms ? ev[i].at_ms : old_end_ms) + OLD_KEY_MS;
+        old.ms[old.cnt++] = old_end_ms - OLD_KEY_MS - ev[i].at_ms;
+        old_last_ms = old_end_ms;
+    }
+    TEST_ASSERT(lat.cnt == keys);
+    TEST_ASSERT(reports[report_cnt - 1].count == 0);
+    last_ms = reports[report_cnt - 1].at_ms;
+
+    printf("typing %u keys/s: engine %.1f keys/s, %u reports, latency p50 %u ms p99 %u ms max %u ms; "
+           "demo task %.1f keys/s, latency p50 %u ms p99 %u ms\n", keys_per_s,
+           keys * 1000.0 / (last_ms - start), report_cnt - first, percentile(&lat, 50),
+           percentile(&lat, 99), percentile(&lat, 100), keys * 1000.0 / (old_last_ms - start),
+           percentile(&old, 50), percentile(&old, 99));
+    TEST_ASSERT(percentile(&lat, 100) <= 2 * WINDOW_MS);
+    free(ev);
+}
+
+int main(void)
+{
+    TEST_ASSERT(hid_kbd_init() == ESP_OK);
+    TEST_ASSERT(hid_kbd_init() == ESP_ERR_INVALID_STATE);
+    hid_kbd_set_conn(CONN, true);
+    /* A new host starts from no key pressed, nothing to tell it */
+    TEST_ASSERT(play(1000) == 0 && report_cnt == 0);
+
+    test_tap();
+    test_window();
+    test_chord();
+    test_rollover();
+    test_conn();
+
+    bench(5);
+    bench(10);
+    bench(20);
+    bench(40);
+    return 0;
+}
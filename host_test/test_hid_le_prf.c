@@ -0,0 +1,314 @@
+/* test_hid_le_prf.c - Links of several HID hosts through the GATT server
+ * events of the profile: clcb allocation and release, per-link protocol mode
+ * and CCCD state, and one report fanned out to every host.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "hidd_le_prf_int.h"
+
+#define GATTS_IF    3
+#define BAS_HANDLE  0x10
+#define HID_HANDLE  0x20
+#define ATT(idx)    (HID_HANDLE + (idx))
+
+/* Hosts, the last conn_id is beyond the direct table */
+static const uint16_t conn[] = { 0, 5, HIDD_LE_CONN_ID_MAX + 4 };
+#define HOSTS       (sizeof(conn) / sizeof(conn[0]))
+
+static struct {
+    uint16_t conn_id;
+    uint16_t handle;
+    uint8_t data[8];
+} sent[64];
+static uint32_t sent_cnt;
+
+static uint16_t attr_tab_len;
+static uint16_t started;
+
+static struct {
+    esp_hidd_cb_event_t event;
+    esp_hidd_cb_param_t param;
+} events[16];
+static uint32_t event_cnt;
+
+esp_err_t esp_ble_gatts_create_attr_tab(const esp_gatts_attr_db_t *gatts_attr_db, esp_gatt_if_t gatts_if,
+                                        uint16_t max_nb_attr, uint8_t srvc_inst_id)
+{
+    (void)gatts_attr_db, (void)srvc_inst_id;
+    TEST_ASSERT(gatts_if == GATTS_IF);
+    attr_tab_len = max_nb_attr;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_start_service(uint16_t service_handle)
+{
+    started = service_handle;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_send_indicate(esp_gatt_if_t gatts_if, uint16_t conn_id, uint16_t attr_handle,
+                                      uint16_t value_len, uint8_t *value, bool need_confirm)
+{
+    TEST_ASSERT(gatts_if == GATTS_IF && !need_confirm && sent_cnt < sizeof(sent) / sizeof(sent[0]));
+    sent[sent_cnt].conn_id = conn_id;
+    sent[sent_cnt].handle = attr_handle;
+    memcpy(sent[sent_cnt].data, value, value_len < 8 ? value_len : 8);
+    sent_cnt++;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_register_callback(esp_gatts_cb_t callback)
+{
+    (void)callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_set_attr_value(uint16_t attr_handle, uint16_t length, const uint8_t *value)
+{
+    (void)attr_handle, (void)length, (void)value;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_get_attr_value(uint16_t attr_handle, uint16_t *length, const uint8_t **value)
+{
+    (void)attr_handle, (void)length, (void)value;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_config_local_icon(uint16_t icon)
+{
+    (void)icon;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_set_encryption(esp_bd_addr_t bd_addr, esp_ble_sec_act_t sec_act)
+{
+    (void)bd_addr, (void)sec_act;
+    return ESP_OK;
+}
+
+static void hidd_event(esp_hidd_cb_event_t event, esp_hidd_cb_param_t *param)
+{
+    TEST_ASSERT(event_cnt < sizeof(events) / sizeof(events[0]));
+    events[event_cnt].event = event;
+    events[event_cnt].param = *param;
+    event_cnt++;
+}
+
+/* Registration, then the battery and HID attribute tables */
+static void setup(void)
+{
+    esp_ble_gatts_cb_param_t param = { 0 };
+    uint16_t handles[HIDD_LE_IDX_NB];
+
+    hidd_le_init();
+    hidd_le_env.hidd_cb = hidd_event;
+    TEST_ASSERT(hid_dev_queue_init() == ESP_OK);
+
+    param.reg.status = ESP_GATT_OK;
+    param.reg.app_id = HIDD_APP_ID;
+    esp_hidd_prf_cb_hdl(ESP_GATTS_REG_EVT, GATTS_IF, &param);
+    TEST_ASSERT(event_cnt == 1 && events[0].event == ESP_HIDD_EVENT_REG_FINISH);
+
+    for (uint16_t i = 0; i < HIDD_LE_IDX_NB; i++) {
+        handles[i] = BAS_HANDLE + i;
+    }
+    memset(&param, 0, sizeof(param));
+    param.add_attr_tab.status = ESP_GATT_OK;
+    param.add_attr_tab.svc_uuid.uuid.uuid16 = ESP_GATT_UUID_BATTERY_SERVICE_SVC;
+    param.add_attr_tab.num_handle = attr_tab_len;
+    param.add_attr_tab.handles = handles;
+    esp_hidd_prf_cb_hdl(ESP_GATTS_CREAT_ATTR_TAB_EVT, GATTS_IF, &param);
+    TEST_ASSERT(attr_tab_len == HIDD_LE_IDX_NB && started == BAS_HANDLE);
+
+    for (uint16_t i = 0; i < HIDD_LE_IDX_NB; i++) {
+        handles[i] = ATT(i);
+    }
+    param.add_attr_tab.svc_uuid.uuid.uuid16 = ATT_SVC_HID;
+    param.add_attr_tab.num_handle = attr_tab_len;
+    esp_hidd_prf_cb_hdl(ESP_GATTS_CREAT_ATTR_TAB_EVT, GATTS_IF, &param);
+    TEST_ASSERT(started == ATT(HIDD_LE_IDX_SVC));
+}
+
+static void connect(uint16_t conn_id)
+{
+    esp_ble_gatts_cb_param_t param = { 0 };
+
+    param.connect.conn_id = conn_id;
+    memset(param.connect.remote_bda, conn_id, sizeof(esp_bd_addr_t));
+    event_cnt = 0;
+    esp_hidd_prf_cb_hdl(ESP_GATTS_CONNECT_EVT, GATTS_IF, &param);
+    TEST_ASSERT(event_cnt == 1 && events[0].event == ESP_HIDD_EVENT_BLE_CONNECT &&
+                events[0].param.connect.conn_id == conn_id);
+}
+
+static void disconnect(uint16_t conn_id)
+{
+    esp_ble_gatts_cb_param_t param = { 0 };
+
+    param.disconnect.conn_id = conn_id;
+    memset(param.disconnect.remote_bda, conn_id, sizeof(esp_bd_addr_t));
+    event_cnt = 0;
+    esp_hidd_prf_cb_hdl(ESP_GATTS_DISCONNECT_EVT, GATTS_IF, &param);
+    TEST_ASSERT(event_cnt == 1 && events[0].event == ESP_HIDD_EVENT_BLE_DISCONNECT &&
+                events[0].param.disconnect.conn_id == conn_id &&
+                events[0].param.disconnect.remote_bda[0] == (uint8_t)conn_id);
+}
+
+static void write_attr(uint16_t conn_id, uint16_t handle, uint16_t len, uint8_t *value)
+{
+    esp_ble_gatts_cb_param_t param = { 0 };
+
+    param.write.conn_id = conn_id;
+    param.write.handle = handle;
+    param.write.len = len;
+    param.write.value = value;
+    esp_hidd_prf_cb_hdl(ESP_GATTS_WRITE_EVT, GATTS_IF, &param);
+}
+
+/* Completes every notification sent so far */
+static void complete(void)
+{
+    for (uint32_t i = 0; i < sent_cnt; i++) {
+        esp_ble_gatts_cb_param_t param = { 0 };
+
+        param.conf.status = ESP_GATT_OK;
+        param.conf.conn_id = sent[i].conn_id;
+        param.conf.handle = sent[i].handle;
+        esp_hidd_prf_cb_hdl(ESP_GATTS_CONF_EVT, GATTS_IF, &param);
+    }
+    sent_cnt = 0;
+}
+
+/* The handle each host got the last broadcast on, 0 if none */
+static uint16_t sent_to(uint16_t conn_id)
+{
+    uint16_t handle = 0;
+
+    for (uint32_t i = 0; i < sent_cnt; i++) {
+        if (sent[i].conn_id == conn_id) {
+            TEST_ASSERT(!handle);
+            handle = sent[i].handle;
+        }
+    }
+    return handle;
+}
+
+static void send_key(uint8_t key)
+{
+    uint8_t report[8] = { 0, 0, key };
+
+    complete();
+    hid_dev_send_report(GATTS_IF, ESP_HIDD_CONN_ID_ALL, HID_RPT_ID_KEY_IN, HID_REPORT_TYPE_INPUT,
+                        sizeof(report), report);
+}
+
+static void test_links(void)
+{
+    for (uint32_t i = 0; i < HOSTS; i++) {
+        connect(conn[i]);
+    }
+    for (uint32_t i = 0; i < HOSTS; i++) {
+        hidd_clcb_t *clcb = hidd_clcb_find(conn[i]);
+
+        TEST_ASSERT(clcb && clcb->in_use && clcb->conn_id == conn[i]);
+        TEST_ASSERT(clcb->proto_mode == HID_PROTOCOL_MODE_REPORT && clcb->remote_bda[0] == (uint8_t)conn[i]);
+    }
+    TEST_ASSERT(hidd_clcb_find(1) == NULL && hidd_clcb_find(HIDD_LE_CONN_ID_MAX + 5) == NULL);
+
+    /* No free link for a fourth host */
+    connect(9);
+    TEST_ASSERT(hidd_clcb_find(9) == NULL);
+
+    send_key(HID_KEY_A);
+    for (uint32_t i = 0; i < HOSTS; i++) {
+        TEST_ASSERT(sent_to(conn[i]) == ATT(HIDD_LE_IDX_REPORT_KEY_IN_VAL));
+    }
+}
+
+/* Each host in its own protocol mode and with its own CCCD */
+static void test_per_link(void)
+{
+    uint8_t boot = HID_PROTOCOL_MODE_BOOT, bad = 2, off[2] = { 0 }, on[2] = { 1, 0 };
+
+    write_attr(conn[1], ATT(HIDD_LE_IDX_PROTO_MODE_VAL), 1, &boot);
+    write_attr(conn[2], ATT(HIDD_LE_IDX_PROTO_MODE_VAL), 1, &bad);
+    TEST_ASSERT(hidd_clcb_find(conn[1])->proto_mode == HID_PROTOCOL_MODE_BOOT);
+    TEST_ASSERT(hidd_clcb_find(conn[2])->proto_mode == HID_PROTOCOL_MODE_REPORT);
+    send_key(HID_KEY_B);
+    TEST_ASSERT(sent_to(conn[0]) == ATT(HIDD_LE_IDX_REPORT_KEY_IN_VAL));
+    TEST_ASSERT(sent_to(conn[1]) == ATT(HIDD_LE_IDX_BOOT_KB_IN_REPORT_VAL));
+    TEST_ASSERT(sent_to(conn[2]) == ATT(HIDD_LE_IDX_REPORT_KEY_IN_VAL));
+    TEST_ASSERT(sent[0].data[2] == HID_KEY_B && sent[1].data[2] == HID_KEY_B);
+
+    /* The host beyond the direct table turns its keyboard notifications off */
+    write_attr(conn[2], ATT(HIDD_LE_IDX_REPORT_KEY_IN_CCC), sizeof(off), off);
+    send_key(HID_KEY_C);
+    TEST_ASSERT(sent_to(conn[0]) && sent_to(conn[1]) && !sent_to(conn[2]));
+    /* Boot mode notifications have a CCCD of their own */
+    write_attr(conn[1], ATT(HIDD_LE_IDX_REPORT_KEY_IN_CCC), sizeof(off), off);
+    send_key(HID_KEY_D);
+    TEST_ASSERT(sent_to(conn[1]) == ATT(HIDD_LE_IDX_BOOT_KB_IN_REPORT_VAL));
+    write_attr(conn[1], ATT(HIDD_LE_IDX_REPORT_KEY_IN_CCC), sizeof(on), on);
+    write_attr(conn[1], ATT(HIDD_LE_IDX_BOOT_KB_IN_REPORT_NTF_CFG), sizeof(off), off);
+    send_key(HID_KEY_E);
+    TEST_ASSERT(sent_to(conn[0]) && !sent_to(conn[1]) && !sent_to(conn[2]));
+}
+
+/* A host leaving frees its own link and nothing else */
+static void test_release(void)
+{
+    hidd_clcb_t *first = hidd_clcb_find(conn[0]), *last = hidd_clcb_find(conn[2]);
+    hidd_clcb_t *clcb;
+
+    disconnect(conn[1]);
+    TEST_ASSERT(hidd_clcb_find(conn[1]) == NULL);
+    TEST_ASSERT(hidd_clcb_find(conn[0]) == first && first->in_use && first->conn_id == conn[0]);
+    TEST_ASSERT(hidd_clcb_find(conn[2]) == last && last->in_use && last->conn_id == conn[2]);
+    /* Its CCCD and protocol mode stayed with it */
+    send_key(HID_KEY_F);
+    TEST_ASSERT(sent_to(conn[0]) && !sent_to(conn[1]) && !sent_to(conn[2]));
+
+    /* A conn_id never connected, or gone already */
+    TEST_ASSERT(!hidd_clcb_dealloc(1) && !hidd_clcb_dealloc(conn[1]));
+    TEST_ASSERT(hidd_clcb_find(conn[0]) == first && hidd_clcb_find(conn[2]) == last);
+
+    /* The next host gets the free link, with a fresh state */
+    connect(7);
+    clcb = hidd_clcb_find(7);
+    TEST_ASSERT(clcb && clcb != first && clcb != last && clcb->proto_mode == HID_PROTOCOL_MODE_REPORT);
+    send_key(HID_KEY_G);
+    TEST_ASSERT(sent_to(7) == ATT(HIDD_LE_IDX_REPORT_KEY_IN_VAL));
+
+    /* The host beyond the direct table leaves, and comes back */
+    disconnect(conn[2]);
+    TEST_ASSERT(hidd_clcb_find(conn[2]) == NULL && hidd_clcb_find(7) == clcb);
+    connect(conn[2]);
+    send_key(HID_KEY_H);
+    TEST_ASSERT(sent_to(conn[0]) && sent_to(7) && sent_to(conn[2]) == ATT(HIDD_LE_IDX_REPORT_KEY_IN_VAL));
+
+    for (uint32_t i = 0; i < HID_MAX_APPS; i++) {
+        disconnect(hidd_le_env.hidd_clcb[i].conn_id);
+    }
+    for (uint32_t i = 0; i < HID_MAX_APPS; i++) {
+        TEST_ASSERT(!hidd_le_env.hidd_clcb[i].in_use);
+    }
+    for (uint32_t i = 0; i < HIDD_LE_CONN_ID_MAX; i++) {
+        TEST_ASSERT(hidd_le_env.hidd_clcb_idx[i] == 0);
+    }
+}
+
+int main(void)
+{
+    setup();
+    test_links();
+    test_per_link();
+    test_release();
+    return 0;
+}
@@ -0,0 +1,190 @@
+/* test_info_store.c - OnOff client info written behind to a stand-in NVS:
+ * writes left to the task by the timer, TIDs never reused across a power
+ * loss, and flash writes and send latency of tap traces against a write per
+ * tap.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "host_kernel.h"
+#include "freertos/FreeRTOS.h"
+#include "info_store.h"
+
+#define BLOCK           CONFIG_EXAMPLE_TID_BLOCK
+#define DELAY_MS        CONFIG_EXAMPLE_STORE_DELAY_MS
+#define NVS_WRITE_US    10000   /* An NVS write with a page erase now and then, on the ESP32 */
+
+static example_info_t store;
+
+/* The stand-in NVS, what a power loss leaves */
+static struct {
+    example_info_t info;
+    uint32_t writes;
+    bool fail;
+} nvs;
+
+static uint32_t due_cnt;
+static bool in_send;            /* The write happens on the send path */
+static uint32_t send_writes;
+
+static esp_err_t nvs_write(const example_info_t *info)
+{
+    /* Called by the store, with its lock held */
+    TEST_ASSERT(host_locks_held == 1);
+    if (nvs.fail) {
+        return ESP_FAIL;
+    }
+    nvs.info = *info;
+    nvs.writes++;
+    send_writes += in_send;
+    return ESP_OK;
+}
+
+/* On the esp_timer task: only tells the tap task */
+static void due(void)
+{
+    due_cnt++;
+}
+
+/* The tap task, woken by due() */
+static void task_run(void)
+{
+    if (due_cnt) {
+        due_cnt = 0;
+        example_info_flush();
+    }
+}
+
+static void power_loss(void)
+{
+    store = nvs.info;
+    example_info_restored();
+}
+
+static uint8_t send(void)
+{
+    uint8_t tid;
+
+    in_send = true;
+    tid = example_info_tid_take();
+    store.onoff = !store.onoff;
+    example_info_changed();
+    in_send = false;
+    return tid;
+}
+
+static void test_behind(void)
+{
+    uint32_t now = k_uptime_get_32(), writes;
+
+    /* A new device writes the first block before sending */
+    TEST_ASSERT(send() == 0 && nvs.writes == 1 && nvs.info.tid == BLOCK);
+    writes = nvs.writes;
+
+    /* The timer only tells the task, which writes */
+    host_kernel_advance(now + DELAY_MS - 1);
+    TEST_ASSERT(due_cnt == 0);
+    host_kernel_advance(now + DELAY_MS);
+    TEST_ASSERT(due_cnt == 1 && nvs.writes == writes);
+    task_run();
+    TEST_ASSERT(nvs.writes == writes + 1 && nvs.info.onoff == store.onoff);
+
+    /* Nothing changed, nothing written */
+    example_info_flush();
+    TEST_ASSERT(nvs.writes == writes + 1);
+
+    /* Every change pushes the write back */
+    now = k_uptime_get_32();
+    for (int i = 0; i < 5; i++) {
+        store.app_idx = i;
+        example_info_changed();
+        host_kernel_advance(now += DELAY_MS / 2);
+    }
+    TEST_ASSERT(due_cnt == 0);
+    host_kernel_advance(now += DELAY_MS / 2);
+    task_run();
+    TEST_ASSERT(nvs.writes == writes + 2 && nvs.info.app_idx == 4);
+
+    /* A failed write is kept dirty and written with the next one, here at
+     * shutdown
+     */
+    store.app_idx = 5;
+    example_info_changed();
+    nvs.fail = true;
+    host_kernel_advance(now += DELAY_MS);
+    task_run();
+    nvs.fail = false;
+    TEST_ASSERT(nvs.writes == writes + 2);
+    example_info_flush();
+    TEST_ASSERT(nvs.writes == writes + 3 && nvs.info.app_idx == 5);
+}
+
+/* Power lost at random points of a tap trace, flash left as it was */
+static void test_power_loss(void)
+{
+    uint32_t seed = 21, now = k_uptime_get_32();
+    uint8_t last = 0, tid;
+
+    power_loss();
+    last = send();
+    for (int i = 0; i < 20000; i++) {
+        now += 300 + host_rand(&seed) % (DELAY_MS * 2);
+        host_kernel_advance(now);
+        task_run();
+        if (host_rand(&seed) % 50 == 0) {
+            power_loss();
+        }
+        tid = send();
+        /* Never a TID the server may still remember, and no more skipped than a block */
+        TEST_ASSERT((uint8_t)(tid - last) >= 1 && (uint8_t)(tid - last) <= BLOCK + 1);
+        last = tid;
+    }
+    host_kernel_advance(now + DELAY_MS);
+    task_run();
+}
+
+/* Sends every 350 ms in bursts, the gap between bursts longer than the delay */
+static void bench(uint32_t burst, uint32_t gap_ms)
+{
+    uint32_t now = k_uptime_get_32(), sends = 0, writes = nvs.writes;
+    uint64_t begin, ns = 0;
+
+    send_writes = 0;
+    for (int round = 0; round < 200; round++) {
+        for (uint32_t i = 0; i < burst; i++) {
+            host_kernel_advance(now += 350);
+            task_run();
+            begin = host_time_ns();
+            send();
+            ns += host_time_ns() - begin;
+            sends++;
+        }
+        host_kernel_advance(now += gap_ms);
+        task_run();
+    }
+    writes = nvs.writes - writes;
+
+    /* The send path waits for the writes it does itself */
+    printf("bursts of %u sends: %u writes per 100 sends, %u of them on the send path, "
+           "send %.2f ms on average; a write per send: 100 writes, send %.2f ms\n",
+           burst, writes * 100 / sends, send_writes * 100 / sends,
+           (ns / 1000.0 + (double)send_writes * NVS_WRITE_US) / sends / 1000, NVS_WRITE_US / 1000.0);
+    TEST_ASSERT(send_writes * BLOCK <= sends + BLOCK);
+}
+
+int main(void)
+{
+    TEST_ASSERT(example_info_init(&store, nvs_write, due) == ESP_OK);
+
+    test_behind();
+    test_power_loss();
+    bench(1, DELAY_MS * 2);
+    bench(5, DELAY_MS * 2);
+    bench(40, DELAY_MS * 2);
+    return 0;
+}
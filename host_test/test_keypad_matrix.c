@@ -0,0 +1,443 @@
+/* test_keypad_matrix.c - Keypad scan logic against a simulated matrix without
+ * diodes and with bouncing contacts, and lost keys and latency of a fast typist
+ * compared with the row interrupt reader it replaced.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "host_test.h"
+#include "keypad_matrix.h"
+
+#define KEY(row, col)   ((row) * KEYPAD_COLS + (col))
+#define ROW_MASK        ((1U << KEYPAD_COLS) - 1)
+#define SCAN_MS         1       /* KEYPAD_SCAN_PERIOD_US */
+#define OLD_DEBOUNCE_MS 100     /* KEYPAD_DEBOUNCING of the row interrupt */
+
+static uint32_t seed = 11;
+
+/* Physical keys, a contact reads at random while it bounces */
+static struct {
+    bool down;
+    uint32_t changed_ms;
+    uint32_t bounce_ms;
+} keys[KEYPAD_KEYS];
+
+static struct {
+    uint8_t key;
+    bool pressed;
+    uint32_t at_ms;     /* Scan which emitted it */
+} events[4096];
+static uint32_t event_cnt;
+
+static void press(uint8_t key, bool down, uint32_t now_ms, uint32_t bounce_ms)
+{
+    keys[key].down = down;
+    keys[key].changed_ms = now_ms;
+    keys[key].bounce_ms = bounce_ms;
+}
+
+static uint16_t contacts(uint32_t now_ms)
+{
+    uint16_t closed = 0;
+
+    for (int key = 0; key < KEYPAD_KEYS; key++) {
+        bool bouncing = now_ms - keys[key].changed_ms < keys[key].bounce_ms;
+
+        if (bouncing ? host_rand(&seed) & 1 : keys[key].down) {
+            closed |= 1U << key;
+        }
+    }
+    return closed;
+}
+
+/* A column reads low on every row it is connected to through closed keys */
+static uint16_t sample(uint32_t now_ms)
+{
+    uint16_t closed = contacts(now_ms), raw = 0;
+    uint16_t cols[KEYPAD_ROWS];
+    bool merged;
+
+    for (int r = 0; r < KEYPAD_ROWS; r++) {
+        cols[r] = (closed >> (r * KEYPAD_COLS)) & ROW_MASK;
+    }
+    do {
+        merged = false;
+        for (int r1 = 0; r1 < KEYPAD_ROWS; r1++) {
+            for (int r2 = 0; r2 < KEYPAD_ROWS; r2++) {
+                if ((cols[r1] & cols[r2]) && cols[r1] != (cols[r1] | cols[r2])) {
+                    cols[r1] |= cols[r2];
+                    merged = true;
+                }
+            }
+        }
+    } while (merged);
+    for (int r = 0; r < KEYPAD_ROWS; r++) {
+        raw |= cols[r] << (r * KEYPAD_COLS);
+    }
+    return raw;
+}
+
+static void emit(uint8_t key, bool pressed, void *arg)
+{
+    TEST_ASSERT(event_cnt < sizeof(events) / sizeof(events[0]));
+    events[event_cnt].key = key;
+    events[event_cnt].pressed = pressed;
+    events[event_cnt].at_ms = *(uint32_t *)arg;
+    event_cnt++;
+}
+
+static bool scan(keypad_matrix_t *matrix, uint32_t now_ms)
+{
+    return keypad_matrix_feed(matrix, sample(now_ms), emit, &now_ms);
+}
+
+/* Every rectangle whose four corners read closed */
+static void test_ghosts(void)
+{
+    for (uint32_t raw = 0; raw < 0x10000; raw++) {
+        uint16_t expect = 0;
+
+        for (int r = 0; r < KEYPAD_ROWS; r++) {
+            for (int c = 0; c < KEYPAD_COLS; c++) {
+                for (int r2 = 0; r2 < KEYPAD_ROWS; r2++) {
+                    for (int c2 = 0; c2 < KEYPAD_COLS; c2++) {
+                        uint16_t corners = 1U << KEY(r, c) | 1U << KEY(r, c2) |
+                                           1U << KEY(r2, c) | 1U << KEY(r2, c2);
+
+                        if (r2 != r && c2 != c && (raw & corners) == corners) {
+                            expect |= 1U << KEY(r, c);
+                        }
+                    }
+                }
+            }
+        }
+        TEST_ASSERT(keypad_matrix_ghosts(raw) == expect);
+    }
+}
+
+static void test_debounce(void)
+{
+    keypad_matrix_t matrix;
+    uint32_t now = 0;
+
+    memset(keys, 0, sizeof(keys));
+    event_cnt = 0;
+    keypad_matrix_init(&matrix);
+
+    /* A glitch shorter than the debounce is not a press */
+    press(KEY(1, 2), true, now, 0);
+    for (int i = 0; i < KEYPAD_DEBOUNCE_SAMPLES - 1; i++) {
+        TEST_ASSERT(scan(&matrix, now++));
+    }
+    press(KEY(1, 2), false, now, 0);
+    while (scan(&matrix, now)) {
+        now++;
+    }
+    TEST_ASSERT(event_cnt == 0 && matrix.state == 0);
+
+    /* One press and one release for a bouncing contact, each on the sample
+     * which completes the debounce.
+     */
+    for (int n = 0; n < 1000; n++) {
+        uint8_t key = host_rand(&seed) % KEYPAD_KEYS;
+        uint32_t bounce = host_rand(&seed) % 6, down_ms = now;
+
+        event_cnt = 0;
+        press(key, true, now, bounce);
+        /* The first samples may read open, the interrupt restarts the scan */
+        for (int i = 0; i < 30; i++) {
+            scan(&matrix, now++);
+        }
+        press(key, false, now, bounce);
+        while (scan(&matrix, now)) {
+            now++;
+        }
+        TEST_ASSERT(event_cnt == 2 && matrix.state == 0);
+        TEST_ASSERT(events[0].key == key && events[0].pressed);
+        TEST_ASSERT(events[1].key == key && !events[1].pressed);
+        TEST_ASSERT(events[0].at_ms - down_ms <= bounce + KEYPAD_DEBOUNCE_SAMPLES - 1);
+        TEST_ASSERT(events[0].at_ms - down_ms >= KEYPAD_DEBOUNCE_SAMPLES - 1);
+        now += 10;
+    }
+}
+
+static void test_rollover(void)
+{
+    keypad_matrix_t matrix;
+    uint32_t now = 0;
+
+    memset(keys, 0, sizeof(keys));
+    event_cnt = 0;
+    keypad_matrix_init(&matrix);
+
+    /* All four held on a diagonal */
+    for (int i = 0; i < 4; i++) {
+        press(KEY(i, i), true, now, 0);
+        now += 3;
+    }
+    for (int i = 0; i < 20; i++) {
+        scan(&matrix, now++);
+    }
+    TEST_ASSERT(event_cnt == 4);
+    TEST_ASSERT(matrix.state == (1U << KEY(0, 0) | 1U << KEY(1, 1) | 1U << KEY(2, 2) | 1U << KEY(3, 3)));
+    for (int i = 0; i < 4; i++) {
+        press(KEY(i, i), false, now, 0);
+    }
+    while (scan(&matrix, now)) {
+        now++;
+    }
+
+    /* Three corners close the fourth: the third key waits for the pattern to
+     * resolve and the phantom never shows up.
+     */
+    event_cnt = 0;
+    press(KEY(0, 0), true, now, 0);
+    press(KEY(0, 1), true, now, 0);
+    for (int i = 0; i < 10; i++) {
+        scan(&matrix, now++);
+    }
+    press(KEY(1, 0), true, now, 0);
+    for (int i = 0; i < 50; i++) {
+        scan(&matrix, now++);
+    }
+    TEST_ASSERT(event_cnt == 2 && matrix.state == (1U << KEY(0, 0) | 1U << KEY(0, 1)));
+    TEST_ASSERT(matrix.ghost == (1U << KEY(1, 0) | 1U << KEY(1, 1)));
+    press(KEY(0, 1), false, now, 0);
+    for (int i = 0; i < 20; i++) {
+        scan(&matrix, now++);
+    }
+    press(KEY(0, 0), false, now, 0);
+    press(KEY(1, 0), false, now, 0);
+    while (scan(&matrix, now)) {
+        now++;
+    }
+    for (uint32_t i = 0; i < event_cnt; i++) {
+        TEST_ASSERT(events[i].key != KEY(1, 1));
+    }
+    TEST_ASSERT(event_cnt == 6 && events[2].key == KEY(0, 1) && !events[2].pressed);
+    TEST_ASSERT(events[3].key == KEY(1, 0) && events[3].pressed);
+}
+
+/* A typist pressing a key every gap_min..gap_max ms and holding it for
+ * hold_min..hold_max ms, so consecutive keys overlap.
+ */
+typedef struct {
+    uint8_t key;
+    uint32_t down_ms, up_ms, bounce_ms;
+    bool credited;
+} stroke_t;
+
+#define STROKES 4000
+
+static stroke_t strokes[STROKES];
+
+static uint32_t script(uint32_t gap_min, uint32_t gap_max, uint32_t hold_min, uint32_t hold_max)
+{
+    uint32_t now = 10;
+
+    for (int i = 0; i < STROKES; i++) {
+        stroke_t *s = &strokes[i];
+        bool busy;
+
+        now += gap_min + host_rand(&seed) % (gap_max - gap_min + 1);
+        /* Not one of the keys still held */
+        do {
+            s->key = host_rand(&seed) % KEYPAD_KEYS;
+            busy = false;
+            for (int j = i - 1; j >= 0 && j >= i - 8; j--) {
+                busy |= strokes[j].key == s->key && strokes[j].up_ms + 10 > now;
+            }
+        } while (busy);
+        s->down_ms = now;
+        s->up_ms = now + hold_min + host_rand(&seed) % (hold_max - hold_min + 1);
+        s->bounce_ms = host_rand(&seed) % 6;
+    }
+    return strokes[STROKES - 1].up_ms + 100;
+}
+
+static void play(uint32_t now_ms, int *next_down)
+{
+    for (int i = *next_down; i < STROKES && strokes[i].down_ms <= now_ms; i++) {
+        if (strokes[i].down_ms == now_ms) {
+            press(strokes[i].key, true, now_ms, strokes[i].bounce_ms);
+        }
+        *next_down = i;
+    }
+    for (int i = *next_down; i >= 0 && i >= *next_down - 8; i--) {
+        if (strokes[i].up_ms == now_ms) {
+            press(strokes[i].key, false, now_ms, strokes[i].bounce_ms);
+        }
+    }
+}
+
+/* Credits a reported press to the stroke of the key held at now_ms */
+static bool credit(uint8_t key, uint32_t now_ms, uint32_t *latency)
+{
+    for (int i = 0; i < STROKES; i++) {
+        stroke_t *s = &strokes[i];
+
+        if (s->key == key && !s->credited && s->down_ms <= now_ms &&
+            now_ms <= s->up_ms + s->bounce_ms + KEYPAD_DEBOUNCE_SAMPLES) {
+            s->credited = true;
+            *latency = now_ms - s->down_ms;
+            return true;
+        }
+    }
+    return false;
+}
+
+typedef struct {
+    uint32_t lost, wrong;
+    uint32_t latency[STROKES];
+    uint32_t latency_cnt;
+} result_t;
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, result_t *res, uint32_t keys_per_s)
+{
+    uint32_t n = res->latency_cnt;
+
+    qsort(res->latency, n, sizeof(uint32_t), cmp_u32);
+    printf("%-7s %3u keys/s: %5.1f%% lost, %4u wrong, latency p50 %3u ms p99 %3u ms\n",
+           name, keys_per_s, 100.0 * res->lost / STROKES, res->wrong,
+           n ? res->latency[n / 2] : 0, n ? res->latency[(n - 1) * 99 / 100] : 0);
+}
+
+static void reset(result_t *res)
+{
+    memset(keys, 0, sizeof(keys));
+    memset(res, 0, sizeof(*res));
+    for (int i = 0; i < STROKES; i++) {
+        strokes[i].credited = false;
+    }
+}
+
+static void run_matrix(uint32_t end_ms, result_t *res)
+{
+    keypad_matrix_t matrix;
+    int next = 0;
+
+    reset(res);
+    keypad_matrix_init(&matrix);
+    for (uint32_t now = 0; now < end_ms; now += SCAN_MS) {
+        play(now, &next);
+        event_cnt = 0;
+        scan(&matrix, now);
+        for (uint32_t i = 0; i < event_cnt; i++) {
+            if (!events[i].pressed) {
+                continue;
+            }
+            if (credit(events[i].key, now, &res->latency[res->latency_cnt])) {
+                res->latency_cnt++;
+            } else {
+                res->wrong++;
+            }
+        }
+    }
+    for (int i = 0; i < STROKES; i++) {
+        res->lost += !strokes[i].credited;
+    }
+}
+
+/* The row interrupt reader: a falling edge on a row is taken if no edge of any
+ * row came within the debounce, and the first closed column of that row is
+ * the key. Releases are not reported.
+ */
+static void run_isr(uint32_t end_ms, result_t *res)
+{
+    uint16_t rows_before = 0;
+    int64_t time_old_isr = 0;
+    int next = 0;
+
+    reset(res);
+    for (uint32_t now = 0; now < end_ms; now++) {
+        uint16_t raw, rows = 0;
+
+        play(now, &next);
+        raw = sample(now);
+        for (int r = 0; r < KEYPAD_ROWS; r++) {
+            if ((raw >> (r * KEYPAD_COLS)) & ROW_MASK) {
+                rows |= 1U << r;
+            }
+        }
+        for (int r = 0; r < KEYPAD_ROWS; r++) {
+            uint16_t cols;
+
+            if (!(rows & ~rows_before & (1U << r))) {
+                continue;
+            }
+            if ((int64_t)now - time_old_isr >= OLD_DEBOUNCE_MS) {
+                /* keypad_execute reads the columns once the task runs */
+                cols = (sample(now) >> (r * KEYPAD_COLS)) & ROW_MASK;
+                if (cols) {
+                    uint8_t key = KEY(r, __builtin_ctz(cols));
+
+                    if (credit(key, now, &res->latency[res->latency_cnt])) {
+                        res->latency_cnt++;
+                    } else {
+                        res->wrong++;
+                    }
+                }
+            }
+            time_old_isr = now;
+        }
+        rows_before = rows;
+    }
+    for (int i = 0; i < STROKES; i++) {
+        res->lost += !strokes[i].credited;
+    }
+}
+
+static void bench(uint32_t gap_min, uint32_t gap_max, uint32_t hold_min, uint32_t hold_max)
+{
+    static result_t res;
+    uint32_t end_ms, keys_per_s;
+    uint64_t begin, elapsed;
+
+    end_ms = script(gap_min, gap_max, hold_min, hold_max);
+    keys_per_s = 2000 / (gap_min + gap_max);
+
+    run_isr(end_ms, &res);
+    report("row isr", &res, keys_per_s);
+
+    begin = host_time_ns();
+    run_matrix(end_ms, &res);
+    elapsed = host_time_ns() - begin;
+    report("matrix", &res, keys_per_s);
+    printf("        %.0f ns per simulated scan\n", (double)elapsed / end_ms);
+
+    /* With rollover of two keys nothing is lost, the only keys held back are
+     * the third key of a rectangle.
+     */
+    TEST_ASSERT(res.wrong == 0);
+    if (hold_max <= gap_min * 2) {
+        TEST_ASSERT(res.lost == 0);
+    }
+    for (uint32_t i = 0; i < res.latency_cnt; i++) {
+        TEST_ASSERT(res.latency[i] >= KEYPAD_DEBOUNCE_SAMPLES - 1);
+    }
+}
+
+int main(void)
+{
+    test_ghosts();
+    test_debounce();
+    test_rollover();
+
+    /* 8, 13 and 20 keys/s, holding up to two keys, then three */
+    bench(100, 150, 40, 120);
+    bench(50, 100, 40, 100);
+    bench(30, 70, 40, 60);
+    bench(30, 70, 60, 150);
+    return 0;
+}
@@ -0,0 +1,190 @@
+/* test_led_dispatch.c - Element to LED dispatch against the per-message lookup it
+ * replaced, and messages/s of both for a few element counts.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "esp_ble_mesh_local_data_operation_api.h"
+#include "led_dispatch.h"
+
+#define PRIMARY     0x0100
+#define MSGS        2000000
+
+static esp_ble_mesh_model_t models[LED_DISPATCH_ELEMS];
+static esp_ble_mesh_model_t *onoff[LED_DISPATCH_ELEMS];
+static struct led_dispatch table;
+static uint32_t seed = 21;
+static uint32_t subscribed_calls;
+
+uint16_t *esp_ble_mesh_is_model_subscribed_to_group(esp_ble_mesh_model_t *model, uint16_t group_addr)
+{
+    subscribed_calls++;
+    for (uint32_t i = 0; i < ARRAY_SIZE(model->groups); i++) {
+        if (model->groups[i] == group_addr) {
+            return &model->groups[i];
+        }
+    }
+    return NULL;
+}
+
+static uint8_t stack_elem_count;
+
+__attribute__((noinline)) uint16_t esp_ble_mesh_get_primary_element_address(void)
+{
+    return PRIMARY;
+}
+
+__attribute__((noinline)) static uint8_t esp_ble_mesh_get_element_count(void)
+{
+    return stack_elem_count;
+}
+
+/* example_change_led_state() before the table: the primary address and the
+ * element count asked from the stack, unicast compared with every element.
+ */
+static int lookup_before(esp_ble_mesh_model_t *model, uint16_t elem_addr, uint16_t dst)
+{
+    uint16_t primary_addr = esp_ble_mesh_get_primary_element_address();
+    uint8_t elem_count = esp_ble_mesh_get_element_count();
+    int led = -1;
+
+    if (ESP_BLE_MESH_ADDR_IS_UNICAST(dst)) {
+        for (uint8_t i = 0; i < elem_count; i++) {
+            if (dst == primary_addr + i) {
+                led = i;
+            }
+        }
+        /* Only the element of the model handles it */
+        return led == elem_addr - primary_addr ? led : -1;
+    } else if (ESP_BLE_MESH_ADDR_IS_GROUP(dst)) {
+        if (esp_ble_mesh_is_model_subscribed_to_group(model, dst)) {
+            led = elem_addr - primary_addr;
+        }
+    } else if (dst == 0xFFFF) {
+        led = elem_addr - primary_addr;
+    }
+    return led;
+}
+
+/* Each element subscribes to groups out of a pool of group_cnt */
+static void setup(uint8_t elems, uint16_t group_cnt)
+{
+    memset(models, 0, sizeof(models));
+    for (uint8_t i = 0; i < LED_DISPATCH_ELEMS; i++) {
+        onoff[i] = i < elems && i % 7 != 6 ? &models[i] : NULL;
+        for (uint32_t j = 0; j < ARRAY_SIZE(models[i].groups); j++) {
+            if (host_rand(&seed) % 4) {
+                models[i].groups[j] = 0xC000 + host_rand(&seed) % group_cnt;
+            }
+        }
+    }
+    stack_elem_count = elems;
+    led_dispatch_build(&table, PRIMARY, onoff, elems);
+}
+
+static uint16_t random_dst(uint8_t elems, uint16_t group_cnt)
+{
+    switch (host_rand(&seed) % 4) {
+    case 0:
+        return PRIMARY - 2 + host_rand(&seed) % (elems + 4);
+    case 1:
+        return 0xFFFF;
+    default:
+        /* Some groups nobody subscribes to */
+        return 0xC000 + host_rand(&seed) % (group_cnt + 8);
+    }
+}
+
+static void test_match(uint8_t elems, uint16_t group_cnt)
+{
+    setup(elems, group_cnt);
+
+    for (int n = 0; n < 100000; n++) {
+        uint8_t i = host_rand(&seed) % elems;
+        uint16_t dst = random_dst(elems, group_cnt);
+
+        if (!onoff[i]) {
+            continue;
+        }
+        TEST_ASSERT(led_dispatch_find(&table, onoff[i], PRIMARY + i, dst) ==
+                    lookup_before(onoff[i], PRIMARY + i, dst));
+    }
+
+    /* Outside of the elements of the node, and before provisioning */
+    TEST_ASSERT(led_dispatch_find(&table, &models[0], PRIMARY + elems, 0xFFFF) == -1);
+    led_dispatch_build(&table, ESP_BLE_MESH_ADDR_UNASSIGNED, onoff, elems);
+    TEST_ASSERT(led_dispatch_find(&table, &models[0], PRIMARY, 0xFFFF) == -1);
+}
+
+/* A subscription the table was not rebuilt for is still found */
+static void test_stale(void)
+{
+    setup(3, 4);
+    models[1].groups[0] = 0xD000;
+    TEST_ASSERT(led_dispatch_find(&table, &models[1], PRIMARY + 1, 0xD000) == 1);
+}
+
+static void bench(uint8_t elems, uint16_t group_cnt)
+{
+    static uint16_t dst[4096];
+    static uint8_t elem[4096];
+    uint64_t begin, before_ns, after_ns;
+    uint32_t hits = 0, calls_before, calls_after;
+
+    setup(elems, group_cnt);
+    /* What the stack hands to a model: its own unicast address, one of its
+     * groups or all nodes.
+     */
+    for (uint32_t n = 0; n < ARRAY_SIZE(dst); n++) {
+        esp_ble_mesh_model_t *model;
+
+        do {
+            elem[n] = host_rand(&seed) % elems;
+            model = onoff[elem[n]];
+            dst[n] = random_dst(elems, group_cnt);
+        } while (!model || (ESP_BLE_MESH_ADDR_IS_UNICAST(dst[n]) && dst[n] != PRIMARY + elem[n]) ||
+                 (ESP_BLE_MESH_ADDR_IS_GROUP(dst[n]) && !esp_ble_mesh_is_model_subscribed_to_group(model, dst[n])));
+    }
+
+    subscribed_calls = 0;
+    begin = host_time_ns();
+    for (int n = 0; n < MSGS; n++) {
+        uint32_t k = n & (ARRAY_SIZE(dst) - 1);
+        hits += lookup_before(onoff[elem[k]], PRIMARY + elem[k], dst[k]) >= 0;
+    }
+    before_ns = host_time_ns() - begin;
+    calls_before = subscribed_calls;
+
+    subscribed_calls = 0;
+    begin = host_time_ns();
+    for (int n = 0; n < MSGS; n++) {
+        uint32_t k = n & (ARRAY_SIZE(dst) - 1);
+        hits -= led_dispatch_find(&table, onoff[elem[k]], PRIMARY + elem[k], dst[k]) >= 0;
+    }
+    after_ns = host_time_ns() - begin;
+    calls_after = subscribed_calls;
+
+    TEST_ASSERT(hits == 0 && calls_after == 0);
+    printf("%2u elements, %3u groups: before %6.1f M msgs/s (%u subscription checks), "
+           "after %6.1f M msgs/s\n", elems, group_cnt, MSGS * 1000.0 / before_ns, calls_before,
+           MSGS * 1000.0 / after_ns);
+}
+
+int main(void)
+{
+    test_match(3, 4);
+    test_match(LED_DISPATCH_ELEMS, 16);
+    /* More groups than slots */
+    test_match(LED_DISPATCH_ELEMS, 200);
+    test_stale();
+
+    bench(3, 4);
+    bench(LED_DISPATCH_ELEMS, 16);
+    bench(LED_DISPATCH_ELEMS, 48);
+    return 0;
+}
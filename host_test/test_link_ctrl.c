@@ -0,0 +1,203 @@
+/* test_link_ctrl.c - Link window controller, and replay of a provisioning trace
+ * comparing the time to provision every device with fixed link caps.
+ *
+ * A trace has one line per device: "<first beacon ms> <link duration ms>". It is
+ * read from the file given as argument, otherwise a synthetic one is used. The
+ * radio is modelled as getting slower and lossier with every concurrent link.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "ble_mesh_fast_prov_common.h"
+#include "ble_mesh_fast_prov_link_ctrl.h"
+
+#define DEVICES_MAX     1024
+#define TICK_MS         50      /* Beacon interval of the devices */
+#define WINDOW_MAX      6       /* max_node_num of the former fixed cap */
+
+typedef struct {
+    uint32_t beacon_ms;
+    uint32_t link_ms;
+} trace_dev_t;
+
+static trace_dev_t trace[DEVICES_MAX];
+static uint32_t trace_len;
+
+static struct {
+    uint32_t end_ms;
+    bool in_link;
+    bool ok;
+    bool done;
+} dev[DEVICES_MAX];
+
+static void config_init(uint8_t min, uint8_t max, uint8_t init)
+{
+    example_link_ctrl_config_t config = EXAMPLE_LINK_CTRL_DEFAULT_CONFIG(max);
+
+    config.window_min  = min;
+    config.window_init = init;
+    TEST_ASSERT(example_link_ctrl_init(&config) == ESP_OK);
+}
+
+static void test_window(void)
+{
+    example_link_ctrl_stats_t stats;
+    example_link_ctrl_sample_t hist[CONFIG_FAST_PROV_LINK_HISTORY];
+
+    host_kernel_advance(1000);
+    config_init(1, 6, 2);
+
+    /* Two rounds of clean links: 2 -> 3 -> 4 */
+    for (int i = 0; i < 5; i++) {
+        TEST_ASSERT(example_link_ctrl_can_start());
+        example_link_ctrl_start();
+        example_link_ctrl_close(FAST_PROV_LINK_CLOSE_SUCCESS);
+    }
+    example_link_ctrl_get_stats(&stats);
+    TEST_ASSERT(stats.window == 4 && stats.succeeded == 5);
+
+    /* The failures of one round halve the window once */
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT(example_link_ctrl_can_start());
+        example_link_ctrl_start();
+    }
+    TEST_ASSERT(!example_link_ctrl_can_start());
+    for (int i = 0; i < 4; i++) {
+        example_link_ctrl_close(FAST_PROV_LINK_CLOSE_FAIL);
+    }
+    example_link_ctrl_get_stats(&stats);
+    TEST_ASSERT(stats.window == 2 && stats.failed == 4 && stats.deferred == 1 && stats.in_flight == 0);
+
+    /* Link Close of a link which was not counted */
+    example_link_ctrl_close(FAST_PROV_LINK_CLOSE_FAIL);
+    example_link_ctrl_get_stats(&stats);
+    TEST_ASSERT(stats.failed == 4);
+
+    TEST_ASSERT(example_link_ctrl_get_history(hist, CONFIG_FAST_PROV_LINK_HISTORY) == 4);
+    TEST_ASSERT(hist[0].window == 2 && hist[2].window == 4 && hist[3].window == 2);
+}
+
+static void test_expire(void)
+{
+    example_link_ctrl_stats_t stats;
+    uint32_t now = k_uptime_get_32();
+
+    config_init(1, 6, 4);
+
+    /* Devices which never get a Link Close release their slots */
+    example_link_ctrl_start();
+    host_kernel_advance(now + 1000);
+    example_link_ctrl_start();
+    example_link_ctrl_start();
+    host_kernel_advance(now + CONFIG_FAST_PROV_LINK_TIMEOUT_MS);
+    example_link_ctrl_get_stats(&stats);
+    TEST_ASSERT(stats.in_flight == 2 && stats.expired == 1 && stats.window == 2);
+
+    host_kernel_advance(now + 1000 + CONFIG_FAST_PROV_LINK_TIMEOUT_MS);
+    example_link_ctrl_get_stats(&stats);
+    TEST_ASSERT(stats.in_flight == 0 && stats.expired == 3 && stats.timeouts == 3);
+    /* Still the same round */
+    TEST_ASSERT(stats.window == 2);
+
+    /* A late Link Close is ignored */
+    example_link_ctrl_close(FAST_PROV_LINK_CLOSE_TIMEOUT);
+    example_link_ctrl_get_stats(&stats);
+    TEST_ASSERT(stats.failed == 3);
+}
+
+static void trace_load(const char *path)
+{
+    uint32_t seed = 11;
+
+    if (path) {
+        FILE *f = fopen(path, "r");
+        TEST_ASSERT(f);
+        while (trace_len < DEVICES_MAX &&
+                fscanf(f, "%u %u", &trace[trace_len].beacon_ms, &trace[trace_len].link_ms) == 2) {
+            trace_len++;
+        }
+        fclose(f);
+        return;
+    }
+
+    /* 100 devices switched on over 10 s, links of 4 to 8 s on a quiet channel */
+    for (trace_len = 0; trace_len < 100; trace_len++) {
+        trace[trace_len].beacon_ms = host_rand(&seed) % 10000;
+        trace[trace_len].link_ms = 4000 + host_rand(&seed) % 4000;
+    }
+}
+
+/* Replays the trace with the window between min and max, returns the time
+ * until every device is provisioned.
+ */
+static uint32_t replay(uint8_t min, uint8_t max, uint8_t init, example_link_ctrl_stats_t *stats)
+{
+    uint32_t start = (k_uptime_get_32() / TICK_MS + 1) * TICK_MS, now = start;
+    uint32_t seed = 5, done = 0, in_flight = 0;
+
+    config_init(min, max, init);
+    memset(dev, 0, sizeof(dev));
+
+    while (done < trace_len) {
+        now += TICK_MS;
+        host_kernel_advance(now);
+
+        for (uint32_t i = 0; i < trace_len; i++) {
+            if (dev[i].in_link && (int32_t)(now - dev[i].end_ms) >= 0) {
+                dev[i].in_link = false;
+                in_flight--;
+                dev[i].done = dev[i].ok;
+                done += dev[i].ok;
+                example_link_ctrl_close(dev[i].ok ? FAST_PROV_LINK_CLOSE_SUCCESS : FAST_PROV_LINK_CLOSE_FAIL);
+            }
+        }
+
+        for (uint32_t i = 0; i < trace_len; i++) {
+            if (dev[i].done || dev[i].in_link || now - start < trace[i].beacon_ms) {
+                continue;
+            }
+            if (!example_link_ctrl_can_start()) {
+                break;
+            }
+            example_link_ctrl_start();
+            /* Every other link slows this one down by 40% and adds 12% of loss */
+            dev[i].in_link = true;
+            dev[i].ok = host_rand(&seed) % 100 >= 3 + 12 * in_flight;
+            dev[i].end_ms = now + trace[i].link_ms * (10 + 4 * in_flight) / 10;
+            in_flight++;
+        }
+        TEST_ASSERT(now - start < 3600 * 1000);
+    }
+
+    example_link_ctrl_get_stats(stats);
+    TEST_ASSERT(stats->succeeded == trace_len && stats->in_flight == 0);
+    return now - start;
+}
+
+int main(int argc, char **argv)
+{
+    example_link_ctrl_stats_t stats;
+    uint32_t fixed_ms, aimd_ms;
+
+    test_window();
+    test_expire();
+
+    trace_load(argc > 1 ? argv[1] : NULL);
+    printf("%u devices\n", trace_len);
+    for (uint8_t cap = 1; cap <= WINDOW_MAX; cap++) {
+        fixed_ms = replay(cap, cap, cap, &stats);
+        printf("fixed %u links: %6.1f s, failed %3u\n", cap, fixed_ms / 1000.0, stats.failed);
+    }
+    aimd_ms = replay(1, WINDOW_MAX, CONFIG_FAST_PROV_LINK_WINDOW_INIT, &stats);
+    printf("window 1..%u:   %6.1f s, failed %3u, deferred %u\n", WINDOW_MAX, aimd_ms / 1000.0,
+           stats.failed, stats.deferred);
+
+    /* Better than the former cap of max_node_num links */
+    TEST_ASSERT(argc > 1 || aimd_ms < fixed_ms);
+    return 0;
+}
@@ -0,0 +1,226 @@
+/* test_mouse_input.c - Mouse button ring and last report: debounce, a full
+ * ring, the isr and the task on two threads, and GET_REPORT reading the last
+ * report while the report timer writes it.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+#include "host_test.h"
+#include "mouse_input.h"
+
+#define PINS            5
+#define PRESS_US        (BUTTON_DEBOUNCE_US + 1000)
+
+static void test_debounce(void)
+{
+    button_ring_t ring = {0};
+    button_event_t ev;
+    int64_t t = 1000000;
+
+    /* A press bouncing for 5 ms counts once, so does the release */
+    TEST_ASSERT(button_ring_edge(&ring, 0, true, t));
+    TEST_ASSERT(!button_ring_edge(&ring, 0, false, t + 1000));
+    TEST_ASSERT(!button_ring_edge(&ring, 0, true, t + 2000));
+    TEST_ASSERT(!button_ring_edge(&ring, 0, false, t + 5000));
+    TEST_ASSERT(!button_ring_edge(&ring, 0, true, t + 5000 + BUTTON_DEBOUNCE_US - 1));
+    /* Released after being held */
+    TEST_ASSERT(!button_ring_edge(&ring, 0, false, t + 200000));
+    /* Another pin bounces on its own */
+    TEST_ASSERT(button_ring_edge(&ring, 1, true, t + 200500));
+    /* Pressed again once quiet */
+    TEST_ASSERT(button_ring_edge(&ring, 0, true, t + 200000 + BUTTON_DEBOUNCE_US));
+
+    TEST_ASSERT(button_ring_pop(&ring, &ev) && ev.btn == 0 && ev.time_us == t);
+    TEST_ASSERT(button_ring_pop(&ring, &ev) && ev.btn == 1 && ev.time_us == t + 200500);
+    TEST_ASSERT(button_ring_pop(&ring, &ev) && ev.btn == 0 && ev.time_us == t + 200000 + BUTTON_DEBOUNCE_US);
+    TEST_ASSERT(!button_ring_pop(&ring, &ev) && ring.dropped == 0);
+}
+
+static void test_full(void)
+{
+    button_ring_t ring = {0};
+    button_event_t ev;
+    int64_t t = 0;
+
+    /* Twice around the ring, the isr drops presses the task has no room for */
+    for (uint32_t round = 0; round < 2; round++) {
+        for (int i = 0; i < BUTTON_RING_SIZE + 3; i++) {
+            t += PRESS_US;
+            TEST_ASSERT(button_ring_edge(&ring, i % PINS, true, t) == (i < BUTTON_RING_SIZE));
+            button_ring_edge(&ring, i % PINS, false, t + 1);
+        }
+        TEST_ASSERT(ring.dropped == 3 * (round + 1));
+        for (int i = 0; i < BUTTON_RING_SIZE; i++) {
+            TEST_ASSERT(button_ring_pop(&ring, &ev) && ev.btn == i % PINS);
+        }
+        TEST_ASSERT(!button_ring_pop(&ring, &ev));
+    }
+}
+
+#define STRESS_PRESSES  500000
+
+static button_ring_t s_ring;
+static uint32_t s_pushed;
+static volatile int s_isr_done;
+
+/* The isr, which never waits: a press and release on the next pin, at
+ * random short intervals so the ring is sometimes empty and sometimes full.
+ * It lets the task run now and then, on a single core too.
+ */
+static void *isr_thread(void *arg)
+{
+    int64_t t = 0;
+    uint32_t seed = 1;
+
+    (void)arg;
+    for (uint32_t i = 0; i < STRESS_PRESSES; i++) {
+        for (volatile uint32_t spin = host_rand(&seed) % 256; spin; spin--) {
+        }
+        t += PRESS_US;
+        s_pushed += button_ring_edge(&s_ring, i % PINS, true, t);
+        button_ring_edge(&s_ring, i % PINS, false, t + 1);
+        if (host_rand(&seed) % 16 == 0) {
+            sched_yield();
+        }
+    }
+    __atomic_store_n(&s_isr_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    pthread_t isr;
+    button_event_t ev;
+    uint32_t popped = 0;
+    int64_t last = 0;
+
+    TEST_ASSERT(pthread_create(&isr, NULL, isr_thread, NULL) == 0);
+    for (;;) {
+        bool done = __atomic_load_n(&s_isr_done, __ATOMIC_ACQUIRE);
+
+        while (button_ring_pop(&s_ring, &ev)) {
+            /* In order, nothing torn: the pin follows from the press time */
+            TEST_ASSERT(ev.time_us > last && ev.time_us % PRESS_US == 0);
+            TEST_ASSERT(ev.btn == (ev.time_us / PRESS_US - 1) % PINS);
+            last = ev.time_us;
+            popped++;
+        }
+        if (done) {
+            break;
+        }
+        /* Waits for the next notification */
+        sched_yield();
+    }
+    pthread_join(isr, NULL);
+
+    TEST_ASSERT(popped == s_pushed && popped + s_ring.dropped == STRESS_PRESSES);
+    printf("ring: %u presses, %u popped, %u dropped by the isr\n", STRESS_PRESSES, popped, s_ring.dropped);
+}
+
+#define STORES          500000
+
+static mouse_report_buf_t s_last;
+static volatile int s_timer_done;
+
+/* The report timer, each report counting up across its bytes */
+static void *timer_thread(void *arg)
+{
+    uint8_t report[MOUSE_REPORT_MAX_SIZE];
+
+    (void)arg;
+    for (uint32_t k = 1; k <= STORES; k++) {
+        for (int i = 0; i < MOUSE_REPORT_MAX_SIZE; i++) {
+            report[i] = (uint8_t)(k + i);
+        }
+        mouse_report_store(&s_last, report);
+        if (k % 64 == 0) {
+            sched_yield();
+        }
+    }
+    __atomic_store_n(&s_timer_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void test_seqlock(void)
+{
+    pthread_t timer;
+    uint8_t report[MOUSE_REPORT_MAX_SIZE] = { 0, 1, 2, 3 };
+    uint32_t loads = 0, changed = 0;
+    uint8_t prev = 0;
+
+    mouse_report_store(&s_last, report);
+    TEST_ASSERT(pthread_create(&timer, NULL, timer_thread, NULL) == 0);
+    while (!__atomic_load_n(&s_timer_done, __ATOMIC_ACQUIRE)) {
+        mouse_report_load(&s_last, report);
+        /* Never half of one report and half of the next */
+        for (int i = 1; i < MOUSE_REPORT_MAX_SIZE; i++) {
+            TEST_ASSERT(report[i] == (uint8_t)(report[0] + i));
+        }
+        changed += report[0] != prev;
+        prev = report[0];
+        if (++loads % 64 == 0) {
+            sched_yield();
+        }
+    }
+    pthread_join(timer, NULL);
+
+    mouse_report_load(&s_last, report);
+    TEST_ASSERT(report[0] == (uint8_t)STORES && s_last.seq == 2 * (STORES + 1));
+    printf("last report: %u loads during %u stores, %u saw a new report\n", loads, STORES, changed);
+}
+
+#define BENCH_ROUNDS    10000000
+
+/* Cost of a press through the ring and of a GET_REPORT copy, uncontended */
+static void bench(void)
+{
+    button_ring_t ring = {0};
+    mouse_report_buf_t last = {0};
+    button_event_t ev;
+    uint8_t report[MOUSE_REPORT_MAX_SIZE] = {0};
+    uint32_t sum = 0;
+    uint64_t start, ring_ns, store_ns, load_ns;
+
+    start = host_time_ns();
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+        button_ring_edge(&ring, i % PINS, true, (int64_t)(i + 1) * PRESS_US);
+        button_ring_edge(&ring, i % PINS, false, (int64_t)(i + 1) * PRESS_US + 1);
+        sum += button_ring_pop(&ring, &ev);
+    }
+    ring_ns = host_time_ns() - start;
+    TEST_ASSERT(sum == BENCH_ROUNDS && ring.dropped == 0);
+
+    start = host_time_ns();
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+        report[1] = (uint8_t)i;
+        mouse_report_store(&last, report);
+    }
+    store_ns = host_time_ns() - start;
+
+    start = host_time_ns();
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+        mouse_report_load(&last, report);
+    }
+    load_ns = host_time_ns() - start;
+
+    TEST_ASSERT(report[1] == (uint8_t)(BENCH_ROUNDS - 1));
+
+    printf("press, release and pop %.1f ns, report store %.1f ns, load %.1f ns\n",
+           (double)ring_ns / BENCH_ROUNDS, (double)store_ns / BENCH_ROUNDS, (double)load_ns / BENCH_ROUNDS);
+}
+
+int main(void)
+{
+    test_debounce();
+    test_full();
+    test_threads();
+    test_seqlock();
+    bench();
+    return 0;
+}
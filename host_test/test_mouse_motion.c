@@ -0,0 +1,222 @@
+/* test_mouse_motion.c - Mouse motion accumulator and report timer: carry of
+ * large deltas, short clicks, no reports while still, and report rate and
+ * motion to report latency at 125, 250 and 500 Hz against the 200 ms + 200 ms
+ * task it replaced.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "host_kernel.h"
+#include "freertos/FreeRTOS.h"
+#include "mouse_motion.h"
+
+#define OLD_EVENT_MS    400     /* Press report, 200 ms, release report, 200 ms */
+
+typedef struct {
+    uint32_t at_ms;
+    mouse_motion_report_t rpt;
+} sent_t;
+
+static sent_t sent[200000];
+static uint32_t sent_cnt;
+
+static void send(const mouse_motion_report_t *report)
+{
+    TEST_ASSERT(host_locks_held == 0 && sent_cnt < sizeof(sent) / sizeof(sent[0]));
+    sent[sent_cnt].at_ms = k_uptime_get_32();
+    sent[sent_cnt].rpt = *report;
+    sent_cnt++;
+}
+
+/* Runs the report timer until the mouse is still */
+static void settle(void)
+{
+    uint32_t due;
+
+    while (host_kernel_next(&due)) {
+        host_kernel_advance(due);
+    }
+}
+
+static void test_carry(void)
+{
+    mouse_motion_t m;
+    mouse_motion_report_t r;
+    int32_t dx = 0, dy = 0, wheel = 0;
+    int n = 0;
+
+    mouse_motion_init(&m);
+    TEST_ASSERT(!mouse_motion_pending(&m) && !mouse_motion_take(&m, &r));
+
+    mouse_motion_move(&m, 300, -1000, 5);
+    mouse_motion_move(&m, 20, 0, -5);
+    while (mouse_motion_take(&m, &r)) {
+        TEST_ASSERT(r.dx >= -127 && r.dy >= -127 && r.wheel >= -127 && r.buttons == 0);
+        dx += r.dx;
+        dy += r.dy;
+        wheel += r.wheel;
+        n++;
+    }
+    /* Nothing truncated, the largest delta takes ceil(1000 / 127) reports */
+    TEST_ASSERT(dx == 320 && dy == -1000 && wheel == 0 && n == 8);
+
+    /* Motion back and forth within one report cancels out */
+    mouse_motion_move(&m, 10, 0, 0);
+    mouse_motion_move(&m, -10, 0, 0);
+    TEST_ASSERT(!mouse_motion_pending(&m));
+}
+
+static void test_buttons(void)
+{
+    mouse_motion_t m;
+    mouse_motion_report_t r;
+
+    mouse_motion_init(&m);
+
+    /* A click within one report period is reported down, then up */
+    mouse_motion_set_buttons(&m, 1);
+    mouse_motion_set_buttons(&m, 0);
+    TEST_ASSERT(mouse_motion_take(&m, &r) && r.buttons == 1);
+    TEST_ASSERT(mouse_motion_take(&m, &r) && r.buttons == 0);
+    TEST_ASSERT(!mouse_motion_take(&m, &r));
+
+    /* A button held is reported once, with the motion */
+    mouse_motion_set_buttons(&m, 2);
+    mouse_motion_move(&m, 1, 2, 0);
+    TEST_ASSERT(mouse_motion_take(&m, &r) && r.buttons == 2 && r.dx == 1 && r.dy == 2);
+    mouse_motion_move(&m, 1, 0, 0);
+    TEST_ASSERT(mouse_motion_take(&m, &r) && r.buttons == 2 && r.dx == 1);
+    TEST_ASSERT(!mouse_motion_take(&m, &r));
+    mouse_motion_set_buttons(&m, 0);
+    TEST_ASSERT(mouse_motion_take(&m, &r) && r.buttons == 0);
+    TEST_ASSERT(!mouse_motion_take(&m, &r));
+}
+
+/* The timer runs only while there is something to report */
+static void test_sched(uint32_t hz)
+{
+    uint32_t period_ms = 1000 / hz, start = k_uptime_get_32() + 1000, first = sent_cnt, due;
+
+    TEST_ASSERT(mouse_motion_sched_init(1000000 / hz, send) == ESP_OK);
+    TEST_ASSERT(mouse_motion_sched_init(1000000 / hz, send) == ESP_ERR_INVALID_STATE);
+    host_kernel_advance(start);
+    TEST_ASSERT(!host_kernel_next(&due));
+
+    mouse_move(500, 0, 0);
+    mouse_buttons(1);
+    mouse_buttons(0);
+    settle();
+    TEST_ASSERT(sent_cnt == first + 4);
+    for (uint32_t i = 0; i < 4; i++) {
+        TEST_ASSERT(sent[first + i].at_ms == start + (i + 1) * period_ms);
+    }
+    TEST_ASSERT(sent[first].rpt.buttons == 1 && sent[first + 1].rpt.buttons == 0);
+    TEST_ASSERT(sent[first].rpt.dx + sent[first + 1].rpt.dx + sent[first + 2].rpt.dx + sent[first + 3].rpt.dx == 500);
+    /* One more tick found nothing and stopped the timer */
+    TEST_ASSERT(k_uptime_get_32() == start + 5 * period_ms && !host_kernel_next(&due));
+
+    /* Motion during a tick waits for the next one only */
+    mouse_move(1, 0, 0);
+    host_kernel_advance(k_uptime_get_32() + period_ms - 1);
+    mouse_move(1, 0, 0);
+    host_kernel_advance(k_uptime_get_32() + 1);
+    TEST_ASSERT(sent_cnt == first + 5 && sent[first + 4].rpt.dx == 2);
+    settle();
+    TEST_ASSERT(sent_cnt == first + 5);
+
+    mouse_motion_sched_deinit();
+    mouse_move(1, 0, 0);
+    TEST_ASSERT(!host_kernel_next(&due));
+}
+
+typedef struct {
+    uint32_t *ms;
+    uint32_t cnt;
+} samples_t;
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(samples_t *s, uint32_t pct)
+{
+    qsort(s->ms, s->cnt, sizeof(uint32_t), cmp_u32);
+    return s->ms[(s->cnt - 1) * pct / 100];
+}
+
+/* A sensor reporting every ms for 10 s, with pauses, at each report rate */
+static void bench(uint32_t hz)
+{
+    static uint32_t event_ms[20000], latency[20000];
+    samples_t lat = { latency, 0 };
+    uint32_t seed = hz, start = k_uptime_get_32() + 1000, events = 0, first = sent_cnt, r;
+    int64_t moved = 0, reported = 0;
+    uint32_t busy_ms = 0;
+
+    TEST_ASSERT(mouse_motion_sched_init(1000000 / hz, send) == ESP_OK);
+    for (uint32_t t = 0; t < 10000; t++) {
+        int32_t dx;
+
+        /* Moving 600 ms out of every second */
+        if (t % 1000 >= 600) {
+            continue;
+        }
+        busy_ms++;
+        dx = (int32_t)(host_rand(&seed) % 61) - 20;
+        if (!dx) {
+            continue;
+        }
+        host_kernel_advance(start + t);
+        mouse_move(dx, 0, 0);
+        moved += dx;
+        event_ms[events++] = start + t;
+    }
+    settle();
+    mouse_motion_sched_deinit();
+
+    /* Every motion event goes out with the first report after it, a tick due
+     * in the same ms ran before the event
+     */
+    r = first;
+    for (uint32_t i = 0; i < events; i++) {
+        while (r < sent_cnt && sent[r].at_ms <= event_ms[i]) {
+            r++;
+        }
+        TEST_ASSERT(r < sent_cnt);
+        lat.ms[lat.cnt++] = sent[r].at_ms - event_ms[i];
+    }
+    for (r = first; r < sent_cnt; r++) {
+        reported += sent[r].rpt.dx;
+        TEST_ASSERT(r == first || sent[r].at_ms - sent[r - 1].at_ms >= 1000 / hz);
+    }
+    TEST_ASSERT(reported == moved);
+
+    /* The old task took OLD_EVENT_MS per event, one after the other */
+    printf("%u Hz: %u events, %.1f reports/s while moving, latency p50 %u ms p99 %u ms max %u ms; "
+           "old task %.1f events/s, %u s to catch up\n", hz, events,
+           (sent_cnt - first) * 1000.0 / busy_ms, percentile(&lat, 50), percentile(&lat, 99),
+           percentile(&lat, 100), 1000.0 / OLD_EVENT_MS, events * OLD_EVENT_MS / 1000);
+    /* Up to a period after the tick before the event, which can fall in the
+     * same ms; later only for motion carried over or cancelled out
+     */
+    TEST_ASSERT(percentile(&lat, 99) <= 1000 / hz + 1);
+}
+
+int main(void)
+{
+    test_carry();
+    test_buttons();
+    test_sched(125);
+    test_sched(500);
+    bench(125);
+    bench(250);
+    bench(500);
+    return 0;
+}
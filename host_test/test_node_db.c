@@ -0,0 +1,553 @@
+/* test_node_db.c - Fast Prov node database on a file-backed partition with
+ * NOR flash semantics: restore after a restart, compaction of superseded
+ * records with the erase left to the node db task, nodes which outgrow the
+ * partition, power cut at random points of a rollout, and boot restore time
+ * against a read call per node.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <setjmp.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "host_test.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ble_mesh_fast_prov_node_index.h"
+#include "ble_mesh_fast_prov_node_db.h"
+
+#define NODES           CONFIG_BLE_MESH_MAX_PROV_NODES
+#define SECTOR          4096
+#define HALF            (PARTITION_SIZE / 2)
+#define DEAD            CONFIG_FAST_PROV_NODE_DB_COMPACT_DEAD
+
+static struct {
+    TaskFunction_t fn;
+    uint32_t notified;
+    bool running;
+    jmp_buf wait;
+} task;
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    static int handle_;
+
+    (void)name, (void)stack_depth, (void)arg;
+    TEST_ASSERT(priority == tskIDLE_PRIORITY + 1 && !task.fn);
+    task.fn = fn;
+    *handle = &handle_;
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t handle)
+{
+    (void)handle;
+    task.notified++;
+    return pdPASS;
+}
+
+/* The task gives the test back control when it waits with nothing to do */
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    TEST_ASSERT(clear_on_exit && ticks == portMAX_DELAY);
+    if (!task.notified) {
+        longjmp(task.wait, 1);
+    }
+    task.notified = 0;
+    return 1;
+}
+
+/* Lets the node db task run, as it does once the mesh callbacks return */
+static void run_task(void)
+{
+    if (!task.notified) {
+        return;
+    }
+    task.running = true;
+    if (!setjmp(task.wait)) {
+        task.fn(NULL);
+    }
+    task.running = false;
+}
+
+/* The partition, a file mapped in memory; writes only clear bits, erases set
+ * whole sectors. Once the power is cut nothing more reaches it.
+ */
+static struct {
+    esp_partition_t part;
+    bool present;
+    int fd;
+    uint8_t *mem;
+    uint32_t mapped;
+    uint32_t writes, write_bytes, erases, half_erases;
+    uint32_t caller_half_erases;    /* Those not left to the node db task */
+    int32_t ops_left;       /* Writes and sector erases before the cut, < 0 never */
+    bool cut;
+    uint32_t seed;
+} flash;
+
+static void flash_open(void)
+{
+    FILE *f = tmpfile();
+
+    TEST_ASSERT(f);
+    flash.fd = dup(fileno(f));
+    fclose(f);
+    TEST_ASSERT(ftruncate(flash.fd, PARTITION_SIZE) == 0);
+    flash.mem = mmap(NULL, PARTITION_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, flash.fd, 0);
+    TEST_ASSERT(flash.mem != MAP_FAILED);
+    flash.part = (esp_partition_t) {
+        .type = ESP_PARTITION_TYPE_DATA,
+        .subtype = ESP_PARTITION_SUBTYPE_ANY,
+        .address = 0x110000,
+        .size = PARTITION_SIZE,
+        .label = CONFIG_FAST_PROV_NODE_DB_PARTITION,
+    };
+    flash.present = true;
+    flash.ops_left = -1;
+    flash.seed = 25;
+}
+
+/* Never formatted, as left by a factory image */
+static void flash_wipe(void)
+{
+    memset(flash.mem, 0, PARTITION_SIZE);
+}
+
+/* 1 if the operation is done, 0 if the power goes during it, -1 if it is gone */
+static int flash_op(void)
+{
+    if (flash.cut) {
+        return -1;
+    }
+    if (flash.ops_left > 0 && --flash.ops_left == 0) {
+        flash.cut = true;
+        return 0;
+    }
+    return 1;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    if (!flash.present || type != ESP_PARTITION_TYPE_DATA || strcmp(label, flash.part.label)) {
+        return NULL;
+    }
+    TEST_ASSERT(subtype == ESP_PARTITION_SUBTYPE_ANY);
+    return &flash.part;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    const uint8_t *data = src;
+    size_t len = size;
+    int op;
+
+    TEST_ASSERT(partition == &flash.part && dst_offset + size <= PARTITION_SIZE);
+    op = flash_op();
+    if (op < 0) {
+        return ESP_OK;
+    }
+    if (op == 0) {
+        /* Cut short, a prefix of the octets got there */
+        len = host_rand(&flash.seed) % (size + 1);
+    }
+    for (size_t i = 0; i < len; i++) {
+        flash.mem[dst_offset + i] &= data[i];
+    }
+    flash.writes++;
+    flash.write_bytes += size;
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    TEST_ASSERT(partition == &flash.part && offset % SECTOR == 0 && size % SECTOR == 0);
+    TEST_ASSERT(offset + size <= PARTITION_SIZE);
+    flash.half_erases += size == HALF;
+    flash.caller_half_erases += size == HALF && !task.running;
+    for (size_t s = offset; s < offset + size; s += SECTOR) {
+        int op = flash_op();
+
+        if (op < 0) {
+            return ESP_OK;
+        }
+        if (op == 0) {
+            /* An erase cut short leaves the sector in any state */
+            for (size_t i = 0; i < SECTOR; i++) {
+                flash.mem[s + i] = host_rand(&flash.seed);
+            }
+            return ESP_OK;
+        }
+        memset(flash.mem + s, 0xFF, SECTOR);
+        flash.erases++;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+                             spi_flash_mmap_memory_t memory, const void **out_ptr,
+                             spi_flash_mmap_handle_t *out_handle)
+{
+    TEST_ASSERT(partition == &flash.part && offset + size <= PARTITION_SIZE);
+    TEST_ASSERT(memory == SPI_FLASH_MMAP_DATA);
+    *out_ptr = flash.mem + offset;
+    *out_handle = ++flash.mapped;
+    return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle)
+{
+    TEST_ASSERT(handle == flash.mapped);
+    flash.mapped--;
+}
+
+/* What the test expects of each node */
+typedef struct {
+    uint8_t uuid[16];
+    bool stored;
+    uint16_t addr, min, max;
+    bool lack;
+} model_t;
+
+static model_t model[NODES], pending;
+static uint32_t model_cnt, next_addr;
+
+static void make_uuid(uint8_t uuid[16], uint32_t n)
+{
+    memset(uuid, 0xdd, 16);
+    memcpy(uuid + 12, &n, sizeof(n));
+}
+
+static uint16_t alloc_addr(void)
+{
+    next_addr = next_addr % 10000 + 1;
+    return next_addr * 3;
+}
+
+static void reboot(uint16_t *restored)
+{
+    flash.cut = false;
+    flash.ops_left = -1;
+    example_node_index_reset();
+    TEST_ASSERT(example_node_db_init(restored) == ESP_OK && flash.mapped == 0);
+}
+
+static bool node_matches(const example_node_info_t *node, const model_t *m)
+{
+    return node && node->unicast_addr == m->addr && node->element_num == 3 &&
+           node->net_idx == 0 && node->app_idx == 1 && node->onoff == (m->addr & 1) &&
+           node->unicast_min == m->min && node->unicast_max == m->max && node->lack_of_addr == m->lack;
+}
+
+/* Every node stored before the cut is back, the one being stored is back as
+ * it was or as it was going to be
+ */
+static void verify(int32_t in_flight)
+{
+    uint32_t stored = 0;
+
+    for (uint32_t n = 0; n < model_cnt; n++) {
+        model_t *m = &model[n];
+        example_node_info_t *node = example_node_index_find_by_uuid(m->uuid);
+
+        if ((int32_t)n == in_flight) {
+            if (node_matches(node, &pending)) {
+                *m = pending;
+            } else {
+                TEST_ASSERT(m->stored ? node_matches(node, m) : !node);
+            }
+        } else {
+            TEST_ASSERT(m->stored ? node_matches(node, m) : !node);
+        }
+        stored += m->stored;
+    }
+    TEST_ASSERT(example_node_index_count() == stored);
+}
+
+/* Provisions node n, or gives it an address range (r 8) or none (r 9), as the
+ * server logs them
+ */
+static void put(uint32_t n, uint32_t r, uint32_t *seed)
+{
+    example_node_info_t *node;
+    model_t *m = &model[n];
+
+    pending = *m;
+    pending.stored = true;
+
+    if (r < 8 || !m->stored) {
+        pending.addr = alloc_addr();
+        TEST_ASSERT(example_node_index_store(m->uuid, pending.addr, 3, 0, 1, pending.addr & 1) == ESP_OK);
+        node = example_node_index_find_by_uuid(m->uuid);
+        TEST_ASSERT(example_node_db_put_node(node) == ESP_OK);
+    } else {
+        node = example_node_index_find_by_uuid(m->uuid);
+        if (r == 8) {
+            pending.min = node->unicast_min = 0x1000 + host_rand(seed) % 0x1000;
+            pending.max = node->unicast_max = pending.min + 10;
+        } else {
+            pending.lack = node->lack_of_addr = true;
+        }
+        TEST_ASSERT(example_node_db_put_range(node) == ESP_OK);
+    }
+}
+
+static uint32_t new_node(void)
+{
+    uint32_t n = model_cnt++;
+
+    model[n] = (model_t) { .stored = false };
+    make_uuid(model[n].uuid, n);
+    return n;
+}
+
+/* A new node half the time, returns the node or -1 if nothing was done */
+static int32_t step(uint32_t *seed)
+{
+    uint32_t r = host_rand(seed) % 10, n;
+
+    if ((r < 5 && model_cnt < NODES) || !model_cnt) {
+        n = new_node();
+    } else {
+        n = host_rand(seed) % model_cnt;
+        if (!model[n].stored) {
+            return -1;
+        }
+    }
+    put(n, r, seed);
+    return n;
+}
+
+static void model_reset(void)
+{
+    model_cnt = 0;
+    next_addr = 0;
+}
+
+static void test_restore(void)
+{
+    uint32_t seed = 1;
+    uint16_t restored;
+
+    /* Without the partition, nodes are kept in RAM only */
+    flash.present = false;
+    example_node_index_reset();
+    TEST_ASSERT(example_node_db_init(&restored) == ESP_ERR_NOT_FOUND && restored == 0);
+    model_reset();
+    step(&seed);
+    TEST_ASSERT(flash.writes == 0);
+    flash.present = true;
+
+    /* A partition never written is formatted */
+    flash_wipe();
+    model_reset();
+    reboot(&restored);
+    TEST_ASSERT(restored == 0);
+
+    for (int i = 0; i < 3 * NODES / 4; i++) {
+        int32_t n = step(&seed);
+        if (n >= 0) {
+            model[n] = pending;
+        }
+    }
+    reboot(&restored);
+    TEST_ASSERT(restored == model_cnt);
+    verify(-1);
+
+    /* Twice, nothing written in between */
+    reboot(&restored);
+    verify(-1);
+}
+
+/* Re-provisioning the same nodes over and over keeps the log short */
+static void test_compact(void)
+{
+    uint32_t seed = 2, nodes = NODES / 8, updates = 20 * (2 * nodes + DEAD), erases, caller_erases;
+    uint16_t restored;
+
+    flash_wipe();
+    model_reset();
+    reboot(&restored);
+    for (uint32_t i = 0; i < nodes; i++) {
+        uint32_t n = new_node();
+
+        put(n, 0, &seed);
+        model[n] = pending;
+    }
+    run_task();
+    erases = flash.half_erases;
+    caller_erases = flash.caller_half_erases;
+    for (uint32_t i = 0; i < updates; i++) {
+        uint32_t n = host_rand(&seed) % nodes;
+
+        put(n, host_rand(&seed) % 10, &seed);
+        model[n] = pending;
+        run_task();
+    }
+    erases = flash.half_erases - erases;
+    /* Each half was erased by the task before it was written */
+    TEST_ASSERT(flash.caller_half_erases == caller_erases);
+    printf("%u nodes provisioned again or given ranges %u times: %u compactions, "
+           "at most %u records replayed at boot\n", nodes, updates, erases, 2 * nodes + DEAD);
+    /* One compaction every DEAD to 2 * nodes + DEAD records */
+    TEST_ASSERT(erases >= updates / (2 * nodes + DEAD) - 1 && erases <= updates / DEAD);
+    reboot(&restored);
+    TEST_ASSERT(restored == nodes);
+    verify(-1);
+}
+
+/* Nodes which do not fit in a half of a two sector partition: puts fail
+ * without wearing the flash until the database is erased
+ */
+static void test_full(void)
+{
+    example_node_info_t *node;
+    uint32_t n, stored, erases;
+    uint16_t restored;
+    esp_err_t err;
+
+    flash_wipe();
+    model_reset();
+    flash.part.size = 2 * SECTOR;
+    reboot(&restored);
+
+    do {
+        n = new_node();
+        TEST_ASSERT(n < NODES);
+        TEST_ASSERT(example_node_index_store(model[n].uuid, alloc_addr(), 3, 0, 1, 0) == ESP_OK);
+        node = example_node_index_find_by_uuid(model[n].uuid);
+        err = example_node_db_put_node(node);
+        run_task();
+    } while (err == ESP_OK);
+    TEST_ASSERT(err == ESP_ERR_NO_MEM);
+    stored = n;
+
+    erases = flash.erases;
+    for (uint32_t i = 0; i < 10 && model_cnt < NODES; i++) {
+        n = new_node();
+        TEST_ASSERT(example_node_index_store(model[n].uuid, alloc_addr(), 3, 0, 1, 0) == ESP_OK);
+        node = example_node_index_find_by_uuid(model[n].uuid);
+        TEST_ASSERT(example_node_db_put_node(node) == ESP_ERR_NO_MEM);
+        run_task();
+    }
+    TEST_ASSERT(flash.erases == erases);
+
+    /* What was logged before is still there */
+    reboot(&restored);
+    TEST_ASSERT(restored == stored);
+
+    /* Erasing starts over */
+    TEST_ASSERT(example_node_db_erase() == ESP_OK);
+    example_node_index_reset();
+    model_reset();
+    put(new_node(), 0, NULL);
+    run_task();
+    reboot(&restored);
+    TEST_ASSERT(restored == 1);
+
+    flash.part.size = PARTITION_SIZE;
+}
+
+/* The power cut after a random number of flash operations, twice per round */
+static void test_power_cut(void)
+{
+    uint32_t seed = 3;
+    uint16_t restored;
+    int32_t n;
+
+    for (int round = 0; round < 300; round++) {
+        flash_wipe();
+        model_reset();
+        reboot(&restored);
+
+        for (int cut = 0; cut < 2; cut++) {
+            flash.ops_left = 1 + host_rand(&seed) % (2 * NODES);
+            n = -1;
+            while (!flash.cut) {
+                n = step(&seed);
+                if (n >= 0 && !flash.cut) {
+                    model[n] = pending;
+                }
+                if (host_rand(&seed) % 4 == 0) {
+                    run_task();
+                }
+            }
+            reboot(&restored);
+            verify(n);
+        }
+    }
+}
+
+static int64_t node_offset[NODES];
+
+/* A rollout of nodes with their ranges, then the restore at the next boot */
+static void bench(uint32_t nodes)
+{
+    uint32_t seed = nodes, writes, bytes, erases;
+    example_node_info_t copy;
+    uint64_t begin, store_ns, restore_ns, read_ns;
+    uint16_t restored;
+
+    flash_wipe();
+    model_reset();
+    reboot(&restored);
+    writes = flash.writes;
+    bytes = flash.write_bytes;
+    erases = flash.erases;
+
+    begin = host_time_ns();
+    for (uint32_t n = 0; n < nodes; n++) {
+        example_node_info_t *node;
+
+        make_uuid(model[n].uuid, n);
+        TEST_ASSERT(example_node_index_store(model[n].uuid, alloc_addr(), 3, 0, 1, 0) == ESP_OK);
+        node = example_node_index_find_by_uuid(model[n].uuid);
+        TEST_ASSERT(example_node_db_put_node(node) == ESP_OK);
+        node->unicast_min = 0x1000 + n;
+        node->unicast_max = node->unicast_min;
+        TEST_ASSERT(example_node_db_put_range(node) == ESP_OK);
+        node_offset[n] = (int64_t)(host_rand(&seed) % (PARTITION_SIZE / sizeof(copy))) * sizeof(copy);
+    }
+    store_ns = host_time_ns() - begin;
+    writes = flash.writes - writes;
+    bytes = flash.write_bytes - bytes;
+    erases = flash.erases - erases;
+
+    example_node_index_reset();
+    begin = host_time_ns();
+    TEST_ASSERT(example_node_db_init(&restored) == ESP_OK);
+    restore_ns = host_time_ns() - begin;
+    TEST_ASSERT(restored == nodes);
+
+    /* A node per key, as the NVS layout it replaces: a read call each */
+    begin = host_time_ns();
+    for (uint32_t n = 0; n < nodes; n++) {
+        TEST_ASSERT(pread(flash.fd, &copy, sizeof(copy), node_offset[n]) == sizeof(copy));
+    }
+    read_ns = host_time_ns() - begin;
+
+    printf("%4u nodes, %u KB partition: %u flash writes (%u octets a node), %u sector erases, "
+           "%.1f us a node logged; restore %.2f ms, a read call per node %.2f ms\n",
+           nodes, PARTITION_SIZE / 1024, writes, bytes / nodes, erases, store_ns / 1000.0 / nodes,
+           restore_ns / 1e6, read_ns / 1e6);
+}
+
+int main(void)
+{
+    flash_open();
+
+    test_restore();
+    test_compact();
+    test_full();
+    test_power_cut();
+    bench(NODES / 8);
+    bench(NODES);
+    return 0;
+}
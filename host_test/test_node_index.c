@@ -0,0 +1,180 @@
+/* test_node_index.c - Fast Prov node index, and lookups/sec against a linear scan */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "ble_mesh_fast_prov_node_index.h"
+
+#define NODES       CONFIG_BLE_MESH_MAX_PROV_NODES
+#define LOOKUPS     2000000
+
+static uint8_t uuids[NODES][16];
+
+static void make_uuid(uint8_t uuid[16], uint32_t n)
+{
+    /* ESP device UUIDs share their leading bytes */
+    memset(uuid, 0xdd, 16);
+    memcpy(uuid + 12, &n, sizeof(n));
+}
+
+static uint16_t node_addr(uint32_t n)
+{
+    return 0x0005 + n * 3;
+}
+
+static void test_store_find(void)
+{
+    example_node_info_t *node;
+
+    example_node_index_reset();
+    for (uint32_t n = 0; n < NODES; n++) {
+        make_uuid(uuids[n], n);
+        TEST_ASSERT(example_node_index_store(uuids[n], node_addr(n), 3, 0, 1, 0) == ESP_OK);
+    }
+    TEST_ASSERT(example_node_index_count() == NODES);
+
+    for (uint32_t n = 0; n < NODES; n++) {
+        node = example_node_index_find_by_uuid(uuids[n]);
+        TEST_ASSERT(node && node->unicast_addr == node_addr(n) && !node->reprov);
+        TEST_ASSERT(example_node_index_find_by_addr(node_addr(n)) == node);
+        /* Secondary element addresses are not indexed */
+        TEST_ASSERT(example_node_index_find_by_addr(node_addr(n) + 1) == NULL);
+    }
+
+    /* The pool holds BLE_MESH_MAX_PROV_NODES entries */
+    {
+        uint8_t uuid[16];
+
+        make_uuid(uuid, NODES);
+        TEST_ASSERT(example_node_index_store(uuid, 0x7000, 1, 0, 1, 0) != ESP_OK);
+        TEST_ASSERT(example_node_index_count() == NODES);
+    }
+}
+
+static void test_reprovision(void)
+{
+    example_node_info_t *node = example_node_index_find_by_uuid(uuids[0]);
+
+    TEST_ASSERT(example_node_index_store(uuids[0], 0x7FF0, 3, 0, 1, 1) == ESP_OK);
+    TEST_ASSERT(example_node_index_find_by_uuid(uuids[0]) == node);
+    TEST_ASSERT(node->reprov && node->unicast_addr == 0x7FF0 && node->onoff == 1);
+    TEST_ASSERT(example_node_index_find_by_addr(node_addr(0)) == NULL);
+    TEST_ASSERT(example_node_index_find_by_addr(0x7FF0) == node);
+    TEST_ASSERT(example_node_index_count() == NODES);
+
+    TEST_ASSERT(example_node_index_store(uuids[0], node_addr(0), 3, 0, 1, 0) == ESP_OK);
+}
+
+static void test_remove(void)
+{
+    /* Every other node, so backward-shift deletion runs inside clusters */
+    for (uint32_t n = 0; n < NODES; n += 2) {
+        TEST_ASSERT(example_node_index_remove(uuids[n]) == ESP_OK);
+    }
+    TEST_ASSERT(example_node_index_remove(uuids[0]) == ESP_ERR_NOT_FOUND);
+    TEST_ASSERT(example_node_index_count() == NODES / 2);
+
+    for (uint32_t n = 0; n < NODES; n++) {
+        example_node_info_t *node = example_node_index_find_by_uuid(uuids[n]);
+        if (n % 2) {
+            TEST_ASSERT(node && example_node_index_find_by_addr(node_addr(n)) == node);
+        } else {
+            TEST_ASSERT(!node && !example_node_index_find_by_addr(node_addr(n)));
+        }
+    }
+
+    /* The removed entries are reused */
+    for (uint32_t n = 0; n < NODES; n += 2) {
+        TEST_ASSERT(example_node_index_store(uuids[n], node_addr(n), 3, 0, 1, 0) == ESP_OK);
+        TEST_ASSERT(!example_node_index_find_by_uuid(uuids[n])->reprov);
+    }
+    TEST_ASSERT(example_node_index_count() == NODES);
+}
+
+static bool count_node(example_node_info_t *node, void *arg)
+{
+    (void)node;
+    (*(uint32_t *)arg)++;
+    return true;
+}
+
+static void test_foreach(void)
+{
+    uint32_t count = 0;
+
+    example_node_index_foreach(count_node, &count);
+    TEST_ASSERT(count == NODES);
+}
+
+/* What example_is_node_exist() and example_get_node_info() do */
+static example_node_info_t linear_nodes[NODES];
+
+static example_node_info_t *linear_find_by_uuid(const uint8_t uuid[16])
+{
+    for (int i = 0; i < NODES; i++) {
+        if (!memcmp(linear_nodes[i].uuid, uuid, 16)) {
+            return &linear_nodes[i];
+        }
+    }
+    return NULL;
+}
+
+static example_node_info_t *linear_find_by_addr(uint16_t addr)
+{
+    for (int i = 0; i < NODES; i++) {
+        if (addr >= linear_nodes[i].unicast_addr &&
+                addr < linear_nodes[i].unicast_addr + linear_nodes[i].element_num) {
+            return &linear_nodes[i];
+        }
+    }
+    return NULL;
+}
+
+static void bench(void)
+{
+    uint32_t seed = 1, hits = 0, n;
+    uint64_t start, index_ns, linear_ns;
+
+    for (n = 0; n < NODES; n++) {
+        memcpy(linear_nodes[n].uuid, uuids[n], 16);
+        linear_nodes[n].unicast_addr = node_addr(n);
+        linear_nodes[n].element_num = 3;
+    }
+
+    start = host_time_ns();
+    for (int i = 0; i < LOOKUPS; i++) {
+        n = host_rand(&seed) % NODES;
+        hits += example_node_index_find_by_uuid(uuids[n]) != NULL;
+        hits += example_node_index_find_by_addr(node_addr(n)) != NULL;
+    }
+    index_ns = host_time_ns() - start;
+    TEST_ASSERT(hits == 2 * LOOKUPS);
+
+    /* A linear scan of 4096 nodes is slow, a fraction of the lookups is enough */
+    hits = 0;
+    start = host_time_ns();
+    for (int i = 0; i < LOOKUPS / NODES * 64; i++) {
+        n = host_rand(&seed) % NODES;
+        hits += linear_find_by_uuid(uuids[n]) != NULL;
+        hits += linear_find_by_addr(node_addr(n)) != NULL;
+    }
+    linear_ns = host_time_ns() - start;
+    TEST_ASSERT(hits == 2 * (LOOKUPS / NODES * 64));
+
+    printf("%4d nodes: index %.1f M lookups/s, linear scan %.2f M lookups/s\n", NODES,
+           2.0 * LOOKUPS * 1e3 / index_ns, 2.0 * (LOOKUPS / NODES * 64) * 1e3 / linear_ns);
+}
+
+int main(void)
+{
+    test_store_find();
+    test_reprovision();
+    test_remove();
+    test_foreach();
+    bench();
+    return 0;
+}
@@ -0,0 +1,229 @@
+/* test_onoff_tap.c - Button taps merged into OnOff commands: scripted tap
+ * traces, other work woken during the window, and messages sent for a user
+ * hammering the button against a message per tap.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <setjmp.h>
+
+#include "host_test.h"
+#include "host_kernel.h"
+#include "freertos/task.h"
+#include "onoff_tap.h"
+
+#define WINDOW_MS   CONFIG_EXAMPLE_TAP_WINDOW_MS
+
+/* Button taps and other wake ups, in time order */
+typedef struct {
+    uint32_t at_ms;
+    bool tap;
+} tap_event_t;
+
+static tap_event_t trace[40000];
+static uint32_t trace_len, trace_pos;
+
+static uint32_t toggle_ms[40000];
+static uint32_t toggle_cnt;
+static uint32_t wake_ms[40000];
+static uint32_t wake_cnt;
+static bool in_task;
+
+static TaskFunction_t task_fn;
+static void *task_arg;
+static jmp_buf quiet;
+static uint32_t notified;
+
+static void event(uint32_t at_ms, bool tap)
+{
+    TEST_ASSERT(trace_len < sizeof(trace) / sizeof(trace[0]));
+    TEST_ASSERT(!trace_len || trace[trace_len - 1].at_ms <= at_ms);
+    trace[trace_len++] = (tap_event_t) { .at_ms = at_ms, .tap = tap };
+}
+
+static void toggle(void)
+{
+    TEST_ASSERT(in_task && toggle_cnt < sizeof(toggle_ms) / sizeof(toggle_ms[0]));
+    toggle_ms[toggle_cnt++] = k_uptime_get_32();
+}
+
+static void wake(void)
+{
+    TEST_ASSERT(in_task && wake_cnt < sizeof(wake_ms) / sizeof(wake_ms[0]));
+    wake_ms[wake_cnt++] = k_uptime_get_32();
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    static int task;
+
+    (void)name, (void)stack_depth, (void)priority;
+    task_fn = fn;
+    task_arg = arg;
+    *handle = &task;
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    (void)task;
+    notified++;
+    return pdPASS;
+}
+
+/* The button callback and the store timer, which never wait, run within the
+ * tap task
+ */
+static void play_until(uint32_t until_ms)
+{
+    bool task = in_task;
+
+    in_task = false;
+    while (trace_pos < trace_len && trace[trace_pos].at_ms <= until_ms) {
+        host_kernel_advance(trace[trace_pos].at_ms);
+        if (trace[trace_pos].tap) {
+            example_onoff_tap();
+        } else {
+            example_onoff_tap_notify();
+        }
+        trace_pos++;
+    }
+    in_task = task;
+}
+
+/* The tap task runs in ulTaskNotifyTake() and vTaskDelay(), the test gets back
+ * control once the task waits and the trace is over.
+ */
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    uint32_t count;
+
+    TEST_ASSERT(ticks == portMAX_DELAY);
+    while (!notified) {
+        if (trace_pos == trace_len) {
+            longjmp(quiet, 1);
+        }
+        play_until(trace[trace_pos].at_ms);
+    }
+    count = notified;
+    notified = clear_on_exit ? 0 : count - 1;
+    return count;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    uint32_t until_ms = k_uptime_get_32() + ticks;
+
+    play_until(until_ms);
+    host_kernel_advance(until_ms);
+}
+
+static void play(void)
+{
+    in_task = true;
+    if (!setjmp(quiet)) {
+        task_fn(task_arg);
+    }
+    in_task = false;
+    TEST_ASSERT(trace_pos == trace_len);
+    trace_len = trace_pos = 0;
+}
+
+static void test_merge(void)
+{
+    uint32_t t = k_uptime_get_32() + 1000, toggles = toggle_cnt;
+
+    /* One tap, one toggle once the window is over */
+    event(t, true);
+    /* Two taps cancel out, three are one toggle */
+    event(t += 1000, true);
+    event(t + 100, true);
+    event(t += 1000, true);
+    event(t + 100, true);
+    event(t + WINDOW_MS, true);
+    /* A tap after the window is a command of its own */
+    event(t += 1000, true);
+    event(t + WINDOW_MS + 1, true);
+    play();
+
+    TEST_ASSERT(toggle_cnt == toggles + 4);
+    TEST_ASSERT(toggle_ms[toggles] == t - 3000 + WINDOW_MS);
+    TEST_ASSERT(toggle_ms[toggles + 1] == t - 1000 + WINDOW_MS);
+    TEST_ASSERT(toggle_ms[toggles + 2] == t + WINDOW_MS);
+    TEST_ASSERT(toggle_ms[toggles + 3] == t + 2 * WINDOW_MS + 1);
+}
+
+/* Other work is done when the task wakes, a wake up during the window is not lost */
+static void test_wake(void)
+{
+    uint32_t t = k_uptime_get_32() + 1000, wakes = wake_cnt;
+
+    event(t, false);
+    event(t += 1000, true);
+    event(t + WINDOW_MS / 2, false);
+    play();
+
+    TEST_ASSERT(wake_cnt >= wakes + 3);
+    TEST_ASSERT(wake_ms[wakes] == t - 1000 && wake_ms[wakes + 1] == t);
+    /* Right after the window, not at the next tap */
+    TEST_ASSERT(wake_ms[wake_cnt - 1] == t + WINDOW_MS);
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Bursts of 1 to max_taps taps 80 to 250 ms apart, 1 to 5 s between bursts */
+static void bench(uint32_t max_taps)
+{
+    static uint32_t last_tap[20000];
+    uint32_t seed = max_taps, t = k_uptime_get_32() + 1000, taps = 0, bursts = 0;
+    uint32_t toggles = toggle_cnt, lat[20000], lat_cnt = 0;
+
+    for (int b = 0; b < 2000; b++) {
+        uint32_t n = 1 + host_rand(&seed) % max_taps;
+
+        for (uint32_t i = 0; i < n; i++) {
+            event(t, true);
+            last_tap[taps++] = t;
+            t += 80 + host_rand(&seed) % 171;
+        }
+        bursts++;
+        t += 1000 + host_rand(&seed) % 4000;
+    }
+    play();
+
+    /* Whatever got merged, the remote ends where a message per tap would */
+    TEST_ASSERT((toggle_cnt - toggles) % 2 == taps % 2);
+    /* From the last tap before a toggle to the toggle */
+    for (uint32_t i = toggles, j = 0; i < toggle_cnt; i++) {
+        while (j + 1 < taps && last_tap[j + 1] < toggle_ms[i]) {
+            j++;
+        }
+        lat[lat_cnt++] = toggle_ms[i] - last_tap[j];
+    }
+    qsort(lat, lat_cnt, sizeof(uint32_t), cmp_u32);
+    printf("bursts up to %u taps: %u taps in %u bursts, %u messages (a message per tap: %u), "
+           "last tap to message p50 %u ms p99 %u ms\n", max_taps, taps, bursts, toggle_cnt - toggles,
+           taps, lat_cnt ? lat[lat_cnt / 2] : 0, lat_cnt ? lat[(lat_cnt - 1) * 99 / 100] : 0);
+    TEST_ASSERT(toggle_cnt - toggles <= taps);
+    TEST_ASSERT(!lat_cnt || lat[lat_cnt - 1] <= WINDOW_MS);
+}
+
+int main(void)
+{
+    TEST_ASSERT(example_onoff_tap_init(NULL, wake) == ESP_ERR_INVALID_ARG);
+    TEST_ASSERT(example_onoff_tap_init(toggle, wake) == ESP_OK && task_fn);
+
+    test_merge();
+    test_wake();
+    bench(1);
+    bench(3);
+    bench(10);
+    return 0;
+}
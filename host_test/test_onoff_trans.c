@@ -0,0 +1,260 @@
+/* test_onoff_trans.c - Generic OnOff delays, transitions and coalesced status
+ * publication on the virtual clock, and the accounting of the Status messages
+ * the engine hands to the stack.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "host_test.h"
+#include "host_kernel.h"
+#include "freertos/semphr.h"
+#include "esp_ble_mesh_networking_api.h"
+#include "onoff_trans.h"
+
+#define ELEMS       3
+#define WINDOW_MS   CONFIG_EXAMPLE_ONOFF_PUB_WINDOW_MS
+#define JITTER_MS   CONFIG_EXAMPLE_ONOFF_PUB_JITTER_MS
+
+static esp_ble_mesh_gen_onoff_srv_t srv[ELEMS];
+static esp_ble_mesh_model_t models[ELEMS];
+static example_onoff_trans_t trans[ELEMS];
+static uint8_t tid;
+
+static struct {
+    esp_ble_mesh_model_t *model;
+    uint8_t status[3];
+    uint16_t len;
+    uint32_t at_ms;
+    uint32_t count;
+} pub, reply;
+static esp_err_t pub_err;
+
+static uint32_t changes;
+
+static void changed(example_onoff_trans_t *t)
+{
+    /* The LED dispatch table is swapped under the lock the callback runs with */
+    TEST_ASSERT(host_locks_held == 1);
+    TEST_ASSERT(srv[t - trans].state.onoff == t->present);
+    changes++;
+}
+
+esp_err_t esp_ble_mesh_model_publish(esp_ble_mesh_model_t *model, uint32_t opcode,
+                                     uint16_t length, uint8_t *data,
+                                     esp_ble_mesh_dev_role_t device_role)
+{
+    /* May wait for the BTC task, which takes the transition lock */
+    TEST_ASSERT(host_locks_held == 0);
+    TEST_ASSERT(opcode == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_STATUS && device_role == ROLE_NODE);
+    TEST_ASSERT(length <= sizeof(pub.status));
+    pub.model = model;
+    memcpy(pub.status, data, length);
+    pub.len = length;
+    pub.at_ms = k_uptime_get_32();
+    pub.count++;
+    return pub_err;
+}
+
+esp_err_t esp_ble_mesh_server_model_send_msg(esp_ble_mesh_model_t *model, esp_ble_mesh_msg_ctx_t *ctx,
+                                             uint32_t opcode, uint16_t length, uint8_t *data)
+{
+    (void)ctx;
+    TEST_ASSERT(host_locks_held == 0);
+    TEST_ASSERT(opcode == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_STATUS && length <= sizeof(reply.status));
+    reply.model = model;
+    memcpy(reply.status, data, length);
+    reply.len = length;
+    reply.count++;
+    return ESP_OK;
+}
+
+static void advance(uint32_t ms)
+{
+    host_kernel_advance(k_uptime_get_32() + ms);
+}
+
+static esp_err_t set(example_onoff_trans_t *t, uint8_t onoff, uint8_t trans_time, uint8_t delay)
+{
+    esp_ble_mesh_msg_ctx_t ctx = { .addr = 0x0001, .recv_dst = 0xC000 };
+    esp_ble_mesh_server_recv_gen_onoff_set_t msg = {
+        .op_en = trans_time || delay,
+        .onoff = onoff,
+        .tid = ++tid,
+        .trans_time = trans_time,
+        .delay = delay,
+    };
+    esp_err_t err = example_onoff_trans_set(t, &ctx, &msg);
+
+    TEST_ASSERT(host_locks_held == 0);
+    return err;
+}
+
+static void setup(void)
+{
+    TEST_ASSERT(example_onoff_trans_init(changed) == ESP_OK);
+    for (int i = 0; i < ELEMS; i++) {
+        memset(&srv[i], 0, sizeof(srv[i]));
+        models[i].user_data = &srv[i];
+        TEST_ASSERT(example_onoff_trans_bind(&trans[i], &models[i]) == ESP_OK);
+    }
+}
+
+/* Waits for the publication of t, at most one window and its jitter away */
+static void wait_pub(example_onoff_trans_t *t, uint32_t done_ms)
+{
+    uint32_t count = pub.count;
+
+    advance(WINDOW_MS + JITTER_MS + 2 * CONFIG_EXAMPLE_ONOFF_TRANS_TICK_MS);
+    TEST_ASSERT(pub.count == count + 1 && pub.model == t->model);
+    TEST_ASSERT(pub.at_ms - done_ms >= WINDOW_MS);
+    TEST_ASSERT(pub.at_ms - done_ms <= WINDOW_MS + JITTER_MS + CONFIG_EXAMPLE_ONOFF_TRANS_TICK_MS);
+}
+
+static void test_transition(void)
+{
+    example_onoff_trans_t *t = &trans[0];
+    uint32_t start = k_uptime_get_32();
+    uint8_t status[3];
+
+    /* 50 ms of delay, then 500 ms from Off to On */
+    TEST_ASSERT(set(t, 1, 0x05, 10) == ESP_OK);
+    TEST_ASSERT(example_onoff_trans_status(t, status) == 3 && status[0] == 0 && status[1] == 1);
+    host_kernel_advance(start + 40);
+    TEST_ASSERT(t->present == 0);
+    /* Off to On takes effect when the transition starts */
+    host_kernel_advance(start + 50);
+    TEST_ASSERT(t->present == 1 && t->phase == ONOFF_TRANS_RUN && pub.count == 0);
+    TEST_ASSERT(example_onoff_trans_status(t, status) == 3 && status[2] == 0x05);
+    host_kernel_advance(start + 550);
+    TEST_ASSERT(t->phase == ONOFF_TRANS_IDLE);
+    TEST_ASSERT(example_onoff_trans_status(t, status) == 1 && status[0] == 1);
+    wait_pub(t, start + 550);
+    TEST_ASSERT(pub.len == 1 && pub.status[0] == 1);
+
+    /* On to Off takes effect when it ends, a newer message cancels it */
+    start = k_uptime_get_32();
+    TEST_ASSERT(set(t, 0, 0x05, 0) == ESP_OK);
+    host_kernel_advance(start + 300);
+    TEST_ASSERT(t->present == 1);
+    TEST_ASSERT(set(t, 1, 0, 0) == ESP_OK);
+    TEST_ASSERT(t->present == 1 && t->phase == ONOFF_TRANS_IDLE);
+    advance(1000);
+    TEST_ASSERT(t->present == 1 && srv[0].state.onoff == 1);
+}
+
+static void test_tid(void)
+{
+    example_onoff_trans_t *t = &trans[1];
+    esp_ble_mesh_msg_ctx_t ctx = { .addr = 0x0002, .recv_dst = t - trans + 0x0100 };
+    esp_ble_mesh_server_recv_gen_onoff_set_t msg = { .onoff = 1, .tid = 7 };
+
+    TEST_ASSERT(example_onoff_trans_set(t, &ctx, &msg) == ESP_OK);
+    advance(5000);
+    msg.onoff = 0;
+    TEST_ASSERT(example_onoff_trans_set(t, &ctx, &msg) == ESP_ERR_INVALID_STATE);
+    TEST_ASSERT(t->present == 1);
+    advance(1000);
+    TEST_ASSERT(example_onoff_trans_set(t, &ctx, &msg) == ESP_OK);
+    TEST_ASSERT(t->present == 0);
+
+    /* Prohibited Transition Time */
+    msg.tid++;
+    msg.op_en = true;
+    msg.trans_time = 0x3F;
+    TEST_ASSERT(example_onoff_trans_set(t, &ctx, &msg) == ESP_ERR_INVALID_ARG);
+    advance(1000);
+}
+
+/* A burst of group Sets is published once per window, with the final state */
+static void test_coalesce(void)
+{
+    example_onoff_pub_stats_t before, after;
+    example_onoff_trans_t *t = &trans[2];
+    uint32_t count = pub.count, start;
+
+    example_onoff_pub_get_stats(&before);
+    start = k_uptime_get_32();
+    for (int i = 0; i < 20; i++) {
+        TEST_ASSERT(set(t, i % 2, 0, 0) == ESP_OK);
+        advance(5);
+    }
+    wait_pub(t, start);
+    TEST_ASSERT(pub.count == count + 1 && pub.status[0] == 1 && t->present == 1);
+
+    /* Back to the published state within the window: nothing to publish */
+    TEST_ASSERT(set(t, 0, 0, 0) == ESP_OK);
+    TEST_ASSERT(set(t, 1, 0, 0) == ESP_OK);
+    advance(WINDOW_MS + JITTER_MS + 2 * CONFIG_EXAMPLE_ONOFF_TRANS_TICK_MS);
+    TEST_ASSERT(pub.count == count + 1);
+
+    example_onoff_pub_get_stats(&after);
+    TEST_ASSERT(after.coalesced - before.coalesced == 19 + 1);
+    TEST_ASSERT(after.suppressed - before.suppressed == 1);
+}
+
+/* Only the Status messages of the engine are counted until their completion */
+static void test_pending(void)
+{
+    example_onoff_pub_stats_t stats, base;
+    esp_ble_mesh_msg_ctx_t ctx = { .addr = 0x0001, .recv_dst = 0x0100 };
+    example_onoff_trans_t *t = &trans[0];
+
+    /* Every publication so far is waiting for its completion */
+    example_onoff_pub_get_stats(&base);
+    TEST_ASSERT(base.status_pending == base.published && base.status_pending_max == base.published);
+    for (int i = 0; i < ELEMS; i++) {
+        while (trans[i].pub_pending) {
+            example_onoff_trans_msg_comp(&trans[i], true, 0);
+        }
+    }
+    example_onoff_pub_get_stats(&base);
+    TEST_ASSERT(base.status_pending == 0);
+
+    /* Completions of messages sent by someone else */
+    example_onoff_trans_msg_comp(t, true, -ENOBUFS);
+    example_onoff_trans_msg_comp(t, false, -ENOBUFS);
+    example_onoff_trans_msg_comp(NULL, true, -ENOBUFS);
+    example_onoff_pub_get_stats(&stats);
+    TEST_ASSERT(stats.status_pending == 0 && stats.no_buf == base.no_buf);
+
+    TEST_ASSERT(example_onoff_trans_reply(t, &ctx) == ESP_OK);
+    TEST_ASSERT(reply.len == 1 && reply.status[0] == t->present);
+    TEST_ASSERT(set(t, !t->present, 0, 0) == ESP_OK);
+    advance(WINDOW_MS + JITTER_MS + 2 * CONFIG_EXAMPLE_ONOFF_TRANS_TICK_MS);
+    example_onoff_pub_get_stats(&stats);
+    TEST_ASSERT(stats.status_pending == 2 && t->reply_pending == 1 && t->pub_pending == 1);
+
+    /* The publication completes first, the reply without a buffer */
+    example_onoff_trans_msg_comp(t, true, 0);
+    example_onoff_trans_msg_comp(t, true, 0);
+    example_onoff_trans_msg_comp(t, false, -ENOBUFS);
+    example_onoff_pub_get_stats(&stats);
+    TEST_ASSERT(stats.status_pending == 0 && stats.no_buf == base.no_buf + 1);
+    TEST_ASSERT(stats.replied == base.replied + 1 && stats.published == base.published + 1);
+
+    /* A publication the stack refused is not pending, nor published */
+    pub_err = ESP_ERR_NO_MEM;
+    TEST_ASSERT(set(t, !t->present, 0, 0) == ESP_OK);
+    advance(WINDOW_MS + JITTER_MS + 2 * CONFIG_EXAMPLE_ONOFF_TRANS_TICK_MS);
+    pub_err = ESP_OK;
+    example_onoff_pub_get_stats(&stats);
+    TEST_ASSERT(stats.status_pending == 0 && stats.published == base.published + 1);
+    TEST_ASSERT(t->pub_onoff != t->present);
+}
+
+int main(void)
+{
+    host_kernel_advance(1000);
+    setup();
+    test_transition();
+    test_tid();
+    test_coalesce();
+    test_pending();
+    TEST_ASSERT(changes > 0 && host_locks_held == 0);
+    return 0;
+}
@@ -0,0 +1,378 @@
+/* test_onoff_txn.c - Acknowledged Generic OnOff Set over a lossy stand-in
+ * transport: retransmission with the same TID, the backoff and the attempt
+ * cap, the newest Set replacing a waiting one, and delivery and latency at
+ * several loss rates.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "host_test.h"
+#include "host_kernel.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_ble_mesh_generic_model_api.h"
+#include "onoff_txn.h"
+
+#define SERVERS         (CONFIG_EXAMPLE_TXN_MAX + 2)
+#define ADDR(i)         ((uint16_t)(0x0101 + (i)))
+#define GROUP           0xC000
+#define TIMEOUT_MS      CONFIG_EXAMPLE_TXN_TIMEOUT_MS
+#define ATTEMPTS        CONFIG_EXAMPLE_TXN_MAX_ATTEMPTS
+
+/* The link to a server, the client timer of the stack and the server itself */
+typedef struct {
+    struct k_delayed_work deliver;  /* The Set on its way to the server */
+    struct k_delayed_work status;   /* The Status on its way back */
+    struct k_delayed_work timeout;
+    bool busy;                      /* The stack waits for a Status */
+    uint8_t tid;                    /* Last Set sent */
+    uint8_t onoff;
+    int32_t timeout_ms;
+    uint32_t sent;
+    uint32_t rtt_ms;
+    bool status_lost;
+    /* Server */
+    uint8_t state;
+    uint8_t last_tid;
+    bool seen;
+    uint32_t applied;               /* Sets with a new TID */
+} link_t;
+
+static link_t links[SERVERS];
+static esp_ble_mesh_model_t model;
+static uint8_t tid_next;
+static bool in_callback;            /* Running a Status or timeout event */
+static uint32_t seed = 5;
+
+static struct {
+    uint32_t set_loss_pct;
+    uint32_t status_loss_pct;
+    uint32_t drop_status;           /* Statuses lost before the loss rate applies */
+    uint32_t rtt_min_ms;
+    uint32_t rtt_max_ms;
+} net;
+
+static uint32_t unack_sent;
+static uint32_t retransmitted;
+
+static example_onoff_txn_result_t result;
+static uint32_t results;
+static uint32_t *latency;           /* Of the acknowledged Sets, when set */
+static uint32_t latency_cnt;
+
+static link_t *link_of(uint16_t addr)
+{
+    for (int i = 0; i < SERVERS; i++) {
+        if (ADDR(i) == addr) {
+            return &links[i];
+        }
+    }
+    return NULL;
+}
+
+static uint8_t tid_take(void)
+{
+    /* May write to flash: not from the mesh callbacks, nor with the lock held */
+    TEST_ASSERT(host_locks_held == 0 && !in_callback);
+    return tid_next++;
+}
+
+esp_err_t esp_ble_mesh_generic_client_set_state(esp_ble_mesh_client_common_param_t *params,
+                                                esp_ble_mesh_generic_client_set_state_t *set_state)
+{
+    link_t *l;
+    uint32_t rtt;
+
+    /* Posts to the BTC task, whose events take the transaction lock */
+    TEST_ASSERT(host_locks_held == 0);
+    TEST_ASSERT(params->model == &model && params->msg_role == ROLE_NODE);
+    if (params->opcode == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET_UNACK) {
+        TEST_ASSERT(!ESP_BLE_MESH_ADDR_IS_UNICAST(params->ctx.addr) && params->msg_timeout == 0);
+        unack_sent++;
+        return ESP_OK;
+    }
+
+    TEST_ASSERT(params->opcode == ESP_BLE_MESH_MODEL_OP_GEN_ONOFF_SET);
+    l = link_of(params->ctx.addr);
+    /* The stack refuses a second Set to a server it waits for */
+    TEST_ASSERT(l && !l->busy);
+    if (l->sent && set_state->onoff_set.tid == l->tid) {
+        /* A retransmission is the same message */
+        TEST_ASSERT(set_state->onoff_set.onoff == l->onoff);
+        retransmitted++;
+    }
+    l->busy = true;
+    l->tid = set_state->onoff_set.tid;
+    l->onoff = set_state->onoff_set.onoff;
+    l->timeout_ms = params->msg_timeout;
+    l->sent++;
+    k_delayed_work_submit(&l->timeout, params->msg_timeout);
+
+    if (host_rand(&seed) % 100 < net.set_loss_pct) {
+        return ESP_OK;
+    }
+    /* Half of the round trip each way, the Status lost at random */
+    rtt = net.rtt_min_ms + host_rand(&seed) % (net.rtt_max_ms - net.rtt_min_ms + 1);
+    l->rtt_ms = rtt;
+    l->status_lost = host_rand(&seed) % 100 < net.status_loss_pct;
+    if (net.drop_status) {
+        net.drop_status--;
+        l->status_lost = true;
+    }
+    k_delayed_work_submit(&l->deliver, rtt / 2);
+    return ESP_OK;
+}
+
+static void set_arrived(struct k_work *work)
+{
+    link_t *l = (link_t *)((char *)work - offsetof(link_t, deliver));
+
+    /* The server takes a TID once, and answers every copy */
+    if (!l->seen || l->last_tid != l->tid) {
+        l->state = l->onoff;
+        l->last_tid = l->tid;
+        l->seen = true;
+        l->applied++;
+    }
+    if (!l->status_lost) {
+        k_delayed_work_submit(&l->status, l->rtt_ms - l->rtt_ms / 2);
+    }
+}
+
+static void status_arrived(struct k_work *work)
+{
+    link_t *l = (link_t *)((char *)work - offsetof(link_t, status));
+
+    k_delayed_work_cancel(&l->timeout);
+    l->busy = false;
+    in_callback = true;
+    example_onoff_txn_status(ADDR(l - links));
+    in_callback = false;
+}
+
+static void timed_out(struct k_work *work)
+{
+    link_t *l = (link_t *)((char *)work - offsetof(link_t, timeout));
+
+    l->busy = false;
+    in_callback = true;
+    example_onoff_txn_timeout(ADDR(l - links));
+    in_callback = false;
+}
+
+static void done(const example_onoff_txn_result_t *r)
+{
+    /* From the mesh callback, with the transaction lock released */
+    TEST_ASSERT(host_locks_held == 0);
+    TEST_ASSERT(r->attempts >= 1 && r->attempts <= ATTEMPTS);
+    if (r->err == ESP_OK) {
+        /* Acknowledged means the server has it */
+        TEST_ASSERT(link_of(r->dst)->state == r->onoff);
+        TEST_ASSERT(r->rtt_ms <= r->latency_ms);
+        if (latency) {
+            latency[latency_cnt++] = r->latency_ms;
+        }
+    } else {
+        TEST_ASSERT(r->err == ESP_ERR_TIMEOUT);
+    }
+    result = *r;
+    results++;
+}
+
+static void settle(void)
+{
+    uint32_t due;
+
+    while (host_kernel_next(&due)) {
+        host_kernel_advance(due);
+    }
+}
+
+static void reset(void)
+{
+    settle();
+    memset(&net, 0, sizeof(net));
+    net.rtt_min_ms = net.rtt_max_ms = 40;
+    for (int i = 0; i < SERVERS; i++) {
+        links[i].sent = 0;
+        links[i].applied = 0;
+    }
+    results = 0;
+}
+
+/* Every Set lost: the same message ATTEMPTS times, each timeout doubled plus
+ * up to a quarter of it
+ */
+static void test_backoff(void)
+{
+    link_t *l = &links[0];
+    uint8_t tid = tid_next;
+    uint32_t start = k_uptime_get_32(), total = 0;
+
+    reset();
+    net.set_loss_pct = 100;
+    TEST_ASSERT(example_onoff_txn_set(0, 0, ADDR(0), 1) == ESP_OK);
+    for (uint32_t attempt = 0; attempt < ATTEMPTS; attempt++) {
+        int32_t base = TIMEOUT_MS << attempt;
+
+        TEST_ASSERT(l->sent == attempt + 1 && l->tid == tid && l->onoff == 1);
+        TEST_ASSERT(l->timeout_ms >= base && l->timeout_ms <= base + base / 4);
+        total += l->timeout_ms;
+        host_kernel_advance(start + total);
+    }
+    TEST_ASSERT(results == 1 && result.err == ESP_ERR_TIMEOUT && result.attempts == ATTEMPTS);
+    TEST_ASSERT(result.latency_ms == total && l->sent == ATTEMPTS && tid_next == tid + 1);
+    TEST_ASSERT(!host_kernel_next(&start));
+}
+
+/* The Status lost once: the server takes the copy as the same Set */
+static void test_status_lost(void)
+{
+    link_t *l = &links[1];
+
+    reset();
+    net.drop_status = 1;
+    TEST_ASSERT(example_onoff_txn_set(0, 0, ADDR(1), 1) == ESP_OK);
+    settle();
+    TEST_ASSERT(results == 1 && result.err == ESP_OK && result.attempts == 2);
+    TEST_ASSERT(result.rtt_ms == 40 && result.latency_ms >= TIMEOUT_MS + 40 && result.latency_ms <= TIMEOUT_MS * 5 / 4 + 40);
+    TEST_ASSERT(l->sent == 2 && l->applied == 1 && l->state == 1);
+}
+
+/* Sets while one is in flight: only the newest is sent after it */
+static void test_newest(void)
+{
+    link_t *l = &links[2];
+    uint8_t tid;
+
+    reset();
+    TEST_ASSERT(example_onoff_txn_set(0, 0, ADDR(2), 1) == ESP_OK);
+    tid = l->tid;
+    TEST_ASSERT(example_onoff_txn_set(0, 0, ADDR(2), 0) == ESP_OK);
+    TEST_ASSERT(example_onoff_txn_set(0, 0, ADDR(2), 1) == ESP_OK);
+    TEST_ASSERT(example_onoff_txn_set(0, 0, ADDR(2), 0) == ESP_OK);
+    TEST_ASSERT(l->sent == 1);
+    settle();
+    TEST_ASSERT(results == 2 && result.err == ESP_OK && result.onoff == 0);
+    /* Each waiting Set took its TID when it was made */
+    TEST_ASSERT(l->sent == 2 && l->applied == 2 && l->tid == (uint8_t)(tid + 3) && l->state == 0);
+
+    /* A newer Set waiting makes a lost one stale, it is not retransmitted */
+    reset();
+    net.set_loss_pct = 100;
+    TEST_ASSERT(example_onoff_txn_set(0, 0, ADDR(2), 1) == ESP_OK);
+    TEST_ASSERT(example_onoff_txn_set(0, 0, ADDR(2), 1) == ESP_OK);
+    host_kernel_advance(k_uptime_get_32() + l->timeout_ms);
+    TEST_ASSERT(results == 1 && result.err == ESP_ERR_TIMEOUT && result.attempts == 1 && l->sent == 2);
+    net.set_loss_pct = 0;
+    settle();
+    TEST_ASSERT(results == 2 && result.err == ESP_OK && l->state == 1);
+}
+
+/* One transaction per destination, a group gets a single unacknowledged Set */
+static void test_table(void)
+{
+    uint32_t due;
+
+    reset();
+    net.set_loss_pct = 100;
+    for (int i = 0; i < CONFIG_EXAMPLE_TXN_MAX; i++) {
+        TEST_ASSERT(example_onoff_txn_set(0, 0, ADDR(i), 1) == ESP_OK);
+    }
+    TEST_ASSERT(example_onoff_txn_set(0, 0, ADDR(CONFIG_EXAMPLE_TXN_MAX), 1) == ESP_ERR_NO_MEM);
+    /* A Status of a server nobody waits for is ignored */
+    example_onoff_txn_status(ADDR(CONFIG_EXAMPLE_TXN_MAX + 1));
+    TEST_ASSERT(results == 0);
+    settle();
+    TEST_ASSERT(results == CONFIG_EXAMPLE_TXN_MAX);
+    TEST_ASSERT(example_onoff_txn_set(0, 0, ADDR(CONFIG_EXAMPLE_TXN_MAX), 1) == ESP_OK);
+    settle();
+
+    unack_sent = 0;
+    TEST_ASSERT(example_onoff_txn_set(0, 0, GROUP, 1) == ESP_OK && unack_sent == 1);
+    TEST_ASSERT(!host_kernel_next(&due));
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Four servers toggled every 2 to 4 s for an hour, the same loss rate on
+ * Sets and Statuses
+ */
+static void bench(uint32_t loss_pct)
+{
+    static uint32_t lat[8000];
+    uint32_t next_ms[4], now = k_uptime_get_32(), end = now + 3600 * 1000;
+    uint32_t cmds = 0, sent = 0, acked, wrong = 0;
+    uint8_t want[4];
+
+    reset();
+    net.set_loss_pct = net.status_loss_pct = loss_pct;
+    net.rtt_min_ms = 20;
+    net.rtt_max_ms = 120;
+    latency = lat;
+    latency_cnt = 0;
+    retransmitted = 0;
+    for (int i = 0; i < 4; i++) {
+        next_ms[i] = now + host_rand(&seed) % 2000;
+        want[i] = !links[i].state;
+    }
+
+    while (now < end) {
+        int first = 0;
+
+        for (int i = 1; i < 4; i++) {
+            first = (int32_t)(next_ms[i] - next_ms[first]) < 0 ? i : first;
+        }
+        now = next_ms[first];
+        host_kernel_advance(now);
+        TEST_ASSERT(example_onoff_txn_set(0, 0, ADDR(first), want[first]) == ESP_OK);
+        want[first] = !want[first];
+        next_ms[first] = now + 2000 + host_rand(&seed) % 2000;
+        cmds++;
+    }
+    settle();
+    acked = latency_cnt;
+    latency = NULL;
+
+    for (int i = 0; i < 4; i++) {
+        sent += links[i].sent;
+        /* The last Set commanded is the state, unless it was never acknowledged */
+        wrong += links[i].state != !want[i];
+    }
+    qsort(lat, acked, sizeof(uint32_t), cmp_u32);
+    printf("%u%% loss: %u Sets, %u acknowledged, %u timed out, %.2f transmissions per Set "
+           "(%u retransmissions), latency p50 %u ms p99 %u ms, %u of 4 servers off the last Set\n",
+           loss_pct, cmds, acked, results - acked, (double)sent / results, retransmitted,
+           acked ? lat[acked / 2] : 0, acked ? lat[(acked - 1) * 99 / 100] : 0, wrong);
+    /* Retransmissions are capped, and a lossless link needs none */
+    TEST_ASSERT(results <= cmds && sent <= results * ATTEMPTS);
+    TEST_ASSERT(loss_pct || (acked == cmds && retransmitted == 0 && wrong == 0));
+}
+
+int main(void)
+{
+    for (int i = 0; i < SERVERS; i++) {
+        k_delayed_work_init(&links[i].deliver, set_arrived);
+        k_delayed_work_init(&links[i].status, status_arrived);
+        k_delayed_work_init(&links[i].timeout, timed_out);
+    }
+    TEST_ASSERT(example_onoff_txn_init(&model, tid_take, done) == ESP_OK);
+
+    test_backoff();
+    test_status_lost();
+    test_newest();
+    test_table();
+    bench(0);
+    bench(10);
+    bench(30);
+    bench(50);
+    return 0;
+}
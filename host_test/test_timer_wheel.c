@@ -0,0 +1,215 @@
+/* test_timer_wheel.c - Timer wheel against a list of deadlines, driven by a
+ * virtual clock the way onoff_trans.c drives it from esp_timer, and the cost
+ * of hundreds of pending transitions.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "host_test.h"
+#include "timer_wheel.h"
+
+#define TIMERS      512
+#define STEPS       200000
+#define MAX_TICKS   (3 * TIMER_WHEEL_SLOTS)
+
+static struct timer_wheel wheel;
+static struct timer_wheel_timer timers[TIMERS];
+static uint32_t due[TIMERS];        /* Expected expiry tick, when armed */
+static bool armed[TIMERS];
+static uint32_t fired, late;
+static bool exact;                  /* Every advance stops at the next slot */
+static uint32_t seed = 3;
+
+static void handler(struct timer_wheel_timer *timer)
+{
+    uint32_t i = timer - timers;
+
+    TEST_ASSERT(i < TIMERS && armed[i]);
+    TEST_ASSERT(!timer_wheel_is_pending(timer));
+    TEST_ASSERT((int32_t)(wheel.now - due[i]) >= 0);
+    if (exact) {
+        TEST_ASSERT(wheel.now == due[i]);
+    }
+    late += wheel.now != due[i];
+    armed[i] = false;
+    fired++;
+
+    /* Like pub_timeout() and trans_timeout(), a handler may start timers */
+    if (host_rand(&seed) % 4 == 0) {
+        uint32_t j = host_rand(&seed) % TIMERS, ticks = host_rand(&seed) % MAX_TICKS;
+
+        timer_wheel_add(&wheel, &timers[j], ticks);
+        due[j] = wheel.now + (ticks ? ticks : 1);
+        armed[j] = true;
+    }
+}
+
+static void reset(void)
+{
+    timer_wheel_init(&wheel);
+    /* Start close to the wrap of the tick counter */
+    wheel.now = UINT32_MAX - 1000;
+    for (uint32_t i = 0; i < TIMERS; i++) {
+        timer_wheel_timer_init(&timers[i], handler);
+        armed[i] = false;
+    }
+    fired = late = 0;
+}
+
+static void check(void)
+{
+    uint32_t pending = 0, first = 0, slot = 0;
+
+    for (uint32_t i = 0; i < TIMERS; i++) {
+        TEST_ASSERT(timer_wheel_is_pending(&timers[i]) == armed[i]);
+        if (armed[i]) {
+            TEST_ASSERT((int32_t)(due[i] - wheel.now) > 0);
+            if (!pending++ || due[i] - wheel.now < first) {
+                first = due[i] - wheel.now;
+            }
+            /* Distance to the slot of the timer */
+            if (pending == 1 || ((due[i] - wheel.now - 1) % TIMER_WHEEL_SLOTS) + 1 < slot) {
+                slot = ((due[i] - wheel.now - 1) % TIMER_WHEEL_SLOTS) + 1;
+            }
+        }
+    }
+    TEST_ASSERT(wheel.pending == pending);
+
+    /* The nearest non-empty slot, a lower bound of the earliest deadline */
+    TEST_ASSERT(timer_wheel_next(&wheel) == slot);
+    TEST_ASSERT(slot <= first);
+}
+
+static void random_op(void)
+{
+    uint32_t i = host_rand(&seed) % TIMERS, ticks;
+
+    if (host_rand(&seed) % 3) {
+        ticks = host_rand(&seed) % MAX_TICKS;
+        timer_wheel_add(&wheel, &timers[i], ticks);
+        due[i] = wheel.now + (ticks ? ticks : 1);
+        armed[i] = true;
+    } else {
+        timer_wheel_cancel(&wheel, &timers[i]);
+        armed[i] = false;
+    }
+}
+
+/* Random steps, some longer than a revolution: timers may fire late but never
+ * early, and none is lost.
+ */
+static void test_random(void)
+{
+    reset();
+    exact = false;
+
+    for (uint32_t step = 0; step < STEPS; step++) {
+        random_op();
+        if (host_rand(&seed) % 4 == 0) {
+            uint32_t ticks = host_rand(&seed) % 16 ? host_rand(&seed) % 32 : host_rand(&seed) % (2 * MAX_TICKS);
+
+            timer_wheel_advance(&wheel, ticks);
+        }
+        check();
+    }
+    printf("random steps: %u fired, %u late after jumps\n", fired, late);
+}
+
+/* The clock of onoff_trans.c: sleep until timer_wheel_next(), advance by what
+ * has elapsed. Every timer fires on its own tick.
+ */
+static void test_virtual_clock(void)
+{
+    uint32_t wakeups = 0, empty = 0;
+
+    reset();
+    exact = true;
+
+    for (uint32_t step = 0; step < STEPS; step++) {
+        uint32_t next, before;
+
+        random_op();
+        if (host_rand(&seed) % 2) {
+            continue;
+        }
+        next = timer_wheel_next(&wheel);
+        if (!next) {
+            continue;
+        }
+        /* Woken up early at times, by a new message */
+        if (host_rand(&seed) % 8 == 0) {
+            next = 1 + host_rand(&seed) % next;
+        }
+        before = fired;
+        timer_wheel_advance(&wheel, next);
+        wakeups++;
+        empty += fired == before;
+        check();
+    }
+    TEST_ASSERT(late == 0);
+    printf("virtual clock: %u fired in %u wakeups, %u without expiry\n", fired, wakeups, empty);
+}
+
+static void test_self_rearm(void)
+{
+    reset();
+    exact = true;
+
+    /* Due in the slot being expired, but a revolution later */
+    timer_wheel_add(&wheel, &timers[0], TIMER_WHEEL_SLOTS);
+    due[0] = wheel.now + TIMER_WHEEL_SLOTS;
+    armed[0] = true;
+    timer_wheel_add(&wheel, &timers[1], 2 * TIMER_WHEEL_SLOTS);
+    due[1] = wheel.now + 2 * TIMER_WHEEL_SLOTS;
+    armed[1] = true;
+    TEST_ASSERT(timer_wheel_next(&wheel) == TIMER_WHEEL_SLOTS);
+
+    timer_wheel_advance(&wheel, TIMER_WHEEL_SLOTS);
+    TEST_ASSERT(fired == 1 && !armed[0] && armed[1]);
+    check();
+    timer_wheel_advance(&wheel, TIMER_WHEEL_SLOTS);
+    TEST_ASSERT(!armed[1]);
+    check();
+}
+
+/* Hundreds of pending delays and transitions on one wheel */
+static void bench(void)
+{
+    uint64_t begin, ns;
+    uint32_t ops = 0;
+
+    reset();
+    exact = false;
+    for (uint32_t i = 0; i < TIMERS; i++) {
+        timer_wheel_add(&wheel, &timers[i], 1 + host_rand(&seed) % MAX_TICKS);
+        due[i] = timers[i].expire;
+        armed[i] = true;
+    }
+
+    begin = host_time_ns();
+    for (uint32_t step = 0; step < STEPS; step++) {
+        uint32_t i = host_rand(&seed) % TIMERS;
+
+        /* A newer TID restarts the transition */
+        timer_wheel_add(&wheel, &timers[i], 1 + host_rand(&seed) % MAX_TICKS);
+        due[i] = timers[i].expire;
+        armed[i] = true;
+        timer_wheel_advance(&wheel, timer_wheel_next(&wheel));
+        ops += 2;
+    }
+    ns = host_time_ns() - begin;
+    printf("%d pending timers: %.0f ns per add/next+advance, %u fired\n", TIMERS, (double)ns / ops, fired);
+}
+
+int main(void)
+{
+    test_self_rearm();
+    test_random();
+    test_virtual_clock();
+    bench();
+    return 0;
+}